@@ -0,0 +1,153 @@
+# -*- coding: UTF-8 -*-
+
+#
+# fcd_backend_bench.py
+# Copyright (C) 2015 Félix Cloutier.
+# All Rights Reserved.
+#
+# This file is part of fcd.
+#
+# fcd is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# fcd is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+#
+# Times the back end alone (loop and switch normalization, AST structuring,
+# AST passes and printing) over a corpus of optimized modules, which fcd saves
+# with -n -n -n. Each module is loaded once with -m -m -m and goes through the back
+# end --runs times; the script reports the time of each run, the functions that
+# took the longest to structure and how much arena memory the AST needed.
+# Results are written as JSON; when a baseline (the output of a previous run) is
+# given, the script exits with status 1 if the back end got slower than the
+# baseline allows.
+#
+# Works with Python 2.7 and Python 3.
+#
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+# Differences below this are noise, no matter what the percentage says.
+MIN_SECONDS_DELTA = 0.05
+
+ALLOCATOR_COMPONENT = "fcd-allocator"
+
+def run_fcd(fcd, fcd_args, module, runs, functions):
+	handle, stats_path = tempfile.mkstemp(prefix = "fcd-backend-bench", suffix = ".json")
+	os.close(handle)
+	try:
+		command = [fcd, "-m", "-m", "-m", "--backend-runs=%d" % runs, "--time-phases=" + stats_path, "--time-functions=%d" % functions] + fcd_args + [module]
+		with open(os.devnull, "w") as devnull:
+			status = subprocess.call(command, stdout = devnull)
+		if status != 0:
+			return None
+
+		with open(stats_path) as stats_file:
+			return json.load(stats_file)
+	finally:
+		os.remove(stats_path)
+
+def summarize(stats, runs):
+	# Every run is its own "backend" phase. Per-function times and statistics add up over every run, so they are
+	# divided back to the cost of one run.
+	run_seconds = [phase["seconds"] for phase in stats["phases"] if phase["name"] == "backend"]
+	functions = []
+	for function in stats.get("functions", []):
+		seconds = sum(phase["seconds"] for phase in function["phases"] if phase["name"] == "backend")
+		functions.append({
+			"name": function["name"],
+			"address": function["address"],
+			"seconds": seconds / runs,
+			"instructions": function["instructions"],
+		})
+	functions.sort(key = lambda function: -function["seconds"])
+
+	allocator = {}
+	for statistic in stats.get("statistics", []):
+		if statistic["component"] == ALLOCATOR_COMPONENT:
+			allocator[statistic["description"]] = statistic["value"] // runs
+
+	return {
+		"runs": run_seconds,
+		"seconds": min(run_seconds) if len(run_seconds) > 0 else 0,
+		"peak_rss_bytes": stats["peak_rss_bytes"],
+		"functions": functions,
+		"allocator": allocator,
+	}
+
+def compare(name, current, baseline, threshold):
+	if current["seconds"] - baseline["seconds"] > max(baseline["seconds"] * threshold / 100.0, MIN_SECONDS_DELTA):
+		return ["%s: %.3fs -> %.3fs" % (name, baseline["seconds"], current["seconds"])]
+	return []
+
+def print_results(name, results):
+	print("%s: best of %d runs %.3fs, %.1f MiB" % (name, len(results["runs"]), results["seconds"], results["peak_rss_bytes"] / (1024.0 * 1024.0)))
+	print("\truns: " + " ".join("%.3fs" % seconds for seconds in results["runs"]))
+	for description in sorted(results["allocator"]):
+		print("\t%-60s %9d" % (description, results["allocator"][description]))
+	for function in results["functions"]:
+		print("\t%-40s %#12x %9.3fs %9d instructions" % (function["name"], function["address"], function["seconds"], function["instructions"]))
+
+def main():
+	parser = argparse.ArgumentParser(description = "Benchmark fcd's back end over a corpus of optimized modules.")
+	parser.add_argument("--fcd", required = True, help = "path to the fcd executable")
+	parser.add_argument("--fcd-args", default = "", help = "additional whitespace-separated arguments for fcd")
+	parser.add_argument("--runs", type = int, default = 5, help = "number of times the back end runs over each module (default 5)")
+	parser.add_argument("--functions", type = int, default = 10, help = "number of slowest functions reported per module (default 10)")
+	parser.add_argument("--output", help = "write results as JSON to this file")
+	parser.add_argument("--baseline", default = "", help = "results of a previous run to compare against")
+	parser.add_argument("--threshold", type = float, default = 10, help = "percentage by which the best run can get slower (default 10)")
+	parser.add_argument("modules", nargs = "+")
+	args = parser.parse_args()
+
+	fcd_args = args.fcd_args.split()
+	runs = max(args.runs, 1)
+	results = {}
+	failed = False
+	for module in args.modules:
+		if not os.path.isfile(module):
+			print("skipping %s: no such file" % module, file = sys.stderr)
+			continue
+
+		stats = run_fcd(args.fcd, fcd_args, module, runs, max(args.functions, 0))
+		if stats is None:
+			print("fcd failed on %s" % module, file = sys.stderr)
+			failed = True
+			continue
+		results[module] = summarize(stats, runs)
+		print_results(module, results[module])
+
+	if args.output:
+		with open(args.output, "w") as output:
+			json.dump(results, output, indent = 1, sort_keys = True)
+
+	regressions = []
+	if args.baseline:
+		with open(args.baseline) as baseline_file:
+			baseline = json.load(baseline_file)
+		for module in sorted(results):
+			if module in baseline:
+				regressions += compare(module, results[module], baseline[module], args.threshold)
+
+	for regression in regressions:
+		print("regression: " + regression, file = sys.stderr)
+	return 1 if failed or len(regressions) > 0 else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
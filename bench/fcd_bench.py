@@ -0,0 +1,160 @@
+# -*- coding: UTF-8 -*-
+
+#
+# fcd_bench.py
+# Copyright (C) 2015 Félix Cloutier.
+# All Rights Reserved.
+#
+# This file is part of fcd.
+#
+# fcd is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# fcd is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+#
+# Decompiles every executable of a corpus with --time-phases and collects the
+# time, peak memory and IR instruction count of each phase. Results are written
+# as JSON; when a baseline (the output of a previous run) is given, the script
+# exits with status 1 if any executable took more time or memory than the
+# baseline allows.
+#
+# Works with Python 2.7 and Python 3.
+#
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+# Differences below these are noise, no matter what the percentage says.
+MIN_SECONDS_DELTA = 0.05
+MIN_BYTES_DELTA = 4 * 1024 * 1024
+
+def run_fcd(fcd, fcd_args, executable):
+	handle, stats_path = tempfile.mkstemp(prefix = "fcd-bench", suffix = ".json")
+	os.close(handle)
+	try:
+		command = [fcd, "--time-phases=" + stats_path] + fcd_args + [executable]
+		with open(os.devnull, "w") as devnull:
+			status = subprocess.call(command, stdout = devnull)
+		if status != 0:
+			return None
+
+		with open(stats_path) as stats_file:
+			return json.load(stats_file)
+	finally:
+		os.remove(stats_path)
+
+def summarize(stats):
+	return {
+		"seconds": stats["seconds"],
+		"peak_rss_bytes": stats["peak_rss_bytes"],
+		"phases": [{
+			"name": phase["name"],
+			"seconds": phase["seconds"],
+			"peak_rss_bytes": phase["peak_rss_bytes"],
+			"functions": phase["functions"],
+			"instructions": phase["instructions"],
+		} for phase in stats["phases"]],
+		"functions": stats.get("functions", []),
+	}
+
+def benchmark(fcd, fcd_args, executable, repeat):
+	# Keep the fastest run; slower runs only measure how busy the machine was.
+	best = None
+	for _ in range(repeat):
+		stats = run_fcd(fcd, fcd_args, executable)
+		if stats is None:
+			return None
+		if best is None or stats["seconds"] < best["seconds"]:
+			best = stats
+	return summarize(best)
+
+def exceeds(current, baseline, threshold, min_delta):
+	return current - baseline > max(baseline * threshold / 100.0, min_delta)
+
+def compare(name, current, baseline, threshold):
+	regressions = []
+	if exceeds(current["seconds"], baseline["seconds"], threshold, MIN_SECONDS_DELTA):
+		regressions.append("%s: %.3fs -> %.3fs" % (name, baseline["seconds"], current["seconds"]))
+	if exceeds(current["peak_rss_bytes"], baseline["peak_rss_bytes"], threshold, MIN_BYTES_DELTA):
+		regressions.append("%s: peak memory %d -> %d bytes" % (name, baseline["peak_rss_bytes"], current["peak_rss_bytes"]))
+
+	baseline_phases = dict((phase["name"], phase) for phase in baseline["phases"])
+	for phase in current["phases"]:
+		old = baseline_phases.get(phase["name"])
+		if old is None:
+			continue
+		if exceeds(phase["seconds"], old["seconds"], threshold, MIN_SECONDS_DELTA):
+			regressions.append("%s/%s: %.3fs -> %.3fs" % (name, phase["name"], old["seconds"], phase["seconds"]))
+		if phase["instructions"] != old["instructions"]:
+			# Not a failure on its own; passes are expected to change the output.
+			print("note: %s/%s: %d -> %d instructions" % (name, phase["name"], old["instructions"], phase["instructions"]))
+	return regressions
+
+def print_results(name, results):
+	print("%s: %.3fs, %.1f MiB" % (name, results["seconds"], results["peak_rss_bytes"] / (1024.0 * 1024.0)))
+	for phase in results["phases"]:
+		print("\t%-20s %9.3fs %9.1f MiB %6d functions %9d instructions" % (
+			phase["name"], phase["seconds"], phase["peak_rss_bytes"] / (1024.0 * 1024.0),
+			phase["functions"], phase["instructions"]))
+
+def main():
+	parser = argparse.ArgumentParser(description = "Benchmark fcd over a corpus of executables.")
+	parser.add_argument("--fcd", required = True, help = "path to the fcd executable")
+	parser.add_argument("--fcd-args", default = "", help = "additional whitespace-separated arguments for fcd")
+	parser.add_argument("--output", help = "write results as JSON to this file")
+	parser.add_argument("--baseline", default = "", help = "results of a previous run to compare against")
+	parser.add_argument("--threshold", type = float, default = 10, help = "percentage by which time and memory can grow (default 10)")
+	parser.add_argument("--repeat", type = int, default = 1, help = "number of runs per executable; the fastest one is kept")
+	parser.add_argument("executables", nargs = "+")
+	args = parser.parse_args()
+
+	fcd_args = args.fcd_args.split()
+	results = {}
+	failed = False
+	for executable in args.executables:
+		if not os.path.isfile(executable):
+			print("skipping %s: no such file" % executable, file = sys.stderr)
+			continue
+
+		result = benchmark(args.fcd, fcd_args, executable, max(args.repeat, 1))
+		if result is None:
+			print("fcd failed on %s" % executable, file = sys.stderr)
+			failed = True
+			continue
+		results[executable] = result
+		print_results(executable, result)
+
+	if args.output:
+		with open(args.output, "w") as output:
+			json.dump(results, output, indent = 1, sort_keys = True)
+
+	regressions = []
+	if args.baseline:
+		with open(args.baseline) as baseline_file:
+			baseline = json.load(baseline_file)
+		for executable in sorted(results):
+			if executable in baseline:
+				regressions += compare(executable, results[executable], baseline[executable], args.threshold)
+
+	for regression in regressions:
+		print("regression: " + regression, file = sys.stderr)
+	return 1 if failed or len(regressions) > 0 else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
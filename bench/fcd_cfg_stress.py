@@ -0,0 +1,298 @@
+# -*- coding: UTF-8 -*-
+
+#
+# fcd_cfg_stress.py
+# Copyright (C) 2015 Félix Cloutier.
+# All Rights Reserved.
+#
+# This file is part of fcd.
+#
+# fcd is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# fcd is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+#
+# Generates LLVM modules whose single function has a control flow graph of a
+# given shape and size, and times fcd's back end on them (fcd -m -m -m
+# --backend-runs). The shapes are the ones that make reaching conditions, path
+# enumeration and condition simplification expensive:
+#
+#	diamonds	a chain of if/else diamonds
+#	ladder		a chain of short-circuit conditions whose side paths skip
+#			over the next condition, so that regions overlap
+#	irreducible	a chain of two-block loops entered at both blocks
+#	multiexit	a loop with one exit per condition
+#	switch		a switch whose cases conditionally fall through to the next
+#
+# Conditions and side effects are calls to external functions, so that no
+# optimization can fold them away. For every shape, the script prints the back
+# end time against the number of basic blocks (or writes it as CSV for
+# plotting), and exits with status 1 if time grows faster than
+# size^--max-exponent between two consecutive sizes or if a run times out.
+#
+# Works with Python 2.7 and Python 3.
+#
+
+from __future__ import print_function
+
+import argparse
+import json
+import math
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+# Differences below this are noise, no matter what the exponent says.
+MIN_SECONDS_DELTA = 0.05
+
+class FunctionWriter(object):
+	def __init__(self, name):
+		self.name = name
+		self.lines = []
+		self.blocks = 0
+		self.values = 0
+		self.effects = 0
+
+	def block(self, label):
+		self.lines.append("%s:" % label)
+		self.blocks += 1
+
+	def emit(self, line):
+		self.lines.append("  " + line)
+
+	def effect(self):
+		self.emit("call void @effect(i64 %d)" % self.effects)
+		self.effects += 1
+
+	def condition(self):
+		name = "%%c%d" % self.values
+		self.emit("%s = call i1 @cond(i64 %d)" % (name, self.values))
+		self.values += 1
+		return name
+
+	def branch(self, true_label, false_label):
+		self.emit("br i1 %s, label %%%s, label %%%s" % (self.condition(), true_label, false_label))
+
+	def jump(self, label):
+		self.emit("br label %%%s" % label)
+
+	def module(self):
+		text = "; generated by fcd_cfg_stress.py\n\n"
+		text += "declare i1 @cond(i64)\n"
+		text += "declare i64 @value()\n"
+		text += "declare void @effect(i64)\n\n"
+		text += "define void @%s() !fcd.vaddr !0 {\n" % self.name
+		text += "\n".join(self.lines)
+		text += "\n}\n\n!0 = !{i64 4096}\n"
+		return text
+
+def diamonds(fn, size):
+	fn.block("entry")
+	fn.jump("d0")
+	for i in range(size):
+		fn.block("d%d" % i)
+		fn.branch("t%d" % i, "e%d" % i)
+		fn.block("t%d" % i)
+		fn.effect()
+		fn.jump("d%d" % (i + 1))
+		fn.block("e%d" % i)
+		fn.effect()
+		fn.jump("d%d" % (i + 1))
+	fn.block("d%d" % size)
+	fn.emit("ret void")
+
+def ladder(fn, size):
+	fn.block("entry")
+	fn.jump("b0")
+	for i in range(size):
+		fn.block("b%d" % i)
+		fn.branch("b%d" % (i + 1), "s%d" % i)
+		fn.block("s%d" % i)
+		fn.effect()
+		fn.jump("b%d" % min(i + 2, size))
+	fn.block("b%d" % size)
+	fn.emit("ret void")
+
+def irreducible(fn, size):
+	fn.block("entry")
+	fn.jump("h0")
+	for i in range(size):
+		fn.block("h%d" % i)
+		fn.branch("a%d" % i, "b%d" % i)
+		fn.block("a%d" % i)
+		fn.effect()
+		fn.branch("b%d" % i, "h%d" % (i + 1))
+		fn.block("b%d" % i)
+		fn.effect()
+		fn.branch("a%d" % i, "h%d" % (i + 1))
+	fn.block("h%d" % size)
+	fn.emit("ret void")
+
+def multiexit(fn, size):
+	fn.block("entry")
+	fn.jump("head")
+	fn.block("head")
+	fn.effect()
+	fn.jump("body0")
+	for i in range(size):
+		fn.block("body%d" % i)
+		fn.branch("exit%d" % i, "body%d" % (i + 1))
+	fn.block("body%d" % size)
+	fn.effect()
+	fn.jump("head")
+	for i in range(size):
+		fn.block("exit%d" % i)
+		fn.effect()
+		fn.jump("done")
+	fn.block("done")
+	fn.emit("ret void")
+
+def switch(fn, size):
+	fn.block("entry")
+	fn.emit("%v = call i64 @value()")
+	cases = " ".join("i64 %d, label %%case%d" % (i, i) for i in range(size))
+	fn.emit("switch i64 %%v, label %%default [ %s ]" % cases)
+	for i in range(size):
+		fn.block("case%d" % i)
+		fn.effect()
+		if i + 1 < size:
+			fn.branch("case%d" % (i + 1), "done")
+		else:
+			fn.jump("done")
+	fn.block("default")
+	fn.effect()
+	fn.jump("done")
+	fn.block("done")
+	fn.emit("ret void")
+
+SHAPES = [
+	("diamonds", diamonds),
+	("ladder", ladder),
+	("irreducible", irreducible),
+	("multiexit", multiexit),
+	("switch", switch),
+]
+
+def generate(shape, generator, size, directory):
+	fn = FunctionWriter("%s_%d" % (shape, size))
+	generator(fn, size)
+	path = os.path.join(directory, "%s-%d.ll" % (shape, size))
+	with open(path, "w") as output:
+		output.write(fn.module())
+	return path, fn.blocks
+
+def call_with_timeout(command, timeout):
+	with open(os.devnull, "w") as devnull:
+		process = subprocess.Popen(command, stdout = devnull)
+		deadline = time.time() + timeout
+		while process.poll() is None:
+			if time.time() > deadline:
+				process.kill()
+				process.wait()
+				return None
+			time.sleep(0.05)
+		return process.returncode
+
+def time_backend(fcd, fcd_args, module, runs, timeout):
+	# Returns the best back end time, None if fcd failed, or "timeout".
+	handle, stats_path = tempfile.mkstemp(prefix = "fcd-cfg-stress", suffix = ".json")
+	os.close(handle)
+	try:
+		command = [fcd, "-m", "-m", "-m", "--backend-runs=%d" % runs, "--time-phases=" + stats_path] + fcd_args + [module]
+		status = call_with_timeout(command, timeout)
+		if status is None:
+			return "timeout"
+		if status != 0:
+			return None
+
+		with open(stats_path) as stats_file:
+			stats = json.load(stats_file)
+		return min(phase["seconds"] for phase in stats["phases"] if phase["name"] == "backend")
+	finally:
+		os.remove(stats_path)
+
+def exponent(previous, current):
+	# Slope of time against size on a log-log plot.
+	if current["seconds"] - previous["seconds"] <= MIN_SECONDS_DELTA or previous["seconds"] <= 0:
+		return None
+	return math.log(current["seconds"] / previous["seconds"]) / math.log(float(current["blocks"]) / previous["blocks"])
+
+def main():
+	parser = argparse.ArgumentParser(description = "Time fcd's back end on generated control flow graphs of growing size.")
+	parser.add_argument("--fcd", help = "path to the fcd executable (without it, modules are only generated)")
+	parser.add_argument("--fcd-args", default = "", help = "additional whitespace-separated arguments for fcd")
+	parser.add_argument("--shapes", default = ",".join(name for name, _ in SHAPES), help = "comma-separated shapes to generate (default: all)")
+	parser.add_argument("--sizes", default = "4,8,16,32,64", help = "comma-separated sizes for every shape (default 4,8,16,32,64)")
+	parser.add_argument("--runs", type = int, default = 3, help = "number of times the back end runs over each module; the fastest is kept (default 3)")
+	parser.add_argument("--timeout", type = float, default = 300, help = "seconds after which a module fails (default 300)")
+	parser.add_argument("--max-exponent", type = float, default = 2.5, help = "fail when time grows faster than size to this power (default 2.5)")
+	parser.add_argument("--module-dir", help = "keep the generated modules in this directory")
+	parser.add_argument("--csv", help = "write shape,size,blocks,seconds rows to this file")
+	args = parser.parse_args()
+
+	generators = dict(SHAPES)
+	shapes = [shape for shape in args.shapes.split(",") if shape]
+	for shape in shapes:
+		if shape not in generators:
+			parser.error("unknown shape %s" % shape)
+	sizes = sorted(set(int(size) for size in args.sizes.split(",") if size))
+
+	directory = args.module_dir or tempfile.mkdtemp(prefix = "fcd-cfg-stress")
+	if not os.path.isdir(directory):
+		os.makedirs(directory)
+
+	rows = []
+	failures = []
+	try:
+		for shape in shapes:
+			previous = None
+			for size in sizes:
+				module, blocks = generate(shape, generators[shape], size, directory)
+				if args.fcd is None:
+					print(module)
+					continue
+
+				seconds = time_backend(args.fcd, args.fcd_args.split(), module, max(args.runs, 1), args.timeout)
+				if seconds is None or seconds == "timeout":
+					reason = "fcd failed" if seconds is None else "timed out"
+					print("%-12s %6d %6d blocks %s" % (shape, size, blocks, reason))
+					failures.append("%s/%d: %s" % (shape, size, reason))
+					# Bigger sizes of the same shape would only take longer.
+					break
+
+				current = {"blocks": blocks, "seconds": seconds}
+				slope = None if previous is None else exponent(previous, current)
+				print("%-12s %6d %6d blocks %9.3fs%s" % (shape, size, blocks, seconds, "" if slope is None else "  (size^%.2f)" % slope))
+				if slope is not None and slope > args.max_exponent:
+					failures.append("%s/%d: time grows as size^%.2f" % (shape, size, slope))
+				rows.append((shape, size, blocks, seconds))
+				previous = current
+	finally:
+		if args.module_dir is None:
+			shutil.rmtree(directory)
+
+	if args.csv:
+		with open(args.csv, "w") as output:
+			output.write("shape,size,blocks,seconds\n")
+			for row in rows:
+				output.write("%s,%d,%d,%.6f\n" % row)
+
+	for failure in failures:
+		print("regression: " + failure, file = sys.stderr)
+	return 1 if len(failures) > 0 else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
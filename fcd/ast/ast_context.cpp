@@ -23,15 +23,21 @@
 #include "expressions.h"
 #include "metadata.h"
 
+#include <llvm/ADT/Hashing.h>
 #include <llvm/IR/InstVisitor.h>
 
-#include <deque>
+#include <mutex>
 
 using namespace std;
 using namespace llvm;
 
 namespace
 {
+	// The AST back end builds functions on several threads that share a LLVMContext. Creating constants, and creating
+	// instructions out of constant expressions (which adds uses to constants), must be serialized. Constant
+	// expressions can nest, hence the recursive mutex.
+	recursive_mutex llvmContextMutex;
+	
 	NAryOperatorExpression::NAryOperatorType getOperator(BinaryOperator::BinaryOps op)
 	{
 #define MAP_OP(x, y) [BinaryOperator::x] = NAryOperatorExpression::y
@@ -172,6 +178,7 @@ public:
 		
 		if (auto expression = dyn_cast<ConstantExpr>(&constant))
 		{
+			lock_guard<recursive_mutex> lock(llvmContextMutex);
 			unique_ptr<Instruction> asInst(expression->getAsInstruction());
 			return ctx.uncachedExpressionFor(*asInst);
 		}
@@ -219,6 +226,11 @@ public:
 			}
 		}
 		
+		if (auto global = dyn_cast<GlobalVariable>(&constant))
+		{
+			return ctx.token(ctx.getPointerTo(ctx.getType(*global->getValueType())), global->getName());
+		}
+		
 		if (isa<UndefValue>(constant))
 		{
 			return ctx.expressionForUndef();
@@ -328,7 +340,12 @@ public:
 		for (unsigned i = 0; i < rawIndices.size(); ++i)
 		{
 			Type* indexedType = ExtractValueInst::getIndexedType(baseType, rawIndices.slice(0, i));
-			result = indexIntoElement(module, result, indexedType, ConstantInt::get(i64, rawIndices[i]));
+			ConstantInt* index;
+			{
+				lock_guard<recursive_mutex> lock(llvmContextMutex);
+				index = ConstantInt::get(i64, rawIndices[i]);
+			}
+			result = indexIntoElement(module, result, indexedType, index);
 		}
 		return result;
 	}
@@ -371,38 +388,29 @@ public:
 	}
 };
 
-template<>
-struct std::hash<pair<const ExpressionType*, size_t>>
-{
-	std::hash<const ExpressionType*> a;
-	std::hash<size_t> b;
-	
-	size_t operator()(const pair<const ExpressionType*, size_t>& pair) const
-	{
-		return a(pair.first) ^ b(pair.second);
-	}
-};
-
 class AstContext::TypeIndex
 {
+	DumbAllocator& pool;
 	VoidExpressionType voidType;
-	unordered_map<unsigned short, unique_ptr<IntegerExpressionType>> intTypes;
-	unordered_map<const ExpressionType*, unique_ptr<PointerExpressionType>> pointerTypes;
-	unordered_map<pair<const ExpressionType*, size_t>, unique_ptr<ArrayExpressionType>> arrayTypes;
-
-	// Function types and struct types are managed but not indexed.
-	deque<unique_ptr<ExpressionType>> unindexedTypes;
+	DenseMap<unsigned, IntegerExpressionType*> intTypes;
+	DenseMap<const ExpressionType*, PointerExpressionType*> pointerTypes;
+	DenseMap<pair<const ExpressionType*, uint64_t>, ArrayExpressionType*> arrayTypes;
 	
 public:
+	TypeIndex(DumbAllocator& pool)
+	: pool(pool)
+	{
+	}
+	
 	VoidExpressionType& getVoid() { return voidType; }
 	
 	IntegerExpressionType& getIntegerType(bool isSigned, unsigned short numBits)
 	{
-		unsigned short key = static_cast<unsigned short>(((isSigned != false) << 15) | (numBits & 0x7fff));
+		unsigned key = ((isSigned != false) << 15) | (numBits & 0x7fff);
 		auto& ptr = intTypes[key];
 		if (ptr == nullptr)
 		{
-			ptr.reset(new IntegerExpressionType(isSigned, numBits));
+			ptr = pool.allocate<IntegerExpressionType>(isSigned, numBits);
 		}
 		return *ptr;
 	}
@@ -412,37 +420,30 @@ public:
 		auto& ptr = pointerTypes[&pointee];
 		if (ptr == nullptr)
 		{
-			ptr.reset(new PointerExpressionType(pointee));
+			ptr = pool.allocate<PointerExpressionType>(pointee);
 		}
 		return *ptr;
 	}
 	
 	ArrayExpressionType& getArrayOf(const ExpressionType& elementType, size_t numElements)
 	{
-		pair<const ExpressionType*, size_t> key(&elementType, numElements);
-		auto& ptr = arrayTypes[key];
+		auto& ptr = arrayTypes[make_pair(&elementType, static_cast<uint64_t>(numElements))];
 		if (ptr == nullptr)
 		{
-			ptr.reset(new ArrayExpressionType(elementType, numElements));
+			ptr = pool.allocate<ArrayExpressionType>(elementType, numElements);
 		}
 		return *ptr;
 	}
 	
-	StructExpressionType& getStructure(string name)
+	// Function types and struct types are managed but not indexed.
+	StructExpressionType& getStructure(StringRef name)
 	{
-		unindexedTypes.emplace_back(new StructExpressionType(name));
-		return llvm::cast<StructExpressionType>(*unindexedTypes.back());
+		return *pool.allocate<StructExpressionType>(pool, name);
 	}
 	
 	FunctionExpressionType& getFunction(const ExpressionType& returnType)
 	{
-		unindexedTypes.emplace_back(new FunctionExpressionType(returnType));
-		return llvm::cast<FunctionExpressionType>(*unindexedTypes.back());
-	}
-	
-	size_t size() const
-	{
-		return 1 + intTypes.size() + pointerTypes.size() + arrayTypes.size() + unindexedTypes.size();
+		return *pool.allocate<FunctionExpressionType>(pool, returnType);
 	}
 };
 
@@ -457,26 +458,9 @@ void* AstContext::prepareStorageAndUses(unsigned useCount, size_t storage)
 	new (nextUseArray) ExpressionUseArrayHead;
 	
 	auto useBegin = reinterpret_cast<ExpressionUse*>(&nextUseArray[1]);
-	auto useEnd = useBegin + useCount;
-	auto firstUse = useEnd - 1;
-	
-	ptrdiff_t bitsToEncode = 0;
-	auto useIter = useEnd;
-	while (useIter != useBegin)
+	for (unsigned i = 0; i < useCount; ++i)
 	{
-		--useIter;
-		ExpressionUse::PrevTag tag;
-		if (bitsToEncode == 0)
-		{
-			tag = useIter == firstUse ? ExpressionUse::FullStop : ExpressionUse::Stop;
-			bitsToEncode = useEnd - useIter;
-		}
-		else
-		{
-			tag = static_cast<ExpressionUse::PrevTag>(bitsToEncode & 1);
-			bitsToEncode >>= 1;
-		}
-		new (useIter) ExpressionUse(tag);
+		new (&useBegin[i]) ExpressionUse(useCount - i);
 	}
 	
 	// The rest of the buffer will be initialized by a placement new
@@ -490,7 +474,9 @@ void* AstContext::prepareStorageAndUses(unsigned useCount, size_t storage)
 AstContext::AstContext(DumbAllocator& pool, Module* module)
 : pool(pool)
 , module(module)
-, types(new TypeIndex)
+, stringLiterals(nullptr)
+, types(new TypeIndex(pool))
+, expressionCount(0)
 {
 	trueExpr = token(getIntegerType(false, 1), "true");
 	undef = token(getVoid(), "__undefined");
@@ -503,8 +489,9 @@ AstContext::~AstContext()
 
 Expression* AstContext::uncachedExpressionFor(llvm::Value& value)
 {
-	auto iter = expressionMap.find(&value);
-	if (iter != expressionMap.end())
+	auto& expressions = isa<Instruction>(value) || isa<Argument>(value) ? localExpressions : globalExpressions;
+	auto iter = expressions.find(&value);
+	if (iter != expressions.end())
 	{
 		return iter->second;
 	}
@@ -515,12 +502,17 @@ Expression* AstContext::uncachedExpressionFor(llvm::Value& value)
 
 Expression* AstContext::expressionFor(Value& value)
 {
-	auto& expr = expressionMap[&value];
-	if (expr == nullptr)
+	auto& expressions = isa<Instruction>(value) || isa<Argument>(value) ? localExpressions : globalExpressions;
+	auto iter = expressions.find(&value);
+	if (iter != expressions.end())
 	{
-		InstToExpr visitor(*this);
-		expr = visitor.visitValue(value);
+		return iter->second;
 	}
+	
+	// The visitor can add operands to the map, so no reference into it is held across the visit.
+	InstToExpr visitor(*this);
+	Expression* expr = visitor.visitValue(value);
+	expressions[&value] = expr;
 	return expr;
 }
 
@@ -570,6 +562,76 @@ Statement* AstContext::statementFor(Instruction &inst)
 	return nullptr;
 }
 
+template<typename T, typename TMatch, typename TCreate>
+T* AstContext::uniqued(size_t hash, TMatch&& matches, TCreate&& create)
+{
+	// Operands can be replaced after an expression is created, so the hash only says what the expression looked like
+	// then. Candidates are checked against what they look like now.
+	auto range = uniquedExpressions.equal_range(hash);
+	for (auto iter = range.first; iter != range.second; ++iter)
+	{
+		if (auto candidate = dyn_cast<T>(iter->second))
+		if (matches(*candidate))
+		{
+			return candidate;
+		}
+	}
+	
+	T* result = create();
+	uniquedExpressions.insert({hash, result});
+	return result;
+}
+
+#pragma mark - Expressions
+UnaryOperatorExpression* AstContext::unary(UnaryOperatorExpression::UnaryOperatorType type, NOT_NULL(Expression) operand)
+{
+	Expression* operandExpr = operand;
+	size_t hash = hash_combine(ExpressionUser::UnaryOperator, type, operandExpr);
+	return uniqued<UnaryOperatorExpression>(hash, [&](UnaryOperatorExpression& expr)
+	{
+		return expr.getType() == type && expr.getOperand() == operandExpr;
+	}, [&]
+	{
+		return allocate<true, UnaryOperatorExpression>(1, type, operand);
+	});
+}
+
+NumericExpression* AstContext::numeric(const IntegerExpressionType& type, uint64_t ui)
+{
+	size_t hash = hash_combine(ExpressionUser::Numeric, &type, ui);
+	return uniqued<NumericExpression>(hash, [&](NumericExpression& expr)
+	{
+		return &expr.expressionType == &type && expr.ui64 == ui;
+	}, [&]
+	{
+		return allocate<false, NumericExpression>(0, type, ui);
+	});
+}
+
+TokenExpression* AstContext::token(const ExpressionType& type, StringRef string)
+{
+	size_t hash = hash_combine(ExpressionUser::Token, &type, string);
+	return uniqued<TokenExpression>(hash, [&](TokenExpression& expr)
+	{
+		return &expr.expressionType == &type && string == static_cast<const char*>(expr.token);
+	}, [&]
+	{
+		return allocate<false, TokenExpression>(0, type, string);
+	});
+}
+
+AssemblyExpression* AstContext::assembly(const FunctionExpressionType& type, StringRef assembly)
+{
+	size_t hash = hash_combine(ExpressionUser::Assembly, &type, assembly);
+	return uniqued<AssemblyExpression>(hash, [&](AssemblyExpression& expr)
+	{
+		return &expr.getFunctionType() == &type && assembly == static_cast<const char*>(expr.assembly);
+	}, [&]
+	{
+		return allocate<false, AssemblyExpression>(0, type, assembly);
+	});
+}
+
 Expression* AstContext::negate(NOT_NULL(Expression) expr)
 {
 	if (auto unary = dyn_cast<UnaryOperatorExpression>(expr))
@@ -592,74 +654,86 @@ ExpressionStatement* AstContext::phiAssignment(PHINode &phi, Value &value)
 	return expr(assignment);
 }
 
+ExpressionStatement* AstContext::coalescedPhiAssignment(PHINode &phi, Value &value)
+{
+	auto assignment = nary(NAryOperatorExpression::Assign, expressionFor(phi), expressionFor(value));
+	return expr(assignment);
+}
+
 #pragma mark - Types
 const ExpressionType& AstContext::getType(Type &type)
 {
+	auto iter = typeMap.find(&type);
+	if (iter != typeMap.end())
+	{
+		return *iter->second;
+	}
+	
+	const ExpressionType* result;
 	if (type.isVoidTy())
 	{
-		return getVoid();
+		result = &getVoid();
 	}
 	else if (auto intTy = dyn_cast<IntegerType>(&type))
 	{
-		return getIntegerType(false, (unsigned short)intTy->getBitWidth());
+		result = &getIntegerType(false, (unsigned short)intTy->getBitWidth());
 	}
 	else if (auto ptr = dyn_cast<PointerType>(&type))
 	{
 		// XXX will break when pointer types lose getElementType
-		return getPointerTo(getType(*ptr->getElementType()));
+		result = &getPointerTo(getType(*ptr->getElementType()));
 	}
 	else if (auto array = dyn_cast<ArrayType>(&type))
 	{
-		return getArrayOf(getType(*array->getElementType()), array->getNumElements());
+		result = &getArrayOf(getType(*array->getElementType()), array->getNumElements());
 	}
 	else if (auto funcType = dyn_cast<FunctionType>(&type))
 	{
 		// We lose parameter names doing this.
-		auto& result = createFunction(getType(*funcType->getReturnType()));
+		auto& functionType = createFunction(getType(*funcType->getReturnType()));
 		for (Type* param : funcType->params())
 		{
-			result.append(getType(*param), "");
+			functionType.append(getType(*param), "");
 		}
-		return result;
+		result = &functionType;
 	}
 	else if (auto structure = dyn_cast<StructType>(&type))
 	{
-		auto& structType = structTypeMap[structure];
-		if (structType == nullptr)
+		StringRef name;
+		if (structure->hasName())
+		{
+			name = structure->getName();
+			if (name.startswith("struct."))
+			{
+				name = name.substr(sizeof "struct." - 1);
+			}
+		}
+		
+		// Structures can refer to themselves, so they need to be in the map before their fields are created.
+		auto& structType = createStructure(name);
+		typeMap[&type] = &structType;
+		for (unsigned i = 0; i < structure->getNumElements(); ++i)
 		{
 			string name;
-			if (structure->hasName())
+			if (module != nullptr)
 			{
-				name = structure->getName().str();
-				char structPrefix[] = "struct.";
-				size_t structPrefixSize = sizeof structPrefix - 1;
-				if (name.compare(0, structPrefixSize, structPrefix) == 0)
-				{
-					name = name.substr(structPrefixSize);
-				}
+				name = md::getRecoveredReturnFieldName(*module, *structure, i).str();
 			}
-			
-			structType = &createStructure(move(name));
-			for (unsigned i = 0; i < structure->getNumElements(); ++i)
+			if (name.size() == 0)
 			{
-				string name;
-				if (module != nullptr)
-				{
-					name = md::getRecoveredReturnFieldName(*module, *structure, i).str();
-				}
-				if (name.size() == 0)
-				{
-					raw_string_ostream(name) << "field" << i;
-				}
-				structType->append(getType(*structure->getElementType(i)), name);
+				raw_string_ostream(name) << "field" << i;
 			}
+			structType.append(getType(*structure->getElementType(i)), name);
 		}
-		return *structType;
+		return structType;
 	}
 	else
 	{
 		llvm_unreachable("unknown LLVM type");
 	}
+	
+	typeMap[&type] = result;
+	return *result;
 }
 
 const VoidExpressionType& AstContext::getVoid()
@@ -682,9 +756,9 @@ const ArrayExpressionType& AstContext::getArrayOf(const ExpressionType& elementT
 	return types->getArrayOf(elementType, numElements);
 }
 
-StructExpressionType& AstContext::createStructure(string name)
+StructExpressionType& AstContext::createStructure(StringRef name)
 {
-	return types->getStructure(move(name));
+	return types->getStructure(name);
 }
 
 FunctionExpressionType& AstContext::createFunction(const ExpressionType &returnType)
@@ -28,6 +28,8 @@
 #include "not_null.h"
 #include "statements.h"
 
+#include <llvm/ADT/DenseMap.h>
+
 #include <memory>
 #include <unordered_map>
 #include <utility>
@@ -44,6 +46,7 @@ namespace llvm
 
 class Expression;
 class ExpressionUser;
+class StringLiteralIndex;
 
 class AstContext
 {
@@ -52,10 +55,21 @@ class AstContext
 	
 	DumbAllocator& pool;
 	llvm::Module* module;
+	const StringLiteralIndex* stringLiterals;
 	std::unordered_map<Expression*, Expression*> phiReadsToWrites;
-	std::unordered_map<llvm::Value*, Expression*> expressionMap;
+	// Expressions of the function's instructions and arguments are looked up for every operand of every instruction.
+	// LLVM values have no room for a dense index, so they are kept in an open-addressing map that is sized for the
+	// function upfront, apart from the few constants and globals that the function uses.
+	llvm::DenseMap<const llvm::Value*, Expression*> localExpressions;
+	llvm::DenseMap<const llvm::Value*, Expression*> globalExpressions;
 	std::unique_ptr<TypeIndex> types;
-	std::unordered_map<const llvm::StructType*, StructExpressionType*> structTypeMap;
+	llvm::DenseMap<const llvm::Type*, const ExpressionType*> typeMap;
+	
+	// Expressions that the printer never turns into temporaries (unary operators, numbers, tokens and assembly) are
+	// uniqued so that identical ones are the same object. Other expressions are shared only when they come from the
+	// same llvm::Value; sharing them would make the printer hoist them.
+	std::unordered_multimap<size_t, Expression*> uniquedExpressions;
+	unsigned expressionCount;
 	
 	Expression* trueExpr;
 	Expression* undef;
@@ -63,6 +77,9 @@ class AstContext
 	
 	Expression* uncachedExpressionFor(llvm::Value& value);
 	
+	template<typename T, typename TMatch, typename TCreate>
+	T* uniqued(size_t hash, TMatch&& matches, TCreate&& create);
+	
 	void* prepareStorageAndUses(unsigned useCount, size_t storageSize);
 	
 	template<typename T, typename... TElements>
@@ -85,7 +102,9 @@ class AstContext
 		void* result = HasUses
 			? prepareStorageAndUses(useCount, sizeof(T))
 			: pool.allocateDynamic<char>(sizeof(T), alignof(T));
-		return new (result) T(*this, useCount, std::forward<TArgs>(args)...);
+		T* expression = new (result) T(*this, useCount, std::forward<TArgs>(args)...);
+		expression->index = expressionCount++;
+		return expression;
 	}
 	
 	template<typename T, typename... TArgs, typename = typename std::enable_if<std::is_base_of<Statement, T>::value, T>::type>
@@ -103,6 +122,14 @@ public:
 	
 	DumbAllocator& getPool() { return pool; }
 	
+	// String literals of the executable that the module was lifted from, when they are known. Printers use them to
+	// recognize pointers to string literals.
+	const StringLiteralIndex* getStringLiterals() const { return stringLiterals; }
+	void setStringLiterals(const StringLiteralIndex* literals) { stringLiterals = literals; }
+	
+	// Expressions are numbered in creation order, from 0 to getExpressionCount() - 1 (see Expression::getIndex).
+	unsigned getExpressionCount() const { return expressionCount; }
+	
 	Expression* expressionFor(llvm::Value& value);
 	Expression* expressionForTrue() { return trueExpr; }
 	Expression* expressionForUndef() { return undef; }
@@ -110,12 +137,20 @@ public:
 	
 	Statement* statementFor(llvm::Instruction& inst);
 	
-#pragma mark - Expressions
-	UnaryOperatorExpression* unary(UnaryOperatorExpression::UnaryOperatorType type, NOT_NULL(Expression) operand)
+	// Forgets the expressions of IR values, for when the IR that they come from is deleted. Expressions stay valid.
+	void forgetValues()
 	{
-		return allocate<true, UnaryOperatorExpression>(1, type, operand);
+		localExpressions.clear();
+		globalExpressions.clear();
 	}
 	
+	// Makes room for the expressions of this many instructions and arguments. DenseMap grows past 3/4 full, and resize
+	// counts buckets.
+	void reserveLocalValues(size_t count) { localExpressions.resize(count * 4 / 3 + 1); }
+	
+#pragma mark - Expressions
+	UnaryOperatorExpression* unary(UnaryOperatorExpression::UnaryOperatorType type, NOT_NULL(Expression) operand);
+	
 	NAryOperatorExpression* nary(NAryOperatorExpression::NAryOperatorType type, unsigned numElements = 2)
 	{
 		return allocate<true, NAryOperatorExpression>(numElements, type);
@@ -139,15 +174,8 @@ public:
 		return allocate<true, TernaryExpression>(3, cond, ifTrue, ifFalse);
 	}
 	
-	NumericExpression* numeric(const IntegerExpressionType& type, uint64_t ui)
-	{
-		return allocate<false, NumericExpression>(0, type, ui);
-	}
-	
-	TokenExpression* token(const ExpressionType& type, llvm::StringRef string)
-	{
-		return allocate<false, TokenExpression>(0, type, string);
-	}
+	NumericExpression* numeric(const IntegerExpressionType& type, uint64_t ui);
+	TokenExpression* token(const ExpressionType& type, llvm::StringRef string);
 	
 	CallExpression* call(NOT_NULL(Expression) callee, unsigned numParams = 0)
 	{
@@ -169,10 +197,7 @@ public:
 		return allocate<true, SubscriptExpression>(2, base, index);
 	}
 	
-	AssemblyExpression* assembly(const FunctionExpressionType& type, llvm::StringRef assembly)
-	{
-		return allocate<false, AssemblyExpression>(0, type, assembly);
-	}
+	AssemblyExpression* assembly(const FunctionExpressionType& type, llvm::StringRef assembly);
 	
 	AssignableExpression* assignable(const ExpressionType& type, llvm::StringRef prefix)
 	{
@@ -180,7 +205,6 @@ public:
 	}
 	
 #pragma mark Simple transformations
-	// XXX: this might create multiple versions of fundamentaly identical expressions
 	Expression* negate(NOT_NULL(Expression) expr);
 	
 #pragma mark - Statements
@@ -221,6 +245,7 @@ public:
 	
 #pragma mark - Φ Nodes
 	ExpressionStatement* phiAssignment(llvm::PHINode& phi, llvm::Value& value);
+	ExpressionStatement* coalescedPhiAssignment(llvm::PHINode& phi, llvm::Value& value);
 	
 #pragma mark - Types
 	const ExpressionType& getType(llvm::Type& type);
@@ -228,7 +253,7 @@ public:
 	const IntegerExpressionType& getIntegerType(bool isSigned, unsigned short numBits);
 	const PointerExpressionType& getPointerTo(const ExpressionType& pointee);
 	const ArrayExpressionType& getArrayOf(const ExpressionType& elementType, size_t numElements);
-	StructExpressionType& createStructure(std::string name);
+	StructExpressionType& createStructure(llvm::StringRef name);
 	FunctionExpressionType& createFunction(const ExpressionType& returnType);
 };
 
@@ -24,6 +24,8 @@
 
 #include "pass.h"
 #include "pass_branchcombine.h"
+#include "pass_fileprint.h"
+#include "pass_jsonprint.h"
 #include "pass_print.h"
 #include "pass_removeundef.h"
 #include "pass_simplifyexpressions.h"
@@ -21,6 +21,8 @@
 
 #include "expression_type.h"
 
+#include <memory>
+
 using namespace std;
 using namespace llvm;
 
@@ -44,6 +46,22 @@ namespace
 	}
 }
 
+void ExpressionTypeFieldArray::append(const ExpressionType& type, StringRef name)
+{
+	if (count == capacity)
+	{
+		// The old array stays in the pool; types rarely have enough fields for this to matter.
+		size_t newCapacity = capacity == 0 ? 4 : capacity * 2;
+		char* storage = pool.allocateDynamic<char>(newCapacity * sizeof(ExpressionTypeField), alignof(ExpressionTypeField));
+		auto newFields = reinterpret_cast<ExpressionTypeField*>(storage);
+		uninitialized_copy(fields, fields + count, newFields);
+		fields = newFields;
+		capacity = newCapacity;
+	}
+	new (&fields[count]) ExpressionTypeField(type, pool.copyString(name));
+	++count;
+}
+
 void ExpressionType::dump() const
 {
 	print(errs());
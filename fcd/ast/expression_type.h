@@ -23,12 +23,11 @@
 #define expression_type_hpp
 
 
+#include "dumb_allocator.h"
+
 #include <llvm/ADT/StringRef.h>
 #include <llvm/Support/raw_ostream.h>
 
-#include <vector>
-#include <string>
-
 class ExpressionType
 {
 public:
@@ -53,7 +52,7 @@ public:
 	{
 	}
 	
-	virtual ~ExpressionType() = default;
+	// no destructor on purpose, since types are allocated in the AstContext's pool and must be trivially destructible
 	
 	Type getType() const { return type; }
 	
@@ -142,33 +141,63 @@ public:
 struct ExpressionTypeField
 {
 	const ExpressionType& type;
-	std::string name;
+	const char* name;
 	
-	ExpressionTypeField(const ExpressionType& type, std::string name)
+	ExpressionTypeField(const ExpressionType& type, const char* name)
 	: type(type), name(name)
 	{
 	}
 };
 
+// Fields of a structure or parameters of a function, stored contiguously in the pool of their type.
+class ExpressionTypeFieldArray
+{
+	DumbAllocator& pool;
+	ExpressionTypeField* fields;
+	size_t count;
+	size_t capacity;
+	
+public:
+	typedef const ExpressionTypeField* const_iterator;
+	
+	ExpressionTypeFieldArray(DumbAllocator& pool)
+	: pool(pool), fields(nullptr), count(0), capacity(0)
+	{
+	}
+	
+	const_iterator begin() const { return fields; }
+	const_iterator end() const { return fields + count; }
+	
+	const ExpressionTypeField& operator[](size_t index) const
+	{
+		assert(index < count);
+		return fields[index];
+	}
+	
+	size_t size() const { return count; }
+	
+	void append(const ExpressionType& type, llvm::StringRef name);
+};
+
 class StructExpressionType : public ExpressionType
 {
-	std::vector<ExpressionTypeField> fields;
-	std::string name;
+	ExpressionTypeFieldArray fields;
+	const char* name;
 	
 public:
-	typedef std::vector<ExpressionTypeField>::const_iterator const_iterator;
+	typedef ExpressionTypeFieldArray::const_iterator const_iterator;
 	
 	static bool classof(const ExpressionType* that)
 	{
 		return that->getType() == Structure;
 	}
 	
-	StructExpressionType(std::string name)
-	: ExpressionType(Structure), name(std::move(name))
+	StructExpressionType(DumbAllocator& pool, llvm::StringRef name)
+	: ExpressionType(Structure), fields(pool), name(pool.copyString(name))
 	{
 	}
 	
-	const std::string& getName() const { return name; }
+	llvm::StringRef getName() const { return name; }
 	
 	const_iterator begin() const { return fields.begin(); }
 	const_iterator end() const { return fields.end(); }
@@ -176,10 +205,7 @@ public:
 	const ExpressionTypeField& operator[](size_t index) const { return fields[index]; }
 	size_t size() const { return fields.size(); }
 	
-	void append(const ExpressionType& type, std::string name)
-	{
-		fields.emplace_back(type, std::move(name));
-	}
+	void append(const ExpressionType& type, llvm::StringRef name) { fields.append(type, name); }
 	
 	virtual void print(llvm::raw_ostream& os) const override;
 };
@@ -187,18 +213,18 @@ public:
 class FunctionExpressionType : public ExpressionType
 {
 	const ExpressionType& returnType;
-	std::vector<ExpressionTypeField> parameters;
+	ExpressionTypeFieldArray parameters;
 	
 public:
-	typedef std::vector<ExpressionTypeField>::const_iterator const_iterator;
+	typedef ExpressionTypeFieldArray::const_iterator const_iterator;
 	
 	static bool classof(const ExpressionType* that)
 	{
 		return that->getType() == Function;
 	}
 	
-	explicit FunctionExpressionType(const ExpressionType& returnType)
-	: ExpressionType(Function), returnType(returnType)
+	FunctionExpressionType(DumbAllocator& pool, const ExpressionType& returnType)
+	: ExpressionType(Function), returnType(returnType), parameters(pool)
 	{
 	}
 	
@@ -209,10 +235,7 @@ public:
 	const ExpressionTypeField& operator[](size_t index) const { return parameters[index]; }
 	size_t size() const { return parameters.size(); }
 	
-	void append(const ExpressionType& type, std::string name)
-	{
-		parameters.emplace_back(type, std::move(name));
-	}
+	void append(const ExpressionType& type, llvm::StringRef name) { parameters.append(type, name); }
 	
 	virtual void print(llvm::raw_ostream& os) const override;
 };
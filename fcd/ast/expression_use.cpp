@@ -25,104 +25,63 @@
 using namespace llvm;
 using namespace std;
 
+constexpr unsigned ExpressionUse::farDistance;
+
 void ExpressionUse::setPrevNext(ExpressionUse *use)
 {
 	if (auto pointer = prev.getPointer())
 	{
-		pointer->next = use;
+		pointer->next.setPointer(use);
 	}
-	else if (expression != nullptr)
+	else if (auto target = expression.getPointer())
 	{
-		expression->firstUse = use;
+		target->firstUse = use;
 	}
 }
 
 void ExpressionUse::setNextPrev(ExpressionUse *use)
 {
-	if (auto pointer = next)
+	if (auto pointer = next.getPointer())
 	{
 		pointer->prev.setPointer(use);
 	}
 }
 
-pair<ExpressionUse*, size_t> ExpressionUse::walkWay()
-{
-	size_t total = 0;
-	ExpressionUse* current = this;
-	while (current->prev.getInt() < Stop)
-	{
-		total <<= 1;
-		total |= current->prev.getInt();
-		++current;
-	}
-	return make_pair(current, total);
-}
-
-pair<ExpressionUse*, ExpressionUser*> ExpressionUse::walkToEndOfArray()
-{
-	ExpressionUse* stop;
-	size_t skip;
-	tie(stop, skip) = walkWay();
-	
-	if (stop->prev.getInt() == FullStop)
-	{
-		skip = 1;
-	}
-	else
-	{
-		tie(stop, skip) = stop[1].walkWay();
-	}
-	
-	ExpressionUse* endPointer = &stop[skip];
-	auto atLocation = reinterpret_cast<PointerIntPair<void*, 1>*>(endPointer);
-	
-	// Pointer heresy directly based off what LLVM does.
-	// (http://llvm.org/docs/doxygen/html/Use_8cpp_source.html#l00041)
-	if (atLocation->getInt() == 0)
-	{
-		// aligned pointer; this is not a tagged pointer
-		// (we're reading the User vtable)
-		return make_pair(nullptr, reinterpret_cast<ExpressionUser*>(atLocation));
-	}
-	else
-	{
-		// tagged pointer, hung-off uses; the pointer in atLocation points to the user
-		return make_pair(nullptr, reinterpret_cast<ExpressionUser*>(atLocation->getPointer()));
-	}
-}
-
 ExpressionUser* ExpressionUse::getUser()
 {
 	ExpressionUse* use = this;
-	ExpressionUser* user = nullptr;
-	while (user == nullptr)
+	unsigned distance = use->getDistance();
+	while (distance == farDistance)
 	{
-		tie(use, user) = use->walkToEndOfArray();
+		// This use is at least farDistance uses away from the end, so the one farDistance - 1 uses ahead is still
+		// in the array.
+		use += farDistance - 1;
+		distance = use->getDistance();
 	}
-	return user;
+	return reinterpret_cast<ExpressionUser*>(use + distance);
 }
 
 void ExpressionUse::setUse(Expression *target)
 {
-	if (expression == target)
+	if (getUse() == target)
 	{
 		return;
 	}
 	
 	// unlink
-	setPrevNext(next);
+	setPrevNext(next.getPointer());
 	setNextPrev(prev.getPointer());
 	
 	// link with new expression
-	expression = target;
-	if (expression == nullptr)
+	expression.setPointer(target);
+	if (target == nullptr)
 	{
-		next = nullptr;
+		next.setPointer(nullptr);
 	}
 	else
 	{
-		next = expression->firstUse;
-		expression->firstUse = this;
+		next.setPointer(target->firstUse);
+		target->firstUse = this;
 	}
 	prev.setPointer(nullptr);
 	setNextPrev(this);
@@ -34,44 +34,44 @@ class Expression;
 class ExpressionUse;
 class ExpressionUser;
 
+// Uses are allocated in an array that immediately precedes their user. Rather than LLVM-style waymarks, the two spare
+// low bits of each of the three pointers hold the distance from the use to the end of its array, so that finding the
+// user doesn't need to decode anything. Uses that are too far from the end for that to fit are recognized by the
+// farDistance marker and jump ahead to a use that is closer.
 class ExpressionUse
 {
 	llvm::PointerIntPair<ExpressionUse*, 2, unsigned> prev;
-	ExpressionUse* next;
-	Expression* expression;
+	llvm::PointerIntPair<ExpressionUse*, 2, unsigned> next;
+	llvm::PointerIntPair<Expression*, 2, unsigned> expression;
 	
 	void setPrevNext(ExpressionUse* use);
 	void setNextPrev(ExpressionUse* use);
 	
-	std::pair<ExpressionUse*, size_t> walkWay();
-	std::pair<ExpressionUse*, ExpressionUser*> walkToEndOfArray();
+	unsigned getDistance() const { return prev.getInt() | (next.getInt() << 2) | (expression.getInt() << 4); }
 	
 public:
-	// borrowed from LLVM's Use
-	enum PrevTag
-	{
-		Zero,
-		One,
-		Stop,
-		FullStop
-	};
+	static constexpr unsigned farDistance = 63;
 	
-	ExpressionUse(PrevTag tag)
+	// distanceToUser is how many uses there are from this one (included) to the end of the array.
+	ExpressionUse(size_t distanceToUser)
 	: prev(nullptr), next(nullptr), expression(nullptr)
 	{
-		prev.setInt(tag);
+		unsigned distance = distanceToUser < farDistance ? static_cast<unsigned>(distanceToUser) : farDistance;
+		prev.setInt(distance & 3);
+		next.setInt((distance >> 2) & 3);
+		expression.setInt(distance >> 4);
 	}
 	
 	ExpressionUse* getPrev() { return prev.getPointer(); }
 	const ExpressionUse* getPrev() const { return prev.getPointer(); }
-	ExpressionUse* getNext() { return next; }
-	const ExpressionUse* getNext() const { return next; }
+	ExpressionUse* getNext() { return next.getPointer(); }
+	const ExpressionUse* getNext() const { return next.getPointer(); }
 	
 	ExpressionUser* getUser();
 	const ExpressionUser* getUser() const { return const_cast<ExpressionUse*>(this)->getUser(); }
 	
-	Expression* getUse() { return expression; }
-	const Expression* getUse() const { return expression; }
+	Expression* getUse() { return expression.getPointer(); }
+	const Expression* getUse() const { return expression.getPointer(); }
 	void setUse(Expression* target);
 	
 	operator Expression*() { return getUse(); }
@@ -62,7 +62,7 @@ bool Expression::defaultEqualityCheck(const Expression &a, const Expression &b)
 	{
 		return std::equal(a.operands_begin(), a.operands_end(), b.operands_begin(), [](const Expression* a, const Expression* b)
 		{
-			return *a == *b;
+			return equal(*a, *b);
 		});
 	}
 	return false;
@@ -167,7 +167,7 @@ bool UnaryOperatorExpression::operator==(const Expression& that) const
 	if (auto unaryThat = llvm::dyn_cast<UnaryOperatorExpression>(&that))
 	if (unaryThat->type == type)
 	{
-		return *getOperand() == *unaryThat->getOperand();
+		return equal(*getOperand(), *unaryThat->getOperand());
 	}
 	return false;
 }
@@ -217,7 +217,7 @@ pair<ExpressionUser::UserType, const StructExpressionType*> MemberAccessExpressi
 }
 
 
-const std::string& MemberAccessExpression::getFieldName() const
+StringRef MemberAccessExpression::getFieldName() const
 {
 	return structureType[fieldIndex].name;
 }
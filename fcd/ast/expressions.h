@@ -40,9 +40,12 @@ class Expression : public ExpressionUser
 	template<bool B, typename T>
 	using OptionallyConst = typename std::conditional<B, typename std::add_const<T>::type, typename std::remove_const<T>::type>::type;
 	
+	friend class AstContext;
 	friend class ExpressionUse;
 	
 private:
+	// Set by AstContext. It goes first so that it sits in the tail padding of ExpressionUser.
+	unsigned index;
 	class ExpressionUse* firstUse;
 	
 protected:
@@ -92,7 +95,7 @@ public:
 	}
 	
 	Expression(UserType type, AstContext& ctx, unsigned allocatedUses, unsigned usedUses)
-	: ExpressionUser(type, allocatedUses, usedUses), firstUse(nullptr)
+	: ExpressionUser(type, allocatedUses, usedUses), index(0), firstUse(nullptr)
 	{
 		assert(type >= ExpressionMin && type < ExpressionMax);
 		// The context parameter only forces subclasses to accept one, for uniformity purposes.
@@ -104,6 +107,10 @@ public:
 	{
 	}
 	
+	// Dense number of this expression in the AstContext that created it, for passes that keep per-expression state in
+	// arrays instead of maps.
+	unsigned getIndex() const { return index; }
+	
 	use_iterator uses_begin() { return use_iterator(firstUse); }
 	const_use_iterator uses_begin() const { return const_use_iterator(firstUse); }
 	const_use_iterator uses_cbegin() const { return uses_begin(); }
@@ -133,6 +140,12 @@ public:
 	{
 		return !(*this == that);
 	}
+	
+	// Uniqued expressions (see AstContext) compare equal by address; this only walks the trees when that fails.
+	static bool equal(const Expression& a, const Expression& b)
+	{
+		return &a == &b || a == b;
+	}
 };
 
 class UnaryOperatorExpression final : public Expression
@@ -306,7 +319,7 @@ public:
 	}
 	
 	unsigned getFieldIndex() const { return fieldIndex; }
-	const std::string& getFieldName() const;
+	llvm::StringRef getFieldName() const;
 	
 	OPERAND_GET_SET(BaseExpression, 0)
 	
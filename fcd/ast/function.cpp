@@ -28,36 +28,281 @@
 #include <llvm/IR/Instructions.h>
 #include <llvm/Support/raw_os_ostream.h>
 
+#include <algorithm>
 #include <memory>
 
 using namespace llvm;
 using namespace std;
 
+namespace
+{
+	typedef SmallPtrSet<Instruction*, 16> ReaderSet;
+	
+	// Expressions are printed where statements use them, so every instruction that uses a Φ node, directly or through
+	// other instructions, reads the Φ variable where it is printed. Φ nodes that use it are copies on an edge, and end
+	// the chain.
+	void collectReaders(PHINode& phi, ReaderSet& readers)
+	{
+		SmallVector<Instruction*, 16> worklist = { &phi };
+		while (!worklist.empty())
+		{
+			Instruction* inst = worklist.pop_back_val();
+			for (User* user : inst->users())
+			{
+				auto userInst = dyn_cast<Instruction>(user);
+				if (userInst != nullptr && readers.insert(userInst).second && !isa<PHINode>(userInst))
+				{
+					worklist.push_back(userInst);
+				}
+			}
+		}
+	}
+	
+	bool reads(Value* value, PHINode& phi, const ReaderSet& readers)
+	{
+		auto inst = dyn_cast<Instruction>(value);
+		return inst != nullptr && (inst == &phi || readers.count(inst) != 0);
+	}
+	
+	// Blocks where the Φ variable is read: blocks with readers, and predecessors that copy a reader to a Φ node.
+	void collectReadingBlocks(PHINode& phi, const ReaderSet& readers, SmallPtrSetImpl<BasicBlock*>& blocks)
+	{
+		for (Instruction* reader : readers)
+		{
+			if (auto readingPhi = dyn_cast<PHINode>(reader))
+			{
+				for (unsigned i = 0; i < readingPhi->getNumIncomingValues(); ++i)
+				{
+					if (reads(readingPhi->getIncomingValue(i), phi, readers))
+					{
+						blocks.insert(readingPhi->getIncomingBlock(i));
+					}
+				}
+			}
+			else
+			{
+				blocks.insert(reader->getParent());
+			}
+		}
+	}
+	
+	// Copies at the end of pred come before its terminator and before the paths to its other successors. The Φ
+	// variable can only be assigned there if nothing on these paths still expects its previous value until the Φ
+	// block is entered again.
+	bool canAssignOnEdge(PHINode& phi, BasicBlock& pred, const ReaderSet& readers, const SmallPtrSetImpl<BasicBlock*>& readingBlocks)
+	{
+		if (readers.count(pred.getTerminator()) != 0)
+		{
+			return false;
+		}
+		
+		BasicBlock* phiBlock = phi.getParent();
+		SmallPtrSet<BasicBlock*, 16> visited;
+		SmallVector<BasicBlock*, 16> worklist;
+		for (BasicBlock* successor : successors(&pred))
+		{
+			if (successor == phiBlock || !visited.insert(successor).second)
+			{
+				continue;
+			}
+			
+			for (auto iter = successor->begin(); PHINode* otherPhi = dyn_cast<PHINode>(iter); ++iter)
+			{
+				if (reads(otherPhi->getIncomingValueForBlock(&pred), phi, readers))
+				{
+					return false;
+				}
+			}
+			worklist.push_back(successor);
+		}
+		
+		while (!worklist.empty())
+		{
+			BasicBlock* bb = worklist.pop_back_val();
+			if (readingBlocks.count(bb) != 0)
+			{
+				return false;
+			}
+			
+			for (BasicBlock* successor : successors(bb))
+			{
+				if (successor != phiBlock && visited.insert(successor).second)
+				{
+					worklist.push_back(successor);
+				}
+			}
+		}
+		return true;
+	}
+	
+	// Sequentializes the parallel copies of the edge from pred to bb: a coalesced Φ variable is only assigned once no
+	// other copy of the edge reads it. Copies to phi_in variables can go anywhere. Returns a coalesced Φ node of a
+	// copy cycle if there is one, in which case order is incomplete.
+	PHINode* orderCopies(BasicBlock& pred, BasicBlock& bb, const SmallPtrSetImpl<PHINode*>& coalesced, const unordered_map<PHINode*, ReaderSet>& readers, SmallVectorImpl<PHINode*>& order)
+	{
+		SmallVector<PHINode*, 4> pending;
+		for (auto iter = bb.begin(); PHINode* phi = dyn_cast<PHINode>(iter); ++iter)
+		{
+			pending.push_back(phi);
+		}
+		
+		order.clear();
+		while (!pending.empty())
+		{
+			auto ready = find_if(pending.begin(), pending.end(), [&](PHINode* target)
+			{
+				if (coalesced.count(target) == 0)
+				{
+					return true;
+				}
+				
+				const ReaderSet& targetReaders = readers.at(target);
+				return none_of(pending.begin(), pending.end(), [&](PHINode* other)
+				{
+					return other != target && reads(other->getIncomingValueForBlock(&pred), *target, targetReaders);
+				});
+			});
+			
+			if (ready == pending.end())
+			{
+				// Only coalesced copies are left, and each one assigns a variable that another one reads.
+				return pending.front();
+			}
+			order.push_back(*ready);
+			pending.erase(ready);
+		}
+		return nullptr;
+	}
+}
+
+void FunctionNode::coalescePhis()
+{
+	// Out of SSA: a Φ node is normally assigned through a phi_in variable on each incoming edge, and phi_in is copied
+	// to the Φ variable where the Φ node is. When it's safe to do it on every incoming edge, the Φ variable is assigned
+	// on edges directly instead, which saves a statement and a variable per Φ node. Copy cycles (like swaps) keep a
+	// phi_in variable for one of their Φ nodes.
+	phisCoalesced = true;
+	unordered_map<PHINode*, ReaderSet> readers;
+	SmallPtrSet<BasicBlock*, 16> readingBlocks;
+	SmallPtrSet<BasicBlock*, 4> predecessorSet;
+	SmallVector<PHINode*, 4> order;
+	for (BasicBlock& bb : function)
+	{
+		if (!isa<PHINode>(bb.begin()))
+		{
+			continue;
+		}
+		
+		predecessorSet.clear();
+		predecessorSet.insert(pred_begin(&bb), pred_end(&bb));
+		bool anyCoalesced = false;
+		for (auto iter = bb.begin(); PHINode* phi = dyn_cast<PHINode>(iter); ++iter)
+		{
+			ReaderSet& phiReaders = readers[phi];
+			collectReaders(*phi, phiReaders);
+			readingBlocks.clear();
+			collectReadingBlocks(*phi, phiReaders, readingBlocks);
+			bool canCoalesce = all_of(predecessorSet.begin(), predecessorSet.end(), [&](BasicBlock* pred)
+			{
+				return canAssignOnEdge(*phi, *pred, phiReaders, readingBlocks);
+			});
+			
+			if (canCoalesce)
+			{
+				coalescedPhis.insert(phi);
+				anyCoalesced = true;
+			}
+		}
+		
+		if (!anyCoalesced)
+		{
+			continue;
+		}
+		
+		bool ordered = false;
+		while (!ordered)
+		{
+			ordered = true;
+			for (BasicBlock* pred : predecessorSet)
+			{
+				if (PHINode* cyclic = orderCopies(*pred, bb, coalescedPhis, readers, order))
+				{
+					coalescedPhis.erase(cyclic);
+					ordered = false;
+					break;
+				}
+				copyOrders[{pred, &bb}] = order;
+			}
+		}
+	}
+}
+
 SequenceStatement* FunctionNode::basicBlockToStatement(llvm::BasicBlock &bb)
 {
+	if (!phisCoalesced)
+	{
+		coalescePhis();
+	}
+	
 	SequenceStatement* sequence = context.sequence();
-	// Translate instructions.
+	// Translate instructions. Coalesced Φ nodes are assigned in their predecessors.
 	for (Instruction& inst : bb)
 	{
+		if (auto phi = dyn_cast<PHINode>(&inst))
+		if (coalescedPhis.count(phi) != 0)
+		{
+			continue;
+		}
+		
 		if (Statement* statement = context.statementFor(inst))
 		{
 			sequence->pushBack(statement);
 		}
 	}
 	
-	// Add phi value assignments.
+	// Add phi value assignments, once per successor.
+	auto addCopy = [&](PHINode& phi)
+	{
+		Value& value = *phi.getIncomingValueForBlock(&bb);
+		if (coalescedPhis.count(&phi) == 0)
+		{
+			sequence->pushBack(context.phiAssignment(phi, value));
+		}
+		else if (&value != &phi)
+		{
+			sequence->pushBack(context.coalescedPhiAssignment(phi, value));
+		}
+	};
+	
+	SmallPtrSet<BasicBlock*, 4> visited;
 	for (BasicBlock* successor : successors(&bb))
 	{
-		for (auto phiIter = successor->begin(); PHINode* phi = dyn_cast<PHINode>(phiIter); phiIter++)
+		if (!visited.insert(successor).second)
+		{
+			continue;
+		}
+		
+		auto orderIter = copyOrders.find({&bb, successor});
+		if (orderIter == copyOrders.end())
+		{
+			for (auto phiIter = successor->begin(); PHINode* phi = dyn_cast<PHINode>(phiIter); phiIter++)
+			{
+				addCopy(*phi);
+			}
+		}
+		else
 		{
-			sequence->pushBack(context.phiAssignment(*phi, *phi->getIncomingValueForBlock(&bb)));
+			for (PHINode* phi : orderIter->second)
+			{
+				addCopy(*phi);
+			}
 		}
 	}
 	
 	return sequence;
 }
 
-void FunctionNode::print(llvm::raw_ostream &os)
+const FunctionExpressionType& FunctionNode::createPrototype()
 {
 	const ExpressionType& returnType = context.getType(*function.getReturnType());
 	FunctionExpressionType& functionType = context.createFunction(returnType);
@@ -65,7 +310,16 @@ void FunctionNode::print(llvm::raw_ostream &os)
 	{
 		functionType.append(context.getType(*arg.getType()), arg.getName());
 	}
-	StatementPrintVisitor::declare(os, functionType, function.getName());
+	return functionType;
+}
+
+void FunctionNode::print(llvm::raw_ostream &os)
+{
+	for (const string& alias : md::getAliases(function))
+	{
+		os << "// also " << alias << '\n';
+	}
+	StatementPrintVisitor::declare(os, createPrototype(), function.getName());
 	
 	if (hasBody())
 	{
@@ -26,11 +26,15 @@
 #include "dumb_allocator.h"
 #include "ast_context.h"
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/Function.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include <list>
 #include <unordered_map>
+#include <utility>
 
 // The FunctionNode's lifetime is tied to the lifetime of its memory pool (because the lifetime of almost everything it
 // contains is), but it is not itself intended to be allocated through the DumbAllocator interface. FunctionNode needs
@@ -42,10 +46,19 @@ class FunctionNode
 	DumbAllocator pool;
 	AstContext context;
 	Statement* body;
+	bool overBudget;
+	
+	// Φ nodes that are assigned on their incoming edges directly, instead of through a phi_in variable that is copied
+	// at the beginning of their block, and the order of these assignments on edges where it matters.
+	bool phisCoalesced;
+	llvm::SmallPtrSet<llvm::PHINode*, 16> coalescedPhis;
+	llvm::DenseMap<std::pair<llvm::BasicBlock*, llvm::BasicBlock*>, llvm::SmallVector<llvm::PHINode*, 4>> copyOrders;
+	
+	void coalescePhis();
 	
 public:
 	FunctionNode(llvm::Function& fn)
-	: function(fn), context(pool, fn.getParent()), body(nullptr)
+	: function(fn), context(pool, fn.getParent()), body(nullptr), overBudget(false), phisCoalesced(false)
 	{
 	}
 	
@@ -61,10 +74,16 @@ public:
 		return *function.getReturnType();
 	}
 	
+	const FunctionExpressionType& createPrototype();
+	
 	void setBody(Statement* body) { this->body = body; }
 	Statement* getBody() { return body; }
 	bool hasBody() const { return body != nullptr; }
 	
+	// Functions over the back end's budget are structured with simpler conditions and skip simplification passes.
+	void setOverBudget() { overBudget = true; }
+	bool isOverBudget() const { return overBudget; }
+	
 	void print(llvm::raw_ostream& os);
 	void dump() const;
 };
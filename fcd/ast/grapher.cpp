@@ -27,45 +27,62 @@ using namespace llvm;
 using namespace std;
 
 #pragma mark - AST Graph Node
-AstGraphNode::AstGraphNode(AstGrapher& grapher, Statement* node, llvm::BasicBlock* entry, llvm::BasicBlock* exit)
-: grapher(grapher), entry(entry), exit(exit), node(node)
+AstGraphNode::AstGraphNode(AstGrapher& grapher, Statement* node, llvm::BasicBlock* entry, unsigned entryIndex, llvm::BasicBlock* exit, unsigned exitIndex)
+: grapher(grapher), entry(entry), exit(exit), entryIndex(entryIndex), exitIndex(exitIndex), node(node)
 {
 	assert(node && entry);
 }
 
 #pragma mark - AST Grapher
+constexpr unsigned AstGrapher::noIndex;
+
 void AstGrapher::createRegion(llvm::BasicBlock &bb, Statement &node)
 {
-	nodeStorage.emplace_back(*this, &node, &bb, &bb);
-	nodeByEntry[&bb] = &node;
-	graphNodeByAstNode[&node] = &nodeStorage.back();
+	// Successors are indexed lazily, once every block has an index.
+	assert(successorIndices.empty() && "regions must be created before the graph is walked");
+	unsigned index = size();
+	bool inserted = blockIndices.insert({&bb, index}).second;
+	assert(inserted && "block already has a region");
+	(void)inserted;
+	
+	blocks.push_back(&bb);
+	nodeStorage.emplace_back(*this, &node, &bb, index, &bb, index);
+	nodesByIndex.push_back(&nodeStorage.back());
 }
 
 void AstGrapher::updateRegion(llvm::BasicBlock &entry, llvm::BasicBlock *exit, Statement &node)
 {
-	nodeStorage.emplace_back(*this, &node, &entry, exit);
-	nodeByEntry[&entry] = &node;
-	graphNodeByAstNode[&node] = &nodeStorage.back();
+	unsigned entryIndex = getIndex(&entry);
+	assert(entryIndex != noIndex);
+	nodeStorage.emplace_back(*this, &node, &entry, entryIndex, exit, getIndex(exit));
+	nodesByIndex[entryIndex] = &nodeStorage.back();
 }
 
-AstGraphNode* AstGrapher::getGraphNode(Statement* node)
+unsigned AstGrapher::getIndex(const llvm::BasicBlock* block) const
 {
-	auto iter = graphNodeByAstNode.find(node);
-	if (iter != graphNodeByAstNode.end())
+	if (block != nullptr)
 	{
-		return iter->second;
+		auto iter = blockIndices.find(block);
+		if (iter != blockIndices.end())
+		{
+			return iter->second;
+		}
 	}
-	
-	return nullptr;
+	return noIndex;
 }
 
-AstGraphNode* AstGrapher::getGraphNodeFromEntry(llvm::BasicBlock* block)
+ArrayRef<unsigned> AstGrapher::getSuccessorIndices(unsigned index)
 {
-	auto nodeIter = nodeByEntry.find(block);
-	if (nodeIter != nodeByEntry.end())
+	if (successorIndices.size() != blocks.size())
 	{
-		return getGraphNode(nodeIter->second);
+		successorIndices.resize(blocks.size());
+		for (unsigned i = 0; i < blocks.size(); ++i)
+		{
+			for (BasicBlock* succ : successors(blocks[i]))
+			{
+				successorIndices[i].push_back(getIndex(succ));
+			}
+		}
 	}
-	
-	return nullptr;
+	return successorIndices[index];
 }
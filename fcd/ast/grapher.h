@@ -25,11 +25,14 @@
 #include "statements.h"
 #include "dumb_allocator.h"
 
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/CFG.h>
 #include <llvm/Support/raw_ostream.h>
 
-#include <unordered_map>
 #include <deque>
+#include <vector>
 
 class AstGrapher;
 
@@ -48,31 +51,52 @@ class AstGraphNode
 	// successors. This state is temporary.
 	llvm::BasicBlock* exit;
 	
+	unsigned entryIndex;
+	unsigned exitIndex;
+	
 public:
 	Statement* node;
 	
-	AstGraphNode(AstGrapher& grapher, Statement* node, llvm::BasicBlock* entry, llvm::BasicBlock* exit);
+	AstGraphNode(AstGrapher& grapher, Statement* node, llvm::BasicBlock* entry, unsigned entryIndex, llvm::BasicBlock* exit, unsigned exitIndex);
 	
 	inline llvm::BasicBlock* getEntry() { return entry; }
 	inline const llvm::BasicBlock* getEntry() const { return entry; }
 	inline llvm::BasicBlock* getExit() { return exit; }
 	inline bool hasExit() const { return entry != exit; }
+	
+	inline unsigned getEntryIndex() const { return entryIndex; }
+	inline unsigned getExitIndex() const { return exitIndex; }
 };
 
+// Blocks get a dense index when their first region is created (which should happen for every reachable block before
+// anything is structured). Graph nodes and block successors are stored in flat vectors by that index, so that walking
+// the graph doesn't need to hash anything.
 class AstGrapher
 {
 	std::deque<AstGraphNode> nodeStorage;
-	std::unordered_map<llvm::BasicBlock*, Statement*> nodeByEntry;
-	std::unordered_map<Statement*, AstGraphNode*> graphNodeByAstNode;
+	std::vector<llvm::BasicBlock*> blocks;
+	std::vector<AstGraphNode*> nodesByIndex;
+	std::vector<llvm::SmallVector<unsigned, 2>> successorIndices;
+	llvm::DenseMap<const llvm::BasicBlock*, unsigned> blockIndices;
 	
 public:
 	typedef decltype(nodeStorage)::const_iterator const_iterator;
 	
+	static constexpr unsigned noIndex = ~0u;
+	
 	void createRegion(llvm::BasicBlock& entry, Statement& node);
 	void updateRegion(llvm::BasicBlock& entry, llvm::BasicBlock* exit, Statement& node);
 	
-	AstGraphNode* getGraphNode(Statement* node);
-	AstGraphNode* getGraphNodeFromEntry(llvm::BasicBlock* block);
+	// Returns noIndex for nullptr (the end of the function) and for blocks that have no region.
+	unsigned getIndex(const llvm::BasicBlock* block) const;
+	unsigned size() const { return static_cast<unsigned>(blocks.size()); }
+	
+	llvm::BasicBlock* getBlock(unsigned index) { return index == noIndex ? nullptr : blocks[index]; }
+	AstGraphNode* getGraphNode(unsigned index) { return index == noIndex ? nullptr : nodesByIndex[index]; }
+	AstGraphNode* getGraphNodeFromEntry(llvm::BasicBlock* block) { return getGraphNode(getIndex(block)); }
+	
+	// Indices of the CFG successors of a block, in terminator order.
+	llvm::ArrayRef<unsigned> getSuccessorIndices(unsigned index);
 	
 	inline const_iterator begin() const { return nodeStorage.begin(); }
 	inline const_iterator end() const { return nodeStorage.end(); }
@@ -39,7 +39,7 @@ namespace
 	}
 }
 
-Statement* AstFunctionPass::append(Statement* a, Statement* b)
+Statement* AstFunctionPass::append(AstContext& context, Statement* a, Statement* b)
 {
 	if (a == nullptr)
 	{
@@ -51,7 +51,7 @@ Statement* AstFunctionPass::append(Statement* a, Statement* b)
 		return a;
 	}
 	
-	SequenceStatement* seq = context().sequence();
+	SequenceStatement* seq = context.sequence();
 	pushAll(*seq, *a);
 	pushAll(*seq, *b);
 	return seq;
@@ -65,14 +65,18 @@ void AstModulePass::run(deque<unique_ptr<FunctionNode>>& fn)
 	}
 }
 
+void AstFunctionPass::runOnFunction(FunctionNode& fn)
+{
+	if ((runOnDeclarations || fn.hasBody()) && !(fn.isOverBudget() && isSimplification()))
+	{
+		doRun(fn);
+	}
+}
+
 void AstFunctionPass::doRun(deque<unique_ptr<FunctionNode>>& list)
 {
 	for (unique_ptr<FunctionNode>& fn : list)
 	{
-		if (runOnDeclarations || fn->hasBody())
-		{
-			this->fn = fn.get();
-			doRun(*fn);
-		}
+		runOnFunction(*fn);
 	}
 }
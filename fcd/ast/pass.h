@@ -34,20 +34,27 @@ protected:
 	
 public:
 	virtual const char* getName() const = 0;
+	virtual bool isFunctionPass() const { return false; }
 	void run(std::deque<std::unique_ptr<FunctionNode>>& functions);
+	
+	// Module passes that only need to see functions one at a time, in order, can support streaming. The back end then
+	// calls beginStreaming, runOnStreamedFunction for every function, and endStreaming, instead of run.
+	virtual bool supportsStreaming() const { return false; }
+	virtual void beginStreaming() {}
+	virtual void runOnStreamedFunction(FunctionNode& function) {}
+	virtual void endStreaming() {}
 	virtual ~AstModulePass() = default;
 };
 
+// Function passes can be run on several functions at once from different threads, so they must not keep
+// per-function state in members.
 class AstFunctionPass : public AstModulePass
 {
-	FunctionNode* fn;
 	bool runOnDeclarations;
 	
 protected:
-	AstContext& context() { return fn->getContext(); }
-	
 	// Transformation helpers.
-	Statement* append(Statement* a, Statement* b);
+	static Statement* append(AstContext& context, Statement* a, Statement* b);
 	
 	virtual void doRun(std::deque<std::unique_ptr<FunctionNode>>& function) override final;
 	virtual void doRun(FunctionNode& function) = 0;
@@ -58,6 +65,12 @@ public:
 	{
 	}
 	
+	virtual bool isFunctionPass() const override final { return true; }
+	
+	// Simplifications only make the output nicer. They don't run on functions that are over budget.
+	virtual bool isSimplification() const { return false; }
+	void runOnFunction(FunctionNode& function);
+	
 	virtual ~AstFunctionPass() = default;
 };
 
@@ -24,8 +24,13 @@
 #include "grapher.h"
 #include "metadata.h"
 #include "passes.h"
+#include "progress.h"
+#include "rooted_post_dom_tree.h"
+#include "trace_events.h"
 
 #include <llvm/IR/Constants.h>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/Statistic.h>
 #include <llvm/ADT/DepthFirstIterator.h>
 #include <llvm/ADT/PostOrderIterator.h>
 #include <llvm/Analysis/RegionInfo.h>
@@ -33,6 +38,7 @@
 #include <llvm/Support/raw_os_ostream.h>
 
 #include <algorithm>
+#include <chrono>
 #include <deque>
 #include <unordered_set>
 #include <vector>
@@ -40,6 +46,15 @@
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "fcd-backend"
+
+STATISTIC(FunctionsOverBudget, "Functions structured without simplifying conditions");
+STATISTIC(AcyclicRegionsStructured, "Acyclic regions turned into sequences of conditionals");
+STATISTIC(CyclicRegionsStructured, "Cyclic regions turned into endless loops");
+STATISTIC(ReachingPathsExtended, "Products of reaching conditions extended along an edge");
+STATISTIC(ConditionsOverExpansionLimit, "Reaching conditions left as a sum because their product of sums was too large");
+STATISTIC(ConditionsOverTruthTableLimit, "Reaching conditions simplified without truth tables because they had too many terms");
+
 #ifdef DEBUG
 #pragma mark Debug
 extern void print(raw_ostream& os, const SmallVector<Expression*, 4>& expressionList, const char* elemSep)
@@ -104,77 +119,377 @@ namespace
 		return nary;
 	}
 	
+	// Computes the condition under which each node of a region is reached, as a sum of products. Nodes are visited in
+	// topological order (back edges are ignored), and the products of a node are the products of its predecessors,
+	// each ANDed with the condition of the edge that leads to the node. Products are bitsets over the region's branch
+	// conditions, with one bit for each polarity of a condition. This makes it cheap to reduce `a & x | a & !x` and
+	// `a | a & x` to `a` as products are formed, so that diamonds don't multiply the number of products like the
+	// number of paths.
 	class ReachingConditions
 	{
+		typedef BitVector Product;
+		
+		struct Edge
+		{
+			AstGraphNode* target;
+			int literal; // -1 if the edge is unconditional
+		};
+		
 	public:
 		unordered_map<Statement*, SmallVector<SmallVector<Expression*, 4>, 4>> conditions;
 		
 	private:
 		AstGrapher& grapher;
 		FunctionNode& output;
+		unordered_map<Expression*, unsigned> atomIndices;
+		SmallVector<Expression*, 16> atoms;
 		
-		void build(AstGraphNode* currentNode, SmallVector<Expression*, 4>& conditionStack, vector<AstGraphNode*>& visitStack)
+		unsigned literalFor(Expression* condition)
 		{
-			// Ignore back edges.
-			if (find(visitStack.begin(), visitStack.end(), currentNode) != visitStack.end())
+			bool negated = false;
+			if (auto unary = dyn_cast<UnaryOperatorExpression>(condition))
+			if (unary->getType() == UnaryOperatorExpression::LogicalNegate)
 			{
-				return;
+				condition = unary->getOperand();
+				negated = true;
 			}
 			
-			visitStack.push_back(currentNode);
-			conditions[currentNode->node].push_back(conditionStack);
-			if (currentNode->hasExit())
+			auto result = atomIndices.insert({condition, static_cast<unsigned>(atoms.size())});
+			if (result.second)
+			{
+				atoms.push_back(condition);
+			}
+			return result.first->second * 2 + (negated ? 1 : 0);
+		}
+		
+		void collectEdges(AstGraphNode* node, SmallVectorImpl<Edge>& edges)
+		{
+			if (node->hasExit())
 			{
 				// Exit reached by sequentially following structured region. No additional condition here.
-				build(grapher.getGraphNodeFromEntry(currentNode->getExit()), conditionStack, visitStack);
+				edges.push_back({grapher.getGraphNode(node->getExitIndex()), -1});
+				return;
 			}
-			else
+			
+			// Exit is unstructured. New conditions may apply.
+			auto terminator = node->getEntry()->getTerminator();
+			if (auto branch = dyn_cast<BranchInst>(terminator))
 			{
-				// Exit is unstructured. New conditions may apply.
-				auto terminator = currentNode->getEntry()->getTerminator();
-				if (auto branch = dyn_cast<BranchInst>(terminator))
+				auto successors = grapher.getSuccessorIndices(node->getEntryIndex());
+				if (branch->isConditional())
 				{
-					if (branch->isConditional())
+					int literal = static_cast<int>(literalFor(output.valueFor(*branch->getCondition())));
+					edges.push_back({grapher.getGraphNode(successors[0]), literal});
+					edges.push_back({grapher.getGraphNode(successors[1]), literal ^ 1});
+				}
+				else
+				{
+					edges.push_back({grapher.getGraphNode(successors[0]), -1});
+				}
+			}
+			else if (!isa<ReturnInst>(terminator) && !isa<UnreachableInst>(terminator))
+			{
+				llvm_unreachable("implement missing terminator type");
+			}
+		}
+		
+		static bool differByOnePolarity(const Product& a, const Product& b)
+		{
+			Product difference = a;
+			difference ^= b;
+			int first = difference.find_first();
+			return first >= 0 && (first & 1) == 0 && difference.count() == 2 && difference.test(first + 1);
+		}
+		
+		// Sums never contain a product that is implied by another one. Products that only differ by the polarity of a
+		// single condition are merged.
+		static void addProduct(SmallVectorImpl<Product>& sum, Product product)
+		{
+			size_t i = 0;
+			while (i < sum.size())
+			{
+				Product& existing = sum[i];
+				if (!existing.test(product))
+				{
+					// `existing` is a subset of `product`.
+					return;
+				}
+				
+				bool merge = differByOnePolarity(existing, product);
+				if (merge || !product.test(existing))
+				{
+					// Either `product` is a subset of `existing`, or both can be merged into a product with fewer
+					// terms. The result might combine with products that were already looked at.
+					if (merge)
+					{
+						product &= existing;
+					}
+					sum.erase(sum.begin() + i);
+					i = 0;
+				}
+				else
+				{
+					++i;
+				}
+			}
+			sum.push_back(move(product));
+		}
+		
+	public:
+		ReachingConditions(FunctionNode& output, AstGrapher& grapher)
+		: grapher(grapher), output(output)
+		{
+		}
+		
+		// `order` is the region in reverse post-order, without its exit node.
+		void buildSumsOfProducts(const vector<AstGraphNode*>& order)
+		{
+			if (order.empty())
+			{
+				return;
+			}
+			
+			// Position of each node in `order`, by block index.
+			const size_t notInRegion = ~size_t(0);
+			vector<size_t> positions(grapher.size(), notInRegion);
+			vector<SmallVector<Edge, 2>> edges(order.size());
+			for (size_t i = 0; i < order.size(); ++i)
+			{
+				positions[order[i]->getEntryIndex()] = i;
+				collectEdges(order[i], edges[i]);
+			}
+			
+			vector<SmallVector<Product, 4>> sums(order.size());
+			sums[0].emplace_back(atoms.size() * 2);
+			for (size_t i = 0; i < order.size(); ++i)
+			{
+				for (const Edge& edge : edges[i])
+				{
+					// Skip the region exit (which isn't part of the order) and back edges.
+					size_t target = edge.target == nullptr ? notInRegion : positions[edge.target->getEntryIndex()];
+					if (target == notInRegion || target <= i)
 					{
-						Expression* trueExpr = output.valueFor(*branch->getCondition());
-						conditionStack.push_back(trueExpr);
-						build(grapher.getGraphNodeFromEntry(branch->getSuccessor(0)), conditionStack, visitStack);
-						conditionStack.pop_back();
-						
-						Expression* falseExpr = output.getContext().negate(trueExpr);
-						conditionStack.push_back(falseExpr);
-						build(grapher.getGraphNodeFromEntry(branch->getSuccessor(1)), conditionStack, visitStack);
-						conditionStack.pop_back();
+						continue;
 					}
-					else
+					
+					for (const Product& product : sums[i])
 					{
-						// Unconditional branch
-						build(grapher.getGraphNodeFromEntry(branch->getSuccessor(0)), conditionStack, visitStack);
+						Product extended = product;
+						if (edge.literal >= 0)
+						{
+							extended.set(static_cast<unsigned>(edge.literal));
+						}
+						addProduct(sums[target], move(extended));
+						++ReachingPathsExtended;
 					}
 				}
-				else if (!isa<ReturnInst>(terminator) && !isa<UnreachableInst>(terminator))
+			}
+			
+			AstContext& ctx = output.getContext();
+			for (size_t i = 0; i < order.size(); ++i)
+			{
+				auto& sumOfProducts = conditions[order[i]->node];
+				for (const Product& product : sums[i])
 				{
-					llvm_unreachable("implement missing terminator type");
+					sumOfProducts.emplace_back();
+					for (int literal = product.find_first(); literal >= 0; literal = product.find_next(literal))
+					{
+						Expression* atom = atoms[literal / 2];
+						sumOfProducts.back().push_back((literal & 1) == 0 ? atom : ctx.negate(atom));
+					}
 				}
 			}
-			visitStack.pop_back();
 		}
+	};
+	
+	// Conditions are simplified with truth tables when they involve at most this many distinct terms.
+	const unsigned maxTruthTableAtoms = 16;
+	
+	// Above this many sums, the product of sums is not built and the sum of products is used as is.
+	const size_t maxExpandedSums = 256;
+	
+	// Truth table of a boolean function of a few atoms: bit `m` is the value of the function when atom `i` is true if
+	// and only if bit `i` of `m` is set.
+	class TruthTable
+	{
+		vector<uint64_t> words;
+		uint64_t lastWordMask;
 		
 	public:
+		TruthTable(unsigned numAtoms, bool value)
+		: words(numAtoms < 6 ? 1 : size_t(1) << (numAtoms - 6), value ? ~uint64_t(0) : 0)
+		, lastWordMask(numAtoms < 6 ? (uint64_t(1) << (1 << numAtoms)) - 1 : ~uint64_t(0))
+		{
+			words.back() &= lastWordMask;
+		}
 		
-		ReachingConditions(FunctionNode& output, AstGrapher& grapher)
-		: grapher(grapher), output(output)
+		static TruthTable literal(unsigned numAtoms, unsigned atom, bool negated)
+		{
+			TruthTable result(numAtoms, false);
+			uint64_t assignments = uint64_t(1) << numAtoms;
+			for (uint64_t m = 0; m < assignments; ++m)
+			{
+				if ((((m >> atom) & 1) != 0) != negated)
+				{
+					result.words[m / 64] |= uint64_t(1) << (m % 64);
+				}
+			}
+			return result;
+		}
+		
+		TruthTable& operator|=(const TruthTable& that)
+		{
+			for (size_t i = 0; i < words.size(); ++i)
+			{
+				words[i] |= that.words[i];
+			}
+			return *this;
+		}
+		
+		TruthTable& operator&=(const TruthTable& that)
+		{
+			for (size_t i = 0; i < words.size(); ++i)
+			{
+				words[i] &= that.words[i];
+			}
+			return *this;
+		}
+		
+		// Whether this function is true everywhere `that` is true.
+		bool impliedBy(const TruthTable& that) const
+		{
+			for (size_t i = 0; i < words.size(); ++i)
+			{
+				if ((that.words[i] & ~words[i]) != 0)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+		
+		bool isTautology() const
 		{
+			for (size_t i = 0; i + 1 < words.size(); ++i)
+			{
+				if (words[i] != ~uint64_t(0))
+				{
+					return false;
+				}
+			}
+			return words.back() == lastWordMask;
 		}
+	};
+	
+	// Terms of sums and products, as negated or non-negated atoms. Atoms that are (structurally) identical share an
+	// index.
+	class TermAtoms
+	{
+		SmallVector<Expression*, 16> atoms;
+		SmallVector<TruthTable, 32> literals;
 		
-		void buildSumsOfProducts(AstGraphNode* regionStart, AstGraphNode* regionEnd)
+	public:
+		pair<unsigned, bool> find(Expression* term)
 		{
-			SmallVector<Expression*, 4> expressionStack;
-			vector<AstGraphNode*> visitStack { regionEnd };
-			build(regionStart, expressionStack, visitStack);
+			bool negated = false;
+			if (auto unary = dyn_cast<UnaryOperatorExpression>(term))
+			if (unary->getType() == UnaryOperatorExpression::LogicalNegate)
+			{
+				term = unary->getOperand();
+				negated = true;
+			}
+			
+			for (unsigned i = 0; i < atoms.size(); ++i)
+			{
+				if (Expression::equal(*atoms[i], *term))
+				{
+					return make_pair(i, negated);
+				}
+			}
+			atoms.push_back(term);
+			return make_pair(static_cast<unsigned>(atoms.size() - 1), negated);
+		}
+		
+		unsigned size() const { return static_cast<unsigned>(atoms.size()); }
+		
+		// Only valid once every atom was found.
+		const TruthTable& literal(Expression* term)
+		{
+			if (literals.empty())
+			{
+				for (unsigned i = 0; i < size(); ++i)
+				{
+					literals.push_back(TruthTable::literal(size(), i, false));
+					literals.push_back(TruthTable::literal(size(), i, true));
+				}
+			}
+			auto atom = find(term);
+			return literals[atom.first * 2 + (atom.second ? 1 : 0)];
 		}
 	};
 	
+	TruthTable truthTableOfSum(TermAtoms& atoms, ArrayRef<Expression*> sum)
+	{
+		TruthTable result(atoms.size(), false);
+		for (Expression* term : sum)
+		{
+			result |= atoms.literal(term);
+		}
+		return result;
+	}
+	
+	// Removes terms and sums that don't change the value of the product. `function` is the value that the product
+	// must keep.
+	void minimizeProductOfSums(TermAtoms& atoms, const TruthTable& function, SmallVector<SmallVector<Expression*, 4>, 4>& productOfSums)
+	{
+		for (auto& sum : productOfSums)
+		{
+			for (size_t i = 0; i < sum.size();)
+			{
+				SmallVector<Expression*, 4> without = sum;
+				without.erase(without.begin() + i);
+				if (truthTableOfSum(atoms, without).impliedBy(function))
+				{
+					sum = move(without);
+				}
+				else
+				{
+					++i;
+				}
+			}
+		}
+		
+		SmallVector<TruthTable, 4> sumTables;
+		for (const auto& sum : productOfSums)
+		{
+			sumTables.push_back(truthTableOfSum(atoms, sum));
+		}
+		
+		for (size_t i = 0; i < productOfSums.size();)
+		{
+			TruthTable others(atoms.size(), true);
+			for (size_t j = 0; j < productOfSums.size(); ++j)
+			{
+				if (j != i)
+				{
+					others &= sumTables[j];
+				}
+			}
+			
+			// Empty sums are always false, but they can only come out of an unsatisfiable function, which reaching
+			// conditions never are.
+			if (productOfSums[i].empty() || sumTables[i].impliedBy(others))
+			{
+				productOfSums.erase(productOfSums.begin() + i);
+				sumTables.erase(sumTables.begin() + i);
+			}
+			else
+			{
+				++i;
+			}
+		}
+	}
+	
 	void expandToProductOfSums(
 		SmallVector<Expression*, 4>& stack,
 		SmallVector<SmallVector<Expression*, 4>, 4>& output,
@@ -197,7 +512,29 @@ namespace
 		}
 	}
 	
-	SmallVector<SmallVector<Expression*, 4>, 4> simplifySumOfProducts(DumbAllocator& pool, SmallVector<SmallVector<Expression*, 4>, 4>& sumOfProducts)
+	// A product with a single sum, which is the whole sum of products. An empty product is always true, and so is the
+	// sum, which then needs no condition.
+	SmallVector<SmallVector<Expression*, 4>, 4> singleSum(AstContext& ctx, const SmallVector<SmallVector<Expression*, 4>, 4>& sumOfProducts)
+	{
+		SmallVector<SmallVector<Expression*, 4>, 4> productOfSums;
+		SmallVector<Expression*, 4> sum;
+		for (const auto& product : sumOfProducts)
+		{
+			if (product.size() == 0)
+			{
+				return productOfSums;
+			}
+			sum.push_back(coalesce(ctx, NAryOperatorExpression::ShortCircuitAnd, product));
+		}
+		
+		if (sum.size() > 0)
+		{
+			productOfSums.push_back(move(sum));
+		}
+		return productOfSums;
+	}
+	
+	SmallVector<SmallVector<Expression*, 4>, 4> simplifySumOfProducts(AstContext& ctx, SmallVector<SmallVector<Expression*, 4>, 4>& sumOfProducts)
 	{
 		if (sumOfProducts.size() == 0)
 		{
@@ -229,7 +566,7 @@ namespace
 				{
 					auto termLocation = find_if(iter->begin(), iter->end(), [&](Expression* that)
 					{
-						return *that == **termIter;
+						return Expression::equal(*that, **termIter);
 					});
 					
 					if (termLocation == iter->end())
@@ -258,12 +595,14 @@ namespace
 				}
 			}
 			
-			// Erase empty products.
+			// Erase empty products. If a product has no term left, the remaining sum is always true.
+			bool alwaysTrue = false;
 			auto possiblyEmptyIter = sumOfProducts.begin();
 			while (possiblyEmptyIter != sumOfProducts.end())
 			{
 				if (possiblyEmptyIter->size() == 0)
 				{
+					alwaysTrue = true;
 					possiblyEmptyIter = sumOfProducts.erase(possiblyEmptyIter);
 				}
 				else
@@ -271,19 +610,69 @@ namespace
 					possiblyEmptyIter++;
 				}
 			}
+			
+			if (alwaysTrue || sumOfProducts.size() == 0)
+			{
+				return productOfSums;
+			}
+		}
+		
+		// Step 2: transform remaining items in sumOfProducts into a product of sums. This multiplies the number of terms
+		// of each product, so give up if that gets too large and keep the sum of products as a single sum.
+		size_t expandedSums = 1;
+		for (const auto& product : sumOfProducts)
+		{
+			expandedSums *= product.size();
+			if (expandedSums > maxExpandedSums)
+			{
+				++ConditionsOverExpansionLimit;
+				auto sum = singleSum(ctx, sumOfProducts);
+				productOfSums.append(sum.begin(), sum.end());
+				return productOfSums;
+			}
 		}
 		
-		// Step 2: transform remaining items in sumOfProducts into a product of sums.
+		SmallVector<SmallVector<Expression*, 4>, 4> expandedSumsOfTerms;
 		auto& firstProduct = sumOfProducts.front();
 		decltype(productOfSums)::value_type stack;
 		for (Expression* expr : firstProduct)
 		{
 			stack.push_back(expr);
-			expandToProductOfSums(stack, productOfSums, sumOfProducts.begin() + 1, sumOfProducts.end());
+			expandToProductOfSums(stack, expandedSumsOfTerms, sumOfProducts.begin() + 1, sumOfProducts.end());
 			stack.pop_back();
 		}
 		
-		// Step 3: visit each sum and delete those in which we find a `A | ~A` tautology.
+		// Step 3: with few enough distinct terms, remove terms and sums that don't change the result using truth tables.
+		TermAtoms atoms;
+		for (const auto& product : sumOfProducts)
+		{
+			for (Expression* term : product)
+			{
+				atoms.find(term);
+			}
+		}
+		
+		if (atoms.size() <= maxTruthTableAtoms)
+		{
+			TruthTable function(atoms.size(), false);
+			for (const auto& product : sumOfProducts)
+			{
+				TruthTable productTable(atoms.size(), true);
+				for (Expression* term : product)
+				{
+					productTable &= atoms.literal(term);
+				}
+				function |= productTable;
+			}
+			
+			minimizeProductOfSums(atoms, function, expandedSumsOfTerms);
+			productOfSums.append(expandedSumsOfTerms.begin(), expandedSumsOfTerms.end());
+			return productOfSums;
+		}
+		
+		// Otherwise, visit each sum and delete those in which we find a `A | ~A` tautology.
+		++ConditionsOverTruthTableLimit;
+		productOfSums.append(expandedSumsOfTerms.begin(), expandedSumsOfTerms.end());
 		auto sumIter = productOfSums.begin();
 		while (sumIter != productOfSums.end())
 		{
@@ -300,7 +689,7 @@ namespace
 					e = negated->getOperand();
 					negation = find_if(iter + 1, end, [&](Expression* that)
 					{
-						return *that == *e;
+						return Expression::equal(*that, *e);
 					});
 				}
 				else
@@ -310,7 +699,7 @@ namespace
 						if (auto negated = dyn_cast<UnaryOperatorExpression>(that))
 						{
 							assert(negated->getType() == UnaryOperatorExpression::LogicalNegate);
-							return *negated->getOperand() == *e;
+							return Expression::equal(*negated->getOperand(), *e);
 						}
 						return false;
 					});
@@ -347,31 +736,36 @@ namespace
 	}
 	
 #pragma mark - Graph stuff
-	void postOrder(AstGrapher& grapher, vector<Statement*>& into, unordered_set<AstGraphNode*>& visited, AstGraphNode* current, AstGraphNode* exit)
+	void postOrder(AstGrapher& grapher, vector<AstGraphNode*>& into, BitVector& visited, AstGraphNode* current)
 	{
-		if (visited.count(current) == 0)
+		// A null node is the end of the function.
+		if (current != nullptr && !visited.test(current->getEntryIndex()))
 		{
-			visited.insert(current);
+			visited.set(current->getEntryIndex());
 			if (current->hasExit())
 			{
-				postOrder(grapher, into, visited, grapher.getGraphNodeFromEntry(current->getExit()), exit);
+				postOrder(grapher, into, visited, grapher.getGraphNode(current->getExitIndex()));
 			}
 			else
 			{
-				for (auto succ : successors(current->getEntry()))
+				for (unsigned succ : grapher.getSuccessorIndices(current->getEntryIndex()))
 				{
-					postOrder(grapher, into, visited, grapher.getGraphNodeFromEntry(succ), exit);
+					postOrder(grapher, into, visited, grapher.getGraphNode(succ));
 				}
 			}
-			into.push_back(current->node);
+			into.push_back(current);
 		}
 	}
 	
-	vector<Statement*> reversePostOrder(AstGrapher& grapher, AstGraphNode* entry, AstGraphNode* exit)
+	vector<AstGraphNode*> reversePostOrder(AstGrapher& grapher, AstGraphNode* entry, AstGraphNode* exit)
 	{
-		vector<Statement*> result;
-		unordered_set<AstGraphNode*> visited { exit };
-		postOrder(grapher, result, visited, entry, exit);
+		vector<AstGraphNode*> result;
+		BitVector visited(grapher.size());
+		if (exit != nullptr)
+		{
+			visited.set(exit->getEntryIndex());
+		}
+		postOrder(grapher, result, visited, entry);
 		reverse(result.begin(), result.end());
 		return result;
 	}
@@ -417,21 +811,28 @@ namespace
 	
 	SequenceStatement* structurizeRegion(FunctionNode& output, AstGrapher& grapher, BasicBlock& entry, BasicBlock* exit)
 	{
+		AstContext& ctx = output.getContext();
 		AstGraphNode* astEntry = grapher.getGraphNodeFromEntry(&entry);
 		AstGraphNode* astExit = grapher.getGraphNodeFromEntry(exit);
 		
+		// Nodes are handled in topological order (reverse postorder). We can't use LLVM's ReversePostOrderTraversal class
+		// here because we're working with a subgraph.
+		vector<AstGraphNode*> order = reversePostOrder(grapher, astEntry, astExit);
+		
 		// Build reaching conditions.
 		ReachingConditions reach(output, grapher);
-		reach.buildSumsOfProducts(astEntry, astExit);
+		reach.buildSumsOfProducts(order);
 		
-		// Structure nodes into `if` statements using reaching conditions. Traverse nodes in topological order (reverse
-		// postorder). We can't use LLVM's ReversePostOrderTraversal class here because we're working with a subgraph.
+		// Structure nodes into `if` statements using reaching conditions.
 		SequenceStatement* sequence = output.getContext().sequence();
 		
-		for (Statement* node : reversePostOrder(grapher, astEntry, astExit))
+		for (AstGraphNode* graphNode : order)
 		{
+			Statement* node = graphNode->node;
 			auto& path = reach.conditions.at(node);
-			SmallVector<SmallVector<Expression*, 4>, 4> productOfSums = simplifySumOfProducts(output.getPool(), path);
+			SmallVector<SmallVector<Expression*, 4>, 4> productOfSums = output.isOverBudget()
+				? singleSum(ctx, path)
+				: simplifySumOfProducts(ctx, path);
 			
 			Statement* toInsert = node;
 			for (auto iter = productOfSums.rbegin(); iter != productOfSums.rend(); iter++)
@@ -448,78 +849,140 @@ namespace
 		return sequence;
 	}
 	
-#pragma mark - Post-Dominator Tree with Arbitrary Roots
-	// This is a fairly nasty hack that hinges on protected members of DominatorTreeBase.
-	// We need it because the post-dominator tree can't find roots on a function with an endless loop.
-	class RootedPostDominatorTree : public DominatorTreeBase<BasicBlock>
+#pragma mark - Other Helpers
+	typedef deque<unique_ptr<AstModulePass>>::iterator PassIterator;
+	
+	uint64_t getVirtualAddress(const Function& fn)
+	{
+		if (auto address = md::getVirtualAddress(fn))
+		{
+			return address->getLimitedValue();
+		}
+		return 0;
+	}
+	
+	bool isOverBudget(const Function& fn, const AstBackEnd::Budget& budget)
 	{
-	public:
-		RootedPostDominatorTree()
-		: DominatorTreeBase<BasicBlock>(true)
+		if (budget.maxBlocks != 0 && fn.size() > budget.maxBlocks)
 		{
+			return true;
 		}
 		
-		void recalculateWithRoots(Function& fn, const SmallVectorImpl<BasicBlock*>& roots)
+		if (budget.maxInstructions != 0)
 		{
-			reset();
-			Vertex.push_back(nullptr);
-			for (BasicBlock* bb : roots)
+			size_t instructions = 0;
+			for (const BasicBlock& bb : fn)
 			{
-				assert(bb->getParent() == &fn);
-				addRoot(bb);
+				instructions += bb.size();
+				if (instructions > budget.maxInstructions)
+				{
+					return true;
+				}
 			}
-			Calculate<Function, Inverse<BasicBlock*>>(*this, fn);
 		}
-		
-		static void treeFromIncompleteTree(Function& fn, unique_ptr<DominatorTreeBase<BasicBlock>>& postDomTree)
+		return false;
+	}
+	
+	size_t countLocalValues(const Function& fn)
+	{
+		size_t count = fn.arg_size();
+		for (const BasicBlock& bb : fn)
 		{
-			SmallVector<BasicBlock*, 1> roots;
-			// Find loops, check if they have a node in the existing post-dominator tree. If not, we need a new tree.
-			auto loops = SESELoop::findBackEdgeDestinations(fn.getEntryBlock());
-			
-			// According to this Chris Dodd person, you get an okay post-dominator tree just by picking missing
-			// nodes at random. Let's see how that works.
-			// http://stackoverflow.com/a/35400454/251153
-			for (const auto& pair : loops)
+			count += bb.size();
+		}
+		return count;
+	}
+	
+	void structureFunctions(deque<unique_ptr<FunctionNode>>& nodes, PassIterator passBegin, PassIterator passEnd, TaskScheduler* scheduler, const AstBackEnd::Budget& budget, PhaseStatistics* stats);
+	
+	// Once structured, nothing reads the IR of a function: AST passes and printers only need its type, arguments and
+	// metadata. deleteBody also clears function metadata, which is put back on the declaration that remains. This
+	// runs between scheduler runs, since metadata lives in the LLVMContext.
+	bool releaseFunctionBodies(deque<unique_ptr<FunctionNode>>& nodes)
+	{
+		bool changed = false;
+		SmallVector<pair<unsigned, MDNode*>, 8> metadata;
+		for (unique_ptr<FunctionNode>& node : nodes)
+		{
+			Function& fn = node->getFunction();
+			if (!node->hasBody() || fn.isDeclaration())
 			{
-				if (postDomTree->getNode(pair.first) == nullptr)
-				{
-					roots.push_back(pair.first);
-				}
+				continue;
 			}
 			
-			if (roots.size() != 0)
+			node->getContext().forgetValues();
+			fn.getAllMetadata(metadata);
+			fn.deleteBody();
+			for (const auto& pair : metadata)
 			{
-				// add the tree's original roots too (in case it had any)
-				const auto& originalRoots = postDomTree->getRoots();
-				roots.insert(roots.end(), originalRoots.begin(), originalRoots.end());
-				
-				auto result = std::make_unique<RootedPostDominatorTree>();
-				result->recalculateWithRoots(fn, roots);
-				postDomTree = move(result);
+				fn.setMetadata(pair.first, pair.second);
 			}
+			changed = true;
 		}
-	};
+		return changed;
+	}
 	
-	BasicBlock* postDominatorOf(DominatorTreeBase<BasicBlock>& postDomTree, BasicBlock& bb)
+	// Runs passes in order. Function passes don't look at other functions, so consecutive function passes go through a
+	// function back to back, while its AST is still in cache, before moving to the next function.
+	void runPasses(deque<unique_ptr<FunctionNode>>& nodes, PassIterator passBegin, PassIterator passEnd)
 	{
-		if (auto node = postDomTree.getNode(&bb))
-		if (auto idom = node->getIDom())
+		auto iter = passBegin;
+		while (iter != passEnd)
 		{
-			return idom->getBlock();
+			if (!(*iter)->isFunctionPass())
+			{
+				(*iter)->run(nodes);
+				++iter;
+				continue;
+			}
+			
+			auto functionPassesEnd = find_if(iter, passEnd, [](unique_ptr<AstModulePass>& pass)
+			{
+				return !pass->isFunctionPass();
+			});
+			for (unique_ptr<FunctionNode>& node : nodes)
+			{
+				for (auto functionPass = iter; functionPass != functionPassesEnd; ++functionPass)
+				{
+					static_cast<AstFunctionPass&>(**functionPass).runOnFunction(*node);
+				}
+			}
+			iter = functionPassesEnd;
 		}
-		return nullptr;
 	}
 	
-#pragma mark - Other Helpers
-	uint64_t getVirtualAddress(FunctionNode& node)
+#pragma mark - Function Structurizer
+	// Holds the state needed to structure a single function, so that several functions can be structured at once.
+	class FunctionStructurizer
 	{
-		if (auto address = md::getVirtualAddress(node.getFunction()))
+		enum RegionType
+		{
+			NotARegion, // Entry and exit don't form a region
+			Acyclic, // Entry and exit form a region, and no node in the region goes back to the region header
+			Cyclic, // Entry and exit form a region, and at least one node in the region goes back to the region header
+		};
+		
+		FunctionNode* output;
+		unsigned maxMilliseconds;
+		unique_ptr<AstGrapher> grapher;
+		unique_ptr<DominatorTree> domTree;
+		unique_ptr<DominatorTreeBase<BasicBlock>> postDomTree;
+		ForwardDominanceFrontierBase<BasicBlock> frontiers;
+		
+		void runOnLoop(Function& fn, BasicBlock& entry, BasicBlock* exit);
+		void runOnRegion(Function& fn, BasicBlock& entry, BasicBlock* exit);
+		bool frontiersAllowRegion(BasicBlock& entry, BasicBlock* exit);
+		RegionType isRegion(BasicBlock& entry, BasicBlock* exit);
+		
+	public:
+		FunctionStructurizer(FunctionNode& output, unsigned maxMilliseconds)
+		: output(&output), maxMilliseconds(maxMilliseconds), grapher(make_unique<AstGrapher>()), domTree(make_unique<DominatorTree>())
+		, postDomTree(make_unique<DominatorTreeBase<BasicBlock>>(true))
 		{
-			return address->getLimitedValue();
 		}
-		return 0;
-	}
+		
+		void run();
+	};
 }
 
 #pragma mark - AST Pass
@@ -528,8 +991,7 @@ static RegisterPass<AstBackEnd> astBackEnd("#ast-backend", "Produce AST from LLV
 
 void AstBackEnd::getAnalysisUsage(llvm::AnalysisUsage &au) const
 {
-	au.addRequired<DominatorTreeWrapperPass>();
-	au.addRequired<PostDominatorTreeWrapperPass>();
+	// Dominator trees are computed by each FunctionStructurizer: on-the-fly function analyses are not thread-safe.
 	au.setPreservesAll();
 }
 
@@ -539,22 +1001,54 @@ void AstBackEnd::addPass(AstModulePass *pass)
 	passes.emplace_back(pass);
 }
 
+void AstBackEnd::setScheduler(TaskScheduler* taskScheduler)
+{
+	scheduler = taskScheduler;
+}
+
+void AstBackEnd::setStreaming(bool stream)
+{
+	streaming = stream;
+}
+
+void AstBackEnd::setReleaseFunctionBodies(bool release)
+{
+	releaseBodies = release;
+}
+
+void AstBackEnd::setFunctionBudget(const Budget& functionBudget)
+{
+	budget = functionBudget;
+}
+
+void AstBackEnd::setStatistics(PhaseStatistics* statistics)
+{
+	stats = statistics;
+}
+
+void AstBackEnd::setStringLiterals(shared_ptr<const StringLiteralIndex> literals)
+{
+	stringLiterals = move(literals);
+}
+
 bool AstBackEnd::runOnModule(llvm::Module &m)
 {
 	outputNodes.clear();
 	
+	// Metadata kinds are registered in the LLVMContext the first time that they are queried. Query the metadata that
+	// AST functions will need before threads start.
+	vector<Function*> functions;
 	for (Function& fn : m)
 	{
-		outputNodes.emplace_back(new FunctionNode(fn));
-		output = outputNodes.back().get();
-		if (!md::isPrototype(fn))
-		{
-			runOnFunction(fn);
-		}
+		(void)md::getAssemblyString(fn);
+		(void)md::getAliases(fn);
+		(void)md::getVirtualAddress(fn);
+		(void)md::isPrototype(fn);
+		functions.push_back(&fn);
 	}
 	
-	// sort outputNodes by virtual address, then by name
-	sort(outputNodes.begin(), outputNodes.end(), [](unique_ptr<FunctionNode>& a, unique_ptr<FunctionNode>& b)
+	// sort functions by virtual address, then by name
+	sort(functions.begin(), functions.end(), [](Function* a, Function* b)
 	{
 		auto virtA = getVirtualAddress(*a);
 		auto virtB = getVirtualAddress(*b);
@@ -564,7 +1058,7 @@ bool AstBackEnd::runOnModule(llvm::Module &m)
 		}
 		else if (virtA == virtB)
 		{
-			return a->getFunction().getName() < b->getFunction().getName();
+			return a->getName() < b->getName();
 		}
 		else
 		{
@@ -572,18 +1066,156 @@ bool AstBackEnd::runOnModule(llvm::Module &m)
 		}
 	});
 	
-	// run passes
-	for (auto& pass : passes)
+	if (ProgressReporter* progress = ProgressReporter::getActive())
+	{
+		progress->beginStep("structuring", functions.size());
+	}
+	
+	// Function passes that come before the first module pass run right after structuring, on the same thread.
+	auto firstModulePass = find_if(passes.begin(), passes.end(), [](unique_ptr<AstModulePass>& pass)
+	{
+		return !pass->isFunctionPass();
+	});
+	
+	bool canStream = all_of(firstModulePass, passes.end(), [](unique_ptr<AstModulePass>& pass)
 	{
-		pass->run(outputNodes);
+		return pass->isFunctionPass() || pass->supportsStreaming();
+	});
+	
+	if (!streaming || !canStream)
+	{
+		for (Function* fn : functions)
+		{
+			outputNodes.emplace_back(new FunctionNode(*fn));
+			outputNodes.back()->getContext().setStringLiterals(stringLiterals.get());
+		}
+		structureFunctions(outputNodes, passes.begin(), firstModulePass, scheduler, budget, stats);
+		bool changed = releaseBodies && releaseFunctionBodies(outputNodes);
+		runPasses(outputNodes, firstModulePass, passes.end());
+		return changed;
+	}
+	
+	// Streaming: functions go through every pass in batches (one function per job), and are freed once they have
+	// been seen by the last pass.
+	if (functions.size() == 0)
+	{
+		return false;
+	}
+	
+	for (auto iter = firstModulePass; iter != passes.end(); ++iter)
+	{
+		(*iter)->beginStreaming();
+	}
+	
+	bool changed = false;
+	unsigned jobs = scheduler == nullptr ? 1 : scheduler->getJobCount();
+	for (size_t batchBegin = 0; batchBegin < functions.size(); batchBegin += jobs)
+	{
+		size_t batchEnd = min<size_t>(functions.size(), batchBegin + jobs);
+		for (size_t i = batchBegin; i < batchEnd; ++i)
+		{
+			outputNodes.emplace_back(new FunctionNode(*functions[i]));
+			outputNodes.back()->getContext().setStringLiterals(stringLiterals.get());
+		}
+		structureFunctions(outputNodes, passes.begin(), firstModulePass, scheduler, budget, stats);
+		if (releaseBodies)
+		{
+			changed |= releaseFunctionBodies(outputNodes);
+		}
+		
+		for (unique_ptr<FunctionNode>& node : outputNodes)
+		{
+			for (auto iter = firstModulePass; iter != passes.end(); ++iter)
+			{
+				if ((*iter)->isFunctionPass())
+				{
+					static_cast<AstFunctionPass&>(**iter).runOnFunction(*node);
+				}
+				else
+				{
+					(*iter)->runOnStreamedFunction(*node);
+				}
+			}
+		}
+		outputNodes.clear();
 	}
 	
-	return false;
+	for (auto iter = firstModulePass; iter != passes.end(); ++iter)
+	{
+		(*iter)->endStreaming();
+	}
+	return changed;
 }
 
-void AstBackEnd::runOnFunction(llvm::Function& fn)
+namespace
 {
-	grapher.reset(new AstGrapher);
+	void structureFunctions(deque<unique_ptr<FunctionNode>>& nodes, PassIterator passBegin, PassIterator passEnd, TaskScheduler* scheduler, const AstBackEnd::Budget& budget, PhaseStatistics* stats)
+	{
+		// Structuring only applies to functions that aren't prototypes, but function passes can apply to declarations
+		// too.
+		auto work = [=](FunctionNode& node)
+		{
+			auto start = PhaseStatistics::clock::now();
+			TraceSpan span("AstBackEnd::runOnFunction", "backend", node.getFunction());
+			if (!md::isPrototype(node.getFunction()))
+			{
+				if (isOverBudget(node.getFunction(), budget))
+				{
+					node.setOverBudget();
+				}
+				node.getContext().reserveLocalValues(countLocalValues(node.getFunction()));
+				FunctionStructurizer(node, budget.maxStructuringMilliseconds).run();
+			}
+			
+			for (auto iter = passBegin; iter != passEnd; ++iter)
+			{
+				static_cast<AstFunctionPass&>(**iter).runOnFunction(node);
+			}
+			
+			if (stats != nullptr)
+			{
+				stats->functionFinished(node.getFunction(), chrono::duration<double>(PhaseStatistics::clock::now() - start).count());
+			}
+			if (ProgressReporter* progress = ProgressReporter::getActive())
+			{
+				progress->functionFinished();
+			}
+		};
+		
+		if (scheduler == nullptr)
+		{
+			for (unique_ptr<FunctionNode>& node : nodes)
+			{
+				work(*node);
+			}
+		}
+		else
+		{
+			for (unique_ptr<FunctionNode>& node : nodes)
+			{
+				FunctionNode* nodePointer = node.get();
+				scheduler->add([=](unsigned)
+				{
+					work(*nodePointer);
+				});
+			}
+			scheduler->run();
+		}
+		
+		for (unique_ptr<FunctionNode>& node : nodes)
+		{
+			if (node->isOverBudget())
+			{
+				++FunctionsOverBudget;
+				errs() << "warning: " << node->getFunction().getName() << " is over the back end's budget; its output isn't simplified\n";
+			}
+		}
+	}
+}
+
+void FunctionStructurizer::run()
+{
+	Function& fn = output->getFunction();
 	
 	// Before doing anything, create statements for blocks in reverse post-order. This ensures that values exist
 	// before they are used. (Post-order would try to use statements before they were created.)
@@ -596,15 +1228,23 @@ void AstBackEnd::runOnFunction(llvm::Function& fn)
 	// of a cyclic region, process the loop. Otherwise, if the basic block is the start of a single-entry-single-exit
 	// region, process that region.
 	
-	auto& domTreeWrapper = getAnalysis<DominatorTreeWrapperPass>(fn);
-	domTree = &domTreeWrapper.getDomTree();
+	domTree->recalculate(fn);
 	postDomTree->recalculate(fn);
 	RootedPostDominatorTree::treeFromIncompleteTree(fn, postDomTree);
 	
+	// Dominance frontiers only depend on the CFG, which structuring doesn't change.
+	frontiers.analyze(*domTree);
+	
 	// Traverse graph in post-order. Try to detect regions with the post-dominator tree.
-	// Cycles are only considered once.
+	// Cycles are only considered once. Once the time budget is exhausted, the remaining regions get simpler conditions.
+	auto deadline = chrono::steady_clock::now() + chrono::milliseconds(maxMilliseconds);
 	for (BasicBlock* entry : post_order(&fn.getEntryBlock()))
 	{
+		if (maxMilliseconds != 0 && !output->isOverBudget() && chrono::steady_clock::now() > deadline)
+		{
+			output->setOverBudget();
+		}
+		
 		BasicBlock* postDominator = entry;
 		while (postDominator != nullptr)
 		{
@@ -635,7 +1275,7 @@ void AstBackEnd::runOnFunction(llvm::Function& fn)
 	output->setBody(bodyStatement);
 }
 
-void AstBackEnd::runOnLoop(Function& fn, BasicBlock& entry, BasicBlock* exit)
+void FunctionStructurizer::runOnLoop(Function& fn, BasicBlock& entry, BasicBlock* exit)
 {
 	// The SESELoop pass already did the meaningful transformations on the loop region:
 	// it's now a single-entry, single-exit region, loop membership has already been refined, etc.
@@ -647,15 +1287,62 @@ void AstBackEnd::runOnLoop(Function& fn, BasicBlock& entry, BasicBlock* exit)
 	AstContext& ctx = output->getContext();
 	Statement* endlessLoop = ctx.loop(ctx.expressionForTrue(), LoopStatement::PreTested, sequence);
 	grapher->updateRegion(entry, exit, *endlessLoop);
+	++CyclicRegionsStructured;
 }
 
-void AstBackEnd::runOnRegion(Function& fn, BasicBlock& entry, BasicBlock* exit)
+void FunctionStructurizer::runOnRegion(Function& fn, BasicBlock& entry, BasicBlock* exit)
 {
 	SequenceStatement* sequence = structurizeRegion(*output, *grapher, entry, exit);
 	grapher->updateRegion(entry, exit, *sequence);
+	++AcyclicRegionsStructured;
+}
+
+bool FunctionStructurizer::frontiersAllowRegion(BasicBlock& entry, BasicBlock* exit)
+{
+	// If a block of the entry's dominance frontier is reachable from the entry without going through the exit, it is
+	// part of the candidate region without being dominated by the entry. The only other way that a block can be in the
+	// entry's frontier is to be reached through the exit, in which case it is in the exit's frontier too (as long as
+	// the entry dominates the exit). Entry and exit themselves are fine.
+	auto entryFrontier = frontiers.find(&entry);
+	if (entryFrontier == frontiers.end())
+	{
+		return true;
+	}
+	
+	if (exit == nullptr)
+	{
+		for (BasicBlock* frontier : entryFrontier->second)
+		{
+			if (frontier != &entry)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	
+	if (!domTree->dominates(&entry, exit))
+	{
+		return true;
+	}
+	
+	auto exitFrontier = frontiers.find(exit);
+	for (BasicBlock* frontier : entryFrontier->second)
+	{
+		if (frontier == &entry || frontier == exit)
+		{
+			continue;
+		}
+		
+		if (exitFrontier == frontiers.end() || exitFrontier->second.count(frontier) == 0)
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
-AstBackEnd::RegionType AstBackEnd::isRegion(BasicBlock &entry, BasicBlock *exit)
+FunctionStructurizer::RegionType FunctionStructurizer::isRegion(BasicBlock &entry, BasicBlock *exit)
 {
 	// LLVM's algorithm for finding regions (as of this early LLVM 3.7 fork) seems over-eager. For instance, with the
 	// following graph:
@@ -680,16 +1367,32 @@ AstBackEnd::RegionType AstBackEnd::isRegion(BasicBlock &entry, BasicBlock *exit)
 	// region can be reached again without traversing A.
 	// This definition means that B is *excluded* from the region, because B could have predecessors that are not
 	// dominated by A. And I'm okay with it, I like [) ranges. To compensate, nullptr represents the end of a function.
+	//
+	// Most candidate pairs fail the domination check. Dominance frontiers catch a lot of them without walking the
+	// region.
+	if (!frontiersAllowRegion(entry, exit))
+	{
+		return NotARegion;
+	}
 	
 	bool cyclic = false;
-	unordered_set<BasicBlock*> toVisit { &entry };
-	unordered_set<BasicBlock*> visited { exit };
-	SmallVector<BasicBlock*, 2> nodeSuccessors;
+	unsigned entryIndex = grapher->getIndex(&entry);
+	unsigned exitIndex = grapher->getIndex(exit);
+	
+	// `seen` has the blocks that were visited or that are waiting to be.
+	BitVector seen(grapher->size());
+	SmallVector<unsigned, 16> toVisit { entryIndex };
+	seen.set(entryIndex);
+	if (exitIndex != AstGrapher::noIndex)
+	{
+		seen.set(exitIndex);
+	}
+	
 	// Step one: check domination
 	while (toVisit.size() > 0)
 	{
-		auto iter = toVisit.begin();
-		BasicBlock* bb = *iter;
+		unsigned index = toVisit.pop_back_val();
+		BasicBlock* bb = grapher->getBlock(index);
 		
 		// We use `exit = nullptr` to denote that the exit is the end of the function, which post-dominates
 		// every basic block. This is a deviation from the normal LLVM dominator tree behavior, where
@@ -699,75 +1402,73 @@ AstBackEnd::RegionType AstBackEnd::isRegion(BasicBlock &entry, BasicBlock *exit)
 			return NotARegion;
 		}
 		
-		toVisit.erase(iter);
-		visited.insert(bb);
-		
 		// Only visit region successors. This saves times, and saves us from spuriously declaring that regions are
 		// cyclic by skipping cycles that have already been identified.
-		nodeSuccessors.clear();
-		AstGraphNode* graphNode = grapher->getGraphNodeFromEntry(bb);
-		if (graphNode->hasExit())
-		{
-			nodeSuccessors.push_back(graphNode->getExit());
-		}
-		else
-		{
-			nodeSuccessors.insert(nodeSuccessors.end(), succ_begin(bb), succ_end(bb));
-		}
+		AstGraphNode* graphNode = grapher->getGraphNode(index);
+		unsigned regionExit = graphNode->getExitIndex();
+		ArrayRef<unsigned> nodeSuccessors = graphNode->hasExit()
+			? ArrayRef<unsigned>(regionExit)
+			: grapher->getSuccessorIndices(index);
 		
-		for (BasicBlock* succ : nodeSuccessors)
+		for (unsigned succ : nodeSuccessors)
 		{
-			if (visited.count(succ) == 0)
+			if (succ == entryIndex)
 			{
-				toVisit.insert(succ);
+				cyclic = true;
 			}
-			else if (succ == &entry)
+			else if (succ != AstGrapher::noIndex && !seen.test(succ))
 			{
-				cyclic = true;
+				seen.set(succ);
+				toVisit.push_back(succ);
 			}
 		}
 	}
 	
 	// Step two: check that no path starting after the exit goes back into the region without first going through the
 	// entry.
-	unordered_set<BasicBlock*> regionMembers;
-	regionMembers.swap(visited);
-	regionMembers.erase(exit);
-	
-	if (exit != nullptr)
-	{
-		toVisit.insert(succ_begin(exit), succ_end(exit));
-	}
-	
-	visited.insert(&entry);
-	while (toVisit.size() > 0)
+	if (exitIndex != AstGrapher::noIndex)
 	{
-		auto iter = toVisit.begin();
-		BasicBlock* bb = *iter;
+		BitVector regionMembers = seen;
+		regionMembers.reset(exitIndex);
 		
-		if (regionMembers.count(bb) != 0)
+		BitVector queued(grapher->size());
+		queued.set(entryIndex);
+		for (unsigned succ : grapher->getSuccessorIndices(exitIndex))
 		{
-			return NotARegion;
+			if (regionMembers.test(succ))
+			{
+				return NotARegion;
+			}
+			if (!queued.test(succ))
+			{
+				queued.set(succ);
+				toVisit.push_back(succ);
+			}
 		}
 		
-		toVisit.erase(iter);
-		visited.insert(bb);
-		for (BasicBlock* succ : successors(bb))
+		while (toVisit.size() > 0)
 		{
-			if (visited.count(succ) == 0)
+			unsigned index = toVisit.pop_back_val();
+			if (regionMembers.test(index))
+			{
+				return NotARegion;
+			}
+			
+			for (unsigned succ : grapher->getSuccessorIndices(index))
 			{
-				toVisit.insert(succ);
+				if (!queued.test(succ))
+				{
+					queued.set(succ);
+					toVisit.push_back(succ);
+				}
 			}
 		}
 	}
 	
-	return cyclic ? Cyclic : Acyclic;
+		return cyclic ? Cyclic : Acyclic;
 }
 
-INITIALIZE_PASS_BEGIN(AstBackEnd, "astbe", "AST Back-End", true, false)
-INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
-INITIALIZE_PASS_DEPENDENCY(PostDominatorTreeWrapperPass)
-INITIALIZE_PASS_END(AstBackEnd, "astbe", "AST Back-End", true, false)
+INITIALIZE_PASS(AstBackEnd, "astbe", "AST Back-End", true, false)
 
 AstBackEnd* createAstBackEnd()
 {
@@ -32,7 +32,9 @@
 #include "function.h"
 #include "grapher.h"
 #include "pass.h"
+#include "phase_stats.h"
 #include "statements.h"
+#include "task_scheduler.h"
 
 #include <llvm/Analysis/DominanceFrontier.h>
 #include <llvm/Analysis/PostDominators.h>
@@ -46,37 +48,41 @@
 #include <unordered_map>
 #include <unordered_set>
 
+class StringLiteralIndex;
+
 // XXX Make this a legit LLVM backend?
 // Doesn't sound like a bad idea, but I don't really know where to start.
+//
+// Functions are structured, and then go through the AST function passes that come before the first module pass, as
+// tasks of the scheduler, if there is one. Module passes run afterwards on every function, sorted by virtual address.
 class AstBackEnd final : public llvm::ModulePass
 {
-	enum RegionType
+public:
+	// Functions with more instructions or blocks than this, or that take longer than this to structure, get simpler
+	// conditions and skip simplification passes, so that a single huge function can't stall the run. Zero means no
+	// limit.
+	struct Budget
 	{
-		NotARegion, // Entry and exit don't form a region
-		Acyclic, // Entry and exit form a region, and no node in the region goes back to the region header
-		Cyclic, // Entry and exit form a region, and at least one node in the region goes back to the region header
+		size_t maxInstructions;
+		size_t maxBlocks;
+		unsigned maxStructuringMilliseconds;
 	};
 	
+private:
 	std::deque<std::unique_ptr<FunctionNode>> outputNodes;
-	FunctionNode* output;
-	
-	std::unique_ptr<AstGrapher> grapher;
 	std::deque<std::unique_ptr<AstModulePass>> passes;
-	
-	llvm::DominatorTree* domTree;
-	std::unique_ptr<llvm::DominatorTreeBase<llvm::BasicBlock>> postDomTree;
-	
-	inline DumbAllocator& pool() { return output->getPool(); }
-	void runOnFunction(llvm::Function& fn);
-	void runOnLoop(llvm::Function& fn, llvm::BasicBlock& entry, llvm::BasicBlock* exit);
-	void runOnRegion(llvm::Function& fn, llvm::BasicBlock& entry, llvm::BasicBlock* exit);
-	RegionType isRegion(llvm::BasicBlock& entry, llvm::BasicBlock* exit);
+	TaskScheduler* scheduler;
+	bool streaming;
+	bool releaseBodies;
+	Budget budget;
+	PhaseStatistics* stats;
+	std::shared_ptr<const StringLiteralIndex> stringLiterals;
 	
 public:
 	static char ID;
 	
 	inline AstBackEnd()
-	: ModulePass(ID), postDomTree(std::make_unique<llvm::DominatorTreeBase<llvm::BasicBlock>>(true))
+	: ModulePass(ID), scheduler(nullptr), streaming(false), releaseBodies(false), budget{0, 0, 0}, stats(nullptr)
 	{
 	}
 	
@@ -89,6 +95,21 @@ public:
 	virtual bool runOnModule(llvm::Module& m) override;
 	
 	void addPass(AstModulePass* pass);
+	void setScheduler(TaskScheduler* taskScheduler);
+	
+	// When streaming, and every module pass supports it, functions are processed and freed one batch at a time.
+	void setStreaming(bool stream);
+	
+	// When set, the IR of a function is deleted once its AST is built, keeping a declaration with its metadata for
+	// calls and printers. The module can't be used for anything else afterwards.
+	void setReleaseFunctionBodies(bool release);
+	void setFunctionBudget(const Budget& functionBudget);
+	
+	// When set, the time spent structuring each function and running AST function passes on it is recorded there.
+	void setStatistics(PhaseStatistics* statistics);
+	
+	// When set, printers show pointers to these string literals as the literal.
+	void setStringLiterals(std::shared_ptr<const StringLiteralIndex> literals);
 };
 
 AstBackEnd* createAstBackEnd();
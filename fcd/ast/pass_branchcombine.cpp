@@ -23,12 +23,21 @@
 #include "pass_branchcombine.h"
 #include "visitor.h"
 
+#include <llvm/ADT/Statistic.h>
+
 #include <cstring>
 #include <deque>
 
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "fcd-branchcombine"
+
+STATISTIC(SameConditionsMerged, "Consecutive conditionals with the same condition merged");
+STATISTIC(OppositeConditionsMerged, "Consecutive conditionals with opposite conditions merged");
+STATISTIC(NestedConditionsCombined, "Nested conditionals combined into one with a short-circuit condition");
+STATISTIC(LoopConditionsRefined, "Loops that absorbed the condition of a breaking conditional");
+
 namespace
 {
 #pragma mark - ConsecutiveCombiner and helpers
@@ -62,7 +71,7 @@ namespace
 	{
 		auto aInfo = countNegationDepth(a);
 		auto bInfo = countNegationDepth(b);
-		return aInfo.second != bInfo.second && *aInfo.first == *bInfo.first;
+		return aInfo.second != bInfo.second && Expression::equal(*aInfo.first, *bInfo.first);
 	}
 	
 	class ConsecutiveCombiner : public AstVisitor<ConsecutiveCombiner, false, Statement*>
@@ -96,6 +105,25 @@ namespace
 			}
 		}
 		
+		// Bodies of statements that were already visited are simplified: they only need to be moved, not visited
+		// again. Visiting them again would copy them once more for every branch that they are merged with.
+		void takeStatements(deque<NOT_NULL(Statement)>& into, Statement* body)
+		{
+			if (auto seq = dyn_cast_or_null<SequenceStatement>(body))
+			{
+				deque<NOT_NULL(Statement)> statements;
+				seq->disownAll(statements);
+				for (Statement* statement : statements)
+				{
+					takeStatements(into, statement);
+				}
+			}
+			else if (body != nullptr && !isa<NoopStatement>(body))
+			{
+				into.push_back(body);
+			}
+		}
+		
 		Statement* optimizeSequence(deque<NOT_NULL(Statement)>& list)
 		{
 			if (list.size() == 0)
@@ -118,31 +146,34 @@ namespace
 						if (isLogicallySame(*thisIfElse->getCondition(), *lastIfElse->getCondition()))
 						{
 							deque<NOT_NULL(Statement)> result;
-							collectStatements(result, lastIfElse->getIfBody());
-							collectStatements(result, thisIfElse->getIfBody());
+							takeStatements(result, lastIfElse->setIfBody(ctx.noop()));
+							takeStatements(result, thisIfElse->setIfBody(ctx.noop()));
 							lastIfElse->setIfBody(optimizeSequence(result));
 							
 							result.clear();
-							collectStatements(result, lastIfElse->getElseBody());
-							collectStatements(result, thisIfElse->getElseBody());
+							takeStatements(result, lastIfElse->setElseBody(nullptr));
+							takeStatements(result, thisIfElse->setElseBody(nullptr));
 							lastIfElse->setElseBody(optimizeSequence(result));
 							
 							thisIfElse->discardCondition();
+							++SameConditionsMerged;
 							continue;
 						}
 						else if (isLogicallyOpposite(*thisIfElse->getCondition(), *lastIfElse->getCondition()))
 						{
 							deque<NOT_NULL(Statement)> result;
-							collectStatements(result, lastIfElse->getIfBody());
-							collectStatements(result, thisIfElse->getElseBody());
-							lastIfElse->setIfBody(optimizeSequence(result));
+							takeStatements(result, lastIfElse->setIfBody(ctx.noop()));
+							takeStatements(result, thisIfElse->setElseBody(nullptr));
+							Statement* ifBody = optimizeSequence(result);
 							
 							result.clear();
-							collectStatements(result, lastIfElse->getElseBody());
-							collectStatements(result, thisIfElse->getIfBody());
+							takeStatements(result, lastIfElse->setElseBody(nullptr));
+							takeStatements(result, thisIfElse->setIfBody(ctx.noop()));
+							lastIfElse->setIfBody(ifBody);
 							lastIfElse->setElseBody(optimizeSequence(result));
 							
 							thisIfElse->discardCondition();
+							++OppositeConditionsMerged;
 							continue;
 						}
 					}
@@ -370,6 +401,7 @@ namespace
 					outerBody->pushBack(structurizeLoop(*newLoop));
 					outerBody->pushBack(loopSuccessor);
 					breakStatement->getParent()->replaceChild(breakStatement, ctx.noop());
+					++LoopConditionsRefined;
 					return outerBody;
 				}
 			}
@@ -417,6 +449,7 @@ namespace
 					
 					ifElse.setCondition(combined);
 					ifElse.setIfBody(innerBody);
+					++NestedConditionsCombined;
 				}
 			}
 			
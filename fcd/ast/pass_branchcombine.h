@@ -32,6 +32,7 @@ protected:
 	
 public:
 	virtual const char* getName() const override;
+	virtual bool isSimplification() const override { return true; }
 };
 
 #endif /* fcd__ast_pass_branchcombine_h */
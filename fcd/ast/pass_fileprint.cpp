@@ -0,0 +1,192 @@
+//
+// pass_fileprint.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "json_string.h"
+#include "metadata.h"
+#include "pass_fileprint.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Path.h>
+
+#include <algorithm>
+#include <cinttypes>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	// Function names can hold characters that file systems or shells don't like.
+	string fileNameFor(uint64_t address, bool hasAddress, StringRef name)
+	{
+		string fileName;
+		raw_string_ostream fileNameStream(fileName);
+		if (hasAddress)
+		{
+			fileNameStream << format("%" PRIx64, address) << '_';
+		}
+		for (char c : name)
+		{
+			fileNameStream << (isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' ? c : '_');
+		}
+		fileNameStream << ".c";
+		return fileNameStream.str();
+	}
+	
+}
+
+AstFilePrint::AstFilePrint(string directory, const vector<string>& includeList, DecompilationCache* cache)
+: AstFunctionPass(true), directory(move(directory)), cache(cache)
+{
+	raw_string_ostream includesStream(includes);
+	for (const auto& file : includeList)
+	{
+		includesStream << "#include \"" << file << "\"\n";
+	}
+	if (includeList.size() > 0)
+	{
+		includesStream << '\n';
+	}
+	includesStream.flush();
+}
+
+void AstFilePrint::addError(string message)
+{
+	lock_guard<mutex> lock(manifestMutex);
+	if (firstError.empty())
+	{
+		firstError = move(message);
+	}
+}
+
+void AstFilePrint::doRun(FunctionNode& fn)
+{
+	string pseudocode;
+	if (fn.hasBody())
+	{
+		raw_string_ostream pseudocodeStream(pseudocode);
+		fn.print(pseudocodeStream);
+		pseudocodeStream.flush();
+		if (cache != nullptr)
+		{
+			cache->store(fn.getFunction(), pseudocode);
+		}
+	}
+	else if (cache != nullptr)
+	{
+		if (const string* cached = cache->getCachedPseudocode(fn.getFunction()))
+		{
+			pseudocode = *cached;
+		}
+	}
+	
+	if (pseudocode.empty())
+	{
+		return;
+	}
+	
+	const Function& function = fn.getFunction();
+	auto address = md::getVirtualAddress(function);
+	ManifestEntry entry = {
+		address == nullptr ? 0 : address->getLimitedValue(),
+		address != nullptr,
+		function.getName().str(),
+	};
+	entry.fileName = fileNameFor(entry.address, entry.hasAddress, entry.name);
+	
+	SmallString<128> path(directory);
+	sys::path::append(path, entry.fileName);
+	SmallString<128> temporaryPath(path);
+	temporaryPath += ".tmp";
+	{
+		error_code error;
+		raw_fd_ostream output(temporaryPath, error, sys::fs::F_Text);
+		if (error)
+		{
+			addError("can't open " + temporaryPath.str().str() + " for writing: " + error.message());
+			return;
+		}
+		output << includes << pseudocode;
+	}
+	
+	if (error_code error = sys::fs::rename(temporaryPath, path))
+	{
+		addError("can't rename " + temporaryPath.str().str() + ": " + error.message());
+		return;
+	}
+	
+	lock_guard<mutex> lock(manifestMutex);
+	manifest.push_back(move(entry));
+}
+
+const char* AstFilePrint::getName() const
+{
+	return "Print AST to files";
+}
+
+bool AstFilePrint::writeManifest(string& errorMessage)
+{
+	lock_guard<mutex> lock(manifestMutex);
+	sort(manifest.begin(), manifest.end(), [](const ManifestEntry& a, const ManifestEntry& b)
+	{
+		return a.address < b.address || (a.address == b.address && a.name < b.name);
+	});
+	
+	SmallString<128> path(directory);
+	sys::path::append(path, "manifest.json");
+	error_code error;
+	raw_fd_ostream output(path, error, sys::fs::F_Text);
+	if (error)
+	{
+		errorMessage = "can't open " + path.str().str() + " for writing: " + error.message();
+		return false;
+	}
+	
+	output << "{\"functions\": [";
+	for (size_t i = 0; i < manifest.size(); ++i)
+	{
+		const ManifestEntry& entry = manifest[i];
+		output << (i == 0 ? "\n" : ",\n") << "\t{\"address\": ";
+		if (entry.hasAddress)
+		{
+			output << entry.address;
+		}
+		else
+		{
+			output << "null";
+		}
+		output << ", \"name\": ";
+		printJsonString(output, entry.name);
+		output << ", \"file\": ";
+		printJsonString(output, entry.fileName);
+		output << '}';
+	}
+	output << (manifest.size() == 0 ? "]}\n" : "\n]}\n");
+	
+	if (!firstError.empty())
+	{
+		errorMessage = firstError;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,73 @@
+//
+// pass_fileprint.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef fcd__ast_pass_fileprint_h
+#define fcd__ast_pass_fileprint_h
+
+#include "decompilation_cache.h"
+#include "pass.h"
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Prints every function with a body (or with cached pseudocode) to its own <address>_<name>.c file of a directory,
+// after the #include lines that AstPrint would print once. As a function pass, it runs on the thread that structured
+// the function, so functions are printed in parallel. Files are written under a temporary name and renamed once they
+// are complete, so that consumers can pick them up as they appear.
+//
+// writeManifest lists the files that were written, sorted by address, in manifest.json.
+class AstFilePrint final : public AstFunctionPass
+{
+	struct ManifestEntry
+	{
+		uint64_t address;
+		bool hasAddress;
+		std::string name;
+		std::string fileName;
+	};
+	
+	std::string directory;
+	std::string includes;
+	DecompilationCache* cache;
+	
+	std::mutex manifestMutex;
+	std::vector<ManifestEntry> manifest;
+	std::string firstError;
+	
+	void addError(std::string message);
+	
+protected:
+	virtual void doRun(FunctionNode& fn) override;
+	
+public:
+	AstFilePrint(std::string directory, const std::vector<std::string>& includes, DecompilationCache* cache = nullptr);
+	
+	virtual const char* getName() const override;
+	
+	// Returns false, with the first error that happened while printing or writing the manifest, if anything failed.
+	bool writeManifest(std::string& errorMessage);
+};
+
+#endif /* fcd__ast_pass_fileprint_h */
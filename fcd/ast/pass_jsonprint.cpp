@@ -0,0 +1,484 @@
+//
+// pass_jsonprint.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "json_string.h"
+#include "metadata.h"
+#include "pass_jsonprint.h"
+#include "visitor.h"
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallString.h>
+
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	void writeIndices(raw_ostream& os, ArrayRef<unsigned> indices)
+	{
+		os << '[';
+		for (size_t i = 0; i < indices.size(); ++i)
+		{
+			os << (i == 0 ? "" : ",") << indices[i];
+		}
+		os << ']';
+	}
+	
+	const char* unaryName(UnaryOperatorExpression::UnaryOperatorType type)
+	{
+		switch (type)
+		{
+			case UnaryOperatorExpression::Increment: return "increment";
+			case UnaryOperatorExpression::Decrement: return "decrement";
+			case UnaryOperatorExpression::AddressOf: return "addressOf";
+			case UnaryOperatorExpression::Dereference: return "dereference";
+			case UnaryOperatorExpression::LogicalNegate: return "logicalNegate";
+			default: llvm_unreachable("unknown unary operator");
+		}
+	}
+	
+	const char* naryName(NAryOperatorExpression::NAryOperatorType type)
+	{
+		switch (type)
+		{
+			case NAryOperatorExpression::Assign: return "assign";
+			case NAryOperatorExpression::Multiply: return "multiply";
+			case NAryOperatorExpression::Divide: return "divide";
+			case NAryOperatorExpression::Modulus: return "modulus";
+			case NAryOperatorExpression::Add: return "add";
+			case NAryOperatorExpression::Subtract: return "subtract";
+			case NAryOperatorExpression::ShiftLeft: return "shiftLeft";
+			case NAryOperatorExpression::ShiftRight: return "shiftRight";
+			case NAryOperatorExpression::SmallerThan: return "smallerThan";
+			case NAryOperatorExpression::GreaterOrEqualTo: return "greaterOrEqualTo";
+			case NAryOperatorExpression::GreaterThan: return "greaterThan";
+			case NAryOperatorExpression::SmallerOrEqualTo: return "smallerOrEqualTo";
+			case NAryOperatorExpression::Equal: return "equal";
+			case NAryOperatorExpression::NotEqual: return "notEqual";
+			case NAryOperatorExpression::BitwiseAnd: return "bitwiseAnd";
+			case NAryOperatorExpression::BitwiseXor: return "bitwiseXor";
+			case NAryOperatorExpression::BitwiseOr: return "bitwiseOr";
+			case NAryOperatorExpression::ShortCircuitAnd: return "shortCircuitAnd";
+			case NAryOperatorExpression::ShortCircuitOr: return "shortCircuitOr";
+			default: llvm_unreachable("unknown n-ary operator");
+		}
+	}
+	
+	// Statements are written to the body stream as they are visited. Expressions are written to the expression table
+	// the first time that they are seen, after their operands, and only their index is written where they are used.
+	// Types are indexed as they are seen and written once the whole function has been visited.
+	class JsonFunctionWriter final : public AstVisitor<JsonFunctionWriter>
+	{
+		typedef ExpressionTypeFieldArray::const_iterator FieldIterator;
+		
+		AstContext& ctx;
+		SmallString<1024> bodyBuffer;
+		SmallString<1024> expressionBuffer;
+		raw_svector_ostream body;
+		raw_svector_ostream expressions;
+		DenseMap<const Expression*, unsigned> expressionIndices;
+		DenseMap<const ExpressionType*, unsigned> typeIndices;
+		vector<const ExpressionType*> types;
+		
+		template<typename TRange>
+		SmallVector<unsigned, 8> indicesOf(TRange&& uses)
+		{
+			SmallVector<unsigned, 8> indices;
+			for (const ExpressionUse& use : uses)
+			{
+				indices.push_back(indexOf(*use.getUse()));
+			}
+			return indices;
+		}
+		
+		void writeFields(raw_ostream& os, FieldIterator begin, FieldIterator end)
+		{
+			os << '[';
+			for (auto iter = begin; iter != end; ++iter)
+			{
+				os << (iter == begin ? "{" : ",{") << "\"name\":";
+				printJsonString(os, iter->name);
+				os << ",\"type\":" << typeIndices[&iter->type] << '}';
+			}
+			os << ']';
+		}
+		
+		void writeType(raw_ostream& os, const ExpressionType& type)
+		{
+			if (isa<VoidExpressionType>(type))
+			{
+				os << "{\"kind\":\"void\"}";
+			}
+			else if (auto integer = dyn_cast<IntegerExpressionType>(&type))
+			{
+				os << "{\"kind\":\"integer\",\"signed\":" << (integer->isSigned() ? "true" : "false");
+				os << ",\"bits\":" << integer->getBits() << '}';
+			}
+			else if (auto pointer = dyn_cast<PointerExpressionType>(&type))
+			{
+				os << "{\"kind\":\"pointer\",\"to\":" << typeIndices[&pointer->getNestedType()] << '}';
+			}
+			else if (auto array = dyn_cast<ArrayExpressionType>(&type))
+			{
+				os << "{\"kind\":\"array\",\"of\":" << typeIndices[&array->getNestedType()];
+				os << ",\"size\":" << array->size() << '}';
+			}
+			else if (auto structure = dyn_cast<StructExpressionType>(&type))
+			{
+				os << "{\"kind\":\"struct\",\"name\":";
+				printJsonString(os, structure->getName());
+				os << ",\"fields\":";
+				writeFields(os, structure->begin(), structure->end());
+				os << '}';
+			}
+			else if (auto function = dyn_cast<FunctionExpressionType>(&type))
+			{
+				os << "{\"kind\":\"function\",\"returns\":" << typeIndices[&function->getReturnType()];
+				os << ",\"parameters\":";
+				writeFields(os, function->begin(), function->end());
+				os << '}';
+			}
+			else
+			{
+				llvm_unreachable("unknown expression type");
+			}
+		}
+		
+		void beginExpression(const Expression& expression, const char* kind)
+		{
+			unsigned index = static_cast<unsigned>(expressionIndices.size());
+			unsigned type = indexOf(expression.getExpressionType(ctx));
+			expressionIndices[&expression] = index;
+			expressions << (index == 0 ? "{" : ",{") << "\"kind\":\"" << kind << "\",\"type\":" << type;
+		}
+		
+		void beginStatement(const char* kind)
+		{
+			body << "{\"kind\":\"" << kind << '"';
+		}
+	
+	public:
+		JsonFunctionWriter(AstContext& ctx)
+		: ctx(ctx), body(bodyBuffer), expressions(expressionBuffer)
+		{
+		}
+		
+		unsigned indexOf(const ExpressionType& type)
+		{
+			auto iter = typeIndices.find(&type);
+			if (iter != typeIndices.end())
+			{
+				return iter->second;
+			}
+			
+			// Index the type before its components, since structures can refer to themselves.
+			unsigned index = static_cast<unsigned>(types.size());
+			typeIndices[&type] = index;
+			types.push_back(&type);
+			if (auto pointer = dyn_cast<PointerExpressionType>(&type))
+			{
+				indexOf(pointer->getNestedType());
+			}
+			else if (auto array = dyn_cast<ArrayExpressionType>(&type))
+			{
+				indexOf(array->getNestedType());
+			}
+			else if (auto structure = dyn_cast<StructExpressionType>(&type))
+			{
+				for (const ExpressionTypeField& field : *structure)
+				{
+					indexOf(field.type);
+				}
+			}
+			else if (auto function = dyn_cast<FunctionExpressionType>(&type))
+			{
+				indexOf(function->getReturnType());
+				for (const ExpressionTypeField& field : *function)
+				{
+					indexOf(field.type);
+				}
+			}
+			return index;
+		}
+		
+		unsigned indexOf(const Expression& expression)
+		{
+			auto iter = expressionIndices.find(&expression);
+			if (iter == expressionIndices.end())
+			{
+				visit(expression);
+				iter = expressionIndices.find(&expression);
+			}
+			return iter->second;
+		}
+		
+		void writeBody(const Statement* statement)
+		{
+			if (statement == nullptr)
+			{
+				body << "null";
+			}
+			else
+			{
+				visit(*statement);
+			}
+		}
+		
+		void writeTables(raw_ostream& os)
+		{
+			os << "\"types\":[";
+			// Writing a type never indexes new types: components were indexed along with the type.
+			for (size_t i = 0; i < types.size(); ++i)
+			{
+				os << (i == 0 ? "" : ",");
+				writeType(os, *types[i]);
+			}
+			os << "],\"expressions\":[" << expressionBuffer << "],\"body\":" << bodyBuffer;
+		}
+		
+		void visitUnaryOperator(const UnaryOperatorExpression& unary)
+		{
+			unsigned operand = indexOf(*unary.getOperand());
+			beginExpression(unary, "unary");
+			expressions << ",\"operator\":\"" << unaryName(unary.getType()) << "\",\"operand\":" << operand << '}';
+		}
+		
+		void visitNAryOperator(const NAryOperatorExpression& nary)
+		{
+			auto operands = indicesOf(nary.operands());
+			beginExpression(nary, "nary");
+			expressions << ",\"operator\":\"" << naryName(nary.getType()) << "\",\"operands\":";
+			writeIndices(expressions, operands);
+			expressions << '}';
+		}
+		
+		void visitMemberAccess(const MemberAccessExpression& memberAccess)
+		{
+			unsigned base = indexOf(*memberAccess.getBaseExpression());
+			bool throughPointer = memberAccess.getAccessType() == MemberAccessExpression::PointerAccess;
+			beginExpression(memberAccess, throughPointer ? "pointerMember" : "member");
+			expressions << ",\"base\":" << base << ",\"field\":" << memberAccess.getFieldIndex() << ",\"fieldName\":";
+			printJsonString(expressions, memberAccess.getFieldName());
+			expressions << '}';
+		}
+		
+		void visitTernary(const TernaryExpression& ternary)
+		{
+			unsigned condition = indexOf(*ternary.getCondition());
+			unsigned ifTrue = indexOf(*ternary.getTrueValue());
+			unsigned ifFalse = indexOf(*ternary.getFalseValue());
+			beginExpression(ternary, "ternary");
+			expressions << ",\"condition\":" << condition << ",\"true\":" << ifTrue << ",\"false\":" << ifFalse << '}';
+		}
+		
+		void visitNumeric(const NumericExpression& numeric)
+		{
+			beginExpression(numeric, "numeric");
+			expressions << ",\"value\":";
+			if (numeric.expressionType.isSigned())
+			{
+				expressions << numeric.si64;
+			}
+			else
+			{
+				expressions << numeric.ui64;
+			}
+			expressions << '}';
+		}
+		
+		void visitToken(const TokenExpression& token)
+		{
+			beginExpression(token, "token");
+			expressions << ",\"token\":";
+			printJsonString(expressions, &*token.token);
+			expressions << '}';
+		}
+		
+		void visitCall(const CallExpression& call)
+		{
+			unsigned callee = indexOf(*call.getCallee());
+			auto parameters = indicesOf(call.params());
+			beginExpression(call, "call");
+			expressions << ",\"callee\":" << callee << ",\"parameters\":";
+			writeIndices(expressions, parameters);
+			expressions << '}';
+		}
+		
+		void visitCast(const CastExpression& cast)
+		{
+			unsigned value = indexOf(*cast.getCastValue());
+			beginExpression(cast, "cast");
+			expressions << ",\"value\":" << value << '}';
+		}
+		
+		void visitAggregate(const AggregateExpression& agg)
+		{
+			auto values = indicesOf(agg.operands());
+			beginExpression(agg, "aggregate");
+			expressions << ",\"values\":";
+			writeIndices(expressions, values);
+			expressions << '}';
+		}
+		
+		void visitSubscript(const SubscriptExpression& subscript)
+		{
+			unsigned pointer = indexOf(*subscript.getPointer());
+			unsigned index = indexOf(*subscript.getIndex());
+			beginExpression(subscript, "subscript");
+			expressions << ",\"pointer\":" << pointer << ",\"index\":" << index << '}';
+		}
+		
+		void visitAssembly(const AssemblyExpression& assembly)
+		{
+			beginExpression(assembly, "assembly");
+			expressions << ",\"assembly\":";
+			printJsonString(expressions, &*assembly.assembly);
+			expressions << '}';
+		}
+		
+		void visitAssignable(const AssignableExpression& assignable)
+		{
+			beginExpression(assignable, "assignable");
+			expressions << ",\"prefix\":";
+			printJsonString(expressions, &*assignable.prefix);
+			expressions << '}';
+		}
+		
+		void visitNoop(const NoopStatement& noop)
+		{
+			beginStatement("noop");
+			body << '}';
+		}
+		
+		void visitSequence(const SequenceStatement& sequence)
+		{
+			beginStatement("sequence");
+			body << ",\"statements\":[";
+			for (auto iter = sequence.begin(); iter != sequence.end(); ++iter)
+			{
+				body << (iter == sequence.begin() ? "" : ",");
+				visit(**iter);
+			}
+			body << "]}";
+		}
+		
+		void visitIfElse(const IfElseStatement& ifElse)
+		{
+			unsigned condition = indexOf(*ifElse.getCondition());
+			beginStatement("if");
+			body << ",\"condition\":" << condition << ",\"then\":";
+			visit(*ifElse.getIfBody());
+			body << ",\"else\":";
+			writeBody(ifElse.getElseBody());
+			body << '}';
+		}
+		
+		void visitLoop(const LoopStatement& loop)
+		{
+			unsigned condition = indexOf(*loop.getCondition());
+			beginStatement(loop.getPosition() == LoopStatement::PreTested ? "while" : "doWhile");
+			body << ",\"condition\":" << condition << ",\"body\":";
+			visit(*loop.getLoopBody());
+			body << '}';
+		}
+		
+		void visitKeyword(const KeywordStatement& keyword)
+		{
+			const Expression* operand = keyword.getOperand();
+			unsigned index = operand == nullptr ? 0 : indexOf(*operand);
+			beginStatement("keyword");
+			body << ",\"name\":";
+			printJsonString(body, &*keyword.name);
+			body << ",\"operand\":";
+			if (operand == nullptr)
+			{
+				body << "null";
+			}
+			else
+			{
+				body << index;
+			}
+			body << '}';
+		}
+		
+		void visitExpr(const ExpressionStatement& expression)
+		{
+			unsigned index = indexOf(*expression.getExpression());
+			beginStatement("expression");
+			body << ",\"expression\":" << index << '}';
+		}
+		
+		void visitDefault(const ExpressionUser& user) { llvm_unreachable("missing JSON code"); }
+	};
+}
+
+void AstJsonPrint::printFunction(FunctionNode& fn)
+{
+	Function& function = fn.getFunction();
+	JsonFunctionWriter writer(fn.getContext());
+	unsigned prototype = writer.indexOf(fn.createPrototype());
+	writer.writeBody(fn.getBody());
+	
+	output << "{\"name\":";
+	printJsonString(output, function.getName());
+	if (auto address = md::getVirtualAddress(function))
+	{
+		output << ",\"address\":" << address->getLimitedValue();
+	}
+	
+	auto aliases = md::getAliases(function);
+	if (aliases.size() > 0)
+	{
+		output << ",\"aliases\":[";
+		for (size_t i = 0; i < aliases.size(); ++i)
+		{
+			output << (i == 0 ? "" : ",");
+			printJsonString(output, aliases[i]);
+		}
+		output << ']';
+	}
+	output << ",\"prototype\":" << prototype << ',';
+	writer.writeTables(output);
+	output << "}\n";
+}
+
+void AstJsonPrint::doRun(deque<unique_ptr<FunctionNode>>& functions)
+{
+	for (unique_ptr<FunctionNode>& fn : functions)
+	{
+		printFunction(*fn);
+	}
+}
+
+void AstJsonPrint::runOnStreamedFunction(FunctionNode& fn)
+{
+	printFunction(fn);
+	output.flush();
+}
+
+const char* AstJsonPrint::getName() const
+{
+	return "Print AST as JSON";
+}
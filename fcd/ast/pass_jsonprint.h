@@ -0,0 +1,56 @@
+//
+// pass_jsonprint.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef fcd__ast_pass_jsonprint_h
+#define fcd__ast_pass_jsonprint_h
+
+#include "pass.h"
+
+#include <llvm/Support/raw_ostream.h>
+
+// Writes functions as JSON lines instead of pseudocode, for tools that would otherwise have to parse fcd's output.
+// Every function is a single line that holds its name, its address (when it has one), the index of its prototype in
+// its type table, that type table, an expression table and its body. Types and expressions refer to each other by
+// their index in these tables; expressions always come after their operands, and an expression that is used several
+// times appears only once. Statements are nested objects. Functions without a body have a null body.
+class AstJsonPrint final : public AstModulePass
+{
+	llvm::raw_ostream& output;
+	
+	void printFunction(FunctionNode& fn);
+	
+protected:
+	virtual void doRun(std::deque<std::unique_ptr<FunctionNode>>& functions) override;
+	
+public:
+	AstJsonPrint(llvm::raw_ostream& output)
+	: output(output)
+	{
+	}
+	
+	virtual const char* getName() const override;
+	
+	virtual bool supportsStreaming() const override { return true; }
+	virtual void runOnStreamedFunction(FunctionNode& fn) override;
+};
+
+#endif /* fcd__ast_pass_jsonprint_h */
@@ -20,12 +20,11 @@
 //
 
 #include "pass_print.h"
-#include "clone.h"
 
 using namespace llvm;
 using namespace std;
 
-void AstPrint::doRun(deque<std::unique_ptr<FunctionNode>> &functions)
+void AstPrint::printIncludes()
 {
 	for (const auto& file : includes)
 	{
@@ -36,15 +35,53 @@ void AstPrint::doRun(deque<std::unique_ptr<FunctionNode>> &functions)
 	{
 		output << '\n';
 	}
-	
-	for (unique_ptr<FunctionNode>& fn : functions)
+}
+
+void AstPrint::printFunction(FunctionNode& fn)
+{
+	if (fn.hasBody())
 	{
-		if (auto body = fn->getBody())
+		if (cache == nullptr)
 		{
-			fn->setBody(CloneVisitor::clone(fn->getContext(), *body));
-			fn->print(output);
+			fn.print(output);
+			return;
 		}
+		
+		string pseudocode;
+		raw_string_ostream pseudocodeStream(pseudocode);
+		fn.print(pseudocodeStream);
+		pseudocodeStream.flush();
+		output << pseudocode;
+		cache->store(fn.getFunction(), pseudocode);
 	}
+	else if (cache != nullptr)
+	{
+		if (const string* pseudocode = cache->getCachedPseudocode(fn.getFunction()))
+		{
+			output << *pseudocode;
+		}
+	}
+}
+
+void AstPrint::doRun(deque<std::unique_ptr<FunctionNode>> &functions)
+{
+	printIncludes();
+	for (unique_ptr<FunctionNode>& fn : functions)
+	{
+		printFunction(*fn);
+	}
+}
+
+void AstPrint::beginStreaming()
+{
+	printIncludes();
+}
+
+void AstPrint::runOnStreamedFunction(FunctionNode& fn)
+{
+	// Flush so that consumers can start working on functions as soon as they are printed.
+	printFunction(fn);
+	output.flush();
 }
 
 const char* AstPrint::getName() const
@@ -22,6 +22,7 @@
 #ifndef fcd__ast_pass_print_h
 #define fcd__ast_pass_print_h
 
+#include "decompilation_cache.h"
 #include "pass.h"
 
 #include <llvm/Support/raw_ostream.h>
@@ -33,17 +34,25 @@ class AstPrint final : public AstModulePass
 {
 	llvm::raw_ostream& output;
 	std::vector<std::string> includes;
+	DecompilationCache* cache;
+	
+	void printIncludes();
+	void printFunction(FunctionNode& fn);
 	
 protected:
 	virtual void doRun(std::deque<std::unique_ptr<FunctionNode>>& functions) override;
 	
 public:
-	AstPrint(llvm::raw_ostream& output, std::vector<std::string> includes)
-	: output(output), includes(std::move(includes))
+	AstPrint(llvm::raw_ostream& output, std::vector<std::string> includes, DecompilationCache* cache = nullptr)
+	: output(output), includes(std::move(includes)), cache(cache)
 	{
 	}
 	
 	virtual const char* getName() const override;
+	
+	virtual bool supportsStreaming() const override { return true; }
+	virtual void beginStreaming() override;
+	virtual void runOnStreamedFunction(FunctionNode& fn) override;
 };
 
 #endif /* fcd__ast_pass_print_h */
@@ -22,6 +22,8 @@
 #include "pass_simplifyexpressions.h"
 #include "visitor.h"
 
+#include <llvm/ADT/SmallPtrSet.h>
+
 using namespace llvm;
 using namespace std;
 
@@ -57,6 +59,9 @@ namespace
 	class ExpressionSimplifierVisitor : public AstVisitor<ExpressionSimplifierVisitor, false>
 	{
 		AstContext& ctx;
+		// Simplifications replace expressions in all of their users, so expressions that several statements share are
+		// only simplified once. Replacements are built from simplified operands and count as simplified too.
+		SmallPtrSet<Expression*, 32> simplified;
 		
 		void collectExpressionTerms(NAryOperatorExpression& baseExpression, SmallPtrSetImpl<Expression*>& trueTerms, SmallPtrSetImpl<Expression*>& falseTerms)
 		{
@@ -147,6 +152,14 @@ namespace
 		{
 		}
 		
+		void visit(ExpressionUser& user)
+		{
+			if (simplified.insert(cast<Expression>(&user)).second)
+			{
+				AstVisitor::visit(user);
+			}
+		}
+		
 		void visitUnaryOperator(UnaryOperatorExpression& unary)
 		{
 			visit(*unary.getOperand());
@@ -182,6 +195,7 @@ namespace
 		{
 			// Negation distribution kills term collection, so do that first before visiting child nodes
 			Expression* result = removeIdenticalTerms(nary);
+			simplified.insert(result);
 			for (ExpressionUse& use : result->operands())
 			{
 				visit(*use.getUse());
@@ -30,6 +30,7 @@ class AstSimplifyExpressions final : public AstFunctionPass
 	
 public:
 	virtual const char* getName() const override;
+	virtual bool isSimplification() const override { return true; }
 };
 
 #endif /* fcd__ast_pass_simplifyexpressions_h */
@@ -21,8 +21,10 @@
 
 #include "expression_type.h"
 #include "print.h"
+#include "string_literal_index.h"
 #include "type_printer.h"
 
+#include <algorithm>
 #include <cctype>
 #include <limits>
 #include <string>
@@ -38,6 +40,25 @@ namespace
 		return N;
 	}
 	
+	// String literals from the executable only have printable characters, tabs and newlines.
+	void printStringLiteral(raw_ostream& os, StringRef literal)
+	{
+		os << '"';
+		for (char c : literal)
+		{
+			switch (c)
+			{
+				case '\t': os << "\\t"; break;
+				case '\n': os << "\\n"; break;
+				case '\r': os << "\\r"; break;
+				case '"': os << "\\\""; break;
+				case '\\': os << "\\\\"; break;
+				default: os << c; break;
+			}
+		}
+		os << '"';
+	}
+	
 	string operatorName[] = {
 		[UnaryOperatorExpression::Increment] = "++",
 		[UnaryOperatorExpression::Decrement] = "--",
@@ -130,32 +151,82 @@ namespace
 		return false;
 	}
 	
-	bool shouldReduceIntoToken(const Expression& expr)
+	// Passes leave behind expressions that are no longer part of the function but that still use other expressions.
+	// Whether an expression gets a variable depends on how many times it is printed, so only uses from the printed tree
+	// are counted.
+	class LiveUseCounter final : public AstVisitor<LiveUseCounter>
+	{
+		vector<unsigned>& useCounts;
+		
+		void visitOperands(const ExpressionUser& user)
+		{
+			for (const ExpressionUse& use : user.operands())
+			{
+				if (const Expression* operand = use.getUse())
+				if (useCounts[operand->getIndex()]++ == 0)
+				{
+					visit(*operand);
+				}
+			}
+		}
+		
+	public:
+		LiveUseCounter(vector<unsigned>& useCounts)
+		: useCounts(useCounts)
+		{
+		}
+		
+		void visitSequence(const SequenceStatement& sequence)
+		{
+			for (const Statement* statement : sequence)
+			{
+				visit(*statement);
+			}
+		}
+		
+		void visitIfElse(const IfElseStatement& ifElse)
+		{
+			visitOperands(ifElse);
+			visit(*ifElse.getIfBody());
+			if (auto elseBody = ifElse.getElseBody())
+			{
+				visit(*elseBody);
+			}
+		}
+		
+		void visitLoop(const LoopStatement& loop)
+		{
+			visitOperands(loop);
+			visit(*loop.getLoopBody());
+		}
+		
+		void visitDefault(const ExpressionUser& user)
+		{
+			visitOperands(user);
+		}
+	};
+	
+	bool shouldReduceIntoToken(const Expression& expr, const vector<unsigned>& useCounts)
 	{
 		switch (expr.getUserType())
 		{
 			case Expression::Assignable:
 				return true;
-				
+			
 			case Expression::UnaryOperator:
 			case Expression::Token:
 			case Expression::Numeric:
 			case Expression::Assembly:
 				return false;
-				
+			
 			case Expression::MemberAccess:
-				return shouldReduceIntoToken(*cast<MemberAccessExpression>(expr).getBaseExpression());
-				
+				return shouldReduceIntoToken(*cast<MemberAccessExpression>(expr).getBaseExpression(), useCounts);
+			
 			default:
-				return expr.uses_many();
+				return useCounts[expr.getIndex()] > 1;
 		}
 	}
 	
-	string take(raw_string_ostream& os)
-	{
-		return move(os.str());
-	}
-	
 	template<typename TCollection>
 	void getStatementParents(PrintableItem* statement, TCollection& ancestry)
 	{
@@ -170,21 +241,29 @@ namespace
 
 StatementPrintVisitor::Tokenization* StatementPrintVisitor::getIdentifier(const Expression &expression)
 {
-	if (!tokenize || noTokens.count(&expression) != 0)
+	if (!tokenize)
 	{
 		return nullptr;
 	}
 	
-	if (!shouldReduceIntoToken(expression))
+	ExpressionState& state = stateOf(expression);
+	if (state.noToken)
 	{
-		noTokens.insert(&expression);
 		return nullptr;
 	}
 	
-	auto iter = tokens.find(&expression);
-	if (iter == tokens.end())
+	if (!shouldReduceIntoToken(expression, liveUses))
 	{
-		Tokenization& identifier = tokens[&expression];
+		state.noToken = true;
+		return nullptr;
+	}
+	
+	if (state.tokenization == nullptr)
+	{
+		tokens.emplace_back();
+		Tokenization& identifier = tokens.back();
+		identifier.expression = &expression;
+		state.tokenization = &identifier;
 		size_t tokenId = tokens.size();
 		if (auto assignable = dyn_cast<AssignableExpression>(&expression))
 		{
@@ -192,13 +271,19 @@ StatementPrintVisitor::Tokenization* StatementPrintVisitor::getIdentifier(const
 		}
 		else
 		{
+			// Print the definition at the end of the buffer, move it to its own line, and cut it back out. The token
+			// stays empty until then, so that the expression is printed in full this one time.
+			size_t start = buffer.size();
+			os << "anon" << tokenId;
+			size_t tokenLength = buffer.size() - start;
+			os << " = ";
 			visit(expression);
-			string lineValue = move(os.str());
-			
-			raw_string_ostream(identifier.token) << "anon" << tokenId;
+			os << ';';
 			
-			os << identifier.token << " = " << lineValue << ';';
-			auto user = currentScope->appendItem(take(os).c_str());
+			StringRef line = since(start);
+			auto user = currentScope->appendItem(line, static_cast<unsigned>(tokenLength));
+			identifier.token = line.substr(0, tokenLength).str();
+			buffer.resize(start);
 			
 			usedByStatement.push_back(&expression);
 			fillUsers(user);
@@ -206,9 +291,9 @@ StatementPrintVisitor::Tokenization* StatementPrintVisitor::getIdentifier(const
 		
 		return &identifier;
 	}
-	else if (!iter->second.token.empty())
+	else if (!state.tokenization->token.empty())
 	{
-		return &iter->second;
+		return state.tokenization;
 	}
 	else
 	{
@@ -218,12 +303,13 @@ StatementPrintVisitor::Tokenization* StatementPrintVisitor::getIdentifier(const
 
 void StatementPrintVisitor::printWithParentheses(unsigned int precedence, const Expression& expression)
 {
+	size_t start = buffer.size();
 	visit(expression);
 	
-	if (needsParentheses(precedence, expression) && tokens.find(&expression) == tokens.end())
+	if (needsParentheses(precedence, expression) && !isTokenized(expression))
 	{
-		string expressionValue = move(os.str());
-		os << '(' << expressionValue << ')';
+		buffer.insert(buffer.begin() + start, '(');
+		os << ')';
 	}
 }
 
@@ -237,36 +323,30 @@ void StatementPrintVisitor::visit(PrintableScope* childScope, const Statement& s
 
 void StatementPrintVisitor::fillUsers(PrintableItem* user)
 {
+	// Only expressions that getIdentifier tokenized are used by statements.
 	for (auto expression : usedByStatement)
 	{
-		tokens[expression].users.push_back(user);
+		stateOf(*expression).tokenization->users.push_back(user);
 	}
 	usedByStatement.clear();
 }
 
 void StatementPrintVisitor::insertDeclarations()
 {
-	for (auto& pair : tokens)
+	// Declarations are prepended to their scope, so going backwards leaves them in the order that tokens were created.
+	SmallString<64> newLine;
+	for (auto iter = tokens.rbegin(); iter != tokens.rend(); ++iter)
 	{
-		Tokenization& info = pair.second;
+		Tokenization& info = *iter;
+		const Expression* expression = info.expression;
 		string& variable = info.token;
 		
 		// find first assignment to variable
-		auto firstAssignment = info.users.begin();
-		while (firstAssignment != info.users.end())
+		auto firstAssignment = find_if(info.users.begin(), info.users.end(), [&](PrintableItem* user)
 		{
-			if (auto line = dyn_cast<PrintableLine>(*firstAssignment))
-			{
-				const char* lineData = line->getLine();
-				auto iterPair = mismatch(variable.begin(), variable.end(), lineData);
-				if (iterPair.first == variable.end() && strncmp(iterPair.second, " = ", 3) == 0)
-				{
-					// first assignment!
-					break;
-				}
-			}
-			++firstAssignment;
-		}
+			auto line = dyn_cast<PrintableLine>(user);
+			return line != nullptr && line->isAssignment() && line->getAssignedVariable() == variable;
+		});
 		
 		// then find common ancestor for all uses, going as far as the first assignment
 		SmallVector<PrintableScope*, 10> parents;
@@ -297,30 +377,30 @@ void StatementPrintVisitor::insertDeclarations()
 		}
 		
 		// print declaration/definition
-		string newLine;
-		raw_string_ostream lineSS(newLine);
-		declare(lineSS, pair.first->getExpressionType(ctx), variable);
+		newLine.clear();
+		raw_svector_ostream lineSS(newLine);
+		typeSpellings.declare(lineSS, expression->getExpressionType(ctx), variable);
 		if (onePastCommonAncestor == parents.end() && firstAssignment != info.users.end())
 		{
 			// modify statement to make it a definition since the first assignment is in the common ancestor
 			auto line = cast<PrintableLine>(*firstAssignment);
-			lineSS << " = " << (&*line->getLine() + variable.size() + 3);
-			line->setLine(lineSS.str().c_str());
+			lineSS << " = " << line->getAssignedValue();
+			line->setLine(lineSS.str());
 		}
 		else
 		{
 			// insert new line in closest parent
 			lineSS << ";";
 			auto closestAncestor = *(onePastCommonAncestor - 1);
-			closestAncestor->prependItem(lineSS.str().c_str());
+			closestAncestor->prependItem(lineSS.str());
 		}
 	}
 }
 
 StatementPrintVisitor::StatementPrintVisitor(AstContext& ctx, bool tokenize)
-: ctx(ctx), tokenize(tokenize), parentExpression(nullptr), currentExpression(nullptr), os(currentValue)
+: ctx(ctx), tokenize(tokenize), parentExpression(nullptr), currentExpression(nullptr), os(buffer)
 {
-	currentScope = ctx.getPool().allocate<PrintableScope>(ctx.getPool(), nullptr);
+	currentScope = pool.allocate<PrintableScope>(pool, nullptr);
 }
 
 StatementPrintVisitor::~StatementPrintVisitor()
@@ -332,7 +412,6 @@ void StatementPrintVisitor::visit(const ExpressionUser &user)
 	const Expression* oldParent = parentExpression;
 	if (auto expr = dyn_cast<Expression>(&user))
 	{
-		assert(os.str().length() == 0);
 		if (auto token = getIdentifier(*expr))
 		{
 			usedByStatement.push_back(expr);
@@ -344,8 +423,10 @@ void StatementPrintVisitor::visit(const ExpressionUser &user)
 		currentExpression = expr;
 	}
 	
+	size_t start = buffer.size();
+	(void)start;
 	AstVisitor::visit(user);
-	assert(!isa<Statement>(user) || os.str().length() == 0);
+	assert(!isa<Statement>(user) || buffer.size() == start);
 	
 	if (isa<Expression>(user))
 	{
@@ -372,15 +453,14 @@ void StatementPrintVisitor::visitUnaryOperator(const UnaryOperatorExpression& un
 		precedence = numeric_limits<unsigned>::max();
 	}
 	
+	os << operatorRepr;
 	printWithParentheses(precedence, *unary.getOperand());
-	string value = take(os);
-	os << operatorRepr << value;
 }
 
 void StatementPrintVisitor::visitNAryOperator(const NAryOperatorExpression& nary)
 {
 	assert(nary.operands_size() > 0);
-
+	
 	const string* displayName = &badOperator;
 	unsigned precedence = numeric_limits<unsigned>::max();
 	auto type = nary.getType();
@@ -390,21 +470,15 @@ void StatementPrintVisitor::visitNAryOperator(const NAryOperatorExpression& nary
 		precedence = operatorPrecedence[type];
 	}
 	
-	string result;
-	raw_string_ostream outSS(result);
-	
 	auto iter = nary.operands_begin();
 	printWithParentheses(precedence, *iter->getUse());
 	++iter;
 	
-	outSS << take(os);
 	for (; iter != nary.operands_end(); ++iter)
 	{
-		outSS << ' ' << *displayName << ' ';
+		os << ' ' << *displayName << ' ';
 		printWithParentheses(precedence, *iter->getUse());
-		outSS << take(os);
 	}
-	swap(outSS.str(), os.str());
 }
 
 void StatementPrintVisitor::visitMemberAccess(const MemberAccessExpression &assignable)
@@ -415,16 +489,11 @@ void StatementPrintVisitor::visitMemberAccess(const MemberAccessExpression &assi
 
 void StatementPrintVisitor::visitTernary(const TernaryExpression& ternary)
 {
-	string result;
-	raw_string_ostream outSS(result);
-	
 	printWithParentheses(ternaryPrecedence, *ternary.getCondition());
-	outSS << take(os) << " ? ";
+	os << " ? ";
 	printWithParentheses(ternaryPrecedence, *ternary.getTrueValue());
-	outSS << take(os) << " : ";
+	os << " : ";
 	printWithParentheses(ternaryPrecedence, *ternary.getFalseValue());
-	outSS << take(os);
-	swap(outSS.str(), os.str());
 }
 
 void StatementPrintVisitor::visitNumeric(const NumericExpression& numeric)
@@ -445,7 +514,7 @@ void StatementPrintVisitor::visitNumeric(const NumericExpression& numeric)
 				case NAryOperatorExpression::BitwiseXor:
 					formatAsHex = true;
 					break;
-					
+				
 				default: break;
 			}
 		}
@@ -453,6 +522,15 @@ void StatementPrintVisitor::visitNumeric(const NumericExpression& numeric)
 	else if (auto cast = dyn_cast_or_null<CastExpression>(parentExpression))
 	{
 		formatAsHex = isa<PointerExpressionType>(cast->getExpressionType(ctx));
+		
+		// Pointers to string literals print as the literal.
+		if (formatAsHex)
+		if (const StringLiteralIndex* literals = ctx.getStringLiterals())
+		if (auto literal = literals->find(numeric.ui64))
+		{
+			printStringLiteral(os, *literal);
+			return;
+		}
 	}
 	
 	if (formatAsHex)
@@ -475,49 +553,39 @@ void StatementPrintVisitor::visitCall(const CallExpression& call)
 	auto callTarget = call.getCallee();
 	printWithParentheses(callPrecedence, *callTarget);
 	
-	string result;
-	raw_string_ostream outSS(result);
-	outSS << take(os);
-	
 	const auto& funcPointerType = cast<PointerExpressionType>(callTarget->getExpressionType(ctx));
 	const auto& funcType = cast<FunctionExpressionType>(funcPointerType.getNestedType());
 	size_t paramIndex = 0;
-	outSS << '(';
+	os << '(';
 	auto iter = call.params_begin();
 	auto end = call.params_end();
 	if (iter != end)
 	{
-		const string& paramName = funcType[paramIndex].name;
+		StringRef paramName = funcType[paramIndex].name;
 		if (paramName != "")
 		{
-			outSS << paramName << '=';
+			os << paramName << '=';
 			paramIndex++;
 		}
 		
 		visit(*iter->getUse());
-		outSS << take(os);
 		for (++iter; iter != end; ++iter)
 		{
-			outSS << ", ";
-			const string& paramName = funcType[paramIndex].name;
+			os << ", ";
+			StringRef paramName = funcType[paramIndex].name;
 			if (paramName != "")
 			{
-				outSS << paramName << '=';
+				os << paramName << '=';
 				paramIndex++;
 			}
 			visit(*iter->getUse());
-			outSS << take(os);
 		}
 	}
-	outSS << ')';
-	swap(outSS.str(), os.str());
+	os << ')';
 }
 
 void StatementPrintVisitor::visitCast(const CastExpression& cast)
 {
-	printWithParentheses(castPrecedence, *cast.getCastValue());
-	string expr = take(os);
-	
 	os << '(';
 	// XXX: are __sext and __zext annotations relevant? they only mirror whether
 	// there's a "u" or not in front of the integer type.
@@ -528,43 +596,40 @@ void StatementPrintVisitor::visitCast(const CastExpression& cast)
 		os << (intType->isSigned() ? "__sext " : "__zext ");
 	}
 	
-	CTypePrinter::print(os, cast.getExpressionType(ctx));
+	typeSpellings.print(os, cast.getExpressionType(ctx));
 	os << ')';
-	os << expr;
+	printWithParentheses(castPrecedence, *cast.getCastValue());
 }
 
 void StatementPrintVisitor::visitAggregate(const AggregateExpression& aggregate)
 {
-	string result;
-	raw_string_ostream outSS(result);
-	
-	outSS << '{';
+	os << '{';
 	size_t count = aggregate.operands_size();
 	if (count > 0)
 	{
 		auto iter = aggregate.operands_begin();
 		visit(*iter->getUse());
-		outSS << take(os);
 		
 		for (++iter; iter != aggregate.operands_end(); ++iter)
 		{
-			outSS << ", ";
+			os << ", ";
 			visit(*iter->getUse());
-			outSS << take(os);
 		}
 	}
-	outSS << '}';
-	swap(outSS.str(), os.str());
+	os << '}';
 }
 
 void StatementPrintVisitor::visitSubscript(const SubscriptExpression& subscript)
 {
+	// The index is visited first (which matters for the order in which tokens are defined), but printed last.
+	size_t start = buffer.size();
+	os << '[';
 	visit(*subscript.getIndex());
-	string index = take(os);
+	os << ']';
 	
+	size_t baseStart = buffer.size();
 	printWithParentheses(subscriptPrecedence, *subscript.getPointer());
-	string base = take(os);
-	os << base << '[' << index << ']';
+	rotate(buffer.begin() + start, buffer.begin() + baseStart, buffer.end());
 }
 
 void StatementPrintVisitor::visitAssembly(const AssemblyExpression& assembly)
@@ -583,6 +648,12 @@ void StatementPrintVisitor::visitAssignable(const AssignableExpression &assignab
 void StatementPrintVisitor::print(AstContext& ctx, raw_ostream &os, const ExpressionUser& user, bool tokenize)
 {
 	StatementPrintVisitor printer(ctx, tokenize);
+	if (tokenize)
+	{
+		printer.states.resize(ctx.getExpressionCount(), ExpressionState{false, nullptr});
+		printer.liveUses.resize(ctx.getExpressionCount());
+		LiveUseCounter(printer.liveUses).visit(user);
+	}
 	printer.visit(user);
 	
 	if (isa<Statement>(user))
@@ -595,7 +666,7 @@ void StatementPrintVisitor::print(AstContext& ctx, raw_ostream &os, const Expres
 	}
 	else
 	{
-		os << printer.os.str() << '\n';
+		os << printer.buffer << '\n';
 	}
 }
 
@@ -618,30 +689,32 @@ void StatementPrintVisitor::visitSequence(const SequenceStatement& sequence)
 
 void StatementPrintVisitor::visitIfElse(const IfElseStatement& ifElse)
 {
-	string prefix;
-	raw_string_ostream outSS(prefix);
+	size_t start = buffer.size();
+	const char* chain = "";
 	
 	const Statement* nextStatement = &ifElse;
 	while (const auto nextIfElse = dyn_cast_or_null<IfElseStatement>(nextStatement))
 	{
-		auto scope = ctx.getPool().allocate<PrintableScope>(ctx.getPool(), currentScope);
+		auto scope = pool.allocate<PrintableScope>(pool, currentScope);
 		
+		os << chain << "if (";
 		visit(*ifElse.getCondition());
 		fillUsers(scope);
-		outSS << "if (" << take(os) << ')';
+		os << ')';
 		
-		scope->setPrefix(take(outSS).c_str());
+		scope->setPrefix(since(start));
+		buffer.resize(start);
 		
 		visit(scope, *ifElse.getIfBody());
 		
-		outSS << "else ";
+		chain = "else ";
 		nextStatement = nextIfElse->getElseBody();
 	}
 	
 	if (nextStatement != nullptr)
 	{
-		auto scope = ctx.getPool().allocate<PrintableScope>(ctx.getPool(), currentScope);
-		scope->setPrefix(take(outSS).c_str());
+		auto scope = pool.allocate<PrintableScope>(pool, currentScope);
+		scope->setPrefix(chain);
 		
 		visit(scope, *nextStatement);
 	}
@@ -649,16 +722,17 @@ void StatementPrintVisitor::visitIfElse(const IfElseStatement& ifElse)
 
 void StatementPrintVisitor::visitLoop(const LoopStatement& loop)
 {
-	string prefix;
-	raw_string_ostream outSS(prefix);
-	auto scope = ctx.getPool().allocate<PrintableScope>(ctx.getPool(), currentScope);
+	size_t start = buffer.size();
+	auto scope = pool.allocate<PrintableScope>(pool, currentScope);
 	
 	if (loop.getPosition() == LoopStatement::PreTested)
 	{
+		os << "while (";
 		visit(*loop.getCondition());
 		fillUsers(scope);
-		outSS << "while (" << take(os) << ')';
-		scope->setPrefix(take(outSS).c_str());
+		os << ')';
+		scope->setPrefix(since(start));
+		buffer.resize(start);
 		
 		visit(scope, *loop.getLoopBody());
 	}
@@ -670,48 +744,69 @@ void StatementPrintVisitor::visitLoop(const LoopStatement& loop)
 		
 		pushScope(scope, [&] {
 			visit(*loop.getLoopBody());
+			os << "while (";
 			visit(*loop.getCondition());
 		});
 		
 		fillUsers(scope);
-		outSS << "while (" << take(os) << ");";
+		os << ");";
 		scope->setPrefix("do");
-		scope->setSuffix(take(outSS).c_str());
+		scope->setSuffix(since(start));
+		buffer.resize(start);
 		currentScope->appendItem(scope);
 	}
 }
 
 void StatementPrintVisitor::visitKeyword(const KeywordStatement& keyword)
 {
-	string prefix;
-	raw_string_ostream outSS(prefix);
-	outSS << keyword.name;
+	size_t start = buffer.size();
+	os << keyword.name;
 	
 	if (auto operand = keyword.getOperand())
 	{
+		os << ' ';
 		visit(*operand);
-		outSS << ' ' << take(os);
 	}
-	outSS << ';';
-	auto user = currentScope->appendItem(take(outSS).c_str());
+	os << ';';
+	auto user = currentScope->appendItem(since(start));
+	buffer.resize(start);
 	fillUsers(user);
 }
 
 void StatementPrintVisitor::visitExpr(const ExpressionStatement& expression)
 {
 	const Expression& expr = *expression.getExpression();
+	size_t start = buffer.size();
 	visit(expr);
 	
 	// Only print something if the expression wasn't turned into a token.
-	if (tokens.find(&expr) == tokens.end())
+	if (!isTokenized(expr))
 	{
 		os << ';';
-		auto user = currentScope->appendItem(take(os).c_str());
+		
+		// Assignments to tokens (like Φ node inputs) are flagged so that declarations can be inserted at the first one.
+		unsigned assignedLength = 0;
+		if (auto nary = dyn_cast<NAryOperatorExpression>(&expr))
+		if (nary->getType() == NAryOperatorExpression::Assign)
+		{
+			auto assigned = nary->getOperand(0);
+			if (isTokenized(*assigned) && !stateOf(*assigned).tokenization->token.empty())
+			{
+				StringRef token = stateOf(*assigned).tokenization->token;
+				StringRef line = since(start);
+				if (line.startswith(token) && line.substr(token.size()).startswith(" = "))
+				{
+					assignedLength = static_cast<unsigned>(token.size());
+				}
+			}
+		}
+		
+		auto user = currentScope->appendItem(since(start), assignedLength);
 		fillUsers(user);
 	}
 	else
 	{
-		os.str().clear();
 		usedByStatement.clear();
 	}
+	buffer.resize(start);
 }
@@ -23,38 +23,65 @@
 #define fcd__ast_print_h
 
 #include "print_item.h"
+#include "type_printer.h"
 #include "visitor.h"
 
 #include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallString.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/Support/ErrorHandling.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <deque>
 #include <list>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
+#include <vector>
 
 class StatementPrintVisitor final : public AstVisitor<StatementPrintVisitor>
 {
 	struct Tokenization
 	{
+		const Expression* expression;
 		std::string token;
 		llvm::SmallVector<PrintableItem*, 10> users;
 	};
 	
+	struct ExpressionState
+	{
+		bool noToken;
+		Tokenization* tokenization;
+	};
+	
 	AstContext& ctx;
-	std::unordered_map<const Expression*, Tokenization> tokens;
-	std::unordered_set<const Expression*> noTokens;
+	std::deque<Tokenization> tokens; // in creation order, so that declarations don't depend on where expressions are allocated
+	// Both indexed by Expression::getIndex. Live uses are uses by the printed tree, as opposed to Expression::uses,
+	// which also has uses by expressions that passes orphaned.
+	std::vector<ExpressionState> states;
+	std::vector<unsigned> liveUses;
+	CTypeSpellingCache typeSpellings;
 	bool tokenize;
 	
-	std::string currentValue;
+	// The printable tree only lives until it is written out, so it doesn't go in the function's pool: it is freed as
+	// soon as print returns and its chunks are reused for the next function.
+	DumbAllocator pool;
+	
+	// Everything is printed to the end of a single buffer. Statements print their line there, move it to a
+	// PrintableLine and truncate the buffer back to where they started.
+	llvm::SmallString<256> buffer;
 	PrintableScope* currentScope;
 	const Expression* parentExpression;
 	const Expression* currentExpression;
-	llvm::raw_string_ostream os;
+	llvm::raw_svector_ostream os;
 	llvm::SmallVector<const Expression*, 16> usedByStatement;
 	
+	llvm::StringRef since(size_t start) const { return buffer.str().substr(start); }
+	ExpressionState& stateOf(const Expression& expression)
+	{
+		assert(expression.getIndex() < states.size() && "expression doesn't belong to the printer's context");
+		return states[expression.getIndex()];
+	}
+	
+	bool isTokenized(const Expression& expression) { return tokenize && stateOf(expression).tokenization != nullptr; }
 	Tokenization* getIdentifier(const Expression& expression);
 	
 	void printWithParentheses(unsigned precedence, const Expression& expression);
@@ -50,17 +50,18 @@ void PrintableLine::print(raw_ostream &os, unsigned int indent) const
 	tabulate(os, indent) << line << '\n';
 }
 
-PrintableItem* PrintableScope::prependItem(NOT_NULL(const char) line)
+PrintableLine* PrintableScope::prependItem(StringRef line)
 {
 	auto expr = pool().allocate<PrintableLine>(pool(), this, line);
 	prepended.push_back(expr);
 	return expr;
 }
 
-PrintableItem* PrintableScope::appendItem(NOT_NULL(const char) line)
+PrintableLine* PrintableScope::appendItem(StringRef line, unsigned assignedLength)
 {
-	auto expr = pool().allocate<PrintableLine>(pool(), this, line);
-	return appendItem(expr);
+	auto expr = pool().allocate<PrintableLine>(pool(), this, line, assignedLength);
+	items.push_back(expr);
+	return expr;
 }
 
 PrintableItem* PrintableScope::appendItem(NOT_NULL(PrintableItem) statement)
@@ -25,8 +25,10 @@
 #include "dumb_allocator.h"
 #include "not_null.h"
 
+#include <llvm/ADT/StringRef.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <cassert>
 #include <string>
 #include <vector>
 
@@ -66,7 +68,10 @@ public:
 
 class PrintableLine : public PrintableItem
 {
-	NOT_NULL(const char) line;
+	llvm::StringRef line;
+	
+	// When the line assigns to a variable ("variable = value;"), the length of the variable name. Zero otherwise.
+	unsigned assignedLength;
 	
 public:
 	static bool classof(const PrintableItem* stmt)
@@ -74,13 +79,27 @@ public:
 		return stmt->getType() == Statement;
 	}
 	
-	PrintableLine(DumbAllocator& allocator, PrintableScope* parent, NOT_NULL(const char) line)
-	: PrintableItem(Statement, allocator, parent), line(pool().copyString(llvm::StringRef(line)))
+	PrintableLine(DumbAllocator& allocator, PrintableScope* parent, llvm::StringRef line, unsigned assignedLength = 0)
+	: PrintableItem(Statement, allocator, parent), line(copy(pool(), line)), assignedLength(assignedLength)
+	{
+		assert(assignedLength == 0 || line.substr(assignedLength).startswith(" = "));
+	}
+	
+	static llvm::StringRef copy(DumbAllocator& pool, llvm::StringRef line)
+	{
+		return llvm::StringRef(pool.copyString(line), line.size());
+	}
+	
+	llvm::StringRef getLine() const { return line; }
+	void setLine(llvm::StringRef line)
 	{
+		this->line = copy(pool(), line);
+		assignedLength = 0;
 	}
 	
-	NOT_NULL(const char) getLine() const { return line; }
-	void setLine(NOT_NULL(const char) line) { this->line = pool().copyString(llvm::StringRef(line)); }
+	bool isAssignment() const { return assignedLength != 0; }
+	llvm::StringRef getAssignedVariable() const { return line.substr(0, assignedLength); }
+	llvm::StringRef getAssignedValue() const { return isAssignment() ? line.substr(assignedLength + 3) : line; }
 	
 	virtual void print(llvm::raw_ostream& os, unsigned indent) const override;
 };
@@ -105,11 +124,11 @@ public:
 	
 	const char* getPrefix() const { return prefix; }
 	const char* getSuffix() const { return suffix; }
-	void setPrefix(NOT_NULL(const char) prefix) { this->prefix = pool().copyString(llvm::StringRef(prefix)); }
-	void setSuffix(NOT_NULL(const char) suffix) { this->suffix = pool().copyString(llvm::StringRef(suffix)); }
+	void setPrefix(llvm::StringRef prefix) { this->prefix = pool().copyString(prefix); }
+	void setSuffix(llvm::StringRef suffix) { this->suffix = pool().copyString(suffix); }
 	
-	PrintableItem* prependItem(NOT_NULL(const char) line);
-	PrintableItem* appendItem(NOT_NULL(const char) line);
+	PrintableLine* prependItem(llvm::StringRef line);
+	PrintableLine* appendItem(llvm::StringRef line, unsigned assignedLength = 0);
 	PrintableItem* appendItem(NOT_NULL(PrintableItem) statement);
 	
 	virtual void print(llvm::raw_ostream& os, unsigned indent) const override;
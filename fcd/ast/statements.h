@@ -138,6 +138,18 @@ public:
 	virtual void replaceChild(NOT_NULL(Statement) child, NOT_NULL(Statement) newChild) override;
 	void pushBack(NOT_NULL(Statement) statement);
 	void takeAllFrom(SequenceStatement& statement);
+	
+	// Moves the statements to the end of into and leaves the sequence empty.
+	template<typename TCollection>
+	void disownAll(TCollection& into)
+	{
+		for (Statement* statement : statements)
+		{
+			disown(statement);
+			into.push_back(statement);
+		}
+		statements.clear();
+	}
 };
 
 class IfElseStatement final : public Statement
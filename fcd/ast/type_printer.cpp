@@ -27,6 +27,12 @@
 using namespace llvm;
 using namespace std;
 
+namespace
+{
+	// Stands for the declarator when printing a type. It starts like an identifier, so that it gets the same spacing.
+	const char declaratorMarker[] = "\x01";
+}
+
 void CTypePrinter::printMiddleIfAny(raw_ostream& os, const string& middle)
 {
 	if (middle.size() > 0)
@@ -92,7 +98,7 @@ void CTypePrinter::print(raw_ostream& os, const ArrayExpressionType& arrayTy, st
 
 void CTypePrinter::print(raw_ostream& os, const StructExpressionType& structTy, string middle)
 {
-	if (structTy.getName().length() > 0)
+	if (structTy.getName().size() > 0)
 	{
 		os << "struct " << structTy.getName();
 	}
@@ -159,3 +165,43 @@ void CTypePrinter::print(raw_ostream& os, const ExpressionType& type, string mid
 			llvm_unreachable("unhandled expression type");
 	}
 }
+
+const CTypeSpellingCache::Spelling& CTypeSpellingCache::getSpelling(const ExpressionType& type)
+{
+	auto result = spellings.insert({&type, Spelling()});
+	Spelling& spelling = result.first->second;
+	if (result.second)
+	{
+		string declared;
+		raw_string_ostream declaredOs(declared);
+		CTypePrinter::print(declaredOs, type, declaratorMarker);
+		declaredOs.flush();
+		
+		size_t markerPosition = declared.find(declaratorMarker);
+		assert(markerPosition != string::npos);
+		spelling.prefix = declared.substr(0, markerPosition);
+		spelling.suffix = declared.substr(markerPosition + sizeof declaratorMarker - 1);
+		
+		raw_string_ostream abstractOs(spelling.abstract);
+		CTypePrinter::print(abstractOs, type);
+	}
+	return spelling;
+}
+
+void CTypeSpellingCache::declare(raw_ostream& os, const ExpressionType& type, const string& identifier)
+{
+	if (identifier.empty())
+	{
+		print(os, type);
+	}
+	else
+	{
+		const Spelling& spelling = getSpelling(type);
+		os << spelling.prefix << identifier << spelling.suffix;
+	}
+}
+
+void CTypeSpellingCache::print(raw_ostream& os, const ExpressionType& type)
+{
+	os << getSpelling(type).abstract;
+}
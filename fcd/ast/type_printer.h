@@ -27,6 +27,7 @@
 #include <llvm/Support/raw_ostream.h>
 
 #include <string>
+#include <unordered_map>
 
 class CTypePrinter
 {
@@ -43,4 +44,25 @@ public:
 	static void print(llvm::raw_ostream& os, const ExpressionType& type, std::string middle = "");
 };
 
+// Prints types the way CTypePrinter does, but only walks each type once. The spelling of a type is kept as the text
+// before and after the declarator, so declaring a variable of a type that was already seen is a concatenation.
+// Types must outlive the cache.
+class CTypeSpellingCache
+{
+	struct Spelling
+	{
+		std::string prefix;
+		std::string suffix;
+		std::string abstract; // without a declarator, as in casts
+	};
+	
+	std::unordered_map<const ExpressionType*, Spelling> spellings;
+	
+	const Spelling& getSpelling(const ExpressionType& type);
+	
+public:
+	void declare(llvm::raw_ostream& os, const ExpressionType& type, const std::string& identifier);
+	void print(llvm::raw_ostream& os, const ExpressionType& type);
+};
+
 #endif /* type_printer_hpp */
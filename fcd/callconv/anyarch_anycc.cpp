@@ -25,12 +25,13 @@
 #include "metadata.h"
 #include "symbolic_expr.h"
 
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/Analysis/CallGraph.h>
 #include <llvm/Analysis/PostDominators.h>
 #include <llvm/IR/Constants.h>
 
-#include <unordered_map>
-#include <unordered_set>
+#include <algorithm>
+#include <vector>
 
 using namespace llvm;
 using namespace std;
@@ -41,99 +42,120 @@ namespace
 {
 	RegisterCallingConvention<CallingConvention_AnyArch_AnyCC> registerAnyAny;
 	
-	typedef unordered_map<const TargetRegisterInfo*, unordered_set<Instruction*>> DominatorsPerRegister;
-	typedef std::unordered_map<const TargetRegisterInfo*, llvm::ModRefInfo> ModRefMap;
+	typedef SmallVector<Instruction*, 4> InstructionList;
+	
+	// Per-register containers are indexed by register slot (TargetInfo::registerSlot).
+	typedef vector<InstructionList> DominatorsPerRegister;
+	typedef vector<ModRefInfo> ModRefMap;
 
 	constexpr auto Incomplete = static_cast<ModRefInfo>(4);
 	constexpr auto IncompleteRef = static_cast<ModRefInfo>(Incomplete | MRI_Ref);
 	
-	bool dominates(DominatorTree& dom, Instruction* a, Instruction* b)
+	void addAllUsers(User& i, size_t regSlot, DominatorsPerRegister& allUsers)
 	{
-		return dom.dominates(a, b);
-	}
-	
-	bool dominates(PostDominatorTree& dom, Instruction* a, Instruction* b)
-	{
-		if (a == b)
-		{
-			return false;
-		}
-		
-		BasicBlock* aBlock = a->getParent();
-		BasicBlock* bBlock = b->getParent();
-		if (aBlock == bBlock)
+		for (User* u : i.users())
 		{
-			// which one happens last?
-			for (auto iter = aBlock->begin(); iter != aBlock->end(); iter++)
+			if (CastInst* bitcast = dyn_cast<CastInst>(u))
 			{
-				if (&*iter == a)
-				{
-					return false;
-				}
-				if (&*iter == b)
-				{
-					return true;
-				}
+				addAllUsers(*bitcast, regSlot, allUsers);
+			}
+			else
+			{
+				allUsers[regSlot].push_back(cast<Instruction>(u));
 			}
-			llvm_unreachable("neither A nor B present in parent block?!");
 		}
-		
-		return dom.dominates(aBlock, bBlock);
 	}
 	
-	ModRefInfo& operator|=(ModRefInfo& a, ModRefInfo b)
+	void removeDuplicates(InstructionList& list)
 	{
-		a = static_cast<ModRefInfo>(a | b);
-		return a;
+		sort(list.begin(), list.end());
+		list.erase(unique(list.begin(), list.end()), list.end());
 	}
 	
-	void addAllUsers(User& i, const TargetRegisterInfo* reg, unordered_map<const TargetRegisterInfo*, unordered_set<Instruction*>>& allUsers)
+	// Returns the values of the collection that are not dominated by another value of the collection. This sorts
+	// values by the DFS number of their block in the dominator tree and by their order in the block, such that
+	// values only have to be checked against the last dominant value found. "Dominated" has the same meaning as
+	// with DominatorTree::dominates(Instruction*, Instruction*); for post-dominator trees, a value is dominated by
+	// the values that follow it in the same block.
+	template<typename TCollection, typename TDomTree>
+	TCollection findDominantValues(ParameterRegistry& registry, TDomTree& dom, const TCollection& set)
 	{
-		assert(reg != nullptr);
-		for (User* u : i.users())
+		typedef typename TCollection::value_type TValue;
+		struct OrderedValue
 		{
-			if (CastInst* bitcast = dyn_cast<CastInst>(u))
+			unsigned dfsIn;
+			unsigned dfsOut;
+			TValue value;
+		};
+		
+		TCollection result;
+		if (set.size() < 2)
+		{
+			result.insert(result.end(), set.begin(), set.end());
+			return result;
+		}
+		
+		SmallVector<OrderedValue, 16> ordered;
+		SmallVector<TValue, 4> unreachable;
+		for (const auto& item : set)
+		{
+			if (DomTreeNode* node = dom.getNode(item->getParent()))
 			{
-				addAllUsers(*bitcast, reg, allUsers);
+				ordered.push_back({node->getDFSNumIn(), node->getDFSNumOut(), item});
 			}
 			else
 			{
-				allUsers[reg].insert(cast<Instruction>(u));
+				unreachable.push_back(item);
 			}
 		}
-	}
-	
-	template<typename TCollection, typename TDomTree>
-	TCollection findDominantValues(TDomTree& dom, const TCollection& set)
-	{
-		TCollection result;
-		for (const auto& item : set)
+		
+		// Values in unreachable blocks are dominated by everything else.
+		if (ordered.size() == 0)
 		{
-			bool dominated = any_of(set.begin(), set.end(), [&](const typename TCollection::value_type& otherItem)
+			result.insert(result.end(), unreachable.begin(), unreachable.end());
+			return result;
+		}
+		
+		bool postDominance = dom.isPostDominator();
+		sort(ordered.begin(), ordered.end(), [&](const OrderedValue& a, const OrderedValue& b)
+		{
+			if (a.dfsIn != b.dfsIn)
 			{
-				return item != otherItem && dominates(dom, otherItem, item);
-			});
-			
-			if (!dominated)
+				return a.dfsIn < b.dfsIn;
+			}
+			if (a.value == b.value)
 			{
-				result.insert(result.end(), item);
+				return false;
+			}
+			return postDominance
+				? registry.comesBefore(b.value, a.value)
+				: registry.comesBefore(a.value, b.value);
+		});
+		
+		const OrderedValue* lastDominant = nullptr;
+		for (const OrderedValue& item : ordered)
+		{
+			// Dominant values are never nested, so if the item is in a dominator subtree, it is in that of the
+			// last dominant value.
+			if (lastDominant == nullptr || item.dfsIn > lastDominant->dfsOut)
+			{
+				result.insert(result.end(), item.value);
+				lastDominant = &item;
 			}
 		}
 		return result;
 	}
 	
-	unordered_map<const TargetRegisterInfo*, ModRefInfo> translateToModRef(const CallInformation& callInfo)
+	void translateToModRef(const TargetInfo& target, const CallInformation& callInfo, vector<unsigned>& result)
 	{
-		unordered_map<const TargetRegisterInfo*, ModRefInfo> result;
 		auto returnCutoff = callInfo.return_begin();
 		for (auto iter = callInfo.begin(); iter != callInfo.end(); ++iter)
 		{
 			if (iter->type == ValueInformation::IntegerRegister)
 			{
-				result[iter->registerInfo] |= iter < returnCutoff ? MRI_Ref : MRI_Mod;
+				result[target.registerSlot(*iter->registerInfo)] |= iter < returnCutoff ? MRI_Ref : MRI_Mod;
 			}
 		}
-		return result;
 	}
 	
 	SExpression* backtrackSExpressionOfValue(const TargetInfo& target, MemorySSA& mssa, ExpressionContext& context, Value* value)
@@ -247,9 +269,8 @@ namespace
 		return nullptr;
 	}
 	
-	bool backtrackDefinitionToEntry(const TargetInfo& target, MemorySSA& mssa, StoreInst& inst)
+	bool backtrackDefinitionToEntry(const TargetInfo& target, MemorySSA& mssa, ExpressionContext& ctx, StoreInst& inst)
 	{
-		ExpressionContext ctx;
 		Value* storedValue = inst.getValueOperand();
 		if (auto backtracked = backtrackSExpressionOfValue(target, mssa, ctx, storedValue))
 		{
@@ -264,10 +285,9 @@ namespace
 		return false;
 	}
 	
-	void walkUpPostDominatingUse(const TargetInfo& target, MemorySSA& mssa, DominatorsPerRegister& preDominatingUses, DominatorsPerRegister& postDominatingUses, ModRefMap& resultMap, const TargetRegisterInfo* regKey)
+	void walkUpPostDominatingUse(const TargetInfo& target, MemorySSA& mssa, ExpressionContext& ctx, DominatorsPerRegister& preDominatingUses, DominatorsPerRegister& postDominatingUses, ModRefMap& resultMap, size_t regSlot)
 	{
-		assert(regKey != nullptr);
-		ModRefInfo& queryResult = resultMap[regKey];
+		ModRefInfo& queryResult = resultMap[regSlot];
 		if ((queryResult & Incomplete) != Incomplete)
 		{
 			// Only incomplete results should be considered.
@@ -275,11 +295,11 @@ namespace
 		}
 		
 		bool preservesRegister = true;
-		for (Instruction* postDominator : postDominatingUses[regKey])
+		for (Instruction* postDominator : postDominatingUses[regSlot])
 		{
 			if (StoreInst* store = dyn_cast<StoreInst>(postDominator))
 			{
-				preservesRegister &= backtrackDefinitionToEntry(target, mssa, *store);
+				preservesRegister &= backtrackDefinitionToEntry(target, mssa, ctx, *store);
 				if (preservesRegister)
 				{
 					continue;
@@ -302,7 +322,7 @@ namespace
 			{
 				// Are we reading the value for any other purpose than storing it?
 				// If so, there is still a Ref dependency.
-				auto& preDom = preDominatingUses[regKey];
+				auto& preDom = preDominatingUses[regSlot];
 				assert(preDom.size() > 0);
 				if (preDom.size() == 1)
 				{
@@ -354,12 +374,6 @@ void CallingConvention_AnyArch_AnyCC::getAnalysisUsage(llvm::AnalysisUsage &au)
 {
 	au.addRequired<CallGraphWrapperPass>();
 	au.addPreserved<CallGraphWrapperPass>();
-	
-	au.addRequired<DominatorTreeWrapperPass>();
-	au.addPreserved<DominatorTreeWrapperPass>();
-	
-	au.addRequired<PostDominatorTreeWrapperPass>();
-	au.addPreserved<PostDominatorTreeWrapperPass>();
 }
 
 bool CallingConvention_AnyArch_AnyCC::analyzeFunction(ParameterRegistry &registry, CallInformation &fillOut, llvm::Function &func)
@@ -370,29 +384,25 @@ bool CallingConvention_AnyArch_AnyCC::analyzeFunction(ParameterRegistry &registr
 	}
 	
 	auto regs = static_cast<Argument*>(func.arg_begin());
-	unordered_map<const TargetRegisterInfo*, ModRefInfo> resultMap;
-	
-	// Find all GEPs
 	const auto& target = registry.getTargetInfo();
-	unordered_multimap<const TargetRegisterInfo*, User*> registerUsers;
+	const auto& registers = target.targetRegisterInfo();
+	ModRefMap resultMap(registers.size(), MRI_NoModRef);
+	
+	// Find all users of register GEPs
+	DominatorsPerRegister gepUsers(registers.size());
 	for (User* user : regs->users())
 	{
 		if (const TargetRegisterInfo* maybeRegister = target.registerInfo(*user))
 		{
 			const TargetRegisterInfo& registerInfo = target.largestOverlappingRegister(*maybeRegister);
-			registerUsers.insert({&registerInfo, user});
+			addAllUsers(*user, target.registerSlot(registerInfo), gepUsers);
 		}
 	}
 	
-	// Find all users of these GEPs
-	DominatorsPerRegister gepUsers;
-	for (auto iter = registerUsers.begin(); iter != registerUsers.end(); iter++)
-	{
-		addAllUsers(*iter->second, iter->first, gepUsers);
-	}
-	
-	DominatorTree& preDom = registry.getAnalysis<DominatorTreeWrapperPass>(func).getDomTree();
-	PostDominatorTree& postDom = registry.getAnalysis<PostDominatorTreeWrapperPass>(func).getPostDomTree();
+	DominatorTree& preDom = registry.getDominatorTree(func);
+	PostDominatorTree& postDom = registry.getPostDominatorTree(func);
+	preDom.updateDFSNumbers();
+	postDom.updateDFSNumbers();
 	
 	// Add calls
 	SmallVector<CallInst*, 8> calls;
@@ -412,51 +422,74 @@ bool CallingConvention_AnyArch_AnyCC::analyzeFunction(ParameterRegistry &registr
 			{
 				if (vi.type == ValueInformation::IntegerRegister)
 				{
-					gepUsers[vi.registerInfo].insert(caller);
+					gepUsers[target.registerSlot(*vi.registerInfo)].push_back(caller);
 				}
 			}
 		}
 	}
 	
+	// The register struct has a slot for every register of the target, but a function usually touches a handful of them.
+	// Only registers that have GEP users in the function, or that a callee uses, can be parameters or return values, so
+	// the analysis only visits these slots.
+	SmallVector<size_t, 32> touchedSlots;
+	for (size_t slot = 0; slot < registers.size(); ++slot)
+	{
+		removeDuplicates(gepUsers[slot]);
+		if (gepUsers[slot].size() > 0)
+		{
+			touchedSlots.push_back(slot);
+		}
+	}
+	
 	// Start out resultMap based on call dominance. Weed out calls until dominant call set has been established.
 	// This map will be refined by results from mod/ref instruction analysis. The purpose is mainly to define
 	// mod/ref behavior for registers that are used in callees of this function, but not in this function
 	// directly.
+	vector<unsigned> callResult(registers.size());
 	while (calls.size() > 0)
 	{
-		unordered_map<const TargetRegisterInfo*, unsigned> callResult;
-		auto dominant = findDominantValues(preDom, calls);
+		fill(callResult.begin(), callResult.end(), 0);
+		auto dominant = findDominantValues(registry, preDom, calls);
+		SmallPtrSet<CallInst*, 8> dominantSet(dominant.begin(), dominant.end());
 		for (CallInst* call : dominant)
 		{
 			Function* callee = call->getCalledFunction();
-			for (const auto& pair : translateToModRef(*registry.getCallInfo(*callee)))
-			{
-				callResult[pair.first] |= pair.second;
-			}
-			
-			calls.erase(find(calls.begin(), calls.end(), call));
+			translateToModRef(target, *registry.getCallInfo(*callee), callResult);
 		}
 		
-		for (const auto& pair : callResult)
+		calls.erase(remove_if(calls.begin(), calls.end(), [&](CallInst* call)
+		{
+			return dominantSet.count(call) != 0;
+		}), calls.end());
+		
+		for (size_t slot : touchedSlots)
 		{
-			resultMap[pair.first] = static_cast<ModRefInfo>(pair.second);
+			if (callResult[slot] != 0)
+			{
+				resultMap[slot] = static_cast<ModRefInfo>(callResult[slot]);
+			}
 		}
 	}
 	
 	// Find the dominant use(s)
-	auto preDominatingUses = gepUsers;
-	for (auto& pair : preDominatingUses)
+	DominatorsPerRegister preDominatingUses(registers.size());
+	for (size_t slot : touchedSlots)
 	{
-		pair.second = findDominantValues(preDom, pair.second);
+		preDominatingUses[slot] = findDominantValues(registry, preDom, gepUsers[slot]);
 	}
 	
 	// Fill out ModRef use dictionary
 	// (Ref info is incomplete)
-	for (auto& pair : preDominatingUses)
+	for (size_t slot : touchedSlots)
 	{
-		ModRefInfo& r = resultMap[pair.first];
+		if (preDominatingUses[slot].size() == 0)
+		{
+			continue;
+		}
+		
+		ModRefInfo& r = resultMap[slot];
 		r = IncompleteRef;
-		for (auto inst : pair.second)
+		for (auto inst : preDominatingUses[slot])
 		{
 			if (isa<StoreInst>(inst))
 			{
@@ -467,69 +500,63 @@ bool CallingConvention_AnyArch_AnyCC::analyzeFunction(ParameterRegistry &registr
 			if (CallInst* call = dyn_cast<CallInst>(inst))
 			{
 				// If the first user is a call, propagate its ModRef value.
-				r = registry.getCallInfo(*call->getCalledFunction())->getRegisterModRef(*pair.first);
+				r = registry.getCallInfo(*call->getCalledFunction())->getRegisterModRef(registers[slot]);
 				break;
 			}
 		}
 	}
 	
 	// Find post-dominating stores
-	auto postDominatingUses = gepUsers;
-	for (auto& pair : postDominatingUses)
+	DominatorsPerRegister postDominatingUses(registers.size());
+	for (size_t slot : touchedSlots)
 	{
-		const TargetRegisterInfo* key = pair.first;
-		auto& set = pair.second;
 		// remove non-Mod instructions
-		for (auto iter = set.begin(); iter != set.end(); )
+		InstructionList modifyingUses;
+		for (Instruction* inst : gepUsers[slot])
 		{
-			if (isa<StoreInst>(*iter))
+			if (isa<StoreInst>(inst))
 			{
-				iter++;
-				continue;
+				modifyingUses.push_back(inst);
 			}
-			else if (CallInst* call = dyn_cast<CallInst>(*iter))
+			else if (CallInst* call = dyn_cast<CallInst>(inst))
 			{
 				auto callee = call->getCalledFunction();
 				const auto& info = *registry.getCallInfo(*callee);
-				if ((info.getRegisterModRef(*key) & MRI_Mod) == MRI_Mod)
+				if ((info.getRegisterModRef(registers[slot]) & MRI_Mod) == MRI_Mod)
 				{
-					iter++;
-					continue;
+					modifyingUses.push_back(inst);
 				}
 			}
-			iter = set.erase(iter);
 		}
 		
-		set = findDominantValues(postDom, set);
+		postDominatingUses[slot] = findDominantValues(registry, postDom, modifyingUses);
 	}
 	
 	MemorySSA& mssa = *registry.getMemorySSA(func);
 	
-	// Walk up post-dominating uses until we get to liveOnEntry.
-	for (auto& pair : postDominatingUses)
+	// Walk up post-dominating uses until we get to liveOnEntry. Stores to different registers often save values
+	// derived from the same registers, so they share an expression context.
+	ExpressionContext ctx;
+	for (size_t slot : touchedSlots)
 	{
-		walkUpPostDominatingUse(target, mssa, preDominatingUses, postDominatingUses, resultMap, pair.first);
+		walkUpPostDominatingUse(target, mssa, ctx, preDominatingUses, postDominatingUses, resultMap, slot);
 	}
 	
-	// Use resultMap to build call information. First, sort registers by their pointer order; this ensures stable
-	// parameter order.
+	// Use resultMap to build call information. Registers are visited in slot order; this ensures stable parameter
+	// order.
 	
 	// We have authoritative information on used parameters, but not on return values. Only register parameters in this
 	// step.
-	SmallVector<pair<const TargetRegisterInfo*, ModRefInfo>, 16> registers;
-	copy(resultMap.begin(), resultMap.end(), registers.begin());
-	sort(registers.begin(), registers.end());
-	
 	vector<const TargetRegisterInfo*> returns;
-	for (const auto& pair : resultMap)
+	for (size_t slot : touchedSlots)
 	{
-		if (pair.second & MRI_Ref)
+		if (resultMap[slot] & MRI_Ref)
 		{
-			fillOut.addParameter(ValueInformation::IntegerRegister, pair.first);
+			fillOut.addParameter(ValueInformation::IntegerRegister, &registers[slot]);
 		}
-		if (pair.second & MRI_Mod)
+		if (resultMap[slot] & MRI_Mod)
 		{
-			returns.push_back(pair.first);
+			returns.push_back(&registers[slot]);
 		}
 	}
 	
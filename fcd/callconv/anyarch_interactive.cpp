@@ -21,10 +21,15 @@
 
 #include "anyarch_interactive.h"
 #include "cc_common.h"
+#include "command_line.h"
 #include "metadata.h"
 #include "targetinfo.h"
 
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
 
 #include <iomanip>
 #include <iostream>
@@ -34,6 +39,8 @@ using namespace std;
 
 namespace
 {
+	cl::opt<string> answerFile("interactive-answers", cl::desc("Replay and record any/interactive answers using this file"), cl::value_desc("file"), whitelist());
+	
 	RegisterCallingConvention<CallingConvention_AnyArch_Interactive> registerAnyInteractive;
 	
 	template<typename T, size_t N>
@@ -63,12 +70,92 @@ bool CallingConvention_AnyArch_Interactive::matches(TargetInfo &target, Executab
 	return false;
 }
 
+void CallingConvention_AnyArch_Interactive::loadAnswers()
+{
+	answersLoaded = true;
+	if (answerFile.empty())
+	{
+		return;
+	}
+	
+	// Answer files have one function per line: "<hex address> <y|n> <number of parameters>". Lines starting with
+	// # are ignored, and later lines override earlier ones.
+	auto bufferOrError = MemoryBuffer::getFile(answerFile);
+	if (!bufferOrError)
+	{
+		if (bufferOrError.getError() != errc::no_such_file_or_directory)
+		{
+			errs() << "can't read answers from " << answerFile << ": " << bufferOrError.getError().message() << '\n';
+		}
+		return;
+	}
+	
+	SmallVector<StringRef, 0> lines;
+	bufferOrError.get()->getBuffer().split(lines, '\n', -1, false);
+	for (StringRef line : lines)
+	{
+		SmallVector<StringRef, 3> fields;
+		line.trim().split(fields, ' ', -1, false);
+		if (fields.size() != 3 || fields[0].startswith("#"))
+		{
+			continue;
+		}
+		
+		uint64_t address;
+		Answer answer;
+		if (fields[0].getAsInteger(16, address) || fields[2].getAsInteger(10, answer.numberOfParameters))
+		{
+			continue;
+		}
+		if (fields[1] != "y" && fields[1] != "n")
+		{
+			continue;
+		}
+		answer.returns = fields[1] == "y";
+		answers[address] = answer;
+	}
+}
+
+void CallingConvention_AnyArch_Interactive::recordAnswer(uint64_t address, const Answer& answer)
+{
+	answers[address] = answer;
+	if (answerFile.empty())
+	{
+		return;
+	}
+	
+	// Append right away, so that answers survive runs that don't complete.
+	error_code error;
+	raw_fd_ostream output(answerFile, error, sys::fs::F_Append | sys::fs::F_Text);
+	if (error)
+	{
+		errs() << "can't record answer to " << answerFile << ": " << error.message() << '\n';
+		return;
+	}
+	output.write_hex(address) << ' ' << (answer.returns ? 'y' : 'n') << ' ' << answer.numberOfParameters << '\n';
+}
+
 bool CallingConvention_AnyArch_Interactive::analyzeFunction(ParameterRegistry &registry, CallInformation &fillOut, llvm::Function &function)
 {
 	TargetInfo& info = registry.getTargetInfo();
-		
+	if (!answersLoaded)
+	{
+		loadAnswers();
+	}
+	
+	auto address = md::getVirtualAddress(function);
+	if (address != nullptr)
+	{
+		auto iter = answers.find(address->getLimitedValue());
+		if (iter != answers.end())
+		{
+			const Answer& answer = iter->second;
+			return hackhack_fillFromParamInfo(function.getContext(), registry, fillOut, answer.returns, answer.numberOfParameters, false);
+		}
+	}
+	
 	cout << function.getName().str();
-	if (auto address = md::getVirtualAddress(function))
+	if (address != nullptr)
 	{
 		cout << " [" << hex << setfill('0') << setw(info.getPointerSize() * 2) << address->getLimitedValue() << ']';
 	}
@@ -108,5 +195,11 @@ bool CallingConvention_AnyArch_Interactive::analyzeFunction(ParameterRegistry &r
 	while (cin.fail());
 	
 	bool returns = yesNoReturns == 'y' || yesNoReturns == '1';
+	
+	// Don't record defaults that were picked because standard input ran out.
+	if (address != nullptr && cin)
+	{
+		recordAnswer(address->getLimitedValue(), {returns, numberOfParameters});
+	}
 	return hackhack_fillFromParamInfo(function.getContext(), registry, fillOut, returns, numberOfParameters, false);
 }
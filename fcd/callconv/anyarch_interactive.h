@@ -25,10 +25,24 @@
 #include "call_conv.h"
 #include "params_registry.h"
 
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 
 class CallingConvention_AnyArch_Interactive : public CallingConvention
 {
+	struct Answer
+	{
+		bool returns;
+		unsigned numberOfParameters;
+	};
+	
+	bool answersLoaded = false;
+	std::unordered_map<uint64_t, Answer> answers;
+	
+	void loadAnswers();
+	void recordAnswer(uint64_t address, const Answer& answer);
+	
 public:
 	static const char* name;
 	
@@ -0,0 +1,258 @@
+//
+// callinfo_database.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "call_conv.h"
+#include "callinfo_database.h"
+#include "targetinfo.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	// Entries are only valid for the fcd build that produced them.
+	const char databaseVersion[] = "fcd-callinfo-1 " __DATE__ " " __TIME__;
+	
+	void printValue(raw_ostream& output, const ValueInformation& value)
+	{
+		switch (value.type)
+		{
+			case ValueInformation::IntegerRegister: output << "r:" << value.registerInfo->name; break;
+			case ValueInformation::FloatingPointRegister: output << "f:" << value.registerInfo->name; break;
+			case ValueInformation::Stack: output << "s:" << value.frameBaseOffset; break;
+		}
+	}
+	
+	template<typename TAction>
+	bool parseValue(const TargetInfo& targetInfo, StringRef token, TAction&& action)
+	{
+		StringRef payload = token.drop_front(2);
+		if (token.startswith("s:"))
+		{
+			uint64_t offset;
+			if (payload.getAsInteger(10, offset))
+			{
+				return false;
+			}
+			action(ValueInformation(ValueInformation::Stack, offset));
+			return true;
+		}
+		
+		auto type = token.startswith("r:") ? ValueInformation::IntegerRegister : ValueInformation::FloatingPointRegister;
+		if (token.startswith("r:") || token.startswith("f:"))
+		if (const TargetRegisterInfo* registerInfo = targetInfo.registerNamed(payload.str().c_str()))
+		{
+			action(ValueInformation(type, registerInfo));
+			return true;
+		}
+		return false;
+	}
+	
+	bool parseEntry(const TargetInfo& targetInfo, StringRef line, string& fingerprint, CallInformation& callInfo)
+	{
+		SmallVector<StringRef, 16> tokens;
+		line.split(tokens, ' ', -1, false);
+		if (tokens.size() < 5)
+		{
+			return false;
+		}
+		
+		unsigned stage;
+		if (tokens[1].getAsInteger(10, stage) || (stage != CallInformation::Completed && stage != CallInformation::Failed))
+		{
+			return false;
+		}
+		
+		callInfo.setStage(static_cast<CallInformation::Stage>(stage));
+		if (callInfo.getStage() == CallInformation::Completed)
+		{
+			CallingConvention* cc = CallingConvention::getCallingConvention(tokens[2].str());
+			if (cc == nullptr)
+			{
+				return false;
+			}
+			callInfo.setCallingConvention(cc);
+		}
+		callInfo.setVararg(tokens[3] == "1");
+		
+		bool inReturns = false;
+		for (StringRef token : make_range(tokens.begin() + 4, tokens.end()))
+		{
+			if (token == "->")
+			{
+				inReturns = true;
+				continue;
+			}
+			
+			bool parsed = parseValue(targetInfo, token, [&](const ValueInformation& value)
+			{
+				if (inReturns)
+				{
+					callInfo.addReturn(value);
+				}
+				else
+				{
+					callInfo.addParameter(value);
+				}
+			});
+			if (!parsed)
+			{
+				return false;
+			}
+		}
+		
+		fingerprint = tokens[0].str();
+		return inReturns;
+	}
+}
+
+CallInformationDatabase::CallInformationDatabase(string path)
+: path(move(path)), loaded(false), dirty(false)
+{
+}
+
+CallInformationDatabase::~CallInformationDatabase()
+{
+	string errorMessage;
+	if (dirty && !path.empty() && !save(errorMessage))
+	{
+		errs() << "can't save call information to " << path << ": " << errorMessage << '\n';
+	}
+}
+
+bool CallInformationDatabase::load(const TargetInfo& targetInfo, string& errorMessage)
+{
+	loaded = true;
+	if (path.empty())
+	{
+		return true;
+	}
+	
+	auto bufferOrError = MemoryBuffer::getFile(path);
+	if (!bufferOrError)
+	{
+		if (bufferOrError.getError() == errc::no_such_file_or_directory)
+		{
+			return true;
+		}
+		errorMessage = bufferOrError.getError().message();
+		return false;
+	}
+	
+	SmallVector<StringRef, 0> lines;
+	bufferOrError.get()->getBuffer().split(lines, '\n', -1, false);
+	if (lines.size() == 0 || lines[0] != databaseVersion)
+	{
+		// Another fcd build wrote this file. Start over.
+		return true;
+	}
+	
+	for (StringRef line : make_range(lines.begin() + 1, lines.end()))
+	{
+		string fingerprint;
+		CallInformation callInfo;
+		if (parseEntry(targetInfo, line, fingerprint, callInfo))
+		{
+			entries[fingerprint] = move(callInfo);
+		}
+	}
+	return true;
+}
+
+bool CallInformationDatabase::save(string& errorMessage) const
+{
+	// Write to a temporary file and rename it, so that concurrent runs never see partial databases.
+	int fd;
+	SmallString<128> temporaryPath;
+	SmallString<128> model(path);
+	model += "-%%%%%%%%.tmp";
+	if (auto error = sys::fs::createUniqueFile(model, fd, temporaryPath))
+	{
+		errorMessage = error.message();
+		return false;
+	}
+	
+	// Sort entries so that the file is stable across runs.
+	vector<const pair<const string, CallInformation>*> sortedEntries;
+	for (const auto& pair : entries)
+	{
+		sortedEntries.push_back(&pair);
+	}
+	sort(sortedEntries.begin(), sortedEntries.end(), [](const pair<const string, CallInformation>* a, const pair<const string, CallInformation>* b)
+	{
+		return a->first < b->first;
+	});
+	
+	{
+		raw_fd_ostream output(fd, true);
+		output << databaseVersion << '\n';
+		for (const auto* entry : sortedEntries)
+		{
+			const CallInformation& callInfo = entry->second;
+			const CallingConvention* cc = callInfo.getCallingConvention();
+			output << entry->first << ' ' << callInfo.getStage() << ' ' << (cc == nullptr ? "-" : cc->getName());
+			output << ' ' << (callInfo.isVararg() ? '1' : '0');
+			for (const ValueInformation& value : callInfo.parameters())
+			{
+				output << ' ';
+				printValue(output, value);
+			}
+			output << " ->";
+			for (const ValueInformation& value : callInfo.returns())
+			{
+				output << ' ';
+				printValue(output, value);
+			}
+			output << '\n';
+		}
+	}
+	
+	if (auto error = sys::fs::rename(temporaryPath, path))
+	{
+		errorMessage = error.message();
+		return false;
+	}
+	return true;
+}
+
+const CallInformation* CallInformationDatabase::find(StringRef fingerprint) const
+{
+	auto iter = entries.find(fingerprint.str());
+	return iter == entries.end() ? nullptr : &iter->second;
+}
+
+void CallInformationDatabase::insert(StringRef fingerprint, const CallInformation& callInfo)
+{
+	assert(callInfo.getStage() == CallInformation::Completed || callInfo.getStage() == CallInformation::Failed);
+	entries[fingerprint.str()] = callInfo;
+	dirty = true;
+}
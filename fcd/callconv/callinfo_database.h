@@ -0,0 +1,64 @@
+//
+// callinfo_database.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef fcd__callconv_callinfo_database_h
+#define fcd__callconv_callinfo_database_h
+
+#include "params_registry.h"
+
+#include <llvm/ADT/StringRef.h>
+
+#include <string>
+#include <unordered_map>
+
+class TargetInfo;
+
+// Call information computed by previous fcd runs, keyed by function fingerprints (see ParameterRegistry). The file
+// has one line per function:
+//
+//   <fingerprint> <stage> <calling convention> <vararg> <parameters...> -> <returns...>
+//
+// where values are written as r:<register>, f:<register> or s:<frame base offset>. The database is written back in
+// its destructor if it changed. A database with an empty path only lives in memory.
+class CallInformationDatabase
+{
+	std::string path;
+	std::unordered_map<std::string, CallInformation> entries;
+	bool loaded;
+	bool dirty;
+	
+	bool save(std::string& errorMessage) const;
+	
+public:
+	explicit CallInformationDatabase(std::string path);
+	~CallInformationDatabase();
+	
+	// A missing file is an empty database. Register names can only be resolved once a target is known, so this is
+	// called by the ParameterRegistry.
+	bool load(const TargetInfo& targetInfo, std::string& errorMessage);
+	bool isLoaded() const { return loaded; }
+	
+	const CallInformation* find(llvm::StringRef fingerprint) const;
+	void insert(llvm::StringRef fingerprint, const CallInformation& callInfo);
+};
+
+#endif /* fcd__callconv_callinfo_database_h */
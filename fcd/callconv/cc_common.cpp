@@ -30,56 +30,6 @@
 using namespace llvm;
 using namespace std;
 
-namespace
-{
-	void findUsedReturns(
-		// invariant inputs
-		const vector<const TargetRegisterInfo*>& returns,
-		TargetInfo& targetInfo,
-		MemorySSA& mssa,
-		
-		// inputs
-		SmallPtrSetImpl<MemoryPhi*>& visited,
-		MemoryAccess& access,
-		
-		// outputs
-		vector<const TargetRegisterInfo*>& result)
-	{
-		for (auto user : access.users())
-		{
-			if (auto phi = dyn_cast<MemoryPhi>(user))
-			{
-				if (visited.insert(phi).second)
-				{
-					findUsedReturns(returns, targetInfo, mssa, visited, *phi, result);
-				}
-			}
-			else if (auto use = dyn_cast<MemoryUse>(user))
-			{
-				if (auto load = dyn_cast<LoadInst>(use->getMemoryInst()))
-				if (const TargetRegisterInfo* maybeReg = targetInfo.registerInfo(*load->getPointerOperand()))
-				{
-					bool alreadyFound = any_of(result.begin(), result.end(), [=](const TargetRegisterInfo* existing)
-					{
-						return existing == maybeReg;
-					});
-					
-					if (!alreadyFound)
-					{
-						const TargetRegisterInfo& registerInfo = targetInfo.largestOverlappingRegister(*maybeReg);
-						auto iter = find(returns.begin(), returns.end(), &registerInfo);
-						if (iter != returns.end())
-						{
-							// return value!
-							result.push_back(&registerInfo);
-						}
-					}
-				}
-			}
-		}
-	}
-}
-
 vector<const TargetRegisterInfo*> ipaFindUsedReturns(ParameterRegistry& registry, Function& function, const vector<const TargetRegisterInfo*>& returns)
 {
 	// Excuse entry points from not having callers; use every return.
@@ -92,8 +42,7 @@ vector<const TargetRegisterInfo*> ipaFindUsedReturns(ParameterRegistry& registry
 	
 	// Otherwise, loop through callers and see which registers are used after the function call.
 	TargetInfo& targetInfo = registry.getTargetInfo();
-	SmallPtrSet<MemoryPhi*, 4> visited;
-	vector<const TargetRegisterInfo*> result;
+	SmallBitVector used(targetInfo.targetRegisterInfo().size());
 	for (auto& use : function.uses())
 	{
 		if (auto call = dyn_cast<CallInst>(use.getUser()))
@@ -109,9 +58,22 @@ vector<const TargetRegisterInfo*> ipaFindUsedReturns(ParameterRegistry& registry
 			auto pointerType = dyn_cast<PointerType>(parentArgs->getType());
 			assert(pointerType != nullptr && pointerType->getTypeAtIndex(int(0))->getStructName() == "struct.x86_regs");
 			
-			visited.clear();
-			MemorySSA& mssa = *registry.getMemorySSA(*parentFunction);
-			findUsedReturns(returns, targetInfo, mssa, visited, *mssa.getMemoryAccess(call), result);
+			const RegisterUses& callerUses = registry.getRegisterUses(*parentFunction);
+			auto iter = callerUses.readAfterCall.find(call);
+			if (iter != callerUses.readAfterCall.end())
+			{
+				used |= iter->second;
+			}
+		}
+	}
+	
+	vector<const TargetRegisterInfo*> result;
+	for (const TargetRegisterInfo* reg : returns)
+	{
+		if (used[targetInfo.registerSlot(*reg)])
+		{
+			// return value!
+			result.push_back(reg);
 		}
 	}
 	return result;
@@ -125,15 +87,10 @@ bool hackhack_fillFromParamInfo(LLVMContext& ctx, ParameterRegistry& registry, C
 	vector<Type*> params(integerLikeParameters, intType);
 	FunctionType* fType = FunctionType::get(returnType, params, false);
 	
-	for (CallingConvention* cc : registry)
+	if (const CallInformation* typeInfo = registry.getFunctionTypeCallInfo(*fType))
 	{
-		if (cc->analyzeFunctionType(registry, info, *fType))
-		{
-			info.setCallingConvention(cc);
-			return true;
-		}
-		
-		info.clear();
+		info = *typeInfo;
+		return true;
 	}
 	
 	assert(false);
@@ -22,16 +22,24 @@
 #include "anyarch_anycc.h"
 #include "anyarch_interactive.h"
 #include "call_conv.h"
+#include "callinfo_database.h"
 #include "command_line.h"
 #include "executable.h"
+#include "main.h"
 #include "metadata.h"
 #include "params_registry.h"
 #include "pass_executable.h"
 
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Analysis/CallGraph.h>
 #include <llvm/Analysis/PostDominators.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/IR/Constants.h>
 #include <llvm/IR/Dominators.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Support/MD5.h>
 
 using namespace llvm;
 using namespace std;
@@ -134,6 +142,297 @@ namespace
 		return false;
 	}
 	
+	void updateHash(MD5& hash, uint64_t value)
+	{
+		uint8_t bytes[sizeof value];
+		for (size_t i = 0; i < sizeof value; ++i)
+		{
+			bytes[i] = static_cast<uint8_t>(value >> (i * 8));
+		}
+		hash.update(bytes);
+	}
+	
+	// Types are hashed by structure rather than by pointer, since fingerprints outlive the LLVMContext. Named structures
+	// are identified by their name, which also stops recursion.
+	void hashType(MD5& hash, Type& type)
+	{
+		updateHash(hash, type.getTypeID());
+		if (auto integer = dyn_cast<IntegerType>(&type))
+		{
+			updateHash(hash, integer->getBitWidth());
+		}
+		else if (auto pointer = dyn_cast<PointerType>(&type))
+		{
+			updateHash(hash, pointer->getAddressSpace());
+			hashType(hash, *pointer->getElementType());
+		}
+		else if (auto structure = dyn_cast<StructType>(&type))
+		{
+			if (structure->hasName())
+			{
+				hash.update(structure->getName());
+				hash.update(StringRef("", 1));
+			}
+			else
+			{
+				updateHash(hash, structure->isPacked());
+				updateHash(hash, structure->getNumElements());
+				for (Type* element : structure->elements())
+				{
+					hashType(hash, *element);
+				}
+			}
+		}
+		else if (auto array = dyn_cast<ArrayType>(&type))
+		{
+			updateHash(hash, array->getNumElements());
+			hashType(hash, *array->getElementType());
+		}
+		else if (auto vector = dyn_cast<VectorType>(&type))
+		{
+			updateHash(hash, vector->getNumElements());
+			hashType(hash, *vector->getElementType());
+		}
+		else if (auto function = dyn_cast<FunctionType>(&type))
+		{
+			updateHash(hash, function->isVarArg());
+			updateHash(hash, function->getNumParams());
+			hashType(hash, *function->getReturnType());
+			for (Type* param : function->params())
+			{
+				hashType(hash, *param);
+			}
+		}
+	}
+	
+	void hashAPInt(MD5& hash, const APInt& value)
+	{
+		updateHash(hash, value.getBitWidth());
+		for (unsigned i = 0; i < value.getNumWords(); ++i)
+		{
+			updateHash(hash, value.getRawData()[i]);
+		}
+	}
+	
+	void hashConstant(MD5& hash, const Constant& constant)
+	{
+		updateHash(hash, constant.getValueID());
+		hashType(hash, *constant.getType());
+		if (auto global = dyn_cast<GlobalValue>(&constant))
+		{
+			hash.update(global->getName());
+			hash.update(StringRef("", 1));
+			return;
+		}
+		
+		if (auto integer = dyn_cast<ConstantInt>(&constant))
+		{
+			hashAPInt(hash, integer->getValue());
+		}
+		else if (auto fp = dyn_cast<ConstantFP>(&constant))
+		{
+			hashAPInt(hash, fp->getValueAPF().bitcastToAPInt());
+		}
+		else if (auto data = dyn_cast<ConstantDataSequential>(&constant))
+		{
+			updateHash(hash, data->getNumElements());
+			hash.update(data->getRawDataValues());
+		}
+		else if (auto expr = dyn_cast<ConstantExpr>(&constant))
+		{
+			updateHash(hash, expr->getOpcode());
+			updateHash(hash, expr->getRawSubclassOptionalData());
+			if (expr->isCompare())
+			{
+				updateHash(hash, expr->getPredicate());
+			}
+			if (expr->hasIndices())
+			{
+				for (unsigned index : expr->getIndices())
+				{
+					updateHash(hash, index);
+				}
+			}
+		}
+		
+		// Aggregates, expressions and block addresses are also identified by their operands.
+		updateHash(hash, constant.getNumOperands());
+		for (const Use& operand : constant.operands())
+		{
+			if (auto constantOperand = dyn_cast<Constant>(operand.get()))
+			{
+				hashConstant(hash, *constantOperand);
+			}
+			else
+			{
+				updateHash(hash, operand->getValueID());
+			}
+		}
+	}
+	
+	// Structural hash of a function body that doesn't depend on the module that holds it: values are numbered in
+	// order, globals are identified by name. Together with the analysis settings, it identifies call information that
+	// can be reused across phases (and across runs, through a CallInformationDatabase).
+	string fingerprint(StringRef settings, const Function& fn)
+	{
+		unordered_map<const Value*, uint64_t> numbers;
+		for (const Argument& arg : fn.args())
+		{
+			numbers.insert({&arg, numbers.size()});
+		}
+		for (const BasicBlock& bb : fn)
+		{
+			numbers.insert({&bb, numbers.size()});
+			for (const Instruction& inst : bb)
+			{
+				numbers.insert({&inst, numbers.size()});
+			}
+		}
+		
+		MD5 hash;
+		hash.update(settings);
+		hashType(hash, *fn.getFunctionType());
+		for (const BasicBlock& bb : fn)
+		{
+			for (const Instruction& inst : bb)
+			{
+				updateHash(hash, inst.getOpcode());
+				updateHash(hash, inst.getRawSubclassOptionalData());
+				hashType(hash, *inst.getType());
+				updateHash(hash, md::isProgramMemory(inst));
+				if (auto alloca = dyn_cast<AllocaInst>(&inst))
+				{
+					hashType(hash, *alloca->getAllocatedType());
+					updateHash(hash, md::isStackFrame(*alloca));
+					updateHash(hash, md::isRegisterStruct(*alloca));
+				}
+				if (auto cmp = dyn_cast<CmpInst>(&inst))
+				{
+					updateHash(hash, cmp->getPredicate());
+				}
+				
+				updateHash(hash, inst.getNumOperands());
+				for (const Use& operand : inst.operands())
+				{
+					auto iter = numbers.find(operand.get());
+					if (iter != numbers.end())
+					{
+						updateHash(hash, iter->second);
+					}
+					else if (auto constant = dyn_cast<Constant>(operand.get()))
+					{
+						hashConstant(hash, *constant);
+					}
+					else
+					{
+						updateHash(hash, operand->getValueID());
+					}
+				}
+			}
+		}
+		
+		MD5::MD5Result result;
+		SmallString<32> resultString;
+		hash.final(result);
+		MD5::stringifyResult(result, resultString);
+		return resultString.str();
+	}
+	
+	// Recursive functions are analyzed again until their call information stops changing, within this bound.
+	const unsigned maxRecursiveIterations = 8;
+	
+	bool sameValues(const ValueInformation& a, const ValueInformation& b)
+	{
+		if (a.type != b.type)
+		{
+			return false;
+		}
+		return a.type == ValueInformation::Stack ? a.frameBaseOffset == b.frameBaseOffset : a.registerInfo == b.registerInfo;
+	}
+	
+	bool sameCallInformation(const CallInformation& a, const CallInformation& b)
+	{
+		return a.getStage() == b.getStage()
+			&& a.getCallingConvention() == b.getCallingConvention()
+			&& a.isVararg() == b.isVararg()
+			&& a.parameters_size() == b.parameters_size()
+			&& equal(a.begin(), a.end(), b.begin(), b.end(), sameValues);
+	}
+	
+	bool isAnalyzable(const Function& fn)
+	{
+		return !md::isPrototype(fn) && md::getAssemblyString(fn) == nullptr;
+	}
+	
+	void addReadsAfter(const TargetInfo& target, SmallPtrSetImpl<MemoryPhi*>& visited, MemoryAccess& access, SmallBitVector& into)
+	{
+		for (User* user : access.users())
+		{
+			if (auto phi = dyn_cast<MemoryPhi>(user))
+			{
+				if (visited.insert(phi).second)
+				{
+					addReadsAfter(target, visited, *phi, into);
+				}
+			}
+			else if (auto use = dyn_cast<MemoryUse>(user))
+			{
+				if (auto load = dyn_cast<LoadInst>(use->getMemoryInst()))
+				if (const TargetRegisterInfo* reg = target.registerInfo(*load->getPointerOperand()))
+				{
+					into.set(target.registerSlot(target.largestOverlappingRegister(*reg)));
+				}
+			}
+		}
+	}
+	
+	void summarizeRegisterUses(const TargetInfo& target, MemorySSA& mssa, Function& fn, RegisterUses& into)
+	{
+		size_t slots = target.targetRegisterInfo().size();
+		into.readOnEntry.resize(slots);
+		into.written.resize(slots);
+		
+		SmallVector<CallInst*, 8> calls;
+		for (BasicBlock& bb : fn)
+		{
+			for (Instruction& inst : bb)
+			{
+				if (auto load = dyn_cast<LoadInst>(&inst))
+				{
+					if (const TargetRegisterInfo* reg = target.registerInfo(*load->getPointerOperand()))
+					if (auto use = dyn_cast_or_null<MemoryUse>(mssa.getMemoryAccess(load)))
+					if (mssa.isLiveOnEntryDef(use->getDefiningAccess()))
+					{
+						into.readOnEntry.set(target.registerSlot(target.largestOverlappingRegister(*reg)));
+					}
+				}
+				else if (auto store = dyn_cast<StoreInst>(&inst))
+				{
+					if (const TargetRegisterInfo* reg = target.registerInfo(*store->getPointerOperand()))
+					{
+						into.written.set(target.registerSlot(target.largestOverlappingRegister(*reg)));
+					}
+				}
+				else if (auto call = dyn_cast<CallInst>(&inst))
+				{
+					calls.push_back(call);
+				}
+			}
+		}
+		
+		SmallPtrSet<MemoryPhi*, 4> visited;
+		for (CallInst* call : calls)
+		{
+			if (auto def = dyn_cast_or_null<MemoryDef>(mssa.getMemoryAccess(call)))
+			{
+				SmallBitVector& readAfter = into.readAfterCall[call];
+				readAfter.resize(slots);
+				visited.clear();
+				addReadsAfter(target, visited, *def, readAfter);
+			}
+		}
+	}
+	
 	struct TemporaryTrue
 	{
 		bool old;
@@ -160,18 +459,52 @@ ModRefInfo CallInformation::getRegisterModRef(const TargetRegisterInfo &reg) con
 	// otherwise, NoModRef, as far as the call information is concerned.
 	// Two notable exceptions are the instruction pointer and the stack pointer, which have to be handled out of here.
 	underlying_type_t<ModRefInfo> result = MRI_NoModRef;
-	auto retBegin = return_begin();
-	for (auto iter = begin(); iter != end(); ++iter)
+	unsigned id = reg.registerId;
+	if (id < referencedRegisters.size() && referencedRegisters[id])
 	{
-		if (iter->type == ValueInformation::IntegerRegister && &reg == iter->registerInfo)
-		{
-			result |= iter < retBegin ? MRI_Ref : MRI_Mod;
-		}
+		result |= MRI_Ref;
+	}
+	if (id < modifiedRegisters.size() && modifiedRegisters[id])
+	{
+		result |= MRI_Mod;
 	}
 	
 	return static_cast<ModRefInfo>(result);
 }
 
+hash_code hash_value(const CallInformation& info)
+{
+	hash_code result = hash_combine(info.getStage(), info.getCallingConvention(), info.isVararg(), info.parameters_size());
+	for (const ValueInformation& value : info)
+	{
+		uint64_t storage = value.type == ValueInformation::Stack
+			? value.frameBaseOffset
+			: reinterpret_cast<uintptr_t>(value.registerInfo);
+		result = hash_combine(result, value.type, storage);
+	}
+	return result;
+}
+
+hash_code ParameterRegistryAAResults::hashCalleeInformation(const Function& fn) const
+{
+	hash_code result = hash_value(&fn);
+	for (const BasicBlock& bb : fn)
+	{
+		for (const Instruction& inst : bb)
+		{
+			if (auto call = dyn_cast<CallInst>(&inst))
+			if (const Function* callee = call->getCalledFunction())
+			{
+				auto iter = callInformation.find(callee);
+				result = iter == callInformation.end()
+					? hash_combine(result, callee)
+					: hash_combine(result, callee, iter->second);
+			}
+		}
+	}
+	return result;
+}
+
 ModRefInfo ParameterRegistryAAResults::getModRefInfo(ImmutableCallSite cs, const MemoryLocation &loc)
 {
 	if (auto func = cs.getCalledFunction())
@@ -189,8 +522,8 @@ ModRefInfo ParameterRegistryAAResults::getModRefInfo(ImmutableCallSite cs, const
 
 char ParameterRegistry::ID = 0;
 
-ParameterRegistry::ParameterRegistry()
-: ModulePass(ID)
+ParameterRegistry::ParameterRegistry(CallInformationDatabase* database)
+: ModulePass(ID), memorySSAs(&localMemorySSAs), database(database)
 {
 }
 
@@ -203,45 +536,99 @@ CallInformation* ParameterRegistry::analyzeFunction(Function& fn)
 	CallInformation& info = aaResults->callInformation[&fn];
 	if (info.getStage() == CallInformation::New)
 	{
-		for (CallingConvention* cc : ccChain)
+		analyzeFunctionInto(fn, info);
+	}
+	
+	return info.getStage() == CallInformation::Completed ? &info : nullptr;
+}
+
+void ParameterRegistry::analyzeFunctionInto(Function& fn, CallInformation& info)
+{
+	for (CallingConvention* cc : ccChain)
+	{
+		info.setStage(CallInformation::Analyzing);
+		if (cc->analyzeFunction(*this, info, fn))
 		{
-			info.setStage(CallInformation::Analyzing);
-			if (cc->analyzeFunction(*this, info, fn))
-			{
-				info.setCallingConvention(cc);
-				info.setStage(CallInformation::Completed);
-				break;
-			}
-			else
-			{
-				info.setStage(CallInformation::New);
-				info.clear();
-			}
+			info.setCallingConvention(cc);
+			info.setStage(CallInformation::Completed);
+			return;
 		}
 		
-		if (info.getStage() != CallInformation::Completed)
+		info.setStage(CallInformation::New);
+		info.clear();
+	}
+	info.setStage(CallInformation::Failed);
+}
+
+// Functions of a non-trivial SCC see each other's call information while it's still being computed, which calling
+// conventions can't use. Once each member has been analyzed, analyze them again with the results of the previous
+// iteration until they settle. Each member is analyzed into a temporary, so that calls to it (including its own
+// recursive calls) keep seeing its previous result in the meantime.
+void ParameterRegistry::analyzeStronglyConnectedFunctions(ArrayRef<Function*> functions, bool recursive)
+{
+	bool reused = all_of(functions.begin(), functions.end(), [&](Function* fn)
+	{
+		return aaResults->callInformation.count(fn) != 0;
+	});
+	
+	for (Function* fn : functions)
+	{
+		analyzeFunction(*fn);
+	}
+	
+	if (!recursive || reused)
+	{
+		return;
+	}
+	
+	for (unsigned i = 0; i < maxRecursiveIterations; ++i)
+	{
+		// Register uses depend on the MemorySSA of functions, which depends on the call information of their callees.
+		for (Function* fn : functions)
+		{
+			registerUses.erase(fn);
+		}
+		
+		bool changed = false;
+		for (Function* fn : functions)
 		{
-			info.setStage(CallInformation::Failed);
+			CallInformation next;
+			analyzeFunctionInto(*fn, next);
+			CallInformation& info = aaResults->callInformation[fn];
+			changed |= !sameCallInformation(info, next);
+			info = move(next);
+		}
+		
+		if (!changed)
+		{
+			break;
 		}
 	}
-	
-	return info.getStage() == CallInformation::Completed ? &info : nullptr;
 }
 
-void ParameterRegistry::setupCCChain()
+void ParameterRegistry::setupCCChain(Module& module)
 {
 	if (defaultCC != nullptr)
 	{
 		addCallingConvention(defaultCC);
 	}
-	else
+	else if (Executable* executable = getExecutable())
 	{
-		if (Executable* executable = getExecutable())
 		if (auto cc = CallingConvention::getMatchingCallingConvention(getTargetInfo(), *executable))
 		{
 			addCallingConvention(cc);
 		}
 	}
+	else
+	{
+		// Modules exported by another fcd process remember the calling convention that it inferred.
+		StringRef ccName = md::getSystemCallingConvention(module);
+		if (ccName.size() > 0)
+		if (auto cc = CallingConvention::getCallingConvention(ccName.str()))
+		{
+			addCallingConvention(cc);
+		}
+	}
 	
 	if (ccChain.size() >= 1)
 	{
@@ -266,10 +653,10 @@ Executable* ParameterRegistry::getExecutable()
 // It is possible that analysis returns an empty set, but then returns nullptr.
 const CallInformation* ParameterRegistry::getCallInfo(Function &function)
 {
-	assert(!md::isPrototype(function));
 	auto iter = aaResults->callInformation.find(&function);
 	if (iter == aaResults->callInformation.end())
 	{
+		assert(!md::isPrototype(function));
 		return analyzing ? analyzeFunction(function) : nullptr;
 	}
 	
@@ -283,13 +670,10 @@ const CallInformation* ParameterRegistry::getDefinitionCallInfo(Function& functi
 	CallInformation& info = aaResults->callInformation[&function];
 	if (info.getStage() == CallInformation::New)
 	{
-		for (CallingConvention* cc : *this)
+		if (const CallInformation* typeInfo = getFunctionTypeCallInfo(*function.getFunctionType()))
 		{
-			if (cc->analyzeFunctionType(*this, info, *function.getFunctionType()))
-			{
-				info.setCallingConvention(cc);
-				return &info;
-			}
+			info = *typeInfo;
+			return &info;
 		}
 	}
 	else if (info.getStage() == CallInformation::Completed)
@@ -300,6 +684,75 @@ const CallInformation* ParameterRegistry::getDefinitionCallInfo(Function& functi
 	return nullptr;
 }
 
+// Prototypes have no body to analyze. They only have complete call information when it was computed by another fcd
+// process (one that had a body for them) and stored in the module with md::setCallInformation.
+const CallInformation* ParameterRegistry::getImportedCallInfo(Function& function)
+{
+	assert(md::isPrototype(function));
+	auto iter = aaResults->callInformation.find(&function);
+	if (iter != aaResults->callInformation.end() && iter->second.getStage() == CallInformation::Completed)
+	{
+		return &iter->second;
+	}
+	return nullptr;
+}
+
+// Prototypes have no body to analyze either, so the first call to them stands for all of them. Binaries call the same
+// imports from many places, and it is only analyzed once.
+const CallInformation* ParameterRegistry::getCallSiteInfo(Function& callee)
+{
+	auto iter = callSiteInfos.find(&callee);
+	if (iter != callSiteInfos.end())
+	{
+		return iter->second.get();
+	}
+	
+	unique_ptr<CallInformation> info;
+	for (User* user : callee.users())
+	{
+		auto call = dyn_cast<CallInst>(user);
+		if (call != nullptr && call->getCalledFunction() == &callee)
+		{
+			info = analyzeCallSite(CallSite(call));
+			break;
+		}
+	}
+	
+	const CallInformation* result = info.get();
+	callSiteInfos[&callee] = move(info);
+	return result;
+}
+
+// Function types are uniqued by their context, so every function with the same type shares the same result.
+const CallInformation* ParameterRegistry::getFunctionTypeCallInfo(FunctionType& type)
+{
+	auto iter = functionTypeInfos.find(&type);
+	if (iter != functionTypeInfos.end())
+	{
+		return iter->second.get();
+	}
+	
+	unique_ptr<CallInformation> info(new CallInformation);
+	for (CallingConvention* cc : ccChain)
+	{
+		if (cc->analyzeFunctionType(*this, *info, type))
+		{
+			info->setCallingConvention(cc);
+			break;
+		}
+		info->clear();
+	}
+	
+	if (info->getCallingConvention() == nullptr)
+	{
+		info.reset();
+	}
+	
+	const CallInformation* result = info.get();
+	functionTypeInfos[&type] = move(info);
+	return result;
+}
+
 unique_ptr<CallInformation> ParameterRegistry::analyzeCallSite(CallSite callSite)
 {
 	unique_ptr<CallInformation> info(new CallInformation);
@@ -325,7 +778,7 @@ unique_ptr<CallInformation> ParameterRegistry::analyzeCallSite(CallSite callSite
 
 unique_ptr<MemorySSA> ParameterRegistry::createMemorySSA(Function &function)
 {
-	auto& domTree = getAnalysis<DominatorTreeWrapperPass>(function).getDomTree();
+	auto& domTree = memorySSAs->getDominatorTree(function);
 	auto& aaResult = getAnalysis<AAResultsWrapperPass>(function).getAAResults();
 	
 	// XXX: don't explicitly depend on this other AA pass
@@ -337,34 +790,48 @@ unique_ptr<MemorySSA> ParameterRegistry::createMemorySSA(Function &function)
 
 MemorySSA* ParameterRegistry::getMemorySSA(Function &function)
 {
-	unsigned version = md::getFunctionVersion(function);
-	auto iter = mssas.find(&function);
-	if (iter == mssas.end())
+	return &memorySSAs->get(function, aaResults->hashCalleeInformation(function), [this](Function& fn)
+	{
+		return createMemorySSA(fn);
+	});
+}
+
+bool ParameterRegistry::comesBefore(const Instruction* a, const Instruction* b)
+{
+	const BasicBlock* block = a->getParent();
+	assert(b->getParent() == block);
+	if (!analyzing)
+	{
+		return OrderedBasicBlock(block).dominates(a, b);
+	}
+	
+	auto& order = blockOrders[block];
+	if (order == nullptr)
 	{
-		auto mssa = createMemorySSA(function);
-		iter = mssas.insert(make_pair(&function, make_pair(version, move(mssa)))).first;
+		order.reset(new OrderedBasicBlock(block));
 	}
-	else if (iter->second.first != version)
+	return order->dominates(a, b);
+}
+
+const RegisterUses& ParameterRegistry::getRegisterUses(Function& fn)
+{
+	auto& uses = registerUses[&fn];
+	if (uses == nullptr || !analyzing)
 	{
-		iter->second.first = version;
-		iter->second.second = createMemorySSA(function);
+		uses.reset(new RegisterUses);
+		summarizeRegisterUses(getTargetInfo(), *getMemorySSA(fn), fn, *uses);
 	}
-	return iter->second.second.get();
+	return *uses;
 }
 
 void ParameterRegistry::getAnalysisUsage(AnalysisUsage &au) const
 {
 	au.addRequired<AAResultsWrapperPass>();
-	
-	au.addRequired<DominatorTreeWrapperPass>();
-	au.addPreserved<DominatorTreeWrapperPass>();
+	au.addRequired<CallGraphWrapperPass>();
 	
 	au.addRequired<TargetLibraryInfoWrapperPass>();
 	au.addPreserved<TargetLibraryInfoWrapperPass>();
 	
-	au.addRequired<PostDominatorTreeWrapperPass>();
-	au.addPreserved<PostDominatorTreeWrapperPass>();
-	
 	au.addRequired<ExecutableWrapper>();
 	au.addPreserved<ExecutableWrapper>();
 	
@@ -394,28 +861,203 @@ bool ParameterRegistry::doInitialization(Module& m)
 	return ModulePass::doInitialization(m);
 }
 
+// Loads call information that the module or the database already has for functions that didn't change, and leaves in
+// fingerprints the functions that still need to be analyzed. Since analysis results depend on callees, a function
+// only reuses call information when all of its callees do too.
+void ParameterRegistry::reuseCallInformation(Module& m, unordered_map<Function*, string>& fingerprints)
+{
+	if (database != nullptr && !database->isLoaded())
+	{
+		string errorMessage;
+		if (!database->load(getTargetInfo(), errorMessage))
+		{
+			errs() << "can't load call information database: " << errorMessage << '\n';
+		}
+	}
+	
+	string settings = isFullDisassembly() ? "full" : "partial";
+	for (CallingConvention* cc : ccChain)
+	{
+		settings += ' ';
+		settings += cc->getName();
+	}
+	
+	unordered_map<Function*, CallInformation> candidates;
+	for (Function& fn : m.getFunctionList())
+	{
+		CallInformation info;
+		StringRef storedFingerprint;
+		if (md::isPrototype(fn))
+		{
+			// Prototypes get call information from the fcd process that had their body, which is already final.
+			if (md::getCallInformation(fn, getTargetInfo(), info))
+			{
+				aaResults->callInformation[&fn] = move(info);
+			}
+			continue;
+		}
+		
+		if (!isAnalyzable(fn))
+		{
+			continue;
+		}
+		
+		string& thisFingerprint = fingerprints[&fn];
+		thisFingerprint = fingerprint(settings, fn);
+		if (md::getCallInformation(fn, getTargetInfo(), info, &storedFingerprint) && storedFingerprint == thisFingerprint)
+		{
+			candidates[&fn] = move(info);
+		}
+		else if (database != nullptr)
+		if (const CallInformation* stored = database->find(thisFingerprint))
+		{
+			candidates[&fn] = *stored;
+		}
+	}
+	
+	bool changed;
+	do
+	{
+		changed = false;
+		for (auto iter = candidates.begin(); iter != candidates.end(); )
+		{
+			bool calleesReused = true;
+			for (const BasicBlock& bb : *iter->first)
+			{
+				for (const Instruction& inst : bb)
+				{
+					if (auto call = dyn_cast<CallInst>(&inst))
+					if (Function* callee = call->getCalledFunction())
+					if (isAnalyzable(*callee) && candidates.count(callee) == 0)
+					{
+						calleesReused = false;
+					}
+				}
+			}
+			
+			if (calleesReused)
+			{
+				++iter;
+			}
+			else
+			{
+				iter = candidates.erase(iter);
+				changed = true;
+			}
+		}
+	}
+	while (changed);
+	
+	for (auto& pair : candidates)
+	{
+		aaResults->callInformation[pair.first] = move(pair.second);
+		fingerprints.erase(pair.first);
+	}
+}
+
 bool ParameterRegistry::runOnModule(Module& m)
 {
 	aaHack.reset(new ProgramMemoryAAResult);
-	setupCCChain();
+	setupCCChain(m);
+	
+	// Share MemorySSA with other passes (and later pass managers) when possible.
+	auto provider = getAnalysisIfAvailable<MemorySSAProvider>();
+	memorySSAs = provider == nullptr ? &localMemorySSAs : &provider->getCache();
 	
 	aaResults.reset(new ParameterRegistryAAResults(TargetInfo::getTargetInfo(m)));
+	callSiteInfos.clear();
+	functionTypeInfos.clear();
+	
+	analyzedFingerprints.clear();
+	reuseCallInformation(m, analyzedFingerprints);
 	
+	// Analyze functions bottom-up, so that callees are complete by the time that their callers need them.
 	TemporaryTrue isAnalyzing(analyzing);
+	CallGraph& callGraph = getAnalysis<CallGraphWrapperPass>().getCallGraph();
+	for (auto scc = scc_begin(&callGraph); !scc.isAtEnd(); ++scc)
+	{
+		SmallVector<Function*, 4> functions;
+		for (CallGraphNode* node : *scc)
+		{
+			if (Function* fn = node->getFunction())
+			if (isAnalyzable(*fn))
+			{
+				functions.push_back(fn);
+			}
+		}
+		analyzeStronglyConnectedFunctions(functions, scc.hasLoop());
+	}
+	
+	// Functions that the call graph doesn't know about (it normally knows about all of them).
 	for (auto& fn : m.getFunctionList())
 	{
-		if (!md::isPrototype(fn) && md::getAssemblyString(fn) == nullptr)
+		if (isAnalyzable(fn))
 		{
 			analyzeFunction(fn);
 		}
 	}
 	
+	blockOrders.clear();
+	registerUses.clear();
 	return false;
 }
 
+void ParameterRegistry::storeCallInformation()
+{
+	for (const auto& pair : analyzedFingerprints)
+	{
+		Function& fn = *pair.first;
+		const CallInformation& info = aaResults->callInformation[&fn];
+		md::setCallInformation(fn, info, pair.second);
+		if (database != nullptr)
+		{
+			database->insert(pair.second, info);
+		}
+	}
+	analyzedFingerprints.clear();
+}
+
 INITIALIZE_PASS_BEGIN(ParameterRegistry, "paramreg", "ModRef info for registers", false, true)
 INITIALIZE_PASS_DEPENDENCY(AAResultsWrapperPass)
 INITIALIZE_PASS_DEPENDENCY(CallGraphWrapperPass)
-INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
-INITIALIZE_PASS_DEPENDENCY(PostDominatorTreeWrapperPass)
 INITIALIZE_PASS_END(ParameterRegistry, "paramreg", "ModRef info for registers", false, true)
+
+namespace
+{
+	// The registry is an analysis, so it doesn't change the module itself. This pass saves the call information that
+	// it computed, in the module and in the database, so that later registry runs (in this process or in another one)
+	// can reuse it.
+	struct CallInformationStore final : public ModulePass
+	{
+		static char ID;
+		
+		CallInformationStore() : ModulePass(ID)
+		{
+		}
+		
+		virtual const char* getPassName() const override
+		{
+			return "Store call information";
+		}
+		
+		virtual void getAnalysisUsage(AnalysisUsage& au) const override
+		{
+			au.addRequired<ParameterRegistry>();
+			au.setPreservesAll();
+		}
+		
+		virtual bool runOnModule(Module& m) override
+		{
+			getAnalysis<ParameterRegistry>().storeCallInformation();
+			return true;
+		}
+	};
+	
+	char CallInformationStore::ID = 0;
+	RegisterPass<CallInformationStore> callInformationStore("#store-callinfo", "Store call information", false, false);
+}
+
+ModulePass* createCallInformationStorePass()
+{
+	return new CallInformationStore;
+}
@@ -22,12 +22,17 @@
 #ifndef fcd__callconv_params_registry_h
 #define fcd__callconv_params_registry_h
 
+#include "memssa_cache.h"
 #include "targetinfo.h"
 #include "pass_regaa.h"
 
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/iterator_range.h>
+#include <llvm/ADT/SmallBitVector.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Analysis/OrderedBasicBlock.h>
 #include <llvm/IR/Function.h>
 #include <llvm/Pass.h>
 #include <llvm/Transforms/Utils/MemorySSA.h>
@@ -38,6 +43,7 @@
 #include <string>
 #include <unordered_map>
 
+class CallInformationDatabase;
 class CallingConvention;
 class Executable;
 class TargetInfo;
@@ -94,10 +100,27 @@ public:
 private:
 	CallingConvention* cc;
 	ContainerType values;
+	// Integer registers that are parameters (referenced) and return values (modified), indexed by register ID, so
+	// that alias analysis doesn't need to go through values.
+	llvm::SmallBitVector referencedRegisters;
+	llvm::SmallBitVector modifiedRegisters;
 	ptrdiff_t returnBegin;
 	Stage stage;
 	bool vararg;
 	
+	static void summarize(llvm::SmallBitVector& registers, const ValueInformation& value)
+	{
+		if (value.type == ValueInformation::IntegerRegister)
+		{
+			unsigned id = value.registerInfo->registerId;
+			if (id >= registers.size())
+			{
+				registers.resize(id + 1);
+			}
+			registers.set(id);
+		}
+	}
+	
 public:
 	CallInformation()
 	: cc(nullptr), returnBegin(0), stage(New), vararg(false)
@@ -157,7 +180,14 @@ public:
 		return size_t(range.end() - range.begin());
 	}
 	
-	void clear() { values.clear(); }
+	void clear()
+	{
+		values.clear();
+		referencedRegisters.clear();
+		modifiedRegisters.clear();
+		returnBegin = 0;
+	}
+	
 	void setCallingConvention(CallingConvention* cc) { this->cc = cc; }
 	void setStage(Stage stage) { this->stage = stage; }
 	void setVararg(bool v = true) { this->vararg = v; }
@@ -172,7 +202,7 @@ public:
 	void insertParameter(iterator iter, T&&... params)
 	{
 		assert(iter <= values.begin() + returnBegin);
-		values.emplace(iter, std::forward<T>(params)...);
+		summarize(referencedRegisters, *values.emplace(iter, std::forward<T>(params)...));
 		returnBegin++;
 	}
 	
@@ -180,16 +210,20 @@ public:
 	void addReturn(T&&... params)
 	{
 		values.emplace_back(std::forward<T>(params)...);
+		summarize(modifiedRegisters, values.back());
 	}
 	
 	template<typename... T>
 	void insertReturn(iterator iter, T&&... params)
 	{
 		assert(iter >= values.begin() + returnBegin);
-		values.emplace(iter, std::forward<T>(params)...);
+		summarize(modifiedRegisters, *values.emplace(iter, std::forward<T>(params)...));
 	}
 };
 
+// Equal call information hashes equally within a run.
+llvm::hash_code hash_value(const CallInformation& info);
+
 class ParameterRegistryAAResults : public llvm::AAResultBase<ParameterRegistryAAResults>
 {
 	friend class llvm::AAResultBase<ParameterRegistryAAResults>;
@@ -214,6 +248,10 @@ public:
 		return false;
 	}
 	
+	// Identifies the call information that the direct calls of fn currently see. Analyses of fn that use this alias
+	// analysis, like its MemorySSA, are outdated when it changes.
+	llvm::hash_code hashCalleeInformation(const llvm::Function& fn) const;
+	
 	llvm::ModRefInfo getModRefInfo(llvm::ImmutableCallSite cs, const llvm::MemoryLocation& loc);
 	llvm::ModRefInfo getModRefInfo(llvm::ImmutableCallSite CS1, llvm::ImmutableCallSite CS2)
 	{
@@ -221,13 +259,36 @@ public:
 	}
 };
 
+// Register accesses of a function body, computed in one sweep, as bit vectors indexed by register slot
+// (TargetInfo::registerSlot). Sub-registers count as their largest overlapping register.
+struct RegisterUses
+{
+	// Registers loaded before the function writes to them.
+	llvm::SmallBitVector readOnEntry;
+	// Registers that the function stores to.
+	llvm::SmallBitVector written;
+	// Registers loaded from the memory state that each call leaves behind, before anything else writes to memory.
+	llvm::DenseMap<const llvm::CallInst*, llvm::SmallBitVector> readAfterCall;
+};
+
 class ParameterRegistry final : public llvm::ModulePass
 {
 	std::unique_ptr<ParameterRegistryAAResults> aaResults;
 	std::unique_ptr<TargetInfo> targetInfo;
 	std::unique_ptr<ProgramMemoryAAResult> aaHack;
 	std::deque<CallingConvention*> ccChain;
-	std::unordered_map<const llvm::Function*, std::pair<unsigned, std::unique_ptr<llvm::MemorySSA>>> mssas;
+	MemorySSACache localMemorySSAs;
+	MemorySSACache* memorySSAs;
+	llvm::DenseMap<const llvm::BasicBlock*, std::unique_ptr<llvm::OrderedBasicBlock>> blockOrders;
+	llvm::DenseMap<const llvm::Function*, std::unique_ptr<RegisterUses>> registerUses;
+	// Results that don't depend on who asks, shared by every caller until the registry runs again. Failures are
+	// cached as null.
+	llvm::DenseMap<const llvm::Function*, std::unique_ptr<CallInformation>> callSiteInfos;
+	llvm::DenseMap<llvm::FunctionType*, std::unique_ptr<CallInformation>> functionTypeInfos;
+	CallInformationDatabase* database;
+	// Functions that the last run analyzed, with the fingerprint of the body that it analyzed, until
+	// storeCallInformation saves their results.
+	std::unordered_map<llvm::Function*, std::string> analyzedFingerprints;
 	bool analyzing;
 	
 	void addCallingConvention(CallingConvention* cc)
@@ -237,7 +298,10 @@ class ParameterRegistry final : public llvm::ModulePass
 	}
 	
 	CallInformation* analyzeFunction(llvm::Function& fn);
-	void setupCCChain();
+	void analyzeFunctionInto(llvm::Function& fn, CallInformation& info);
+	void analyzeStronglyConnectedFunctions(llvm::ArrayRef<llvm::Function*> functions, bool recursive);
+	void setupCCChain(llvm::Module& module);
+	void reuseCallInformation(llvm::Module& module, std::unordered_map<llvm::Function*, std::string>& fingerprints);
 	
 	std::unique_ptr<llvm::MemorySSA> createMemorySSA(llvm::Function& fn);
 	
@@ -247,7 +311,7 @@ public:
 	typedef decltype(ccChain)::iterator iterator;
 	typedef decltype(ccChain)::const_iterator const_iterator;
 	
-	ParameterRegistry();
+	ParameterRegistry(CallInformationDatabase* database = nullptr);
 	~ParameterRegistry();
 	
 	iterator begin() { return ccChain.begin(); }
@@ -263,9 +327,30 @@ public:
 	
 	const CallInformation* getCallInfo(llvm::Function& function);
 	const CallInformation* getDefinitionCallInfo(llvm::Function& function);
+	const CallInformation* getImportedCallInfo(llvm::Function& function);
+	const CallInformation* getCallSiteInfo(llvm::Function& callee);
+	const CallInformation* getFunctionTypeCallInfo(llvm::FunctionType& type);
 	std::unique_ptr<CallInformation> analyzeCallSite(llvm::CallSite callSite);
 	
 	llvm::MemorySSA* getMemorySSA(llvm::Function& function);
+	MemorySSACache& getMemorySSACache() { return *memorySSAs; }
+	
+	// Dominator trees come from the MemorySSA cache rather than from the pass manager, which would build them again
+	// every time that a module pass asks for them, and again in every pass manager.
+	llvm::DominatorTree& getDominatorTree(llvm::Function& function) { return memorySSAs->getDominatorTree(function); }
+	llvm::PostDominatorTree& getPostDominatorTree(llvm::Function& function) { return memorySSAs->getPostDominatorTree(function); }
+	
+	// Whether a comes before b in their (common) basic block. Block numberings are cached while the registry
+	// analyzes functions, since the IR doesn't change in the meantime.
+	bool comesBefore(const llvm::Instruction* a, const llvm::Instruction* b);
+	
+	// Register accesses of fn, cached like block numberings. Calling conventions look up registers in them instead
+	// of walking MemorySSA once per register, and functions of recursive SCCs are only summarized once.
+	const RegisterUses& getRegisterUses(llvm::Function& fn);
+	
+	// Saves the results of the last run in the module (with md::setCallInformation) and in the database. The
+	// CallInformationStore pass calls this, so that the registry itself doesn't change the module.
+	void storeCallInformation();
 	
 	virtual void getAnalysisUsage(llvm::AnalysisUsage& au) const override;
 	virtual const char* getPassName() const override;
@@ -273,11 +358,14 @@ public:
 	virtual bool runOnModule(llvm::Module& m) override;
 };
 
-inline ParameterRegistry* createParameterRegistryPass()
+inline ParameterRegistry* createParameterRegistryPass(CallInformationDatabase* database = nullptr)
 {
-	return new ParameterRegistry;
+	return new ParameterRegistry(database);
 }
 
+// Runs right after the ParameterRegistry that it should save the results of.
+llvm::ModulePass* createCallInformationStorePass();
+
 namespace llvm
 {
 	void initializeParameterRegistryPass(PassRegistry& PR);
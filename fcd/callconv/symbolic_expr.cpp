@@ -113,24 +113,38 @@ Expression* ExpressionContext::simplify(Expression* x)
 	// only binary operator expressions can be simplified
 	if (auto bin = dyn_cast<AddExpression>(x))
 	{
+		Expression*& result = simplified[bin];
+		if (result != nullptr)
+		{
+			return result;
+		}
+		
 		CollectedOperands operands = collectExpressionOperands(bin);
 		Expression* root = nullptr;
 		for (Expression* pos : operands.plus)
 		{
-			root = root == nullptr ? pos : pool.allocate<AddExpression>(root, pos);
+			root = root == nullptr ? pos : createAdd(root, pos);
 		}
 		
 		for (Expression* neg : operands.minus)
 		{
-			Expression* negated = pool.allocate<NegateExpression>(neg);
-			root = root == nullptr ? negated : pool.allocate<AddExpression>(root, negated);
+			Expression* negated = createNegate(neg);
+			root = root == nullptr ? negated : createAdd(root, negated);
 		}
 		
 		if (operands.constant != 0)
 		{
-			Expression* constant = pool.allocate<ConstantIntExpression>(operands.constant);
-			root = root == nullptr ? constant : pool.allocate<AddExpression>(root, constant);
+			Expression* constant = createConstant(operands.constant);
+			root = root == nullptr ? constant : createAdd(root, constant);
 		}
+		
+		// Everything canceled out.
+		if (root == nullptr)
+		{
+			root = createConstant(0);
+		}
+		
+		result = root;
 		return root;
 	}
 	
@@ -26,14 +26,18 @@
 #include "targetinfo.h"
 
 #include <llvm/ADT/APInt.h>
+#include <llvm/ADT/Hashing.h>
 #include <llvm/Support/Casting.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <cstdint>
+#include <unordered_map>
+
 namespace symbolic
 {
 	class Expression
 	{
-	protected:
+	public:
 		enum ExpressionKind
 		{
 			LiveOnEntry,
@@ -43,6 +47,7 @@ namespace symbolic
 			Negate,
 		};
 		
+	protected:
 		inline explicit Expression(ExpressionKind kind)
 		: kind(kind)
 		{
@@ -168,24 +173,63 @@ namespace symbolic
 		virtual void print(llvm::raw_ostream&) const override;
 	};
 
+	// Expressions are hash-consed: creating an expression that has the same kind and operands as an existing one
+	// returns the existing one. This means that structurally identical expressions can be compared by address, and
+	// that simplification results can be remembered per expression.
 	class ExpressionContext
 	{
+		struct ExpressionKey
+		{
+			Expression::ExpressionKind kind;
+			uintptr_t first;
+			uintptr_t second;
+			
+			bool operator==(const ExpressionKey& that) const
+			{
+				return kind == that.kind && first == that.first && second == that.second;
+			}
+		};
+		
+		struct ExpressionKeyHash
+		{
+			size_t operator()(const ExpressionKey& key) const
+			{
+				return llvm::hash_combine(key.kind, key.first, key.second);
+			}
+		};
+		
 		DumbAllocator pool;
+		std::unordered_map<ExpressionKey, Expression*, ExpressionKeyHash> expressions;
+		std::unordered_map<Expression*, Expression*> simplified;
+		
+		template<typename T, typename... TParams>
+		T* getOrCreate(Expression::ExpressionKind kind, uintptr_t first, uintptr_t second, TParams&&... params)
+		{
+			Expression*& expression = expressions[{kind, first, second}];
+			if (expression == nullptr)
+			{
+				expression = pool.allocate<T>(std::forward<TParams>(params)...);
+			}
+			return llvm::cast<T>(expression);
+		}
 		
 	public:
 		inline AddExpression* createAdd(Expression* left, Expression* right)
 		{
-			return pool.allocate<AddExpression>(left, right);
+			auto first = reinterpret_cast<uintptr_t>(left);
+			auto second = reinterpret_cast<uintptr_t>(right);
+			return getOrCreate<AddExpression>(Expression::Add, first, second, left, right);
 		}
 		
 		inline NegateExpression* createNegate(Expression* operand)
 		{
-			return pool.allocate<NegateExpression>(operand);
+			auto first = reinterpret_cast<uintptr_t>(operand);
+			return getOrCreate<NegateExpression>(Expression::Negate, first, 0, operand);
 		}
 		
 		inline ConstantIntExpression* createConstant(uint64_t value)
 		{
-			return pool.allocate<ConstantIntExpression>(value);
+			return getOrCreate<ConstantIntExpression>(Expression::ConstantInt, value, 0, value);
 		}
 		
 		inline ConstantIntExpression* createConstant(const llvm::APInt& value)
@@ -195,12 +239,14 @@ namespace symbolic
 		
 		inline LoadExpression* createLoad(Expression* expr)
 		{
-			return pool.allocate<LoadExpression>(expr);
+			auto first = reinterpret_cast<uintptr_t>(expr);
+			return getOrCreate<LoadExpression>(Expression::Load, first, 0, expr);
 		}
 		
 		inline LiveOnEntryExpression* createLiveOnEntry(const TargetRegisterInfo* info)
 		{
-			return pool.allocate<LiveOnEntryExpression>(info);
+			auto first = reinterpret_cast<uintptr_t>(info);
+			return getOrCreate<LiveOnEntryExpression>(Expression::LiveOnEntry, first, 0, info);
 		}
 		
 		Expression* simplify(Expression* that);
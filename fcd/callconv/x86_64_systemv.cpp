@@ -41,6 +41,7 @@
 #include <llvm/IR/PatternMatch.h>
 #include <llvm/Transforms/Utils/MemorySSA.h>
 
+#include <set>
 #include <unordered_map>
 
 using namespace llvm;
@@ -105,8 +106,28 @@ namespace
 		return type == Type::getVoidTy(type->getContext());
 	}
 	
-	void identifyParameterCandidates(TargetInfo& target, MemorySSA& mssa, MemoryAccess* access, CallInformation& fillOut)
+	void insertStackParameter(CallInformation& fillOut, uint64_t offset)
 	{
+		auto range = fillOut.parameters();
+		auto position = lower_bound(range.begin(), range.end(), offset, [](const ValueInformation& that, uint64_t offset)
+		{
+			return that.type < ValueInformation::Stack || that.frameBaseOffset < offset;
+		});
+		
+		// TODO: add/extend values up to this stack offset.
+		// If we see a parameter at +0 and a parameter at +16, then we have missing values.
+		
+		if (position == range.end() || position->type != ValueInformation::Stack || position->frameBaseOffset != offset)
+		{
+			fillOut.insertParameter(position, ValueInformation::Stack, offset);
+		}
+	}
+	
+	void identifyParameterCandidates(TargetInfo& target, MemorySSA& mssa, Instruction& call, MemoryAccess* access, CallInformation& fillOut)
+	{
+		int64_t callStackOffset;
+		bool callOffsetKnown = md::getStackOffset(call, callStackOffset);
+		
 		// Look for values that are written but not used by the caller (parameters).
 		// MemorySSA chains memory uses and memory defs. Walk back from the call until the previous call, or to liveOnEntry.
 		// Registers in the parameter set that are written to before the function call are parameters for sure.
@@ -164,28 +185,24 @@ namespace
 					}
 					else if (md::isProgramMemory(*store))
 					{
-						// this could be a stack register
+						// this could be a stack parameter
+						int64_t storeStackOffset;
 						Value* origin = nullptr;
 						ConstantInt* offset = nullptr;
-						if (match(&pointer, m_BitCast(m_Add(m_Value(origin), m_ConstantInt(offset)))))
-						if (const TargetRegisterInfo* rsp = target.registerInfo(*origin))
-						if (rsp->name == "rsp")
+						if (callOffsetKnown && md::getStackOffset(*store, storeStackOffset))
 						{
-							// stack parameter
-							auto range = fillOut.parameters();
-							auto position = lower_bound(range.begin(), range.end(), offset->getLimitedValue(), [](const ValueInformation& that, uint64_t offset)
-							{
-								return that.type < ValueInformation::Stack || that.frameBaseOffset < offset;
-							});
-							
-							// TODO: add/extend values up to this stack offset.
-							// If we see a parameter at +0 and a parameter at +16, then we have missing values.
-							
-							if (position == range.end() || position->registerInfo != info)
+							// Lifting knows where both the store and the stack pointer of the call are.
+							if (storeStackOffset >= callStackOffset)
 							{
-								fillOut.insertParameter(position, ValueInformation::IntegerRegister, info);
+								insertStackParameter(fillOut, static_cast<uint64_t>(storeStackOffset - callStackOffset));
 							}
 						}
+						else if (match(&pointer, m_BitCast(m_Add(m_Value(origin), m_ConstantInt(offset)))))
+						if (const TargetRegisterInfo* rsp = target.registerInfo(*origin))
+						if (rsp->name == "rsp")
+						{
+							insertStackParameter(fillOut, offset->getLimitedValue());
+						}
 					}
 				}
 				else
@@ -290,47 +307,46 @@ bool CallingConvention_x86_64_systemv::analyzeFunction(ParameterRegistry &regist
 	}
 	
 	// Look at temporary registers that are read before they are written
-	MemorySSA& mssa = *registry.getMemorySSA(function);
+	const RegisterUses& uses = registry.getRegisterUses(function);
 	for (const char* name : parameterRegisters)
 	{
-		const TargetRegisterInfo* smallReg = targetInfo.registerNamed(name);
-		const TargetRegisterInfo& regInfo = targetInfo.largestOverlappingRegister(*smallReg);
-		auto range = geps.equal_range(&regInfo);
-		
-		vector<Instruction*> addresses;
-		for (auto iter = range.first; iter != range.second; ++iter)
+		const TargetRegisterInfo& regInfo = targetInfo.largestOverlappingRegister(*targetInfo.registerNamed(name));
+		if (uses.readOnEntry[targetInfo.registerSlot(regInfo)])
 		{
-			addresses.push_back(iter->second);
+			// register argument!
+			callInfo.addParameter(ValueInformation::IntegerRegister, &regInfo);
 		}
-		
-		for (size_t i = 0; i < addresses.size(); ++i)
+	}
+	
+	// Does the function refer to values at an offset above the initial rsp value? Reads that lifting annotated with
+	// their stack offset say so directly: the return address is at -8, so anything at or above 0 is in the caller's
+	// frame.
+	bool hasStackOffsets = false;
+	set<int64_t> stackArguments;
+	for (BasicBlock& bb : function)
+	{
+		for (Instruction& inst : bb)
 		{
-			Instruction* addressInst = addresses[i];
-			for (auto& use : addressInst->uses())
+			int64_t offset;
+			if (md::isProgramMemory(inst) && md::getStackOffset(inst, offset))
 			{
-				if (auto load = dyn_cast<LoadInst>(use.getUser()))
-				{
-					MemoryAccess* parent = cast<MemoryUse>(mssa.getMemoryAccess(load))->getDefiningAccess();
-					if (mssa.isLiveOnEntryDef(parent))
-					{
-						// register argument!
-						callInfo.addParameter(ValueInformation::IntegerRegister, &regInfo);
-					}
-				}
-				else if (auto cast = dyn_cast<CastInst>(use.getUser()))
+				hasStackOffsets = true;
+				if (isa<LoadInst>(inst) && offset >= 0)
 				{
-					if (cast->getType()->isPointerTy())
-					{
-						addresses.push_back(cast);
-					}
+					stackArguments.insert(offset);
 				}
 			}
 		}
 	}
 	
-	// Does the function refer to values at an offset above the initial rsp value?
-	// Assume that rsp is known to be preserved.
-	auto spRange = geps.equal_range(targetInfo.getStackPointer());
+	for (int64_t offset : stackArguments)
+	{
+		// memory argument!
+		callInfo.addParameter(ValueInformation::Stack, static_cast<uint64_t>(offset));
+	}
+	
+	// Otherwise, assume that rsp is known to be preserved.
+	auto spRange = hasStackOffsets ? make_pair(geps.end(), geps.end()) : geps.equal_range(targetInfo.getStackPointer());
 	for (auto iter = spRange.first; iter != spRange.second; ++iter)
 	{
 		auto* gep = iter->second;
@@ -364,19 +380,9 @@ bool CallingConvention_x86_64_systemv::analyzeFunction(ParameterRegistry &regist
 	for (const char* name : returnRegisters)
 	{
 		const TargetRegisterInfo* regInfo = targetInfo.registerNamed(name);
-		auto range = geps.equal_range(regInfo);
-		for (auto iter = range.first; iter != range.second; ++iter)
+		if (uses.written[targetInfo.registerSlot(*regInfo)])
 		{
-			bool hasStore = any_of(iter->second->use_begin(), iter->second->use_end(), [](Use& use)
-			{
-				return isa<StoreInst>(use.getUser());
-			});
-			
-			if (hasStore)
-			{
-				usedReturns.push_back(regInfo);
-				break;
-			}
+			usedReturns.push_back(regInfo);
 		}
 	}
 	
@@ -423,7 +429,7 @@ bool CallingConvention_x86_64_systemv::analyzeCallSite(ParameterRegistry &regist
 	MemorySSA& mssa = *registry.getMemorySSA(caller);
 	MemoryDef* thisDef = cast<MemoryDef>(mssa.getMemoryAccess(&inst));
 	
-	identifyParameterCandidates(targetInfo, mssa, thisDef->getDefiningAccess(), fillOut);
+	identifyParameterCandidates(targetInfo, mssa, inst, thisDef->getDefiningAccess(), fillOut);
 	identifyReturnCandidates(targetInfo, mssa, thisDef, fillOut);
 	return true;
 }
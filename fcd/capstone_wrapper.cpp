@@ -19,10 +19,14 @@
 // along with fcd.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#include <algorithm>
+#include <iterator>
 #include <string>
 #include <system_error>
 #include "capstone_wrapper.h"
 
+#include <llvm/Support/ErrorHandling.h>
+
 using namespace llvm;
 using namespace std;
 
@@ -145,6 +149,18 @@ capstone::~capstone()
 	cs_close(&handle);
 }
 
+cs_mode cs_size_mode(size_t address_size)
+{
+	switch (address_size)
+	{
+		case 2: return CS_MODE_16;
+		case 4: return CS_MODE_32;
+		case 8: return CS_MODE_64;
+		default:
+			llvm_unreachable("invalid pointer size");
+	}
+}
+
 capstone::inst_ptr capstone::alloc()
 {
 	return inst_ptr(cs_malloc(handle));
@@ -165,3 +181,81 @@ capstone_iter capstone::begin(const uint8_t *begin, const uint8_t *end, uint64_t
 	}
 	return capstone_iter(handle, begin, end - begin, virtual_address);
 }
+
+const pair<uint64_t, size_t>* instruction_table::find_entry(uint64_t address) const
+{
+	auto iter = lower_bound(index.begin(), index.end(), make_pair(address, size_t(0)));
+	if (iter != index.end() && iter->first == address)
+	{
+		return &*iter;
+	}
+	return nullptr;
+}
+
+const cs_insn* instruction_table::find(uint64_t address) const
+{
+	if (auto entry = find_entry(address))
+	{
+		return &instructions[entry->second];
+	}
+	return nullptr;
+}
+
+const cs_insn* instruction_table::previous(const cs_insn& inst) const
+{
+	auto iter = lower_bound(index.begin(), index.end(), make_pair(inst.address, size_t(0)));
+	if (iter != index.begin())
+	{
+		const cs_insn& candidate = instructions[prev(iter)->second];
+		if (candidate.address + candidate.size == inst.address)
+		{
+			return &candidate;
+		}
+	}
+	return nullptr;
+}
+
+size_t instruction_table::sweep(capstone& cs, const uint8_t* begin, const uint8_t* end, uint64_t virtual_address, size_t max_count, stop_predicate stop)
+{
+	size_t first = instructions.size();
+	const cs_detail* oldDetails = details.data();
+	
+	capstone_iter iter = cs.begin(begin, end, virtual_address);
+	while (instructions.size() - first < max_count && find_entry(iter.next_address()) == nullptr)
+	{
+		if (iter.next() != capstone_iter::success)
+		{
+			break;
+		}
+		
+		instructions.push_back(*iter);
+		details.push_back(*iter->detail);
+		if (stop(*iter))
+		{
+			break;
+		}
+	}
+	
+	// Details are stored separately; point instructions to their copy.
+	size_t fixFrom = details.data() == oldDetails ? first : 0;
+	for (size_t i = fixFrom; i < instructions.size(); ++i)
+	{
+		instructions[i].detail = &details[i];
+	}
+	
+	// A sweep yields increasing addresses, so the index only needs a merge.
+	auto middle = index.size();
+	for (size_t i = first; i < instructions.size(); ++i)
+	{
+		index.emplace_back(instructions[i].address, i);
+	}
+	inplace_merge(index.begin(), index.begin() + middle, index.end());
+	return instructions.size() - first;
+}
+
+void instruction_table::clear()
+{
+	instructions.clear();
+	details.clear();
+	index.clear();
+}
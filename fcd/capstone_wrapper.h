@@ -27,6 +27,8 @@
 
 #include <capstone.h>
 #include <memory>
+#include <utility>
+#include <vector>
 
 class capstone_error_category final : public std::error_category
 {
@@ -97,4 +99,33 @@ public:
 	capstone_iter begin(const uint8_t* begin, const uint8_t* end, uint64_t virtual_address = 0);
 };
 
+// Capstone mode for x86 code that uses address_size-byte addresses.
+cs_mode cs_size_mode(size_t address_size);
+
+// Flat, address-indexed table of decoded instructions. Instructions are decoded by linear sweeps over contiguous runs
+// of code, which are much cheaper than going back to Capstone for every single instruction. Pointers returned by find
+// are invalidated by the next sweep or clear.
+class instruction_table
+{
+	std::vector<cs_insn> instructions;
+	std::vector<cs_detail> details;
+	std::vector<std::pair<uint64_t, size_t>> index; // sorted by address
+	
+	const std::pair<uint64_t, size_t>* find_entry(uint64_t address) const;
+	
+public:
+	typedef bool (*stop_predicate)(const cs_insn& inst);
+	
+	const cs_insn* find(uint64_t address) const;
+	// The decoded instruction that ends right where inst begins, if any.
+	const cs_insn* previous(const cs_insn& inst) const;
+	
+	// Decodes at most max_count instructions starting at virtual_address, stopping after an instruction for which
+	// stop returns true, on invalid data, or when the sweep reaches an instruction that is already in the table.
+	// Returns the number of instructions added.
+	size_t sweep(capstone& cs, const uint8_t* begin, const uint8_t* end, uint64_t virtual_address, size_t max_count, stop_predicate stop);
+	
+	void clear();
+};
+
 #endif /* defined(fcd__capstone_wrapper_h) */
@@ -22,15 +22,28 @@
 #include "code_generator.h"
 #include "metadata.h"
 
+#include <llvm/ADT/Hashing.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Bitcode/ReaderWriter.h>
 #include <llvm/IRReader/IRReader.h>
 #include <llvm/Support/raw_os_ostream.h>
 #include <llvm/Support/SourceMgr.h>
+#include <llvm/Transforms/Scalar.h>
 
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "fcd-codegen"
+
+STATISTIC(InstructionsInlined, "Number of instruction implementations inlined");
+STATISTIC(IntrinsicCallsResolved, "Number of intrinsic calls resolved");
+STATISTIC(NoReturnCallsTruncated, "Number of calls to noreturn functions where lifting stopped");
+STATISTIC(TailCallsLifted, "Number of jumps to other functions lifted as tail calls");
+
 extern "C" const char fcd_emulator_start_x86;
 extern "C" const char fcd_emulator_end_x86;
 
@@ -94,7 +107,7 @@ namespace
 			return CallInst::Create(segmentFunc, { &pointer }, "", &location);
 		}
 		
-		void replaceIntrinsic(AddressToFunction& funcMap, AddressToBlock& blockMap, StringRef name, CallInst* translated)
+		void replaceIntrinsic(AddressToFunction& funcMap, AddressToBlock& blockMap, const StackOffsets& stackOffsets, StringRef name, CallInst* translated)
 		{
 			if (name == "x86_jump_intrin")
 			{
@@ -105,8 +118,28 @@ namespace
 					auto terminator = parent->getTerminator();
 					
 					uint64_t dest = constantDestination->getLimitedValue();
-					BasicBlock* destination = blockMap.blockToInstruction(dest);
-					BranchInst::Create(destination, terminator);
+					auto address = md::getVirtualAddress(*parent->getParent());
+					if (address != nullptr && address->getLimitedValue() != dest && funcMap.isFunctionStart(dest))
+					{
+						// Tail calls and shared epilogues: call the other function instead of lifting its code again.
+						LLVMContext& ctx = parent->getContext();
+						Function* target = funcMap.getCallTarget(dest);
+						CallInst::Create(target, {translated->getOperand(1)}, "", terminator);
+						if (target->doesNotReturn())
+						{
+							new UnreachableInst(ctx, terminator);
+						}
+						else
+						{
+							ReturnInst::Create(ctx, nullptr, terminator);
+						}
+						++TailCallsLifted;
+					}
+					else
+					{
+						BasicBlock* destination = blockMap.blockToInstruction(dest);
+						BranchInst::Create(destination, terminator);
+					}
 					terminator->eraseFromParent();
 					remainder->eraseFromParent();
 				}
@@ -118,8 +151,25 @@ namespace
 					uint64_t destination = constantDestination->getLimitedValue();
 					Function* target = funcMap.getCallTarget(destination);
 					CallInst* replacement = CallInst::Create(target, {translated->getOperand(1)}, "", translated);
+					if (stackOffsets.stackPointer)
+					{
+						md::setStackOffset(*replacement, *stackOffsets.stackPointer);
+					}
 					translated->replaceAllUsesWith(replacement);
-					translated->eraseFromParent();
+					if (target->doesNotReturn())
+					{
+						// Don't fall through to the next instruction, so that whatever follows isn't lifted.
+						BasicBlock* parent = translated->getParent();
+						BasicBlock* remainder = parent->splitBasicBlock(translated);
+						parent->getTerminator()->eraseFromParent();
+						new UnreachableInst(parent->getContext(), parent);
+						remainder->eraseFromParent();
+						++NoReturnCallsTruncated;
+					}
+					else
+					{
+						translated->eraseFromParent();
+					}
 				}
 			}
 			else if (name == "x86_ret_intrin")
@@ -139,6 +189,10 @@ namespace
 				
 				Instruction* replacement = new LoadInst(pointer, "", translated);
 				md::setProgramMemory(*replacement);
+				if (stackOffsets.read)
+				{
+					md::setStackOffset(*replacement, *stackOffsets.read);
+				}
 				
 				Type* i64 = Type::getInt64Ty(translated->getContext());
 				if (replacement->getType() != i64)
@@ -166,6 +220,10 @@ namespace
 				}
 				StoreInst* storeInst = new StoreInst(value, pointer, translated);
 				md::setProgramMemory(*storeInst);
+				if (stackOffsets.write)
+				{
+					md::setStackOffset(*storeInst, *stackOffsets.write);
+				}
 				translated->eraseFromParent();
 			}
 		}
@@ -208,24 +266,35 @@ namespace
 			}
 		}
 		
-		virtual void resolveIntrinsics(llvm::Function& targetFunction, AddressToFunction& funcMap, AddressToBlock& blockMap) override
+		virtual void resolveIntrinsics(BasicBlock::iterator begin, Function::iterator end, AddressToFunction& funcMap, AddressToBlock& blockMap, const StackOffsets& stackOffsets) override
 		{
-			Module& module = *targetFunction.getParent();
-			for (Function* decl : declarations)
+			// Collect first: replacing intrinsics splits and erases blocks.
+			SmallVector<CallInst*, 8> intrinsicCalls;
+			auto collect = [&](iterator_range<BasicBlock::iterator> instructions)
 			{
-				StringRef name = decl->getName();
-				Function* matching = module.getFunction(name);
-				if (isIntrinsic(name))
+				for (Instruction& inst : instructions)
 				{
-					auto iter = matching->use_begin();
-					while (iter != matching->use_end())
+					if (auto call = dyn_cast<CallInst>(&inst))
+					if (Function* callee = call->getCalledFunction())
+					if (isIntrinsic(callee->getName()))
 					{
-						auto call = cast<CallInst>(iter->getUser());
-						++iter;
-						replaceIntrinsic(funcMap, blockMap, name, call);
+						intrinsicCalls.push_back(call);
 					}
 				}
+			};
+			
+			BasicBlock* firstBlock = begin->getParent();
+			collect(make_range(begin, firstBlock->end()));
+			for (BasicBlock& bb : make_range(next(firstBlock->getIterator()), end))
+			{
+				collect(make_range(bb.begin(), bb.end()));
+			}
+			
+			for (CallInst* call : intrinsicCalls)
+			{
+				replaceIntrinsic(funcMap, blockMap, stackOffsets, call->getCalledFunction()->getName(), call);
 			}
+			IntrinsicCallsResolved += intrinsicCalls.size();
 		}
 		
 	public:
@@ -247,7 +316,8 @@ namespace
 			StructType* x86Ty = module.getTypeByName("struct.cs_x86");
 			StructType* x86Op = module.getTypeByName("struct.cs_x86_op");
 			StructType* x86OpMem = module.getTypeByName("struct.x86_op_mem");
-			StructType* x86OpMemWrapper = module.getTypeByName("union.anon");
+			// The operand union is anonymous, and its name depends on which other anonymous unions the emulator uses.
+			StructType* x86OpMemWrapper = cast<StructType>(x86Op->getElementType(1));
 			
 			vector<Constant*> operands;
 			for (size_t i = 0; i < 8; i++)
@@ -295,7 +365,7 @@ namespace
 		
 		virtual Function* implementationForPrologue() override
 		{
-			return getFunction("x86_function_prologue");
+			return materialize(getFunction("x86_function_prologue"));
 		}
 		
 		virtual llvm::StructType* getRegisterTy() override
@@ -321,14 +391,60 @@ namespace
 }
 
 CodeGenerator::CodeGenerator(llvm::LLVMContext& ctx)
-: ctx(ctx)
+: ctx(ctx), discardNames(false)
 {
 }
 
+Function* CodeGenerator::materialize(Function* fn)
+{
+	if (fn != nullptr && fn->isMaterializable())
+	{
+		if (auto error = fn->materialize())
+		{
+			errs() << "couldn't materialize " << fn->getName() << ": " << error.message() << '\n';
+			return nullptr;
+		}
+		
+		if (discardNames)
+		{
+			for (Argument& arg : fn->args())
+			{
+				arg.setName("");
+			}
+			for (BasicBlock& bb : *fn)
+			{
+				bb.setName("");
+				for (Instruction& inst : bb)
+				{
+					inst.setName("");
+				}
+			}
+		}
+	}
+	return fn;
+}
+
 bool CodeGenerator::initGenerator(const char* begin, const char* end)
 {
+	StringRef bytes(begin, end - begin);
+	if (isBitcode(bytes.bytes_begin(), bytes.bytes_end()))
+	{
+		// Only read types and the function index now. Instruction implementations are materialized the first time
+		// that they are requested, which is a small fraction of the emulator for most programs.
+		auto moduleOrError = getLazyBitcodeModule(MemoryBuffer::getMemBuffer(bytes, "IRImplementation", false), ctx);
+		if (moduleOrError)
+		{
+			generatorModule = move(moduleOrError.get());
+			return true;
+		}
+		
+		errs() << "couldn't load emulator bitcode: " << moduleOrError.getError().message() << '\n';
+		assert(false);
+		return false;
+	}
+	
 	SMDiagnostic errors;
-	MemoryBufferRef buffer(StringRef(begin, end - begin), "IRImplementation");
+	MemoryBufferRef buffer(bytes, "IRImplementation");
 	if (auto module = parseIR(buffer, errors, ctx))
 	{
 		generatorModule = move(module);
@@ -342,46 +458,229 @@ bool CodeGenerator::initGenerator(const char* begin, const char* end)
 	}
 }
 
-unique_ptr<CodeGenerator> CodeGenerator::x86(LLVMContext &ctx)
+shared_ptr<CodeGenerator> CodeGenerator::x86(LLVMContext &ctx)
 {
-	unique_ptr<CodeGenerator> codegen(new x86CodeGenerator(ctx));
+	// Keyed by context address: entries expire with the last TranslationContext using them, so a new context that
+	// happens to reuse an address never sees a stale generator.
+	static mutex generatorsMutex;
+	static unordered_map<LLVMContext*, weak_ptr<CodeGenerator>> generators;
+	
+	lock_guard<mutex> lock(generatorsMutex);
+	for (auto iter = generators.begin(); iter != generators.end();)
+	{
+		iter = iter->second.expired() ? generators.erase(iter) : next(iter);
+	}
+	
+	weak_ptr<CodeGenerator>& cached = generators[&ctx];
+	if (auto codegen = cached.lock())
+	{
+		return codegen;
+	}
+	
+	shared_ptr<CodeGenerator> codegen(new x86CodeGenerator(ctx));
 	if (codegen->init())
 	{
+		cached = codegen;
 		return codegen;
 	}
 	return nullptr;
 }
 
-void CodeGenerator::inlineFunction(Function *target, Function *toInline, ArrayRef<Value *> parameters, AddressToFunction& funcMap, AddressToBlock &blockMap, uint64_t nextAddress)
+void CodeGenerator::stitchInlinedBlocks(Function* target, Function::iterator blockBeforeInstruction, ArrayRef<ReturnInst*> returns, AddressToFunction& funcMap, AddressToBlock& blockMap, uint64_t nextAddress, const StackOffsets& stackOffsets)
 {
-	assert(toInline->arg_size() == parameters.size());
+	// Stitch blocks together. Nothing branches to the entry block of the implementation, so it continues the block
+	// before it: instructions that don't branch end up in the same block (see AddressToBlock).
+	BasicBlock& before = *blockBeforeInstruction;
+	BasicBlock& firstNewBlock = *next(blockBeforeInstruction);
+	Instruction* lastBefore = before.empty() ? nullptr : &before.back();
+	before.getInstList().splice(before.end(), firstNewBlock.getInstList());
+	firstNewBlock.eraseFromParent();
+	BasicBlock::iterator firstInlined = lastBefore == nullptr ? before.begin() : next(lastBefore->getIterator());
+	
+	// Redirect returns
+	BasicBlock* nextBlock = blockMap.blockToInstruction(nextAddress);
+	for (auto ret : returns)
+	{
+		BranchInst::Create(nextBlock, ret);
+		ret->eraseFromParent();
+	}
+	
+	// Everything from the first inlined instruction on was created by this inlining (or is an empty stub), so that's
+	// the only place where there can be unresolved intrinsic calls.
+	++InstructionsInlined;
+	resolveIntrinsics(firstInlined, target->end(), funcMap, blockMap, stackOffsets);
+}
+
+GlobalVariable* CodeGenerator::getDetailGlobal(Module& module, const cs_detail& detail, Constant* detailAsConstant)
+{
+	// Details are named after a hash of their contents, so that the module's symbol table doubles as an index and
+	// identical operand descriptors share a single global. The initializer check takes care of hash collisions. Fields
+	// are hashed one by one, as constantForDetail reads them, since the padding between them is uninitialized.
+	const cs_x86& x86 = detail.x86;
+	hash_code hash = hash_combine(hash_combine_range(begin(x86.prefix), end(x86.prefix)), hash_combine_range(begin(x86.opcode), end(x86.opcode)));
+	hash = hash_combine(hash, x86.rex, x86.addr_size, x86.modrm, x86.sib, x86.disp);
+	hash = hash_combine(hash, x86.sib_index, x86.sib_scale, x86.sib_base, x86.sse_cc, x86.avx_cc, x86.avx_sae, x86.avx_rm);
+	hash = hash_combine(hash, x86.op_count);
+	for (const cs_x86_op& op : x86.operands)
+	{
+		hash = hash_combine(hash, op.mem.segment, op.mem.base, op.mem.index, op.mem.scale, op.mem.disp);
+		hash = hash_combine(hash, op.type, op.size, op.avx_bcast, op.avx_zero_opmask);
+	}
+	char name[] = "detail.0000000000000000";
+	snprintf(name, sizeof name, "detail.%016zx", static_cast<size_t>(hash));
+	
+	GlobalVariable* global = module.getNamedGlobal(name);
+	if (global == nullptr || global->getInitializer() != detailAsConstant)
+	{
+		global = new GlobalVariable(module, detailAsConstant->getType(), true, GlobalValue::PrivateLinkage, detailAsConstant, name);
+		global->setUnnamedAddr(true);
+	}
+	return global;
+}
+
+void CodeGenerator::buildTemplate(InstructionTemplate& templ, Function* implementation, Constant* config, Constant* detail)
+{
+	Module& module = this->module();
+	GlobalVariable*& configVariable = templateConfigs[config];
+	if (configVariable == nullptr)
+	{
+		configVariable = new GlobalVariable(module, config->getType(), true, GlobalValue::PrivateLinkage, config, "config.template");
+	}
+	
+	templ.config = configVariable;
+	templ.detail = new GlobalVariable(module, detail->getType(), true, GlobalValue::PrivateLinkage, detail, "detail.template");
+	templ.body = Function::Create(implementation->getFunctionType(), GlobalValue::PrivateLinkage, implementation->getName() + ".template", &module);
+	
+	ValueToValueMapTy valueMap;
+	auto implArg = implementation->arg_begin();
+	auto templArg = templ.body->arg_begin();
+	valueMap[static_cast<Argument*>(implArg++)] = templ.config;
+	valueMap[static_cast<Argument*>(implArg++)] = templ.detail;
+	++templArg;
+	++templArg;
+	while (implArg != implementation->arg_end())
+	{
+		valueMap[static_cast<Argument*>(implArg++)] = static_cast<Argument*>(templArg++);
+	}
+	
+	SmallVector<ReturnInst*, 1> returns;
+	CloneAndPruneFunctionInto(templ.body, implementation, valueMap, false, returns);
+	
+	// Pruning folds the branches that depend on the detail, but leaves behind the arithmetic of register selectors and
+	// operand sizes. Every stamped copy would need to be cleaned up; do it once here instead.
+	if (templateCleanup == nullptr)
+	{
+		templateCleanup.reset(new legacy::FunctionPassManager(&module));
+		templateCleanup->add(createInstructionCombiningPass());
+		templateCleanup->add(createCFGSimplificationPass());
+		templateCleanup->doInitialization();
+	}
+	templateCleanup->run(*templ.body);
+	
+	// Cleaning up may have introduced calls to intrinsics that only the generator module declares.
+	for (BasicBlock& bb : *templ.body)
+	{
+		for (Instruction& inst : bb)
+		{
+			if (auto call = dyn_cast<CallInst>(&inst))
+			if (Function* callee = call->getCalledFunction())
+			if (callee->isDeclaration())
+			{
+				templ.declarations.push_back(callee);
+			}
+		}
+	}
+}
+
+void CodeGenerator::inlineInstruction(Function* target, unsigned opcode, const cs_detail& detail, ArrayRef<Value*> parameters, AddressToFunction& funcMap, AddressToBlock& blockMap, uint64_t nextAddress, const StackOffsets& stackOffsets)
+{
+	Function* implementation = implementationFor(opcode);
+	assert(implementation != nullptr && implementation->arg_size() == parameters.size() && parameters.size() >= 2);
+	
 	Module& targetModule = *target->getParent();
-	auto iter = toInline->arg_begin();
+	Constant* detailAsConstant = constantForDetail(detail);
+	Constant* config = cast<GlobalVariable>(parameters[0])->getInitializer();
+	InstructionTemplate& templ = templates[make_tuple(opcode, config, detailAsConstant)];
+	
+	// Most instructions are only ever seen once; only pay for a template when some are seen again.
+	templ.uses++;
+	if (templ.body == nullptr && templ.uses > 1)
+	{
+		buildTemplate(templ, implementation, config, detailAsConstant);
+	}
+	
+	SmallVector<Value*, 4> actualParameters(parameters.begin(), parameters.end());
+	if (templ.body == nullptr)
+	{
+		actualParameters[1] = getDetailGlobal(targetModule, detail, detailAsConstant);
+		inlineFunction(target, implementation, actualParameters, funcMap, blockMap, nextAddress, stackOffsets);
+		return;
+	}
 	
 	ValueToValueMapTy valueMap;
 	getModuleLevelValueChanges(valueMap, targetModule);
-	for (Value* parameter : parameters)
+	for (Function* decl : templ.declarations)
+	{
+		if (valueMap.count(decl) == 0)
+		{
+			valueMap[decl] = targetModule.getOrInsertFunction(decl->getName(), decl->getFunctionType(), decl->getAttributes());
+		}
+	}
+	valueMap[templ.config] = actualParameters[0];
+	if (!templ.detail->use_empty())
+	{
+		valueMap[templ.detail] = getDetailGlobal(targetModule, detail, detailAsConstant);
+	}
+	
+	auto iter = templ.body->arg_begin();
+	for (Value* parameter : actualParameters)
 	{
 		valueMap[static_cast<Argument*>(iter)] = parameter;
 		++iter;
 	}
 	
+	// The template is already pruned: copy it block by block and remap operands.
 	SmallVector<ReturnInst*, 1> returns;
+	SmallVector<BasicBlock*, 8> newBlocks;
 	Function::iterator blockBeforeInstruction = target->back().getIterator();
-	CloneAndPruneFunctionInto(target, toInline, valueMap, true, returns);
+	for (BasicBlock& bb : *templ.body)
+	{
+		BasicBlock* clone = CloneBasicBlock(&bb, valueMap, "", target);
+		valueMap[&bb] = clone;
+		newBlocks.push_back(clone);
+		if (auto ret = dyn_cast<ReturnInst>(clone->getTerminator()))
+		{
+			returns.push_back(ret);
+		}
+	}
 	
-	// Stitch blocks together
-	Function::iterator firstNewBlock = blockBeforeInstruction;
-	++firstNewBlock;
-	BranchInst::Create(static_cast<BasicBlock*>(firstNewBlock), static_cast<BasicBlock*>(blockBeforeInstruction));
+	for (BasicBlock* bb : newBlocks)
+	{
+		for (Instruction& inst : *bb)
+		{
+			RemapInstruction(&inst, valueMap);
+		}
+	}
 	
-	// Redirect returns
-	BasicBlock* nextBlock = blockMap.blockToInstruction(nextAddress);
-	for (auto ret : returns)
+	stitchInlinedBlocks(target, blockBeforeInstruction, returns, funcMap, blockMap, nextAddress, stackOffsets);
+}
+
+void CodeGenerator::inlineFunction(Function *target, Function *toInline, ArrayRef<Value *> parameters, AddressToFunction& funcMap, AddressToBlock &blockMap, uint64_t nextAddress, const StackOffsets& stackOffsets)
+{
+	assert(toInline->arg_size() == parameters.size());
+	Module& targetModule = *target->getParent();
+	auto iter = toInline->arg_begin();
+	
+	ValueToValueMapTy valueMap;
+	getModuleLevelValueChanges(valueMap, targetModule);
+	for (Value* parameter : parameters)
 	{
-		BranchInst::Create(nextBlock, ret);
-		ret->eraseFromParent();
+		valueMap[static_cast<Argument*>(iter)] = parameter;
+		++iter;
 	}
 	
-	resolveIntrinsics(*target, funcMap, blockMap);
+	SmallVector<ReturnInst*, 1> returns;
+	Function::iterator blockBeforeInstruction = target->back().getIterator();
+	CloneAndPruneFunctionInto(target, toInline, valueMap, true, returns);
+	stitchInlinedBlocks(target, blockBeforeInstruction, returns, funcMap, blockMap, nextAddress, stackOffsets);
 }
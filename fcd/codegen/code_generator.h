@@ -26,20 +26,59 @@
 #include "not_null.h"
 #include "translation_maps.h"
 
+#include <llvm/ADT/Optional.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Transforms/Utils/Cloning.h>
 
 #include <cstdint>
+#include <map>
 #include <memory>
+#include <tuple>
 #include <vector>
 
+// Offsets from the stack pointer on function entry that the lifter could work out for one instruction. They become
+// fcd.stackoffset metadata on the program memory accesses and calls that the instruction lifts to.
+struct StackOffsets
+{
+	llvm::Optional<int64_t> read;
+	llvm::Optional<int64_t> write;
+	llvm::Optional<int64_t> stackPointer; // at calls
+};
+
 class CodeGenerator
 {
+	// Pruned and constant-folded copy of an instruction implementation for one particular cs_detail and config.
+	// The config and detail globals are local to the generator module and get remapped when the template is stamped.
+	struct InstructionTemplate
+	{
+		unsigned uses;
+		llvm::Function* body;
+		llvm::GlobalVariable* config;
+		llvm::GlobalVariable* detail;
+		std::vector<llvm::Function*> declarations; // functions that the cleaned-up body calls
+		
+		InstructionTemplate()
+		: uses(0), body(nullptr), config(nullptr), detail(nullptr)
+		{
+		}
+	};
+	
 	llvm::LLVMContext& ctx;
 	std::unique_ptr<llvm::Module> generatorModule;
 	std::vector<llvm::Function*> functionByOpcode;
 	
+	// Constants are uniqued by the LLVMContext, so identical details (and configs) map to the same Constant.
+	std::map<std::tuple<unsigned, llvm::Constant*, llvm::Constant*>, InstructionTemplate> templates;
+	std::map<llvm::Constant*, llvm::GlobalVariable*> templateConfigs;
+	std::unique_ptr<llvm::legacy::FunctionPassManager> templateCleanup;
+	bool discardNames;
+	
+	llvm::GlobalVariable* getDetailGlobal(llvm::Module& module, const cs_detail& detail, llvm::Constant* detailAsConstant);
+	void buildTemplate(InstructionTemplate& templ, llvm::Function* implementation, llvm::Constant* config, llvm::Constant* detail);
+	void stitchInlinedBlocks(llvm::Function* target, llvm::Function::iterator blockBeforeInstruction, llvm::ArrayRef<llvm::ReturnInst*> returns, AddressToFunction& funcMap, AddressToBlock& blockMap, uint64_t nextAddress, const StackOffsets& stackOffsets);
+	
 protected:
 	CodeGenerator(llvm::LLVMContext& ctx);
 	
@@ -48,6 +87,8 @@ protected:
 		return module().getFunction(name);
 	}
 	
+	llvm::Function* materialize(llvm::Function* fn);
+	
 	llvm::LLVMContext& context() { return ctx; }
 	llvm::Module& module() { return *generatorModule; }
 	bool initGenerator(const char* begin, const char* end);
@@ -55,15 +96,22 @@ protected:
 	
 	virtual bool init() = 0;
 	virtual void getModuleLevelValueChanges(llvm::ValueToValueMapTy& map, llvm::Module& targetModule) = 0;
-	virtual void resolveIntrinsics(llvm::Function& targetFunction, AddressToFunction& funcMap, AddressToBlock& blockMap) = 0;
+	// Resolves the intrinsic calls from begin to the end of its block, and in the blocks after it until end.
+	virtual void resolveIntrinsics(llvm::BasicBlock::iterator begin, llvm::Function::iterator end, AddressToFunction& funcMap, AddressToBlock& blockMap, const StackOffsets& stackOffsets) = 0;
 	
 public:
 	virtual ~CodeGenerator() = default;
-	static std::unique_ptr<CodeGenerator> x86(llvm::LLVMContext& ctx);
+	// Code generators are shared by every user of the same LLVMContext.
+	static std::shared_ptr<CodeGenerator> x86(llvm::LLVMContext& ctx);
+	
+	// Implementations materialized after this call lose the names of their blocks, arguments and instructions, so
+	// that inlining them doesn't copy the names into lifted functions. This can't be undone, and it affects every
+	// user of the generator.
+	void discardValueNames() { discardNames = true; }
 	
 	llvm::Function* implementationFor(unsigned index)
 	{
-		return functionByOpcode.at(index);
+		return materialize(functionByOpcode.at(index));
 	}
 	
 	virtual llvm::Function* implementationForPrologue() = 0;
@@ -73,7 +121,13 @@ public:
 	virtual llvm::ArrayRef<llvm::Value*> getIpOffset() = 0;
 	virtual llvm::Constant* constantForDetail(const cs_detail& detail) = 0;
 	
-	void inlineFunction(llvm::Function *target, llvm::Function *toInline, llvm::ArrayRef<llvm::Value *> parameters, AddressToFunction& funcMap, AddressToBlock& blockMap, uint64_t nextAddress);
+	void inlineFunction(llvm::Function *target, llvm::Function *toInline, llvm::ArrayRef<llvm::Value *> parameters, AddressToFunction& funcMap, AddressToBlock& blockMap, uint64_t nextAddress, const StackOffsets& stackOffsets = StackOffsets());
+	
+	// Inlines the implementation of an instruction. parameters are (config, detail, registers, flags); the detail
+	// parameter is ignored and a global is created for it only if the implementation still needs one after folding.
+	// Instructions seen more than once are stamped from a cached template instead of being pruned again. Templates
+	// are cleaned up when they are built, so stamped copies are already free of operand size and register dispatch.
+	void inlineInstruction(llvm::Function* target, unsigned opcode, const cs_detail& detail, llvm::ArrayRef<llvm::Value*> parameters, AddressToFunction& funcMap, AddressToBlock& blockMap, uint64_t nextAddress, const StackOffsets& stackOffsets = StackOffsets());
 };
 
 #endif /* code_generator_hpp */
@@ -0,0 +1,779 @@
+//
+// function_discovery.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "function_discovery.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <system_error>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	// Control flow of a decoded instruction.
+	struct DecodedInstruction
+	{
+		uint64_t address;
+		uint64_t target;
+		uint8_t size;
+		bool hasTarget;
+		bool fallsThrough;
+		// Input of the signature of the function.
+		string masked;
+		// Addresses that masked leaves out, except for branch targets.
+		string references;
+	};
+	
+	// Functions with fewer instructions than this don't get a signature: too many unrelated functions would share it.
+	const size_t minSignatureInstructions = 8;
+	
+	// Index files are a header followed by function records, all made of native-endian 64-bit words so that the
+	// file can be read straight from a mapping:
+	//   header:   magic, executable hash (2 words), function count
+	//   function: address, instruction count, block count, [begin, end, successor count, successors...] per block,
+	//             callee count, callees..., no-return callee count, no-return callees..., signature length,
+	//             signature (padded to a word), body hash length, body hash (padded to a word)
+	const char indexMagic[8] = {'f', 'c', 'd', 'i', 'd', 'x', '0', '4'};
+	
+	class IndexReader
+	{
+		const char* cursor;
+		const char* end;
+		
+	public:
+		IndexReader(StringRef data)
+		: cursor(data.begin()), end(data.end())
+		{
+		}
+		
+		bool read(uint64_t& value)
+		{
+			if (size_t(end - cursor) < sizeof value)
+			{
+				return false;
+			}
+			memcpy(&value, cursor, sizeof value);
+			cursor += sizeof value;
+			return true;
+		}
+		
+		bool readArray(vector<uint64_t>& values)
+		{
+			uint64_t count;
+			if (!read(count) || count > size_t(end - cursor) / sizeof(uint64_t))
+			{
+				return false;
+			}
+			values.resize(count);
+			for (uint64_t& value : values)
+			{
+				read(value);
+			}
+			return true;
+		}
+		
+		bool readString(string& value)
+		{
+			uint64_t size;
+			if (!read(size))
+			{
+				return false;
+			}
+			
+			uint64_t paddedSize = (size + 7) & ~uint64_t(7);
+			if (paddedSize < size || paddedSize > size_t(end - cursor))
+			{
+				return false;
+			}
+			value.assign(cursor, size);
+			cursor += paddedSize;
+			return true;
+		}
+		
+		bool atEnd() const { return cursor == end; }
+	};
+	
+	void write(raw_ostream& output, uint64_t value)
+	{
+		output.write(reinterpret_cast<const char*>(&value), sizeof value);
+	}
+	
+	void writeArray(raw_ostream& output, const vector<uint64_t>& values)
+	{
+		write(output, values.size());
+		for (uint64_t value : values)
+		{
+			write(output, value);
+		}
+	}
+	
+	void writeString(raw_ostream& output, const string& value)
+	{
+		write(output, value.size());
+		output << value;
+		for (size_t i = value.size(); i % 8 != 0; ++i)
+		{
+			output << '\0';
+		}
+	}
+	
+	void appendWord(string& output, uint64_t value)
+	{
+		for (size_t i = 0; i < sizeof value; ++i)
+		{
+			output.push_back(static_cast<char>(value >> (i * 8)));
+		}
+	}
+	
+	// The parts of an instruction that don't depend on where code and data are: the instruction, its prefixes and
+	// opcode, and its operands, except for branch targets, displacements from the instruction pointer, and values that
+	// point into the executable. The values that are masked out, other than branch targets, go to references.
+	void appendMaskedInstruction(const Executable& executable, const cs_insn& inst, bool isBranch, string& output, string& references)
+	{
+		const cs_x86& x86 = inst.detail->x86;
+		appendWord(output, inst.id);
+		output.append(reinterpret_cast<const char*>(x86.prefix), sizeof x86.prefix);
+		output.append(reinterpret_cast<const char*>(x86.opcode), sizeof x86.opcode);
+		appendWord(output, x86.op_count);
+		for (uint8_t i = 0; i < x86.op_count; ++i)
+		{
+			const cs_x86_op& op = x86.operands[i];
+			appendWord(output, op.type);
+			appendWord(output, op.size);
+			if (op.type == X86_OP_REG)
+			{
+				appendWord(output, op.reg);
+			}
+			else if (op.type == X86_OP_IMM)
+			{
+				uint64_t value = static_cast<uint64_t>(op.imm);
+				bool positionDependent = !isBranch && executable.map(value) != nullptr;
+				appendWord(output, isBranch || positionDependent ? 0 : value);
+				if (positionDependent)
+				{
+					appendWord(references, value);
+				}
+			}
+			else if (op.type == X86_OP_MEM)
+			{
+				const x86_op_mem& mem = op.mem;
+				uint64_t displacement = static_cast<uint64_t>(mem.disp);
+				bool positionDependent = mem.base == X86_REG_INVALID || mem.base == X86_REG_RIP || mem.base == X86_REG_EIP || executable.map(displacement) != nullptr;
+				appendWord(output, mem.segment);
+				appendWord(output, mem.base);
+				appendWord(output, mem.index);
+				appendWord(output, static_cast<uint64_t>(mem.scale));
+				appendWord(output, positionDependent ? 0 : displacement);
+				if (mem.base == X86_REG_RIP || mem.base == X86_REG_EIP)
+				{
+					appendWord(references, inst.address + inst.size + displacement);
+				}
+				else if (positionDependent)
+				{
+					appendWord(references, displacement);
+				}
+			}
+			else if (op.type == X86_OP_FP)
+			{
+				uint64_t bits;
+				static_assert(sizeof bits == sizeof op.fp, "unexpected floating-point operand size");
+				memcpy(&bits, &op.fp, sizeof bits);
+				appendWord(output, bits);
+			}
+		}
+	}
+	
+	bool hasGroup(const cs_insn& inst, uint8_t group)
+	{
+		const cs_detail& detail = *inst.detail;
+		return find(detail.groups, detail.groups + detail.groups_count, group) != detail.groups + detail.groups_count;
+	}
+	
+	bool immediateOperand(const cs_insn& inst, uint64_t& value)
+	{
+		const cs_x86& x86 = inst.detail->x86;
+		if (x86.op_count == 1 && x86.operands[0].type == X86_OP_IMM)
+		{
+			value = static_cast<uint64_t>(x86.operands[0].imm);
+			return true;
+		}
+		return false;
+	}
+	
+	uint64_t readDisplacement(const uint8_t* bytes, size_t size)
+	{
+		switch (size)
+		{
+			case 1: return static_cast<uint64_t>(static_cast<int8_t>(bytes[0]));
+			case 4: { int32_t value; memcpy(&value, bytes, sizeof value); return static_cast<uint64_t>(value); }
+			default: { uint64_t value; memcpy(&value, bytes, sizeof value); return value; }
+		}
+	}
+	
+	uint64_t readImmediate(const uint8_t* bytes, size_t size, bool signExtend)
+	{
+		switch (size)
+		{
+			case 1: return signExtend ? static_cast<uint64_t>(static_cast<int8_t>(bytes[0])) : bytes[0];
+			case 2: { uint16_t value; memcpy(&value, bytes, sizeof value); return signExtend ? static_cast<uint64_t>(static_cast<int16_t>(value)) : value; }
+			case 4: { uint32_t value; memcpy(&value, bytes, sizeof value); return signExtend ? static_cast<uint64_t>(static_cast<int32_t>(value)) : value; }
+			case 8: { uint64_t value; memcpy(&value, bytes, sizeof value); return value; }
+			default: return 0; // enter's two immediates
+		}
+	}
+	
+	// The same as appendMaskedInstruction, for instructions that the length decoder understood: the instruction's bytes,
+	// with the branch target, the displacement and the immediate zeroed where they depend on where code and data are.
+	void appendMaskedBytes(const Executable& executable, const uint8_t* bytes, uint64_t address, const X86LengthDecoder::Instruction& inst, string& output, string& references)
+	{
+		char masked[16];
+		memcpy(masked, bytes, inst.size);
+		appendWord(output, inst.size);
+		
+		if (inst.displacementSize != 0)
+		{
+			uint64_t displacement = readDisplacement(bytes + inst.displacementOffset, inst.displacementSize);
+			bool positionDependent = inst.ripRelative || inst.absoluteAddress || executable.map(displacement) != nullptr;
+			if (positionDependent)
+			{
+				memset(masked + inst.displacementOffset, 0, inst.displacementSize);
+				appendWord(references, inst.ripRelative ? address + inst.size + displacement : displacement);
+			}
+		}
+		
+		if (inst.immediateSize != 0)
+		{
+			bool isBranch = inst.controlFlow == X86LengthDecoder::Jump || inst.controlFlow == X86LengthDecoder::ConditionalJump || inst.controlFlow == X86LengthDecoder::Call;
+			uint64_t value = readImmediate(bytes + inst.immediateOffset, inst.immediateSize, inst.signExtendedImmediate);
+			bool positionDependent = !isBranch && executable.map(value) != nullptr;
+			if (isBranch || positionDependent)
+			{
+				memset(masked + inst.immediateOffset, 0, inst.immediateSize);
+			}
+			if (positionDependent)
+			{
+				appendWord(references, value);
+			}
+		}
+		output.append(masked, inst.size);
+	}
+	
+	// How a Capstone-decoded instruction affects control flow, in the length decoder's terms.
+	X86LengthDecoder::ControlFlow capstoneControlFlow(const cs_insn& inst, uint64_t& target)
+	{
+		bool direct = immediateOperand(inst, target);
+		if (hasGroup(inst, CS_GRP_JUMP))
+		{
+			if (inst.id == X86_INS_JMP || inst.id == X86_INS_LJMP)
+			{
+				return direct ? X86LengthDecoder::Jump : X86LengthDecoder::IndirectJump;
+			}
+			return direct ? X86LengthDecoder::ConditionalJump : X86LengthDecoder::FallsThrough;
+		}
+		if (hasGroup(inst, CS_GRP_CALL))
+		{
+			return direct ? X86LengthDecoder::Call : X86LengthDecoder::IndirectCall;
+		}
+		if (hasGroup(inst, CS_GRP_RET) || hasGroup(inst, CS_GRP_IRET))
+		{
+			return X86LengthDecoder::Return;
+		}
+		if (inst.id == X86_INS_HLT || inst.id == X86_INS_UD2)
+		{
+			return X86LengthDecoder::Stop;
+		}
+		return X86LengthDecoder::FallsThrough;
+	}
+	
+	FunctionDiscovery::DiscoveredFunction emptyFunction(uint64_t address, size_t depth)
+	{
+		FunctionDiscovery::DiscoveredFunction fn;
+		fn.address = address;
+		fn.depth = depth;
+		fn.instructionCount = 0;
+		return fn;
+	}
+}
+
+FunctionDiscovery::FunctionDiscovery(const Executable& executable, const x86_config& config)
+: executable(executable), lengthDecoder(config.address_size), signatures(nullptr), changedIndex(false)
+{
+	if (auto csHandle = capstone::create(CS_ARCH_X86, CS_MODE_LITTLE_ENDIAN | cs_size_mode(config.address_size)))
+	{
+		cs.reset(new capstone(move(csHandle.get())));
+	}
+	else
+	{
+		errs() << "couldn't open Capstone handle: " << csHandle.getError().message() << '\n';
+		abort();
+	}
+}
+
+void FunctionDiscovery::discover(DiscoveredFunction& fn)
+{
+	map<uint64_t, DecodedInstruction> decoded;
+	set<uint64_t> leaders = { fn.address };
+	SmallVector<uint64_t, 16> worklist = { fn.address };
+	auto inst = cs->alloc();
+	while (worklist.size() > 0)
+	{
+		uint64_t address = worklist.pop_back_val();
+		while (decoded.count(address) == 0)
+		{
+			const uint8_t* begin = executable.map(address);
+			if (begin == nullptr)
+			{
+				break;
+			}
+			
+			// Most instructions only need the length decoder. Capstone (with details) gets the others, and says
+			// whether they are valid at all.
+			X86LengthDecoder::Instruction quick;
+			bool decodedQuickly = lengthDecoder.decode(begin, executable.end(), address, quick);
+			if (!decodedQuickly && !cs->disassemble(inst.get(), begin, executable.end(), address))
+			{
+				break;
+			}
+			
+			DecodedInstruction& decodedInst = decoded[address];
+			decodedInst.address = address;
+			
+			uint64_t target = 0;
+			X86LengthDecoder::ControlFlow controlFlow;
+			if (decodedQuickly)
+			{
+				decodedInst.size = quick.size;
+				controlFlow = quick.controlFlow;
+				target = quick.target;
+				appendMaskedBytes(executable, begin, address, quick, decodedInst.masked, decodedInst.references);
+			}
+			else
+			{
+				decodedInst.size = static_cast<uint8_t>(inst->size);
+				controlFlow = capstoneControlFlow(*inst, target);
+				bool isBranch = hasGroup(*inst, CS_GRP_JUMP) || hasGroup(*inst, CS_GRP_CALL);
+				appendMaskedInstruction(executable, *inst, isBranch, decodedInst.masked, decodedInst.references);
+			}
+			
+			decodedInst.hasTarget = controlFlow == X86LengthDecoder::Jump || controlFlow == X86LengthDecoder::ConditionalJump;
+			decodedInst.target = target;
+			switch (controlFlow)
+			{
+				case X86LengthDecoder::Jump:
+				case X86LengthDecoder::IndirectJump:
+				case X86LengthDecoder::Return:
+				case X86LengthDecoder::Stop:
+					decodedInst.fallsThrough = false;
+					break;
+					
+				case X86LengthDecoder::Call:
+					decodedInst.fallsThrough = true;
+					appendWord(decodedInst.references, target);
+					fn.callees.push_back(target);
+					if (isNoReturn && isNoReturn(target))
+					{
+						fn.noReturnCallees.push_back(target);
+						decodedInst.fallsThrough = false;
+					}
+					break;
+					
+				default:
+					decodedInst.fallsThrough = true;
+					break;
+			}
+			
+			address += decodedInst.size;
+			if (decodedInst.hasTarget)
+			{
+				leaders.insert(decodedInst.target);
+				worklist.push_back(decodedInst.target);
+				if (decodedInst.fallsThrough)
+				{
+					leaders.insert(address);
+				}
+			}
+			if (!decodedInst.fallsThrough)
+			{
+				break;
+			}
+		}
+	}
+	
+	// Blocks end at control flow instructions, before leaders and where decoded instructions stop being contiguous
+	// (at invalid data, or where an instruction overlaps with another one).
+	bool blockOpen = false;
+	for (const auto& pair : decoded)
+	{
+		const DecodedInstruction& decodedInst = pair.second;
+		if (blockOpen)
+		{
+			Block& block = fn.blocks.back();
+			if (block.end != decodedInst.address || leaders.count(decodedInst.address) != 0)
+			{
+				if (block.end == decodedInst.address)
+				{
+					block.successors.push_back(decodedInst.address);
+				}
+				blockOpen = false;
+			}
+		}
+		
+		if (!blockOpen)
+		{
+			fn.blocks.push_back({decodedInst.address, decodedInst.address, {}});
+			blockOpen = true;
+		}
+		
+		Block& block = fn.blocks.back();
+		block.end = decodedInst.address + decodedInst.size;
+		fn.instructionCount++;
+		if (decodedInst.hasTarget || !decodedInst.fallsThrough)
+		{
+			if (decodedInst.hasTarget)
+			{
+				block.successors.push_back(decodedInst.target);
+			}
+			if (decodedInst.fallsThrough)
+			{
+				block.successors.push_back(block.end);
+			}
+			blockOpen = false;
+		}
+	}
+	
+	sort(fn.callees.begin(), fn.callees.end());
+	fn.callees.erase(unique(fn.callees.begin(), fn.callees.end()), fn.callees.end());
+	sort(fn.noReturnCallees.begin(), fn.noReturnCallees.end());
+	fn.noReturnCallees.erase(unique(fn.noReturnCallees.begin(), fn.noReturnCallees.end()), fn.noReturnCallees.end());
+	
+	if (fn.instructionCount >= minSignatureInstructions)
+	{
+		MD5 signature;
+		for (const auto& pair : decoded)
+		{
+			signature.update(pair.second.masked);
+		}
+		MD5::MD5Result result;
+		SmallString<32> resultString;
+		signature.final(result);
+		MD5::stringifyResult(result, resultString);
+		fn.signature = resultString.str();
+	}
+	
+	// Instructions are hashed with their offset in the function, and jumps that stay in the function with the offset
+	// of their target. Everything else refers to the same place for every copy of the function.
+	if (fn.instructionCount == 0)
+	{
+		return;
+	}
+	
+	MD5 body;
+	for (const auto& pair : decoded)
+	{
+		const DecodedInstruction& decodedInst = pair.second;
+		string words;
+		appendWord(words, decodedInst.address - fn.address);
+		if (decodedInst.hasTarget)
+		{
+			bool internal = decoded.count(decodedInst.target) != 0;
+			appendWord(words, internal ? 1 : 2);
+			appendWord(words, internal ? decodedInst.target - fn.address : decodedInst.target);
+		}
+		body.update(words);
+		body.update(decodedInst.masked);
+		body.update(decodedInst.references);
+	}
+	MD5::MD5Result bodyResult;
+	SmallString<32> bodyString;
+	body.final(bodyResult);
+	MD5::stringifyResult(bodyResult, bodyString);
+	fn.bodyHash = bodyString.str();
+}
+
+bool FunctionDiscovery::reuseIndexed(DiscoveredFunction& fn)
+{
+	auto iter = indexed.find(fn.address);
+	if (iter == indexed.end())
+	{
+		return false;
+	}
+	
+	// Which imports don't return depends on the headers of the run, so calls that disassembly stopped at (or didn't)
+	// must still be in the same state.
+	const DiscoveredFunction& indexedFunction = iter->second;
+	for (uint64_t callee : indexedFunction.callees)
+	{
+		bool wasNoReturn = binary_search(indexedFunction.noReturnCallees.begin(), indexedFunction.noReturnCallees.end(), callee);
+		if (wasNoReturn != (isNoReturn && isNoReturn(callee)))
+		{
+			return false;
+		}
+	}
+	
+	size_t depth = fn.depth;
+	fn = indexedFunction;
+	fn.depth = depth;
+	return true;
+}
+
+void FunctionDiscovery::hashExecutable(uint8_t (&hash)[16]) const
+{
+	MD5 md5;
+	md5.update(ArrayRef<uint8_t>(executable.begin(), executable.end()));
+	MD5::MD5Result result;
+	md5.final(result);
+	memcpy(hash, result, sizeof hash);
+}
+
+bool FunctionDiscovery::loadIndex(StringRef path, string& errorMessage)
+{
+	auto bufferOrError = MemoryBuffer::getFile(path, -1, false);
+	if (!bufferOrError)
+	{
+		if (bufferOrError.getError() == errc::no_such_file_or_directory)
+		{
+			return true;
+		}
+		errorMessage = bufferOrError.getError().message();
+		return false;
+	}
+	
+	StringRef data = bufferOrError.get()->getBuffer();
+	uint8_t hash[16];
+	hashExecutable(hash);
+	if (data.size() < sizeof indexMagic + sizeof hash || memcmp(data.data(), indexMagic, sizeof indexMagic) != 0 || memcmp(data.data() + sizeof indexMagic, hash, sizeof hash) != 0)
+	{
+		// Another executable or another fcd build. Start over.
+		return true;
+	}
+	
+	// A truncated or otherwise malformed index is ignored as a whole.
+	IndexReader reader(data.drop_front(sizeof indexMagic + sizeof hash));
+	map<uint64_t, DiscoveredFunction> loaded;
+	uint64_t functionCount;
+	if (!reader.read(functionCount))
+	{
+		return true;
+	}
+	
+	for (uint64_t i = 0; i < functionCount; ++i)
+	{
+		DiscoveredFunction fn = emptyFunction(0, 0);
+		uint64_t instructionCount;
+		uint64_t blockCount;
+		if (!reader.read(fn.address) || !reader.read(instructionCount) || !reader.read(blockCount))
+		{
+			return true;
+		}
+		
+		fn.instructionCount = instructionCount;
+		for (uint64_t j = 0; j < blockCount; ++j)
+		{
+			Block block;
+			vector<uint64_t> successors;
+			if (!reader.read(block.begin) || !reader.read(block.end) || !reader.readArray(successors))
+			{
+				return true;
+			}
+			block.successors.append(successors.begin(), successors.end());
+			fn.blocks.push_back(move(block));
+		}
+		
+		if (!reader.readArray(fn.callees) || !reader.readArray(fn.noReturnCallees) || !reader.readString(fn.signature) || !reader.readString(fn.bodyHash))
+		{
+			return true;
+		}
+		loaded[fn.address] = move(fn);
+	}
+	
+	if (reader.atEnd())
+	{
+		indexed = move(loaded);
+	}
+	return true;
+}
+
+bool FunctionDiscovery::saveIndex(StringRef path, string& errorMessage) const
+{
+	map<uint64_t, const DiscoveredFunction*> saved;
+	for (const auto& pair : indexed)
+	{
+		saved[pair.first] = &pair.second;
+	}
+	for (const auto& pair : functions)
+	{
+		saved[pair.first] = &pair.second;
+	}
+	
+	// Write to a temporary file and rename it, so that concurrent runs never see partial indices.
+	int fd;
+	SmallString<128> temporaryPath;
+	SmallString<128> model(path);
+	model += "-%%%%%%%%.tmp";
+	if (auto error = sys::fs::createUniqueFile(model, fd, temporaryPath))
+	{
+		errorMessage = error.message();
+		return false;
+	}
+	
+	{
+		uint8_t hash[16];
+		hashExecutable(hash);
+		raw_fd_ostream output(fd, true);
+		output.write(indexMagic, sizeof indexMagic);
+		output.write(reinterpret_cast<const char*>(hash), sizeof hash);
+		write(output, saved.size());
+		for (const auto& pair : saved)
+		{
+			const DiscoveredFunction& fn = *pair.second;
+			write(output, fn.address);
+			write(output, fn.instructionCount);
+			write(output, fn.blocks.size());
+			for (const Block& block : fn.blocks)
+			{
+				write(output, block.begin);
+				write(output, block.end);
+				write(output, block.successors.size());
+				for (uint64_t successor : block.successors)
+				{
+					write(output, successor);
+				}
+			}
+			writeArray(output, fn.callees);
+			writeArray(output, fn.noReturnCallees);
+			writeString(output, fn.signature);
+			writeString(output, fn.bodyHash);
+		}
+	}
+	
+	if (auto error = sys::fs::rename(temporaryPath, path))
+	{
+		errorMessage = error.message();
+		return false;
+	}
+	return true;
+}
+
+void FunctionDiscovery::addEntryPoint(uint64_t address)
+{
+	if (functions.count(address) == 0)
+	{
+		functions[address] = emptyFunction(address, 0);
+		queue.push_back(address);
+	}
+}
+
+void FunctionDiscovery::run(size_t maxDepth)
+{
+	while (queue.size() > 0)
+	{
+		DiscoveredFunction& fn = functions[queue.front()];
+		queue.pop_front();
+		if (!reuseIndexed(fn))
+		{
+			discover(fn);
+			changedIndex = true;
+		}
+		
+		if (const string* name = signatures == nullptr || fn.signature.empty() ? nullptr : signatures->find(fn.signature))
+		{
+			fn.libraryName = *name;
+		}
+		
+		if (fn.depth < maxDepth && fn.libraryName.empty())
+		{
+			for (uint64_t callee : fn.callees)
+			{
+				if (functions.count(callee) == 0 && executable.getInfo(callee))
+				{
+					functions[callee] = emptyFunction(callee, fn.depth + 1);
+					queue.push_back(callee);
+				}
+			}
+		}
+	}
+}
+
+const FunctionDiscovery::DiscoveredFunction* FunctionDiscovery::getFunction(uint64_t address) const
+{
+	auto iter = functions.find(address);
+	return iter == functions.end() ? nullptr : &iter->second;
+}
+
+// Version 2 hashes the raw bytes of instructions.
+const char FunctionSignatures::fileHeader[] = "# fcd signatures 2";
+
+bool FunctionSignatures::load(StringRef path, string& errorMessage)
+{
+	auto bufferOrError = MemoryBuffer::getFile(path);
+	if (!bufferOrError)
+	{
+		errorMessage = bufferOrError.getError().message();
+		return false;
+	}
+	
+	SmallVector<StringRef, 0> lines;
+	bufferOrError.get()->getBuffer().split(lines, '\n', -1, false);
+	if (lines.empty() || lines.front().trim() != fileHeader)
+	{
+		// Signatures of other versions don't match anything, which would go unnoticed.
+		errorMessage = "not a signature file of this version of fcd; write it again with --write-signatures";
+		return false;
+	}
+	
+	for (StringRef line : makeArrayRef(lines).drop_front())
+	{
+		line = line.trim();
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+		
+		auto parts = line.split(' ');
+		StringRef name = parts.second.trim();
+		if (parts.first.size() != 32 || name.empty())
+		{
+			errorMessage = "malformed signature line: " + line.str();
+			return false;
+		}
+		
+		// Aliases share their code. The first name wins.
+		names.insert({parts.first.lower(), name.str()});
+	}
+	return true;
+}
+
+const string* FunctionSignatures::find(StringRef signature) const
+{
+	auto iter = names.find(signature.str());
+	return iter == names.end() ? nullptr : &iter->second;
+}
@@ -0,0 +1,135 @@
+//
+// function_discovery.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef fcd__function_discovery_h
+#define fcd__function_discovery_h
+
+#include "capstone_wrapper.h"
+#include "executable.h"
+#include "x86_length_decoder.h"
+#include "x86_regs.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Names of library functions, by signature. A signature is a hash of the instructions of a function with everything
+// that depends on where code and data are (branch targets, addresses) masked out, so that a library function has the
+// same signature in every executable that it is statically linked into. Files start with the fileHeader line, which
+// changes whenever signatures are computed differently, then have one "<signature> <name>" line per function; other
+// lines that start with '#' are ignored.
+class FunctionSignatures
+{
+	std::unordered_map<std::string, std::string> names;
+	
+public:
+	static const char fileHeader[];
+	
+	bool load(llvm::StringRef path, std::string& errorMessage);
+	const std::string* find(llvm::StringRef signature) const;
+};
+
+// Recursive-descent disassembly that finds functions, their machine-level control flow graphs and the call graph
+// without lifting anything. Indirect jumps and calls are not followed, so lifting can still find more: jump tables and
+// call targets that only become constant in IR are left to TranslationContext.
+class FunctionDiscovery
+{
+public:
+	struct Block
+	{
+		uint64_t begin;
+		uint64_t end; // one past the last instruction
+		llvm::SmallVector<uint64_t, 2> successors;
+	};
+	
+	struct DiscoveredFunction
+	{
+		uint64_t address;
+		// Calls away from the closest entry point.
+		size_t depth;
+		size_t instructionCount;
+		// Sorted by address.
+		std::vector<Block> blocks;
+		// Direct call targets, sorted by address.
+		std::vector<uint64_t> callees;
+		// Callees after which disassembly stopped because they don't return, sorted by address.
+		std::vector<uint64_t> noReturnCallees;
+		// Empty for functions too short to be told apart by their code.
+		std::string signature;
+		// Name of the library function that the signature matched, if any.
+		std::string libraryName;
+		// Hash of the instructions and of what they refer to. Functions with the same body hash do the same thing,
+		// no matter where they are; unlike signatures, addresses outside of the function are not masked out.
+		std::string bodyHash;
+	};
+	
+private:
+	const Executable& executable;
+	X86LengthDecoder lengthDecoder;
+	std::unique_ptr<capstone> cs;
+	std::function<bool(uint64_t)> isNoReturn;
+	const FunctionSignatures* signatures;
+	std::map<uint64_t, DiscoveredFunction> functions;
+	std::deque<uint64_t> queue;
+	// Functions of a previous run, loaded from an index file. Their depth is meaningless.
+	std::map<uint64_t, DiscoveredFunction> indexed;
+	bool changedIndex;
+	
+	void discover(DiscoveredFunction& fn);
+	bool reuseIndexed(DiscoveredFunction& fn);
+	void hashExecutable(uint8_t (&hash)[16]) const;
+	
+public:
+	FunctionDiscovery(const Executable& executable, const x86_config& config);
+	
+	// Disassembly stops after calls to addresses for which this returns true.
+	void setNoReturnQuery(std::function<bool(uint64_t)> query) { isNoReturn = std::move(query); }
+	// Functions that match a signature are library functions. Discovery doesn't go into their callees.
+	void setSignatures(const FunctionSignatures* librarySignatures) { signatures = librarySignatures; }
+	
+	void addEntryPoint(uint64_t address);
+	// Discovers the functions that are at most maxDepth calls away from an entry point. Functions are discovered in
+	// breadth-first order, so each one gets the depth of its shortest call chain.
+	void run(size_t maxDepth);
+	
+	const DiscoveredFunction* getFunction(uint64_t address) const;
+	const std::map<uint64_t, DiscoveredFunction>& getFunctions() const { return functions; }
+	
+	// Index files keep discovered functions across runs on the same executable, so that runs with other entry points
+	// only disassemble what previous runs haven't. Functions of the index are reused by run() when the calls that they
+	// end at still don't return. Indices of other executables, or written by other fcd builds, are ignored.
+	bool loadIndex(llvm::StringRef path, std::string& errorMessage);
+	// Writes the functions of the index and the functions that were discovered since it was loaded.
+	bool saveIndex(llvm::StringRef path, std::string& errorMessage) const;
+	// Whether run() discovered functions that the index didn't have.
+	bool indexChanged() const { return changedIndex; }
+};
+
+#endif /* fcd__function_discovery_h */
@@ -0,0 +1,261 @@
+//
+// parallel_translation.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "metadata.h"
+#include "parallel_translation.h"
+#include "progress.h"
+#include "translation_context.h"
+
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <cinttypes>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	const char fieldNamesSuffix[] = ".fcd.fields";
+
+	// Worker modules are linked by name. Functions that stand for machine code are renamed to their canonical name
+	// (their symbol names are applied after linking), and values that are created per-instruction and that share a
+	// name across worker modules get a worker-specific suffix so that the linker doesn't merge them.
+	void prepareForLinking(Module& module, size_t workerIndex, vector<uint64_t>& prototypes)
+	{
+		string suffix = ".w" + to_string(workerIndex);
+		for (Function& fn : module)
+		{
+			if (auto address = md::getVirtualAddress(fn))
+			{
+				uint64_t virtualAddress = address->getLimitedValue();
+				if (md::isPrototype(fn))
+				{
+					// Prototypes have a placeholder body. Turn them back into declarations so that they can be
+					// resolved against the worker that lifted them.
+					prototypes.push_back(virtualAddress);
+					fn.deleteBody();
+				}
+				fn.setName(ParallelTranslation::canonicalName(virtualAddress));
+			}
+			else if (md::getAssemblyString(fn) != nullptr || fn.getName().startswith("fcd.placeholder"))
+			{
+				fn.setName(fn.getName() + suffix);
+			}
+		}
+
+		vector<NamedMDNode*> fieldNameNodes;
+		for (NamedMDNode& node : module.named_metadata())
+		{
+			if (node.getName().endswith(fieldNamesSuffix))
+			{
+				fieldNameNodes.push_back(&node);
+			}
+		}
+
+		for (NamedMDNode* node : fieldNameNodes)
+		{
+			string typeName = node->getName().drop_back(sizeof fieldNamesSuffix - 1);
+			if (StructType* type = module.getTypeByName(typeName))
+			{
+				type->setName(typeName + suffix);
+				NamedMDNode* renamed = module.getOrInsertNamedMetadata(type->getName().str() + fieldNamesSuffix);
+				for (MDNode* operand : node->operands())
+				{
+					renamed->addOperand(operand);
+				}
+				node->eraseFromParent();
+			}
+		}
+	}
+}
+
+string ParallelTranslation::canonicalName(uint64_t address)
+{
+	char name[] = "func_0000000000000000";
+	snprintf(name, sizeof name, "func_%" PRIx64, address);
+	return name;
+}
+
+struct ParallelTranslation::WorkerState
+{
+	LLVMContext context;
+	unique_ptr<TranslationContext> transl;
+	SmallVector<char, 0> bitcode;
+	vector<uint64_t> prototypes;
+};
+
+ParallelTranslation::ParallelTranslation(Executable& executable, const x86_config& config, TaskScheduler& scheduler, size_t maxDepth)
+: executable(executable), config(config), scheduler(scheduler), maxDepth(maxDepth), stats(nullptr), discovery(nullptr), valueNames(true), failed(false)
+{
+	workers.resize(scheduler.getJobCount());
+}
+
+ParallelTranslation::~ParallelTranslation()
+{
+}
+
+void ParallelTranslation::addEntryPoint(const SymbolInfo& info, size_t depth)
+{
+	lock_guard<mutex> lock(claimedMutex);
+	if (claimed.insert({info.virtualAddress, info}).second)
+	{
+		schedule(info.virtualAddress, depth);
+	}
+}
+
+void ParallelTranslation::schedule(uint64_t address, size_t depth)
+{
+	scheduler.add([this, address, depth](unsigned worker)
+	{
+		lift(worker, address, depth);
+	});
+}
+
+void ParallelTranslation::lift(unsigned worker, uint64_t address, size_t depth)
+{
+	if (failed)
+	{
+		return;
+	}
+	
+	unique_ptr<WorkerState>& state = workers[worker];
+	if (state == nullptr)
+	{
+		state.reset(new WorkerState);
+		md::registerKinds(state->context);
+		state->transl.reset(new TranslationContext(state->context, executable, config, "fcd-worker"));
+		state->transl->setNoReturnImportQuery(isNoReturnImport);
+		state->transl->setDiscovery(discovery);
+		state->transl->setValueNames(valueNames);
+	}
+	
+	auto start = PhaseStatistics::clock::now();
+	Function* fn = state->transl->createFunction(address);
+	if (fn == nullptr)
+	{
+		// Other workers stop at their next function, and run() fails.
+		errs() << "couldn't lift function at " << format("0x%" PRIx64, address) << '\n';
+		failed = true;
+		return;
+	}
+	
+	if (stats != nullptr)
+	{
+		stats->functionFinished(*fn, chrono::duration<double>(PhaseStatistics::clock::now() - start).count());
+	}
+	if (ProgressReporter* progress = ProgressReporter::getActive())
+	{
+		progress->functionFinished();
+	}
+	
+	if (depth < maxDepth)
+	{
+		lock_guard<mutex> lock(claimedMutex);
+		for (uint64_t discovered : state->transl->getDiscoveredEntryPoints())
+		{
+			if (claimed.count(discovered) == 0 && !(isSkipped && isSkipped(discovered)))
+			if (auto symbolInfo = executable.getInfo(discovered))
+			{
+				claimed.insert({discovered, *symbolInfo});
+				schedule(discovered, depth + 1);
+			}
+		}
+	}
+}
+
+bool ParallelTranslation::run(Module& into)
+{
+	scheduler.run();
+	if (failed)
+	{
+		return false;
+	}
+	
+	// Worker modules are written out in parallel too. Each task owns one worker's state, whichever thread runs it.
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		if (WorkerState* state = workers[i].get())
+		{
+			scheduler.add([state, i](unsigned)
+			{
+				unique_ptr<Module> module = state->transl->take();
+				prepareForLinking(*module, i, state->prototypes);
+				raw_svector_ostream bitcodeStream(state->bitcode);
+				WriteBitcodeToFile(module.get(), bitcodeStream);
+			});
+		}
+	}
+	scheduler.run();
+	
+	for (unique_ptr<WorkerState>& state : workers)
+	{
+		if (state == nullptr)
+		{
+			continue;
+		}
+		
+		StringRef bitcode(state->bitcode.data(), state->bitcode.size());
+		auto moduleOrError = parseBitcodeFile(MemoryBufferRef(bitcode, "fcd-worker"), into.getContext());
+		if (!moduleOrError)
+		{
+			errs() << "couldn't read back worker module: " << moduleOrError.getError().message() << '\n';
+			return false;
+		}
+
+		if (Linker::linkModules(into, move(moduleOrError.get())))
+		{
+			return false;
+		}
+	}
+
+	// Whatever is still a declaration after linking was not lifted by any worker and goes back to being a prototype.
+	for (unique_ptr<WorkerState>& state : workers)
+	{
+		if (state == nullptr)
+		{
+			continue;
+		}
+		
+		for (uint64_t address : state->prototypes)
+		{
+			if (Function* fn = into.getFunction(canonicalName(address)))
+			if (fn->isDeclaration())
+			{
+				md::setVirtualAddress(*fn, address);
+				md::setArgumentsRecoverable(*fn);
+			}
+		}
+	}
+
+	for (const auto& pair : claimed)
+	{
+		if (pair.second.name.size() > 0)
+		if (Function* fn = into.getFunction(canonicalName(pair.first)))
+		{
+			fn->setName(pair.second.name);
+		}
+	}
+	return true;
+}
@@ -0,0 +1,97 @@
+//
+// parallel_translation.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef fcd__parallel_translation_h
+#define fcd__parallel_translation_h
+
+#include "executable.h"
+#include "function_discovery.h"
+#include "phase_stats.h"
+#include "task_scheduler.h"
+#include "x86_regs.h"
+
+#include <llvm/IR/Module.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Lifts functions as tasks of a TaskScheduler. Each worker owns a LLVMContext and a TranslationContext (and, through
+// it, a Capstone handle and per-function AddressToBlock maps), created the first time that it lifts something. Call
+// targets discovered while lifting a function become new tasks, for any worker to pick up. Once every task is done,
+// worker modules are serialized to bitcode and linked into the destination module in worker order.
+class ParallelTranslation
+{
+	struct WorkerState;
+
+	Executable& executable;
+	x86_config config;
+	TaskScheduler& scheduler;
+	size_t maxDepth;
+	std::function<bool(llvm::StringRef)> isNoReturnImport;
+	std::function<bool(uint64_t)> isSkipped;
+	PhaseStatistics* stats;
+	const FunctionDiscovery* discovery;
+	bool valueNames;
+
+	std::mutex claimedMutex;
+	std::unordered_map<uint64_t, SymbolInfo> claimed;
+	std::atomic<bool> failed; // set by the first function that can't be lifted; checked by lift() and run()
+
+	std::vector<std::unique_ptr<WorkerState>> workers;
+
+	void schedule(uint64_t address, size_t depth);
+	void lift(unsigned worker, uint64_t address, size_t depth);
+
+public:
+	static std::string canonicalName(uint64_t address);
+
+	// maxDepth bounds how many calls away from an initial entry point functions are lifted; 0 means that only initial
+	// entry points are lifted.
+	ParallelTranslation(Executable& executable, const x86_config& config, TaskScheduler& scheduler, size_t maxDepth);
+	~ParallelTranslation();
+
+	// Called from worker threads; see TranslationContext::setNoReturnImportQuery.
+	void setNoReturnImportQuery(std::function<bool(llvm::StringRef)> query) { isNoReturnImport = std::move(query); }
+	
+	// Call targets for which query returns true are not lifted.
+	void setSkipQuery(std::function<bool(uint64_t)> query) { isSkipped = std::move(query); }
+	
+	// See TranslationContext::setValueNames.
+	void setValueNames(bool names) { valueNames = names; }
+	
+	// When set, the time spent lifting each function is recorded there.
+	void setStatistics(PhaseStatistics* statistics) { stats = statistics; }
+
+	// See TranslationContext::setDiscovery.
+	void setDiscovery(const FunctionDiscovery* functionDiscovery) { discovery = functionDiscovery; }
+
+	// depth is how many calls away from an initial entry point the function is. Functions that are known ahead of time
+	// can be added with their depth, so that workers don't have to wait for their callers to be lifted.
+	void addEntryPoint(const SymbolInfo& info, size_t depth = 0);
+	bool run(llvm::Module& into);
+};
+
+#endif /* fcd__parallel_translation_h */
@@ -0,0 +1,293 @@
+//
+// prologue_scanner.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "capstone_wrapper.h"
+#include "prologue_scanner.h"
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace llvm;
+using namespace std;
+
+#define DEBUG_TYPE "fcd-codegen"
+
+STATISTIC(PrologueCandidates, "Number of possible function starts found by scanning for prologues");
+STATISTIC(PrologueCandidatesRejected, "Number of possible function starts that didn't disassemble cleanly");
+
+namespace
+{
+	const uint64_t functionAlignment = 16;
+
+	// Instructions that must decode after a candidate for it to be kept, unless the function returns or jumps away
+	// before that.
+	const size_t validatedInstructions = 6;
+
+	// Every pattern starts with one of these bytes, so that a single search finds all of them.
+	const uint8_t endbrFirstByte = 0xf3;
+	const uint8_t pushEbpByte = 0x55;
+
+	const StringRef endbr64("\xf3\x0f\x1e\xfa", 4);
+	const StringRef endbr32("\xf3\x0f\x1e\xfb", 4);
+
+	// push rbp; mov rbp, rsp (both encodings of the mov)
+	const StringRef prologues64[] = {
+		endbr64,
+		StringRef("\x55\x48\x89\xe5", 4),
+		StringRef("\x55\x48\x8b\xec", 4),
+	};
+
+	const StringRef prologues32[] = {
+		endbr32,
+		StringRef("\x55\x89\xe5", 3),
+		StringRef("\x55\x8b\xec", 3),
+	};
+
+	// Nops that assemblers use to pad code, longest first. Longer ones only add 0x66 prefixes.
+	const StringRef paddingNops[] = {
+		StringRef("\x66\x2e\x0f\x1f\x84\x00\x00\x00\x00\x00", 10),
+		StringRef("\x66\x0f\x1f\x84\x00\x00\x00\x00\x00", 9),
+		StringRef("\x0f\x1f\x84\x00\x00\x00\x00\x00", 8),
+		StringRef("\x0f\x1f\x80\x00\x00\x00\x00", 7),
+		StringRef("\x66\x0f\x1f\x44\x00\x00", 6),
+		StringRef("\x0f\x1f\x44\x00\x00", 5),
+		StringRef("\x0f\x1f\x40\x00", 4),
+		StringRef("\x0f\x1f\x00", 3),
+		StringRef("\x66\x90", 2),
+		StringRef("\x90", 1),
+	};
+
+	StringRef bytesBetween(const uint8_t* begin, const uint8_t* end)
+	{
+		return StringRef(reinterpret_cast<const char*>(begin), static_cast<size_t>(end - begin));
+	}
+
+	// Calls found with every position of [begin, end) that holds first or second.
+	template<typename Callback>
+	void findBytes(const uint8_t* begin, const uint8_t* end, uint8_t first, uint8_t second, Callback&& found)
+	{
+		const uint8_t* cursor = begin;
+#ifdef __SSE2__
+		__m128i firstNeedle = _mm_set1_epi8(static_cast<char>(first));
+		__m128i secondNeedle = _mm_set1_epi8(static_cast<char>(second));
+		for (; end - cursor >= 16; cursor += 16)
+		{
+			__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cursor));
+			__m128i matches = _mm_or_si128(_mm_cmpeq_epi8(chunk, firstNeedle), _mm_cmpeq_epi8(chunk, secondNeedle));
+			unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(matches));
+			while (mask != 0)
+			{
+				found(cursor + __builtin_ctz(mask));
+				mask &= mask - 1;
+			}
+		}
+#endif
+		for (; cursor != end; ++cursor)
+		{
+			if (*cursor == first || *cursor == second)
+			{
+				found(cursor);
+			}
+		}
+	}
+
+	// Whether the code right before at is padding between functions: int3 bytes, or nops after an instruction that
+	// doesn't fall through. Loop heads are aligned with nops too, but they follow code that falls through, or a short
+	// jump forward to the loop condition.
+	bool followsPadding(const uint8_t* begin, const uint8_t* at)
+	{
+		if (at > begin && at[-1] == 0xcc)
+		{
+			return true;
+		}
+
+		const uint8_t* cursor = at;
+		while (static_cast<uint64_t>(at - cursor) < functionAlignment)
+		{
+			StringRef before = bytesBetween(begin, cursor);
+			auto nop = find_if(std::begin(paddingNops), std::end(paddingNops), [&](StringRef candidate)
+			{
+				return before.endswith(candidate);
+			});
+			if (nop == std::end(paddingNops))
+			{
+				break;
+			}
+
+			cursor -= nop->size();
+			while (cursor > begin && cursor[-1] == 0x66)
+			{
+				--cursor;
+			}
+		}
+
+		if (cursor == at)
+		{
+			return false;
+		}
+
+		ptrdiff_t available = cursor - begin;
+		if (available >= 1 && cursor[-1] == 0xc3)
+		{
+			return true;
+		}
+		if (available >= 2 && cursor[-2] == 0x0f && cursor[-1] == 0x0b)
+		{
+			return true;
+		}
+		if (available >= 2 && cursor[-2] == 0xeb)
+		{
+			return static_cast<int8_t>(cursor[-1]) < 0;
+		}
+		if (available >= 5 && cursor[-5] == 0xe9)
+		{
+			int32_t displacement;
+			memcpy(&displacement, cursor - 4, sizeof displacement);
+			return displacement < 0 || displacement > 0x100;
+		}
+		return false;
+	}
+
+	bool disassemblesCleanly(capstone& cs, cs_insn* inst, const uint8_t* begin, const uint8_t* end, uint64_t address)
+	{
+		for (size_t i = 0; i < validatedInstructions; ++i)
+		{
+			if (!cs.disassemble(inst, begin, end, address))
+			{
+				return false;
+			}
+
+			// Padding and traps don't start functions, and user code doesn't talk to I/O ports.
+			switch (inst->id)
+			{
+				case X86_INS_NOP:
+					if (i == 0)
+					{
+						return false;
+					}
+					break;
+
+				case X86_INS_INT3:
+				case X86_INS_HLT:
+				case X86_INS_IN:
+				case X86_INS_INSB:
+				case X86_INS_INSD:
+				case X86_INS_INSW:
+				case X86_INS_OUT:
+				case X86_INS_OUTSB:
+				case X86_INS_OUTSD:
+				case X86_INS_OUTSW:
+					return false;
+
+				case X86_INS_RET:
+				case X86_INS_JMP:
+					return true;
+
+				default: break;
+			}
+
+			begin += inst->size;
+			address += inst->size;
+		}
+		return true;
+	}
+}
+
+vector<uint64_t> scanForPrologues(const Executable& executable, const x86_config& config)
+{
+	auto csHandle = capstone::create(CS_ARCH_X86, CS_MODE_LITTLE_ENDIAN | cs_size_mode(config.address_size));
+	if (!csHandle)
+	{
+		errs() << "couldn't open Capstone handle: " << csHandle.getError().message() << '\n';
+		abort();
+	}
+	capstone cs(move(csHandle.get()));
+	auto inst = cs.alloc();
+
+	bool is64 = config.address_size == 8;
+	StringRef endbr = is64 ? endbr64 : endbr32;
+	ArrayRef<StringRef> prologues = is64 ? makeArrayRef(prologues64) : makeArrayRef(prologues32);
+
+	vector<uint64_t> result;
+	for (const SegmentInfo& segment : executable.getExecutableSegments())
+	{
+		const uint8_t* begin = executable.map(segment.begin);
+		if (begin == nullptr || begin >= executable.end())
+		{
+			continue;
+		}
+
+		// Segments can be bigger in memory than in the file.
+		uint64_t size = min<uint64_t>(segment.end - segment.begin, static_cast<uint64_t>(executable.end() - begin));
+		const uint8_t* end = begin + size;
+
+		vector<uint64_t> candidates;
+		findBytes(begin, end, endbrFirstByte, pushEbpByte, [&](const uint8_t* at)
+		{
+			StringRef code = bytesBetween(at, end);
+			for (StringRef prologue : prologues)
+			{
+				// A frame pointer setup right after endbr is part of the same prologue.
+				if (code.startswith(prologue) && (prologue == endbr || !bytesBetween(begin, at).endswith(endbr)))
+				{
+					candidates.push_back(segment.begin + static_cast<uint64_t>(at - begin));
+					break;
+				}
+			}
+		});
+
+		uint64_t aligned = (segment.begin + functionAlignment) & ~(functionAlignment - 1);
+		for (uint64_t address = aligned; address < segment.begin + size; address += functionAlignment)
+		{
+			if (followsPadding(begin, begin + (address - segment.begin)))
+			{
+				candidates.push_back(address);
+			}
+		}
+
+		sort(candidates.begin(), candidates.end());
+		candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+		PrologueCandidates += static_cast<unsigned>(candidates.size());
+		for (uint64_t address : candidates)
+		{
+			if (disassemblesCleanly(cs, inst.get(), begin + (address - segment.begin), end, address))
+			{
+				result.push_back(address);
+			}
+			else
+			{
+				++PrologueCandidatesRejected;
+			}
+		}
+	}
+	return result;
+}
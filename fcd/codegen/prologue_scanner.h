@@ -0,0 +1,39 @@
+//
+// prologue_scanner.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef fcd__codegen_prologue_scanner_h
+#define fcd__codegen_prologue_scanner_h
+
+#include "executable.h"
+#include "x86_regs.h"
+
+#include <cstdint>
+#include <vector>
+
+// Finds addresses of the executable segments of executable that look like the start of a function: CET landing pads
+// (endbr), frame pointer setup (push rbp; mov rbp, rsp), and 16-byte aligned code that follows int3 padding, or nop
+// padding after a ret or a jmp. Byte patterns are searched with SSE2 where it is available, and each candidate must
+// then disassemble cleanly for a few instructions. This is only a guess: candidates can be in the middle of a
+// function, so they are meant to add entry points to stripped executables that have no unwind information, not to
+// replace symbols. Sorted by address.
+std::vector<uint64_t> scanForPrologues(const Executable& executable, const x86_config& config);
+
+#endif /* fcd__codegen_prologue_scanner_h */
@@ -0,0 +1,254 @@
+//
+// semantics_report.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "metadata.h"
+#include "semantics_report.h"
+#include "translation_context.h"
+
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/Format.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	struct InstructionSample
+	{
+		const char* text;
+		vector<uint8_t> bytes;
+	};
+
+	// Operands are registers where the instruction allows it, and a base register plus a displacement for memory.
+	const InstructionSample samples[] = {
+		{"add rax, rbx", {0x48, 0x01, 0xd8}},
+		{"adc rax, rbx", {0x48, 0x11, 0xd8}},
+		{"sub rax, rbx", {0x48, 0x29, 0xd8}},
+		{"sbb rax, rbx", {0x48, 0x19, 0xd8}},
+		{"and rax, rbx", {0x48, 0x21, 0xd8}},
+		{"or rax, rbx", {0x48, 0x09, 0xd8}},
+		{"xor eax, eax", {0x31, 0xc0}},
+		{"cmp rax, rbx", {0x48, 0x39, 0xd8}},
+		{"test rax, rax", {0x48, 0x85, 0xc0}},
+		{"inc rax", {0x48, 0xff, 0xc0}},
+		{"dec rax", {0x48, 0xff, 0xc8}},
+		{"neg rax", {0x48, 0xf7, 0xd8}},
+		{"not rax", {0x48, 0xf7, 0xd0}},
+		{"shl rax, 3", {0x48, 0xc1, 0xe0, 0x03}},
+		{"shl rax, cl", {0x48, 0xd3, 0xe0}},
+		{"shr rax, cl", {0x48, 0xd3, 0xe8}},
+		{"sar rax, cl", {0x48, 0xd3, 0xf8}},
+		{"rol rax, cl", {0x48, 0xd3, 0xc0}},
+		{"ror rax, 1", {0x48, 0xd1, 0xc8}},
+		{"shld rax, rbx, cl", {0x48, 0x0f, 0xa5, 0xd8}},
+		{"shrd rax, rbx, cl", {0x48, 0x0f, 0xad, 0xd8}},
+		{"imul rax, rbx", {0x48, 0x0f, 0xaf, 0xc3}},
+		{"imul rbx", {0x48, 0xf7, 0xeb}},
+		{"mul rbx", {0x48, 0xf7, 0xe3}},
+		{"div ebx", {0xf7, 0xf3}},
+		{"div rbx", {0x48, 0xf7, 0xf3}},
+		{"idiv rbx", {0x48, 0xf7, 0xfb}},
+		{"mov rax, rbx", {0x48, 0x89, 0xd8}},
+		{"mov rax, [rbx+8]", {0x48, 0x8b, 0x43, 0x08}},
+		{"mov [rbx+8], rax", {0x48, 0x89, 0x43, 0x08}},
+		{"movzx eax, byte [rbx]", {0x0f, 0xb6, 0x03}},
+		{"movsx rax, word [rbx]", {0x48, 0x0f, 0xbf, 0x03}},
+		{"movsxd rax, ebx", {0x48, 0x63, 0xc3}},
+		{"lea rax, [rbx+rcx*4+8]", {0x48, 0x8d, 0x44, 0x8b, 0x08}},
+		{"push rbx", {0x53}},
+		{"pop rbx", {0x5b}},
+		{"cmove rax, rbx", {0x48, 0x0f, 0x44, 0xc3}},
+		{"sete al", {0x0f, 0x94, 0xc0}},
+		{"setl al", {0x0f, 0x9c, 0xc0}},
+		{"bt rax, rbx", {0x48, 0x0f, 0xa3, 0xd8}},
+		{"bsf rax, rbx", {0x48, 0x0f, 0xbc, 0xc3}},
+		{"bsr rax, rbx", {0x48, 0x0f, 0xbd, 0xc3}},
+		{"bswap rax", {0x48, 0x0f, 0xc8}},
+		{"xchg rax, rbx", {0x48, 0x93}},
+		{"cmpxchg [rbx], rcx", {0x48, 0x0f, 0xb1, 0x0b}},
+		{"xadd [rbx], rax", {0x48, 0x0f, 0xc1, 0x03}},
+		{"cqo", {0x48, 0x99}},
+		{"cdqe", {0x48, 0x98}},
+		{"rep movsb", {0xf3, 0xa4}},
+		{"rep stosq", {0xf3, 0x48, 0xab}},
+		{"leave", {0xc9}},
+		{"nop", {0x90}},
+		{"movq xmm0, rax", {0x66, 0x48, 0x0f, 0x6e, 0xc0}},
+		{"movaps xmm0, xmm1", {0x0f, 0x28, 0xc1}},
+		{"pxor xmm0, xmm0", {0x66, 0x0f, 0xef, 0xc0}},
+		{"addsd xmm0, xmm1", {0xf2, 0x0f, 0x58, 0xc1}},
+		{"cvtsi2sd xmm0, rax", {0xf2, 0x48, 0x0f, 0x2a, 0xc0}},
+	};
+
+	const uint64_t sampleBase = 0x1000;
+	const uint8_t ret = 0xc3;
+
+	// Every sample followed by a ret, and one last ret on its own for the cost of a function that does nothing.
+	class SampleExecutable : public Executable
+	{
+	public:
+		SampleExecutable(const uint8_t* begin, const uint8_t* end)
+		: Executable(begin, end)
+		{
+		}
+
+		virtual string getExecutableType() const override
+		{
+			return "Instruction samples";
+		}
+
+		virtual const uint8_t* map(uint64_t address) const override
+		{
+			size_t size = end() - begin();
+			if (address >= sampleBase && address < sampleBase + size)
+			{
+				return begin() + (address - sampleBase);
+			}
+			return nullptr;
+		}
+
+		virtual StubTargetQueryResult doGetStubTarget(uint64_t address, string& libraryName, string& into) const override
+		{
+			return Unresolved;
+		}
+	};
+
+	struct SampleSize
+	{
+		const char* text;
+		uint64_t address;
+		Function* function;
+		size_t lifted;
+		size_t cleaned;
+		bool implemented;
+	};
+
+	size_t countInstructions(const Function& fn)
+	{
+		size_t count = 0;
+		for (const BasicBlock& bb : fn)
+		{
+			count += bb.size();
+		}
+		return count;
+	}
+
+	bool callsAsmStandIn(const Function& fn)
+	{
+		for (const BasicBlock& bb : fn)
+		{
+			for (const Instruction& inst : bb)
+			{
+				if (auto call = dyn_cast<CallInst>(&inst))
+				if (Function* callee = call->getCalledFunction())
+				if (callee->getName().startswith("fcd.asm"))
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	size_t difference(size_t value, size_t baseline)
+	{
+		return value > baseline ? value - baseline : 0;
+	}
+}
+
+void writeSemanticsReport(const x86_config& config, const function<void(legacy::FunctionPassManager&, Executable&)>& addCleanupPasses, raw_ostream& os)
+{
+	vector<uint8_t> code;
+	vector<SampleSize> sizes;
+	for (const InstructionSample& sample : samples)
+	{
+		sizes.push_back({sample.text, sampleBase + code.size(), nullptr, 0, 0, true});
+		code.insert(code.end(), sample.bytes.begin(), sample.bytes.end());
+		code.push_back(ret);
+	}
+	uint64_t baselineAddress = sampleBase + code.size();
+	code.push_back(ret);
+
+	LLVMContext context;
+	md::registerKinds(context);
+	SampleExecutable executable(code.data(), code.data() + code.size());
+	TranslationContext transl(context, executable, config, "fcd-semantics");
+
+	Function* baseline = transl.createFunction(baselineAddress);
+	for (SampleSize& size : sizes)
+	{
+		size.function = transl.createFunction(size.address);
+		if (size.function != nullptr)
+		{
+			size.implemented = !callsAsmStandIn(*size.function);
+			size.lifted = countInstructions(*size.function);
+		}
+	}
+	size_t baselineLifted = baseline == nullptr ? 0 : countInstructions(*baseline);
+
+	legacy::FunctionPassManager cleanup(&transl.get());
+	addCleanupPasses(cleanup, executable);
+	cleanup.doInitialization();
+	if (baseline != nullptr)
+	{
+		cleanup.run(*baseline);
+	}
+	for (SampleSize& size : sizes)
+	{
+		if (size.function != nullptr)
+		{
+			cleanup.run(*size.function);
+			size.cleaned = countInstructions(*size.function);
+		}
+	}
+	cleanup.doFinalization();
+	size_t baselineCleaned = baseline == nullptr ? 0 : countInstructions(*baseline);
+
+	// Largest after cleanup first, since that's what later phases pay for.
+	stable_sort(sizes.begin(), sizes.end(), [](const SampleSize& a, const SampleSize& b)
+	{
+		return a.cleaned > b.cleaned;
+	});
+
+	os << format("%-28s %8s %8s\n", "instruction", "lifted", "cleaned");
+	for (const SampleSize& size : sizes)
+	{
+		if (size.function != nullptr && size.implemented)
+		{
+			os << format("%-28s %8zu %8zu\n", size.text, difference(size.lifted, baselineLifted), difference(size.cleaned, baselineCleaned));
+		}
+	}
+
+	for (const SampleSize& size : sizes)
+	{
+		if (size.function == nullptr)
+		{
+			os << "not lifted: " << size.text << '\n';
+		}
+		else if (!size.implemented)
+		{
+			os << "not implemented: " << size.text << '\n';
+		}
+	}
+}
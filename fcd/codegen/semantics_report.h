@@ -0,0 +1,39 @@
+//
+// semantics_report.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef fcd__codegen_semantics_report_h
+#define fcd__codegen_semantics_report_h
+
+#include "executable.h"
+#include "x86_regs.h"
+
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <functional>
+
+// Lifts a sample of common x86 instructions, each alone in a function that only returns after it, and writes how
+// many IR instructions its semantics take right after lifting and after the cleanup passes that addCleanupPasses
+// adds. The cost of a function that only returns is subtracted, so that the numbers are those of the instruction's
+// implementation. Instructions that the emulator doesn't implement are listed separately.
+void writeSemanticsReport(const x86_config& config, const std::function<void(llvm::legacy::FunctionPassManager&, Executable&)>& addCleanupPasses, llvm::raw_ostream& os);
+
+#endif /* fcd__codegen_semantics_report_h */
@@ -22,16 +22,21 @@
 #include "metadata.h"
 #include "not_null.h"
 #include "params_registry.h"
+#include "trace_events.h"
 #include "translation_context.h"
 #include "x86_register_map.h"
 
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/Statistic.h>
 #include <llvm/ADT/Triple.h>
 #include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Support/MD5.h>
 #include <llvm/Support/raw_os_ostream.h>
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Utils/Cloning.h>
 
+#include <algorithm>
 #include <array>
 #include <unordered_set>
 #include <vector>
@@ -39,18 +44,964 @@
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "fcd-codegen"
+
+STATISTIC(InstructionPointerStoresSkipped, "Number of lifted instructions that didn't store the instruction pointer");
+STATISTIC(InstructionsLiftedDirectly, "Number of instructions lifted without inlining their implementation");
+STATISTIC(StackRunsCoalesced, "Number of runs of pushes or pops lifted with a single stack pointer update");
+STATISTIC(StackOffsetConflicts, "Number of lifted functions whose stack offsets were dropped because paths disagreed");
+
 namespace
 {
-	cs_mode cs_size_mode(size_t address_size)
+	// Longest run decoded at once. This bounds how far past the end of a function a sweep may wander into data.
+	const size_t maxSweepLength = 256;
+	
+	bool endsCodeRun(const cs_insn& inst)
+	{
+		switch (inst.id)
+		{
+			case X86_INS_HLT:
+			case X86_INS_JMP:
+			case X86_INS_LJMP:
+			case X86_INS_RET:
+			case X86_INS_RETF:
+			case X86_INS_RETFQ:
+			case X86_INS_UD2:
+				return true;
+			default:
+				return false;
+		}
+	}
+	
+	// How many instructions to look at past a flag-setting instruction to find out if its flags are used.
+	const size_t maxFlagsLookahead = 16;
+	
+	// Instructions whose implementation sets all six status flags without reading any of them.
+	bool overwritesStatusFlags(unsigned opcode)
 	{
-		switch (address_size)
+		switch (opcode)
 		{
-			case 2: return CS_MODE_16;
-			case 4: return CS_MODE_32;
-			case 8: return CS_MODE_64;
+			case X86_INS_ADD:
+			case X86_INS_AND:
+			case X86_INS_CMP:
+			case X86_INS_DIV:
+			case X86_INS_IDIV:
+			case X86_INS_IMUL:
+			case X86_INS_MUL:
+			case X86_INS_NEG:
+			case X86_INS_OR:
+			case X86_INS_SUB:
+			case X86_INS_TEST:
+			case X86_INS_XOR:
+				return true;
 			default:
-				llvm_unreachable("invalid pointer size");
+				return false;
+		}
+	}
+	
+	bool usesFlags(const cs_detail& detail)
+	{
+		auto readsBegin = begin(detail.regs_read);
+		auto writesBegin = begin(detail.regs_write);
+		return find(readsBegin, readsBegin + detail.regs_read_count, X86_REG_EFLAGS) != readsBegin + detail.regs_read_count
+			|| find(writesBegin, writesBegin + detail.regs_write_count, X86_REG_EFLAGS) != writesBegin + detail.regs_write_count;
+	}
+	
+	bool transfersControl(const cs_detail& detail)
+	{
+		for (size_t i = 0; i < detail.groups_count; ++i)
+		{
+			switch (detail.groups[i])
+			{
+				case CS_GRP_JUMP:
+				case CS_GRP_CALL:
+				case CS_GRP_RET:
+				case CS_GRP_INT:
+				case CS_GRP_IRET:
+					return true;
+				default:
+					break;
+			}
+		}
+		return false;
+	}
+	
+	bool isInstructionPointer(unsigned reg)
+	{
+		return reg == X86_REG_RIP || reg == X86_REG_EIP || reg == X86_REG_IP;
+	}
+	
+	// Lifted code only stores the address of the next instruction to the instruction pointer when something can read
+	// it: an operand or an implicit read, indirect jumps (they can become tail calls) and calls (the callee pushes it
+	// as its return address). Conditional and direct jumps go to a constant destination.
+	bool readsInstructionPointer(const cs_detail& detail)
+	{
+		auto readsBegin = begin(detail.regs_read);
+		if (any_of(readsBegin, readsBegin + detail.regs_read_count, isInstructionPointer))
+		{
+			return true;
+		}
+		
+		const cs_x86& x86 = detail.x86;
+		for (size_t i = 0; i < x86.op_count; ++i)
+		{
+			const cs_x86_op& op = x86.operands[i];
+			if ((op.type == X86_OP_REG && isInstructionPointer(op.reg)) || (op.type == X86_OP_MEM && isInstructionPointer(op.mem.base)))
+			{
+				return true;
+			}
+		}
+		
+		for (size_t i = 0; i < detail.groups_count; ++i)
+		{
+			switch (detail.groups[i])
+			{
+				case CS_GRP_JUMP:
+					if (x86.op_count == 0 || x86.operands[0].type != X86_OP_IMM)
+					{
+						return true;
+					}
+					break;
+				case CS_GRP_CALL:
+				case CS_GRP_INT:
+				case CS_GRP_IRET:
+					return true;
+				default:
+					break;
+			}
 		}
+		return false;
+	}
+	
+	// The address of the next instruction is known while lifting, so RIP-relative memory operands can be made
+	// absolute. Returns false, without touching folded, if detail has no RIP-relative operand.
+	bool foldRipRelativeOperands(const cs_detail& detail, uint64_t nextAddress, cs_detail& folded)
+	{
+		const cs_x86& x86 = detail.x86;
+		auto operandsEnd = x86.operands + x86.op_count;
+		auto isRipRelative = [](const cs_x86_op& op)
+		{
+			return op.type == X86_OP_MEM && op.mem.base == X86_REG_RIP;
+		};
+		
+		if (none_of(x86.operands, operandsEnd, isRipRelative))
+		{
+			return false;
+		}
+		
+		folded = detail;
+		for (size_t i = 0; i < folded.x86.op_count; ++i)
+		{
+			cs_x86_op& op = folded.x86.operands[i];
+			if (isRipRelative(op))
+			{
+				// Without a segment, RIP-relative operands were in CS, which memory accesses ignore just the same.
+				op.mem.base = X86_REG_INVALID;
+				op.mem.disp = static_cast<int64_t>(static_cast<uint64_t>(op.mem.disp) + nextAddress);
+			}
+		}
+		return true;
+	}
+	
+	// Backwards flag liveness over the straight-line code that follows inst, using the instructions that have already
+	// been decoded. Returns true if every status flag that inst sets is overwritten before anything can read it. Since
+	// the flags structure is local to the lifted function, flags that are still pending when it returns are dead too.
+	// Anything else (branches, calls, instructions that aren't decoded yet) conservatively keeps the flags alive.
+	bool statusFlagsAreDead(CodeGenerator& irgen, const instruction_table& instructions, const cs_insn& inst)
+	{
+		if (!overwritesStatusFlags(inst.id))
+		{
+			return false;
+		}
+		
+		uint64_t address = inst.address + inst.size;
+		for (size_t i = 0; i < maxFlagsLookahead; ++i)
+		{
+			const cs_insn* next = instructions.find(address);
+			if (next == nullptr)
+			{
+				return false;
+			}
+			
+			if (overwritesStatusFlags(next->id) && irgen.implementationFor(next->id) != nullptr)
+			{
+				return true;
+			}
+			
+			if (next->id == X86_INS_RET)
+			{
+				return true;
+			}
+			
+			if (usesFlags(*next->detail) || transfersControl(*next->detail) || endsCodeRun(*next))
+			{
+				return false;
+			}
+			address += next->size;
+		}
+		return false;
+	}
+	
+	// xor r, r and sub r, r are how compilers zero a register. Inlining their implementation brings in the generic
+	// logical/arithmetic operator and its flag computations for what is a constant: these instructions are lifted
+	// directly instead. Only 32- and 64-bit registers are recognized, since their writes clear the whole register.
+	const TargetRegisterInfo* zeroedRegister(TargetInfo& target, const cs_insn& inst)
+	{
+		if (inst.id != X86_INS_XOR && inst.id != X86_INS_SUB)
+		{
+			return nullptr;
+		}
+	
+		const cs_x86& x86 = inst.detail->x86;
+		if (x86.op_count != 2 || x86.operands[0].type != X86_OP_REG || x86.operands[1].type != X86_OP_REG || x86.operands[0].reg != x86.operands[1].reg)
+		{
+			return nullptr;
+		}
+	
+		const TargetRegisterInfo* info = target.registerInfo(x86.operands[0].reg);
+		if (info == nullptr || (info->size != 4 && info->size != 8))
+		{
+			return nullptr;
+		}
+		return &target.largestOverlappingRegister(*info);
+	}
+	
+	// Stores the result of a zero idiom. flags is null when they are dead; otherwise, they are set like a zero result
+	// sets them (af is undefined after xor, and 0 is as good a value as any). With lazy flags, the flags structure has
+	// more fields than the six status flags, and the pending operation (the first of them) is cleared.
+	void liftZeroIdiom(TargetInfo& target, const TargetRegisterInfo& zeroed, Value* registers, AllocaInst* flags, BasicBlock& into)
+	{
+		GetElementPtrInst* gep = target.getRegister(registers, zeroed);
+		into.getInstList().push_back(gep);
+		new StoreInst(Constant::getNullValue(gep->getResultElementType()), gep, &into);
+		if (flags == nullptr)
+		{
+			return;
+		}
+	
+		// cf, pf, af, zf, sf, of, [lazy_op]
+		static const uint64_t statusFlags[] = { 0, 1, 0, 1, 0, 0, 0 };
+		StructType* flagsType = cast<StructType>(flags->getAllocatedType());
+		Type* i32 = Type::getInt32Ty(into.getContext());
+		unsigned count = min<unsigned>(flagsType->getNumElements(), array_lengthof(statusFlags));
+		for (unsigned i = 0; i < count; ++i)
+		{
+			Value* indices[] = { ConstantInt::get(i32, 0), ConstantInt::get(i32, i) };
+			auto flagPointer = GetElementPtrInst::CreateInBounds(flags, indices, "", &into);
+			new StoreInst(ConstantInt::get(flagsType->getElementType(i), statusFlags[i]), flagPointer, &into);
+		}
+	}
+	
+	// Jump tables are recognized from the instructions that lead to an indirect jump. Both the absolute form
+	//   cmp idx, N; ja default; ...; jmp [idx * ptrsize + table]
+	// and the position-independent form
+	//   lea base, [rip + table]; cmp idx, N; ja default; ...; movsxd dst, dword [base + idx * 4]; add dst, base; jmp dst
+	// are accepted, as long as nothing in between writes to the registers involved.
+	const size_t maxJumpTableLookbehind = 8;
+	const uint64_t maxJumpTableEntries = 4096;
+	
+	struct JumpTable
+	{
+		uint64_t address;
+		uint64_t entries;
+		size_t entrySize;
+		bool relative; // entries are signed offsets from the table address
+	};
+	
+	class JumpTableMatcher
+	{
+		TargetInfo& target;
+		const instruction_table& instructions;
+		size_t addressSize;
+		
+		const TargetRegisterInfo* largest(unsigned reg) const
+		{
+			if (reg != X86_REG_INVALID)
+			if (auto info = target.registerInfo(reg))
+			{
+				return &target.largestOverlappingRegister(*info);
+			}
+			return nullptr;
+		}
+		
+		const TargetRegisterInfo* destination(const cs_insn& inst) const
+		{
+			const cs_x86& x86 = inst.detail->x86;
+			return x86.op_count > 0 && x86.operands[0].type == X86_OP_REG ? largest(x86.operands[0].reg) : nullptr;
+		}
+		
+		bool writes(const cs_insn& inst, const TargetRegisterInfo* reg) const
+		{
+			if (reg == nullptr)
+			{
+				return false;
+			}
+			
+			if (inst.id != X86_INS_CMP && inst.id != X86_INS_TEST && destination(inst) == reg)
+			{
+				return true;
+			}
+			
+			const cs_detail& detail = *inst.detail;
+			for (size_t i = 0; i < detail.regs_write_count; ++i)
+			{
+				if (largest(detail.regs_write[i]) == reg)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+		
+		bool matchJumpOperand(const cs_insn*& inst, JumpTable& table, const TargetRegisterInfo*& index, const TargetRegisterInfo*& base) const
+		{
+			const cs_x86_op& operand = inst->detail->x86.operands[0];
+			if (operand.type == X86_OP_MEM)
+			{
+				const x86_op_mem& mem = operand.mem;
+				if (mem.segment != X86_REG_INVALID || mem.base != X86_REG_INVALID || static_cast<size_t>(mem.scale) != addressSize)
+				{
+					return false;
+				}
+				
+				index = largest(mem.index);
+				table.address = static_cast<uint64_t>(mem.disp);
+				table.entrySize = addressSize;
+				table.relative = false;
+				return index != nullptr;
+			}
+			
+			if (operand.type != X86_OP_REG)
+			{
+				return false;
+			}
+			
+			// add dst, base
+			const TargetRegisterInfo* jumpRegister = largest(operand.reg);
+			inst = instructions.previous(*inst);
+			if (inst == nullptr || inst->id != X86_INS_ADD || destination(*inst) != jumpRegister)
+			{
+				return false;
+			}
+			
+			const cs_x86& add = inst->detail->x86;
+			if (add.op_count != 2 || add.operands[1].type != X86_OP_REG)
+			{
+				return false;
+			}
+			base = largest(add.operands[1].reg);
+			
+			// movsxd dst, dword [base + index * 4]
+			inst = instructions.previous(*inst);
+			if (inst == nullptr || inst->id != X86_INS_MOVSXD || destination(*inst) != jumpRegister)
+			{
+				return false;
+			}
+			
+			const cs_x86& load = inst->detail->x86;
+			if (load.op_count != 2 || load.operands[1].type != X86_OP_MEM)
+			{
+				return false;
+			}
+			
+			const x86_op_mem& mem = load.operands[1].mem;
+			if (mem.segment != X86_REG_INVALID || largest(mem.base) != base || mem.scale != 4 || mem.disp != 0)
+			{
+				return false;
+			}
+			
+			index = largest(mem.index);
+			table.entrySize = 4;
+			table.relative = true;
+			return index != nullptr && base != nullptr;
+		}
+		
+	public:
+		JumpTableMatcher(TargetInfo& target, const instruction_table& instructions, size_t addressSize)
+		: target(target), instructions(instructions), addressSize(addressSize)
+		{
+		}
+		
+		bool match(const cs_insn& jump, JumpTable& table) const
+		{
+			if (jump.id != X86_INS_JMP || jump.detail->x86.op_count != 1)
+			{
+				return false;
+			}
+			
+			const cs_insn* inst = &jump;
+			const TargetRegisterInfo* index = nullptr;
+			const TargetRegisterInfo* base = nullptr;
+			if (!matchJumpOperand(inst, table, index, base))
+			{
+				return false;
+			}
+			
+			bool tableKnown = !table.relative;
+			bool sawBranch = false;
+			bool sawBound = false;
+			for (size_t i = 0; i < maxJumpTableLookbehind && !(sawBound && tableKnown); ++i)
+			{
+				inst = instructions.previous(*inst);
+				if (inst == nullptr)
+				{
+					return false;
+				}
+				
+				const cs_x86& x86 = inst->detail->x86;
+				if (!tableKnown && inst->id == X86_INS_LEA && destination(*inst) == base)
+				{
+					const x86_op_mem& mem = x86.operands[1].mem;
+					if (x86.op_count != 2 || x86.operands[1].type != X86_OP_MEM || mem.base != X86_REG_RIP || mem.index != X86_REG_INVALID)
+					{
+						return false;
+					}
+					table.address = inst->address + inst->size + static_cast<uint64_t>(mem.disp);
+					tableKnown = true;
+				}
+				else if (sawBound)
+				{
+					if (writes(*inst, base) || transfersControl(*inst->detail))
+					{
+						return false;
+					}
+				}
+				else if (!sawBranch && inst->id == X86_INS_JA)
+				{
+					sawBranch = true;
+				}
+				else if (sawBranch && inst->id == X86_INS_CMP)
+				{
+					if (x86.op_count != 2 || destination(*inst) != index || x86.operands[1].type != X86_OP_IMM)
+					{
+						return false;
+					}
+					
+					uint64_t bound = static_cast<uint64_t>(x86.operands[1].imm);
+					if (bound >= maxJumpTableEntries)
+					{
+						return false;
+					}
+					table.entries = bound + 1;
+					sawBound = true;
+				}
+				else if (writes(*inst, index))
+				{
+					// Only follow register copies, which compilers emit to zero-extend the index after the check.
+					if (sawBranch || (inst->id != X86_INS_MOV && inst->id != X86_INS_MOVZX) || x86.op_count != 2 || x86.operands[1].type != X86_OP_REG)
+					{
+						return false;
+					}
+					index = largest(x86.operands[1].reg);
+				}
+				else if (writes(*inst, base) || transfersControl(*inst->detail) || (sawBranch && usesFlags(*inst->detail)))
+				{
+					return false;
+				}
+			}
+			return sawBound && tableKnown;
+		}
+	};
+	
+	// Reads every target of a jump table. Fails if any entry is outside of the executable's mapped data or points
+	// outside of it.
+	bool readJumpTable(const Executable& executable, const JumpTable& table, SmallVectorImpl<uint64_t>& targets)
+	{
+		for (uint64_t i = 0; i < table.entries; ++i)
+		{
+			const uint8_t* entry = executable.map(table.address + i * table.entrySize);
+			if (entry == nullptr || entry + table.entrySize > executable.end())
+			{
+				return false;
+			}
+			
+			uint64_t value = 0;
+			for (size_t byte = 0; byte < table.entrySize; ++byte)
+			{
+				value |= static_cast<uint64_t>(entry[byte]) << (byte * CHAR_BIT);
+			}
+			
+			uint64_t target = table.relative ? table.address + static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(value))) : value;
+			if (executable.map(target) == nullptr)
+			{
+				return false;
+			}
+			targets.push_back(target);
+		}
+		
+		sort(targets.begin(), targets.end());
+		targets.erase(unique(targets.begin(), targets.end()), targets.end());
+		return true;
+	}
+	
+	// Replaces the indirect jump that an instruction was lifted to with a switch over the jump table targets. The bounds
+	// check that guards the jump keeps the index within the table, so the default destination is unreachable, unless
+	// the targets aren't exhaustive, in which case the default destination is the indirect jump. The instruction's code
+	// comes after start, in its block and in the blocks after it.
+	void lowerJumpTable(Instruction& start, Function::iterator end, ArrayRef<uint64_t> targets, AddressToBlock& blockMap, bool exhaustive = true)
+	{
+		SmallVector<CallInst*, 1> jumps;
+		auto collect = [&](iterator_range<BasicBlock::iterator> instructions)
+		{
+			for (Instruction& inst : instructions)
+			{
+				if (auto call = dyn_cast<CallInst>(&inst))
+				if (Function* callee = call->getCalledFunction())
+				if (callee->getName() == "x86_jump_intrin" && !isa<ConstantInt>(call->getArgOperand(2)))
+				{
+					jumps.push_back(call);
+				}
+			}
+		};
+		
+		BasicBlock* startBlock = start.getParent();
+		collect(make_range(next(start.getIterator()), startBlock->end()));
+		for (BasicBlock& bb : make_range(next(startBlock->getIterator()), end))
+		{
+			collect(make_range(bb.begin(), bb.end()));
+		}
+		
+		for (CallInst* jump : jumps)
+		{
+			BasicBlock* parent = jump->getParent();
+			Function& fn = *parent->getParent();
+			LLVMContext& ctx = fn.getContext();
+			Value* destination = jump->getArgOperand(2);
+			
+			BasicBlock* remainder = parent->splitBasicBlock(jump);
+			parent->getTerminator()->eraseFromParent();
+			BasicBlock* outOfBounds = remainder;
+			if (exhaustive)
+			{
+				outOfBounds = BasicBlock::Create(ctx, "", &fn);
+				new UnreachableInst(ctx, outOfBounds);
+			}
+			
+			SwitchInst* switchInst = SwitchInst::Create(destination, outOfBounds, static_cast<unsigned>(targets.size()), parent);
+			for (uint64_t target : targets)
+			{
+				auto caseValue = cast<ConstantInt>(ConstantInt::get(destination->getType(), target));
+				switchInst->addCase(caseValue, blockMap.blockToInstruction(target));
+			}
+			
+			if (exhaustive)
+			{
+				remainder->eraseFromParent();
+			}
+		}
+	}
+	
+	// The stack and frame pointers as offsets from the stack pointer on function entry, when they are known.
+	struct StackState
+	{
+		Optional<int64_t> sp;
+		Optional<int64_t> fp;
+		
+		bool operator==(const StackState& that) const
+		{
+			return sp == that.sp && fp == that.fp;
+		}
+		
+		bool operator!=(const StackState& that) const
+		{
+			return !(*this == that);
+		}
+	};
+	
+	// Follows push, pop, call, leave and constant adjustments of the stack pointer along the paths that lifting takes,
+	// and works out which stack slots the memory accesses of each instruction use. Lifting picks instructions from a
+	// worklist, so an instruction can be lifted before all of its predecessors are: if a predecessor lifted later
+	// reaches it with different offsets, the whole function is marked as conflicting and its offsets are dropped.
+	class StackOffsetTracker
+	{
+		const TargetInfo& target;
+		const x86_config& config;
+		unordered_map<uint64_t, StackState> states;
+		unordered_set<uint64_t> lifted;
+		bool conflicting;
+		
+		const TargetRegisterInfo* largest(unsigned reg) const
+		{
+			if (reg != X86_REG_INVALID)
+			if (auto info = target.registerInfo(reg))
+			{
+				return &target.largestOverlappingRegister(*info);
+			}
+			return nullptr;
+		}
+		
+		bool writes(const cs_insn& inst, unsigned reg) const
+		{
+			const TargetRegisterInfo* info = largest(reg);
+			const cs_detail& detail = *inst.detail;
+			const cs_x86& x86 = detail.x86;
+			if (inst.id != X86_INS_CMP && inst.id != X86_INS_TEST && inst.id != X86_INS_PUSH)
+			if (x86.op_count > 0 && x86.operands[0].type == X86_OP_REG && largest(x86.operands[0].reg) == info)
+			{
+				return true;
+			}
+			
+			for (size_t i = 0; i < detail.regs_write_count; ++i)
+			{
+				if (largest(detail.regs_write[i]) == info)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+		
+		bool isRegisterOperand(const cs_x86_op& op, unsigned reg) const
+		{
+			return op.type == X86_OP_REG && op.reg == reg;
+		}
+		
+		// Stack slot of the explicit memory operand, if it has one and it's relative to the stack or frame pointer.
+		Optional<int64_t> memoryOperandOffset(const cs_x86& x86, const StackState& state) const
+		{
+			for (size_t i = 0; i < x86.op_count; ++i)
+			{
+				const cs_x86_op& op = x86.operands[i];
+				if (op.type != X86_OP_MEM)
+				{
+					continue;
+				}
+				
+				const x86_op_mem& mem = op.mem;
+				if ((mem.segment != X86_REG_INVALID && mem.segment != X86_REG_SS) || mem.index != X86_REG_INVALID)
+				{
+					return None;
+				}
+				if (mem.base == config.sp && state.sp)
+				{
+					return *state.sp + mem.disp;
+				}
+				if (mem.base == config.fp && state.fp)
+				{
+					return *state.fp + mem.disp;
+				}
+				return None;
+			}
+			return None;
+		}
+		
+		void flowTo(uint64_t address, const StackState& state)
+		{
+			auto result = states.insert({address, state});
+			if (!result.second)
+			{
+				StackState& existing = result.first->second;
+				StackState merged = existing;
+				if (merged.sp != state.sp)
+				{
+					merged.sp = None;
+				}
+				if (merged.fp != state.fp)
+				{
+					merged.fp = None;
+				}
+				
+				if (merged != existing)
+				{
+					conflicting |= lifted.count(address) != 0;
+					existing = merged;
+				}
+			}
+		}
+	
+	public:
+		StackOffsetTracker(const TargetInfo& target, const x86_config& config)
+		: target(target), config(config), conflicting(false)
+		{
+		}
+		
+		bool isConflicting() const { return conflicting; }
+		
+		// The prologue pushes the return address, so the first instruction sees it at the top of the stack.
+		void start(uint64_t entryAddress)
+		{
+			StackState entry;
+			entry.sp = -static_cast<int64_t>(config.address_size);
+			states[entryAddress] = entry;
+		}
+		
+		// Offsets of the stack accesses of inst, and the state that it leaves behind for its successors. Jump table
+		// targets aren't in the instruction, so they are passed separately.
+		StackOffsets lift(const cs_insn& inst, ArrayRef<uint64_t> jumpTargets)
+		{
+			lifted.insert(inst.address);
+			StackState state = states[inst.address];
+			StackState next = state;
+			StackOffsets offsets;
+			
+			const cs_x86& x86 = inst.detail->x86;
+			int64_t addressSize = static_cast<int64_t>(config.address_size);
+			Optional<int64_t> memoryOffset = memoryOperandOffset(x86, state);
+			bool handled = true;
+			switch (inst.id)
+			{
+				case X86_INS_PUSH:
+				{
+					int64_t size = x86.operands[0].size;
+					offsets.read = memoryOffset;
+					if (state.sp)
+					{
+						offsets.write = *state.sp - size;
+						next.sp = *state.sp - size;
+					}
+					break;
+				}
+				case X86_INS_POP:
+				{
+					int64_t size = x86.operands[0].size;
+					if (state.sp)
+					{
+						offsets.read = *state.sp;
+						next.sp = *state.sp + size;
+					}
+					// Memory destinations are addressed with the stack pointer after the pop; leave them alone.
+					if (x86.operands[0].type == X86_OP_REG)
+					{
+						const TargetRegisterInfo* destination = largest(x86.operands[0].reg);
+						if (destination == largest(config.fp))
+						{
+							next.fp = None;
+						}
+						else if (destination == largest(config.sp))
+						{
+							next.sp = None;
+						}
+					}
+					break;
+				}
+				case X86_INS_CALL:
+					// The callee pushes the return address and pops it back, so only callee-cleanup conventions change
+					// the stack pointer, and they don't exist on x86_64.
+					offsets.read = memoryOffset;
+					offsets.stackPointer = state.sp;
+					if (config.address_size != 8)
+					{
+						next.sp = None;
+					}
+					break;
+				case X86_INS_RET:
+					offsets.read = state.sp;
+					break;
+				case X86_INS_LEAVE:
+					offsets.read = state.fp;
+					next.sp = state.fp ? Optional<int64_t>(*state.fp + addressSize) : None;
+					next.fp = None;
+					break;
+				case X86_INS_ADD:
+				case X86_INS_SUB:
+					handled = false;
+					if (x86.op_count == 2 && isRegisterOperand(x86.operands[0], config.sp) && x86.operands[1].type == X86_OP_IMM)
+					{
+						int64_t adjustment = inst.id == X86_INS_ADD ? x86.operands[1].imm : -x86.operands[1].imm;
+						next.sp = state.sp ? Optional<int64_t>(*state.sp + adjustment) : None;
+						handled = true;
+					}
+					break;
+				case X86_INS_LEA:
+					handled = false;
+					if (x86.op_count == 2 && x86.operands[0].type == X86_OP_REG && (x86.operands[0].reg == config.sp || x86.operands[0].reg == config.fp))
+					{
+						Optional<int64_t>& destination = x86.operands[0].reg == config.sp ? next.sp : next.fp;
+						destination = memoryOffset;
+						handled = true;
+					}
+					break;
+				case X86_INS_MOV:
+					handled = false;
+					if (x86.op_count == 2 && isRegisterOperand(x86.operands[0], config.fp) && isRegisterOperand(x86.operands[1], config.sp))
+					{
+						next.fp = state.sp;
+						handled = true;
+					}
+					else if (x86.op_count == 2 && isRegisterOperand(x86.operands[0], config.sp) && isRegisterOperand(x86.operands[1], config.fp))
+					{
+						next.sp = state.fp;
+						handled = true;
+					}
+					break;
+				default:
+					handled = false;
+					break;
+			}
+			
+			if (!handled)
+			{
+				offsets.read = memoryOffset;
+				offsets.write = memoryOffset;
+				if (writes(inst, config.sp))
+				{
+					// Stack pointer changes that aren't tracked may come with accesses relative to the stack pointer
+					// that the memory operand doesn't account for.
+					offsets = StackOffsets();
+					next.sp = None;
+				}
+				if (writes(inst, config.fp))
+				{
+					next.fp = None;
+				}
+			}
+			
+			if (!endsCodeRun(inst))
+			{
+				flowTo(inst.address + inst.size, next);
+			}
+			
+			for (size_t i = 0; i < inst.detail->groups_count; ++i)
+			{
+				if (inst.detail->groups[i] == CS_GRP_JUMP && x86.op_count == 1 && x86.operands[0].type == X86_OP_IMM)
+				{
+					flowTo(static_cast<uint64_t>(x86.operands[0].imm), next);
+				}
+			}
+			
+			for (uint64_t target : jumpTargets)
+			{
+				flowTo(target, next);
+			}
+			return offsets;
+		}
+	};
+	
+	// Pushes and pops of whole registers, which is how prologues save callee-saved registers and epilogues restore
+	// them. The stack pointer itself is left to the instruction implementations.
+	const TargetRegisterInfo* stackedRegister(TargetInfo& target, const x86_config& config, const cs_insn& inst, unsigned id)
+	{
+		if (inst.id != id)
+		{
+			return nullptr;
+		}
+		
+		const cs_x86& x86 = inst.detail->x86;
+		if (x86.op_count != 1 || x86.operands[0].type != X86_OP_REG || x86.operands[0].size != config.address_size)
+		{
+			return nullptr;
+		}
+		
+		const TargetRegisterInfo* info = target.registerInfo(x86.operands[0].reg);
+		const TargetRegisterInfo* sp = target.registerInfo(config.sp);
+		if (info == nullptr || sp == nullptr || &target.largestOverlappingRegister(*info) == &target.largestOverlappingRegister(*sp))
+		{
+			return nullptr;
+		}
+		return &target.largestOverlappingRegister(*info);
+	}
+	
+	// Collects the run of pushes or pops that starts at inst. The run stops at the first instruction that something
+	// already branches to, since that instruction needs a block of its own.
+	bool collectStackRun(TargetInfo& target, const x86_config& config, const instruction_table& instructions, AddressToBlock& blockMap, const cs_insn& inst, SmallVectorImpl<const cs_insn*>& run)
+	{
+		run.clear();
+		if (inst.id != X86_INS_PUSH && inst.id != X86_INS_POP)
+		{
+			return false;
+		}
+		
+		const cs_insn* member = &inst;
+		while (member != nullptr && stackedRegister(target, config, *member, inst.id) != nullptr)
+		{
+			run.push_back(member);
+			uint64_t next = member->address + member->size;
+			member = blockMap.isKnown(next) ? nullptr : instructions.find(next);
+		}
+		return !run.empty();
+	}
+	
+	// Lifts a run of pushes or pops with a single stack pointer update. Each register is stored to (or loaded from)
+	// its stack slot directly, instead of through an inlined implementation that reads and writes the stack pointer
+	// once per instruction, which leaves fewer stack pointer values for the optimizer and recoverstackframe to go
+	// through. Since every member of the run writes a whole register, the stored values are truncated or
+	// zero-extended to the size of the largest overlapping register.
+	void liftStackRun(TargetInfo& target, const x86_config& config, StackOffsetTracker& stackTracker, ArrayRef<const cs_insn*> run, Value* registers, BasicBlock& into)
+	{
+		LLVMContext& ctx = into.getContext();
+		bool isPush = run.front()->id == X86_INS_PUSH;
+		int64_t slotSize = static_cast<int64_t>(config.address_size);
+		IntegerType* slotType = Type::getIntNTy(ctx, static_cast<unsigned>(slotSize * 8));
+		
+		GetElementPtrInst* spPointer = target.getRegister(registers, *target.registerInfo(config.sp));
+		into.getInstList().push_back(spPointer);
+		LoadInst* sp = new LoadInst(spPointer, "", &into);
+		auto offsetFromSp = [&](int64_t offset) -> Value*
+		{
+			if (offset == 0)
+			{
+				return sp;
+			}
+			return BinaryOperator::Create(Instruction::Add, sp, ConstantInt::get(sp->getType(), static_cast<uint64_t>(offset), true), "", &into);
+		};
+		
+		int64_t adjustment = 0;
+		for (const cs_insn* inst : run)
+		{
+			StackOffsets offsets = stackTracker.lift(*inst, None);
+			GetElementPtrInst* registerPointer = target.getRegister(registers, *stackedRegister(target, config, *inst, inst->id));
+			into.getInstList().push_back(registerPointer);
+			Type* registerType = registerPointer->getResultElementType();
+			
+			if (isPush)
+			{
+				adjustment -= slotSize;
+				auto slot = new IntToPtrInst(offsetFromSp(adjustment), slotType->getPointerTo(), "", &into);
+				Value* value = new LoadInst(registerPointer, "", &into);
+				if (registerType != slotType)
+				{
+					value = new TruncInst(value, slotType, "", &into);
+				}
+				StoreInst* store = new StoreInst(value, slot, &into);
+				md::setProgramMemory(*store);
+				if (offsets.write)
+				{
+					md::setStackOffset(*store, *offsets.write);
+				}
+			}
+			else
+			{
+				auto slot = new IntToPtrInst(offsetFromSp(adjustment), slotType->getPointerTo(), "", &into);
+				LoadInst* load = new LoadInst(slot, "", &into);
+				md::setProgramMemory(*load);
+				if (offsets.read)
+				{
+					md::setStackOffset(*load, *offsets.read);
+				}
+				Value* value = load;
+				if (registerType != slotType)
+				{
+					value = new ZExtInst(value, registerType, "", &into);
+				}
+				new StoreInst(value, registerPointer, &into);
+				adjustment += slotSize;
+			}
+		}
+		new StoreInst(offsetFromSp(adjustment), spPointer, &into);
+	}
+	
+	// Lifted functions return through x86_ret_intrin, which becomes a ret instruction. Indirect jumps could be tail
+	// calls, so functions that have them can return too.
+	bool canReturn(Function& fn)
+	{
+		for (BasicBlock& bb : fn)
+		{
+			if (isa<ReturnInst>(bb.getTerminator()))
+			{
+				return true;
+			}
+			
+			for (Instruction& inst : bb)
+			{
+				if (auto call = dyn_cast<CallInst>(&inst))
+				if (Function* callee = call->getCalledFunction())
+				if (callee->getName() == "x86_jump_intrin")
+				{
+					return true;
+				}
+			}
+		}
+		return false;
 	}
 	
 	CallInformation infoForInstruction(TargetInfo& target, const cs_insn& inst)
@@ -87,33 +1038,20 @@ namespace
 		return result;
 	}
 	
-	void createAsmCall(TargetInfo& targetInfo, const cs_insn& inst, Value* registerStruct, BasicBlock& insertInto)
+	Function* createAsmFunction(TargetInfo& targetInfo, const cs_insn& inst, const CallInformation& info, Module& module)
 	{
-		Module& module = *insertInto.getParent()->getParent();
 		LLVMContext& ctx = module.getContext();
 		Type* integer = Type::getIntNTy(ctx, targetInfo.getPointerSize() * CHAR_BIT);
-		CallInformation info = infoForInstruction(targetInfo, inst);
 		
 		// Create a return type structure
 		StructType* returnType = StructType::create(module.getContext(), string(inst.mnemonic) + ".return");
 		// XXX: this assumes that we only deal with integer registers (which may have to be updated shortly)
 		
-		unordered_map<unsigned, GetElementPtrInst*> gepsForRegister;
-		
-		size_t i = 0;
-		vector<Type*> structBody(info.returns_size());
-		for (ValueInformation& value : info.returns())
+		vector<Type*> structBody;
+		for (const ValueInformation& value : info.returns())
 		{
 			assert(value.type == ValueInformation::IntegerRegister);
-			structBody[i] = integer;
-			
-			GetElementPtrInst*& gep = gepsForRegister[value.registerInfo->registerId];
-			if (gep == nullptr)
-			{
-				gep = targetInfo.getRegister(registerStruct, *value.registerInfo);
-				insertInto.getInstList().push_back(gep);
-			}
-			++i;
+			structBody.push_back(integer);
 		}
 		
 		returnType->setBody(structBody);
@@ -121,20 +1059,11 @@ namespace
 		
 		// Create a function type for the assembly value
 		// XXX: this also assumes that we only deal with integer registers
-		vector<Type*> parameters(info.parameters_size());
-		i = 0;
-		for (ValueInformation& value : info.parameters())
+		vector<Type*> parameters;
+		for (const ValueInformation& value : info.parameters())
 		{
 			assert(value.type == ValueInformation::IntegerRegister);
-			parameters[i] = integer;
-			
-			GetElementPtrInst*& gep = gepsForRegister[value.registerInfo->registerId];
-			if (gep == nullptr)
-			{
-				gep = targetInfo.getRegister(registerStruct, *value.registerInfo);
-				insertInto.getInstList().push_back(gep);
-			}
-			++i;
+			parameters.push_back(integer);
 		}
 		
 		string disassembly;
@@ -145,24 +1074,63 @@ namespace
 		
 		// set parameter names while we're at it
 		auto argIter = asmFunc->arg_begin();
-		for (ValueInformation& value : info.parameters())
+		for (const ValueInformation& value : info.parameters())
 		{
 			argIter->setName(value.registerInfo->name);
 			++argIter;
 		}
+		return asmFunc;
+	}
+	
+	// Occurrences of the same instruction share their stand-in function (and its return type), so that code that is
+	// heavy in unimplemented instructions doesn't produce one declaration per instruction.
+	void createAsmCall(TargetInfo& targetInfo, const cs_insn& inst, unordered_map<string, Function*>& asmFunctions, Value* registerStruct, BasicBlock& insertInto, bool valueNames)
+	{
+		Module& module = *insertInto.getParent()->getParent();
+		CallInformation info = infoForInstruction(targetInfo, inst);
+		
+		string key;
+		raw_string_ostream keyStream(key);
+		keyStream << inst.mnemonic << ' ' << inst.op_str << ';';
+		for (const ValueInformation& value : info.parameters())
+		{
+			keyStream << ' ' << value.registerInfo->name;
+		}
+		keyStream << ';';
+		for (const ValueInformation& value : info.returns())
+		{
+			keyStream << ' ' << value.registerInfo->name;
+		}
+		
+		Function*& asmFunc = asmFunctions[keyStream.str()];
+		if (asmFunc == nullptr)
+		{
+			asmFunc = createAsmFunction(targetInfo, inst, info, module);
+		}
+		
+		unordered_map<unsigned, GetElementPtrInst*> gepsForRegister;
+		for (const ValueInformation& value : info)
+		{
+			GetElementPtrInst*& gep = gepsForRegister[value.registerInfo->registerId];
+			if (gep == nullptr)
+			{
+				gep = targetInfo.getRegister(registerStruct, *value.registerInfo);
+				insertInto.getInstList().push_back(gep);
+			}
+		}
 		
 		SmallVector<Value*, 16> paramValues;
 		for (ValueInformation& value : info.parameters())
 		{
-			auto load = new LoadInst(gepsForRegister[value.registerInfo->registerId], value.registerInfo->name, &insertInto);
+			auto load = new LoadInst(gepsForRegister[value.registerInfo->registerId], valueNames ? StringRef(value.registerInfo->name) : StringRef(), &insertInto);
 			paramValues.push_back(load);
 		}
 		auto asmCall = CallInst::Create(asmFunc, paramValues, "", &insertInto);
 		
-		i = 0;
+		unsigned i = 0;
 		for (ValueInformation& value : info.returns())
 		{
-			auto element = ExtractValueInst::Create(asmCall, {static_cast<unsigned>(i)}, value.registerInfo->name, &insertInto);
+			auto element = ExtractValueInst::Create(asmCall, {i}, valueNames ? StringRef(value.registerInfo->name) : StringRef(), &insertInto);
 			new StoreInst(element, gepsForRegister[value.registerInfo->registerId], &insertInto);
 			++i;
 		}
@@ -173,6 +1141,9 @@ TranslationContext::TranslationContext(LLVMContext& context, Executable& executa
 : context(context)
 , executable(executable)
 , module(new Module(module_name, context))
+, config(config)
+, discovery(nullptr)
+, valueNames(true)
 {
 	if (auto generator = CodeGenerator::x86(context))
 	{
@@ -198,6 +1169,10 @@ TranslationContext::TranslationContext(LLVMContext& context, Executable& executa
 	
 	resultFnTy = FunctionType::get(Type::getVoidTy(context), { irgen->getRegisterTy()->getPointerTo() }, false);
 	functionMap.reset(new AddressToFunction(*module, *resultFnTy));
+	functionMap->setNoReturnQuery([this](uint64_t address)
+	{
+		return isNoReturnStub(address);
+	});
 	
 	Type* int32Ty = Type::getInt32Ty(context);
 	Type* int64Ty = Type::getInt64Ty(context);
@@ -262,64 +1237,226 @@ TranslationContext::~TranslationContext()
 {
 }
 
-void TranslationContext::setFunctionName(uint64_t address, const std::string &name)
+bool TranslationContext::isNoReturnStub(uint64_t address)
+{
+	const uint8_t* begin = isNoReturnImport ? executable.map(address) : nullptr;
+	if (begin == nullptr)
+	{
+		return false;
+	}
+	
+	auto inst = cs->alloc();
+	if (!cs->disassemble(inst.get(), begin, executable.end(), address))
+	{
+		return false;
+	}
+	
+	// Import stubs jump through a slot that the loader fills with the address of the import.
+	const cs_x86& x86 = inst->detail->x86;
+	if (inst->id != X86_INS_JMP || x86.op_count != 1 || x86.operands[0].type != X86_OP_MEM)
+	{
+		return false;
+	}
+	
+	const x86_op_mem& memory = x86.operands[0].mem;
+	uint64_t slot;
+	if (memory.index != X86_REG_INVALID)
+	{
+		return false;
+	}
+	else if (memory.base == X86_REG_RIP)
+	{
+		slot = address + inst->size + static_cast<uint64_t>(memory.disp);
+	}
+	else if (memory.base == X86_REG_INVALID)
+	{
+		slot = static_cast<uint64_t>(memory.disp);
+	}
+	else
+	{
+		return false;
+	}
+	
+	const StubInfo* stub = executable.getStubTarget(slot);
+	return stub != nullptr && isNoReturnImport(stub->name);
+}
+
+void TranslationContext::setFunctionName(uint64_t address, StringRef name)
 {
 	functionMap->getCallTarget(address)->setName(name);
 }
 
+void TranslationContext::setValueNames(bool names)
+{
+	valueNames = names;
+	if (!names)
+	{
+		irgen->discardValueNames();
+	}
+}
+
 Function* TranslationContext::createFunction(uint64_t baseAddress)
 {
+	TraceSpan span("createFunction", "lift", baseAddress);
 	Function* fn = functionMap->createFunction(baseAddress);
 	assert(fn != nullptr);
 	
 	auto targetInfo = TargetInfo::getTargetInfo(*module);
-	AddressToBlock blockMap(*fn);
+	AddressToBlock blockMap(*fn, valueNames);
+	if (const FunctionDiscovery::DiscoveredFunction* discovered = discovery == nullptr ? nullptr : discovery->getFunction(baseAddress))
+	{
+		blockMap.reserve(discovered->blocks.size(), discovered->instructionCount);
+	}
 	BasicBlock* entry = &fn->back();
 	
 	Argument* registers = static_cast<Argument*>(fn->arg_begin());
 	auto flags = new AllocaInst(irgen->getFlagsTy(), "flags", entry);
+	// Instructions whose flags are never read write them here instead, so that they don't add stores to the real
+	// flags structure that SROA has to see through.
+	auto deadFlags = new AllocaInst(irgen->getFlagsTy(), "flags.dead", entry);
 	
 	ArrayRef<Value*> ipGepIndices = irgen->getIpOffset();
 	auto ipPointer = GetElementPtrInst::CreateInBounds(registers, ipGepIndices, "", entry);
 	Type* ipType = GetElementPtrInst::getIndexedType(irgen->getRegisterTy(), ipGepIndices);
 	
+	// The prologue pushes the return address right below the stack pointer that the function receives.
+	StackOffsetTracker stackTracker(*targetInfo, config);
+	StackOffsets prologueOffsets;
+	prologueOffsets.write = -static_cast<int64_t>(config.address_size);
+	stackTracker.start(baseAddress);
+	
 	Function* prologue = irgen->implementationForPrologue();
-	irgen->inlineFunction(fn, prologue, { configVariable, registers }, *functionMap, blockMap, baseAddress);
+	irgen->inlineFunction(fn, prologue, { configVariable, registers }, *functionMap, blockMap, baseAddress, prologueOffsets);
 	
+	// The code hash identifies the machine code that went into this function, for the decompilation cache.
+	MD5 codeHash;
 	uint64_t addressToDisassemble;
 	auto end = executable.end();
-	auto inst = cs->alloc();
+	decodedInstructions.clear();
 	SmallVector<Value*, 4> inliningParameters = { configVariable, nullptr, registers, flags };
+	JumpTableMatcher jumpTables(*targetInfo, decodedInstructions, module->getDataLayout().getPointerSize(1));
+	SmallVector<uint64_t, 16> jumpTargets;
+	SmallVector<const cs_insn*, 8> stackRun;
+	auto lateTargets = lateJumpTargets.find(baseAddress);
+	cs_detail foldedDetail;
 	while (blockMap.getOneStub(addressToDisassemble))
 	{
+		const cs_insn* inst = decodedInstructions.find(addressToDisassemble);
+		if (inst == nullptr)
 		if (auto begin = executable.map(addressToDisassemble))
-		if (cs->disassemble(inst.get(), begin, end, addressToDisassemble))
+		if (decodedInstructions.sweep(*cs, begin, end, addressToDisassemble, maxSweepLength, &endsCodeRun) > 0)
+		{
+			inst = decodedInstructions.find(addressToDisassemble);
+		}
+		
+		if (inst != nullptr)
 		if (BasicBlock* thisBlock = blockMap.implementInstruction(inst->address)) // already implemented?
 		{
+			auto nextInstAddress = inst->address + inst->size;
+			codeHash.update(ArrayRef<uint8_t>(reinterpret_cast<const uint8_t*>(&inst->address), sizeof inst->address));
+			codeHash.update(ArrayRef<uint8_t>(inst->bytes, inst->size));
+			
+			bool implemented = irgen->implementationFor(inst->id) != nullptr;
+			const cs_detail* detail = inst->detail;
+			if (implemented && foldRipRelativeOperands(*inst->detail, nextInstAddress, foldedDetail))
+			{
+				detail = &foldedDetail;
+			}
+			
 			// store instruction pointer
 			// (this needs to be the IP of the next instruction)
-			auto nextInstAddress = inst->address + inst->size;
-			auto ipValue = ConstantInt::get(ipType, nextInstAddress);
-			new StoreInst(ipValue, ipPointer, false, thisBlock);
+			StoreInst* ipStore = nullptr;
+			if (readsInstructionPointer(*detail))
+			{
+				auto ipValue = ConstantInt::get(ipType, nextInstAddress);
+				ipStore = new StoreInst(ipValue, ipPointer, false, thisBlock);
+			}
+			else
+			{
+				++InstructionPointerStoresSkipped;
+			}
 			
-			if (Function* implementation = irgen->implementationFor(inst->id))
+			if (implemented && collectStackRun(*targetInfo, config, decodedInstructions, blockMap, *inst, stackRun))
+			{
+				for (const cs_insn* member : makeArrayRef(stackRun).slice(1))
+				{
+					codeHash.update(ArrayRef<uint8_t>(reinterpret_cast<const uint8_t*>(&member->address), sizeof member->address));
+					codeHash.update(ArrayRef<uint8_t>(member->bytes, member->size));
+				}
+				
+				liftStackRun(*targetInfo, config, stackTracker, stackRun, registers, *thisBlock);
+				const cs_insn* last = stackRun.back();
+				BranchInst* fallThrough = BranchInst::Create(thisBlock, thisBlock);
+				fallThrough->setSuccessor(0, blockMap.blockToInstruction(last->address + last->size));
+				InstructionsLiftedDirectly += stackRun.size();
+				++StackRunsCoalesced;
+			}
+			else if (const TargetRegisterInfo* zeroed = implemented ? zeroedRegister(*targetInfo, *inst) : nullptr)
+			{
+				stackTracker.lift(*inst, None);
+				bool flagsAreDead = statusFlagsAreDead(*irgen, decodedInstructions, *inst);
+				liftZeroIdiom(*targetInfo, *zeroed, registers, flagsAreDead ? nullptr : flags, *thisBlock);
+				BranchInst* fallThrough = BranchInst::Create(thisBlock, thisBlock);
+				fallThrough->setSuccessor(0, blockMap.blockToInstruction(nextInstAddress));
+				++InstructionsLiftedDirectly;
+			}
+			else if (implemented)
 			{
 				// We have an implementation: inline it
-				Constant* detailAsConstant = irgen->constantForDetail(*inst->detail);
-				inliningParameters[1] = new GlobalVariable(*module, detailAsConstant->getType(), true, GlobalValue::PrivateLinkage, detailAsConstant);
-				irgen->inlineFunction(fn, implementation, inliningParameters, *functionMap, blockMap, nextInstAddress);
+				JumpTable table;
+				jumpTargets.clear();
+				bool isJumpTable = jumpTables.match(*inst, table) && readJumpTable(executable, table, jumpTargets);
+				StackOffsets stackOffsets = stackTracker.lift(*inst, isJumpTable ? jumpTargets : ArrayRef<uint64_t>());
+				
+				inliningParameters[3] = statusFlagsAreDead(*irgen, decodedInstructions, *inst) ? deadFlags : flags;
+				irgen->inlineInstruction(fn, inst->id, *detail, inliningParameters, *functionMap, blockMap, nextInstAddress, stackOffsets);
+				if (isJumpTable)
+				{
+					// Jump tables are indirect jumps, which always store the instruction pointer.
+					assert(ipStore != nullptr);
+					lowerJumpTable(*ipStore, fn->end(), jumpTargets, blockMap);
+				}
+				else if (ipStore != nullptr && lateTargets != lateJumpTargets.end())
+				{
+					lowerJumpTable(*ipStore, fn->end(), lateTargets->second, blockMap, false);
+				}
 			}
 			else
 			{
-				createAsmCall(*targetInfo, *inst, registers, *thisBlock);
-				BasicBlock* target = blockMap.blockToInstruction(nextInstAddress);
-				BranchInst::Create(target, thisBlock);
+				// The block needs a terminator before looking for the next instruction, which can split it.
+				stackTracker.lift(*inst, None);
+				createAsmCall(*targetInfo, *inst, asmFunctions, registers, *thisBlock, valueNames);
+				BranchInst* fallThrough = BranchInst::Create(thisBlock, thisBlock);
+				fallThrough->setSuccessor(0, blockMap.blockToInstruction(nextInstAddress));
 			}
 			continue;
 		}
 		break;
 	}
 	
+	if (!canReturn(*fn))
+	{
+		fn->setDoesNotReturn();
+	}
+	
+	if (stackTracker.isConflicting())
+	{
+		for (BasicBlock& bb : *fn)
+		{
+			for (Instruction& inst : bb)
+			{
+				md::removeStackOffset(inst);
+			}
+		}
+		++StackOffsetConflicts;
+	}
+	
+	MD5::MD5Result codeHashResult;
+	SmallString<32> codeHashString;
+	codeHash.final(codeHashResult);
+	MD5::stringifyResult(codeHashResult, codeHashString);
+	md::setCodeHash(*fn, codeHashString);
+	
 #if DEBUG && 0
 	// check that it still works
 	if (verifyModule(*module, &errs()))
@@ -339,7 +1476,65 @@ std::unordered_set<uint64_t> TranslationContext::getDiscoveredEntryPoints() cons
 	return entryPoints;
 }
 
+Function* TranslationContext::getCallTarget(uint64_t address)
+{
+	return functionMap->getCallTarget(address);
+}
+
+void TranslationContext::setDiscovery(const FunctionDiscovery* functionDiscovery)
+{
+	discovery = functionDiscovery;
+	discoveredFunctionStarts.clear();
+	if (discovery == nullptr)
+	{
+		functionMap->setFunctionStartQuery(nullptr);
+		return;
+	}
+	
+	for (const auto& pair : discovery->getFunctions())
+	{
+		discoveredFunctionStarts.insert(pair.first);
+		discoveredFunctionStarts.insert(pair.second.callees.begin(), pair.second.callees.end());
+	}
+	functionMap->setFunctionStartQuery([this](uint64_t address)
+	{
+		return discoveredFunctionStarts.count(address) != 0 || executable.getStubTarget(address) != nullptr;
+	});
+}
+
+bool TranslationContext::isFunctionStart(uint64_t address) const
+{
+	return functionMap->isFunctionStart(address);
+}
+
+bool TranslationContext::addLateJumpTarget(uint64_t address, uint64_t destination)
+{
+	vector<uint64_t>& targets = lateJumpTargets[address];
+	if (find(targets.begin(), targets.end(), destination) != targets.end())
+	{
+		return false;
+	}
+	targets.push_back(destination);
+	return true;
+}
+
+Function* TranslationContext::reliftFunction(uint64_t address)
+{
+	// Functions without a body are prototypes, which createFunction can lift into.
+	functionMap->getCallTarget(address)->deleteBody();
+	return createFunction(address);
+}
+
 unique_ptr<Module> TranslationContext::take()
 {
+	// Stand-ins can be deleted once the module is out of our hands.
+	asmFunctions.clear();
 	return move(module);
 }
+
+void TranslationContext::resume(unique_ptr<Module> taken)
+{
+	assert(module == nullptr);
+	module = move(taken);
+	functionMap->rebuild();
+}
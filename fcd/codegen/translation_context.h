@@ -25,6 +25,7 @@
 #include "capstone_wrapper.h"
 #include "code_generator.h"
 #include "executable.h"
+#include "function_discovery.h"
 #include "targetinfo.h"
 #include "translation_maps.h"
 #include "x86_regs.h"
@@ -33,9 +34,11 @@
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/LLVMContext.h>
 
+#include <functional>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 class CodeGenerator;
 
@@ -44,12 +47,24 @@ class TranslationContext
 	llvm::LLVMContext& context;
 	Executable& executable;
 	std::unique_ptr<capstone> cs;
-	std::unique_ptr<CodeGenerator> irgen;
+	instruction_table decodedInstructions;
+	std::shared_ptr<CodeGenerator> irgen;
 	std::unique_ptr<llvm::Module> module;
 	std::unique_ptr<AddressToFunction> functionMap;
+	x86_config config;
 	
 	llvm::FunctionType* resultFnTy;
 	llvm::GlobalVariable* configVariable;
+	std::function<bool(llvm::StringRef)> isNoReturnImport;
+	const FunctionDiscovery* discovery;
+	// Functions that discovery found, and the functions that they call. Import stubs are function starts too.
+	std::unordered_set<uint64_t> discoveredFunctionStarts;
+	bool valueNames;
+	// fcd.asm stand-ins for unimplemented instructions, by disassembly and registers read and written.
+	std::unordered_map<std::string, llvm::Function*> asmFunctions;
+	// Destinations inside of a function that its indirect jumps were found to go to after it was lifted, by function
+	// address.
+	std::unordered_map<uint64_t, std::vector<uint64_t>> lateJumpTargets;
 	
 	llvm::CastInst& getPointer(llvm::Value* intptr, size_t size);
 	std::string nameOf(uint64_t address) const;
@@ -58,13 +73,37 @@ public:
 	TranslationContext(llvm::LLVMContext& context, Executable& executable, const x86_config& config, const std::string& module_name = "");
 	~TranslationContext();
 	
-	void setFunctionName(uint64_t address, const std::string& name);
+	void setFunctionName(uint64_t address, llvm::StringRef name);
+	// Calls to import stubs are where lifting stops when query returns true for the name of the import.
+	void setNoReturnImportQuery(std::function<bool(llvm::StringRef)> query) { isNoReturnImport = std::move(query); }
+	// Whether address is an import stub for which the no-return import query returns true.
+	bool isNoReturnStub(uint64_t address);
+	// Blocks, register loads and values copied from the emulator are named only to make the IR readable; without
+	// names, lifting saves a string and a symbol table entry per value. Functions and the arguments of fcd.asm
+	// stand-ins keep their names, since the output uses them. Names are on by default.
+	void setValueNames(bool names);
+	// Functions that discovery found are lifted into maps that are already the right size, and jumps to them are tail
+	// calls whatever has been lifted so far.
+	void setDiscovery(const FunctionDiscovery* functionDiscovery);
 	llvm::Function* createFunction(uint64_t base_address);
 	std::unordered_set<uint64_t> getDiscoveredEntryPoints() const;
 	
+	llvm::Function* getCallTarget(uint64_t address);
+	// Whether jumps to address are tail calls rather than branches (see AddressToFunction::isFunctionStart).
+	bool isFunctionStart(uint64_t address) const;
+	
+	// Records that an indirect jump of the function at address goes to destination, in the same function. Returns
+	// false if it was known already. Once the function is lifted again with reliftFunction, its indirect jumps
+	// branch to the known destinations when their target is one of them.
+	bool addLateJumpTarget(uint64_t address, uint64_t destination);
+	llvm::Function* reliftFunction(uint64_t address);
+	
 	inline llvm::Module* operator->() { return &get(); }
 	llvm::Module& get() { return *module; }
 	std::unique_ptr<llvm::Module> take();
+	// Gives back the module that take() returned, so that more functions can be lifted into it after it has been
+	// optimized.
+	void resume(std::unique_ptr<llvm::Module> taken);
 };
 
 #endif /* defined(fcd__translation_context_h) */
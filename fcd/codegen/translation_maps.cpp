@@ -22,9 +22,17 @@
 #include "metadata.h"
 #include "translation_maps.h"
 
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/Instructions.h>
+
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "fcd-codegen"
+
+STATISTIC(InstructionsAppended, "Number of machine instructions implemented at the end of the block that leads to them");
+STATISTIC(AppendedInstructionsSplit, "Number of appended machine instructions that later needed a block of their own");
+
 Function* AddressToFunction::insertFunction(uint64_t address)
 {
 	char defaultName[] = "func_0000000000000000";
@@ -34,9 +42,25 @@ Function* AddressToFunction::insertFunction(uint64_t address)
 	Function* fn = Function::Create(&fnType, GlobalValue::ExternalLinkage, defaultName, &module);
 	md::setVirtualAddress(*fn, address);
 	md::setArgumentsRecoverable(*fn);
+	if (isNoReturn && isNoReturn(address))
+	{
+		fn->setDoesNotReturn();
+	}
 	return fn;
 }
 
+void AddressToFunction::rebuild()
+{
+	functions.clear();
+	for (Function& fn : module)
+	{
+		if (auto address = md::getVirtualAddress(fn))
+		{
+			functions[address->getLimitedValue()] = &fn;
+		}
+	}
+}
+
 size_t AddressToFunction::getDiscoveredEntryPoints(unordered_set<uint64_t> &entryPoints) const
 {
 	size_t total = 0;
@@ -51,6 +75,16 @@ size_t AddressToFunction::getDiscoveredEntryPoints(unordered_set<uint64_t> &entr
 	return total;
 }
 
+bool AddressToFunction::isFunctionStart(uint64_t address) const
+{
+	// Which functions exist depends on the order in which they were lifted, so the query wins when there is one.
+	if (isKnownFunction)
+	{
+		return isKnownFunction(address);
+	}
+	return functions.count(address) != 0;
+}
+
 Function* AddressToFunction::getCallTarget(uint64_t address)
 {
 	Function*& result = functions[address];
@@ -85,26 +119,65 @@ Function* AddressToFunction::createFunction(uint64_t address)
 
 bool AddressToBlock::getOneStub(uint64_t& address)
 {
-	auto iter = stubs.begin();
-	while (iter != stubs.end())
+	while (stubWorklist.size() > 0)
 	{
-		if (iter->second->getNumUses() != 0)
+		uint64_t stubAddress = stubWorklist.front();
+		if (BasicBlock** stub = stubs.find(stubAddress))
 		{
-			address = iter->first;
-			return true;
+			if ((*stub)->getNumUses() != 0)
+			{
+				address = stubAddress;
+				return true;
+			}
+			(*stub)->eraseFromParent();
+			stubs.erase(stubAddress);
 		}
-		iter->second->eraseFromParent();
-		iter = stubs.erase(iter);
+		// Either implemented or dead.
+		stubWorklist.pop_front();
 	}
 	return false;
 }
 
+bool AddressToBlock::isKnown(uint64_t address)
+{
+	return blocks.find(address) != nullptr || appended.find(address) != nullptr || stubs.find(address) != nullptr;
+}
+
+void AddressToBlock::setBlockName(BasicBlock& block, uint64_t address)
+{
+	if (!nameBlocks)
+	{
+		return;
+	}
+	
+	unsigned pointerSize = ((sizeof address * CHAR_BIT) - __builtin_clzll(address) + CHAR_BIT - 1) / CHAR_BIT * 2;
+	
+	// set block name (aesthetic reasons)
+	char blockName[] = "0000000000000000";
+	snprintf(blockName, sizeof blockName, "%0.*" PRIx64, pointerSize, address);
+	block.setName(blockName);
+}
+
 llvm::BasicBlock* AddressToBlock::blockToInstruction(uint64_t address)
 {
-	auto iter = blocks.find(address);
-	if (iter != blocks.end())
+	if (BasicBlock** block = blocks.find(address))
 	{
-		return iter->second;
+		return *block;
+	}
+	
+	if (Instruction** before = appended.find(address))
+	{
+		// Lifted code has no PHI nodes yet, so moving the end of the block to a new block is all it takes.
+		Instruction* last = *before;
+		BasicBlock* head = last->getParent();
+		BasicBlock* tail = BasicBlock::Create(insertInto.getContext(), "", &insertInto, head->getNextNode());
+		tail->getInstList().splice(tail->end(), head->getInstList(), next(last->getIterator()), head->end());
+		BranchInst::Create(tail, head);
+		setBlockName(*tail, address);
+		appended.erase(address);
+		blocks[address] = tail;
+		++AppendedInstructionsSplit;
+		return tail;
 	}
 	
 	BasicBlock*& stub = stubs[address];
@@ -112,33 +185,61 @@ llvm::BasicBlock* AddressToBlock::blockToInstruction(uint64_t address)
 	{
 		stub = BasicBlock::Create(insertInto.getContext(), "", &insertInto);
 		ReturnInst::Create(insertInto.getContext(), stub);
+		stubWorklist.push_back(address);
 	}
 	return stub;
 }
 
 llvm::BasicBlock* AddressToBlock::implementInstruction(uint64_t address)
 {
-	BasicBlock*& bodyBlock = blocks[address];
-	if (bodyBlock != nullptr)
+	if (blocks.find(address) != nullptr || appended.find(address) != nullptr)
 	{
 		return nullptr;
 	}
 	
-	bodyBlock = BasicBlock::Create(insertInto.getContext(), "", &insertInto);
-	
-	unsigned pointerSize = ((sizeof address * CHAR_BIT) - __builtin_clzll(address) + CHAR_BIT - 1) / CHAR_BIT * 2;
+	BasicBlock* stub = nullptr;
+	if (BasicBlock** stubEntry = stubs.find(address))
+	{
+		stub = *stubEntry;
+		stubs.erase(address);
+	}
 	
-	// set block name (aesthetic reasons)
-	char blockName[] = "0000000000000000";
-	snprintf(blockName, sizeof blockName, "%0.*" PRIx64, pointerSize, address);
-	bodyBlock->setName(blockName);
+	// Instructions are implemented at the end of the function. The block that leads to this instruction can be moved
+	// there, unless it's the entry block.
+	if (stub != nullptr && stub->hasOneUse())
+	if (auto branch = dyn_cast<BranchInst>(stub->user_back()))
+	if (branch->isUnconditional() && branch->getParent() != &insertInto.getEntryBlock())
+	{
+		BasicBlock* block = branch->getParent();
+		Instruction* last = branch->getPrevNode();
+		branch->eraseFromParent();
+		stub->eraseFromParent();
+		if (block != &insertInto.back())
+		{
+			block->moveAfter(&insertInto.back());
+		}
+		
+		if (last == nullptr)
+		{
+			// The block only led to this instruction; it may as well be the instruction's block.
+			setBlockName(*block, address);
+			blocks[address] = block;
+		}
+		else
+		{
+			appended[address] = last;
+			++InstructionsAppended;
+		}
+		return block;
+	}
 	
-	auto iter = stubs.find(address);
-	if (iter != stubs.end())
+	BasicBlock* bodyBlock = BasicBlock::Create(insertInto.getContext(), "", &insertInto);
+	setBlockName(*bodyBlock, address);
+	blocks[address] = bodyBlock;
+	if (stub != nullptr)
 	{
-		iter->second->replaceAllUsesWith(bodyBlock);
-		iter->second->eraseFromParent();
-		stubs.erase(iter);
+		stub->replaceAllUsesWith(bodyBlock);
+		stub->eraseFromParent();
 	}
 	return bodyBlock;
 }
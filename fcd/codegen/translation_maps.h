@@ -27,16 +27,76 @@
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Module.h>
 
-#include <unordered_map>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <map>
 #include <unordered_set>
 #include <string>
+#include <utility>
+#include <vector>
+
+// Sorted vector keyed by virtual address. Lifted code mostly visits addresses in increasing order, so most insertions
+// happen at or near the end.
+template<typename T>
+class FlatAddressMap
+{
+	typedef std::pair<uint64_t, T> value_type;
+	std::vector<value_type> entries;
+	
+	typename std::vector<value_type>::iterator lowerBound(uint64_t address)
+	{
+		return std::lower_bound(entries.begin(), entries.end(), address, [](const value_type& entry, uint64_t key)
+		{
+			return entry.first < key;
+		});
+	}
+	
+public:
+	T* find(uint64_t address)
+	{
+		auto iter = lowerBound(address);
+		return iter != entries.end() && iter->first == address ? &iter->second : nullptr;
+	}
+	
+	T& operator[](uint64_t address)
+	{
+		auto iter = lowerBound(address);
+		if (iter == entries.end() || iter->first != address)
+		{
+			iter = entries.insert(iter, value_type(address, T()));
+		}
+		return iter->second;
+	}
+	
+	bool erase(uint64_t address)
+	{
+		auto iter = lowerBound(address);
+		if (iter != entries.end() && iter->first == address)
+		{
+			entries.erase(iter);
+			return true;
+		}
+		return false;
+	}
+	
+	void clear() { entries.clear(); }
+	void reserve(size_t count) { entries.reserve(count); }
+};
 
 class AddressToFunction
 {
 	llvm::Module& module;
 	llvm::FunctionType& fnType;
-	std::unordered_map<uint64_t, std::string> aliases;
-	std::unordered_map<uint64_t, llvm::Function*> functions;
+	// Call targets arrive in no particular order, which is a bad fit for a sorted vector.
+	std::map<uint64_t, std::string> aliases;
+	std::map<uint64_t, llvm::Function*> functions;
+	// Functions that are created for addresses for which this returns true are marked noreturn, so that lifting
+	// stops at calls to them.
+	std::function<bool(uint64_t)> isNoReturn;
+	// Addresses that are function entries, known before lifting. When it is set, it alone decides what's a function
+	// start, so that the answer doesn't depend on what was lifted first.
+	std::function<bool(uint64_t)> isKnownFunction;
 	
 	llvm::Function* insertFunction(uint64_t address);
 	
@@ -52,26 +112,60 @@ public:
 		functions.clear();
 	}
 	
+	// Functions can be renamed or deleted once the module is optimized. This maps addresses back to the functions
+	// that are still in the module.
+	void rebuild();
+	
 	size_t getDiscoveredEntryPoints(std::unordered_set<uint64_t>& entryPoints) const;
 	
+	void setNoReturnQuery(std::function<bool(uint64_t)> query) { isNoReturn = std::move(query); }
+	void setFunctionStartQuery(std::function<bool(uint64_t)> query) { isKnownFunction = std::move(query); }
+	
+	// Jumps to function starts are tail calls: the target is called instead of being lifted again in the caller.
+	bool isFunctionStart(uint64_t address) const;
+	
 	llvm::Function* getCallTarget(uint64_t address);
 	llvm::Function* createFunction(uint64_t address);
 };
 
+// Instructions that only one branch leads to are implemented at the end of the block of that branch, so that
+// straight-line machine code becomes a single block. Such an instruction gets a block of its own only when something
+// else branches to it later, by splitting the block that it was added to. For that to work, blocks that are being
+// implemented must have a terminator whenever blockToInstruction is called.
 class AddressToBlock
 {
 	llvm::Function& insertInto;
-	std::unordered_map<uint64_t, llvm::BasicBlock*> blocks;
-	std::unordered_map<uint64_t, llvm::BasicBlock*> stubs;
+	FlatAddressMap<llvm::BasicBlock*> blocks;
+	// Instructions that were added to the block of the branch that leads to them, by the LLVM instruction that comes
+	// right before their implementation.
+	FlatAddressMap<llvm::Instruction*> appended;
+	FlatAddressMap<llvm::BasicBlock*> stubs;
+	// Stub addresses in creation order. Stubs are implemented in that order, which makes translation reproducible.
+	std::deque<uint64_t> stubWorklist;
+	bool nameBlocks;
+	
+	void setBlockName(llvm::BasicBlock& block, uint64_t address);
 	
 public:
-	AddressToBlock(llvm::Function& fn)
-	: insertInto(fn)
+	// Blocks are named after their address when nameBlocks is set. This is only for readability.
+	AddressToBlock(llvm::Function& fn, bool nameBlocks = true)
+	: insertInto(fn), nameBlocks(nameBlocks)
+	{
+	}
+	
+	// Sizes the maps for a function of that many blocks and instructions, when these are known before lifting.
+	void reserve(size_t blockCount, size_t instructionCount)
 	{
+		blocks.reserve(blockCount);
+		stubs.reserve(blockCount);
+		appended.reserve(instructionCount);
 	}
 	
 	bool getOneStub(uint64_t& address);
 	
+	// Whether the instruction at address has a block or a stub, or was appended to another instruction's block.
+	bool isKnown(uint64_t address);
+	
 	llvm::BasicBlock* blockToInstruction(uint64_t address);
 	llvm::BasicBlock* implementInstruction(uint64_t address);
 };
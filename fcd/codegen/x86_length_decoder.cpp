@@ -0,0 +1,547 @@
+//
+// x86_length_decoder.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "x86_length_decoder.h"
+
+#include <cstring>
+#include <initializer_list>
+
+using namespace std;
+
+namespace
+{
+	const size_t maxInstructionSize = 15;
+
+	enum OpcodeFlags : uint8_t
+	{
+		HasModRM = 1 << 0,
+		ImmediateByte = 1 << 1,  // ib
+		ImmediateWord = 1 << 2,  // iw
+		ImmediateOperand = 1 << 3, // iz: 2 or 4 bytes, depending on the operand size
+		Invalid64 = 1 << 4,
+		Declined = 1 << 5,
+	};
+
+	// Flags of the one-byte and 0x0f opcode maps. Prefixes, escapes and opcodes whose shape depends on more than the
+	// opcode byte are special-cased in decode.
+	struct OpcodeTables
+	{
+		uint8_t oneByte[256];
+		uint8_t twoByte[256];
+
+		void set(uint8_t (&table)[256], unsigned first, unsigned last, uint8_t flags)
+		{
+			for (unsigned i = first; i <= last; ++i)
+			{
+				table[i] = flags;
+			}
+		}
+
+		OpcodeTables()
+		{
+			memset(oneByte, 0, sizeof oneByte);
+			for (unsigned row = 0; row < 0x40; row += 8)
+			{
+				// add, or, adc, sbb, and, sub, xor, cmp
+				set(oneByte, row, row + 3, HasModRM);
+				oneByte[row + 4] = ImmediateByte;
+				oneByte[row + 5] = ImmediateOperand;
+			}
+			for (unsigned opcode : {0x06, 0x07, 0x0e, 0x16, 0x17, 0x1e, 0x1f, 0x27, 0x2f, 0x37, 0x3f, 0x60, 0x61, 0xce})
+			{
+				oneByte[opcode] = Invalid64;
+			}
+			oneByte[0x62] = HasModRM | Invalid64;
+			oneByte[0x63] = HasModRM;
+			oneByte[0x68] = ImmediateOperand;
+			oneByte[0x69] = HasModRM | ImmediateOperand;
+			oneByte[0x6a] = ImmediateByte;
+			oneByte[0x6b] = HasModRM | ImmediateByte;
+			set(oneByte, 0x70, 0x7f, ImmediateByte);
+			oneByte[0x80] = HasModRM | ImmediateByte;
+			oneByte[0x81] = HasModRM | ImmediateOperand;
+			oneByte[0x82] = HasModRM | ImmediateByte | Invalid64;
+			oneByte[0x83] = HasModRM | ImmediateByte;
+			set(oneByte, 0x84, 0x8f, HasModRM);
+			oneByte[0x9a] = Declined;
+			oneByte[0xa8] = ImmediateByte;
+			oneByte[0xa9] = ImmediateOperand;
+			set(oneByte, 0xb0, 0xb7, ImmediateByte);
+			set(oneByte, 0xb8, 0xbf, ImmediateOperand);
+			oneByte[0xc0] = HasModRM | ImmediateByte;
+			oneByte[0xc1] = HasModRM | ImmediateByte;
+			oneByte[0xc2] = ImmediateWord;
+			oneByte[0xc4] = HasModRM | Invalid64;
+			oneByte[0xc5] = HasModRM | Invalid64;
+			oneByte[0xc6] = HasModRM | ImmediateByte;
+			oneByte[0xc7] = HasModRM | ImmediateOperand;
+			oneByte[0xc8] = ImmediateWord | ImmediateByte;
+			oneByte[0xca] = ImmediateWord;
+			oneByte[0xcd] = ImmediateByte;
+			set(oneByte, 0xd0, 0xd3, HasModRM);
+			oneByte[0xd4] = ImmediateByte | Invalid64;
+			oneByte[0xd5] = ImmediateByte | Invalid64;
+			oneByte[0xd6] = Declined;
+			set(oneByte, 0xd8, 0xdf, HasModRM);
+			set(oneByte, 0xe0, 0xe7, ImmediateByte);
+			oneByte[0xe8] = ImmediateOperand;
+			oneByte[0xe9] = ImmediateOperand;
+			oneByte[0xea] = Declined;
+			oneByte[0xeb] = ImmediateByte;
+			oneByte[0xf6] = HasModRM;
+			oneByte[0xf7] = HasModRM;
+			oneByte[0xfe] = HasModRM;
+			oneByte[0xff] = HasModRM;
+
+			set(twoByte, 0x00, 0xff, HasModRM);
+			for (unsigned opcode : {0x05, 0x06, 0x07, 0x08, 0x09, 0x0b, 0x0e, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x37, 0x77, 0xa0, 0xa1, 0xa2, 0xa8, 0xa9, 0xaa})
+			{
+				twoByte[opcode] = 0;
+			}
+			set(twoByte, 0xc8, 0xcf, 0);
+			for (unsigned opcode : {0x04, 0x0a, 0x0c, 0x0f, 0x24, 0x25, 0x26, 0x27, 0x36, 0x39, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x7a, 0x7b, 0xa6, 0xa7, 0xff})
+			{
+				twoByte[opcode] = Declined;
+			}
+			for (unsigned opcode : {0x70, 0x71, 0x72, 0x73, 0xa4, 0xac, 0xba, 0xc2, 0xc4, 0xc5, 0xc6})
+			{
+				twoByte[opcode] = HasModRM | ImmediateByte;
+			}
+			set(twoByte, 0x80, 0x8f, ImmediateOperand);
+		}
+	};
+
+	const OpcodeTables tables;
+
+	// Opcodes of the 0x0f map, with or without VEX/EVEX, that take an imm8 after their ModRM byte.
+	bool twoByteOpcodeHasImmediate(uint8_t opcode)
+	{
+		return (opcode >= 0x70 && opcode <= 0x73) || opcode == 0xc2 || (opcode >= 0xc4 && opcode <= 0xc6);
+	}
+
+	bool isLegacyPrefix(uint8_t byte)
+	{
+		switch (byte)
+		{
+			case 0x26: case 0x2e: case 0x36: case 0x3e: case 0x64: case 0x65:
+			case 0x66: case 0x67: case 0xf0: case 0xf2: case 0xf3:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	int64_t readSigned(const uint8_t* bytes, size_t size)
+	{
+		switch (size)
+		{
+			case 1: return static_cast<int8_t>(bytes[0]);
+			case 2: { int16_t value; memcpy(&value, bytes, sizeof value); return value; }
+			case 4: { int32_t value; memcpy(&value, bytes, sizeof value); return value; }
+			default: { int64_t value; memcpy(&value, bytes, sizeof value); return value; }
+		}
+	}
+}
+
+bool X86LengthDecoder::decode(const uint8_t* begin, const uint8_t* end, uint64_t address, Instruction& into) const
+{
+	if (end <= begin)
+	{
+		return false;
+	}
+
+	size_t available = static_cast<size_t>(end - begin);
+	if (available > maxInstructionSize)
+	{
+		available = maxInstructionSize;
+	}
+
+	const uint8_t* cursor = begin;
+	const uint8_t* limit = begin + available;
+	bool operandSizeOverride = false;
+	bool addressSizeOverride = false;
+	bool repPrefix = false;
+	bool simdPrefix = false;
+	bool lockPrefix = false;
+	uint8_t rex = 0;
+
+	// Legacy prefixes, then REX right before the opcode.
+	for (; cursor != limit; ++cursor)
+	{
+		uint8_t byte = *cursor;
+		if (byte == 0x66)
+		{
+			operandSizeOverride = true;
+		}
+		else if (byte == 0x67)
+		{
+			addressSizeOverride = true;
+		}
+		else if (byte == 0xf2 || byte == 0xf3)
+		{
+			repPrefix |= byte == 0xf3;
+			simdPrefix = true;
+		}
+		else if (byte == 0xf0)
+		{
+			lockPrefix = true;
+		}
+		else if (!isLegacyPrefix(byte))
+		{
+			break;
+		}
+	}
+	if (is64 && cursor != limit && (*cursor & 0xf0) == 0x40)
+	{
+		rex = *cursor;
+		++cursor;
+	}
+	if (cursor == limit)
+	{
+		return false;
+	}
+
+	// 16-bit addressing has a different ModRM layout.
+	if (addressSizeOverride && !is64)
+	{
+		return false;
+	}
+
+	bool rexW = (rex & 0x08) != 0;
+	size_t operandSize = rexW ? 4 : operandSizeOverride ? 2 : 4;
+	into.controlFlow = FallsThrough;
+	into.target = 0;
+	into.displacementOffset = 0;
+	into.displacementSize = 0;
+	into.immediateOffset = 0;
+	into.immediateSize = 0;
+	into.ripRelative = false;
+	into.absoluteAddress = false;
+	into.signExtendedImmediate = false;
+
+	// A prefix after REX cancels it. That is legal but never generated.
+	uint8_t opcode = *cursor++;
+	if (rex != 0 && (isLegacyPrefix(opcode) || (opcode & 0xf0) == 0x40))
+	{
+		return false;
+	}
+
+	bool hasModRM = false;
+	size_t immediateSize = 0;
+	bool relativeBranch = false;
+	// 0 for the one-byte map, 1 for 0x0f, 2 for 0x0f38, 3 for 0x0f3a.
+	unsigned map = 0;
+	bool vex = false;
+
+	bool vexPrefix = opcode == 0xc4 || opcode == 0xc5 || opcode == 0x62;
+	if (vexPrefix && !is64)
+	{
+		// Outside of long mode, these are les, lds and bound unless their next byte looks like a register operand.
+		// EVEX is rare enough there to leave to Capstone.
+		if (cursor == limit)
+		{
+			return false;
+		}
+		vexPrefix = opcode != 0x62 && (*cursor & 0xc0) == 0xc0;
+	}
+
+	if (vexPrefix)
+	{
+		if (operandSizeOverride || simdPrefix || lockPrefix || rex != 0)
+		{
+			return false;
+		}
+
+		size_t payload = opcode == 0xc5 ? 1 : opcode == 0xc4 ? 2 : 3;
+		if (static_cast<size_t>(limit - cursor) <= payload)
+		{
+			return false;
+		}
+		map = opcode == 0xc5 ? 1 : opcode == 0xc4 ? (cursor[0] & 0x1f) : (cursor[0] & 0x07);
+		if (map < 1 || map > 3)
+		{
+			return false;
+		}
+		cursor += payload;
+		opcode = *cursor++;
+		vex = true;
+		hasModRM = !(map == 1 && opcode == 0x77); // vzeroupper, vzeroall
+		immediateSize = map == 3 || (map == 1 && twoByteOpcodeHasImmediate(opcode)) ? 1 : 0;
+	}
+	else if (opcode == 0x0f)
+	{
+		if (cursor == limit)
+		{
+			return false;
+		}
+
+		opcode = *cursor++;
+		if (opcode == 0x38 || opcode == 0x3a)
+		{
+			if (cursor == limit)
+			{
+				return false;
+			}
+			map = opcode == 0x38 ? 2 : 3;
+			opcode = *cursor++;
+			hasModRM = true;
+			immediateSize = map == 3 ? 1 : 0;
+		}
+		else
+		{
+			map = 1;
+			uint8_t flags = tables.twoByte[opcode];
+			if ((flags & Declined) || (opcode == 0xb8 && !repPrefix))
+			{
+				return false;
+			}
+			hasModRM = (flags & HasModRM) != 0;
+			immediateSize = (flags & ImmediateByte) ? 1 : 0;
+			if (opcode >= 0x80 && opcode <= 0x8f)
+			{
+				if (operandSizeOverride && !is64)
+				{
+					return false;
+				}
+				immediateSize = 4;
+				relativeBranch = true;
+				into.controlFlow = ConditionalJump;
+			}
+			else if (opcode == 0x0b)
+			{
+				into.controlFlow = Stop;
+			}
+		}
+	}
+	else
+	{
+		uint8_t flags = tables.oneByte[opcode];
+		if ((flags & Declined) || (is64 && (flags & Invalid64)))
+		{
+			return false;
+		}
+
+		hasModRM = (flags & HasModRM) != 0;
+		immediateSize += (flags & ImmediateByte) ? 1 : 0;
+		immediateSize += (flags & ImmediateWord) ? 2 : 0;
+		immediateSize += (flags & ImmediateOperand) ? operandSize : 0;
+		if (opcode >= 0xb8 && opcode <= 0xbf && rexW)
+		{
+			immediateSize = 8;
+		}
+		else if (opcode >= 0xa0 && opcode <= 0xa3)
+		{
+			// moffs: an address of the address size, where the displacement of other instructions goes.
+			size_t offsetSize = is64 && !addressSizeOverride ? 8 : 4;
+			if (static_cast<size_t>(limit - cursor) < offsetSize)
+			{
+				return false;
+			}
+			into.displacementOffset = static_cast<uint8_t>(cursor - begin);
+			into.displacementSize = static_cast<uint8_t>(offsetSize);
+			into.absoluteAddress = true;
+			cursor += offsetSize;
+		}
+
+		if ((opcode >= 0x70 && opcode <= 0x7f) || (opcode >= 0xe0 && opcode <= 0xe3))
+		{
+			relativeBranch = true;
+			into.controlFlow = ConditionalJump;
+		}
+		else if (opcode == 0xeb || opcode == 0xe9)
+		{
+			relativeBranch = true;
+			into.controlFlow = Jump;
+		}
+		else if (opcode == 0xe8)
+		{
+			relativeBranch = true;
+			into.controlFlow = Call;
+		}
+		else if (opcode == 0xc2 || opcode == 0xc3 || opcode == 0xca || opcode == 0xcb || opcode == 0xcf)
+		{
+			into.controlFlow = Return;
+		}
+		else if (opcode == 0xf4)
+		{
+			into.controlFlow = Stop;
+		}
+
+		// In long mode, relative branches ignore operand size overrides (like in the padding of TLS calls). Elsewhere,
+		// they truncate the instruction pointer.
+		if (relativeBranch && operandSizeOverride)
+		{
+			if (!is64)
+			{
+				return false;
+			}
+			if (opcode == 0xe8 || opcode == 0xe9)
+			{
+				immediateSize = 4;
+			}
+		}
+	}
+
+	if (hasModRM)
+	{
+		if (cursor == limit)
+		{
+			return false;
+		}
+
+		uint8_t modRM = *cursor++;
+		uint8_t mod = modRM >> 6;
+		uint8_t reg = (modRM >> 3) & 7;
+		uint8_t rm = modRM & 7;
+
+		// Groups whose shape or meaning depends on the reg field.
+		if (map == 0 && !vex)
+		{
+			switch (opcode)
+			{
+				case 0x8f:
+				case 0xc6:
+				case 0xc7:
+					if (reg != 0)
+					{
+						return false; // XOP, xabort, xbegin
+					}
+					break;
+
+				case 0xc0:
+				case 0xc1:
+				case 0xd0:
+				case 0xd1:
+				case 0xd2:
+				case 0xd3:
+					if (reg == 6)
+					{
+						return false;
+					}
+					break;
+
+				case 0xf6:
+				case 0xf7:
+					if (reg == 1)
+					{
+						return false;
+					}
+					if (reg == 0)
+					{
+						immediateSize = opcode == 0xf6 ? 1 : operandSize;
+					}
+					break;
+
+				case 0xfe:
+					if (reg > 1)
+					{
+						return false;
+					}
+					break;
+
+				case 0xff:
+					if (reg == 7 || ((reg == 3 || reg == 5) && mod == 3))
+					{
+						return false;
+					}
+					if (reg == 2 || reg == 3)
+					{
+						into.controlFlow = IndirectCall;
+					}
+					else if (reg == 4 || reg == 5)
+					{
+						into.controlFlow = IndirectJump;
+					}
+					break;
+
+				default: break;
+			}
+		}
+		else if (map == 1 && !vex)
+		{
+			if ((opcode == 0xba && reg < 4) || (opcode == 0x00 && reg >= 6))
+			{
+				return false;
+			}
+		}
+
+		if (mod != 3)
+		{
+			size_t displacementSize = mod == 1 ? 1 : mod == 2 ? 4 : 0;
+			if (rm == 4)
+			{
+				if (cursor == limit)
+				{
+					return false;
+				}
+				uint8_t sib = *cursor++;
+				uint8_t index = (sib >> 3) & 7;
+				uint8_t base = sib & 7;
+				if (mod == 0 && base == 5)
+				{
+					displacementSize = 4;
+					into.absoluteAddress = index == 4 && (rex & 0x02) == 0;
+				}
+			}
+			else if (mod == 0 && rm == 5)
+			{
+				displacementSize = 4;
+				into.ripRelative = is64;
+				into.absoluteAddress = !is64;
+			}
+
+			if (displacementSize != 0)
+			{
+				if (static_cast<size_t>(limit - cursor) < displacementSize)
+				{
+					return false;
+				}
+				into.displacementOffset = static_cast<uint8_t>(cursor - begin);
+				into.displacementSize = static_cast<uint8_t>(displacementSize);
+				cursor += displacementSize;
+			}
+		}
+	}
+
+	if (immediateSize != 0)
+	{
+		if (static_cast<size_t>(limit - cursor) < immediateSize)
+		{
+			return false;
+		}
+		into.immediateOffset = static_cast<uint8_t>(cursor - begin);
+		into.immediateSize = static_cast<uint8_t>(immediateSize);
+		into.signExtendedImmediate = relativeBranch || (is64 && rexW && immediateSize == 4);
+		cursor += immediateSize;
+	}
+
+	into.size = static_cast<uint8_t>(cursor - begin);
+	if (relativeBranch)
+	{
+		uint64_t next = address + into.size;
+		into.target = next + static_cast<uint64_t>(readSigned(begin + into.immediateOffset, into.immediateSize));
+		if (!is64)
+		{
+			into.target &= 0xffffffff;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,81 @@
+//
+// x86_length_decoder.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef fcd__codegen_x86_length_decoder_h
+#define fcd__codegen_x86_length_decoder_h
+
+#include <cstddef>
+#include <cstdint>
+
+// Table-driven decoder that only finds the length of x86 instructions, how they affect control flow, and where their
+// displacement and immediate are. That's all that function discovery needs to follow code and to mask out what
+// depends on addresses, and it costs a fraction of a Capstone decode with details. Encodings that the tables don't
+// describe with certainty (3DNow!, XOP, 16-bit addressing, reserved group members, operand size overrides on relative
+// branches, ...) are declined instead of guessed, and callers fall back to Capstone for them.
+class X86LengthDecoder
+{
+public:
+	enum ControlFlow
+	{
+		FallsThrough,
+		Jump,
+		ConditionalJump,
+		Call,
+		IndirectJump,
+		IndirectCall,
+		Return,
+		Stop, // hlt, ud2
+	};
+
+	struct Instruction
+	{
+		uint8_t size;
+		ControlFlow controlFlow;
+		// Destination of relative jumps and calls.
+		uint64_t target;
+
+		// Offsets from the beginning of the instruction, and sizes in bytes. Sizes are 0 when there is none.
+		uint8_t displacementOffset;
+		uint8_t displacementSize;
+		uint8_t immediateOffset;
+		uint8_t immediateSize;
+		// The displacement is relative to the next instruction.
+		bool ripRelative;
+		// The memory operand has no base or index register, so the displacement is an address.
+		bool absoluteAddress;
+		// The immediate is sign-extended to 64 bits.
+		bool signExtendedImmediate;
+	};
+
+private:
+	bool is64;
+
+public:
+	explicit X86LengthDecoder(size_t addressSize)
+	: is64(addressSize == 8)
+	{
+	}
+
+	// Returns false for invalid or declined encodings, and when the instruction doesn't fit before end.
+	bool decode(const uint8_t* begin, const uint8_t* end, uint64_t address, Instruction& into) const;
+};
+
+#endif /* fcd__codegen_x86_length_decoder_h */
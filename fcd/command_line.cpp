@@ -35,7 +35,7 @@ namespace
 
 bool whitelist::isWhitelisted(const llvm::cl::Option &o)
 {
-	return o.ArgStr == "help" || o.ArgStr == "version" || optWhitelist->count(&o) != 0;
+	return o.ArgStr == "help" || o.ArgStr == "version" || o.ArgStr == "stats" || optWhitelist->count(&o) != 0;
 }
 
 void whitelist::apply(llvm::cl::Option &o) const
@@ -23,6 +23,16 @@
 #include <limits.h>
 #include <type_traits>
 
+// fcd only lifts x86_64 code (see config64 in main.cpp). Emulators built with FCD_X86_64_ONLY read the configuration
+// from this constant instead of their config parameter, so that inlined instructions don't load from it and don't
+// need to be folded after inlining.
+#ifdef FCD_X86_64_ONLY
+static constexpr x86_config x86_64_config = { x86_isa64, 8, X86_REG_RIP, X86_REG_RSP, X86_REG_RBP };
+#define X86_CONFIG(config) (&x86_64_config)
+#else
+#define X86_CONFIG(config) (config)
+#endif
+
 struct x86_effective_address
 {
 	x86_reg segment;
@@ -61,28 +71,15 @@ static uint64_t x86_read_reg(CPTR(x86_regs) regs, x86_reg reg)
 {
 	const x86_reg_info* reg_info = &x86_register_table[reg];
 	const x86_reg_selector* selector = &reg_info->reg;
-	const x86_qword_reg* r64 = &(regs->*selector->qword);
+	uint64_t r64 = regs->*selector->qword;
 	if (reg_info->size == 8)
 	{
-		return r64->qword;
-	}
-	
-	const x86_dword_reg* r32 = &(r64->*selector->dword);
-	if (reg_info->size == 4)
-	{
-		return r32->dword;
-	}
-	
-	const x86_word_reg* r16 = &(r32->*selector->word);
-	if (reg_info->size == 2)
-	{
-		return r16->word;
+		return r64;
 	}
 	
-	if (reg_info->size == 1)
+	if (reg_info->size == 4 || reg_info->size == 2 || reg_info->size == 1)
 	{
-		uint8_t byte = r16->*selector->byte;
-		return byte;
+		return (r64 >> selector->shift) & make_mask(reg_info->size * CHAR_BIT);
 	}
 	
 	x86_assertion_failure("reading from register with non-standard size");
@@ -121,31 +118,23 @@ static void x86_write_reg(PTR(x86_regs) regs, x86_reg reg, uint64_t value64)
 	const x86_reg_info* reg_info = &x86_register_table[reg];
 	const x86_reg_selector* selector = &reg_info->reg;
 	
-	x86_qword_reg* r64 = &(regs->*selector->qword);
+	uint64_t* r64 = &(regs->*selector->qword);
 	if (reg_info->size == 8)
 	{
-		r64->qword = value64;
+		*r64 = value64;
 		return;
 	}
 	
 	if (reg_info->size == 4)
 	{
-		// Clear whole register. Intentionally using r64 instead of r32.
-		r64->qword = static_cast<uint32_t>(value64);
+		*r64 = static_cast<uint32_t>(value64);
 		return;
 	}
 	
-	x86_dword_reg* r32 = &(r64->*selector->dword);
-	x86_word_reg* r16 = &(r32->*selector->word);
-	if (reg_info->size == 2)
+	if (reg_info->size == 2 || reg_info->size == 1)
 	{
-		r16->word = static_cast<uint16_t>(value64);
-		return;
-	}
-	
-	if (reg_info->size == 1)
-	{
-		r16->*selector->byte = static_cast<uint8_t>(value64);
+		uint64_t mask = make_mask(reg_info->size * CHAR_BIT) << selector->shift;
+		*r64 = (*r64 & ~mask) | ((value64 << selector->shift) & mask);
 		return;
 	}
 	
@@ -342,6 +331,171 @@ static uint64_t x86_subtract(PTR(x86_flags_reg) flags, size_t size, uint64_t lef
 	return result;
 }
 
+#pragma mark - Status flags
+
+// When FCD_LAZY_FLAGS is defined, add, sub, cmp and the logical operators don't compute status flags. They record
+// their operands and result instead, and flags are computed from these values only where they are read. Instructions
+// that read or partially update flags materialize them first. This keeps most flag computations out of lifted code
+// before it is even optimized.
+#ifdef FCD_LAZY_FLAGS
+enum x86_lazy_flags_op : uint8_t
+{
+	x86_lazy_none,
+	x86_lazy_add,
+	x86_lazy_sub,
+	x86_lazy_logic,
+};
+
+[[gnu::always_inline]]
+static void x86_flags_record(PTR(x86_flags_reg) flags, x86_lazy_flags_op op, size_t size, uint64_t left, uint64_t right, uint64_t result)
+{
+	uint64_t mask = make_mask(size * CHAR_BIT);
+	flags->lazy_op = op;
+	flags->lazy_size = size;
+	flags->lazy_left = left & mask;
+	flags->lazy_right = right & mask;
+	flags->lazy_result = result & mask;
+}
+
+[[gnu::always_inline]]
+static bool x86_lazy_sign_bit(CPTR(x86_flags_reg) flags, uint64_t value)
+{
+	return (value >> (flags->lazy_size * CHAR_BIT - 1)) & 1;
+}
+#endif
+
+[[gnu::always_inline]]
+static bool x86_flag_cf(CPTR(x86_flags_reg) flags)
+{
+#ifdef FCD_LAZY_FLAGS
+	switch (flags->lazy_op)
+	{
+		case x86_lazy_add: return flags->lazy_result < flags->lazy_left;
+		case x86_lazy_sub: return flags->lazy_left < flags->lazy_right;
+		case x86_lazy_logic: return false;
+		default: break;
+	}
+#endif
+	return flags->cf;
+}
+
+[[gnu::always_inline]]
+static bool x86_flag_pf(CPTR(x86_flags_reg) flags)
+{
+#ifdef FCD_LAZY_FLAGS
+	if (flags->lazy_op != x86_lazy_none)
+	{
+		return x86_parity(flags->lazy_result);
+	}
+#endif
+	return flags->pf;
+}
+
+[[gnu::always_inline]]
+static bool x86_flag_af(CPTR(x86_flags_reg) flags)
+{
+#ifdef FCD_LAZY_FLAGS
+	switch (flags->lazy_op)
+	{
+		case x86_lazy_add: return (flags->lazy_left & 0xf) + (flags->lazy_right & 0xf) > 0xf;
+		case x86_lazy_sub: return (flags->lazy_left & 0xf) < (flags->lazy_right & 0xf);
+		case x86_lazy_logic: return x86_clobber_bit();
+		default: break;
+	}
+#endif
+	return flags->af;
+}
+
+[[gnu::always_inline]]
+static bool x86_flag_zf(CPTR(x86_flags_reg) flags)
+{
+#ifdef FCD_LAZY_FLAGS
+	if (flags->lazy_op != x86_lazy_none)
+	{
+		return flags->lazy_result == 0;
+	}
+#endif
+	return flags->zf;
+}
+
+[[gnu::always_inline]]
+static bool x86_flag_sf(CPTR(x86_flags_reg) flags)
+{
+#ifdef FCD_LAZY_FLAGS
+	if (flags->lazy_op != x86_lazy_none)
+	{
+		return x86_lazy_sign_bit(flags, flags->lazy_result);
+	}
+#endif
+	return flags->sf;
+}
+
+[[gnu::always_inline]]
+static bool x86_flag_of(CPTR(x86_flags_reg) flags)
+{
+#ifdef FCD_LAZY_FLAGS
+	uint64_t left = flags->lazy_left;
+	uint64_t right = flags->lazy_right;
+	uint64_t result = flags->lazy_result;
+	switch (flags->lazy_op)
+	{
+		case x86_lazy_add: return x86_lazy_sign_bit(flags, (left ^ result) & (right ^ result));
+		case x86_lazy_sub: return x86_lazy_sign_bit(flags, (left ^ right) & (left ^ result));
+		case x86_lazy_logic: return false;
+		default: break;
+	}
+#endif
+	return flags->of;
+}
+
+// Writes back pending flags to the flags structure. Instructions that read flags directly, or that only update some of
+// them, must call this first.
+[[gnu::always_inline]]
+static void x86_flags_materialize(PTR(x86_flags_reg) flags)
+{
+#ifdef FCD_LAZY_FLAGS
+	bool cf = x86_flag_cf(flags);
+	bool pf = x86_flag_pf(flags);
+	bool af = x86_flag_af(flags);
+	bool zf = x86_flag_zf(flags);
+	bool sf = x86_flag_sf(flags);
+	bool of = x86_flag_of(flags);
+	flags->cf = cf;
+	flags->pf = pf;
+	flags->af = af;
+	flags->zf = zf;
+	flags->sf = sf;
+	flags->of = of;
+	flags->lazy_op = x86_lazy_none;
+#endif
+}
+
+[[gnu::always_inline]]
+static uint64_t x86_add_setting_flags(PTR(x86_flags_reg) flags, size_t size, uint64_t left, uint64_t right)
+{
+#ifdef FCD_LAZY_FLAGS
+	uint64_t result = (left + right) & make_mask(size * CHAR_BIT);
+	x86_flags_record(flags, x86_lazy_add, size, left, right, result);
+	return result;
+#else
+	memset(flags, 0, sizeof *flags);
+	return x86_add(flags, size, left, right);
+#endif
+}
+
+[[gnu::always_inline]]
+static uint64_t x86_subtract_setting_flags(PTR(x86_flags_reg) flags, size_t size, uint64_t left, uint64_t right)
+{
+#ifdef FCD_LAZY_FLAGS
+	uint64_t result = (left - right) & make_mask(size * CHAR_BIT);
+	x86_flags_record(flags, x86_lazy_sub, size, left, right, result);
+	return result;
+#else
+	memset(flags, 0, sizeof *flags);
+	return x86_subtract(flags, size, left, right);
+#endif
+}
+
 template<typename TOperator>
 [[gnu::always_inline]]
 static uint64_t x86_logical_operator(PTR(x86_regs) regs, PTR(x86_flags_reg) flags, CPTR(cs_x86) inst, TOperator&& func)
@@ -352,12 +506,16 @@ static uint64_t x86_logical_operator(PTR(x86_regs) regs, PTR(x86_flags_reg) flag
 	uint64_t right = x86_read_source_operand(source, regs);
 	
 	uint64_t result = func(left, right);
+#ifdef FCD_LAZY_FLAGS
+	x86_flags_record(flags, x86_lazy_logic, destination->size, left, right, result);
+#else
 	flags->of = false;
 	flags->cf = false;
 	flags->sf = result > make_mask(destination->size * CHAR_BIT - 1);
 	flags->pf = x86_parity(result);
 	flags->zf = result == 0;
 	flags->af = x86_clobber_bit();
+#endif
 	
 	return result;
 }
@@ -365,17 +523,17 @@ static uint64_t x86_logical_operator(PTR(x86_regs) regs, PTR(x86_flags_reg) flag
 [[gnu::always_inline]]
 static void x86_push_value(CPTR(x86_config) config, PTR(x86_regs) regs, size_t size, uint64_t value)
 {
-	uint64_t push_address = x86_read_reg(regs, config->sp) - size;
+	uint64_t push_address = x86_read_reg(regs, X86_CONFIG(config)->sp) - size;
 	x86_write_mem(X86_REG_SS, push_address, size, value);
-	x86_write_reg(regs, config->sp, push_address);
+	x86_write_reg(regs, X86_CONFIG(config)->sp, push_address);
 }
 
 [[gnu::always_inline]]
 static uint64_t x86_pop_value(CPTR(x86_config) config, PTR(x86_regs) regs, size_t size)
 {
-	uint64_t pop_address = x86_read_reg(regs, config->sp);
+	uint64_t pop_address = x86_read_reg(regs, X86_CONFIG(config)->sp);
 	uint64_t popped = x86_read_mem(X86_REG_SS, pop_address, size);
-	x86_write_reg(regs, config->sp, pop_address + size);
+	x86_write_reg(regs, X86_CONFIG(config)->sp, pop_address + size);
 	return popped;
 }
 
@@ -410,97 +568,97 @@ static void x86_move_sign_extend(PTR(x86_regs) regs, CPTR(cs_x86) inst)
 [[gnu::always_inline]]
 static bool x86_cond_above(CPTR(x86_flags_reg) flags)
 {
-	return !flags->cf & !flags->zf;
+	return !x86_flag_cf(flags) & !x86_flag_zf(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_above_or_equal(CPTR(x86_flags_reg) flags)
 {
-	return !flags->cf;
+	return !x86_flag_cf(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_below(CPTR(x86_flags_reg) flags)
 {
-	return flags->cf;
+	return x86_flag_cf(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_below_or_equal(CPTR(x86_flags_reg) flags)
 {
-	return flags->cf | flags->zf;
+	return x86_flag_cf(flags) | x86_flag_zf(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_equal(CPTR(x86_flags_reg) flags)
 {
-	return flags->zf;
+	return x86_flag_zf(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_greater(CPTR(x86_flags_reg) flags)
 {
-	return !flags->zf & (flags->sf == flags->of);
+	return !x86_flag_zf(flags) & (x86_flag_sf(flags) == x86_flag_of(flags));
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_greater_or_equal(CPTR(x86_flags_reg) flags)
 {
-	return flags->sf == flags->of;
+	return x86_flag_sf(flags) == x86_flag_of(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_less(CPTR(x86_flags_reg) flags)
 {
-	return flags->sf != flags->of;
+	return x86_flag_sf(flags) != x86_flag_of(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_less_or_equal(CPTR(x86_flags_reg) flags)
 {
-	return flags->zf | (flags->sf != flags->of);
+	return x86_flag_zf(flags) | (x86_flag_sf(flags) != x86_flag_of(flags));
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_not_equal(CPTR(x86_flags_reg) flags)
 {
-	return !flags->zf;
+	return !x86_flag_zf(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_no_overflow(CPTR(x86_flags_reg) flags)
 {
-	return !flags->of;
+	return !x86_flag_of(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_no_parity(CPTR(x86_flags_reg) flags)
 {
-	return !flags->pf;
+	return !x86_flag_pf(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_no_sign(CPTR(x86_flags_reg) flags)
 {
-	return !flags->sf;
+	return !x86_flag_sf(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_overflow(CPTR(x86_flags_reg) flags)
 {
-	return flags->of;
+	return x86_flag_of(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_parity(CPTR(x86_flags_reg) flags)
 {
-	return flags->pf;
+	return x86_flag_pf(flags);
 }
 
 [[gnu::always_inline]]
 static bool x86_cond_signed(CPTR(x86_flags_reg) flags)
 {
-	return flags->sf;
+	return x86_flag_sf(flags);
 }
 
 [[gnu::always_inline]]
@@ -513,194 +671,594 @@ static void x86_conditional_jump(CPTR(x86_config) config, PTR(x86_regs) regs, CP
 	}
 }
 
-#pragma mark - Helpers
-extern "C" void x86_function_prologue(CPTR(x86_config) config, PTR(x86_regs) regs)
-{
-	uint64_t ip = x86_read_reg(regs, config->ip);
-	x86_push_value(config, regs, config->address_size, ip);
-}
+#pragma mark - Vectors
 
-#pragma mark - Instruction Implementation
-X86_INSTRUCTION_DEF(adc)
-{
-	const cs_x86_op* source = &inst->operands[1];
-	const cs_x86_op* destination = &inst->operands[0];
-	uint64_t left = x86_read_destination_operand(destination, regs);
-	uint64_t right = x86_read_source_operand(source, regs);
-	uint64_t result = flags->cf;
-	
-	memset(flags, 0, sizeof *flags);
-	result = x86_add(flags, source->size, result, left);
-	result = x86_add(flags, source->size, result, right);
-	x86_write_destination_operand(destination, regs, result);
-}
+// Vector registers are x86_mm_reg structures. Instructions operate on them through Clang vector types, so that lifted
+// SIMD code uses LLVM vector types too. Memory operands are accessed 8 bytes at a time.
+template<typename TElement>
+struct x86_vector_types;
 
-X86_INSTRUCTION_DEF(add)
-{
-	const cs_x86_op* source = &inst->operands[1];
-	const cs_x86_op* destination = &inst->operands[0];
-	uint64_t left = x86_read_destination_operand(destination, regs);
-	uint64_t right = x86_read_source_operand(source, regs);
-	
-	memset(flags, 0, sizeof *flags);
-	uint64_t result = x86_add(flags, source->size, left, right);
-	x86_write_destination_operand(destination, regs, result);
-}
+#define X86_VECTOR_TYPES(element, name) \
+	typedef element x86_xmm_##name __attribute__((vector_size(16))); \
+	typedef element x86_ymm_##name __attribute__((vector_size(32))); \
+	template<> struct x86_vector_types<element> { typedef x86_xmm_##name xmm; typedef x86_ymm_##name ymm; }
 
-X86_INSTRUCTION_DEF(and)
-{
-	const cs_x86_op* destination = &inst->operands[0];
-	uint64_t result = x86_logical_operator(regs, flags, inst, [](uint64_t left, uint64_t right) { return left & right; });
-	x86_write_destination_operand(destination, regs, result);
-}
+X86_VECTOR_TYPES(int8_t, i8);
+X86_VECTOR_TYPES(uint8_t, u8);
+X86_VECTOR_TYPES(int16_t, i16);
+X86_VECTOR_TYPES(uint16_t, u16);
+X86_VECTOR_TYPES(int32_t, i32);
+X86_VECTOR_TYPES(uint32_t, u32);
+X86_VECTOR_TYPES(int64_t, i64);
+X86_VECTOR_TYPES(uint64_t, u64);
+X86_VECTOR_TYPES(float, f32);
+X86_VECTOR_TYPES(double, f64);
 
-X86_INSTRUCTION_DEF(bt)
+[[gnu::always_inline]]
+static bool x86_is_vector_register(CPTR(cs_x86_op) op)
 {
-	uint64_t bitBase = x86_read_source_operand(&inst->operands[0], regs);
-	uint64_t bitOffset = x86_read_source_operand(&inst->operands[1], regs);
-	flags->cf = (bitBase >> bitOffset) & 1;
-	flags->af = x86_clobber_bit();
-	flags->of = x86_clobber_bit();
-	flags->pf = x86_clobber_bit();
-	flags->zf = x86_clobber_bit();
+	return op->type == X86_OP_REG && x86_register_table[op->reg].type == x86_reg_type::mm_reg;
 }
 
-X86_INSTRUCTION_DEF(call)
+template<typename TVector>
+[[gnu::always_inline]]
+static TVector x86_read_vector_operand(CPTR(x86_regs) regs, CPTR(cs_x86_op) source)
 {
-	uint64_t target = x86_read_source_operand(&inst->operands[0], regs);
-	x86_call_intrin(config, regs, target);
+	TVector result;
+	if (source->type == X86_OP_REG)
+	{
+		const x86_mm_reg* reg = &(regs->*x86_register_table[source->reg].mm);
+		__builtin_memcpy(&result, reg, sizeof result);
+	}
+	else if (source->type == X86_OP_MEM)
+	{
+		auto address = x86_get_effective_address(regs, source);
+		uint64_t quads[sizeof result / 8];
+		for (size_t i = 0; i < sizeof result / 8; ++i)
+		{
+			quads[i] = x86_read_mem(address.segment, address.pointer + i * 8, 8);
+		}
+		__builtin_memcpy(&result, quads, sizeof result);
+	}
+	else
+	{
+		x86_assertion_failure("trying to read vector from immediate, FP or invalid operand");
+	}
+	return result;
 }
 
-X86_INSTRUCTION_DEF(cdq)
+// VEX-encoded instructions clear the destination register above the bits that they write. Legacy SSE encodings leave
+// these bits alone.
+template<typename TVector>
+[[gnu::always_inline]]
+static void x86_write_vector_operand(PTR(x86_regs) regs, CPTR(cs_x86_op) destination, TVector value, bool clearUpper)
 {
-	int32_t signedAx = static_cast<int32_t>(x86_read_reg(regs, X86_REG_EAX));
-	x86_write_reg(regs, X86_REG_EDX, signedAx < 0 ? 0xffffffff : 0);
+	if (destination->type == X86_OP_REG)
+	{
+		x86_mm_reg* reg = &(regs->*x86_register_table[destination->reg].mm);
+		__builtin_memcpy(reg, &value, sizeof value);
+		if (clearUpper)
+		{
+			memset(&reg->b[sizeof value], 0, sizeof *reg - sizeof value);
+		}
+	}
+	else if (destination->type == X86_OP_MEM)
+	{
+		auto address = x86_get_effective_address(regs, destination);
+		uint64_t quads[sizeof value / 8];
+		__builtin_memcpy(quads, &value, sizeof value);
+		for (size_t i = 0; i < sizeof value / 8; ++i)
+		{
+			x86_write_mem(address.segment, address.pointer + i * 8, 8, quads[i]);
+		}
+	}
+	else
+	{
+		x86_assertion_failure("trying to write vector to immediate, FP or invalid operand");
+	}
 }
 
-X86_INSTRUCTION_DEF(cdqe)
+// Reads the low element of a vector register, or a scalar memory operand.
+template<typename T>
+[[gnu::always_inline]]
+static T x86_read_scalar_operand(CPTR(x86_regs) regs, CPTR(cs_x86_op) source)
 {
-	int32_t signedAx = static_cast<int32_t>(x86_read_reg(regs, X86_REG_EAX));
-	int64_t signExtendedAx = static_cast<int64_t>(signedAx);
-	x86_write_reg(regs, X86_REG_RAX, signExtendedAx);
+	uint64_t bits = x86_is_vector_register(source)
+		? (regs->*x86_register_table[source->reg].mm).l[0]
+		: x86_read_source_operand(source, regs);
+	
+	T result;
+	memcpy(&result, &bits, sizeof result);
+	return result;
 }
 
-X86_INSTRUCTION_DEF(cmova)
+[[gnu::always_inline]]
+static void x86_move_vector(PTR(x86_regs) regs, CPTR(cs_x86) inst, bool vex)
 {
-	if (x86_cond_above(flags))
+	const cs_x86_op* destination = &inst->operands[0];
+	const cs_x86_op* source = &inst->operands[1];
+	if (destination->size == 32)
 	{
-		x86_move_zero_extend(regs, inst);
+		x86_write_vector_operand(regs, destination, x86_read_vector_operand<x86_ymm_u64>(regs, source), vex);
 	}
-}
-
-X86_INSTRUCTION_DEF(cmovae)
-{
-	if (x86_cond_above_or_equal(flags))
+	else
 	{
-		x86_move_zero_extend(regs, inst);
+		x86_write_vector_operand(regs, destination, x86_read_vector_operand<x86_xmm_u64>(regs, source), vex);
 	}
 }
 
-X86_INSTRUCTION_DEF(cmovb)
+// Element-wise operations. Legacy encodings are "destination op= source"; VEX encodings are
+// "destination = left op right" and can be 256 bits wide.
+template<typename TElement, typename TOperator>
+[[gnu::always_inline]]
+static void x86_vector_operator(PTR(x86_regs) regs, CPTR(cs_x86) inst, bool vex, TOperator&& func)
 {
-	if (x86_cond_below(flags))
+	const cs_x86_op* destination = &inst->operands[0];
+	const cs_x86_op* left = &inst->operands[vex ? 1 : 0];
+	const cs_x86_op* right = &inst->operands[vex ? 2 : 1];
+	if (destination->size == 32)
 	{
-		x86_move_zero_extend(regs, inst);
+		typedef typename x86_vector_types<TElement>::ymm TVector;
+		auto result = func(x86_read_vector_operand<TVector>(regs, left), x86_read_vector_operand<TVector>(regs, right));
+		x86_write_vector_operand(regs, destination, result, vex);
 	}
-}
-
-X86_INSTRUCTION_DEF(cmovbe)
-{
-	if (x86_cond_below_or_equal(flags))
+	else
 	{
-		x86_move_zero_extend(regs, inst);
+		typedef typename x86_vector_types<TElement>::xmm TVector;
+		auto result = func(x86_read_vector_operand<TVector>(regs, left), x86_read_vector_operand<TVector>(regs, right));
+		x86_write_vector_operand(regs, destination, result, vex);
 	}
 }
 
-X86_INSTRUCTION_DEF(cmove)
+// Operations on the low element only; the other elements of the destination are preserved.
+template<typename T, typename TOperator>
+[[gnu::always_inline]]
+static void x86_scalar_operator(PTR(x86_regs) regs, CPTR(cs_x86) inst, TOperator&& func)
 {
-	if (x86_cond_equal(flags))
-	{
-		x86_move_zero_extend(regs, inst);
-	}
+	typedef typename x86_vector_types<T>::xmm TVector;
+	const cs_x86_op* destination = &inst->operands[0];
+	TVector result = x86_read_vector_operand<TVector>(regs, destination);
+	result[0] = func(result[0], x86_read_scalar_operand<T>(regs, &inst->operands[1]));
+	x86_write_vector_operand(regs, destination, result, false);
 }
 
-X86_INSTRUCTION_DEF(cmovg)
+template<typename TVector>
+[[gnu::always_inline]]
+static TVector x86_vector_min(TVector left, TVector right)
 {
-	if (x86_cond_greater(flags))
-	{
-		x86_move_zero_extend(regs, inst);
-	}
+	TVector mask = (TVector)(left < right);
+	return (left & mask) | (right & ~mask);
 }
 
-X86_INSTRUCTION_DEF(cmovge)
+template<typename TVector>
+[[gnu::always_inline]]
+static TVector x86_vector_max(TVector left, TVector right)
 {
-	if (x86_cond_greater_or_equal(flags))
-	{
-		x86_move_zero_extend(regs, inst);
-	}
+	TVector mask = (TVector)(left > right);
+	return (left & mask) | (right & ~mask);
 }
 
-X86_INSTRUCTION_DEF(cmovl)
+// pshufb: zero if the top bit of the index is set, otherwise select from the same 128-bit lane.
+template<typename TVector>
+[[gnu::always_inline]]
+static TVector x86_shuffle_bytes(TVector value, TVector indices)
 {
-	if (x86_cond_less(flags))
+	TVector result;
+	for (size_t i = 0; i < sizeof value; ++i)
 	{
-		x86_move_zero_extend(regs, inst);
+		uint8_t index = indices[i];
+		result[i] = (index & 0x80) ? 0 : value[(i & ~15) + (index & 15)];
 	}
+	return result;
 }
 
-X86_INSTRUCTION_DEF(cmovle)
+template<typename TVector>
+[[gnu::always_inline]]
+static TVector x86_shuffle_dwords(TVector value, uint8_t order)
 {
-	if (x86_cond_less_or_equal(flags))
+	TVector result;
+	for (size_t i = 0; i < sizeof value / 4; ++i)
 	{
-		x86_move_zero_extend(regs, inst);
+		result[i] = value[(i & ~3) + ((order >> ((i & 3) * 2)) & 3)];
 	}
+	return result;
 }
 
-X86_INSTRUCTION_DEF(cmovne)
+[[gnu::always_inline]]
+static void x86_shuffle_dwords(PTR(x86_regs) regs, CPTR(cs_x86) inst, bool vex)
 {
-	if (x86_cond_not_equal(flags))
+	const cs_x86_op* destination = &inst->operands[0];
+	uint8_t order = static_cast<uint8_t>(x86_read_source_operand(&inst->operands[2], regs));
+	if (destination->size == 32)
 	{
-		x86_move_zero_extend(regs, inst);
+		auto value = x86_read_vector_operand<x86_ymm_u32>(regs, &inst->operands[1]);
+		x86_write_vector_operand(regs, destination, x86_shuffle_dwords(value, order), vex);
 	}
-}
-
-X86_INSTRUCTION_DEF(cmovno)
-{
-	if (x86_cond_no_overflow(flags))
+	else
 	{
-		x86_move_zero_extend(regs, inst);
+		auto value = x86_read_vector_operand<x86_xmm_u32>(regs, &inst->operands[1]);
+		x86_write_vector_operand(regs, destination, x86_shuffle_dwords(value, order), vex);
 	}
 }
 
-X86_INSTRUCTION_DEF(cmovnp)
+template<typename TVector>
+[[gnu::always_inline]]
+static uint64_t x86_byte_sign_mask(TVector value)
 {
-	if (x86_cond_no_parity(flags))
+	uint64_t mask = 0;
+	for (size_t i = 0; i < sizeof value; ++i)
 	{
-		x86_move_zero_extend(regs, inst);
+		mask |= static_cast<uint64_t>(static_cast<uint8_t>(value[i]) >> 7) << i;
 	}
+	return mask;
 }
 
-X86_INSTRUCTION_DEF(cmovns)
+[[gnu::always_inline]]
+static void x86_move_byte_mask(PTR(x86_regs) regs, CPTR(cs_x86) inst)
 {
-	if (x86_cond_no_sign(flags))
-	{
-		x86_move_zero_extend(regs, inst);
-	}
+	const cs_x86_op* source = &inst->operands[1];
+	uint64_t mask = source->size == 32
+		? x86_byte_sign_mask(x86_read_vector_operand<x86_ymm_u8>(regs, source))
+		: x86_byte_sign_mask(x86_read_vector_operand<x86_xmm_u8>(regs, source));
+	x86_write_reg(regs, &inst->operands[0], mask);
 }
 
-X86_INSTRUCTION_DEF(cmovo)
+// movd/movq: moves between the low element of a vector register and a general-purpose register or memory. Vector
+// destinations are zero-extended to 128 bits.
+template<typename T>
+[[gnu::always_inline]]
+static void x86_move_low_element(PTR(x86_regs) regs, CPTR(cs_x86) inst, bool vex)
 {
-	if (x86_cond_overflow(flags))
+	const cs_x86_op* destination = &inst->operands[0];
+	const cs_x86_op* source = &inst->operands[1];
+	uint64_t value = static_cast<T>(x86_read_scalar_operand<uint64_t>(regs, source));
+	if (x86_is_vector_register(destination))
 	{
-		x86_move_zero_extend(regs, inst);
+		x86_xmm_u64 result = { value, 0 };
+		x86_write_vector_operand(regs, destination, result, vex);
 	}
-}
-
-X86_INSTRUCTION_DEF(cmovp)
-{
-	if (x86_cond_parity(flags))
+	else
 	{
-		x86_move_zero_extend(regs, inst);
+		x86_write_destination_operand(destination, regs, value);
+	}
+}
+
+// movss: register-to-register moves merge the low element, loads zero-extend it, and stores only write it.
+template<typename T>
+[[gnu::always_inline]]
+static void x86_move_scalar(PTR(x86_regs) regs, CPTR(cs_x86) inst)
+{
+	typedef typename x86_vector_types<T>::xmm TVector;
+	const cs_x86_op* destination = &inst->operands[0];
+	const cs_x86_op* source = &inst->operands[1];
+	T value = x86_read_scalar_operand<T>(regs, source);
+	if (destination->type == X86_OP_MEM)
+	{
+		uint64_t bits = 0;
+		memcpy(&bits, &value, sizeof value);
+		x86_write_mem(regs, destination, bits);
+	}
+	else
+	{
+		TVector result = {};
+		if (source->type == X86_OP_REG)
+		{
+			result = x86_read_vector_operand<TVector>(regs, destination);
+		}
+		result[0] = value;
+		x86_write_vector_operand(regs, destination, result, false);
+	}
+}
+
+template<typename TFrom, typename TTo>
+[[gnu::always_inline]]
+static void x86_convert_scalar(PTR(x86_regs) regs, CPTR(cs_x86) inst)
+{
+	typedef typename x86_vector_types<TTo>::xmm TVector;
+	const cs_x86_op* destination = &inst->operands[0];
+	TVector result = x86_read_vector_operand<TVector>(regs, destination);
+	result[0] = static_cast<TTo>(x86_read_scalar_operand<TFrom>(regs, &inst->operands[1]));
+	x86_write_vector_operand(regs, destination, result, false);
+}
+
+template<typename T>
+[[gnu::always_inline]]
+static void x86_convert_integer_to_scalar(PTR(x86_regs) regs, CPTR(cs_x86) inst)
+{
+	typedef typename x86_vector_types<T>::xmm TVector;
+	const cs_x86_op* destination = &inst->operands[0];
+	const cs_x86_op* source = &inst->operands[1];
+	uint64_t value = x86_read_source_operand(source, regs);
+	int64_t integer = source->size == 8 ? make_signed<int64_t>(value) : make_signed<int32_t>(value);
+	
+	TVector result = x86_read_vector_operand<TVector>(regs, destination);
+	result[0] = static_cast<T>(integer);
+	x86_write_vector_operand(regs, destination, result, false);
+}
+
+// Out-of-range and NaN values convert to the "integer indefinite" value, which is the smallest signed integer.
+template<typename T>
+[[gnu::always_inline]]
+static void x86_truncate_scalar_to_integer(PTR(x86_regs) regs, CPTR(cs_x86) inst)
+{
+	const cs_x86_op* destination = &inst->operands[0];
+	T value = x86_read_scalar_operand<T>(regs, &inst->operands[1]);
+	uint64_t indefinite = 1ull << (destination->size * CHAR_BIT - 1);
+	T limit = static_cast<T>(indefinite);
+	
+	uint64_t result = indefinite;
+	if (value >= -limit && value < limit)
+	{
+		result = destination->size == 8
+			? static_cast<uint64_t>(static_cast<int64_t>(value))
+			: static_cast<uint32_t>(static_cast<int32_t>(value));
+	}
+	x86_write_destination_operand(destination, regs, result);
+}
+
+// comis/ucomis: unordered sets zf, pf and cf; otherwise zf and cf work like an unsigned integer comparison.
+template<typename T>
+[[gnu::always_inline]]
+static void x86_compare_scalar(PTR(x86_regs) regs, PTR(x86_flags_reg) flags, CPTR(cs_x86) inst)
+{
+	T left = x86_read_scalar_operand<T>(regs, &inst->operands[0]);
+	T right = x86_read_scalar_operand<T>(regs, &inst->operands[1]);
+	flags->zf = !(left < right) && !(left > right);
+	flags->pf = left != left || right != right;
+	flags->cf = !(left >= right);
+	flags->of = false;
+	flags->sf = false;
+	flags->af = false;
+}
+
+template<typename TVector>
+[[gnu::always_inline]]
+static void x86_test_vector(PTR(x86_flags_reg) flags, TVector left, TVector right)
+{
+	bool andIsZero = true;
+	bool andNotIsZero = true;
+	for (size_t i = 0; i < sizeof left / sizeof left[0]; ++i)
+	{
+		andIsZero &= (left[i] & right[i]) == 0;
+		andNotIsZero &= (~left[i] & right[i]) == 0;
+	}
+	flags->zf = andIsZero;
+	flags->cf = andNotIsZero;
+	flags->of = false;
+	flags->sf = false;
+	flags->af = false;
+	flags->pf = false;
+}
+
+#pragma mark - Helpers
+extern "C" void x86_function_prologue(CPTR(x86_config) config, PTR(x86_regs) regs)
+{
+	uint64_t ip = x86_read_reg(regs, X86_CONFIG(config)->ip);
+	x86_push_value(config, regs, X86_CONFIG(config)->address_size, ip);
+}
+
+#pragma mark - Instruction Implementation
+X86_INSTRUCTION_DEF(adc)
+{
+	x86_flags_materialize(flags);
+	const cs_x86_op* source = &inst->operands[1];
+	const cs_x86_op* destination = &inst->operands[0];
+	uint64_t left = x86_read_destination_operand(destination, regs);
+	uint64_t right = x86_read_source_operand(source, regs);
+	uint64_t result = flags->cf;
+	
+	memset(flags, 0, sizeof *flags);
+	result = x86_add(flags, source->size, result, left);
+	result = x86_add(flags, source->size, result, right);
+	x86_write_destination_operand(destination, regs, result);
+}
+
+X86_INSTRUCTION_DEF(add)
+{
+	const cs_x86_op* source = &inst->operands[1];
+	const cs_x86_op* destination = &inst->operands[0];
+	uint64_t left = x86_read_destination_operand(destination, regs);
+	uint64_t right = x86_read_source_operand(source, regs);
+	
+	uint64_t result = x86_add_setting_flags(flags, source->size, left, right);
+	x86_write_destination_operand(destination, regs, result);
+}
+
+X86_INSTRUCTION_DEF(addpd)
+{
+	x86_vector_operator<double>(regs, inst, false, [](auto left, auto right) { return left + right; });
+}
+
+X86_INSTRUCTION_DEF(addps)
+{
+	x86_vector_operator<float>(regs, inst, false, [](auto left, auto right) { return left + right; });
+}
+
+X86_INSTRUCTION_DEF(addsd)
+{
+	x86_scalar_operator<double>(regs, inst, [](double left, double right) { return left + right; });
+}
+
+X86_INSTRUCTION_DEF(addss)
+{
+	x86_scalar_operator<float>(regs, inst, [](float left, float right) { return left + right; });
+}
+
+X86_INSTRUCTION_DEF(and)
+{
+	const cs_x86_op* destination = &inst->operands[0];
+	uint64_t result = x86_logical_operator(regs, flags, inst, [](uint64_t left, uint64_t right) { return left & right; });
+	x86_write_destination_operand(destination, regs, result);
+}
+
+X86_INSTRUCTION_DEF(andnpd)
+{
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return ~left & right; });
+}
+
+X86_INSTRUCTION_DEF(andnps)
+{
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return ~left & right; });
+}
+
+X86_INSTRUCTION_DEF(andpd)
+{
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return left & right; });
+}
+
+X86_INSTRUCTION_DEF(andps)
+{
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return left & right; });
+}
+
+X86_INSTRUCTION_DEF(bt)
+{
+	x86_flags_materialize(flags);
+	uint64_t bitBase = x86_read_source_operand(&inst->operands[0], regs);
+	uint64_t bitOffset = x86_read_source_operand(&inst->operands[1], regs);
+	flags->cf = (bitBase >> bitOffset) & 1;
+	flags->af = x86_clobber_bit();
+	flags->of = x86_clobber_bit();
+	flags->pf = x86_clobber_bit();
+	flags->zf = x86_clobber_bit();
+}
+
+X86_INSTRUCTION_DEF(call)
+{
+	uint64_t target = x86_read_source_operand(&inst->operands[0], regs);
+	x86_call_intrin(config, regs, target);
+}
+
+X86_INSTRUCTION_DEF(cdq)
+{
+	int32_t signedAx = static_cast<int32_t>(x86_read_reg(regs, X86_REG_EAX));
+	x86_write_reg(regs, X86_REG_EDX, signedAx < 0 ? 0xffffffff : 0);
+}
+
+X86_INSTRUCTION_DEF(cdqe)
+{
+	int32_t signedAx = static_cast<int32_t>(x86_read_reg(regs, X86_REG_EAX));
+	int64_t signExtendedAx = static_cast<int64_t>(signedAx);
+	x86_write_reg(regs, X86_REG_RAX, signExtendedAx);
+}
+
+X86_INSTRUCTION_DEF(cmova)
+{
+	if (x86_cond_above(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovae)
+{
+	if (x86_cond_above_or_equal(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovb)
+{
+	if (x86_cond_below(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovbe)
+{
+	if (x86_cond_below_or_equal(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmove)
+{
+	if (x86_cond_equal(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovg)
+{
+	if (x86_cond_greater(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovge)
+{
+	if (x86_cond_greater_or_equal(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovl)
+{
+	if (x86_cond_less(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovle)
+{
+	if (x86_cond_less_or_equal(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovne)
+{
+	if (x86_cond_not_equal(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovno)
+{
+	if (x86_cond_no_overflow(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovnp)
+{
+	if (x86_cond_no_parity(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovns)
+{
+	if (x86_cond_no_sign(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovo)
+{
+	if (x86_cond_overflow(flags))
+	{
+		x86_move_zero_extend(regs, inst);
+	}
+}
+
+X86_INSTRUCTION_DEF(cmovp)
+{
+	if (x86_cond_parity(flags))
+	{
+		x86_move_zero_extend(regs, inst);
 	}
 }
 
@@ -719,8 +1277,19 @@ X86_INSTRUCTION_DEF(cmp)
 	uint64_t leftValue = x86_read_source_operand(left, regs);
 	uint64_t rightValue = x86_read_source_operand(right, regs);
 	
-	memset(flags, 0, sizeof *flags);
-	x86_subtract(flags, left->size, leftValue, rightValue);
+	x86_subtract_setting_flags(flags, left->size, leftValue, rightValue);
+}
+
+X86_INSTRUCTION_DEF(comisd)
+{
+	x86_flags_materialize(flags);
+	x86_compare_scalar<double>(regs, flags, inst);
+}
+
+X86_INSTRUCTION_DEF(comiss)
+{
+	x86_flags_materialize(flags);
+	x86_compare_scalar<float>(regs, flags, inst);
 }
 
 X86_INSTRUCTION_DEF(cqo)
@@ -729,8 +1298,39 @@ X86_INSTRUCTION_DEF(cqo)
 	x86_write_reg(regs, X86_REG_RDX, signedAx < 0 ? 0xffffffffffffffffull : 0);
 }
 
+X86_INSTRUCTION_DEF(cvtsd2ss)
+{
+	x86_convert_scalar<double, float>(regs, inst);
+}
+
+X86_INSTRUCTION_DEF(cvtsi2sd)
+{
+	x86_convert_integer_to_scalar<double>(regs, inst);
+}
+
+X86_INSTRUCTION_DEF(cvtsi2ss)
+{
+	x86_convert_integer_to_scalar<float>(regs, inst);
+}
+
+X86_INSTRUCTION_DEF(cvtss2sd)
+{
+	x86_convert_scalar<float, double>(regs, inst);
+}
+
+X86_INSTRUCTION_DEF(cvttsd2si)
+{
+	x86_truncate_scalar_to_integer<double>(regs, inst);
+}
+
+X86_INSTRUCTION_DEF(cvttss2si)
+{
+	x86_truncate_scalar_to_integer<float>(regs, inst);
+}
+
 X86_INSTRUCTION_DEF(dec)
 {
+	x86_flags_materialize(flags);
 	bool preserved_cf = flags->cf;
 	const cs_x86_op* destination = &inst->operands[0];
 	uint64_t left = x86_read_destination_operand(destination, regs);
@@ -743,6 +1343,7 @@ X86_INSTRUCTION_DEF(dec)
 
 X86_INSTRUCTION_DEF(div)
 {
+	x86_flags_materialize(flags);
 	// XXX: div can raise exceptions, but we don't support CPU exceptions.
 	
 	const cs_x86_op* divisor_op = &inst->operands[0];
@@ -788,6 +1389,26 @@ X86_INSTRUCTION_DEF(div)
 	flags->zf = x86_clobber_bit();
 }
 
+X86_INSTRUCTION_DEF(divpd)
+{
+	x86_vector_operator<double>(regs, inst, false, [](auto left, auto right) { return left / right; });
+}
+
+X86_INSTRUCTION_DEF(divps)
+{
+	x86_vector_operator<float>(regs, inst, false, [](auto left, auto right) { return left / right; });
+}
+
+X86_INSTRUCTION_DEF(divsd)
+{
+	x86_scalar_operator<double>(regs, inst, [](double left, double right) { return left / right; });
+}
+
+X86_INSTRUCTION_DEF(divss)
+{
+	x86_scalar_operator<float>(regs, inst, [](float left, float right) { return left / right; });
+}
+
 X86_INSTRUCTION_DEF(hlt)
 {
 	__builtin_trap();
@@ -795,6 +1416,7 @@ X86_INSTRUCTION_DEF(hlt)
 
 X86_INSTRUCTION_DEF(idiv)
 {
+	x86_flags_materialize(flags);
 	// XXX: idiv can raise exceptions, but we don't support CPU exceptions.
 	
 	const cs_x86_op* divisor_op = &inst->operands[0];
@@ -842,6 +1464,7 @@ X86_INSTRUCTION_DEF(idiv)
 
 X86_INSTRUCTION_DEF(imul)
 {
+	x86_flags_materialize(flags);
 	// SF had undefined contents up until relatively recently. Set it, but don't check it with tests
 	// (the implementation is trivial anyway).
 	
@@ -985,6 +1608,7 @@ X86_INSTRUCTION_DEF(imul)
 
 X86_INSTRUCTION_DEF(inc)
 {
+	x86_flags_materialize(flags);
 	bool preserved_cf = flags->cf;
 	const cs_x86_op* destination = &inst->operands[0];
 	uint64_t left = x86_read_destination_operand(destination, regs);
@@ -1107,7 +1731,7 @@ X86_INSTRUCTION_DEF(lea)
 X86_INSTRUCTION_DEF(leave)
 {
 	regs->sp = regs->bp;
-	regs->bp.qword = x86_pop_value(config, regs, config->address_size);
+	regs->bp = x86_pop_value(config, regs, X86_CONFIG(config)->address_size);
 }
 
 X86_INSTRUCTION_DEF(mov)
@@ -1120,6 +1744,41 @@ X86_INSTRUCTION_DEF(movabs)
 	x86_move_zero_extend(regs, inst);
 }
 
+X86_INSTRUCTION_DEF(movapd)
+{
+	x86_move_vector(regs, inst, false);
+}
+
+X86_INSTRUCTION_DEF(movaps)
+{
+	x86_move_vector(regs, inst, false);
+}
+
+X86_INSTRUCTION_DEF(movd)
+{
+	x86_move_low_element<uint32_t>(regs, inst, false);
+}
+
+X86_INSTRUCTION_DEF(movdqa)
+{
+	x86_move_vector(regs, inst, false);
+}
+
+X86_INSTRUCTION_DEF(movdqu)
+{
+	x86_move_vector(regs, inst, false);
+}
+
+X86_INSTRUCTION_DEF(movq)
+{
+	x86_move_low_element<uint64_t>(regs, inst, false);
+}
+
+X86_INSTRUCTION_DEF(movss)
+{
+	x86_move_scalar<float>(regs, inst);
+}
+
 X86_INSTRUCTION_DEF(movsx)
 {
 	x86_move_sign_extend(regs, inst);
@@ -1130,6 +1789,16 @@ X86_INSTRUCTION_DEF(movsxd)
 	x86_move_sign_extend(regs, inst);
 }
 
+X86_INSTRUCTION_DEF(movupd)
+{
+	x86_move_vector(regs, inst, false);
+}
+
+X86_INSTRUCTION_DEF(movups)
+{
+	x86_move_vector(regs, inst, false);
+}
+
 X86_INSTRUCTION_DEF(movzx)
 {
 	x86_move_zero_extend(regs, inst);
@@ -1137,6 +1806,7 @@ X86_INSTRUCTION_DEF(movzx)
 
 X86_INSTRUCTION_DEF(mul)
 {
+	x86_flags_materialize(flags);
 	const cs_x86_op* op0 = &inst->operands[0];
 	uint64_t a, d;
 	uint64_t multiplyBy = x86_read_source_operand(op0, regs);
@@ -1185,34 +1855,140 @@ X86_INSTRUCTION_DEF(mul)
 	flags->zf = x86_clobber_bit();
 }
 
-X86_INSTRUCTION_DEF(neg)
+X86_INSTRUCTION_DEF(mulpd)
+{
+	x86_vector_operator<double>(regs, inst, false, [](auto left, auto right) { return left * right; });
+}
+
+X86_INSTRUCTION_DEF(mulps)
+{
+	x86_vector_operator<float>(regs, inst, false, [](auto left, auto right) { return left * right; });
+}
+
+X86_INSTRUCTION_DEF(mulsd)
+{
+	x86_scalar_operator<double>(regs, inst, [](double left, double right) { return left * right; });
+}
+
+X86_INSTRUCTION_DEF(mulss)
+{
+	x86_scalar_operator<float>(regs, inst, [](float left, float right) { return left * right; });
+}
+
+X86_INSTRUCTION_DEF(neg)
+{
+	x86_flags_materialize(flags);
+	const cs_x86_op* destination = &inst->operands[0];
+	uint64_t valueToNegate = x86_read_source_operand(destination, regs);
+	
+	memset(flags, 0, sizeof *flags);
+	uint64_t result = x86_subtract(flags, destination->size, 0, valueToNegate);
+	x86_write_destination_operand(destination, regs, result);
+	flags->cf = valueToNegate != 0;
+}
+
+X86_INSTRUCTION_DEF(nop)
+{
+	// do nothing
+}
+
+X86_INSTRUCTION_DEF(not)
+{
+	const cs_x86_op* destination = &inst->operands[0];
+	uint64_t writeValue = ~x86_read_destination_operand(destination, regs);
+	x86_write_destination_operand(destination, regs, writeValue);
+}
+
+X86_INSTRUCTION_DEF(or)
+{
+	const cs_x86_op* destination = &inst->operands[0];
+	uint64_t result = x86_logical_operator(regs, flags, inst, [](uint64_t left, uint64_t right) { return left | right; });
+	x86_write_destination_operand(destination, regs, result);
+}
+
+X86_INSTRUCTION_DEF(orpd)
+{
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return left | right; });
+}
+
+X86_INSTRUCTION_DEF(orps)
+{
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return left | right; });
+}
+
+X86_INSTRUCTION_DEF(paddb)
+{
+	x86_vector_operator<uint8_t>(regs, inst, false, [](auto left, auto right) { return left + right; });
+}
+
+X86_INSTRUCTION_DEF(paddd)
 {
-	const cs_x86_op* destination = &inst->operands[0];
-	uint64_t valueToNegate = x86_read_source_operand(destination, regs);
-	
-	memset(flags, 0, sizeof *flags);
-	uint64_t result = x86_subtract(flags, destination->size, 0, valueToNegate);
-	x86_write_destination_operand(destination, regs, result);
-	flags->cf = valueToNegate != 0;
+	x86_vector_operator<uint32_t>(regs, inst, false, [](auto left, auto right) { return left + right; });
 }
 
-X86_INSTRUCTION_DEF(nop)
+X86_INSTRUCTION_DEF(paddq)
 {
-	// do nothing
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return left + right; });
 }
 
-X86_INSTRUCTION_DEF(not)
+X86_INSTRUCTION_DEF(paddw)
 {
-	const cs_x86_op* destination = &inst->operands[0];
-	uint64_t writeValue = ~x86_read_destination_operand(destination, regs);
-	x86_write_destination_operand(destination, regs, writeValue);
+	x86_vector_operator<uint16_t>(regs, inst, false, [](auto left, auto right) { return left + right; });
 }
 
-X86_INSTRUCTION_DEF(or)
+X86_INSTRUCTION_DEF(pand)
 {
-	const cs_x86_op* destination = &inst->operands[0];
-	uint64_t result = x86_logical_operator(regs, flags, inst, [](uint64_t left, uint64_t right) { return left | right; });
-	x86_write_destination_operand(destination, regs, result);
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return left & right; });
+}
+
+X86_INSTRUCTION_DEF(pandn)
+{
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return ~left & right; });
+}
+
+X86_INSTRUCTION_DEF(pcmpeqb)
+{
+	x86_vector_operator<int8_t>(regs, inst, false, [](auto left, auto right) { return (decltype(left))(left == right); });
+}
+
+X86_INSTRUCTION_DEF(pcmpeqd)
+{
+	x86_vector_operator<int32_t>(regs, inst, false, [](auto left, auto right) { return (decltype(left))(left == right); });
+}
+
+X86_INSTRUCTION_DEF(pcmpeqw)
+{
+	x86_vector_operator<int16_t>(regs, inst, false, [](auto left, auto right) { return (decltype(left))(left == right); });
+}
+
+X86_INSTRUCTION_DEF(pcmpgtb)
+{
+	x86_vector_operator<int8_t>(regs, inst, false, [](auto left, auto right) { return (decltype(left))(left > right); });
+}
+
+X86_INSTRUCTION_DEF(pcmpgtd)
+{
+	x86_vector_operator<int32_t>(regs, inst, false, [](auto left, auto right) { return (decltype(left))(left > right); });
+}
+
+X86_INSTRUCTION_DEF(pcmpgtw)
+{
+	x86_vector_operator<int16_t>(regs, inst, false, [](auto left, auto right) { return (decltype(left))(left > right); });
+}
+
+X86_INSTRUCTION_DEF(pmaxub)
+{
+	x86_vector_operator<uint8_t>(regs, inst, false, [](auto left, auto right) { return x86_vector_max(left, right); });
+}
+
+X86_INSTRUCTION_DEF(pminub)
+{
+	x86_vector_operator<uint8_t>(regs, inst, false, [](auto left, auto right) { return x86_vector_min(left, right); });
+}
+
+X86_INSTRUCTION_DEF(pmovmskb)
+{
+	x86_move_byte_mask(regs, inst);
 }
 
 X86_INSTRUCTION_DEF(pop)
@@ -1224,9 +2000,10 @@ X86_INSTRUCTION_DEF(pop)
 
 X86_INSTRUCTION_DEF(popf)
 {
+	x86_flags_materialize(flags);
 	size_t size = inst->prefix[2] == 0x66
 		? 2 // override 16 bits
-		: config->address_size;
+		: X86_CONFIG(config)->address_size;
 	
 	uint64_t flatFlags = x86_pop_value(config, regs, size);
 	flags->cf = flatFlags & 1;
@@ -1242,6 +2019,47 @@ X86_INSTRUCTION_DEF(popf)
 	flags->of = flatFlags & 1;
 }
 
+X86_INSTRUCTION_DEF(por)
+{
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return left | right; });
+}
+
+X86_INSTRUCTION_DEF(pshufb)
+{
+	x86_vector_operator<uint8_t>(regs, inst, false, [](auto left, auto right) { return x86_shuffle_bytes(left, right); });
+}
+
+X86_INSTRUCTION_DEF(pshufd)
+{
+	x86_shuffle_dwords(regs, inst, false);
+}
+
+X86_INSTRUCTION_DEF(psubb)
+{
+	x86_vector_operator<uint8_t>(regs, inst, false, [](auto left, auto right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(psubd)
+{
+	x86_vector_operator<uint32_t>(regs, inst, false, [](auto left, auto right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(psubq)
+{
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(psubw)
+{
+	x86_vector_operator<uint16_t>(regs, inst, false, [](auto left, auto right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(ptest)
+{
+	x86_flags_materialize(flags);
+	x86_test_vector(flags, x86_read_vector_operand<x86_xmm_u64>(regs, &inst->operands[0]), x86_read_vector_operand<x86_xmm_u64>(regs, &inst->operands[1]));
+}
+
 X86_INSTRUCTION_DEF(push)
 {
 	const cs_x86_op* source = &inst->operands[0];
@@ -1251,6 +2069,7 @@ X86_INSTRUCTION_DEF(push)
 
 X86_INSTRUCTION_DEF(pushf)
 {
+	x86_flags_materialize(flags);
 	uint64_t flatFlags = 0;
 	flatFlags |= flags->of;
 	flatFlags <<= 2;
@@ -1270,19 +2089,25 @@ X86_INSTRUCTION_DEF(pushf)
 	
 	size_t size = inst->prefix[2] == 0x66
 		? 2 // override 16 bits
-		: config->address_size;
+		: X86_CONFIG(config)->address_size;
 	x86_push_value(config, regs, size, flatFlags);
 }
 
+X86_INSTRUCTION_DEF(pxor)
+{
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return left ^ right; });
+}
+
 X86_INSTRUCTION_DEF(ret)
 {
-	uint64_t return_adress = x86_pop_value(config, regs, config->address_size);
-	x86_write_reg(regs, config->ip, return_adress);
+	uint64_t return_adress = x86_pop_value(config, regs, X86_CONFIG(config)->address_size);
+	x86_write_reg(regs, X86_CONFIG(config)->ip, return_adress);
 	x86_ret_intrin(config, regs);
 }
 
 X86_INSTRUCTION_DEF(rol)
 {
+	x86_flags_materialize(flags);
 	const cs_x86_op* destination = &inst->operands[0];
 	uint64_t left = x86_read_destination_operand(destination, regs);
 	uint64_t shiftAmount = x86_read_source_operand(&inst->operands[1], regs);
@@ -1310,6 +2135,7 @@ X86_INSTRUCTION_DEF(rol)
 
 X86_INSTRUCTION_DEF(ror)
 {
+	x86_flags_materialize(flags);
 	const cs_x86_op* destination = &inst->operands[0];
 	uint64_t left = x86_read_destination_operand(destination, regs);
 	uint64_t shiftAmount = x86_read_source_operand(&inst->operands[1], regs);
@@ -1338,6 +2164,7 @@ X86_INSTRUCTION_DEF(ror)
 
 X86_INSTRUCTION_DEF(sar)
 {
+	x86_flags_materialize(flags);
 	const cs_x86_op* destination = &inst->operands[0];
 	uint64_t left = x86_read_destination_operand(destination, regs);
 	int64_t signedLeft;
@@ -1368,6 +2195,7 @@ X86_INSTRUCTION_DEF(sar)
 
 X86_INSTRUCTION_DEF(sbb)
 {
+	x86_flags_materialize(flags);
 	const cs_x86_op* source = &inst->operands[1];
 	const cs_x86_op* destination = &inst->operands[0];
 	uint64_t left = x86_read_destination_operand(destination, regs);
@@ -1479,6 +2307,7 @@ X86_INSTRUCTION_DEF(sets)
 
 X86_INSTRUCTION_DEF(shl)
 {
+	x86_flags_materialize(flags);
 	const cs_x86_op* destination = &inst->operands[0];
 	uint64_t left = x86_read_destination_operand(destination, regs);
 	uint64_t shiftAmount = x86_read_source_operand(&inst->operands[1], regs);
@@ -1507,6 +2336,7 @@ X86_INSTRUCTION_DEF(shl)
 
 X86_INSTRUCTION_DEF(shr)
 {
+	x86_flags_materialize(flags);
 	const cs_x86_op* destination = &inst->operands[0];
 	uint64_t left = x86_read_destination_operand(destination, regs);
 	uint64_t shiftAmount = x86_read_source_operand(&inst->operands[1], regs);
@@ -1527,6 +2357,7 @@ X86_INSTRUCTION_DEF(shr)
 
 X86_INSTRUCTION_DEF(stc)
 {
+	x86_flags_materialize(flags);
 	flags->cf = 1;
 }
 
@@ -1537,16 +2368,304 @@ X86_INSTRUCTION_DEF(sub)
 	uint64_t left = x86_read_destination_operand(destination, regs);
 	uint64_t right = x86_read_source_operand(source, regs);
 	
-	memset(flags, 0, sizeof *flags);
-	uint64_t result = x86_subtract(flags, destination->size, left, right);
+	uint64_t result = x86_subtract_setting_flags(flags, destination->size, left, right);
 	x86_write_destination_operand(destination, regs, result);
 }
 
+X86_INSTRUCTION_DEF(subpd)
+{
+	x86_vector_operator<double>(regs, inst, false, [](auto left, auto right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(subps)
+{
+	x86_vector_operator<float>(regs, inst, false, [](auto left, auto right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(subsd)
+{
+	x86_scalar_operator<double>(regs, inst, [](double left, double right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(subss)
+{
+	x86_scalar_operator<float>(regs, inst, [](float left, float right) { return left - right; });
+}
+
 X86_INSTRUCTION_DEF(test)
 {
 	x86_logical_operator(regs, flags, inst, [](uint64_t left, uint64_t right) { return left & right; });
 }
 
+X86_INSTRUCTION_DEF(ucomisd)
+{
+	x86_flags_materialize(flags);
+	x86_compare_scalar<double>(regs, flags, inst);
+}
+
+X86_INSTRUCTION_DEF(ucomiss)
+{
+	x86_flags_materialize(flags);
+	x86_compare_scalar<float>(regs, flags, inst);
+}
+
+X86_INSTRUCTION_DEF(vaddpd)
+{
+	x86_vector_operator<double>(regs, inst, true, [](auto left, auto right) { return left + right; });
+}
+
+X86_INSTRUCTION_DEF(vaddps)
+{
+	x86_vector_operator<float>(regs, inst, true, [](auto left, auto right) { return left + right; });
+}
+
+X86_INSTRUCTION_DEF(vandnpd)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return ~left & right; });
+}
+
+X86_INSTRUCTION_DEF(vandnps)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return ~left & right; });
+}
+
+X86_INSTRUCTION_DEF(vandpd)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return left & right; });
+}
+
+X86_INSTRUCTION_DEF(vandps)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return left & right; });
+}
+
+X86_INSTRUCTION_DEF(vdivpd)
+{
+	x86_vector_operator<double>(regs, inst, true, [](auto left, auto right) { return left / right; });
+}
+
+X86_INSTRUCTION_DEF(vdivps)
+{
+	x86_vector_operator<float>(regs, inst, true, [](auto left, auto right) { return left / right; });
+}
+
+X86_INSTRUCTION_DEF(vmovapd)
+{
+	x86_move_vector(regs, inst, true);
+}
+
+X86_INSTRUCTION_DEF(vmovaps)
+{
+	x86_move_vector(regs, inst, true);
+}
+
+X86_INSTRUCTION_DEF(vmovd)
+{
+	x86_move_low_element<uint32_t>(regs, inst, true);
+}
+
+X86_INSTRUCTION_DEF(vmovdqa)
+{
+	x86_move_vector(regs, inst, true);
+}
+
+X86_INSTRUCTION_DEF(vmovdqu)
+{
+	x86_move_vector(regs, inst, true);
+}
+
+X86_INSTRUCTION_DEF(vmovq)
+{
+	x86_move_low_element<uint64_t>(regs, inst, true);
+}
+
+X86_INSTRUCTION_DEF(vmovupd)
+{
+	x86_move_vector(regs, inst, true);
+}
+
+X86_INSTRUCTION_DEF(vmovups)
+{
+	x86_move_vector(regs, inst, true);
+}
+
+X86_INSTRUCTION_DEF(vmulpd)
+{
+	x86_vector_operator<double>(regs, inst, true, [](auto left, auto right) { return left * right; });
+}
+
+X86_INSTRUCTION_DEF(vmulps)
+{
+	x86_vector_operator<float>(regs, inst, true, [](auto left, auto right) { return left * right; });
+}
+
+X86_INSTRUCTION_DEF(vorpd)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return left | right; });
+}
+
+X86_INSTRUCTION_DEF(vorps)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return left | right; });
+}
+
+X86_INSTRUCTION_DEF(vpaddb)
+{
+	x86_vector_operator<uint8_t>(regs, inst, true, [](auto left, auto right) { return left + right; });
+}
+
+X86_INSTRUCTION_DEF(vpaddd)
+{
+	x86_vector_operator<uint32_t>(regs, inst, true, [](auto left, auto right) { return left + right; });
+}
+
+X86_INSTRUCTION_DEF(vpaddq)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return left + right; });
+}
+
+X86_INSTRUCTION_DEF(vpaddw)
+{
+	x86_vector_operator<uint16_t>(regs, inst, true, [](auto left, auto right) { return left + right; });
+}
+
+X86_INSTRUCTION_DEF(vpand)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return left & right; });
+}
+
+X86_INSTRUCTION_DEF(vpandn)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return ~left & right; });
+}
+
+X86_INSTRUCTION_DEF(vpcmpeqb)
+{
+	x86_vector_operator<int8_t>(regs, inst, true, [](auto left, auto right) { return (decltype(left))(left == right); });
+}
+
+X86_INSTRUCTION_DEF(vpcmpeqd)
+{
+	x86_vector_operator<int32_t>(regs, inst, true, [](auto left, auto right) { return (decltype(left))(left == right); });
+}
+
+X86_INSTRUCTION_DEF(vpcmpeqw)
+{
+	x86_vector_operator<int16_t>(regs, inst, true, [](auto left, auto right) { return (decltype(left))(left == right); });
+}
+
+X86_INSTRUCTION_DEF(vpcmpgtb)
+{
+	x86_vector_operator<int8_t>(regs, inst, true, [](auto left, auto right) { return (decltype(left))(left > right); });
+}
+
+X86_INSTRUCTION_DEF(vpcmpgtd)
+{
+	x86_vector_operator<int32_t>(regs, inst, true, [](auto left, auto right) { return (decltype(left))(left > right); });
+}
+
+X86_INSTRUCTION_DEF(vpcmpgtw)
+{
+	x86_vector_operator<int16_t>(regs, inst, true, [](auto left, auto right) { return (decltype(left))(left > right); });
+}
+
+X86_INSTRUCTION_DEF(vpmaxub)
+{
+	x86_vector_operator<uint8_t>(regs, inst, true, [](auto left, auto right) { return x86_vector_max(left, right); });
+}
+
+X86_INSTRUCTION_DEF(vpminub)
+{
+	x86_vector_operator<uint8_t>(regs, inst, true, [](auto left, auto right) { return x86_vector_min(left, right); });
+}
+
+X86_INSTRUCTION_DEF(vpmovmskb)
+{
+	x86_move_byte_mask(regs, inst);
+}
+
+X86_INSTRUCTION_DEF(vpor)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return left | right; });
+}
+
+X86_INSTRUCTION_DEF(vpshufb)
+{
+	x86_vector_operator<uint8_t>(regs, inst, true, [](auto left, auto right) { return x86_shuffle_bytes(left, right); });
+}
+
+X86_INSTRUCTION_DEF(vpshufd)
+{
+	x86_shuffle_dwords(regs, inst, true);
+}
+
+X86_INSTRUCTION_DEF(vpsubb)
+{
+	x86_vector_operator<uint8_t>(regs, inst, true, [](auto left, auto right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(vpsubd)
+{
+	x86_vector_operator<uint32_t>(regs, inst, true, [](auto left, auto right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(vpsubq)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(vpsubw)
+{
+	x86_vector_operator<uint16_t>(regs, inst, true, [](auto left, auto right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(vptest)
+{
+	x86_flags_materialize(flags);
+	if (inst->operands[0].size == 32)
+	{
+		x86_test_vector(flags, x86_read_vector_operand<x86_ymm_u64>(regs, &inst->operands[0]), x86_read_vector_operand<x86_ymm_u64>(regs, &inst->operands[1]));
+	}
+	else
+	{
+		x86_test_vector(flags, x86_read_vector_operand<x86_xmm_u64>(regs, &inst->operands[0]), x86_read_vector_operand<x86_xmm_u64>(regs, &inst->operands[1]));
+	}
+}
+
+X86_INSTRUCTION_DEF(vpxor)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return left ^ right; });
+}
+
+X86_INSTRUCTION_DEF(vsubpd)
+{
+	x86_vector_operator<double>(regs, inst, true, [](auto left, auto right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(vsubps)
+{
+	x86_vector_operator<float>(regs, inst, true, [](auto left, auto right) { return left - right; });
+}
+
+X86_INSTRUCTION_DEF(vxorpd)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return left ^ right; });
+}
+
+X86_INSTRUCTION_DEF(vxorps)
+{
+	x86_vector_operator<uint64_t>(regs, inst, true, [](auto left, auto right) { return left ^ right; });
+}
+
+X86_INSTRUCTION_DEF(vzeroupper)
+{
+	for (unsigned i = 0; i < 16; ++i)
+	{
+		x86_mm_reg* reg = &(regs->*x86_register_table[X86_REG_XMM0 + i].mm);
+		memset(&reg->b[16], 0, sizeof *reg - 16);
+	}
+}
+
 X86_INSTRUCTION_DEF(xor)
 {
 	const cs_x86_op* destination = &inst->operands[0];
@@ -1554,39 +2673,49 @@ X86_INSTRUCTION_DEF(xor)
 	x86_write_destination_operand(destination, regs, result);
 }
 
+X86_INSTRUCTION_DEF(xorpd)
+{
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return left ^ right; });
+}
+
+X86_INSTRUCTION_DEF(xorps)
+{
+	x86_vector_operator<uint64_t>(regs, inst, false, [](auto left, auto right) { return left ^ right; });
+}
+
 #pragma mark - Register Table
 const x86_reg_info x86_register_table[X86_REG_ENDING] = {
-	[X86_REG_AH]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::a, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::high}},
-	[X86_REG_AL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::a, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::low}},
-	[X86_REG_AX]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::a, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_BH]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::b, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::high}},
-	[X86_REG_BL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::b, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::low}},
-	[X86_REG_BP]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::bp, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_BPL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::bp, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::low}},
-	[X86_REG_BX]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::b, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_CH]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::c, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::high}},
-	[X86_REG_CL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::c, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::low}},
+	[X86_REG_AH]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::a, 8}},
+	[X86_REG_AL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::a}},
+	[X86_REG_AX]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::a}},
+	[X86_REG_BH]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::b, 8}},
+	[X86_REG_BL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::b}},
+	[X86_REG_BP]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::bp}},
+	[X86_REG_BPL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::bp}},
+	[X86_REG_BX]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::b}},
+	[X86_REG_CH]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::c, 8}},
+	[X86_REG_CL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::c}},
 	[X86_REG_CS]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::cs}},
-	[X86_REG_CX]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::c, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_DH]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::d, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::high}},
-	[X86_REG_DI]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::di, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_DIL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::di, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::low}},
-	[X86_REG_DL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::d, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::low}},
+	[X86_REG_CX]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::c}},
+	[X86_REG_DH]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::d, 8}},
+	[X86_REG_DI]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::di}},
+	[X86_REG_DIL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::di}},
+	[X86_REG_DL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::d}},
 	[X86_REG_DS]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::ds}},
-	[X86_REG_DX]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::d, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_EAX]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::a, &x86_qword_reg::low}},
-	[X86_REG_EBP]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::bp, &x86_qword_reg::low}},
-	[X86_REG_EBX]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::b, &x86_qword_reg::low}},
-	[X86_REG_ECX]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::c, &x86_qword_reg::low}},
-	[X86_REG_EDI]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::di, &x86_qword_reg::low}},
-	[X86_REG_EDX]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::d, &x86_qword_reg::low}},
-	[X86_REG_EIP]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::ip, &x86_qword_reg::low}},
+	[X86_REG_DX]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::d}},
+	[X86_REG_EAX]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::a}},
+	[X86_REG_EBP]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::bp}},
+	[X86_REG_EBX]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::b}},
+	[X86_REG_ECX]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::c}},
+	[X86_REG_EDI]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::di}},
+	[X86_REG_EDX]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::d}},
+	[X86_REG_EIP]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::ip}},
 	[X86_REG_ES]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::es}},
-	[X86_REG_ESI]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::si, &x86_qword_reg::low}},
-	[X86_REG_ESP]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::sp, &x86_qword_reg::low}},
+	[X86_REG_ESI]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::si}},
+	[X86_REG_ESP]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::sp}},
 	[X86_REG_FS]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::fs}},
 	[X86_REG_GS]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::gs}},
-	[X86_REG_IP]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::ip, &x86_qword_reg::low, &x86_dword_reg::low}},
+	[X86_REG_IP]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::ip}},
 	[X86_REG_RAX]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::a}},
 	[X86_REG_RBP]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::bp}},
 	[X86_REG_RBX]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::b}},
@@ -1596,10 +2725,10 @@ const x86_reg_info x86_register_table[X86_REG_ENDING] = {
 	[X86_REG_RIP]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::ip}},
 	[X86_REG_RSI]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::si}},
 	[X86_REG_RSP]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::sp}},
-	[X86_REG_SI]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::si, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_SIL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::si, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::low}},
-	[X86_REG_SP]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::sp, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_SPL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::sp, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::low}},
+	[X86_REG_SI]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::si}},
+	[X86_REG_SIL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::si}},
+	[X86_REG_SP]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::sp}},
+	[X86_REG_SPL]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::sp}},
 	[X86_REG_SS]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::ss}},
 	//	[X86_REG_K0]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::k0}},
 	//	[X86_REG_K1]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::k1}},
@@ -1617,28 +2746,60 @@ const x86_reg_info x86_register_table[X86_REG_ENDING] = {
 	[X86_REG_R13]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::r13}},
 	[X86_REG_R14]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::r14}},
 	[X86_REG_R15]	= {.type = x86_reg_type::qword_reg,	.size = 8,	.reg = {&x86_regs::r15}},
-	[X86_REG_R8B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r8, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::high}},
-	[X86_REG_R9B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r9, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::high}},
-	[X86_REG_R10B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r10, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::high}},
-	[X86_REG_R11B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r11, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::high}},
-	[X86_REG_R12B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r12, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::high}},
-	[X86_REG_R13B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r13, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::high}},
-	[X86_REG_R14B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r14, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::high}},
-	[X86_REG_R15B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r15, &x86_qword_reg::low, &x86_dword_reg::low, &x86_word_reg::high}},
-	[X86_REG_R8D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r8, &x86_qword_reg::low}},
-	[X86_REG_R9D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r9, &x86_qword_reg::low}},
-	[X86_REG_R10D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r10, &x86_qword_reg::low}},
-	[X86_REG_R11D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r11, &x86_qword_reg::low}},
-	[X86_REG_R12D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r12, &x86_qword_reg::low}},
-	[X86_REG_R13D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r13, &x86_qword_reg::low}},
-	[X86_REG_R14D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r14, &x86_qword_reg::low}},
-	[X86_REG_R15D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r15, &x86_qword_reg::low}},
-	[X86_REG_R8W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r8, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_R9W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r9, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_R10W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r10, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_R11W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r11, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_R12W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r12, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_R13W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r13, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_R14W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r14, &x86_qword_reg::low, &x86_dword_reg::low}},
-	[X86_REG_R15W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r15, &x86_qword_reg::low, &x86_dword_reg::low}},
+	[X86_REG_R8B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r8}},
+	[X86_REG_R9B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r9}},
+	[X86_REG_R10B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r10}},
+	[X86_REG_R11B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r11}},
+	[X86_REG_R12B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r12}},
+	[X86_REG_R13B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r13}},
+	[X86_REG_R14B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r14}},
+	[X86_REG_R15B]	= {.type = x86_reg_type::qword_reg,	.size = 1,	.reg = {&x86_regs::r15}},
+	[X86_REG_R8D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r8}},
+	[X86_REG_R9D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r9}},
+	[X86_REG_R10D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r10}},
+	[X86_REG_R11D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r11}},
+	[X86_REG_R12D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r12}},
+	[X86_REG_R13D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r13}},
+	[X86_REG_R14D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r14}},
+	[X86_REG_R15D]	= {.type = x86_reg_type::qword_reg,	.size = 4,	.reg = {&x86_regs::r15}},
+	[X86_REG_R8W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r8}},
+	[X86_REG_R9W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r9}},
+	[X86_REG_R10W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r10}},
+	[X86_REG_R11W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r11}},
+	[X86_REG_R12W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r12}},
+	[X86_REG_R13W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r13}},
+	[X86_REG_R14W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r14}},
+	[X86_REG_R15W]	= {.type = x86_reg_type::qword_reg,	.size = 2,	.reg = {&x86_regs::r15}},
+	[X86_REG_XMM0]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm0},
+	[X86_REG_XMM1]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm1},
+	[X86_REG_XMM2]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm2},
+	[X86_REG_XMM3]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm3},
+	[X86_REG_XMM4]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm4},
+	[X86_REG_XMM5]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm5},
+	[X86_REG_XMM6]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm6},
+	[X86_REG_XMM7]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm7},
+	[X86_REG_XMM8]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm8},
+	[X86_REG_XMM9]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm9},
+	[X86_REG_XMM10]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm10},
+	[X86_REG_XMM11]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm11},
+	[X86_REG_XMM12]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm12},
+	[X86_REG_XMM13]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm13},
+	[X86_REG_XMM14]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm14},
+	[X86_REG_XMM15]	= {.type = x86_reg_type::mm_reg,	.size = 16,	.mm = &x86_regs::mm15},
+	[X86_REG_YMM0]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm0},
+	[X86_REG_YMM1]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm1},
+	[X86_REG_YMM2]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm2},
+	[X86_REG_YMM3]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm3},
+	[X86_REG_YMM4]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm4},
+	[X86_REG_YMM5]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm5},
+	[X86_REG_YMM6]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm6},
+	[X86_REG_YMM7]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm7},
+	[X86_REG_YMM8]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm8},
+	[X86_REG_YMM9]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm9},
+	[X86_REG_YMM10]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm10},
+	[X86_REG_YMM11]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm11},
+	[X86_REG_YMM12]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm12},
+	[X86_REG_YMM13]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm13},
+	[X86_REG_YMM14]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm14},
+	[X86_REG_YMM15]	= {.type = x86_reg_type::mm_reg,	.size = 32,	.mm = &x86_regs::mm15},
 };
@@ -41,22 +41,25 @@ namespace
 		size_t offset = 0;
 		unsigned fieldOffset = 0;
 		
-		inline void regInfo(size_t size, const string& name, x86_reg registerId)
+		inline void addRegister(size_t size, size_t offset, SmallVector<unsigned, 4> gepOffsets, const string& name, x86_reg registerId)
 		{
 			if (registerId != X86_REG_INVALID)
 			{
-				TargetRegisterInfo result = { offset, size, {0, fieldOffset, 0}, name, registerId };
+				TargetRegisterInfo result = { offset, size, move(gepOffsets), name, registerId };
 				info.push_back(result);
 			}
 		}
 		
+		// General-purpose registers are i64 fields of the register struct. Smaller registers share the field and are
+		// extracted with shifts and masks, so they all have the same GEP.
+		inline void regInfo(size_t size, const string& name, x86_reg registerId)
+		{
+			regInfo(size, offset, name, registerId);
+		}
+		
 		inline void regInfo(size_t size, size_t offset, const string& name, x86_reg registerId)
 		{
-			if (registerId != X86_REG_INVALID)
-			{
-				TargetRegisterInfo result = { offset, size, {0, fieldOffset, 0}, name, registerId };
-				info.push_back(result);
-			}
+			addRegister(size, offset, {0, fieldOffset}, name, registerId);
 		}
 		
 		void singleLetterReg(char letter, x86_reg r64, x86_reg r32, x86_reg r16, x86_reg r8h, x86_reg r8l)
@@ -104,6 +107,18 @@ namespace
 			offset += 8;
 			fieldOffset++;
 		}
+		
+		void vectorReg(unsigned num, x86_reg zmm, x86_reg ymm, x86_reg xmm)
+		{
+			string number;
+			raw_string_ostream(number) << num;
+			// Vector registers are unions, whose first member holds the value.
+			addRegister(64, offset, {0, fieldOffset, 0}, "zmm" + number, zmm);
+			addRegister(32, offset, {0, fieldOffset, 0}, "ymm" + number, ymm);
+			addRegister(16, offset, {0, fieldOffset, 0}, "xmm" + number, xmm);
+			offset += 64;
+			fieldOffset++;
+		}
 	};
 	
 #define ONE_LETTER_REG(letter) \
@@ -125,6 +140,9 @@ namespace
 	builder.extendedReg((num), \
 		X86_REG_R##num, X86_REG_R##num##D, X86_REG_R##num##W, X86_REG_R##num##B)
 	
+#define VECTOR_REG(num) \
+	builder.vectorReg((num), X86_REG_ZMM##num, X86_REG_YMM##num, X86_REG_XMM##num)
+	
 	std::vector<TargetRegisterInfo> x86RegisterInfo = []()
 	{
 		RegInfoBuilder builder;
@@ -154,14 +172,32 @@ namespace
 		builder.segmentReg("fs", X86_REG_FS);
 		builder.segmentReg("gs", X86_REG_GS);
 		builder.segmentReg("ss", X86_REG_SS);
+		
+		VECTOR_REG(0);
+		VECTOR_REG(1);
+		VECTOR_REG(2);
+		VECTOR_REG(3);
+		VECTOR_REG(4);
+		VECTOR_REG(5);
+		VECTOR_REG(6);
+		VECTOR_REG(7);
+		VECTOR_REG(8);
+		VECTOR_REG(9);
+		VECTOR_REG(10);
+		VECTOR_REG(11);
+		VECTOR_REG(12);
+		VECTOR_REG(13);
+		VECTOR_REG(14);
+		VECTOR_REG(15);
 		return builder.info;
 	}();
 }
 
 void x86TargetInfo(TargetInfo* info)
 {
+	static TargetRegisterIndex x86RegisterIndex(x86RegisterInfo);
 	info->targetName() = "x86_64";
-	info->setTargetRegisterInfo(x86RegisterInfo);
+	info->setTargetRegisterInfo(x86RegisterIndex);
 	
 	auto rsp_iter = find_if(x86RegisterInfo.begin(), x86RegisterInfo.end(), [](const TargetRegisterInfo& info)
 	{
@@ -25,30 +25,6 @@
 #include <cstdint>
 #include <x86.h> // capstone/x86.h
 
-union x86_word_reg {
-	uint16_t word;
-	struct {
-		uint8_t low;
-		uint8_t high;
-	};
-};
-
-union x86_dword_reg {
-	uint32_t dword;
-	struct {
-		x86_word_reg low;
-		x86_word_reg high;
-	};
-};
-
-union x86_qword_reg {
-	uint64_t qword;
-	struct {
-		x86_dword_reg low;
-		x86_dword_reg high;
-	};
-};
-
 union x86_mm_reg {
 	double d[8];
 	float f[16];
@@ -68,6 +44,15 @@ struct x86_flags_reg {
 	bool sf; // sign: set if most significant bit of result is 1
 	bool of; // overflow: set when the result has a sign different from the expected one (carry into ^ carry out)
 	
+#ifdef FCD_LAZY_FLAGS
+	// last flag-producing operation, when its status flags haven't been materialized into the fields above
+	uint8_t lazy_op;
+	uint8_t lazy_size;
+	uint64_t lazy_left;
+	uint64_t lazy_right;
+	uint64_t lazy_result;
+	
+#endif
 	// control/system flags
 	/*
 	 bool tf; // trap; single-step
@@ -84,20 +69,24 @@ struct x86_flags_reg {
 	 */
 };
 
+// General-purpose registers are plain 64-bit integers. Smaller registers are read and written with shifts and masks
+// instead of through unions, so that lifted code only ever accesses whole i64 fields, which SROA and mem2reg can
+// promote without first reconciling pointer types.
 struct x86_regs {
-	x86_qword_reg zero; // eiz/riz pseudo-registers
-	x86_qword_reg a, b, c, d;
-	x86_qword_reg si, di;
-	x86_qword_reg bp, sp, ip;
-	x86_qword_reg r8, r9, r10, r11, r12, r13, r14, r15;
-	x86_qword_reg cs, ds, es, fs, gs, ss;
+	uint64_t zero; // eiz/riz pseudo-registers
+	uint64_t a, b, c, d;
+	uint64_t si, di;
+	uint64_t bp, sp, ip;
+	uint64_t r8, r9, r10, r11, r12, r13, r14, r15;
+	uint64_t cs, ds, es, fs, gs, ss;
 	
 	// AVX512 mask registers
-	//x86_qword_reg k0, k1, k2, k3, k4, k5, k6, k7;
+	//uint64_t k0, k1, k2, k3, k4, k5, k6, k7;
 	
 	// Crazy large amount of multimedia registers
-	//x86_mm_reg mm0, mm1, mm2, mm3, mm4, mm5, mm6, mm7;
-	//x86_mm_reg mm8, mm9, mm10, mm11, mm12, mm13, mm14, mm15;
+	// (xmm/ymm/zmm 0-15; AVX-512 registers 16-31 aren't supported)
+	x86_mm_reg mm0, mm1, mm2, mm3, mm4, mm5, mm6, mm7;
+	x86_mm_reg mm8, mm9, mm10, mm11, mm12, mm13, mm14, mm15;
 	//x86_mm_reg mm16, mm17, mm18, mm19, mm20, mm21, mm22, mm23;
 	//x86_mm_reg mm24, mm25, mm26, mm27, mm28, mm29, mm30, mm31;
 	
@@ -116,10 +105,8 @@ enum class x86_reg_type {
 };
 
 struct x86_reg_selector {
-	x86_qword_reg x86_regs::*qword;
-	x86_dword_reg x86_qword_reg::*dword;
-	x86_word_reg x86_dword_reg::*word;
-	uint8_t x86_word_reg::*byte;
+	uint64_t x86_regs::*qword;
+	uint8_t shift; // 8 for ah, bh, ch and dh, 0 otherwise
 };
 
 struct x86_reg_info {
@@ -0,0 +1,301 @@
+//
+// decompilation_cache.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "decompilation_cache.h"
+#include "metadata.h"
+
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/IR/CallSite.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	// Cached pseudocode is only valid for the fcd build that produced it.
+	const char cacheVersion[] = "fcd-cache-1 " __DATE__ " " __TIME__;
+	
+	uint64_t virtualAddressOf(const Function& fn)
+	{
+		if (auto address = md::getVirtualAddress(fn))
+		{
+			return address->getLimitedValue();
+		}
+		return 0;
+	}
+	
+	string md5String(MD5& hash)
+	{
+		MD5::MD5Result result;
+		SmallString<32> resultString;
+		hash.final(result);
+		MD5::stringifyResult(result, resultString);
+		return resultString.str();
+	}
+	
+	// Functions are identified by their code hash, or by their name if they weren't lifted (for instance, imports).
+	// Intrinsics have no identifier.
+	string identifierOf(const Function& fn)
+	{
+		if (auto hash = md::getCodeHash(fn))
+		{
+			return hash->getString().str();
+		}
+		return fn.isIntrinsic() ? string() : fn.getName().str();
+	}
+	
+	vector<Function*> directCallees(Function& fn)
+	{
+		vector<Function*> result;
+		for (Instruction& inst : instructions(fn))
+		{
+			CallSite cs(&inst);
+			if (!cs)
+			{
+				continue;
+			}
+			
+			if (Function* callee = dyn_cast<Function>(cs.getCalledValue()->stripPointerCasts()))
+			{
+				result.push_back(callee);
+			}
+		}
+		return result;
+	}
+	
+	void sortUnique(vector<string>& strings)
+	{
+		sort(strings.begin(), strings.end());
+		strings.erase(unique(strings.begin(), strings.end()), strings.end());
+	}
+	
+	struct DecompilationCachePruning final : public ModulePass
+	{
+		static char ID;
+		DecompilationCache* cache;
+		
+		DecompilationCachePruning(DecompilationCache* cache = nullptr)
+		: ModulePass(ID), cache(cache)
+		{
+		}
+		
+		virtual const char* getPassName() const override
+		{
+			return "Prune cached functions";
+		}
+		
+		virtual bool runOnModule(Module& module) override
+		{
+			// Without a cache (when created from the pass registry), this does nothing.
+			bool changed = false;
+			if (cache == nullptr)
+			{
+				return false;
+			}
+			
+			for (Function& fn : module)
+			{
+				if (!md::isPrototype(fn) && cache->getCachedPseudocode(fn) != nullptr)
+				{
+					uint64_t address = virtualAddressOf(fn);
+					fn.deleteBody();
+					md::setVirtualAddress(fn, address);
+					changed = true;
+				}
+			}
+			return changed;
+		}
+	};
+	
+	char DecompilationCachePruning::ID = 0;
+	RegisterPass<DecompilationCachePruning> decompilationCachePruning("#cache-pruning", "Prune cached functions", false, false);
+}
+
+DecompilationCache::DecompilationCache(string directory, ArrayRef<string> passNames)
+: directory(move(directory))
+{
+	MD5 configuration;
+	configuration.update(cacheVersion);
+	for (const string& passName : passNames)
+	{
+		configuration.update(passName);
+		configuration.update(StringRef("", 1));
+	}
+	configurationKey = md5String(configuration);
+}
+
+string DecompilationCache::pathForKey(StringRef key) const
+{
+	SmallString<128> path(directory);
+	sys::path::append(path, key + ".c");
+	return path.str();
+}
+
+bool DecompilationCache::open(string& errorMessage)
+{
+	if (auto error = sys::fs::create_directories(directory))
+	{
+		errorMessage = error.message();
+		return false;
+	}
+	return true;
+}
+
+void DecompilationCache::computeKeys(Module& module)
+{
+	keys.clear();
+	hits.clear();
+	
+	// Argument recovery of a function depends on every function that it calls, directly or not, so keys cover the
+	// code of everything that a function reaches. Functions that call each other share the key of the strongly
+	// connected component that they form, which covers their code and the keys of the components that they call.
+	// Components come callees first.
+	unordered_map<const Function*, string> componentKeys;
+	CallGraph callGraph(module);
+	for (auto scc = scc_begin(&callGraph); !scc.isAtEnd(); ++scc)
+	{
+		unordered_set<Function*> members;
+		for (CallGraphNode* node : *scc)
+		{
+			if (Function* fn = node->getFunction())
+			{
+				members.insert(fn);
+			}
+		}
+		
+		vector<string> identifiers;
+		vector<string> calleeKeys;
+		for (Function* member : members)
+		{
+			identifiers.push_back(identifierOf(*member));
+			for (Function* callee : directCallees(*member))
+			{
+				// The call graph misses calls through casts, so these callees might not have a key yet.
+				auto iter = componentKeys.find(callee);
+				if (iter != componentKeys.end())
+				{
+					calleeKeys.push_back(iter->second);
+				}
+				else if (members.count(callee) == 0)
+				{
+					calleeKeys.push_back(identifierOf(*callee));
+				}
+			}
+		}
+		sortUnique(identifiers);
+		sortUnique(calleeKeys);
+		
+		MD5 component;
+		for (const string& identifier : identifiers)
+		{
+			component.update(identifier);
+			component.update(StringRef("", 1));
+		}
+		component.update(StringRef("", 1));
+		for (const string& calleeKey : calleeKeys)
+		{
+			component.update(calleeKey);
+			component.update(StringRef("", 1));
+		}
+		
+		string componentKey = md5String(component);
+		for (const Function* member : members)
+		{
+			componentKeys[member] = componentKey;
+		}
+	}
+	
+	for (Function& fn : module)
+	{
+		if (md::isPrototype(fn))
+		{
+			continue;
+		}
+		
+		auto codeHash = md::getCodeHash(fn);
+		uint64_t address = virtualAddressOf(fn);
+		if (codeHash == nullptr || address == 0)
+		{
+			continue;
+		}
+		
+		MD5 key;
+		key.update(configurationKey);
+		key.update(codeHash->getString());
+		key.update(StringRef("", 1));
+		key.update(componentKeys[&fn]);
+		
+		string keyString = md5String(key);
+		if (auto bufferOrError = MemoryBuffer::getFile(pathForKey(keyString)))
+		{
+			hits[address] = bufferOrError.get()->getBuffer().str();
+		}
+		keys[address] = move(keyString);
+	}
+}
+
+const string* DecompilationCache::getCachedPseudocode(const Function& fn) const
+{
+	auto iter = hits.find(virtualAddressOf(fn));
+	return iter == hits.end() ? nullptr : &iter->second;
+}
+
+void DecompilationCache::store(const Function& fn, StringRef pseudocode)
+{
+	auto iter = keys.find(virtualAddressOf(fn));
+	if (iter == keys.end())
+	{
+		return;
+	}
+	
+	// Write to a temporary file and rename it, so that concurrent runs never see partial entries.
+	int fd;
+	SmallString<128> temporaryPath;
+	SmallString<128> model(directory);
+	sys::path::append(model, "entry-%%%%%%%%.tmp");
+	if (sys::fs::createUniqueFile(model, fd, temporaryPath))
+	{
+		return;
+	}
+	
+	{
+		raw_fd_ostream output(fd, true);
+		output << pseudocode;
+	}
+	sys::fs::rename(temporaryPath, pathForKey(iter->second));
+}
+
+ModulePass* createDecompilationCachePruningPass(DecompilationCache& cache)
+{
+	return new DecompilationCachePruning(&cache);
+}
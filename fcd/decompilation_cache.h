@@ -0,0 +1,63 @@
+//
+// decompilation_cache.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef fcd__decompilation_cache_h
+#define fcd__decompilation_cache_h
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// On-disk cache of the pseudocode of functions, keyed by the function's machine code, the machine code of the
+// functions that it calls directly or not, the pass pipeline and the fcd build.
+//
+// Keys are computed before argument recovery. Cached functions still need to be lifted and analyzed, because their
+// callers' parameters depend on them, but they are turned back into prototypes after argument recovery and skip the
+// rest of the pipeline and the back end. AstPrint then prints the cached pseudocode in their place.
+class DecompilationCache
+{
+	std::string directory;
+	std::string configurationKey;
+	std::unordered_map<uint64_t, std::string> keys;
+	std::unordered_map<uint64_t, std::string> hits;
+	
+	std::string pathForKey(llvm::StringRef key) const;
+	
+public:
+	DecompilationCache(std::string directory, llvm::ArrayRef<std::string> passNames);
+	
+	bool open(std::string& errorMessage);
+	void computeKeys(llvm::Module& module);
+	
+	const std::string* getCachedPseudocode(const llvm::Function& fn) const;
+	void store(const llvm::Function& fn, llvm::StringRef pseudocode);
+	size_t hitCount() const { return hits.size(); }
+};
+
+// Turns functions that were found in the cache into prototypes.
+llvm::ModulePass* createDecompilationCachePruningPass(DecompilationCache& cache);
+
+#endif /* fcd__decompilation_cache_h */
@@ -0,0 +1,273 @@
+//
+// dumb_allocator.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd. fcd as a whole is licensed under the terms
+// of the GNU GPLv3 license, but specific parts (such as this one) are
+// dual-licensed under the terms of a BSD-like license as well. You
+// may use, modify and distribute this part of fcd under the terms of
+// either license, at your choice.
+//
+
+#include "dumb_allocator.h"
+
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Support/ErrorHandling.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <sys/mman.h>
+
+using namespace llvm;
+using namespace std;
+
+#define DEBUG_TYPE "fcd-allocator"
+
+STATISTIC(ArenaKilobytesAllocated, "Kilobytes of objects allocated in arenas");
+STATISTIC(ArenaKilobytesWasted, "Kilobytes of arena memory lost to alignment and chunk ends");
+STATISTIC(ArenaKilobytesReserved, "Kilobytes of arena chunks requested from the system");
+
+namespace
+{
+	const size_t hugePageSize = 0x200000;
+	
+	void* mapHugePages(size_t size)
+	{
+#ifdef MADV_HUGEPAGE
+		// Transparent huge pages only back aligned regions. Map a bit more and trim so that the chunk is aligned.
+		size_t mappedSize = size + hugePageSize;
+		void* mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapped == MAP_FAILED)
+		{
+			return nullptr;
+		}
+		
+		uintptr_t begin = reinterpret_cast<uintptr_t>(mapped);
+		uintptr_t aligned = (begin + hugePageSize - 1) & ~(hugePageSize - 1);
+		if (aligned != begin)
+		{
+			munmap(mapped, aligned - begin);
+		}
+		if (aligned + size != begin + mappedSize)
+		{
+			munmap(reinterpret_cast<void*>(aligned + size), begin + mappedSize - (aligned + size));
+		}
+		madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+		return reinterpret_cast<void*>(aligned);
+#else
+		return nullptr;
+#endif
+	}
+}
+
+bool DumbAllocator::useHugePages = false;
+
+// Chunks of the geometric sizes, by size, up to a total of maxCachedBytes.
+struct DumbAllocator::ChunkCache
+{
+	static constexpr size_t sizeClasses = 10;
+	static constexpr size_t maxCachedBytes = 0x4000000;
+	static_assert(FirstChunkSize << (sizeClasses - 1) == MaxChunkSize, "size classes don't cover all chunk sizes");
+	
+	Chunk* chunks[sizeClasses];
+	size_t cachedBytes;
+	
+	ChunkCache()
+	: cachedBytes(0)
+	{
+		fill(begin(chunks), end(chunks), nullptr);
+	}
+	
+	~ChunkCache()
+	{
+		for (Chunk* chunk : chunks)
+		{
+			while (chunk != nullptr)
+			{
+				Chunk* next = chunk->next;
+				release(chunk);
+				chunk = next;
+			}
+		}
+	}
+	
+	static Chunk** slot(ChunkCache& cache, size_t size)
+	{
+		for (size_t i = 0; i < sizeClasses; ++i)
+		{
+			if (size == FirstChunkSize << i)
+			{
+				return &cache.chunks[i];
+			}
+		}
+		return nullptr;
+	}
+	
+	static void release(Chunk* chunk)
+	{
+		if (chunk->mapped)
+		{
+			munmap(chunk, chunk->size);
+		}
+		else
+		{
+			free(chunk);
+		}
+	}
+	
+	Chunk* take(size_t size)
+	{
+		Chunk** head = slot(*this, size);
+		if (head == nullptr || *head == nullptr)
+		{
+			return nullptr;
+		}
+		
+		Chunk* chunk = *head;
+		*head = chunk->next;
+		cachedBytes -= chunk->size;
+		chunk->next = nullptr;
+		return chunk;
+	}
+	
+	bool give(Chunk* chunk)
+	{
+		Chunk** head = slot(*this, chunk->size);
+		if (head == nullptr || cachedBytes + chunk->size > maxCachedBytes)
+		{
+			return false;
+		}
+		
+		chunk->next = *head;
+		*head = chunk;
+		cachedBytes += chunk->size;
+		return true;
+	}
+};
+
+DumbAllocator::ChunkCache& DumbAllocator::chunkCache()
+{
+	static thread_local ChunkCache cache;
+	return cache;
+}
+
+DumbAllocator::Chunk* DumbAllocator::createChunk(size_t size)
+{
+	if (Chunk* recycled = chunkCache().take(size))
+	{
+		return recycled;
+	}
+	
+	void* memory = nullptr;
+	bool mapped = false;
+	if (useHugePages && size >= hugePageSize && size % hugePageSize == 0)
+	{
+		memory = mapHugePages(size);
+		mapped = memory != nullptr;
+	}
+	
+	if (memory == nullptr)
+	{
+		memory = malloc(size);
+		if (memory == nullptr)
+		{
+			report_fatal_error("out of memory for arena chunk");
+		}
+	}
+	
+	Chunk* chunk = static_cast<Chunk*>(memory);
+	chunk->next = nullptr;
+	chunk->size = size;
+	chunk->mapped = mapped;
+	return chunk;
+}
+
+void DumbAllocator::destroyChunk(Chunk* chunk)
+{
+	if (!chunkCache().give(chunk))
+	{
+		ChunkCache::release(chunk);
+	}
+}
+
+char* DumbAllocator::allocateSlow(size_t size, size_t alignment)
+{
+	// Objects that would take more than a quarter of a new chunk get a chunk of their own. It goes behind the current
+	// chunk, so that what's left of the current chunk can still be used.
+	if (size + alignment > nextChunkSize / 4)
+	{
+		Chunk* chunk = createChunk(sizeof(Chunk) + size + alignment);
+		if (chunks == nullptr)
+		{
+			chunks = chunk;
+		}
+		else
+		{
+			chunk->next = chunks->next;
+			chunks->next = chunk;
+		}
+		
+		uintptr_t begin = reinterpret_cast<uintptr_t>(chunk->begin());
+		char* result = reinterpret_cast<char*>((begin + alignment - 1) & ~(alignment - 1));
+		bytesReserved += chunk->size;
+		bytesAllocated += size;
+		bytesWasted += size_t(chunk->end() - result) - size;
+		return result;
+	}
+	
+	Chunk* chunk = createChunk(nextChunkSize);
+	chunk->next = chunks;
+	chunks = chunk;
+	bytesReserved += chunk->size;
+	bytesWasted += size_t(limit - cursor);
+	cursor = chunk->begin();
+	limit = chunk->end();
+	nextChunkSize = min(nextChunkSize * 2, MaxChunkSize);
+	return allocateBytes(size, alignment);
+}
+
+void DumbAllocator::flushStatistics()
+{
+	ArenaKilobytesAllocated += static_cast<unsigned>(bytesAllocated / 1024);
+	ArenaKilobytesWasted += static_cast<unsigned>(bytesWasted / 1024);
+	ArenaKilobytesReserved += static_cast<unsigned>(bytesReserved / 1024);
+	bytesAllocated %= 1024;
+	bytesWasted %= 1024;
+	bytesReserved %= 1024;
+}
+
+DumbAllocator::~DumbAllocator()
+{
+	flushStatistics();
+	while (chunks != nullptr)
+	{
+		Chunk* next = chunks->next;
+		destroyChunk(chunks);
+		chunks = next;
+	}
+}
+
+void DumbAllocator::clear()
+{
+	flushStatistics();
+	
+	// The current chunk is the biggest one that isn't dedicated to a single object. Keep it, unless only dedicated
+	// chunks were ever created.
+	Chunk* kept = cursor == nullptr ? nullptr : chunks;
+	Chunk* chunk = kept == nullptr ? chunks : kept->next;
+	while (chunk != nullptr)
+	{
+		Chunk* next = chunk->next;
+		destroyChunk(chunk);
+		chunk = next;
+	}
+	
+	chunks = kept;
+	if (kept != nullptr)
+	{
+		kept->next = nullptr;
+		cursor = kept->begin();
+	}
+}
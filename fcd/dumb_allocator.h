@@ -20,7 +20,6 @@
 #include <cassert>
 #include <cstddef>
 #include <iterator>
-#include <list>
 #include <memory>
 #include <cstring>
 #include <type_traits>
@@ -30,82 +29,80 @@
 // This class provides a fast, stack-like allocation mechanism. It's a lot faster than using a raw `new` for every
 // small object we create, and a lot easier to manage: since the objects are enforced to be trivially destructible,
 // we can just deallocate everything in bulk.
-// On the other hand, it can lead to a small amount of wasted memory (though that should be much much smaller than
-// the equivalent overhead would we be to allocate everything with `new`).
+// Memory comes from chunks that double in size up to MaxChunkSize, each starting with an intrusive header that links
+// it to the previous one, so that big functions don't cost one heap node per page. Objects that are too big for the
+// current chunk's growth get a chunk of their own. Allocated and wasted bytes are reported through LLVM statistics.
+// Any power-of-two alignment is supported. Chunks that allocators release are cached per thread and handed to the
+// next allocators that need a chunk of the same size, so that pools that are created and destroyed over and over
+// (one per function, for instance) don't go back to malloc every time.
 class DumbAllocator
 {
-	static constexpr size_t DefaultPageSize = 0x1000 - 0x20;
-	static constexpr size_t HalfPageSize = DefaultPageSize / 2;
-	
-	std::list<std::unique_ptr<char[]>> pool;
-	size_t offset;
-	
-	inline char* allocateSmall(size_t size, size_t alignment)
+	struct Chunk
 	{
-		auto& lastPage = pool.back();
-		uintptr_t endOffset = reinterpret_cast<uintptr_t>(&lastPage[offset]);
-		size_t realSize = size + ((endOffset - size) & (alignment - 1));
+		Chunk* next;
+		size_t size; // including this header
+		bool mapped; // comes from mmap instead of malloc
 		
-		if (offset < realSize)
+		char* begin() { return reinterpret_cast<char*>(this + 1); }
+		char* end() { return reinterpret_cast<char*>(this) + size; }
+	};
+	
+	static constexpr size_t FirstChunkSize = 0x1000;
+	static constexpr size_t MaxChunkSize = 0x200000;
+	static bool useHugePages;
+	
+	struct ChunkCache;
+	static ChunkCache& chunkCache();
+	
+	Chunk* chunks; // current chunk first
+	char* cursor;
+	char* limit;
+	size_t nextChunkSize;
+	size_t bytesAllocated;
+	size_t bytesWasted;
+	size_t bytesReserved;
+	
+	static Chunk* createChunk(size_t size);
+	static void destroyChunk(Chunk* chunk);
+	char* allocateSlow(size_t size, size_t alignment);
+	void flushStatistics();
+	
+	inline char* allocateBytes(size_t size, size_t alignment)
+	{
+		assert((alignment & (alignment - 1)) == 0);
+		size_t padding = (alignment - (reinterpret_cast<uintptr_t>(cursor) & (alignment - 1))) & (alignment - 1);
+		if (size + padding <= size_t(limit - cursor))
 		{
-			char* bytes = new char[DefaultPageSize];
-			pool.emplace_back(bytes);
-			offset = DefaultPageSize;
-			
-			endOffset = reinterpret_cast<uintptr_t>(&bytes[offset]);
-			realSize = size + ((endOffset - size) & (alignment - 1));
-			assert(realSize <= offset);
+			char* result = cursor + padding;
+			cursor = result + size;
+			bytesAllocated += size;
+			bytesWasted += padding;
+			return result;
 		}
-		
-		offset -= realSize;
-		char* result = &pool.back()[offset];
-		assert((reinterpret_cast<uintptr_t>(result) & (alignment - 1)) == 0);
-		return result;
-	}
-	
-	inline char* allocateLarge(size_t size, size_t alignment)
-	{
-		char* bytes = nullptr;
-		if (alignment <= alignof(std::max_align_t))
-		{
-			bytes = new char[size];
-		}
-		else
-		{
-			assert(false && "not implemented");
-			return nullptr;
-		}
-		pool.emplace_front(bytes);
-		return pool.front().get();
+		return allocateSlow(size, alignment);
 	}
 	
 public:
-	inline DumbAllocator() : offset(0)
+	// Chunks of MaxChunkSize bytes are backed by transparent huge pages where the system supports it. This should be
+	// set before any allocation is made.
+	static void setUseHugePages(bool use) { useHugePages = use; }
+	
+	inline DumbAllocator()
+	: chunks(nullptr), cursor(nullptr), limit(nullptr), nextChunkSize(FirstChunkSize), bytesAllocated(0), bytesWasted(0), bytesReserved(0)
 	{
-		pool.push_back(nullptr);
 	}
 	
 	DumbAllocator(const DumbAllocator&) = delete;
+	~DumbAllocator();
 	
-	inline void clear()
-	{
-		pool.clear();
-		offset = 0;
-	}
-	
-	template<typename T, typename... TParams>
-	typename std::enable_if<sizeof(T) < HalfPageSize && std::is_trivially_destructible<T>::value, T>::type*
-	allocate(TParams&&... params)
-	{
-		char* address = allocateSmall(sizeof(T), alignof(T));
-		return new (address) T(params...);
-	}
+	// Deallocates everything, but keeps the current chunk to serve the next allocations.
+	void clear();
 	
 	template<typename T, typename... TParams>
-	typename std::enable_if<sizeof(T) >= HalfPageSize && std::is_trivially_destructible<T>::value, T>::type*
+	typename std::enable_if<std::is_trivially_destructible<T>::value, T>::type*
 	allocate(TParams&&... params)
 	{
-		char* address = allocateLarge(sizeof(T), alignof(T));
+		char* address = allocateBytes(sizeof(T), alignof(T));
 		return new (address) T(params...);
 	}
 	
@@ -118,12 +115,7 @@ public:
 			assert(false);
 			return nullptr;
 		}
-		
-		if (totalSize < HalfPageSize)
-		{
-			return new (allocateSmall(totalSize, alignment)) T[count];
-		}
-		return new (allocateLarge(totalSize, alignment)) T[count];
+		return new (allocateBytes(totalSize, alignment)) T[count];
 	}
 	
 	char* copyString(const char* begin, const char* end)
@@ -149,51 +141,30 @@ public:
 
 // PooledDeque needs to be a separate class because it is trivially destructible. It would be simpler if we could use
 // deque<T, Allocator> instead, but we live in a sad world.
+// Elements live in buffers that double in size, so that the buffer and the position of an element follow from its
+// index: indexing is constant-time, and iterating walks contiguous memory. Buffers are never moved or resized, so
+// elements keep their address as the deque grows.
 
-template<typename T>
-struct PooledDequeBuffer
+template<typename T, typename TDeque>
+class PooledDequeIterator : public std::iterator<std::input_iterator_tag, T, void>
 {
-	PooledDequeBuffer<T>* prev;
-	PooledDequeBuffer<T>* next;
-	size_t count;
-	size_t used;
-	T* pointer;
-	
-	PooledDequeBuffer()
-	: prev(nullptr), next(nullptr), count(0), used(0), pointer(nullptr)
-	{
-	}
+	TDeque* deque;
+	size_t index;
 	
-	PooledDequeBuffer(DumbAllocator& pool, PooledDequeBuffer<T>* prev, size_t count)
-	: prev(prev), next(nullptr), count(count), used(0)
+	bool atEnd() const
 	{
-		if (prev != nullptr)
-		{
-			prev->next = this;
-		}
-		pointer = pool.allocateDynamic<T>(count);
+		return deque == nullptr || index >= deque->size();
 	}
-};
-
-template<typename T>
-class PooledDequeIterator : public std::iterator<std::input_iterator_tag, T, void>
-{
-	PooledDequeBuffer<T>* buffer;
-	size_t index;
 	
 public:
-	PooledDequeIterator(PooledDequeBuffer<T>* buffer)
-	: buffer(buffer), index(0)
+	PooledDequeIterator(TDeque* deque, size_t index)
+	: deque(deque), index(index)
 	{
-		if (this->buffer != nullptr && this->buffer->used == 0)
-		{
-			this->buffer = nullptr;
-		}
 	}
 	
 	inline T& operator*()
 	{
-		return buffer->pointer[index];
+		return (*deque)[index];
 	}
 	
 	inline T* operator->()
@@ -201,30 +172,25 @@ public:
 		return &operator*();
 	}
 	
-	inline bool operator==(const PooledDequeIterator<T>& that) const
+	// The end iterator doesn't belong to a deque, so that elements that are added during iteration are visited.
+	inline bool operator==(const PooledDequeIterator<T, TDeque>& that) const
 	{
-		return buffer == that.buffer && index == that.index;
+		bool end = atEnd();
+		return end == that.atEnd() && (end || (deque == that.deque && index == that.index));
 	}
 	
-	inline bool operator!=(const PooledDequeIterator<T>& that) const
+	inline bool operator!=(const PooledDequeIterator<T, TDeque>& that) const
 	{
 		return !(*this == that);
 	}
 	
-	inline PooledDequeIterator<T>& operator++()
+	inline PooledDequeIterator<T, TDeque>& operator++()
 	{
 		index++;
-		// This can happen at most 2 times. If it happens a second time, it'll set the iterator to the end iterator
-		// value.
-		while (buffer != nullptr && index == buffer->used)
-		{
-			buffer = buffer->next;
-			index = 0;
-		}
 		return *this;
 	}
 	
-	inline PooledDequeIterator<T> operator++(int)
+	inline PooledDequeIterator<T, TDeque> operator++(int)
 	{
 		auto copy = *this;
 		operator++();
@@ -237,55 +203,71 @@ class PooledDeque
 {
 	static_assert(std::is_trivially_destructible<T>::value, "type needs to be trivially destructible");
 	
-	static PooledDequeBuffer<T> empty;
+	static constexpr size_t FirstBufferSize = 8;
+	static constexpr size_t MaxBuffers = 48;
 	
 	DumbAllocator& pool;
-	PooledDequeBuffer<T>* first;
-	PooledDequeBuffer<T>* last;
+	T* firstBuffer;
+	// Buffer i holds FirstBufferSize << i elements. The table is only allocated once a second buffer is needed, so
+	// short deques (most sequences and scopes) cost a single allocation.
+	T** buffers;
+	size_t count;
+	size_t capacity;
 	
-	void newBufferIfNeeded()
+	static size_t bufferOf(size_t index)
 	{
-		if (last->used == last->count)
-		{
-			size_t allocCount = last->count;
-			allocCount += last->prev == nullptr ? 5 : last->prev->count;
-			if (last == &empty)
-			{
-				last = pool.template allocate<PooledDequeBuffer<T>>(pool, nullptr, allocCount);
-				first = last;
-			}
-			else
-			{
-				last = pool.template allocate<PooledDequeBuffer<T>>(pool, last, allocCount);
-			}
-		}
+		unsigned long long position = index / FirstBufferSize + 1;
+		return static_cast<size_t>(63 - __builtin_clzll(position));
 	}
 	
-	PooledDequeBuffer<T>* seek(size_t index, size_t& indexInBuffer)
+	static size_t bufferStart(size_t buffer)
 	{
-		return const_cast<PooledDequeBuffer<T>*>(static_cast<const PooledDeque<T>*>(this)->seek(index, indexInBuffer));
+		return FirstBufferSize * ((size_t(1) << buffer) - 1);
 	}
 	
-	const PooledDequeBuffer<T>* seek(size_t index, size_t& indexInBuffer) const
+	T& at(size_t index) const
 	{
-		auto buffer = first;
-		while (index >= buffer->used)
+		assert(index < count);
+		if (index < FirstBufferSize)
 		{
-			index -= buffer->used;
-			buffer = buffer->next;
+			return firstBuffer[index];
 		}
-		indexInBuffer = index;
-		return buffer;
+		size_t buffer = bufferOf(index);
+		return buffers[buffer][index - bufferStart(buffer)];
+	}
+	
+	void newBufferIfNeeded()
+	{
+		if (count < capacity)
+		{
+			return;
+		}
+		
+		if (firstBuffer == nullptr)
+		{
+			firstBuffer = pool.allocateDynamic<T>(FirstBufferSize);
+			capacity = FirstBufferSize;
+			return;
+		}
+		
+		if (buffers == nullptr)
+		{
+			buffers = pool.allocateDynamic<T*>(MaxBuffers);
+			buffers[0] = firstBuffer;
+		}
+		size_t buffer = bufferOf(capacity);
+		assert(buffer < MaxBuffers);
+		buffers[buffer] = pool.allocateDynamic<T>(FirstBufferSize << buffer);
+		capacity += FirstBufferSize << buffer;
 	}
 	
 public:
-	typedef PooledDequeIterator<T> iterator;
-	typedef PooledDequeIterator<const T> const_iterator;
+	typedef PooledDequeIterator<T, PooledDeque<T>> iterator;
+	typedef PooledDequeIterator<const T, const PooledDeque<T>> const_iterator;
 	
 	PooledDeque(DumbAllocator& pool)
-	: pool(pool)
+	: pool(pool), firstBuffer(nullptr), buffers(nullptr), count(0), capacity(0)
 	{
-		clear();
 	}
 	
 	DumbAllocator& getPool() { return pool; }
@@ -293,8 +275,7 @@ public:
 	void push_back(const T& item)
 	{
 		newBufferIfNeeded();
-		last->pointer[last->used] = item;
-		last->used++;
+		at(count++) = item;
 	}
 	
 	template<typename TIter>
@@ -313,7 +294,7 @@ public:
 	
 	void insert(iterator at, T&& item)
 	{
-		T displaced = move(item);
+		T displaced = std::move(item);
 		auto end = this->end();
 		while (at != end)
 		{
@@ -323,78 +304,39 @@ public:
 		push_back(displaced);
 	}
 	
+	// Buffers are kept for the elements that are added next.
 	void clear()
 	{
-		first = &empty;
-		last = first;
+		count = 0;
 	}
 	
 	size_t size() const
 	{
-		size_t count = 0;
-		auto buffer = first;
-		while (buffer != nullptr)
-		{
-			count += buffer->used;
-			buffer = buffer->next;
-		}
 		return count;
 	}
 	
-	// This implementation potentially wastes some space in return for speed.
 	void erase_at(size_t index)
 	{
-		size_t indexInBuffer;
-		auto buffer = seek(index, indexInBuffer);
-		
-		buffer->used--;
-		if (buffer->used == 0)
-		{
-			// push buffer back to end of list, if it's not there already.
-			if (auto next = buffer->next)
-			{
-				next->prev = buffer->prev;
-				if (auto prev = buffer->prev)
-				{
-					prev->next = next;
-				}
-				else
-				{
-					first = next;
-				}
-				last->next = buffer;
-				buffer->prev = last;
-				buffer->next = nullptr;
-				last = buffer;
-			}
-		}
-		else
+		for (size_t i = index + 1; i < count; i++)
 		{
-			for (size_t i = indexInBuffer; i < buffer->used; i++)
-			{
-				buffer->pointer[i] = buffer->pointer[i + 1];
-			}
+			at(i - 1) = at(i);
 		}
+		count--;
 	}
 	
 	T& front()
 	{
-		return first->pointer[0];
+		return at(0);
 	}
 	
 	T& back()
 	{
-		auto buffer = last;
-		while (buffer->used == 0)
-		{
-			buffer = buffer->prev;
-		}
-		return buffer->pointer[buffer->used - 1];
+		return at(count - 1);
 	}
 	
 	T* back_or_null()
 	{
-		if (first->used > 0)
+		if (count > 0)
 		{
 			return &back();
 		}
@@ -403,17 +345,17 @@ public:
 	
 	const_iterator cbegin() const
 	{
-		return const_iterator(reinterpret_cast<PooledDequeBuffer<const T>*>(first));
+		return const_iterator(this, 0);
 	}
 	
 	const_iterator cend() const
 	{
-		return const_iterator(nullptr);
+		return const_iterator(nullptr, 0);
 	}
 	
 	iterator begin()
 	{
-		return iterator(first);
+		return iterator(this, 0);
 	}
 	
 	const_iterator begin() const
@@ -423,7 +365,7 @@ public:
 	
 	iterator end()
 	{
-		return PooledDequeIterator<T>(nullptr);
+		return iterator(nullptr, 0);
 	}
 	
 	const_iterator end() const
@@ -433,18 +375,13 @@ public:
 	
 	const T& operator[](size_t index) const
 	{
-		size_t indexInBuffer;
-		auto buffer = seek(index, indexInBuffer);
-		return buffer->pointer[indexInBuffer];
+		return at(index);
 	}
 	
 	T& operator[](size_t index)
 	{
-		return const_cast<T&>(static_cast<const PooledDeque<T>*>(this)->operator[](index));
+		return at(index);
 	}
 };
 
-template<typename T>
-PooledDequeBuffer<T> PooledDeque<T>::empty = PooledDequeBuffer<T>();
-
 #endif /* fcd__dumb_allocator_h */
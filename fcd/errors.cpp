@@ -39,11 +39,17 @@ namespace
 		ERROR_MESSAGE(Main_NoEntryPoint, "no entry point (see --help)"),
 		ERROR_MESSAGE(Main_DecompilationError, "decompiler error"),
 		ERROR_MESSAGE(Main_HeaderParsingError, "header file parsing error"),
+		ERROR_MESSAGE(Main_SignatureDatabaseError, "signature database error"),
 		
 		ERROR_MESSAGE(Python_LoadError, "couldn't load Python script"),
 		ERROR_MESSAGE(Python_InvalidPassFunction, "run function should accept a single argument"),
 		ERROR_MESSAGE(Python_PassTypeConfusion, "Python pass must declare exactly one of runOnFunction or runOnModule"),
 		ERROR_MESSAGE(Python_ExecutableScriptInitializationError, "Python script failed to initialize correctly"),
+		
+		ERROR_MESSAGE(Plugin_LoadError, "couldn't load plugin"),
+		ERROR_MESSAGE(Plugin_MissingEntryPoint, "plugin doesn't name its pass with FCD_PLUGIN_PASS"),
+		ERROR_MESSAGE(Plugin_VersionMismatch, "plugin was built for another version of the fcd plugin API"),
+		ERROR_MESSAGE(Plugin_NoPass, "plugin didn't create a pass"),
 	};
 	
 	static_assert(countof(errorMessages) == static_cast<size_t>(FcdError::MaxError), "missing error strings");
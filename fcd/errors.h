@@ -42,12 +42,18 @@ enum class FcdError
 	Main_NoEntryPoint,
 	Main_DecompilationError,
 	Main_HeaderParsingError,
+	Main_SignatureDatabaseError,
 	
 	Python_LoadError,
 	Python_InvalidPassFunction,
 	Python_PassTypeConfusion,
 	Python_ExecutableScriptInitializationError,
 	
+	Plugin_LoadError,
+	Plugin_MissingEntryPoint,
+	Plugin_VersionMismatch,
+	Plugin_NoPass,
+	
 	MaxError,
 };
 
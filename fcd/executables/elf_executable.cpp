@@ -17,8 +17,12 @@
 #include <llvm/Support/raw_ostream.h>
 
 #include <array>
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstring>
 #include <deque>
+#include <mutex>
 #include <unordered_map>
 
 using namespace llvm;
@@ -115,6 +119,13 @@ namespace
 	{
 		PT_LOAD = 1,
 		PT_DYNAMIC = 2,
+		PT_GNU_EH_FRAME = 0x6474e550,
+	};
+
+	enum ElfPhdrFlags
+	{
+		PF_X = 1,
+		PF_W = 2,
 	};
 
 	enum ElfShdrType
@@ -136,9 +147,11 @@ namespace
 		DT_STRTAB = 5,
 		DT_SYMTAB = 6,
 		DT_RELA = 7,
+		DT_RELASZ = 8,
 		DT_INIT = 12,
 		DT_FINI = 13,
 		DT_REL = 17,
+		DT_RELSZ = 18,
 		DT_PLTREL = 20,
 		DT_JMPREL = 23,
 		DT_INIT_ARRAY = 25,
@@ -150,11 +163,130 @@ namespace
 		DT_MAX = 34,
 	};
 
+	// The relocations that bind a symbol to an address have the same numbers on x86 and x86_64.
+	enum ElfRelocationType
+	{
+		R_ABSOLUTE = 1, // R_386_32, R_X86_64_64
+		R_GLOB_DAT = 6,
+		R_JUMP_SLOT = 7,
+	};
+	
+	const uint16_t SHN_UNDEF = 0;
+
+	// Pointer encodings of .eh_frame_hdr. Only the fixed-size ones can appear in its search table.
+	enum DwarfPointerEncoding
+	{
+		DW_EH_PE_absptr = 0x00,
+		DW_EH_PE_udata2 = 0x02,
+		DW_EH_PE_udata4 = 0x03,
+		DW_EH_PE_udata8 = 0x04,
+		DW_EH_PE_sdata2 = 0x0a,
+		DW_EH_PE_sdata4 = 0x0b,
+		DW_EH_PE_sdata8 = 0x0c,
+		DW_EH_PE_pcrel = 0x10,
+		DW_EH_PE_datarel = 0x30,
+		DW_EH_PE_omit = 0xff,
+	};
+	
+	// Reads a pointer encoded as described by encoding at cursor, which is at virtual address cursorAddress, and moves
+	// cursor past it. Data-relative values are relative to dataAddress.
+	bool readEncodedPointer(const uint8_t*& cursor, const uint8_t* end, uint8_t encoding, size_t pointerSize, uint64_t cursorAddress, uint64_t dataAddress, uint64_t& result)
+	{
+		size_t size;
+		bool isSigned = false;
+		switch (encoding & 0x0f)
+		{
+			case DW_EH_PE_absptr: size = pointerSize; break;
+			case DW_EH_PE_udata2: size = 2; break;
+			case DW_EH_PE_udata4: size = 4; break;
+			case DW_EH_PE_udata8: size = 8; break;
+			case DW_EH_PE_sdata2: size = 2; isSigned = true; break;
+			case DW_EH_PE_sdata4: size = 4; isSigned = true; break;
+			case DW_EH_PE_sdata8: size = 8; isSigned = true; break;
+			default: return false;
+		}
+		
+		if (end < cursor || static_cast<size_t>(end - cursor) < size)
+		{
+			return false;
+		}
+		
+		// Values are in the executable's byte order, which is the host's.
+		uint64_t value = 0;
+		switch (size)
+		{
+			case 2: { uint16_t v; memcpy(&v, cursor, size); value = isSigned ? static_cast<uint64_t>(static_cast<int16_t>(v)) : v; break; }
+			case 4: { uint32_t v; memcpy(&v, cursor, size); value = isSigned ? static_cast<uint64_t>(static_cast<int32_t>(v)) : v; break; }
+			default: memcpy(&value, cursor, size); break;
+		}
+		
+		switch (encoding & 0x70)
+		{
+			case 0: break;
+			case DW_EH_PE_pcrel: value += cursorAddress; break;
+			case DW_EH_PE_datarel: value += dataAddress; break;
+			default: return false;
+		}
+		
+		cursor += size;
+		result = pointerSize == 4 ? static_cast<uint32_t>(value) : value;
+		return true;
+	}
+	
+	// Start addresses of the functions that have unwind information, from the binary search table of .eh_frame_hdr.
+	// The table is sorted and lists every FDE of .eh_frame, which compilers emit for nearly every function, so this
+	// finds functions of stripped executables without disassembling anything.
+	vector<uint64_t> readEhFrameHeaderTable(const uint8_t* header, const uint8_t* end, uint64_t headerAddress, size_t pointerSize)
+	{
+		vector<uint64_t> result;
+		if (header == nullptr || end < header || end - header < 4 || header[0] != 1)
+		{
+			return result;
+		}
+		
+		uint8_t ehFramePointerEncoding = header[1];
+		uint8_t countEncoding = header[2];
+		uint8_t tableEncoding = header[3];
+		const uint8_t* cursor = header + 4;
+		
+		uint64_t ehFrame;
+		uint64_t count;
+		if (ehFramePointerEncoding == DW_EH_PE_omit || countEncoding == DW_EH_PE_omit || tableEncoding == DW_EH_PE_omit)
+		{
+			return result;
+		}
+		if (!readEncodedPointer(cursor, end, ehFramePointerEncoding, pointerSize, headerAddress + (cursor - header), headerAddress, ehFrame))
+		{
+			return result;
+		}
+		if (!readEncodedPointer(cursor, end, countEncoding, pointerSize, headerAddress + (cursor - header), headerAddress, count))
+		{
+			return result;
+		}
+		
+		// Each entry is the initial location of a function and the address of its FDE.
+		result.reserve(min<uint64_t>(count, static_cast<uint64_t>(end - cursor) / 4));
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			uint64_t location;
+			uint64_t fde;
+			if (!readEncodedPointer(cursor, end, tableEncoding, pointerSize, headerAddress + (cursor - header), headerAddress, location)
+				|| !readEncodedPointer(cursor, end, tableEncoding, pointerSize, headerAddress + (cursor - header), headerAddress, fde))
+			{
+				break;
+			}
+			result.push_back(location);
+		}
+		return result;
+	}
+
 	struct Segment
 	{
 		uint64_t vbegin;
 		uint64_t vend;
 		const uint8_t* fbegin;
+		bool writable;
+		bool executable;
 	};
 
 	template<typename Types>
@@ -197,15 +329,65 @@ namespace
 		struct Elf_Rel;
 		struct Elf_Rela;
 		
+		// Sorted and non-overlapping. When program headers overlap, the last one wins.
 		vector<Segment> segments;
-		unordered_map<uint64_t, string> stubTargets;
+		mutable atomic<size_t> lastHit;
+		
+		// Symbol tables and relocations are only walked when symbols or stub targets are first needed. The input is
+		// memory-mapped, so the pages of sections that are never needed are never read.
+		bool hasEntryPoint;
+		uint64_t entryPoint;
+		array<const Elf_Dynamic*, DT_MAX> dynEnt;
+		deque<const Elf_Shdr*> sections;
+		deque<const Elf_Shdr*> symtabs;
+		size_t sectionNamesIndex;
+		uint64_t ehFrameHeaderAddress;
+		
+		bool isInPltSection(uint64_t address) const;
+		void addStubTargets(const uint8_t* symtab, const uint8_t* strtab, uint64_t relocAddress, uint64_t relocSize, uint64_t entrySize);
+		
+		void addSegment(const Segment& segment)
+		{
+			if (segment.vbegin >= segment.vend)
+			{
+				return;
+			}
+			
+			vector<Segment> result;
+			for (const Segment& piece : segments)
+			{
+				if (piece.vend <= segment.vbegin || piece.vbegin >= segment.vend)
+				{
+					result.push_back(piece);
+					continue;
+				}
+				
+				// Keep whatever sticks out on either side.
+				if (piece.vbegin < segment.vbegin)
+				{
+					result.push_back({ piece.vbegin, segment.vbegin, piece.fbegin, piece.writable, piece.executable });
+				}
+				if (piece.vend > segment.vend)
+				{
+					result.push_back({ segment.vend, piece.vend, piece.fbegin + (segment.vend - piece.vbegin), piece.writable, piece.executable });
+				}
+			}
+			result.push_back(segment);
+			sort(result.begin(), result.end(), [](const Segment& a, const Segment& b)
+			{
+				return a.vbegin < b.vbegin;
+			});
+			segments = move(result);
+			lastHit = 0;
+		}
 		
 	public:
 		static ErrorOr<unique_ptr<ElfExecutable<Types>>> parse(const uint8_t* begin, const uint8_t* end);
 		
 		ElfExecutable(const uint8_t* begin, const uint8_t* end)
-		: Executable(begin, end)
+		: Executable(begin, end), lastHit(0), hasEntryPoint(false), entryPoint(0), sectionNamesIndex(0), ehFrameHeaderAddress(0)
 		{
+			dynEnt.fill(nullptr);
 		}
 		
 		virtual string getExecutableType() const override
@@ -220,28 +402,82 @@ namespace
 			return type;
 		}
 		
-		virtual const uint8_t* map(uint64_t address) const override
+		const Segment* findSegment(uint64_t address) const
 		{
-			for (auto iter = segments.rbegin(); iter != segments.rend(); iter++)
+			// Consecutive lookups (like decoding a function) tend to hit the same segment.
+			size_t hint = lastHit.load(memory_order_relaxed);
+			if (hint < segments.size() && address >= segments[hint].vbegin && address < segments[hint].vend)
+			{
+				return &segments[hint];
+			}
+			
+			auto iter = upper_bound(segments.begin(), segments.end(), address, [](uint64_t value, const Segment& segment)
 			{
-				if (address >= iter->vbegin && address < iter->vend)
+				return value < segment.vbegin;
+			});
+			
+			if (iter != segments.begin())
+			{
+				--iter;
+				if (address < iter->vend)
 				{
-					return iter->fbegin + (address - iter->vbegin);
+					lastHit.store(static_cast<size_t>(iter - segments.begin()), memory_order_relaxed);
+					return &*iter;
 				}
 			}
 			return nullptr;
 		}
 		
-		virtual StubTargetQueryResult doGetStubTarget(uint64_t address, string& libraryName, string& into) const override
+		virtual const uint8_t* map(uint64_t address) const override
+		{
+			if (const Segment* segment = findSegment(address))
+			{
+				return segment->fbegin + (address - segment->vbegin);
+			}
+			return nullptr;
+		}
+		
+		virtual bool getSegment(uint64_t address, SegmentInfo& info) const override
+		{
+			if (const Segment* segment = findSegment(address))
+			{
+				info.begin = segment->vbegin;
+				info.end = segment->vend;
+				info.writable = segment->writable;
+				return true;
+			}
+			return false;
+		}
+		
+		virtual vector<SegmentInfo> getExecutableSegments() const override
+		{
+			vector<SegmentInfo> result;
+			for (const Segment& segment : segments)
+			{
+				if (segment.executable)
+				{
+					result.push_back({ segment.vbegin, segment.vend, segment.writable });
+				}
+			}
+			return result;
+		}
+		
+		virtual vector<SegmentInfo> getReadOnlySegments() const override
 		{
-			auto iter = stubTargets.find(address);
-			if (iter != stubTargets.end())
+			vector<SegmentInfo> result;
+			for (const Segment& segment : segments)
 			{
-				into = iter->second;
-				return ResolvedInFlatNamespace;
+				if (!segment.writable)
+				{
+					result.push_back({ segment.vbegin, segment.vend, segment.writable });
+				}
 			}
-			return Unresolved;
+			return result;
 		}
+		
+	protected:
+		virtual void loadSymbols() override;
+		virtual bool loadStubTargets() override;
 	};
 
 	template<>
@@ -388,8 +624,6 @@ namespace
 		auto executable = make_unique<ElfExecutable<Types>>(begin, end);
 		
 		deque<const Elf_Phdr*> dynamics;
-		deque<const Elf_Shdr*> sections;
-		deque<const Elf_Shdr*> symtabs;
 		
 		// Walk header, identify PT_LOAD and PT_DYNAMIC segments, sections, and symbol tables.
 		bool loadAtZero = false;
@@ -411,7 +645,9 @@ namespace
 								seg.vbegin = ph.vaddr;
 								seg.vend = endAddress;
 								seg.fbegin = fileLoc.begin();
-								executable->segments.push_back(seg);
+								seg.writable = (ph.flags & PF_W) != 0;
+								seg.executable = (ph.flags & PF_X) != 0;
+								executable->addSegment(seg);
 								loadAtZero |= seg.vbegin == 0;
 							}
 						}
@@ -420,31 +656,34 @@ namespace
 					{
 						dynamics.push_back(&ph);
 					}
+					else if (ph.type == PT_GNU_EH_FRAME)
+					{
+						executable->ehFrameHeaderAddress = ph.vaddr;
+					}
 				}
 			}
 			
 			if (eh->shentsize == sizeof (Elf_Shdr))
 			{
+				executable->sectionNamesIndex = eh->shstrndx;
 				for (const auto& sh : bounded_cast<Elf_Shdr>(begin, end, eh->shoff, eh->shnum))
 				{
-					sections.push_back(&sh);
+					executable->sections.push_back(&sh);
 					if (sh.type == SHT_SYMTAB)
 					{
-						symtabs.push_back(&sh);
+						executable->symtabs.push_back(&sh);
 					}
 				}
 			}
 			
 			if (eh->entry != 0 || loadAtZero)
 			{
-				executable->getSymbol(eh->entry).virtualAddress = eh->entry;
+				executable->hasEntryPoint = true;
+				executable->entryPoint = eh->entry;
 			}
 		}
 		
 		// Walk dynamic segments.
-		array<const Elf_Dynamic*, DT_MAX> dynEnt;
-		dynEnt.fill(nullptr);
-		
 		for (const auto* dynHeader : dynamics)
 		{
 			size_t numEnts = dynHeader->filesz / sizeof (Elf_Dynamic);
@@ -452,11 +691,34 @@ namespace
 			{
 				if (dyn.tag < DT_MAX)
 				{
-					dynEnt[dyn.tag] = &dyn;
+					executable->dynEnt[dyn.tag] = &dyn;
 				}
 			}
 		}
 		
+		return move(executable);
+	}
+	
+	template<typename Types>
+	void ElfExecutable<Types>::loadSymbols()
+	{
+		// This runs under Executable's once flag, so it can't go through getVisibleSymbols to find which symbols it
+		// created.
+		vector<uint64_t> addresses;
+		auto addSymbol = [&](uint64_t address) -> SymbolInfo&
+		{
+			addresses.push_back(address);
+			auto& symInfo = getSymbol(address);
+			symInfo.virtualAddress = address;
+			return symInfo;
+		};
+		
+		const uint8_t* end = this->end();
+		if (hasEntryPoint)
+		{
+			addSymbol(entryPoint);
+		}
+		
 		EntryPointArrayInfo arrayInfo[] = {
 			{DT_PREINIT_ARRAY, DT_PREINIT_ARRAYSZ, "preinit_"},
 			{DT_INIT_ARRAY, DT_INIT_ARRAYSZ, "init_"},
@@ -470,11 +732,10 @@ namespace
 			{
 				size_t counter = 0;
 				const string& prefix = arrayData.name;
-				for (addr entry : bounded_cast<addr>(begin, end, arrayLocation->address, arraySize->address))
+				for (addr entry : bounded_cast<addr>(begin(), end, arrayLocation->address, arraySize->address))
 				{
-					auto& symInfo = executable->getSymbol(entry);
-					symInfo.virtualAddress = entry;
-					raw_string_ostream(symInfo.name) << prefix << counter;
+					auto& symInfo = addSymbol(entry);
+					symInfo.name = saveString(prefix + to_string(counter));
 					counter++;
 				}
 			}
@@ -489,36 +750,20 @@ namespace
 			auto location = dynEnt[pair.first];
 			if (location != nullptr)
 			{
-				auto& symInfo = executable->getSymbol(location->address);
-				symInfo.virtualAddress = location->address;
-				symInfo.name = pair.second;
+				auto& symInfo = addSymbol(location->address);
+				symInfo.name = saveString(pair.second);
 			}
 		}
 		
-		// Check relocations to put a name on relocated entries.
-		// I usually do explicit checks against nullptr for pointers but there are quite a few to check here.
-		if (dynEnt[DT_JMPREL] && dynEnt[DT_PLTRELSZ] && dynEnt[DT_PLTREL] && dynEnt[DT_STRTAB] && dynEnt[DT_SYMTAB])
+		// Functions that have unwind information. The PLT has some too, but its entries are stubs and not functions.
+		// Unwind information has no names, so this goes before the symbol tables.
+		if (ehFrameHeaderAddress != 0)
 		{
-			const uint8_t* relocBase = executable->map(dynEnt[DT_JMPREL]->address);
-			const uint8_t* symtab = executable->map(dynEnt[DT_SYMTAB]->address);
-			const uint8_t* strtab = executable->map(dynEnt[DT_STRTAB]->address);
-			ElfDynamicTag relType = static_cast<ElfDynamicTag>(dynEnt[DT_PLTREL]->value);
-			if (relocBase && symtab && strtab && (relType == DT_REL || relType == DT_RELA))
+			for (uint64_t address : readEhFrameHeaderTable(map(ehFrameHeaderAddress), end, ehFrameHeaderAddress, Types::bits / 8))
 			{
-				uint64_t relocSize = relType == DT_REL ? sizeof (Elf_Rel) : sizeof (Elf_Rela);
-				uint64_t relocMax = dynEnt[DT_PLTRELSZ]->value;
-				
-				// Fortunately, Elf_Rela is merely an extension of Elf_Rel and we can treat both as Elf_Rel as long as
-				// we correctly increment the pointer.
-				for (uint64_t relocIter = 0; relocIter < relocMax; relocIter += relocSize)
+				if (!isInPltSection(address))
 				{
-					if (const auto* reloc = bounded_cast<Elf_Rel>(relocBase, end, relocIter))
-					if (const auto* symbol = bounded_cast<Elf_Sym>(symtab, end, sizeof (Elf_Sym) * reloc->symbol()))
-					if (const char* nameBegin = bounded_cast<char>(strtab, end, symbol->name))
-					{
-						const char* nameEnd = nameBegin + strnlen(nameBegin, end - (const uint8_t*)nameBegin);
-						executable->stubTargets[reloc->offset] = string(nameBegin, nameEnd);
-					}
+					addSymbol(address);
 				}
 			}
 		}
@@ -538,12 +783,12 @@ namespace
 				auto strtabHeader = sections[sth->link];
 				if (strtabHeader->type == SHT_STRTAB)
 				{
-					strtab = bounded_cast<uint8_t>(begin, end, strtabHeader->offset);
+					strtab = bounded_cast<uint8_t>(begin(), end, strtabHeader->offset);
 				}
 			}
 			
 			size_t numEnts = sth->size / sizeof (Elf_Sym);
-			for (const auto& sym : bounded_cast<Elf_Sym>(begin, end, sth->offset, numEnts))
+			for (const auto& sym : bounded_cast<Elf_Sym>(begin(), end, sth->offset, numEnts))
 			{
 				// Exclude non-function symbols.
 				if ((sym.info & 0xf) != STT_FUNC)
@@ -563,26 +808,132 @@ namespace
 					nameEnd = nameBegin + strnlen(nameBegin, reinterpret_cast<const char*>(end) - nameBegin);
 				}
 				
-				auto& symInfo = executable->getSymbol(sym.value);
-				symInfo.virtualAddress = sym.value;
-				symInfo.name = string(nameBegin, nameEnd);
+				auto& symInfo = addSymbol(sym.value);
+				// Names point into the string table.
+				symInfo.name = StringRef(nameBegin, nameEnd - nameBegin);
 			}
 		}
 		
 		// Figure out file offset for symbols, remove those that don't have one.
-		for (auto entryPoint : executable->getVisibleEntryPoints())
+		for (auto address : addresses)
 		{
-			if (auto address = executable->map(entryPoint))
+			if (auto memory = map(address))
 			{
-				executable->getSymbol(entryPoint).memory = address;
+				getSymbol(address).memory = memory;
 			}
 			else
 			{
-				executable->eraseSymbol(entryPoint);
+				eraseSymbol(address);
 			}
 		}
+	}
+	
+	template<typename Types>
+	bool ElfExecutable<Types>::isInPltSection(uint64_t address) const
+	{
+		if (sectionNamesIndex == 0 || sectionNamesIndex >= sections.size())
+		{
+			return false;
+		}
 		
-		return move(executable);
+		const uint8_t* end = this->end();
+		const auto* namesHeader = sections[sectionNamesIndex];
+		for (const auto* section : sections)
+		{
+			if (address < section->addr || address - section->addr >= section->size)
+			{
+				continue;
+			}
+			
+			if (const char* nameBegin = bounded_cast<char>(begin(), end, namesHeader->offset + section->name))
+			{
+				// .plt, .plt.got and .plt.sec
+				StringRef name(nameBegin, strnlen(nameBegin, reinterpret_cast<const char*>(end) - nameBegin));
+				if (name == ".plt" || name.startswith(".plt."))
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+	
+	template<typename Types>
+	void ElfExecutable<Types>::addStubTargets(const uint8_t* symtab, const uint8_t* strtab, uint64_t relocAddress, uint64_t relocSize, uint64_t entrySize)
+	{
+		const uint8_t* end = this->end();
+		const uint8_t* relocBase = map(relocAddress);
+		if (relocBase == nullptr)
+		{
+			return;
+		}
+		
+		// Fortunately, Elf_Rela is merely an extension of Elf_Rel and we can treat both as Elf_Rel as long as we
+		// correctly increment the pointer.
+		for (uint64_t relocIter = 0; relocIter + entrySize <= relocSize; relocIter += entrySize)
+		{
+			const auto* reloc = bounded_cast<Elf_Rel>(relocBase, end, relocIter);
+			if (reloc == nullptr || reloc->symbol() == 0)
+			{
+				continue;
+			}
+			
+			const auto* symbol = bounded_cast<Elf_Sym>(symtab, end, sizeof (Elf_Sym) * reloc->symbol());
+			if (symbol == nullptr)
+			{
+				continue;
+			}
+			
+			// PLT slots and GOT entries always name an import. Absolute relocations also fill pointers to the
+			// executable's own symbols, which aren't stubs.
+			bool isImport = reloc->type() == R_JUMP_SLOT || reloc->type() == R_GLOB_DAT;
+			isImport |= reloc->type() == R_ABSOLUTE && symbol->shndx == SHN_UNDEF;
+			if (isImport)
+			if (const char* nameBegin = bounded_cast<char>(strtab, end, symbol->name))
+			{
+				const char* nameEnd = nameBegin + strnlen(nameBegin, end - (const uint8_t*)nameBegin);
+				if (nameEnd != nameBegin)
+				{
+					addStubTarget(reloc->offset, "", StringRef(nameBegin, nameEnd - nameBegin));
+				}
+			}
+		}
+	}
+	
+	template<typename Types>
+	bool ElfExecutable<Types>::loadStubTargets()
+	{
+		// Put a name on the entries that the dynamic loader fills with the address of an import: PLT slots, but also
+		// GOT entries that code calls or loads from directly (like with -fno-plt) and pointers in data.
+		// I usually do explicit checks against nullptr for pointers but there are quite a few to check here.
+		if (dynEnt[DT_STRTAB] && dynEnt[DT_SYMTAB])
+		{
+			const uint8_t* symtab = map(dynEnt[DT_SYMTAB]->address);
+			const uint8_t* strtab = map(dynEnt[DT_STRTAB]->address);
+			if (symtab && strtab)
+			{
+				if (dynEnt[DT_JMPREL] && dynEnt[DT_PLTRELSZ] && dynEnt[DT_PLTREL])
+				{
+					ElfDynamicTag relType = static_cast<ElfDynamicTag>(dynEnt[DT_PLTREL]->value);
+					if (relType == DT_REL || relType == DT_RELA)
+					{
+						uint64_t entrySize = relType == DT_REL ? sizeof (Elf_Rel) : sizeof (Elf_Rela);
+						addStubTargets(symtab, strtab, dynEnt[DT_JMPREL]->address, dynEnt[DT_PLTRELSZ]->value, entrySize);
+					}
+				}
+				if (dynEnt[DT_RELA] && dynEnt[DT_RELASZ])
+				{
+					addStubTargets(symtab, strtab, dynEnt[DT_RELA]->address, dynEnt[DT_RELASZ]->value, sizeof (Elf_Rela));
+				}
+				if (dynEnt[DT_REL] && dynEnt[DT_RELSZ])
+				{
+					addStubTargets(symtab, strtab, dynEnt[DT_REL]->address, dynEnt[DT_RELSZ]->value, sizeof (Elf_Rel));
+				}
+			}
+		}
+		
+		// Relocations are all that an ELF executable knows about its imports: other addresses aren't stubs.
+		return true;
 	}
 }
 
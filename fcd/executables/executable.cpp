@@ -18,6 +18,7 @@
 #include "flat_binary.h"
 #include "python_executable.h"
 
+#include <algorithm>
 #include <ctype.h>
 
 using namespace llvm;
@@ -178,48 +179,125 @@ namespace
 	cl::alias formatA("f", cl::desc("Alias for --format"), cl::aliasopt(executableFactory), whitelist());
 }
 
-vector<uint64_t> Executable::getVisibleEntryPoints() const
+void Executable::ensureSymbolsLoaded() const
 {
-	vector<uint64_t> result;
-	for (const auto& pair : symbols)
+	// Executables are queried from several threads when lifting in parallel.
+	call_once(symbolsLoaded, [this]
 	{
-		result.push_back(pair.second.virtualAddress);
-	}
-	return result;
+		auto self = const_cast<Executable*>(this);
+		self->loadSymbols();
+		
+		symbols.reserve(self->loadingSymbols.size());
+		for (const auto& pair : self->loadingSymbols)
+		{
+			symbols.push_back(pair.second);
+		}
+		self->loadingSymbols.clear();
+		
+		sort(symbols.begin(), symbols.end(), [](const SymbolInfo& a, const SymbolInfo& b)
+		{
+			return a.virtualAddress < b.virtualAddress;
+		});
+	});
+}
+
+ArrayRef<SymbolInfo> Executable::getVisibleSymbols() const
+{
+	ensureSymbolsLoaded();
+	return symbols;
 }
 
-const SymbolInfo* Executable::getInfo(uint64_t address) const
+Optional<SymbolInfo> Executable::getInfo(uint64_t address) const
 {
-	auto iter = symbols.find(address);
-	if (iter != symbols.end())
+	ensureSymbolsLoaded();
+	auto iter = lower_bound(symbols.begin(), symbols.end(), address, [](const SymbolInfo& info, uint64_t address)
 	{
-		return &iter->second;
+		return info.virtualAddress < address;
+	});
+	
+	if (iter != symbols.end() && iter->virtualAddress == address)
+	{
+		return *iter;
 	}
 	else if (const uint8_t* memory = map(address))
 	{
-		SymbolInfo& info = symbols[address];
+		SymbolInfo info;
 		info.virtualAddress = address;
 		info.memory = memory;
-		return &info;
+		return info;
 	}
-	return nullptr;
+	return None;
+}
+
+void Executable::addStubTarget(uint64_t address, StringRef sharedObject, StringRef symbolName)
+{
+	StubInfo& stub = loadingStubTargets[address];
+	stub.sharedObject = sharedObject.empty() ? nullptr : &*libraries.insert(sharedObject.str()).first;
+	stub.name = symbolName.str();
+}
+
+void Executable::ensureStubTargetsLoaded() const
+{
+	call_once(stubTargetsLoaded, [this]
+	{
+		auto self = const_cast<Executable*>(this);
+		hasStubTable = self->loadStubTargets();
+		
+		stubTable.reserve(self->loadingStubTargets.size());
+		for (auto& pair : self->loadingStubTargets)
+		{
+			stubTable.emplace_back(pair.first, move(pair.second));
+		}
+		self->loadingStubTargets.clear();
+		
+		sort(stubTable.begin(), stubTable.end(), [](const pair<uint64_t, StubInfo>& a, const pair<uint64_t, StubInfo>& b)
+		{
+			return a.first < b.first;
+		});
+	});
+}
+
+shared_ptr<const StringLiteralIndex> Executable::getStringLiterals() const
+{
+	call_once(stringLiteralsIndexed, [this]
+	{
+		stringLiterals = make_shared<StringLiteralIndex>();
+		stringLiterals->build(*this);
+	});
+	return stringLiterals;
 }
 
 const StubInfo* Executable::getStubTarget(uint64_t address) const
 {
-	auto iter = stubTargets.find(address);
-	if (iter != stubTargets.end())
+	ensureStubTargetsLoaded();
+	if (hasStubTable)
+	{
+		auto iter = lower_bound(stubTable.begin(), stubTable.end(), address, [](const pair<uint64_t, StubInfo>& entry, uint64_t address)
+		{
+			return entry.first < address;
+		});
+		return iter != stubTable.end() && iter->first == address ? &iter->second : nullptr;
+	}
+	
+	lock_guard<mutex> lock(stubTargetsMutex);
+	auto iter = resolvedStubTargets.find(address);
+	if (iter != resolvedStubTargets.end())
 	{
 		return &iter->second;
 	}
 	
+	if (unresolvedStubTargets.count(address) != 0)
+	{
+		return nullptr;
+	}
+	
 	string libraryName;
 	string targetName;
 	switch (doGetStubTarget(address, libraryName, targetName))
 	{
 		case ResolvedInFlatNamespace:
 		{
-			StubInfo& stub = stubTargets[address];
+			StubInfo& stub = resolvedStubTargets[address];
 			stub.sharedObject = nullptr;
 			stub.name = move(targetName);
 			return &stub;
@@ -227,12 +305,13 @@ const StubInfo* Executable::getStubTarget(uint64_t address) const
 		case ResolvedInTwoLevelNamespace:
 		{
 			auto libIter = libraries.insert(libraryName).first;
-			StubInfo& stub = stubTargets[address];
+			StubInfo& stub = resolvedStubTargets[address];
 			stub.sharedObject = &*libIter;
 			stub.name = move(targetName);
 			return &stub;
 		}
 		case Unresolved:
+			unresolvedStubTargets.insert(address);
 			return nullptr;
 		default:
 			llvm_unreachable("Unknown stub target resolution type!");
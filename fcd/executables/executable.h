@@ -14,21 +14,38 @@
 #ifndef fcd__executables_executable_h
 #define fcd__executables_executable_h
 
+#include "string_literal_index.h"
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
 #include <llvm/Support/ErrorOr.h>
+#include <llvm/Support/StringSaver.h>
 
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 struct SymbolInfo
 {
-	std::string name;
+	// Points into the executable's data or into its string arena, and lives as long as the executable.
+	llvm::StringRef name;
 	uint64_t virtualAddress;
 	const uint8_t* memory;
 };
 
+struct SegmentInfo
+{
+	uint64_t begin;
+	uint64_t end;
+	bool writable;
+};
+
 struct StubInfo
 {
 	const std::string* sharedObject;
@@ -41,9 +58,30 @@ class Executable
 {
 	const uint8_t* dataBegin;
 	const uint8_t* dataEnd;
-	mutable std::unordered_map<uint64_t, SymbolInfo> symbols;
-	mutable std::unordered_map<uint64_t, StubInfo> stubTargets;
+	llvm::BumpPtrAllocator stringArena;
+	llvm::StringSaver strings;
+	// Symbols are collected in loadingSymbols, and then sorted by address into symbols. symbols doesn't change after
+	// that, so that it can be searched from several threads without locking.
+	std::unordered_map<uint64_t, SymbolInfo> loadingSymbols;
+	mutable std::vector<SymbolInfo> symbols;
+	// Executables that know all of their imports up front add them from loadStubTargets to loadingStubTargets, which
+	// is then sorted into stubTable and searched without locking. Other executables resolve stub targets on demand,
+	// possibly from lifting threads, with doGetStubTarget. Its answers are remembered, including for addresses that
+	// aren't stubs, so that it is asked about every address at most once.
+	std::unordered_map<uint64_t, StubInfo> loadingStubTargets;
+	mutable std::vector<std::pair<uint64_t, StubInfo>> stubTable;
+	mutable bool hasStubTable;
+	mutable std::mutex stubTargetsMutex;
+	mutable std::unordered_map<uint64_t, StubInfo> resolvedStubTargets;
+	mutable std::unordered_set<uint64_t> unresolvedStubTargets;
 	mutable std::set<std::string> libraries;
+	mutable std::shared_ptr<StringLiteralIndex> stringLiterals;
+	mutable std::once_flag symbolsLoaded;
+	mutable std::once_flag stubTargetsLoaded;
+	mutable std::once_flag stringLiteralsIndexed;
+	
+	void ensureSymbolsLoaded() const;
+	void ensureStubTargetsLoaded() const;
 	
 protected:
 	enum StubTargetQueryResult
@@ -54,14 +92,29 @@ protected:
 	};
 	
 	inline Executable(const uint8_t* begin, const uint8_t* end)
-	: dataBegin(begin), dataEnd(end)
+	: dataBegin(begin), dataEnd(end), strings(stringArena), hasStubTable(false)
 	{
 	}
 	
-	SymbolInfo& getSymbol(uint64_t address) { return symbols[address]; }
-	void eraseSymbol(uint64_t address) { symbols.erase(address); }
+	// Symbols can only be added before they are first needed (at the latest, from loadSymbols).
+	SymbolInfo& getSymbol(uint64_t address) { return loadingSymbols[address]; }
+	void eraseSymbol(uint64_t address) { loadingSymbols.erase(address); }
+	
+	// For symbol names that don't already live in the executable's data.
+	llvm::StringRef saveString(llvm::StringRef string) { return strings.save(string); }
 	
-	virtual StubTargetQueryResult doGetStubTarget(uint64_t address, std::string& sharedObject, std::string& symbolName) const = 0;
+	// Called once, the first time that symbols are needed. Executables that can defer parsing their symbol tables
+	// should populate them from here.
+	virtual void loadSymbols() {}
+	
+	// Stub targets can only be added from loadStubTargets. An empty sharedObject means the flat namespace.
+	void addStubTarget(uint64_t address, llvm::StringRef sharedObject, llvm::StringRef symbolName);
+	
+	// Called once, the first time that a stub target is needed. Executables that can list every stub target should
+	// add them with addStubTarget and return true; doGetStubTarget is then never called.
+	virtual bool loadStubTargets() { return false; }
+	
+	virtual StubTargetQueryResult doGetStubTarget(uint64_t address, std::string& sharedObject, std::string& symbolName) const { return Unresolved; }
 	
 public:
 	static llvm::ErrorOr<std::unique_ptr<Executable>> parse(const uint8_t* begin, const uint8_t* end);
@@ -73,9 +126,28 @@ public:
 	
 	virtual const uint8_t* map(uint64_t address) const = 0;
 	
-	std::vector<uint64_t> getVisibleEntryPoints() const;
-	const SymbolInfo* getInfo(uint64_t address) const;
+	// Bounds of the segment that contains address, and whether the program can write to it. Executables that don't
+	// know their segment layout return false.
+	virtual bool getSegment(uint64_t address, SegmentInfo& info) const { return false; }
+	
+	// Segments that the program can execute, sorted by address. Executables that don't know their segment layout
+	// return none.
+	virtual std::vector<SegmentInfo> getExecutableSegments() const { return {}; }
+	
+	// Segments that the program can't write to, sorted by address. Executables that don't know their segment layout
+	// return none.
+	virtual std::vector<SegmentInfo> getReadOnlySegments() const { return {}; }
+	
+	// Whether map() can be called from several threads at once.
+	virtual bool canMapConcurrently() const { return true; }
+	
+	// Sorted by address.
+	llvm::ArrayRef<SymbolInfo> getVisibleSymbols() const;
+	// Known symbols, or a nameless symbol if the address is mapped.
+	llvm::Optional<SymbolInfo> getInfo(uint64_t address) const;
 	const StubInfo* getStubTarget(uint64_t address) const;
+	// Indexed the first time that they are needed. The index can be kept after the executable is gone.
+	std::shared_ptr<const StringLiteralIndex> getStringLiterals() const;
 	
 	virtual ~Executable() = default;
 };
@@ -47,6 +47,26 @@ namespace
 			return nullptr;
 		}
 		
+		virtual bool getSegment(uint64_t address, SegmentInfo& info) const override
+		{
+			// Flat binaries have no permissions; everything could be written to.
+			size_t size = end() - begin();
+			if (address >= baseAddress && address < baseAddress + size)
+			{
+				info.begin = baseAddress;
+				info.end = baseAddress + size;
+				info.writable = true;
+				return true;
+			}
+			return false;
+		}
+		
+		virtual vector<SegmentInfo> getExecutableSegments() const override
+		{
+			size_t size = end() - begin();
+			return { { baseAddress, baseAddress + size, true } };
+		}
+		
 		virtual StubTargetQueryResult doGetStubTarget(uint64_t address, string& libraryName, string& into) const override
 		{
 			return Unresolved;
@@ -25,7 +25,9 @@
 
 #include <llvm/Support/raw_ostream.h>
 
+#include <algorithm>
 #include <unordered_map>
+#include <vector>
 
 // We assume here that Python has already been initialized (most likely with a PythonContext).
 
@@ -34,6 +36,17 @@ using namespace std;
 
 namespace
 {
+	// Scripts can expose a segments sequence of (virtual address, size, file offset, permissions) tuples, where
+	// permissions is a string like "r-x". Its bounds are read once, and addresses are then mapped without calling back
+	// into Python. Scripts that don't have it must expose a mapAddress function that maps one address at a time.
+	struct ScriptSegment
+	{
+		uint64_t vbegin;
+		uint64_t vend;
+		uint64_t offset;
+		bool writable;
+	};
+	
 	class PythonParsedExecutable : public Executable
 	{
 		string path;
@@ -42,6 +55,24 @@ namespace
 		AutoPyObject module;
 		AutoPyObject getStubTarget;
 		AutoPyObject mapAddress;
+		bool hasSegments;
+		vector<ScriptSegment> segments; // sorted and non-overlapping
+		
+		static bool getUnsigned(AutoPyObject&& object, unsigned long long& output)
+		{
+			auto longObject = callObject(ADDREF reinterpret_cast<PyObject*>(&PyLong_Type), object);
+			if (!PyErr_Occurred())
+			{
+				output = PyLong_AsUnsignedLongLong(longObject.get());
+			}
+			
+			if (PyErr_Occurred())
+			{
+				PyErr_Print();
+				return false;
+			}
+			return true;
+		}
 		
 		static bool getString(AutoPyObject&& object, string& output)
 		{
@@ -59,16 +90,111 @@ namespace
 		}
 		
 		PythonParsedExecutable(string path, const uint8_t* begin, const uint8_t* end)
-		: Executable(begin, end), path(move(path))
+		: Executable(begin, end), path(move(path)), hasSegments(false)
 		{
 		}
 		
+		const ScriptSegment* findSegment(uint64_t address) const
+		{
+			auto iter = upper_bound(segments.begin(), segments.end(), address, [](uint64_t value, const ScriptSegment& segment)
+			{
+				return value < segment.vbegin;
+			});
+			
+			if (iter != segments.begin())
+			{
+				--iter;
+				if (address < iter->vend)
+				{
+					return &*iter;
+				}
+			}
+			return nullptr;
+		}
+		
+		bool cacheSegments()
+		{
+			PyErrClearAtEnd clearPyErrAtEndOfFunction;
+			
+			auto segmentList = TAKEREF PyObject_GetAttrString(module.get(), "segments");
+			if (!segmentList)
+			{
+				return true;
+			}
+			
+			auto sequence = TAKEREF PySequence_Fast(segmentList.get(), nullptr);
+			if (!sequence)
+			{
+				errs() << "Script " << path << "'s segments is not a sequence!\n";
+				return false;
+			}
+			
+			Py_ssize_t len = PySequence_Length(sequence.get());
+			for (Py_ssize_t i = 0; i < len; ++i)
+			{
+				auto element = TAKEREF PySequence_Fast(PySequence_Fast_GET_ITEM(sequence.get(), i), nullptr);
+				if (!element || PySequence_Length(element.get()) != 4)
+				{
+					errs() << "Segment entry " << i << " does not follow format (address, size, offset, permissions)!\n";
+					return false;
+				}
+				
+				unsigned long long address;
+				unsigned long long size;
+				unsigned long long offset;
+				string permissions;
+				if (!getUnsigned(ADDREF PySequence_Fast_GET_ITEM(element.get(), 0), address)
+					|| !getUnsigned(ADDREF PySequence_Fast_GET_ITEM(element.get(), 1), size)
+					|| !getUnsigned(ADDREF PySequence_Fast_GET_ITEM(element.get(), 2), offset)
+					|| !getString(ADDREF PySequence_Fast_GET_ITEM(element.get(), 3), permissions))
+				{
+					errs() << "Segment entry " << i << " does not follow format (address, size, offset, permissions)!\n";
+					return false;
+				}
+				
+				uint64_t fileSize = static_cast<uint64_t>(end() - begin());
+				if (offset > fileSize || size > fileSize - offset || address + size < address)
+				{
+					errs() << "Segment entry " << i << " is out of the bounds of the executable!\n";
+					return false;
+				}
+				
+				if (size > 0)
+				{
+					bool writable = permissions.find('w') != string::npos;
+					segments.push_back({ address, address + size, offset, writable });
+				}
+			}
+			
+			sort(segments.begin(), segments.end(), [](const ScriptSegment& a, const ScriptSegment& b)
+			{
+				return a.vbegin < b.vbegin;
+			});
+			
+			for (size_t i = 1; i < segments.size(); ++i)
+			{
+				if (segments[i].vbegin < segments[i - 1].vend)
+				{
+					errs() << "Script " << path << " has overlapping segments at 0x";
+					errs().write_hex(segments[i].vbegin) << "!\n";
+					return false;
+				}
+			}
+			
+			hasSegments = true;
+			return true;
+		}
+		
 		bool callInitFunction()
 		{
 			PyErrClearAtEnd clearPyErrAtEndOfFunction;
 			
 			auto init = getCallable("init");
-			auto bytes = TAKEREF PyString_FromStringAndSize(reinterpret_cast<const char*>(begin()), end() - begin());
+			// A read-only buffer over the executable's memory, rather than a copy of it in a string. It behaves like a
+			// string for indexing and slicing (slices are copies), and it supports struct.unpack_from. It points into
+			// the mapped input, so scripts shouldn't use it after fcd is done with the executable.
+			void* memory = const_cast<uint8_t*>(begin());
+			auto bytes = TAKEREF PyBuffer_FromMemory(memory, end() - begin());
 			callObject(init, bytes);
 			
 			if (PyErr_Occurred())
@@ -122,25 +248,16 @@ namespace
 						return false;
 					}
 					
-					auto addressObject = ADDREF PySequence_Fast_GET_ITEM(element.get(), 0);
-					auto longAddress = callObject(ADDREF reinterpret_cast<PyObject*>(&PyLong_Type), addressObject);
-					if (PyErr_Occurred())
-					{
-						PyErr_Print();
-						return false;
-					}
-					
-					unsigned long long address = PyLong_AsUnsignedLongLong(longAddress.get());
-					if (PyErr_Occurred())
+					unsigned long long address;
+					if (!getUnsigned(ADDREF PySequence_Fast_GET_ITEM(element.get(), 0), address))
 					{
-						PyErr_Print();
 						return false;
 					}
 					
 					if (const uint8_t* memory = map(address))
 					{
 						auto& symbol = getSymbol(address);
-						symbol.name = move(symbolName);
+						symbol.name = saveString(symbolName);
 						symbol.virtualAddress = address;
 						symbol.memory = memory;
 					}
@@ -271,12 +388,20 @@ namespace
 				return make_error_code(FcdError::Python_ExecutableScriptInitializationError);
 			}
 			
-			parsedExecutable->mapAddress = parsedExecutable->getCallable("mapAddress");
-			if (!parsedExecutable->getStubTarget)
+			if (!parsedExecutable->cacheSegments())
 			{
 				return make_error_code(FcdError::Python_ExecutableScriptInitializationError);
 			}
 			
+			if (!parsedExecutable->hasSegments)
+			{
+				parsedExecutable->mapAddress = parsedExecutable->getCallable("mapAddress");
+				if (!parsedExecutable->mapAddress)
+				{
+					return make_error_code(FcdError::Python_ExecutableScriptInitializationError);
+				}
+			}
+			
 			if (!parsedExecutable->cacheEntryPoints())
 			{
 				return make_error_code(FcdError::Python_ExecutableScriptInitializationError);
@@ -292,6 +417,15 @@ namespace
 		
 		virtual const uint8_t* map(uint64_t address) const override
 		{
+			if (hasSegments)
+			{
+				if (const ScriptSegment* segment = findSegment(address))
+				{
+					return begin() + segment->offset + (address - segment->vbegin);
+				}
+				return nullptr;
+			}
+			
 			PyErrClearAtEnd clearPyErrAtEndOfFunction;
 			AutoPyObject& mapAddressFunc = const_cast<PythonParsedExecutable*>(this)->mapAddress;
 			auto offset = callObject(mapAddressFunc, TAKEREF PyLong_FromUnsignedLong(address));
@@ -325,6 +459,24 @@ namespace
 			return begin() + intOffset;
 		}
 		
+		virtual bool getSegment(uint64_t address, SegmentInfo& info) const override
+		{
+			if (const ScriptSegment* segment = findSegment(address))
+			{
+				info.begin = segment->vbegin;
+				info.end = segment->vend;
+				info.writable = segment->writable;
+				return true;
+			}
+			return false;
+		}
+		
+		virtual bool canMapConcurrently() const override
+		{
+			// mapAddress runs Python code, and so does getStubTarget even when there is a segment table.
+			return false;
+		}
+		
 		virtual ~PythonParsedExecutable() = default;
 	};
 }
@@ -0,0 +1,164 @@
+//
+// string_literal_index.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd. fcd as a whole is licensed under the terms
+// of the GNU GPLv3 license, but specific parts (such as this one) are
+// dual-licensed under the terms of a BSD-like license as well. You
+// may use, modify and distribute this part of fcd under the terms of
+// either license, at your choice. See the LICENSE file in this directory
+// for details.
+//
+
+#include "executable.h"
+#include "string_literal_index.h"
+
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	// Shortest run of printable characters that is indexed. Format strings like "%d" are that short.
+	const size_t minimumLength = 2;
+	const size_t chunkSize = 16;
+	
+	bool isStringCharacter(uint8_t byte)
+	{
+		return (byte >= 0x20 && byte < 0x7f) || byte == '\t' || byte == '\n' || byte == '\r';
+	}
+	
+	// Sets bit i of printable when begin[i] can be part of a string literal, and bit i of nul when it's a NUL, for
+	// the count bytes (at most a chunk) at begin.
+	void classifyBytes(const uint8_t* begin, size_t count, unsigned& printable, unsigned& nul)
+	{
+#ifdef __SSE2__
+		if (count == chunkSize)
+		{
+			__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+			// Comparisons are signed: bytes of 0x80 and above are negative, and fail the lower bound.
+			__m128i visible = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8(0x1f)), _mm_cmplt_epi8(chunk, _mm_set1_epi8(0x7f)));
+			__m128i tabs = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t'));
+			__m128i newlines = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r')));
+			printable = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(visible, _mm_or_si128(tabs, newlines))));
+			nul = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_setzero_si128())));
+			return;
+		}
+#endif
+		printable = 0;
+		nul = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (isStringCharacter(begin[i]))
+			{
+				printable |= 1u << i;
+			}
+			else if (begin[i] == 0)
+			{
+				nul |= 1u << i;
+			}
+		}
+	}
+	
+	// Calls found with the address and the bytes of each string literal of [begin, end), which is mapped at address.
+	template<typename Callback>
+	void findStringLiterals(const uint8_t* begin, const uint8_t* end, uint64_t address, Callback&& found)
+	{
+		const uint8_t* runBegin = nullptr;
+		for (const uint8_t* chunk = begin; chunk < end; chunk += chunkSize)
+		{
+			size_t count = min<size_t>(chunkSize, static_cast<size_t>(end - chunk));
+			unsigned printable;
+			unsigned nul;
+			classifyBytes(chunk, count, printable, nul);
+			
+			// Most chunks are either entirely inside of a string or have nothing to do with one.
+			unsigned all = (1u << count) - 1;
+			if (printable == all)
+			{
+				if (runBegin == nullptr)
+				{
+					runBegin = chunk;
+				}
+				continue;
+			}
+			if (printable == 0 && nul == 0)
+			{
+				runBegin = nullptr;
+				continue;
+			}
+			
+			for (size_t i = 0; i < count; ++i)
+			{
+				const uint8_t* cursor = chunk + i;
+				if ((printable & (1u << i)) != 0)
+				{
+					if (runBegin == nullptr)
+					{
+						runBegin = cursor;
+					}
+					continue;
+				}
+				
+				size_t length = runBegin == nullptr ? 0 : static_cast<size_t>(cursor - runBegin);
+				if ((nul & (1u << i)) != 0 && length >= minimumLength)
+				{
+					found(address + static_cast<uint64_t>(runBegin - begin), StringRef(reinterpret_cast<const char*>(runBegin), length));
+				}
+				runBegin = nullptr;
+			}
+		}
+	}
+}
+
+void StringLiteralIndex::build(const Executable& executable)
+{
+	literals.clear();
+	for (const SegmentInfo& segment : executable.getReadOnlySegments())
+	{
+		const uint8_t* begin = executable.map(segment.begin);
+		if (begin == nullptr || begin >= executable.end())
+		{
+			continue;
+		}
+		
+		// Segments can be bigger in memory than in the file.
+		uint64_t size = min<uint64_t>(segment.end - segment.begin, static_cast<uint64_t>(executable.end() - begin));
+		findStringLiterals(begin, begin + size, segment.begin, [&](uint64_t address, StringRef literal)
+		{
+			literals.emplace_back(address, strings.save(literal));
+		});
+	}
+	
+	// Segments are sorted, so this is normally sorted already.
+	sort(literals.begin(), literals.end(), [](const pair<uint64_t, StringRef>& a, const pair<uint64_t, StringRef>& b)
+	{
+		return a.first < b.first;
+	});
+}
+
+Optional<StringRef> StringLiteralIndex::find(uint64_t address) const
+{
+	auto iter = upper_bound(literals.begin(), literals.end(), address, [](uint64_t address, const pair<uint64_t, StringRef>& literal)
+	{
+		return address < literal.first;
+	});
+	
+	// Pointers into the middle of a literal are fine: linkers merge strings that are the suffix of another one.
+	if (iter != literals.begin())
+	{
+		--iter;
+		uint64_t offset = address - iter->first;
+		if (offset < iter->second.size())
+		{
+			return iter->second.drop_front(offset);
+		}
+	}
+	return None;
+}
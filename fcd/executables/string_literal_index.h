@@ -0,0 +1,56 @@
+//
+// string_literal_index.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd. fcd as a whole is licensed under the terms
+// of the GNU GPLv3 license, but specific parts (such as this one) are
+// dual-licensed under the terms of a BSD-like license as well. You
+// may use, modify and distribute this part of fcd under the terms of
+// either license, at your choice. See the LICENSE file in this directory
+// for details.
+//
+
+#ifndef fcd__executables_string_literal_index_h
+#define fcd__executables_string_literal_index_h
+
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/StringSaver.h>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class Executable;
+
+// NUL-terminated runs of printable characters in the read-only segments of an executable, found with a single scan,
+// so that telling whether a constant points to a string literal is a binary search. The index keeps its own copy of
+// the strings and can outlive the executable.
+class StringLiteralIndex
+{
+	llvm::BumpPtrAllocator arena;
+	llvm::StringSaver strings;
+	// Sorted by address. The strings don't include the NUL.
+	std::vector<std::pair<uint64_t, llvm::StringRef>> literals;
+
+public:
+	StringLiteralIndex()
+	: strings(arena)
+	{
+	}
+	
+	StringLiteralIndex(const StringLiteralIndex&) = delete;
+	StringLiteralIndex& operator=(const StringLiteralIndex&) = delete;
+	
+	// Scans the segments that executable reports with getReadOnlySegments.
+	void build(const Executable& executable);
+	
+	size_t size() const { return literals.size(); }
+	
+	// The string literal that address points into, up to (and without) its terminating NUL.
+	llvm::Optional<llvm::StringRef> find(uint64_t address) const;
+};
+
+#endif /* fcd__executables_string_literal_index_h */
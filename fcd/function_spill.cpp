@@ -0,0 +1,197 @@
+//
+// function_spill.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "function_spill.h"
+#include "metadata.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+using namespace llvm;
+using namespace std;
+
+FunctionSpill::FunctionSpill()
+: spilledCount(0)
+{
+}
+
+FunctionSpill::~FunctionSpill()
+{
+	for (const Batch& batch : batches)
+	{
+		sys::fs::remove(batch.path);
+	}
+}
+
+void FunctionSpill::promoteLocalValues(Module& module)
+{
+	for (GlobalValue& value : module.global_values())
+	{
+		if (value.hasLocalLinkage())
+		{
+			bool unnamed = !value.hasName();
+			if (unnamed)
+			{
+				value.setName("fcd.local");
+			}
+			if (localNames.insert(value.getName().str()).second)
+			{
+				locals.push_back({value.getName().str(), value.getLinkage(), unnamed});
+			}
+			value.setLinkage(GlobalValue::ExternalLinkage);
+		}
+	}
+}
+
+void FunctionSpill::restoreLocalValues(Module& module)
+{
+	for (const LocalValue& local : locals)
+	{
+		if (GlobalValue* value = module.getNamedValue(local.name))
+		{
+			value->setLinkage(local.linkage);
+			if (local.unnamed)
+			{
+				value->setName("");
+			}
+		}
+	}
+	locals.clear();
+	localNames.clear();
+}
+
+bool FunctionSpill::spill(Module& module, ArrayRef<Function*> functions, string& errorMessage)
+{
+	if (functions.size() == 0)
+	{
+		return true;
+	}
+	
+	promoteLocalValues(module);
+	unordered_set<const Function*> spilled(functions.begin(), functions.end());
+	ValueToValueMapTy valueMap;
+	auto spillModule = CloneModule(&module, valueMap, [&](const GlobalValue* value)
+	{
+		auto fn = dyn_cast<Function>(value);
+		return fn != nullptr && spilled.count(fn) != 0;
+	});
+	
+	// Named metadata is appended when modules are linked; the module keeps all of it.
+	vector<NamedMDNode*> namedMetadata;
+	for (NamedMDNode& node : spillModule->named_metadata())
+	{
+		namedMetadata.push_back(&node);
+	}
+	for (NamedMDNode* node : namedMetadata)
+	{
+		spillModule->eraseNamedMetadata(node);
+	}
+	
+	int fd;
+	SmallString<128> path;
+	if (auto error = sys::fs::createTemporaryFile("fcd-spill", "bc", fd, path))
+	{
+		errorMessage = "can't create temporary file: " + error.message();
+		return false;
+	}
+	
+	{
+		raw_fd_ostream output(fd, true);
+		WriteBitcodeToFile(spillModule.get(), output);
+		if (output.has_error())
+		{
+			output.clear_error();
+			sys::fs::remove(path);
+			errorMessage = "can't write " + path.str().str();
+			return false;
+		}
+	}
+	spillModule.reset();
+	
+	Batch batch;
+	batch.path = path.str();
+	for (Function* fn : functions)
+	{
+		// Deleting the body drops metadata attachments too.
+		SmallVector<pair<unsigned, MDNode*>, 8> metadata;
+		fn->getAllMetadata(metadata);
+		fn->deleteBody();
+		md::ensureFunctionBody(*fn);
+		for (const auto& pair : metadata)
+		{
+			fn->setMetadata(pair.first, pair.second);
+		}
+		batch.functions.push_back(fn->getName().str());
+	}
+	spilledCount += functions.size();
+	batches.push_back(move(batch));
+	return true;
+}
+
+bool FunctionSpill::restore(Module& module, string& errorMessage)
+{
+	bool success = true;
+	for (const Batch& batch : batches)
+	{
+		if (success)
+		{
+			for (const string& name : batch.functions)
+			{
+				if (Function* fn = module.getFunction(name))
+				{
+					fn->deleteBody();
+				}
+			}
+			
+			auto bufferOrError = MemoryBuffer::getFile(batch.path);
+			if (!bufferOrError)
+			{
+				errorMessage = "can't read " + batch.path + ": " + bufferOrError.getError().message();
+				success = false;
+			}
+			else
+			{
+				auto moduleOrError = parseBitcodeFile(bufferOrError.get()->getMemBufferRef(), module.getContext());
+				if (!moduleOrError)
+				{
+					errorMessage = "can't parse " + batch.path + ": " + moduleOrError.getError().message();
+					success = false;
+				}
+				else if (Linker::linkModules(module, move(moduleOrError.get())))
+				{
+					errorMessage = "can't link " + batch.path + " back";
+					success = false;
+				}
+			}
+		}
+		sys::fs::remove(batch.path);
+	}
+	
+	batches.clear();
+	spilledCount = 0;
+	restoreLocalValues(module);
+	return success;
+}
@@ -0,0 +1,76 @@
+//
+// function_spill.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef fcd__function_spill_h
+#define fcd__function_spill_h
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Moves the bodies of functions to temporary bitcode files, so that they don't take memory until they are needed
+// again. Spilled functions keep their metadata and get a placeholder body, which makes them prototypes (see
+// md::isPrototype) until they are restored: passes skip them, but their address, name and call information stay
+// available to their callers.
+//
+// Bitcode files refer to the rest of the module by name, so values with local linkage get external linkage from the
+// first spill until restore links the bodies back, like the worker modules of ParallelFunctionPasses.
+class FunctionSpill
+{
+	struct LocalValue
+	{
+		std::string name;
+		llvm::GlobalValue::LinkageTypes linkage;
+		bool unnamed;
+	};
+	
+	struct Batch
+	{
+		std::string path;
+		std::vector<std::string> functions;
+	};
+	
+	std::vector<LocalValue> locals;
+	std::unordered_set<std::string> localNames;
+	std::vector<Batch> batches;
+	size_t spilledCount;
+	
+	void promoteLocalValues(llvm::Module& module);
+	void restoreLocalValues(llvm::Module& module);
+	
+public:
+	FunctionSpill();
+	~FunctionSpill();
+	
+	size_t getSpilledCount() const { return spilledCount; }
+	
+	// Writes the bodies of functions, which must be definitions of module, to a single file.
+	bool spill(llvm::Module& module, llvm::ArrayRef<llvm::Function*> functions, std::string& errorMessage);
+	
+	// Links every spilled body back into module and deletes the files.
+	bool restore(llvm::Module& module, std::string& errorMessage);
+};
+
+#endif /* fcd__function_spill_h */
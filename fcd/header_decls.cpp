@@ -34,6 +34,8 @@
 #include <llvm/IR/CallingConv.h>
 #include <llvm/IR/Function.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/Path.h>
 
 #include <dlfcn.h>
 
@@ -93,13 +95,43 @@ namespace
 		return parentPath.str();
 	}
 	
+	// Cached ASTs are only valid for the fcd build (and Clang version) that produced them. Header contents aren't part
+	// of the key: clear the cache directory after changing headers.
+	const char headerCacheVersion[] = "fcd-headers-1 " CLANG_VERSION_STRING " " __DATE__ " " __TIME__;
+	
+	string cachedHeadersPath(StringRef cacheDirectory, StringRef triple, const vector<string>& searchPath, const vector<string>& headers)
+	{
+		MD5 hash;
+		hash.update(headerCacheVersion);
+		hash.update(StringRef("", 1));
+		hash.update(triple);
+		for (const auto& list : {&searchPath, &headers})
+		{
+			for (const string& item : *list)
+			{
+				hash.update(StringRef("", 1));
+				hash.update(item);
+			}
+			hash.update(StringRef("\1", 1));
+		}
+		
+		MD5::MD5Result result;
+		SmallString<32> resultString;
+		hash.final(result);
+		MD5::stringifyResult(result, resultString);
+		
+		SmallString<128> path(cacheDirectory);
+		sys::path::append(path, resultString + ".ast");
+		return path.str();
+	}
+	
 	class FunctionDeclarationFinder : public RecursiveASTVisitor<FunctionDeclarationFinder>
 	{
 		index::CodegenNameGenerator& mangler;
-		unordered_map<string, FunctionDecl*>& knownFunctions;
+		StringMap<HeaderDeclarations::KnownFunction>& knownFunctions;
 		
 	public:
-		FunctionDeclarationFinder(index::CodegenNameGenerator& mangler, unordered_map<string, FunctionDecl*>& knownFunctions)
+		FunctionDeclarationFinder(index::CodegenNameGenerator& mangler, StringMap<HeaderDeclarations::KnownFunction>& knownFunctions)
 		: mangler(mangler), knownFunctions(knownFunctions)
 		{
 		}
@@ -112,7 +144,7 @@ namespace
 		bool TraverseFunctionDecl(FunctionDecl* fn)
 		{
 			string mangledName = mangler.getName(fn);
-			knownFunctions[mangledName] = fn;
+			knownFunctions[mangledName] = HeaderDeclarations::KnownFunction(fn);
 			return true;
 		}
 	};
@@ -123,7 +155,7 @@ HeaderDeclarations::HeaderDeclarations(llvm::Module& module, unique_ptr<ASTUnit>
 {
 }
 
-unique_ptr<HeaderDeclarations> HeaderDeclarations::create(llvm::Module& module, const vector<string>& searchPath, vector<string> headers, raw_ostream& errors)
+unique_ptr<HeaderDeclarations> HeaderDeclarations::create(llvm::Module& module, const vector<string>& searchPath, vector<string> headers, raw_ostream& errors, StringRef cacheDirectory)
 {
 	if (headers.size() == 0)
 	{
@@ -178,7 +210,32 @@ unique_ptr<HeaderDeclarations> HeaderDeclarations::create(llvm::Module& module,
 		auto fileManager = std::make_unique<FileManager>(fsOptions);
 		
 		auto pch = std::make_shared<PCHContainerOperations>();
-		auto tu = ASTUnit::LoadFromCompilerInvocation(clang.get(), pch, diags, fileManager.release(), true);
+		unique_ptr<ASTUnit> tu;
+		string cachePath;
+		if (cacheDirectory.size() > 0)
+		{
+			cachePath = cachedHeadersPath(cacheDirectory, clang->getTargetOpts().Triple, searchPath, headers);
+			if (sys::fs::exists(cachePath))
+			{
+				// A cache file that doesn't load is simply replaced, so don't report why it didn't load.
+				IntrusiveRefCntPtr<DiagnosticsEngine> cacheDiags(CompilerInstance::createDiagnostics(new DiagnosticOptions, new IgnoringDiagConsumer));
+				tu = ASTUnit::LoadFromASTFile(cachePath, pch->getRawReader(), cacheDiags, fsOptions, false, true);
+			}
+		}
+		
+		if (!tu)
+		{
+			tu = ASTUnit::LoadFromCompilerInvocation(clang.get(), pch, diags, fileManager.release(), true);
+			if (tu && diagPrinter->getNumErrors() == 0 && cachePath.size() > 0)
+			{
+				// ASTUnit::Save returns true on failure. A failure to cache headers isn't fatal.
+				if (sys::fs::create_directories(cacheDirectory) || tu->Save(cachePath))
+				{
+					errors << "Couldn't cache parsed headers to " << cachePath << "\n";
+				}
+			}
+		}
+		
 		if (diagPrinter->getNumErrors() == 0)
 		{
 			if (tu)
@@ -214,7 +271,7 @@ unique_ptr<HeaderDeclarations> HeaderDeclarations::create(llvm::Module& module,
 	return nullptr;
 }
 
-Function* HeaderDeclarations::prototypeForImportName(const string& importName)
+Function* HeaderDeclarations::prototypeForImportName(StringRef importName)
 {
 	if (Function* fn = module.getFunction(importName))
 	{
@@ -227,29 +284,48 @@ Function* HeaderDeclarations::prototypeForImportName(const string& importName)
 		return nullptr;
 	}
 	
-	FunctionDecl* funcDecl = iter->second;
-	llvm::FunctionType* functionType = typeLowering->GetFunctionType(GlobalDecl(funcDecl));
+	// The lowered function may have been renamed if its name was taken.
+	KnownFunction& known = iter->second;
+	if (auto fn = dyn_cast_or_null<Function>(static_cast<Value*>(known.prototype)))
+	{
+		return fn;
+	}
+	
+	Function* fn = lowerPrototype(*known.decl, importName);
+	known.prototype = fn;
+	return fn;
+}
+
+bool HeaderDeclarations::isNoReturn(StringRef importName) const
+{
+	auto iter = knownFunctions.find(importName);
+	return iter != knownFunctions.end() && iter->second.decl->isNoReturn();
+}
+
+Function* HeaderDeclarations::lowerPrototype(FunctionDecl& funcDecl, StringRef importName)
+{
+	llvm::FunctionType* functionType = typeLowering->GetFunctionType(GlobalDecl(&funcDecl));
 	
 	// Cheating and bringing in CodeGenTypes is fairly cheap and reliable. Unfortunately, CodeGenModules, which is
 	// responsible for attribute translation, is a pretty big class with lots of dependencies.
 	// That said, while most attributes have a lot of value for compilation, they don't bring that much in for
 	// decompilation.
 	AttrBuilder attributeBuilder;
-	if (funcDecl->isNoReturn())
+	if (funcDecl.isNoReturn())
 	{
 		attributeBuilder.addAttribute(Attribute::NoReturn);
 	}
-	if (funcDecl->hasAttr<ConstAttr>())
+	if (funcDecl.hasAttr<ConstAttr>())
 	{
 		attributeBuilder.addAttribute(Attribute::ReadNone);
 		attributeBuilder.addAttribute(Attribute::NoUnwind);
 	}
-	if (funcDecl->hasAttr<PureAttr>())
+	if (funcDecl.hasAttr<PureAttr>())
 	{
 		attributeBuilder.addAttribute(Attribute::ReadOnly);
 		attributeBuilder.addAttribute(Attribute::NoUnwind);
 	}
-	if (funcDecl->hasAttr<NoAliasAttr>())
+	if (funcDecl.hasAttr<NoAliasAttr>())
 	{
 		attributeBuilder.addAttribute(Attribute::ArgMemOnly);
 		attributeBuilder.addAttribute(Attribute::NoUnwind);
@@ -257,13 +333,13 @@ Function* HeaderDeclarations::prototypeForImportName(const string& importName)
 	
 	Function* fn = Function::Create(functionType, GlobalValue::ExternalLinkage);
 	fn->addAttributes(AttributeSet::FunctionIndex, AttributeSet::get(module.getContext(), AttributeSet::FunctionIndex, attributeBuilder));
-	if (funcDecl->hasAttr<RestrictAttr>())
+	if (funcDecl.hasAttr<RestrictAttr>())
 	{
 		fn->addAttribute(AttributeSet::ReturnIndex, Attribute::NoAlias);
 	}
 	
 	// If we know the calling convention, apply it here
-	auto prototype = funcDecl->getType()->getCanonicalTypeUnqualified().getAs<FunctionProtoType>();
+	auto prototype = funcDecl.getType()->getCanonicalTypeUnqualified().getAs<FunctionProtoType>();
 	auto callingConvention = lookupCallingConvention(prototype->getExtInfo().getCC());
 	
 	fn->setCallingConv(callingConvention);
@@ -23,14 +23,15 @@
 #define header_index_h
 
 #include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
+#include <llvm/IR/ValueHandle.h>
 #include <llvm/Pass.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 namespace clang
@@ -47,27 +48,47 @@ namespace clang
 
 class HeaderDeclarations
 {
+public:
+	struct KnownFunction
+	{
+		clang::FunctionDecl* decl;
+		// Lowered at most once, on the first lookup.
+		llvm::WeakVH prototype;
+		
+		KnownFunction(clang::FunctionDecl* decl = nullptr)
+		: decl(decl)
+		{
+		}
+	};
+	
+private:
 	llvm::Module& module;
 	std::unique_ptr<clang::ASTUnit> tu;
 	std::unique_ptr<clang::CodeGenerator> codeGenerator;
 	std::unique_ptr<clang::CodeGen::CodeGenTypes> typeLowering;
 	
 	std::vector<std::string> includedFiles;
-	std::unordered_map<std::string, clang::FunctionDecl*> knownFunctions;
+	llvm::StringMap<KnownFunction> knownFunctions;
+	
+	llvm::Function* lowerPrototype(clang::FunctionDecl& funcDecl, llvm::StringRef importName);
 	
 	HeaderDeclarations(llvm::Module& module, std::unique_ptr<clang::ASTUnit> tu, std::vector<std::string> includedFiles);
 	
 public:
-	static std::unique_ptr<HeaderDeclarations> create(llvm::Module& module, const std::vector<std::string>& searchPath, std::vector<std::string> headers, llvm::raw_ostream& errors);
+	// When cacheDirectory isn't empty, parsed headers are saved there as an AST file and loaded back on later runs
+	// that use the same headers, search path and target.
+	static std::unique_ptr<HeaderDeclarations> create(llvm::Module& module, const std::vector<std::string>& searchPath, std::vector<std::string> headers, llvm::raw_ostream& errors, llvm::StringRef cacheDirectory = "");
 	
 	template<typename TSearchPathIter, typename THeaderIter>
-	static std::unique_ptr<HeaderDeclarations> create(llvm::Module& module, TSearchPathIter searchPathBegin, TSearchPathIter searchPathEnd, THeaderIter headerBegin, THeaderIter headerEnd, llvm::raw_ostream& errors)
+	static std::unique_ptr<HeaderDeclarations> create(llvm::Module& module, TSearchPathIter searchPathBegin, TSearchPathIter searchPathEnd, THeaderIter headerBegin, THeaderIter headerEnd, llvm::raw_ostream& errors, llvm::StringRef cacheDirectory = "")
 	{
-		return create(module, std::vector<std::string>(searchPathBegin, searchPathEnd), std::vector<std::string>(headerBegin, headerEnd), errors);
+		return create(module, std::vector<std::string>(searchPathBegin, searchPathEnd), std::vector<std::string>(headerBegin, headerEnd), errors, cacheDirectory);
 	}
 	
 	const std::vector<std::string>& getIncludedFiles() const { return includedFiles; }
-	llvm::Function* prototypeForImportName(const std::string& importName);
+	llvm::Function* prototypeForImportName(llvm::StringRef importName);
+	// Whether headers declare importName as a function that doesn't return, without lowering its prototype.
+	bool isNoReturn(llvm::StringRef importName) const;
 	
 	~HeaderDeclarations();
 };
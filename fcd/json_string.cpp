@@ -0,0 +1,52 @@
+//
+// json_string.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "json_string.h"
+
+#include <llvm/Support/Format.h>
+
+using namespace llvm;
+
+void printJsonString(raw_ostream& os, StringRef string)
+{
+	os << '"';
+	for (char c : string)
+	{
+		switch (c)
+		{
+			case '"': os << "\\\""; break;
+			case '\\': os << "\\\\"; break;
+			case '\n': os << "\\n"; break;
+			case '\t': os << "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+				{
+					os << format("\\u%04x", c);
+				}
+				else
+				{
+					os << c;
+				}
+				break;
+		}
+	}
+	os << '"';
+}
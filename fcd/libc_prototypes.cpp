@@ -0,0 +1,241 @@
+//
+// libc_prototypes.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "libc_prototypes.h"
+
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	enum PrototypeAttributes : unsigned
+	{
+		AttrNoReturn = 1 << 0,
+		AttrReadOnly = 1 << 1,
+		AttrReadNone = 1 << 2,
+		AttrNoUnwind = 1 << 3,
+	};
+	
+	struct LibcPrototype
+	{
+		const char* name;
+		// Return type followed by parameter types: v is void, i is int, l is long (and size_t), p is a pointer and d
+		// is a double. A trailing . makes the function variadic.
+		const char* signature;
+		unsigned attributes;
+	};
+	
+	// Sorted by name.
+	constexpr LibcPrototype prototypes[] = {
+		{"_Exit", "vi", AttrNoReturn},
+		{"_Unwind_Resume", "vp", AttrNoReturn},
+		{"__assert_fail", "vppip", AttrNoReturn},
+		{"__chk_fail", "v", AttrNoReturn},
+		{"__ctype_b_loc", "p", AttrReadNone},
+		{"__cxa_rethrow", "v", AttrNoReturn},
+		{"__cxa_throw", "vppp", AttrNoReturn},
+		{"__errno_location", "p", AttrReadNone},
+		{"__fortify_fail", "vp", AttrNoReturn},
+		{"__fprintf_chk", "ipip.", 0},
+		{"__libc_start_main", "ipippppp", AttrNoReturn},
+		{"__longjmp_chk", "vpi", AttrNoReturn},
+		{"__memcpy_chk", "pppll", 0},
+		{"__printf_chk", "iip.", 0},
+		{"__snprintf_chk", "iplilp.", 0},
+		{"__sprintf_chk", "ipilp.", 0},
+		{"__stack_chk_fail", "v", AttrNoReturn},
+		{"__strcpy_chk", "pppl", 0},
+		{"_exit", "vi", AttrNoReturn},
+		{"abort", "v", AttrNoReturn},
+		{"atexit", "ip", 0},
+		{"atoi", "ip", AttrReadOnly},
+		{"atol", "lp", AttrReadOnly},
+		{"calloc", "pll", AttrNoUnwind},
+		{"close", "ii", 0},
+		{"err", "vip.", AttrNoReturn},
+		{"errx", "vip.", AttrNoReturn},
+		{"exit", "vi", AttrNoReturn},
+		{"fclose", "ip", 0},
+		{"fflush", "ip", 0},
+		{"fgetc", "ip", 0},
+		{"fgets", "ppip", 0},
+		{"fopen", "ppp", 0},
+		{"fprintf", "ipp.", 0},
+		{"fputc", "iip", 0},
+		{"fputs", "ipp", 0},
+		{"fread", "lpllp", 0},
+		{"free", "vp", AttrNoUnwind},
+		{"fscanf", "ipp.", 0},
+		{"fseek", "ipli", 0},
+		{"ftell", "lp", 0},
+		{"fwrite", "lpllp", 0},
+		{"getc", "ip", 0},
+		{"getchar", "i", 0},
+		{"getenv", "pp", AttrReadOnly},
+		{"getpid", "i", 0},
+		{"longjmp", "vpi", AttrNoReturn},
+		{"malloc", "pl", AttrNoUnwind},
+		{"memcmp", "ippl", AttrReadOnly},
+		{"memcpy", "pppl", 0},
+		{"memmove", "pppl", 0},
+		{"memset", "ppil", 0},
+		{"open", "ipi.", 0},
+		{"perror", "vp", 0},
+		{"printf", "ip.", 0},
+		{"pthread_exit", "vp", AttrNoReturn},
+		{"putc", "iip", 0},
+		{"putchar", "ii", 0},
+		{"puts", "ip", 0},
+		{"qsort", "vpllp", 0},
+		{"quick_exit", "vi", AttrNoReturn},
+		{"rand", "i", 0},
+		{"read", "lipl", 0},
+		{"realloc", "ppl", AttrNoUnwind},
+		{"scanf", "ip.", 0},
+		{"siglongjmp", "vpi", AttrNoReturn},
+		{"sleep", "ii", 0},
+		{"snprintf", "iplp.", 0},
+		{"sprintf", "ipp.", 0},
+		{"srand", "vi", 0},
+		{"sscanf", "ipp.", 0},
+		{"strcat", "ppp", 0},
+		{"strchr", "ppi", AttrReadOnly},
+		{"strcmp", "ipp", AttrReadOnly},
+		{"strcpy", "ppp", 0},
+		{"strdup", "pp", 0},
+		{"strerror", "pi", 0},
+		{"strlen", "lp", AttrReadOnly},
+		{"strncmp", "ippl", AttrReadOnly},
+		{"strncpy", "pppl", 0},
+		{"strrchr", "ppi", AttrReadOnly},
+		{"strstr", "ppp", AttrReadOnly},
+		{"strtod", "dpp", 0},
+		{"strtol", "lppi", 0},
+		{"strtoul", "lppi", 0},
+		{"system", "ip", 0},
+		{"time", "lp", 0},
+		{"write", "lipl", 0},
+	};
+	
+	Type* typeForCode(LLVMContext& ctx, char code)
+	{
+		switch (code)
+		{
+			case 'v': return Type::getVoidTy(ctx);
+			case 'i': return Type::getInt32Ty(ctx);
+			case 'l': return Type::getInt64Ty(ctx);
+			case 'p': return Type::getInt8PtrTy(ctx);
+			case 'd': return Type::getDoubleTy(ctx);
+			default: llvm_unreachable("unknown type code in libc prototype");
+		}
+	}
+	
+	FunctionType* functionTypeForSignature(LLVMContext& ctx, StringRef signature)
+	{
+		bool isVariadic = signature.endswith(".");
+		if (isVariadic)
+		{
+			signature = signature.drop_back();
+		}
+		
+		Type* returnType = typeForCode(ctx, signature.front());
+		SmallVector<Type*, 8> params;
+		for (char code : signature.drop_front())
+		{
+			params.push_back(typeForCode(ctx, code));
+		}
+		return FunctionType::get(returnType, params, isVariadic);
+	}
+	
+	const LibcPrototype* findPrototype(StringRef importName)
+	{
+		assert(is_sorted(begin(prototypes), end(prototypes), [](const LibcPrototype& a, const LibcPrototype& b)
+		{
+			return strcmp(a.name, b.name) < 0;
+		}));
+		
+		auto iter = lower_bound(begin(prototypes), end(prototypes), importName, [](const LibcPrototype& a, StringRef b)
+		{
+			return a.name < b;
+		});
+		if (iter == end(prototypes) || iter->name != importName)
+		{
+			return nullptr;
+		}
+		return iter;
+	}
+}
+
+bool isNoReturnLibcImport(StringRef importName)
+{
+	const LibcPrototype* prototype = findPrototype(importName);
+	return prototype != nullptr && (prototype->attributes & AttrNoReturn) != 0;
+}
+
+Function* libcPrototypeForImportName(Module& module, StringRef importName)
+{
+	const LibcPrototype* iter = findPrototype(importName);
+	if (iter == nullptr)
+	{
+		return nullptr;
+	}
+	
+	if (Function* fn = module.getFunction(importName))
+	{
+		return fn;
+	}
+	
+	AttrBuilder attributeBuilder;
+	if (iter->attributes & AttrNoReturn)
+	{
+		attributeBuilder.addAttribute(Attribute::NoReturn);
+	}
+	if (iter->attributes & AttrReadOnly)
+	{
+		attributeBuilder.addAttribute(Attribute::ReadOnly);
+		attributeBuilder.addAttribute(Attribute::NoUnwind);
+	}
+	if (iter->attributes & AttrReadNone)
+	{
+		attributeBuilder.addAttribute(Attribute::ReadNone);
+		attributeBuilder.addAttribute(Attribute::NoUnwind);
+	}
+	if (iter->attributes & AttrNoUnwind)
+	{
+		attributeBuilder.addAttribute(Attribute::NoUnwind);
+	}
+	
+	LLVMContext& ctx = module.getContext();
+	Function* fn = Function::Create(functionTypeForSignature(ctx, iter->signature), GlobalValue::ExternalLinkage);
+	fn->addAttributes(AttributeSet::FunctionIndex, AttributeSet::get(ctx, AttributeSet::FunctionIndex, attributeBuilder));
+	fn->setCallingConv(CallingConv::C);
+	fn->setName(importName);
+	module.getFunctionList().insert(module.getFunctionList().end(), fn);
+	return fn;
+}
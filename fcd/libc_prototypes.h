@@ -0,0 +1,36 @@
+//
+// libc_prototypes.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef fcd__libc_prototypes_h
+#define fcd__libc_prototypes_h
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Module.h>
+
+// Prototypes for common C library imports, so that they get parameters and attributes (notably noreturn, which
+// affects the control flow graph) without parsing headers. Returns nullptr for unknown names.
+llvm::Function* libcPrototypeForImportName(llvm::Module& module, llvm::StringRef importName);
+
+// Doesn't create anything in a module, so it can be called from any thread.
+bool isNoReturnLibcImport(llvm::StringRef importName);
+
+#endif /* fcd__libc_prototypes_h */
@@ -20,22 +20,45 @@
 //
 
 #include "ast_passes.h"
+#include "callinfo_database.h"
+#include "code_generator.h"
 #include "command_line.h"
+#include "decompilation_cache.h"
+#include "dumb_allocator.h"
 #include "errors.h"
 #include "executable.h"
+#include "function_discovery.h"
+#include "function_spill.h"
+#include "json_string.h"
 #include "header_decls.h"
+#include "libc_prototypes.h"
 #include "main.h"
+#include "memssa_cache.h"
 #include "metadata.h"
+#include "module_partition.h"
+#include "parallel_function_passes.h"
+#include "parallel_translation.h"
+#include "pass_argrec.h"
 #include "passes.h"
+#include "phase_stats.h"
+#include "plugin.h"
+#include "progress.h"
+#include "prologue_scanner.h"
 #include "python_context.h"
+#include "semantics_report.h"
 #include "params_registry.h"
+#include "task_scheduler.h"
+#include "trace_events.h"
 #include "translation_context.h"
 
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/Statistic.h>
 #include <llvm/Analysis/AliasAnalysis.h>
 #include <llvm/Analysis/BasicAliasAnalysis.h>
 #include <llvm/Analysis/Passes.h>
 #include <llvm/Analysis/ScopedNoAliasAA.h>
 #include <llvm/Analysis/TypeBasedAliasAnalysis.h>
+#include <llvm/Bitcode/ReaderWriter.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Metadata.h>
@@ -47,32 +70,87 @@
 #include <llvm/Support/Process.h>
 #include <llvm/Support/raw_os_ostream.h>
 #include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/SystemUtils.h>
 #include <llvm/Transforms/IPO.h>
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Scalar/GVN.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/Local.h>
 
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <unordered_map>
+#include <unordered_set>
 #include <sstream>
 #include <string>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <vector>
 
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "fcd-main"
+
+STATISTIC(PreoptimizationRounds, "Rounds of pre-optimization passes run");
+STATISTIC(PreoptimizationRunsSkipped, "Function runs of pre-optimization passes skipped because the function was clean");
+
 namespace
 {
-	cl::opt<string> inputFile(cl::Positional, cl::desc("<input program>"), cl::Required, whitelist());
+	cl::opt<string> inputFile(cl::Positional, cl::desc("<input program>"), whitelist());
 	cl::list<unsigned long long> additionalEntryPoints("other-entry", cl::desc("Add entry point from virtual address (can be used multiple times)"), cl::CommaSeparated, whitelist());
 	cl::list<bool> partialDisassembly("partial", cl::desc("Only decompile functions specified with --other-entry"), whitelist());
+	cl::opt<unsigned> partialDepth("partial-depth", cl::desc("With --partial, also lift the functions up to <depth> calls away from the entry points, so that their prototypes can be inferred"), cl::value_desc("depth"), cl::init(1), whitelist());
 	cl::list<bool> inputIsModule("module-in", cl::desc("Input file is a LLVM module"), whitelist());
 	cl::list<bool> outputIsModule("module-out", cl::desc("Output LLVM module"), whitelist());
+	cl::opt<bool> bitcodeOutput("bitcode", cl::desc("Output LLVM modules as bitcode instead of textual IR (input format is detected)"), whitelist());
+	cl::opt<bool> valueNames("value-names", cl::desc("Name lifted blocks after their address and lifted values after registers (default with --module-out)"), whitelist());
+	cl::opt<string> splitModuleOutput("split-module-out", cl::desc("With --module-out, write one bitcode module per function to <directory>"), cl::value_desc("directory"), whitelist());
+	cl::opt<string> partitionOutput("partition-out", cl::desc("Stop after pre-optimization and write modules that can be decompiled separately (with -m -m) to <directory>"), cl::value_desc("directory"), whitelist());
+	cl::opt<unsigned> partitionCount("partitions", cl::desc("Number of modules written by --partition-out"), cl::init(2), whitelist());
+	cl::opt<unsigned> preoptimizationRounds("preoptimize-rounds", cl::desc("Maximum number of pre-optimization rounds; rounds after the first only revisit functions that the previous one changed"), cl::init(4), whitelist());
+	cl::opt<unsigned> jobs("jobs", cl::desc("Number of worker threads that lifting, optimization and the back end share"), cl::init(1), whitelist());
+	cl::opt<string> batchList("batch", cl::desc("Decompile every input listed in <file> (one path per line) instead of a single input program"), cl::value_desc("file"), whitelist());
+	cl::opt<string> batchOutput("batch-out", cl::desc("Directory where --batch writes the output of each input, prefixed with its position in the list"), cl::value_desc("directory"), cl::init("."), whitelist());
+	cl::opt<unsigned> batchJobs("batch-jobs", cl::desc("Number of --batch inputs decompiled at once"), cl::init(1), whitelist());
+	cl::opt<bool> serverMode("serve", cl::desc("Keep the input program loaded and decompile the functions at the virtual addresses read from standard input, one per line, answering with JSON lines"), whitelist());
+	cl::opt<bool> workerProcesses("worker-processes", cl::desc("With --jobs, run function passes after argument recovery in forked processes instead of threads, including Python passes"), whitelist());
+	cl::opt<bool> deterministicOutput("deterministic", cl::desc("Produce the same output on every run with the same arguments; functions are lifted on a single thread even with --jobs"), whitelist());
+	cl::opt<unsigned> maxFunctionInstructions("max-function-instructions", cl::desc("Functions with more IR instructions than this are structured with unsimplified conditions (0 for no limit)"), cl::init(0), whitelist());
+	cl::opt<unsigned> maxFunctionBlocks("max-function-blocks", cl::desc("Functions with more basic blocks than this are structured with unsimplified conditions (0 for no limit)"), cl::init(0), whitelist());
+	cl::opt<unsigned> maxStructuringTime("max-structuring-ms", cl::desc("Milliseconds after which the rest of a function is structured with unsimplified conditions (0 for no limit)"), cl::init(0), whitelist());
+	cl::opt<unsigned> outlineRegionBlocks("outline-regions", cl::desc("Move the single-entry, single-exit regions of functions with more basic blocks than this to helper functions that are structured separately (0 to disable)"), cl::value_desc("blocks"), cl::init(0), whitelist());
+	cl::opt<bool> jsonOutput("json", cl::desc("Print functions as JSON lines (one object per function) instead of pseudocode"), whitelist());
+	cl::opt<string> outputDirectory("output-dir", cl::desc("Print each function to its own <address>_<name>.c file of <directory>, from the thread that decompiled it, and list them in <directory>/manifest.json"), cl::value_desc("directory"), whitelist());
+	cl::opt<bool> streamOutput("stream", cl::desc("Print and free each function as soon as it is decompiled"), whitelist());
+	cl::opt<string> cacheDirectory("cache-dir", cl::desc("Reuse parsed headers and the pseudocode of functions whose code didn't change since a previous run, stored in <directory>"), cl::value_desc("directory"), whitelist());
+	cl::opt<string> callInfoDatabasePath("callinfo-db", cl::desc("Reuse the call information of functions that didn't change since a previous run, stored in <file>"), cl::value_desc("file"), whitelist());
+	cl::opt<string> signatureDatabase("signatures", cl::desc("Functions whose code matches a signature of <file> are named after it and given its prototype instead of being lifted"), cl::value_desc("file"), whitelist());
+	cl::opt<string> signatureOutput("write-signatures", cl::desc("Write the signatures of the named functions of the input program to <file> and exit"), cl::value_desc("file"), whitelist());
+	cl::opt<string> semanticsReport("semantics-report", cl::desc("Write the IR size of the semantics of common x86 instructions, lifted alone, before and after phase one cleanup to <file> and exit"), cl::value_desc("file"), whitelist());
+	cl::opt<bool> scanPrologues("scan-prologues", cl::desc("Also lift code that looks like the start of a function, for stripped executables without unwind information (full disassembly only)"), whitelist());
+	cl::opt<bool> discoveryIndex("discovery-index", cl::desc("Keep the functions found before lifting in <input program>.fcdindex, and reuse them in later runs on the same executable"), whitelist());
+	cl::opt<unsigned> memoryLimit("memory-limit", cl::desc("Run phase one on functions as they are lifted, and keep the bodies of lifted functions in temporary files while the process uses more than <n> MiB"), cl::value_desc("n"), cl::init(0), whitelist());
+	cl::opt<bool> hugePageArenas("huge-pages", cl::desc("Back large arena chunks with transparent huge pages where available"), whitelist());
+	cl::opt<string> timePhases("time-phases", cl::desc("Write per-phase timing, memory and pass statistics as JSON to <file> (stderr if omitted)"), cl::value_desc("file"), cl::ValueOptional, whitelist());
+	cl::opt<string> progressOutput("progress", cl::desc("Report the phase, functions done and an estimated time to completion periodically to <file> (stderr if omitted)"), cl::value_desc("file"), cl::ValueOptional, whitelist());
+	cl::opt<unsigned> progressInterval("progress-interval", cl::desc("Seconds between --progress reports"), cl::init(10), whitelist());
+	cl::opt<unsigned> timedFunctions("time-functions", cl::desc("Number of functions that took the most time listed by --time-phases"), cl::init(20), whitelist());
+	cl::opt<string> traceOutput("trace", cl::desc("Write a Chrome trace_event timeline of phases, lifted functions, passes and back end functions to <file>"), cl::value_desc("file"), whitelist());
+	cl::opt<unsigned> backendRuns("backend-runs", cl::desc("With an optimized input module (-m -m -m), run the back end on <n> fresh copies of it and only print the first one, to time the back end alone"), cl::value_desc("n"), cl::init(1), whitelist());
 	
-	cl::list<string> additionalPasses("opt", cl::desc("Insert LLVM optimization pass; a pass name ending in .py is interpreted as a Python script. Requires default pass pipeline."), whitelist());
-	cl::opt<string> customPassPipeline("opt-pipeline", cl::desc("Customize pass pipeline. Empty string lets you order passes through $EDITOR; otherwise, must be a whitespace-separated list of passes."), cl::init("default"), whitelist());
+	cl::list<string> additionalPasses("opt", cl::desc("Insert LLVM optimization pass; a pass name ending in .py is interpreted as a Python script, and one ending in .so as a native plugin (see plugin.h). Requires default pass pipeline."), whitelist());
+	cl::opt<string> customPassPipeline("opt-pipeline", cl::desc("Customize pass pipeline. \"fast\" only runs the passes needed for correct output, for triage. Empty string lets you order passes through $EDITOR; otherwise, must be a whitespace-separated list of passes."), cl::init("default"), whitelist());
 	
 	cl::list<string> headers("header", cl::desc("Path of a header file to parse for function declarations. Can be specified multiple times"), whitelist());
 	cl::list<string> headerSearchPath("I", cl::desc("Additional directory to search headers in. Can be specified multiple times"), whitelist());
@@ -82,6 +160,7 @@ namespace
 	cl::alias additionalPassesAlias("O", cl::desc("Alias for --opt"), cl::aliasopt(additionalPasses), whitelist());
 	cl::alias inputIsModuleAlias("m", cl::desc("Alias for --module-in"), cl::aliasopt(inputIsModule), whitelist());
 	cl::alias outputIsModuleAlias("n", cl::desc("Alias for --module-out"), cl::aliasopt(outputIsModule), whitelist());
+	cl::alias jobsAlias("j", cl::desc("Alias for --jobs"), cl::aliasopt(jobs), whitelist());
 	
 	template<int (*)()> // templated to ensure multiple instatiation of the static variables
 	inline int optCount(const cl::list<bool>& list)
@@ -114,6 +193,12 @@ namespace
 		return optCount<moduleOutCount>(outputIsModule);
 	}
 	
+	// Names only help people who read the IR.
+	inline bool namesValues()
+	{
+		return valueNames.getNumOccurrences() > 0 ? valueNames : moduleOutCount() > 0;
+	}
+	
 	void pruneOptionList(StringMap<cl::Option*>& list)
 	{
 		for (auto& pair : list)
@@ -125,6 +210,9 @@ namespace
 		}
 	}
 	
+	// The emulator is built specialized for this configuration unless X86_64_ONLY_EMULATOR is turned off in CMake.
+	const x86_config config64 = { x86_isa64, 8, X86_REG_RIP, X86_REG_RSP, X86_REG_RBP };
+	
 	template<typename T>
 	string errorOf(const ErrorOr<T>& error)
 	{
@@ -159,15 +247,23 @@ namespace
 		return count;
 	}
 	
-	bool refillEntryPoints(const TranslationContext& transl, const Executable& executable, unordered_map<uint64_t, SymbolInfo>& toVisit, size_t iterations)
+	// How many calls away from the entry points functions are lifted.
+	size_t maxCallDepth()
+	{
+		return isExclusiveDisassembly() ? 0 : isPartialDisassembly() ? partialDepth : SIZE_MAX;
+	}
+	
+	// Call targets for which isSkipped returns true are never lifted.
+	bool refillEntryPoints(const TranslationContext& transl, const Executable& executable, const function<bool(uint64_t)>& isSkipped, map<uint64_t, SymbolInfo>& toVisit, size_t iterations)
 	{
-		if (isExclusiveDisassembly() || (isPartialDisassembly() && iterations > 1))
+		if (iterations > maxCallDepth())
 		{
 			return false;
 		}
 		
 		for (uint64_t entryPoint : transl.getDiscoveredEntryPoints())
 		{
+			if (!isSkipped(entryPoint))
 			if (auto symbolInfo = executable.getInfo(entryPoint))
 			{
 				toVisit.insert({entryPoint, *symbolInfo});
@@ -184,6 +280,23 @@ namespace
 		LLVMContext llvm;
 		PythonContext python;
 		vector<Pass*> optimizeAndTransformPasses;
+		unique_ptr<PhaseStatistics> phaseStats;
+		unique_ptr<TraceRecorder> traceRecorder;
+		unique_ptr<ProgressReporter> progress;
+		unique_ptr<DecompilationCache> cache;
+		unique_ptr<CallInformationDatabase> callInfoDatabase;
+		// Kept after the module is generated so that targets resolved during optimization can be lifted into it.
+		unique_ptr<TranslationContext> translation;
+		unique_ptr<FunctionSignatures> signatures;
+		// Functions that matched a signature, by address, with the name of the signature.
+		unordered_map<uint64_t, string> libraryFunctions;
+		// Functions that have the same body as a function at another address, mapped to that address.
+		map<uint64_t, uint64_t> duplicateFunctions;
+		MemorySSACache memorySSAs;
+		// Kept for the back end, which runs after the executable is released.
+		shared_ptr<const StringLiteralIndex> stringLiterals;
+		// Started the first time that a phase runs in parallel, and shared by every phase after it.
+		unique_ptr<TaskScheduler> scheduler;
 		
 		static void aliasAnalysisHooks(Pass& pass, Function& fn, AAResults& aar)
 		{
@@ -197,16 +310,113 @@ namespace
 			}
 		}
 	
-		static legacy::PassManager createBasePassManager()
+		static void addAliasAnalyses(legacy::PassManagerBase& pm)
 		{
-			legacy::PassManager pm;
 			pm.add(createTypeBasedAAWrapperPass());
 			pm.add(createScopedNoAliasAAWrapperPass());
 			pm.add(createBasicAAWrapperPass());
 			pm.add(createProgramMemoryAliasAnalysis());
+		}
+		
+		TaskScheduler& getScheduler()
+		{
+			if (scheduler == nullptr)
+			{
+				scheduler.reset(new TaskScheduler(max(jobs.getValue(), 1u)));
+			}
+			return *scheduler;
+		}
+		
+		legacy::PassManager createBasePassManager()
+		{
+			legacy::PassManager pm;
+			addAliasAnalyses(pm);
+			pm.add(new MemorySSAProvider(&memorySSAs));
 			return pm;
 		}
 		
+		// Analyses for the pass managers of parallel function pass workers. They don't get a ParameterRegistry.
+		static void addParallelWorkerAnalyses(legacy::PassManagerBase& pm, Executable* executable)
+		{
+			addAliasAnalyses(pm);
+			pm.add(new ExecutableWrapper(executable));
+			pm.add(createExternalAAWrapperPass(&Main::aliasAnalysisHooks));
+		}
+		
+		void addPass(legacy::PassManager& pm, Pass* pass)
+		{
+			if (phaseStats)
+			{
+				phaseStats->addTimedPass(pm, pass);
+			}
+			else
+			{
+				TraceRecorder::addPass(pm, pass);
+			}
+			ProgressReporter::addPassMarker(pm, *pass);
+		}
+		
+		// Function pass managers run their passes one function at a time, so passes aren't timed individually. They
+		// are still traced.
+		void addPass(legacy::FunctionPassManager& pm, Pass* pass)
+		{
+			TraceRecorder::addPass(pm, pass);
+		}
+		
+		template<typename TPassManager>
+		void addPhaseOnePasses(TPassManager& pm)
+		{
+			addPass(pm, createDeadCodeEliminationPass());
+			addPass(pm, createCFGSimplificationPass());
+			addPass(pm, createInstructionCombiningPass());
+			addPass(pm, createRegisterPointerPromotionPass());
+			addPass(pm, createRegisterForwardingPass());
+			addPass(pm, createDeadStoreEliminationPass());
+			addPass(pm, createInstructionCombiningPass());
+			addPass(pm, createCFGSimplificationPass());
+		}
+		
+		template<typename TPassManager>
+		void addPreoptimizationPasses(TPassManager& pm)
+		{
+			// GVN is left to the optimization pipeline. Before argument recovery, most of what it does on lifted code
+			// is forwarding register values, which regforward does without querying memory dependences.
+			addPass(pm, createRegisterForwardingPass());
+			addPass(pm, createEarlyCSEPass());
+			addPass(pm, createReadOnlyLoadFoldingPass());
+			addPass(pm, createDeadStoreEliminationPass());
+			addPass(pm, createInstructionCombiningPass());
+			addPass(pm, createCFGSimplificationPass());
+		}
+		
+		void beginPhase(string name)
+		{
+			if (traceRecorder)
+			{
+				traceRecorder->beginPhase(name);
+			}
+			if (progress)
+			{
+				progress->beginPhase(name);
+			}
+			if (phaseStats)
+			{
+				phaseStats->beginPhase(move(name));
+			}
+		}
+		
+		void endPhase(const Module* module)
+		{
+			if (traceRecorder)
+			{
+				traceRecorder->endPhase();
+			}
+			if (phaseStats)
+			{
+				phaseStats->endPhase(module);
+			}
+		}
+		
 		vector<Pass*> createPassesFromList(const vector<string>& passNames)
 		{
 			vector<Pass*> result;
@@ -256,6 +466,24 @@ namespace
 							return vector<Pass*>();
 						}
 					}
+					else if (ext == ".so" || ext == ".dylib")
+					{
+						string errorMessage;
+						if (auto passOrError = createPluginPass(passName, errorMessage))
+						{
+							result.push_back(passOrError.get());
+						}
+						else
+						{
+							cerr << getProgramName() << ": couldn't load " << passName << ": " << errorOf(passOrError);
+							if (errorMessage.size() > 0)
+							{
+								cerr << ": " << errorMessage;
+							}
+							cerr << endl;
+							return vector<Pass*>();
+						}
+					}
 					else if (const PassInfo* pi = pr->getPassInfo(passName))
 					{
 						result.push_back(pi->createPass());
@@ -289,6 +517,7 @@ namespace
 			passListOs << "# Enter the name of the LLVM or fcd passes that you want to run on the module.\n";
 			passListOs << "# Files starting with a # symbol are ignored.\n";
 			passListOs << "# Names ending with .py are assumed to be Python scripts implementing passes.\n";
+			passListOs << "# Names ending with .so are assumed to be native plugins implementing passes.\n";
 			for (const string& passName : basePasses)
 			{
 				passListOs << passName << '\n';
@@ -359,64 +588,148 @@ namespace
 		Main(int argc, char** argv)
 		: argc(argc), argv(argv), python(argv[0])
 		{
+			md::registerKinds(llvm);
+			if (timePhases.getNumOccurrences() > 0)
+			{
+				phaseStats.reset(new PhaseStatistics(timePhases.empty() ? "-" : timePhases, timedFunctions));
+			}
+			if (traceOutput.size() > 0)
+			{
+				traceRecorder.reset(new TraceRecorder(traceOutput));
+			}
+			if (progressOutput.getNumOccurrences() > 0)
+			{
+				progress.reset(new ProgressReporter(progressOutput.empty() ? "-" : progressOutput, progressInterval));
+			}
+			
+			if (callInfoDatabasePath.size() > 0)
+			{
+				callInfoDatabase.reset(new CallInformationDatabase(callInfoDatabasePath));
+			}
 		}
 	
 		string getProgramName() { return sys::path::stem(argv[0]); }
+		
+		// Writes what is normally written on destruction, for processes that exit without destroying this object.
+		void finish()
+		{
+			phaseStats.reset();
+			traceRecorder.reset();
+			progress.reset();
+			callInfoDatabase.reset();
+		}
+
 		LLVMContext& getContext() { return llvm; }
-	
-		ErrorOr<unique_ptr<Executable>> parseExecutable(MemoryBuffer& executableCode)
+		
+		void memoryReleased(string what)
 		{
-			auto start = reinterpret_cast<const uint8_t*>(executableCode.getBufferStart());
-			auto end = reinterpret_cast<const uint8_t*>(executableCode.getBufferEnd());
-			return Executable::parse(start, end);
+			if (phaseStats)
+			{
+				phaseStats->memoryReleased(move(what));
+			}
 		}
 		
-		ErrorOr<unique_ptr<Module>> generateAnnotatedModule(Executable& executable, const string& moduleName = "fcd-out")
+		// The translation context (with its Capstone handle and code generator module) is only needed until late
+		// targets are resolved.
+		void releaseTranslation()
 		{
-			x86_config config64 = { x86_isa64, 8, X86_REG_RIP, X86_REG_RSP, X86_REG_RBP };
-			TranslationContext transl(llvm, executable, config64, moduleName);
-			
-			// Load headers here, since this is the earliest point where we have an executable and a module.
-			auto cDecls = HeaderDeclarations::create(transl.get(), headerSearchPath.begin(), headerSearchPath.end(), headers.begin(), headers.end(), errs());
-			if (!cDecls)
+			translation.reset();
+			memoryReleased("translation");
+		}
+		
+		// The back end prints pointers to string literals as the literal. The index outlives the executable.
+		void keepStringLiterals(const Executable& executable)
+		{
+			stringLiterals = executable.getStringLiterals();
+		}
+		
+		// Memory SSA is only cached for the LLVM phases; the back end doesn't use it.
+		void releaseAnalyses()
+		{
+			memorySSAs.clear();
+			memoryReleased("memory-ssa");
+		}
+		
+		// Each function module keeps its own definition, the definitions of prototypes (which carry their metadata) and
+		// of global variables. Other functions become declarations.
+		bool writeFunctionModules(Module& module, const string& directory)
+		{
+			if (auto error = sys::fs::create_directories(directory))
 			{
-				return make_error_code(FcdError::Main_HeaderParsingError);
+				errs() << getProgramName() << ": can't create " << directory << ": " << error.message() << '\n';
+				return false;
 			}
 			
-			md::addIncludedFiles(transl.get(), cDecls->getIncludedFiles());
-	
-			unordered_map<uint64_t, SymbolInfo> toVisit;
-			for (uint64_t address : executable.getVisibleEntryPoints())
+			for (Function& fn : module)
 			{
-				auto symbolInfo = executable.getInfo(address);
-				// Entry points are always considered when naming symbols, but only used in full disassembly mode.
-				// Otherwise, we expect symbols to be specified with the command line.
-				if (isFullDisassembly())
+				if (fn.isDeclaration() || md::isPrototype(fn))
 				{
-					assert(symbolInfo != nullptr);
-					toVisit.insert({symbolInfo->virtualAddress, *symbolInfo});
+					continue;
 				}
-			}
-	
-			unordered_set<uint64_t> entryPoints(additionalEntryPoints.begin(), additionalEntryPoints.end());
-			for (uint64_t address : entryPoints)
-			{
-				if (auto symbolInfo = executable.getInfo(address))
+				
+				ValueToValueMapTy valueMap;
+				auto functionModule = CloneModule(&module, valueMap, [&](const GlobalValue* value)
 				{
-					toVisit.insert({symbolInfo->virtualAddress, *symbolInfo});
+					if (auto function = dyn_cast<Function>(value))
+					{
+						return function == &fn || md::isPrototype(*function);
+					}
+					return true;
+				});
+				
+				error_code error;
+				SmallString<128> path(directory);
+				sys::path::append(path, fn.getName() + ".bc");
+				raw_fd_ostream output(path, error, sys::fs::F_None);
+				if (error)
+				{
+					errs() << getProgramName() << ": can't open " << path << ": " << error.message() << '\n';
+					return false;
 				}
-				else
+				WriteBitcodeToFile(functionModule.get(), output);
+			}
+			return true;
+		}
+		
+		int emitModule(Module& module)
+		{
+			if (splitModuleOutput.size() > 0)
+			{
+				return writeFunctionModules(module, splitModuleOutput) ? 0 : 1;
+			}
+			
+			if (bitcodeOutput)
+			{
+				if (CheckBitcodeOutputToConsole(outs()))
 				{
-					return make_error_code(FcdError::Main_EntryPointOutOfMappedMemory);
+					return 1;
 				}
+				WriteBitcodeToFile(&module, outs());
 			}
-	
-			if (toVisit.size() == 0)
+			else
 			{
-				return make_error_code(FcdError::Main_NoEntryPoint);
+				module.print(outs(), nullptr);
 			}
+			return 0;
+		}
 	
-			size_t iterations = 0;
+		ErrorOr<unique_ptr<Executable>> parseExecutable(MemoryBuffer& executableCode)
+		{
+			auto start = reinterpret_cast<const uint8_t*>(executableCode.getBufferStart());
+			auto end = reinterpret_cast<const uint8_t*>(executableCode.getBufferEnd());
+			return Executable::parse(start, end);
+		}
+		
+		// Lifts the functions of toVisit, and then the functions that they call, within the limits of the disassembly
+		// mode. iterations is how many rounds of call targets are already behind toVisit. When set, lifted is called
+		// with every function right after it is lifted, and returning false stops lifting.
+		bool liftFunctions(TranslationContext& transl, const Executable& executable, map<uint64_t, SymbolInfo>& toVisit, size_t iterations, const function<bool(Function&)>& lifted = nullptr)
+		{
+			auto isSkipped = [this](uint64_t address)
+			{
+				return isNotLifted(address);
+			};
+			
 			do
 			{
 				while (toVisit.size() > 0)
@@ -424,173 +737,1187 @@ namespace
 					auto iter = toVisit.begin();
 					auto functionInfo = iter->second;
 					toVisit.erase(iter);
-			
+					
 					if (functionInfo.name.size() > 0)
 					{
 						transl.setFunctionName(functionInfo.virtualAddress, functionInfo.name);
 					}
 					
+					auto liftStart = PhaseStatistics::clock::now();
 					Function* fn = transl.createFunction(functionInfo.virtualAddress);
 					// Couldn't decompile, abort
 					if (fn == nullptr)
 					{
-						return make_error_code(FcdError::Main_DecompilationError);
+						return false;
+					}
+					
+					if (phaseStats)
+					{
+						phaseStats->functionFinished(*fn, chrono::duration<double>(PhaseStatistics::clock::now() - liftStart).count());
+					}
+					if (progress)
+					{
+						progress->functionFinished();
+						progress->setTotal(progress->getFunctionsDone() + toVisit.size());
+					}
+					
+					if (lifted && !lifted(*fn))
+					{
+						return false;
 					}
 				}
 				iterations++;
 			}
-			while (refillEntryPoints(transl, executable, toVisit, iterations));
-	
-			// Perform early optimizations to make the module suitable for analysis
-			auto module = transl.take();
-			legacy::PassManager phaseOne = createBasePassManager();
-			phaseOne.add(createExternalAAWrapperPass(&Main::aliasAnalysisHooks));
-			phaseOne.add(createDeadCodeEliminationPass());
-			phaseOne.add(createCFGSimplificationPass());
-			phaseOne.add(createInstructionCombiningPass());
-			phaseOne.add(createRegisterPointerPromotionPass());
-			phaseOne.add(createGVNPass());
-			phaseOne.add(createDeadStoreEliminationPass());
-			phaseOne.add(createInstructionCombiningPass());
-			phaseOne.add(createCFGSimplificationPass());
-			phaseOne.add(createGlobalDCEPass());
-			phaseOne.run(*module);
-	
-			// Annotate stubs before returning module
-			Function* jumpIntrin = module->getFunction("x86_jump_intrin");
-			vector<Function*> functions;
-			for (Function& fn : module->getFunctionList())
+			while (refillEntryPoints(transl, executable, isSkipped, toVisit, iterations));
+			return true;
+		}
+		
+		// With --memory-limit, functions go through phase one as soon as they are lifted instead of once everything is
+		// lifted, so that raw lifted code never piles up. When the process grows over the limit, the bodies that phase
+		// one is done with move to temporary bitcode files until lifting is over. The rest of the pipeline has module
+		// passes that look at every function, so bodies come back before it starts.
+		bool liftWithinMemoryLimit(TranslationContext& transl, Executable& executable, map<uint64_t, SymbolInfo>& toVisit)
+		{
+			MemorySSACache liftMemorySSAs;
+			legacy::FunctionPassManager phaseOne(&transl.get());
+			addParallelWorkerAnalyses(phaseOne, &executable);
+			phaseOne.add(new MemorySSAProvider(&liftMemorySSAs));
+			addPhaseOnePasses(phaseOne);
+			phaseOne.doInitialization();
+			
+			// A process doesn't always give memory back to the system, so it can stay over the limit after a spill.
+			// Spilling at most every few functions keeps that from writing a file per function.
+			const size_t minimumSpill = 32;
+			uint64_t limit = static_cast<uint64_t>(memoryLimit) * 1024 * 1024;
+			FunctionSpill spill;
+			vector<Function*> done;
+			bool lifted = liftFunctions(transl, executable, toVisit, 0, [&](Function& fn)
 			{
-				if (md::isPrototype(fn))
+				phaseOne.run(fn);
+				liftMemorySSAs.erase(fn);
+				done.push_back(&fn);
+				if (done.size() < minimumSpill || PhaseStatistics::currentResidentSetSize() <= limit)
 				{
-					continue;
+					return true;
 				}
 				
-				BasicBlock& entry = fn.getEntryBlock();
-				auto terminator = entry.getTerminator();
-				if (isa<UnreachableInst>(terminator))
+				string errorMessage;
+				if (!spill.spill(transl.get(), done, errorMessage))
+				{
+					errs() << getProgramName() << ": can't spill function bodies: " << errorMessage << '\n';
+					return false;
+				}
+				done.clear();
+				memoryReleased("spilled-functions");
+				return true;
+			});
+			phaseOne.doFinalization();
+			
+			string errorMessage;
+			if (!spill.restore(transl.get(), errorMessage))
+			{
+				errs() << getProgramName() << ": can't restore spilled function bodies: " << errorMessage << '\n';
+				return false;
+			}
+			return lifted;
+		}
+		
+		// Library functions become prototypes, and duplicates become aliases of the function that has their body.
+		bool isNotLifted(uint64_t address) const
+		{
+			return libraryFunctions.count(address) != 0 || duplicateFunctions.count(address) != 0;
+		}
+		
+		uint64_t liftedAddress(uint64_t address) const
+		{
+			auto iter = duplicateFunctions.find(address);
+			return iter == duplicateFunctions.end() ? address : iter->second;
+		}
+		
+		// Groups discovered functions by body hash. Each group is lifted once, preferably at an entry point (partial
+		// disassembly prunes the bodies of other functions), and otherwise at its lowest address.
+		void findDuplicates(const FunctionDiscovery& discovery, const Executable& executable, map<uint64_t, SymbolInfo>& toVisit)
+		{
+			unordered_map<string, vector<uint64_t>> bodies;
+			for (const auto& pair : discovery.getFunctions())
+			{
+				if (!pair.second.bodyHash.empty() && libraryFunctions.count(pair.first) == 0)
+				{
+					bodies[pair.second.bodyHash].push_back(pair.first);
+				}
+			}
+			
+			duplicateFunctions.clear();
+			for (const auto& pair : bodies)
+			{
+				const vector<uint64_t>& addresses = pair.second;
+				auto representative = find_if(addresses.begin(), addresses.end(), isEntryPoint);
+				uint64_t lifted = representative == addresses.end() ? addresses.front() : *representative;
+				for (uint64_t address : addresses)
 				{
-					if (auto prev = dyn_cast<CallInst>(terminator->getPrevNode()))
-					if (prev->getCalledFunction() == jumpIntrin)
-					if (auto load = dyn_cast<LoadInst>(prev->getOperand(2)))
-					if (auto constantExpr = dyn_cast<ConstantExpr>(load->getPointerOperand()))
+					if (address != lifted)
 					{
-						unique_ptr<Instruction> inst(constantExpr->getAsInstruction());
-						if (auto int2ptr = dyn_cast<IntToPtrInst>(inst.get()))
+						duplicateFunctions.insert({address, lifted});
+						// Functions that were going to be lifted for themselves are lifted through their body.
+						if (toVisit.erase(address) != 0)
+						if (auto symbolInfo = executable.getInfo(lifted))
 						{
-							auto value = cast<ConstantInt>(int2ptr->getOperand(0));
-							auto intValue = value->getLimitedValue();
-							if (const StubInfo* stubTarget = executable.getStubTarget(intValue))
-							{
-								if (Function* cFunction = cDecls->prototypeForImportName(stubTarget->name))
-								{
-									md::ensureFunctionBody(*cFunction);
-									md::setStubTarget(fn, *cFunction);
-								}
-								
-								// If we identified no function from the header file, this gives the import its real
-								// name. Otherwise, it'll prefix the name with some number.
-								fn.setName(stubTarget->name);
-							}
+							toVisit.insert({lifted, *symbolInfo});
 						}
 					}
 				}
 			}
-			return move(module);
 		}
-
-		bool preoptimizeModule(Module& module, raw_ostream& errorOutput, Executable* executable = nullptr)
+		
+		// Calls to duplicates go to the function that was lifted for their body, which lists them as aliases.
+		void mergeDuplicates(Module& module, const Executable& executable)
 		{
-			// Do we still have instances of the unimplemented intrinsic? Bail out here if so.
-			size_t errorCount = 0;
-			if (Function* unimplemented = module.getFunction("x86_unimplemented"))
-			{
-				errorCount += forEachCall(unimplemented, 1, [](const string& message) {
-					cerr << "translation for instruction '" << message << "' is missing" << endl;
-				});
-			}
-	
-			if (Function* assertionFailure = module.getFunction("x86_assertion_failure"))
+			unordered_map<uint64_t, Function*> lifted;
+			vector<Function*> duplicates;
+			for (Function& fn : module)
 			{
-				errorCount += forEachCall(assertionFailure, 0, [](const string& message) {
-					cerr << "translation assertion failure: " << message << endl;
-				});
+				if (auto address = md::getVirtualAddress(fn))
+				{
+					uint64_t virtualAddress = address->getLimitedValue();
+					if (!md::isPrototype(fn))
+					{
+						lifted[virtualAddress] = &fn;
+					}
+					else if (duplicateFunctions.count(virtualAddress) != 0)
+					{
+						duplicates.push_back(&fn);
+					}
+				}
 			}
-	
-			if (errorCount > 0)
+			
+			for (const auto& pair : duplicateFunctions)
 			{
-				cerr << "incorrect or missing translations; cannot decompile" << endl;
-				return false;
+				auto iter = lifted.find(pair.second);
+				if (iter != lifted.end())
+				{
+					auto symbolInfo = executable.getInfo(pair.first);
+					bool hasName = symbolInfo && symbolInfo->name.size() > 0;
+					md::addAlias(*iter->second, hasName ? symbolInfo->name : ParallelTranslation::canonicalName(pair.first));
+				}
 			}
-	
-			// Pre-optimize the module before running the customizable pipeline.
-			for (int i = 0; i < 2; i++)
+			
+			for (Function* duplicate : duplicates)
 			{
-				auto phaseTwo = createBasePassManager();
-				phaseTwo.add(new ExecutableWrapper(executable));
-				phaseTwo.add(createParameterRegistryPass());
-				phaseTwo.add(createExternalAAWrapperPass(&Main::aliasAnalysisHooks));
-				phaseTwo.add(createGVNPass());
-				phaseTwo.add(createDeadStoreEliminationPass());
-				phaseTwo.add(createInstructionCombiningPass());
-				phaseTwo.add(createCFGSimplificationPass());
-				phaseTwo.run(module);
-		
-#if DEBUG
-				if (verifyModule(module, &errorOutput))
+				uint64_t address = md::getVirtualAddress(*duplicate)->getLimitedValue();
+				auto iter = lifted.find(duplicateFunctions[address]);
+				if (iter != lifted.end() && iter->second->getType() == duplicate->getType())
 				{
-					// errors!
-					return false;
+					duplicate->replaceAllUsesWith(iter->second);
+					duplicate->eraseFromParent();
 				}
-#endif
 			}
-			return true;
 		}
 		
-		bool optimizeAndTransformModule(Module& module, raw_ostream& errorOutput, Executable* executable = nullptr)
+		// Names fn and, when its prototype is known, makes it point to it.
+		void applyPrototype(Function& fn, StringRef name, HeaderDeclarations& cDecls)
 		{
-			// Phase 3: make into functions with arguments, run codegen.
-			auto passManager = createBasePassManager();
-			passManager.add(new ExecutableWrapper(executable));
-			passManager.add(createParameterRegistryPass());
-			passManager.add(createExternalAAWrapperPass(&Main::aliasAnalysisHooks));
-			for (Pass* pass : optimizeAndTransformPasses)
+			// Built-in libc prototypes don't need headers; headers cover everything else.
+			Module& module = *fn.getParent();
+			Function* cFunction = libcPrototypeForImportName(module, name);
+			if (cFunction == nullptr)
 			{
-				passManager.add(pass);
+				cFunction = cDecls.prototypeForImportName(name);
 			}
-			passManager.run(module);
-	
-#ifdef DEBUG
-			if (verifyModule(module, &errorOutput))
+			
+			if (cFunction != nullptr)
 			{
-				// errors!
-				return false;
+				md::ensureFunctionBody(*cFunction);
+				md::setStubTarget(fn, *cFunction);
 			}
-#endif
-			return true;
+			
+			// If we identified no function from the header file, this gives the function its real name. Otherwise,
+			// it'll prefix the name with some number.
+			fn.setName(name);
 		}
-
-		bool generateEquivalentPseudocode(Module& module, raw_ostream& output)
+		
+		// Import stubs jump through a constant pointer after phase one. They are given the name of the import and, when
+		// its prototype is known, point to it.
+		void annotateStub(Function& fn, Executable& executable, HeaderDeclarations& cDecls)
+		{
+			Module& module = *fn.getParent();
+			Function* jumpIntrin = module.getFunction("x86_jump_intrin");
+			BasicBlock& entry = fn.getEntryBlock();
+			auto terminator = entry.getTerminator();
+			if (isa<UnreachableInst>(terminator))
+			{
+				if (auto prev = dyn_cast<CallInst>(terminator->getPrevNode()))
+				if (prev->getCalledFunction() == jumpIntrin)
+				if (auto load = dyn_cast<LoadInst>(prev->getOperand(2)))
+				if (auto constantExpr = dyn_cast<ConstantExpr>(load->getPointerOperand()))
+				{
+					unique_ptr<Instruction> inst(constantExpr->getAsInstruction());
+					if (auto int2ptr = dyn_cast<IntToPtrInst>(inst.get()))
+					{
+						auto value = cast<ConstantInt>(int2ptr->getOperand(0));
+						auto intValue = value->getLimitedValue();
+						if (const StubInfo* stubTarget = executable.getStubTarget(intValue))
+						{
+							applyPrototype(fn, stubTarget->name, cDecls);
+						}
+					}
+				}
+			}
+		}
+		
+		// When indexPath isn't empty, functions are discovered with the help of the index file at that path, which is
+		// updated with the functions that it didn't have.
+		ErrorOr<unique_ptr<Module>> generateAnnotatedModule(Executable& executable, const string& moduleName = "fcd-out", const string& indexPath = "")
+		{
+			translation.reset(new TranslationContext(llvm, executable, config64, moduleName));
+			translation->setValueNames(namesValues());
+			TranslationContext& transl = *translation;
+			
+			// Load headers here, since this is the earliest point where we have an executable and a module.
+			auto cDecls = HeaderDeclarations::create(transl.get(), headerSearchPath.begin(), headerSearchPath.end(), headers.begin(), headers.end(), errs(), cacheDirectory);
+			if (!cDecls)
+			{
+				return make_error_code(FcdError::Main_HeaderParsingError);
+			}
+			
+			md::addIncludedFiles(transl.get(), cDecls->getIncludedFiles());
+			
+			if (signatureDatabase.size() > 0 && !signatures)
+			{
+				string errorMessage;
+				signatures.reset(new FunctionSignatures);
+				if (!signatures->load(signatureDatabase, errorMessage))
+				{
+					errs() << getProgramName() << ": can't load signatures from " << signatureDatabase << ": " << errorMessage << '\n';
+					signatures.reset();
+					return make_error_code(FcdError::Main_SignatureDatabaseError);
+				}
+			}
+	
+			beginPhase("lift");
+			map<uint64_t, SymbolInfo> toVisit;
+			// Entry points are always considered when naming symbols, but only used in full disassembly mode.
+			// Otherwise, we expect symbols to be specified with the command line.
+			if (isFullDisassembly())
+			{
+				for (const SymbolInfo& symbolInfo : executable.getVisibleSymbols())
+				{
+					toVisit.insert({symbolInfo.virtualAddress, symbolInfo});
+				}
+				
+				// Symbols win over guesses at the same address.
+				if (scanPrologues)
+				{
+					TraceSpan span("scanForPrologues", "lift");
+					for (uint64_t address : scanForPrologues(executable, config64))
+					{
+						if (auto symbolInfo = executable.getInfo(address))
+						{
+							toVisit.insert({address, *symbolInfo});
+						}
+					}
+				}
+			}
+	
+			unordered_set<uint64_t> entryPoints(additionalEntryPoints.begin(), additionalEntryPoints.end());
+			for (uint64_t address : entryPoints)
+			{
+				if (auto symbolInfo = executable.getInfo(address))
+				{
+					toVisit.insert({symbolInfo->virtualAddress, *symbolInfo});
+				}
+				else
+				{
+					return make_error_code(FcdError::Main_EntryPointOutOfMappedMemory);
+				}
+			}
+	
+			if (toVisit.size() == 0)
+			{
+				return make_error_code(FcdError::Main_NoEntryPoint);
+			}
+	
+			// Worker modules are named after the worker that lifted them, which depends on scheduling. Workers also keep
+			// every function that they lift in memory until the end, which --memory-limit is meant to avoid.
+			bool liftInParallel = jobs > 1 && !deterministicOutput && memoryLimit == 0;
+			if (liftInParallel && !executable.canMapConcurrently())
+			{
+				errs() << getProgramName() << ": executable can't be mapped from several threads; ignoring --jobs\n";
+				liftInParallel = false;
+			}
+			
+			// Lifting stops at calls to imports that don't return. Headers are only looked up until lifting is done
+			// here; functions that are lifted later only know about libc.
+			mutex headersMutex;
+			auto isNoReturnImport = [&](StringRef importName)
+			{
+				if (isNoReturnLibcImport(importName))
+				{
+					return true;
+				}
+				lock_guard<mutex> lock(headersMutex);
+				return cDecls->isNoReturn(importName);
+			};
+			transl.setNoReturnImportQuery(isNoReturnImport);
+			
+			// Find functions and their sizes with a quick disassembly, within the same depth limits as
+			// refillEntryPoints, before lifting anything.
+			size_t maxDepth = maxCallDepth();
+			FunctionDiscovery discovery(executable, config64);
+			discovery.setSignatures(signatures.get());
+			discovery.setNoReturnQuery([&](uint64_t address)
+			{
+				return transl.isNoReturnStub(address);
+			});
+			for (const auto& pair : toVisit)
+			{
+				discovery.addEntryPoint(pair.first);
+			}
+			
+			// The index only saves time, so problems with it aren't fatal.
+			string indexError;
+			if (indexPath.size() > 0 && !discovery.loadIndex(indexPath, indexError))
+			{
+				errs() << getProgramName() << ": can't read " << indexPath << ": " << indexError << '\n';
+			}
+			discovery.run(maxDepth);
+			if (indexPath.size() > 0 && discovery.indexChanged() && !discovery.saveIndex(indexPath, indexError))
+			{
+				errs() << getProgramName() << ": can't write " << indexPath << ": " << indexError << '\n';
+			}
+			transl.setDiscovery(&discovery);
+			
+			// Library functions become prototypes instead of being lifted, unless they were explicitly requested.
+			libraryFunctions.clear();
+			for (const auto& pair : discovery.getFunctions())
+			{
+				if (pair.second.libraryName.size() > 0 && entryPoints.count(pair.first) == 0)
+				{
+					libraryFunctions.insert({pair.first, pair.second.libraryName});
+					toVisit.erase(pair.first);
+				}
+			}
+			findDuplicates(discovery, executable, toVisit);
+			if (progress)
+			{
+				const auto& discovered = discovery.getFunctions();
+				size_t toLift = count_if(discovered.begin(), discovered.end(), [&](const pair<const uint64_t, FunctionDiscovery::DiscoveredFunction>& function)
+				{
+					return !isNotLifted(function.first);
+				});
+				progress->beginStep("lifting", max(toLift, toVisit.size()));
+			}
+			
+			bool lifted;
+			if (liftInParallel)
+			{
+				ParallelTranslation parallelTransl(executable, config64, getScheduler(), maxDepth);
+				parallelTransl.setNoReturnImportQuery(isNoReturnImport);
+				parallelTransl.setStatistics(phaseStats.get());
+				parallelTransl.setDiscovery(&discovery);
+				parallelTransl.setValueNames(namesValues());
+				parallelTransl.setSkipQuery([this](uint64_t address)
+				{
+					return isNotLifted(address);
+				});
+				for (const auto& pair : toVisit)
+				{
+					parallelTransl.addEntryPoint(pair.second);
+				}
+				
+				// Workers start with every function that discovery found instead of waiting for callers to be lifted.
+				for (const auto& pair : discovery.getFunctions())
+				{
+					if (!isNotLifted(pair.first))
+					if (auto symbolInfo = executable.getInfo(pair.first))
+					{
+						parallelTransl.addEntryPoint(*symbolInfo, pair.second.depth);
+					}
+				}
+				lifted = parallelTransl.run(transl.get());
+			}
+			else if (memoryLimit > 0)
+			{
+				lifted = liftWithinMemoryLimit(transl, executable, toVisit);
+			}
+			else
+			{
+				lifted = liftFunctions(transl, executable, toVisit, 0);
+			}
+			
+			transl.setDiscovery(nullptr);
+			transl.setNoReturnImportQuery(isNoReturnLibcImport);
+			if (!lifted)
+			{
+				return make_error_code(FcdError::Main_DecompilationError);
+			}
+	
+			// Perform early optimizations to make the module suitable for analysis
+			auto module = transl.take();
+			endPhase(module.get());
+			
+			beginPhase("phase-one");
+			legacy::PassManager phaseOne = createBasePassManager();
+			phaseOne.add(createExternalAAWrapperPass(&Main::aliasAnalysisHooks));
+			if (memoryLimit == 0)
+			{
+				addPhaseOnePasses(phaseOne);
+			}
+			addPass(phaseOne, createGlobalDCEPass());
+			phaseOne.run(*module);
+			endPhase(module.get());
+			mergeDuplicates(*module, executable);
+	
+			// Annotate stubs and library functions before returning module
+			for (Function& fn : module->getFunctionList())
+			{
+				if (!md::isPrototype(fn))
+				{
+					annotateStub(fn, executable, *cDecls);
+				}
+				else if (auto address = md::getVirtualAddress(fn))
+				{
+					auto iter = libraryFunctions.find(address->getLimitedValue());
+					if (iter != libraryFunctions.end())
+					{
+						applyPrototype(fn, iter->second, *cDecls);
+					}
+				}
+			}
+			
+			// Prototypes that were needed are lowered now, and the Clang AST is by far the largest part of headers.
+			cDecls.reset();
+			memoryReleased("headers");
+			return move(module);
+		}
+
+		// Coordinator side of distributed decompilation: call information is computed once over the whole module, so
+		// that every partition recovers the same arguments for every function.
+		bool writePartitions(Module& module, Executable* executable)
+		{
+			auto passManager = createBasePassManager();
+			passManager.add(new ExecutableWrapper(executable));
+			passManager.add(createParameterRegistryPass(callInfoDatabase.get()));
+			passManager.add(createExternalAAWrapperPass(&Main::aliasAnalysisHooks));
+			passManager.add(createCallInformationStorePass());
+			passManager.add(createCallInformationExportPass());
+			passManager.run(module);
+			
+			string errorMessage;
+			if (!writeModulePartitions(module, partitionCount, partitionOutput, errorMessage))
+			{
+				errs() << getProgramName() << ": can't write partitions to " << partitionOutput << ": " << errorMessage << '\n';
+				return false;
+			}
+			return true;
+		}
+		
+		bool preoptimizeModule(Module& module, raw_ostream& errorOutput, Executable* executable = nullptr)
+		{
+			// Do we still have instances of the unimplemented intrinsic? Bail out here if so.
+			size_t errorCount = 0;
+			if (Function* unimplemented = module.getFunction("x86_unimplemented"))
+			{
+				errorCount += forEachCall(unimplemented, 1, [](const string& message) {
+					cerr << "translation for instruction '" << message << "' is missing" << endl;
+				});
+			}
+	
+			if (Function* assertionFailure = module.getFunction("x86_assertion_failure"))
+			{
+				errorCount += forEachCall(assertionFailure, 0, [](const string& message) {
+					cerr << "translation assertion failure: " << message << endl;
+				});
+			}
+	
+			if (errorCount > 0)
+			{
+				cerr << "incorrect or missing translations; cannot decompile" << endl;
+				return false;
+			}
+	
+			// Pre-optimize the module before running the customizable pipeline. The first round visits every function;
+			// the next ones only visit the functions that the previous round changed, until no function changes.
+			// Functions that are clean are hidden from the round by marking them optnone, which LLVM's passes honor.
+			unordered_set<Function*> dirty;
+			for (Function& fn : module)
+			{
+				if (!fn.isDeclaration())
+				{
+					dirty.insert(&fn);
+				}
+			}
+			
+			// Functions also need another round when the call information of their callees changes, since alias
+			// analysis uses it. The registry stores it in the module as each round starts, so the call information that
+			// a round used is known once it ends.
+			unordered_map<Function*, hash_code> calleeInformation;
+			auto hashCalleeInformation = [](const Function& fn)
+			{
+				hash_code result = hash_value(&fn);
+				for (const BasicBlock& bb : fn)
+				{
+					for (const Instruction& inst : bb)
+					{
+						if (auto call = dyn_cast<CallInst>(&inst))
+						if (const Function* callee = call->getCalledFunction())
+						{
+							result = hash_combine(result, md::hashCallInformation(*callee));
+						}
+					}
+				}
+				return result;
+			};
+			
+			for (unsigned round = 1; round <= preoptimizationRounds && !dirty.empty(); ++round)
+			{
+				unordered_map<Function*, hash_code> fingerprints;
+				SmallVector<Function*, 16> hidden;
+				for (Function& fn : module)
+				{
+					if (fn.isDeclaration())
+					{
+						continue;
+					}
+					
+					if (dirty.count(&fn) != 0)
+					{
+						fingerprints.insert({&fn, MemorySSACache::fingerprint(fn)});
+					}
+					else
+					{
+						++PreoptimizationRunsSkipped;
+						if (!fn.hasFnAttribute(Attribute::OptimizeNone))
+						{
+							fn.addFnAttr(Attribute::OptimizeNone);
+							hidden.push_back(&fn);
+						}
+					}
+				}
+				
+				++PreoptimizationRounds;
+				beginPhase("preoptimize-" + to_string(round));
+				auto phaseTwo = createBasePassManager();
+				phaseTwo.add(new ExecutableWrapper(executable));
+				phaseTwo.add(createParameterRegistryPass(callInfoDatabase.get()));
+				phaseTwo.add(createExternalAAWrapperPass(&Main::aliasAnalysisHooks));
+				phaseTwo.add(createCallInformationStorePass());
+				addPreoptimizationPasses(phaseTwo);
+				phaseTwo.run(module);
+				endPhase(&module);
+				
+				for (Function* fn : hidden)
+				{
+					fn->removeFnAttr(Attribute::OptimizeNone);
+				}
+				
+				dirty.clear();
+				for (const auto& pair : fingerprints)
+				{
+					if (MemorySSACache::fingerprint(*pair.first) != pair.second)
+					{
+						md::incrementFunctionVersion(*pair.first);
+						dirty.insert(pair.first);
+					}
+				}
+				for (Function& fn : module)
+				{
+					if (!fn.isDeclaration())
+					{
+						hash_code hash = hashCalleeInformation(fn);
+						auto iter = calleeInformation.find(&fn);
+						if (iter != calleeInformation.end() && iter->second != hash)
+						{
+							dirty.insert(&fn);
+						}
+						calleeInformation[&fn] = hash;
+					}
+				}
+		
+#if DEBUG
+				if (verifyModule(module, &errorOutput))
+				{
+					// errors!
+					return false;
+				}
+#endif
+			}
+			return true;
+		}
+		
+		// Runs the phase one and pre-optimization passes over a few functions of an already pre-optimized module. There
+		// is no ParameterRegistry in a function pass manager, so this is somewhat more conservative about calls than
+		// preoptimizeModule.
+		void preoptimizeFunctions(Module& module, Executable* executable, ArrayRef<Function*> functions)
+		{
+			legacy::FunctionPassManager fpm(&module);
+			addParallelWorkerAnalyses(fpm, executable);
+			fpm.add(new MemorySSAProvider(&memorySSAs));
+			addPhaseOnePasses(fpm);
+			// Two pre-optimization rounds, like the first two of preoptimizeModule. These functions were pre-optimized
+			// already, so later rounds would rarely change anything.
+			for (unsigned round = 1; round <= 2; ++round)
+			{
+				addPreoptimizationPasses(fpm);
+			}
+			
+			fpm.doInitialization();
+			for (Function* fn : functions)
+			{
+				fpm.run(*fn);
+			}
+			fpm.doFinalization();
+		}
+		
+		// Pre-optimization can turn the destination of indirect calls and jumps into constants. Calls are redirected to
+		// the function at their destination, and jumps to the start of another function become tail calls to it. Other
+		// jumps stay within their function, which is lifted again with their destination as a branch target. Functions
+		// that weren't lifted yet are lifted into the module, following the same rules as the initial lifting, and only
+		// the functions that changed are pre-optimized again. This repeats until no new destinations become known.
+		bool resolveLateTargets(unique_ptr<Module>& module, Executable* executable)
+		{
+			if (translation == nullptr || executable == nullptr)
+			{
+				return true;
+			}
+			
+			for (unsigned round = 1; ; ++round)
+			{
+				SmallVector<CallInst*, 16> resolved;
+				for (const char* intrinsicName : { "x86_call_intrin", "x86_jump_intrin" })
+				{
+					if (Function* intrinsic = module->getFunction(intrinsicName))
+					{
+						for (User* user : intrinsic->users())
+						{
+							if (auto call = dyn_cast<CallInst>(user))
+							if (auto destination = dyn_cast<ConstantInt>(call->getArgOperand(2)))
+							if (executable->getInfo(destination->getLimitedValue()))
+							{
+								resolved.push_back(call);
+							}
+						}
+					}
+				}
+				
+				if (resolved.empty())
+				{
+					return true;
+				}
+				
+				beginPhase("late-targets-" + to_string(round));
+				unordered_set<Function*> definedBefore;
+				for (Function& fn : *module)
+				{
+					if (!fn.isDeclaration() && !md::isPrototype(fn))
+					{
+						definedBefore.insert(&fn);
+					}
+				}
+				
+				translation->resume(move(module));
+				map<uint64_t, SymbolInfo> toVisit;
+				unordered_set<Function*> changed;
+				set<uint64_t> relift;
+				SmallVector<CallInst*, 16> tailCalls;
+				for (CallInst* call : resolved)
+				{
+					uint64_t address = liftedAddress(cast<ConstantInt>(call->getArgOperand(2))->getLimitedValue());
+					BasicBlock* parent = call->getParent();
+					Function& caller = *parent->getParent();
+					bool isJump = call->getCalledFunction()->getName() == "x86_jump_intrin";
+					if (isJump)
+					{
+						// Same test as lifting: jumps within the function are branches, which only lifting can
+						// create, since optimized code doesn't map addresses to blocks anymore.
+						auto callerAddress = md::getVirtualAddress(caller);
+						if (callerAddress == nullptr)
+						{
+							continue;
+						}
+						if (callerAddress->getLimitedValue() == address || !translation->isFunctionStart(address))
+						{
+							if (translation->addLateJumpTarget(callerAddress->getLimitedValue(), address))
+							{
+								relift.insert(callerAddress->getLimitedValue());
+							}
+							continue;
+						}
+					}
+					
+					Function* target = translation->getCallTarget(address);
+					if (md::isPrototype(*target) && !isExclusiveDisassembly() && !isNotLifted(address))
+					{
+						toVisit.insert({address, *executable->getInfo(address)});
+					}
+					
+					CallInst* replacement = CallInst::Create(target, { call->getArgOperand(1) }, "", call);
+					if (isJump)
+					{
+						// Cutting the rest of the block also removes it from the PHI nodes of its successors.
+						changeToUnreachable(call, false);
+						parent->getTerminator()->eraseFromParent();
+						ReturnInst::Create(parent->getContext(), parent);
+						tailCalls.push_back(replacement);
+					}
+					else
+					{
+						call->eraseFromParent();
+					}
+					changed.insert(&caller);
+				}
+				
+				// Relifting replaces the bodies of functions, along with the tail calls that were just added to them.
+				tailCalls.erase(remove_if(tailCalls.begin(), tailCalls.end(), [&](CallInst* tailCall)
+				{
+					auto address = md::getVirtualAddress(*tailCall->getParent()->getParent());
+					return relift.count(address->getLimitedValue()) != 0;
+				}), tailCalls.end());
+				for (uint64_t address : relift)
+				{
+					changed.insert(translation->reliftFunction(address));
+				}
+				
+				// Late targets count as call targets of the functions that were lifted first.
+				bool lifted = liftFunctions(*translation, *executable, toVisit, 1);
+				module = translation->take();
+				if (!lifted)
+				{
+					errs() << getProgramName() << ": couldn't lift functions found during pre-optimization\n";
+					return false;
+				}
+				
+				// Whether targets return is only known once they are lifted.
+				for (CallInst* tailCall : tailCalls)
+				{
+					if (tailCall->getCalledFunction()->doesNotReturn())
+					{
+						BasicBlock* parent = tailCall->getParent();
+						parent->getTerminator()->eraseFromParent();
+						new UnreachableInst(parent->getContext(), parent);
+					}
+				}
+				
+				if (relift.empty() && changed.empty())
+				{
+					endPhase(module.get());
+					return true;
+				}
+				
+				vector<Function*> functions;
+				for (Function& fn : *module)
+				{
+					if (!fn.isDeclaration() && !md::isPrototype(fn))
+					if (changed.count(&fn) != 0 || definedBefore.count(&fn) == 0)
+					{
+						functions.push_back(&fn);
+					}
+				}
+				preoptimizeFunctions(*module, executable, functions);
+				endPhase(module.get());
+			}
+		}
+		
+		// Runs the module-level passes of the pipeline serially, and runs each sequence of function passes that comes
+		// after argument recovery on several threads or, with --worker-processes, on several processes. Python passes
+		// can only run in processes.
+		bool runOptimizeAndTransformPassesInParallel(Module& module, Executable* executable)
+		{
+			bool argumentsRecovered = false;
+			auto workerKind = workerProcesses ? ParallelFunctionPasses::Processes : ParallelFunctionPasses::Threads;
+			auto isParallelizable = [&](Pass* pass)
+			{
+				if (!argumentsRecovered || (workerKind == ParallelFunctionPasses::Threads && PythonContext::isPythonPass(*pass)))
+				{
+					return false;
+				}
+				return ParallelFunctionPasses::canRunInParallel(*pass, workerKind);
+			};
+			
+			auto iter = optimizeAndTransformPasses.begin();
+			while (iter != optimizeAndTransformPasses.end())
+			{
+				if (isParallelizable(*iter))
+				{
+					ParallelFunctionPasses parallelPasses(executable, getScheduler(), &Main::addParallelWorkerAnalyses, workerKind);
+					if (progress)
+					{
+						// Workers don't count functions.
+						progress->beginStep("parallel function passes", 0);
+					}
+					for (; iter != optimizeAndTransformPasses.end() && isParallelizable(*iter); ++iter)
+					{
+						// Thread workers create their own instances of the pass; process workers use this one.
+						parallelPasses.addPass(**iter);
+						if (workerKind == ParallelFunctionPasses::Threads)
+						{
+							delete *iter;
+						}
+					}
+					
+					auto parallelStart = PhaseStatistics::clock::now();
+					if (!parallelPasses.run(module))
+					{
+						errs() << getProgramName() << ": couldn't run function passes in parallel\n";
+						return false;
+					}
+					
+					if (phaseStats)
+					{
+						phaseStats->addPassTime("Parallel function passes", chrono::duration<double>(PhaseStatistics::clock::now() - parallelStart).count());
+					}
+				}
+				else
+				{
+					auto passManager = createBasePassManager();
+					passManager.add(new ExecutableWrapper(executable));
+					passManager.add(createParameterRegistryPass(callInfoDatabase.get()));
+					passManager.add(createExternalAAWrapperPass(&Main::aliasAnalysisHooks));
+					passManager.add(createCallInformationStorePass());
+					for (; iter != optimizeAndTransformPasses.end() && !isParallelizable(*iter); ++iter)
+					{
+						argumentsRecovered |= (*iter)->getPassID() == &ArgumentRecovery::ID;
+						addPass(passManager, *iter);
+					}
+					passManager.run(module);
+				}
+			}
+			optimizeAndTransformPasses.clear();
+			return true;
+		}
+		
+		bool optimizeAndTransformModule(Module& module, raw_ostream& errorOutput, Executable* executable = nullptr)
+		{
+			// Phase 3: make into functions with arguments, run codegen.
+			beginPhase("optimize");
+			if (cache)
+			{
+				cache->computeKeys(module);
+			}
+			
+			// Forked workers each have their own copy of the executable.
+			if (jobs > 1 && (executable == nullptr || workerProcesses || executable->canMapConcurrently()))
+			{
+				if (!runOptimizeAndTransformPassesInParallel(module, executable))
+				{
+					return false;
+				}
+				endPhase(&module);
+				
+#ifdef DEBUG
+				if (verifyModule(module, &errorOutput))
+				{
+					// errors!
+					return false;
+				}
+#endif
+				return true;
+			}
+			
+			auto passManager = createBasePassManager();
+			passManager.add(new ExecutableWrapper(executable));
+			passManager.add(createParameterRegistryPass(callInfoDatabase.get()));
+			passManager.add(createExternalAAWrapperPass(&Main::aliasAnalysisHooks));
+			passManager.add(createCallInformationStorePass());
+			for (Pass* pass : optimizeAndTransformPasses)
+			{
+				addPass(passManager, pass);
+			}
+			passManager.run(module);
+			optimizeAndTransformPasses.clear();
+			endPhase(&module);
+	
+#ifdef DEBUG
+			if (verifyModule(module, &errorOutput))
+			{
+				// errors!
+				return false;
+			}
+#endif
+			return true;
+		}
+
+		bool generateEquivalentPseudocode(Module& module, raw_ostream& output)
 		{
 			// Run that module through the output pass
 			// UnwrapReturns happens after value propagation because value propagation doesn't know that calls
 			// are generally not safe to reorder.
 			AstBackEnd* backend = createAstBackEnd();
+			backend->setScheduler(jobs > 1 ? &getScheduler() : nullptr);
+			backend->setStreaming(streamOutput);
+			backend->setReleaseFunctionBodies(true);
+			backend->setFunctionBudget({maxFunctionInstructions, maxFunctionBlocks, maxStructuringTime});
+			backend->setStatistics(phaseStats.get());
+			backend->setStringLiterals(stringLiterals);
 			backend->addPass(new AstRemoveUndef);
 			backend->addPass(new AstBranchCombine);
 			backend->addPass(new AstSimplifyExpressions);
-			backend->addPass(new AstPrint(output, md::getIncludedFiles(module)));
+			AstFilePrint* filePrint = nullptr;
+			if (jsonOutput)
+			{
+				backend->addPass(new AstJsonPrint(output));
+			}
+			else if (outputDirectory.size() > 0)
+			{
+				filePrint = new AstFilePrint(outputDirectory, md::getIncludedFiles(module), cache.get());
+				backend->addPass(filePrint);
+			}
+			else
+			{
+				backend->addPass(new AstPrint(output, md::getIncludedFiles(module), cache.get()));
+			}
 	
+			beginPhase("backend");
 			legacy::PassManager outputPhase;
-			outputPhase.add(createSESELoopPass());
-			outputPhase.add(createSwitchRemoverPass());
-			outputPhase.add(createVerifierPass());
-			outputPhase.add(createEarlyCSEPass()); // EarlyCSE eliminates redundant PHI nodes
-			outputPhase.add(backend);
+			addPass(outputPhase, createSESELoopPass());
+			addPass(outputPhase, createSwitchRemoverPass());
+			if (outlineRegionBlocks != 0)
+			{
+				addPass(outputPhase, createRegionOutliningPass(outlineRegionBlocks));
+			}
+			addPass(outputPhase, createVerifierPass());
+			addPass(outputPhase, createEarlyCSEPass()); // EarlyCSE eliminates redundant PHI nodes
+			addPass(outputPhase, backend);
 			outputPhase.run(module);
+			endPhase(&module);
+			
+			// The back end, which owns filePrint, lives as long as outputPhase.
+			string errorMessage;
+			if (filePrint != nullptr && !filePrint->writeManifest(errorMessage))
+			{
+				errs() << getProgramName() << ": " << errorMessage << '\n';
+				return false;
+			}
 			return true;
 		}
-	
+	
+		// Every run starts from a copy of module, since the back end's passes change the module they run on.
+		bool benchmarkBackEnd(const Module& module, unsigned runs)
+		{
+			for (unsigned i = 0; i < runs; ++i)
+			{
+				unique_ptr<Module> copy = CloneModule(&module);
+				if (!generateEquivalentPseudocode(*copy, i == 0 ? outs() : nulls()))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+		
+		// Lifts the function at address into the module of the translation context, unless it was lifted already.
+		// Functions lifted by this call are added to lifted.
+		Function* liftOnce(Executable& executable, unordered_set<uint64_t>& liftedAddresses, uint64_t address, SmallVectorImpl<Function*>& lifted)
+		{
+			TranslationContext& transl = *translation;
+			if (!liftedAddresses.insert(address).second)
+			{
+				return transl.getCallTarget(address);
+			}
+			
+			auto symbolInfo = executable.getInfo(address);
+			if (symbolInfo && symbolInfo->name.size() > 0)
+			{
+				transl.setFunctionName(address, symbolInfo->name);
+			}
+			
+			Function* fn = transl.createFunction(address);
+			if (fn != nullptr)
+			{
+				lifted.push_back(fn);
+			}
+			return fn;
+		}
+		
+		// Decompiles the function at address the way that --partial would, from a copy of the functions that it needs.
+		// Late targets aren't resolved, since that would lift them into the copy instead of the shared module.
+		string serveRequest(Executable& executable, HeaderDeclarations& cDecls, unordered_set<uint64_t>& liftedAddresses, uint64_t address)
+		{
+			string response;
+			raw_string_ostream responseStream(response);
+			responseStream << "{\"address\":" << address;
+			auto fail = [&](StringRef message)
+			{
+				responseStream << ",\"error\":";
+				printJsonString(responseStream, message);
+				responseStream << '}';
+				return responseStream.str();
+			};
+			
+			if (!executable.getInfo(address))
+			{
+				return fail("address is outside of mapped memory");
+			}
+			
+			SmallVector<Function*, 16> lifted;
+			Function* fn = liftOnce(executable, liftedAddresses, address, lifted);
+			if (fn == nullptr)
+			{
+				return fail("couldn't lift function");
+			}
+			
+			// Functions that the requested function calls are lifted too; functions that they call remain prototypes.
+			SmallPtrSet<const Function*, 16> needed;
+			needed.insert(fn);
+			SmallVector<uint64_t, 16> callees;
+			for (BasicBlock& block : *fn)
+			{
+				for (Instruction& inst : block)
+				{
+					for (Value* operand : inst.operands())
+					{
+						if (auto callee = dyn_cast<Function>(operand))
+						if (auto calleeAddress = md::getVirtualAddress(*callee))
+						if (executable.getInfo(calleeAddress->getLimitedValue()))
+						{
+							callees.push_back(calleeAddress->getLimitedValue());
+						}
+					}
+				}
+			}
+			
+			for (uint64_t calleeAddress : callees)
+			{
+				Function* callee = liftOnce(executable, liftedAddresses, calleeAddress, lifted);
+				if (callee == nullptr)
+				{
+					return fail("couldn't lift called function");
+				}
+				needed.insert(callee);
+			}
+			
+			// Newly lifted functions get what generateAnnotatedModule does for the whole module.
+			if (lifted.size() > 0)
+			{
+				legacy::FunctionPassManager phaseOne(&translation->get());
+				addParallelWorkerAnalyses(phaseOne, &executable);
+				phaseOne.add(new MemorySSAProvider(&memorySSAs));
+				addPhaseOnePasses(phaseOne);
+				phaseOne.doInitialization();
+				for (Function* liftedFunction : lifted)
+				{
+					phaseOne.run(*liftedFunction);
+				}
+				phaseOne.doFinalization();
+				
+				for (Function* liftedFunction : lifted)
+				{
+					annotateStub(*liftedFunction, executable, cDecls);
+				}
+			}
+			
+			ValueToValueMapTy valueMap;
+			auto module = CloneModule(&translation->get(), valueMap, [&](const GlobalValue* value)
+			{
+				if (auto function = dyn_cast<Function>(value))
+				{
+					return needed.count(function) != 0 || md::isPrototype(*function);
+				}
+				return true;
+			});
+			
+			for (Function& declaration : *module)
+			{
+				if (declaration.isDeclaration() && declaration.hasLocalLinkage())
+				{
+					declaration.setLinkage(GlobalValue::ExternalLinkage);
+				}
+			}
+			
+			// Pass instances belong to the pass manager that ran them.
+			if (optimizeAndTransformPasses.empty() && !prepareOptimizationPasses())
+			{
+				return fail("couldn't create optimization passes");
+			}
+			
+			if (!preoptimizeModule(*module, errs(), &executable) || !optimizeAndTransformModule(*module, errs(), &executable))
+			{
+				return fail("couldn't decompile function");
+			}
+			
+			keepStringLiterals(executable);
+			string pseudocode;
+			raw_string_ostream pseudocodeStream(pseudocode);
+			generateEquivalentPseudocode(*module, pseudocodeStream);
+			pseudocodeStream.flush();
+			
+			if (jsonOutput)
+			{
+				SmallVector<StringRef, 16> lines;
+				StringRef(pseudocode).split(lines, '\n', -1, false);
+				responseStream << ",\"functions\":[";
+				for (size_t i = 0; i < lines.size(); ++i)
+				{
+					responseStream << (i == 0 ? "" : ",") << lines[i];
+				}
+				responseStream << "]}";
+			}
+			else
+			{
+				responseStream << ",\"pseudocode\":";
+				printJsonString(responseStream, pseudocode);
+				responseStream << '}';
+			}
+			return responseStream.str();
+		}
+		
+		// Answers requests read from input until it ends. Each request is a line with the virtual address of a function
+		// (decimal, or hexadecimal starting with 0x). Each response is a JSON line with that address and either an
+		// "error", or the output that --partial would have for it: "pseudocode", or "functions" with --json. Lifted
+		// functions, parsed headers and call information are kept from one request to the next, and responses are
+		// remembered.
+		int serve(Executable& executable, istream& input, raw_ostream& output)
+		{
+			translation.reset(new TranslationContext(llvm, executable, config64, "fcd-serve"));
+			translation->setValueNames(namesValues());
+			auto cDecls = HeaderDeclarations::create(translation->get(), headerSearchPath.begin(), headerSearchPath.end(), headers.begin(), headers.end(), errs(), cacheDirectory);
+			if (!cDecls)
+			{
+				return 1;
+			}
+			
+			md::addIncludedFiles(translation->get(), cDecls->getIncludedFiles());
+			translation->setNoReturnImportQuery([&](StringRef importName)
+			{
+				return isNoReturnLibcImport(importName) || cDecls->isNoReturn(importName);
+			});
+			
+			// Without a database file, call information is kept in memory for as long as the server runs.
+			if (!callInfoDatabase)
+			{
+				callInfoDatabase.reset(new CallInformationDatabase(""));
+			}
+			
+			string line;
+			unordered_set<uint64_t> liftedAddresses;
+			unordered_map<uint64_t, string> responses;
+			while (getline(input, line))
+			{
+				StringRef request = StringRef(line).trim();
+				uint64_t address;
+				if (request.empty())
+				{
+					continue;
+				}
+				else if (request.getAsInteger(0, address))
+				{
+					output << "{\"address\":null,\"error\":\"expected a virtual address\"}\n";
+				}
+				else
+				{
+					auto iter = responses.find(address);
+					if (iter == responses.end())
+					{
+						iter = responses.insert({address, serveRequest(executable, *cDecls, liftedAddresses, address)}).first;
+					}
+					output << iter->second << '\n';
+				}
+				output.flush();
+			}
+			
+			translation->setNoReturnImportQuery(isNoReturnLibcImport);
+			return 0;
+		}
+		
 		static void initializePasses()
 		{
 			auto& pr = *PassRegistry::getPassRegistry();
@@ -608,6 +1935,26 @@ namespace
 			initializeSESELoopPass(pr);
 		}
 		
+		// Samples are cleaned up like newly lifted functions are, one function at a time.
+		bool writeSemanticsReport(const string& outputPath)
+		{
+			error_code error;
+			raw_fd_ostream output(outputPath, error, sys::fs::F_Text);
+			if (error)
+			{
+				errs() << getProgramName() << ": can't write " << outputPath << ": " << error.message() << '\n';
+				return false;
+			}
+			
+			::writeSemanticsReport(config64, [&](legacy::FunctionPassManager& pm, Executable& executable)
+			{
+				addParallelWorkerAnalyses(pm, &executable);
+				pm.add(new MemorySSAProvider(&memorySSAs));
+				addPhaseOnePasses(pm);
+			}, output);
+			return true;
+		}
+		
 		bool prepareOptimizationPasses()
 		{
 			// Default passes
@@ -618,17 +1965,16 @@ namespace
 				"sroa",
 				"instcombine",
 				"intnarrowing",
-				"signext",
-				"simplifyconditions",
+				"flagcleanup",
 				// <-- custom passes go here with the default pass pipeline
 				"instcombine",
 				"gvn",
 				"simplifycfg",
-				"instcombine",
-				"gvn",
 				"recoverstackframe",
+				"memeffects",
 				"dse",
 				"sccp",
+				"recoverglobals",
 				"simplifycfg",
 				"eliminatecasts",
 				"instcombine",
@@ -641,11 +1987,31 @@ namespace
 				"simplifycfg",
 			};
 			
-			if (customPassPipeline == "default")
+			// Triage preset: the passes that the back end needs to produce correct output, with a single round of
+			// cleanup instead of the repeated instcombine, gvn and sroa runs that make the default output nicer.
+			vector<string> fastPassNames = {
+				"fixindirects",
+				"argrec",
+				"sroa",
+				"instcombine",
+				"flagcleanup",
+				// <-- custom passes go here with the fast pass pipeline
+				"simplifycfg",
+				"recoverstackframe",
+				"recoverglobals",
+				"globaldce",
+			};
+			
+			if (customPassPipeline == "fast")
+			{
+				passNames = move(fastPassNames);
+			}
+			
+			if (customPassPipeline == "default" || customPassPipeline == "fast")
 			{
 				if (additionalPasses.size() > 0)
 				{
-					auto extensionPoint = find(passNames.begin(), passNames.end(), "simplifyconditions") + 1;
+					auto extensionPoint = find(passNames.begin(), passNames.end(), "flagcleanup") + 1;
 					passNames.insert(extensionPoint, additionalPasses.begin(), additionalPasses.end());
 				}
 				optimizeAndTransformPasses = createPassesFromList(passNames);
@@ -666,7 +2032,55 @@ namespace
 			{
 				optimizeAndTransformPasses = readPassPipelineFromString(customPassPipeline);
 			}
-			return optimizeAndTransformPasses.size() > 0;
+			
+			if (optimizeAndTransformPasses.size() == 0)
+			{
+				return false;
+			}
+			
+			if (cacheDirectory.size() > 0)
+			{
+				vector<string> pipelineNames;
+				for (Pass* pass : optimizeAndTransformPasses)
+				{
+					pipelineNames.push_back(pass->getPassName());
+				}
+				
+				// Outlining changes the pseudocode of the functions that regions come from.
+				if (outlineRegionBlocks != 0)
+				{
+					pipelineNames.push_back("outline-regions=" + to_string(outlineRegionBlocks));
+				}
+				
+				string errorMessage;
+				cache.reset(new DecompilationCache(cacheDirectory, pipelineNames));
+				if (!cache->open(errorMessage))
+				{
+					errs() << getProgramName() << ": can't open cache directory " << cacheDirectory << ": " << errorMessage << '\n';
+					return false;
+				}
+				
+				// Cached functions are needed until argument recovery has run on their callers.
+				auto argrec = find_if(optimizeAndTransformPasses.begin(), optimizeAndTransformPasses.end(), [](Pass* pass)
+				{
+					return pass->getPassID() == &ArgumentRecovery::ID;
+				});
+				auto insertionPoint = argrec == optimizeAndTransformPasses.end() ? optimizeAndTransformPasses.begin() : argrec + 1;
+				optimizeAndTransformPasses.insert(insertionPoint, createDecompilationCachePruningPass(*cache));
+			}
+			
+			// Callees of partial disassembly are only needed until argument recovery, like cached functions. Pipelines
+			// without argument recovery never read their bodies, so they are pruned before anything runs on them.
+			if (isPartialDisassembly())
+			{
+				auto argrec = find_if(optimizeAndTransformPasses.begin(), optimizeAndTransformPasses.end(), [](Pass* pass)
+				{
+					return pass->getPassID() == &ArgumentRecovery::ID;
+				});
+				auto insertionPoint = argrec == optimizeAndTransformPasses.end() ? optimizeAndTransformPasses.begin() : argrec + 1;
+				optimizeAndTransformPasses.insert(insertionPoint, createCalleePruningPass());
+			}
+			return true;
 		}
 	};
 }
@@ -694,109 +2108,442 @@ bool isEntryPoint(uint64_t vaddr)
 	});
 }
 
-int main(int argc, char** argv)
+namespace
 {
-	pruneOptionList(cl::getRegisteredOptions());
-	cl::ParseCommandLineOptions(argc, argv, "native program decompiler");
-	
-	if (customPassPipeline != "default" && additionalPasses.size() > 0)
+	int decompile(Main& mainObj, const string& input)
 	{
-		errs() << sys::path::filename(argv[0]) << ": additional passes only accepted when using the default pipeline\n";
-		errs() << "Specify custom passes using the " << customPassPipeline.ArgStr << " parameter\n";
-		return 1;
+		string program = mainObj.getProgramName();
+		
+		unique_ptr<Executable> executable;
+		unique_ptr<Module> module;
+		
+		// step one: create annotated module from executable (or load it from .ll)
+		ErrorOr<unique_ptr<MemoryBuffer>> bufferOrError(nullptr);
+		if (moduleInCount())
+		{
+			SMDiagnostic errors;
+			module = parseIRFile(input, errors, mainObj.getContext());
+			if (!module)
+			{
+				errors.print(program.c_str(), errs());
+				return 1;
+			}
+		}
+		else
+		{
+			// Not requiring a null terminator lets MemoryBuffer map the file instead of reading it: executables only
+			// touch the pages that they actually parse.
+			bufferOrError = MemoryBuffer::getFile(input, -1, false);
+			if (!bufferOrError)
+			{
+				cerr << program << ": can't open " << input << ": " << errorOf(bufferOrError) << endl;
+				return 1;
+			}
+			
+			auto executableOrError = mainObj.parseExecutable(*bufferOrError.get());
+			if (!executableOrError)
+			{
+				cerr << program << ": couldn't parse " << input << ": " << errorOf(executableOrError) << endl;
+				return 1;
+			}
+			
+			executable = move(executableOrError.get());
+			string moduleName = sys::path::stem(input);
+			auto moduleOrError = mainObj.generateAnnotatedModule(*executable, moduleName, discoveryIndex ? input + ".fcdindex" : "");
+			if (!moduleOrError)
+			{
+				cerr << program << ": couldn't build LLVM module out of " << input << ": " << errorOf(moduleOrError) << endl;
+				return 1;
+			}
+			
+			module = move(moduleOrError.get());
+		}
+		
+		// if we want module output, this is where we stop
+		if (moduleOutCount() == 1)
+		{
+			return mainObj.emitModule(*module);
+		}
+		
+		if (moduleInCount() < 2)
+		{
+			// step two: pe-optimize module
+			if (!mainObj.preoptimizeModule(*module, errs(), executable.get()))
+			{
+				return 1;
+			}
+			
+			if (!mainObj.resolveLateTargets(module, executable.get()))
+			{
+				return 1;
+			}
+			mainObj.releaseTranslation();
+		}
+		
+		if (moduleOutCount() == 2)
+		{
+			return mainObj.emitModule(*module);
+		}
+		
+		if (partitionOutput.size() > 0)
+		{
+			return mainObj.writePartitions(*module, executable.get()) ? 0 : 1;
+		}
+		
+		if (moduleInCount() < 3)
+		{
+			if (!mainObj.optimizeAndTransformModule(*module, errs(), executable.get()))
+			{
+				return 1;
+			}
+		}
+		
+		// Nothing reads the executable once the module is optimized, apart from its string literals, which the back
+		// end gets from an index.
+		if (executable)
+		{
+			mainObj.keepStringLiterals(*executable);
+			executable.reset();
+			bufferOrError.get().reset();
+			mainObj.memoryReleased("executable");
+		}
+		mainObj.releaseAnalyses();
+		
+		if (moduleOutCount() > 2)
+		{
+			return mainObj.emitModule(*module);
+		}
+		
+		// An optimized input module still has the body of every function that was lifted, but in partial disassembly,
+		// only the entry points go through the back end.
+		if (moduleInCount() >= 3 && isPartialDisassembly())
+		{
+			legacy::PassManager pruning;
+			pruning.add(createCalleePruningPass());
+			pruning.run(*module);
+		}
+		
+		// step three (final step): emit pseudocode
+		if (backendRuns > 1)
+		{
+			return mainObj.benchmarkBackEnd(*module, backendRuns) ? 0 : 1;
+		}
+		return mainObj.generateEquivalentPseudocode(*module, outs()) ? 0 : 1;
 	}
 	
-	Main::initializePasses();
-	
-	Main mainObj(argc, argv);
-	string program = mainObj.getProgramName();
-	
-	// step 0: before even attempting anything, prepare optimization passes
-	// (the user won't be happy if we work for 5 minutes only to discover that the optimization passes don't load)
-	if (!mainObj.prepareOptimizationPasses())
+	int serveRequests(Main& mainObj, const string& input)
 	{
-		return 1;
+		string program = mainObj.getProgramName();
+		auto bufferOrError = MemoryBuffer::getFile(input, -1, false);
+		if (!bufferOrError)
+		{
+			cerr << program << ": can't open " << input << ": " << errorOf(bufferOrError) << endl;
+			return 1;
+		}
+		
+		auto executableOrError = mainObj.parseExecutable(*bufferOrError.get());
+		if (!executableOrError)
+		{
+			cerr << program << ": couldn't parse " << input << ": " << errorOf(executableOrError) << endl;
+			return 1;
+		}
+		return mainObj.serve(*executableOrError.get(), cin, outs());
 	}
 	
-	unique_ptr<Executable> executable;
-	unique_ptr<Module> module;
-	
-	// step one: create annotated module from executable (or load it from .ll)
-	ErrorOr<unique_ptr<MemoryBuffer>> bufferOrError(nullptr);
-	if (moduleInCount())
+	string outputExtension()
 	{
-		SMDiagnostic errors;
-		module = parseIRFile(inputFile, errors, mainObj.getContext());
-		if (!module)
+		if (moduleOutCount() > 0)
 		{
-			errors.print(argv[0], errs());
-			return 1;
+			return bitcodeOutput ? ".bc" : ".ll";
 		}
+		return jsonOutput ? ".json" : ".c";
 	}
-	else
+	
+	// Signatures are written for the named visible symbols of the input, sorted by address.
+	int writeSignatures(Main& mainObj, const string& input, const string& outputPath)
 	{
-		bufferOrError = MemoryBuffer::getFile(inputFile, -1, false);
+		string program = mainObj.getProgramName();
+		auto bufferOrError = MemoryBuffer::getFile(input, -1, false);
 		if (!bufferOrError)
 		{
-			cerr << program << ": can't open " << inputFile << ": " << errorOf(bufferOrError) << endl;
+			cerr << program << ": can't open " << input << ": " << errorOf(bufferOrError) << endl;
 			return 1;
 		}
 		
 		auto executableOrError = mainObj.parseExecutable(*bufferOrError.get());
 		if (!executableOrError)
 		{
-			cerr << program << ": couldn't parse " << inputFile << ": " << errorOf(executableOrError) << endl;
+			cerr << program << ": couldn't parse " << input << ": " << errorOf(executableOrError) << endl;
 			return 1;
 		}
 		
-		executable = move(executableOrError.get());
-		string moduleName = sys::path::stem(inputFile);
-		auto moduleOrError = mainObj.generateAnnotatedModule(*executable, moduleName);
-		if (!moduleOrError)
+		Executable& executable = *executableOrError.get();
+		FunctionDiscovery discovery(executable, config64);
+		for (const SymbolInfo& symbolInfo : executable.getVisibleSymbols())
+		{
+			if (symbolInfo.name.size() > 0)
+			{
+				discovery.addEntryPoint(symbolInfo.virtualAddress);
+			}
+		}
+		discovery.run(0);
+		
+		error_code error;
+		raw_fd_ostream output(outputPath, error, sys::fs::F_None);
+		if (error)
 		{
-			cerr << program << ": couldn't build LLVM module out of " << inputFile << ": " << errorOf(moduleOrError) << endl;
+			cerr << program << ": can't write " << outputPath << ": " << error.message() << endl;
 			return 1;
 		}
 		
-		module = move(moduleOrError.get());
-	}
-	
-	// if we want module output, this is where we stop
-	if (moduleOutCount() == 1)
-	{
-		module->print(outs(), nullptr);
+		output << FunctionSignatures::fileHeader << '\n';
+		for (const SymbolInfo& symbolInfo : executable.getVisibleSymbols())
+		{
+			const FunctionDiscovery::DiscoveredFunction* fn = discovery.getFunction(symbolInfo.virtualAddress);
+			if (symbolInfo.name.size() > 0 && fn != nullptr && fn->signature.size() > 0)
+			{
+				output << fn->signature << ' ' << symbolInfo.name << '\n';
+			}
+		}
 		return 0;
 	}
 	
-	if (moduleInCount() < 2)
+	// Inputs are decompiled in forked processes. They start from what was set up once: registered passes, the pass
+	// pipeline (with its Python scripts), the Python interpreter and the x86 code generator of the main context. Each
+	// process writes its standard output to its own file.
+	int decompileBatch(Main& mainObj, const string& listPath)
 	{
-		// step two: pe-optimize module
-		if (!mainObj.preoptimizeModule(*module, errs(), executable.get()))
+		string program = mainObj.getProgramName();
+		auto listOrError = MemoryBuffer::getFile(listPath);
+		if (!listOrError)
+		{
+			errs() << program << ": can't open " << listPath << ": " << listOrError.getError().message() << '\n';
+			return 1;
+		}
+		
+		vector<string> inputs;
+		SmallVector<StringRef, 16> lines;
+		listOrError.get()->getBuffer().split(lines, '\n');
+		for (StringRef line : lines)
+		{
+			line = line.trim();
+			if (line.size() > 0 && line[0] != '#')
+			{
+				inputs.push_back(line.str());
+			}
+		}
+		
+		if (auto error = sys::fs::create_directories(batchOutput))
+		{
+			errs() << program << ": can't create " << batchOutput << ": " << error.message() << '\n';
+			return 1;
+		}
+		
+		// The code generator lives as long as something references it.
+		auto codegen = CodeGenerator::x86(mainObj.getContext());
+		if (!codegen)
 		{
+			errs() << program << ": couldn't create x86 code generator\n";
 			return 1;
 		}
+		
+		// Children inherit whatever is still buffered and would print it again.
+		outs().flush();
+		errs().flush();
+		fflush(nullptr);
+		
+		unsigned failures = 0;
+		size_t nextInput = 0;
+		unordered_map<pid_t, string> running;
+		while (nextInput < inputs.size() || running.size() > 0)
+		{
+			if (nextInput < inputs.size() && running.size() < max(batchJobs.getValue(), 1u))
+			{
+				// Inputs from different directories can have the same name, so their position in the list keeps the
+				// output paths apart.
+				size_t index = nextInput++;
+				const string& input = inputs[index];
+				SmallString<128> outputPath(batchOutput);
+				sys::path::append(outputPath, to_string(index + 1) + "-" + sys::path::filename(input) + outputExtension());
+				
+				pid_t pid = fork();
+				if (pid == 0)
+				{
+					int fd = open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+					if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0)
+					{
+						errs() << program << ": can't open " << outputPath << ": " << strerror(errno) << '\n';
+						_exit(1);
+					}
+					close(fd);
+					
+					int status = decompile(mainObj, input);
+					mainObj.finish();
+					outs().flush();
+					fflush(nullptr);
+					_exit(status);
+				}
+				
+				if (pid < 0)
+				{
+					errs() << program << ": can't fork to decompile " << input << ": " << strerror(errno) << '\n';
+					++failures;
+				}
+				else
+				{
+					running.insert({pid, input});
+				}
+				continue;
+			}
+			
+			int status;
+			pid_t pid = wait(&status);
+			if (pid < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				break;
+			}
+			
+			auto iter = running.find(pid);
+			if (iter != running.end())
+			{
+				if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				{
+					errs() << program << ": couldn't decompile " << iter->second << '\n';
+					++failures;
+				}
+				running.erase(iter);
+			}
+		}
+		return failures == 0 ? 0 : 1;
 	}
+}
+
+int main(int argc, char** argv)
+{
+	pruneOptionList(cl::getRegisteredOptions());
+	cl::ParseCommandLineOptions(argc, argv, "native program decompiler");
+	DumbAllocator::setUseHugePages(hugePageArenas);
 	
-	if (moduleOutCount() == 2)
+	if (customPassPipeline != "default" && customPassPipeline != "fast" && additionalPasses.size() > 0)
 	{
-		module->print(outs(), nullptr);
-		return 0;
+		errs() << sys::path::filename(argv[0]) << ": additional passes only accepted when using the default or fast pipeline\n";
+		errs() << "Specify custom passes using the " << customPassPipeline.ArgStr << " parameter\n";
+		return 1;
 	}
 	
-	if (moduleInCount() < 3)
+	if (splitModuleOutput.size() > 0 && moduleOutCount() == 0)
 	{
-		if (!mainObj.optimizeAndTransformModule(*module, errs(), executable.get()))
+		errs() << sys::path::filename(argv[0]) << ": --split-module-out needs --module-out\n";
+		return 1;
+	}
+	
+	if (partitionOutput.size() > 0 && partitionCount == 0)
+	{
+		errs() << sys::path::filename(argv[0]) << ": --partitions must be at least 1\n";
+		return 1;
+	}
+	
+	if (jsonOutput && cacheDirectory.size() > 0)
+	{
+		// The cache only keeps the pseudocode of functions, which can't be turned back into an AST.
+		errs() << sys::path::filename(argv[0]) << ": --json can't be used with --cache-dir\n";
+		return 1;
+	}
+	
+	if (semanticsReport.empty() && batchList.empty() == inputFile.empty())
+	{
+		errs() << sys::path::filename(argv[0]) << ": expected either an input program or --batch\n";
+		return 1;
+	}
+	
+	if (batchList.size() > 0 && timePhases.getNumOccurrences() > 0)
+	{
+		// Every input would write its report to the same file.
+		errs() << sys::path::filename(argv[0]) << ": --time-phases can't be used with --batch\n";
+		return 1;
+	}
+	
+	if (batchList.size() > 0 && traceOutput.size() > 0)
+	{
+		errs() << sys::path::filename(argv[0]) << ": --trace can't be used with --batch\n";
+		return 1;
+	}
+	
+	if (batchList.size() > 0 && partitionOutput.size() > 0)
+	{
+		// Every input would write its partitions to the same directory.
+		errs() << sys::path::filename(argv[0]) << ": --partition-out can't be used with --batch\n";
+		return 1;
+	}
+	
+	if (serverMode && (batchList.size() > 0 || moduleInCount() > 0 || moduleOutCount() > 0 || partitionOutput.size() > 0 || customPassPipeline == ""))
+	{
+		// Requests are decompiled from executables to pseudocode, and the pass pipeline is created again for each.
+		errs() << sys::path::filename(argv[0]) << ": --serve only decompiles executables to pseudocode with a fixed pass pipeline\n";
+		return 1;
+	}
+	
+	if (outputDirectory.size() > 0)
+	{
+		if (jsonOutput || batchList.size() > 0 || serverMode)
 		{
+			errs() << sys::path::filename(argv[0]) << ": --output-dir can't be used with --json, --batch or --serve\n";
+			return 1;
+		}
+		
+		if (auto error = sys::fs::create_directories(outputDirectory))
+		{
+			errs() << sys::path::filename(argv[0]) << ": can't create " << outputDirectory << ": " << error.message() << '\n';
 			return 1;
 		}
 	}
 	
-	if (moduleOutCount() > 2)
+	if (backendRuns > 1 && (moduleInCount() < 3 || cacheDirectory.size() > 0))
 	{
-		module->print(outs(), nullptr);
-		return 0;
+		// Later runs would print cached pseudocode instead of running the back end.
+		errs() << sys::path::filename(argv[0]) << ": --backend-runs needs an optimized module (-m -m -m) and no --cache-dir\n";
+		return 1;
+	}
+	
+	if (signatureOutput.size() > 0 && inputFile.empty())
+	{
+		errs() << sys::path::filename(argv[0]) << ": --write-signatures needs an input program\n";
+		return 1;
+	}
+	
+	Main::initializePasses();
+	
+	Main mainObj(argc, argv);
+	
+	if (signatureOutput.size() > 0)
+	{
+		return writeSignatures(mainObj, inputFile, signatureOutput);
+	}
+	
+	if (semanticsReport.size() > 0)
+	{
+		return mainObj.writeSemanticsReport(semanticsReport) ? 0 : 1;
+	}
+	
+	// step 0: before even attempting anything, prepare optimization passes
+	// (the user won't be happy if we work for 5 minutes only to discover that the optimization passes don't load)
+	if (!mainObj.prepareOptimizationPasses())
+	{
+		return 1;
+	}
+	
+	if (serverMode)
+	{
+		return serveRequests(mainObj, inputFile);
 	}
 	
-	// step three (final step): emit pseudocode
-	return mainObj.generateEquivalentPseudocode(*module, outs()) ? 0 : 1;
+	if (batchList.size() > 0)
+	{
+		return decompileBatch(mainObj, batchList);
+	}
+	return decompile(mainObj, inputFile);
 }
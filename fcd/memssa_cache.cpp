@@ -0,0 +1,129 @@
+//
+// memssa_cache.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "memssa_cache.h"
+#include "metadata.h"
+
+#include <llvm/IR/Instructions.h>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	RegisterPass<MemorySSAProvider> memorySSAProvider("#memssa-provider", "MemorySSA provider", false, true);
+}
+
+char MemorySSAProvider::ID = 0;
+
+void MemorySSACache::FunctionHandle::deleted()
+{
+	// This destroys the handle.
+	cache->erase(*cast<Function>(getValPtr()));
+}
+
+hash_code MemorySSACache::fingerprint(const Function& fn)
+{
+	hash_code result = hash_value(&fn);
+	for (const BasicBlock& bb : fn)
+	{
+		result = hash_combine(result, &bb);
+		for (const Instruction& inst : bb)
+		{
+			// Instructions are also identified by what they are, in case that a new one took the address of a deleted
+			// one, and by what passes change in place.
+			result = hash_combine(result, &inst, inst.getOpcode(), inst.getType(), inst.getRawSubclassOptionalData(), md::isProgramMemory(inst));
+			if (auto cmp = dyn_cast<CmpInst>(&inst))
+			{
+				result = hash_combine(result, cmp->getPredicate());
+			}
+			for (const Use& operand : inst.operands())
+			{
+				result = hash_combine(result, operand.get(), operand->getValueID());
+			}
+		}
+	}
+	return result;
+}
+
+unsigned MemorySSACache::versionOf(const Function& fn)
+{
+	return md::getFunctionVersion(fn);
+}
+
+MemorySSACache::Entry& MemorySSACache::currentEntry(Function& fn)
+{
+	unsigned version = versionOf(fn);
+	hash_code currentFingerprint = fingerprint(fn);
+	auto iter = entries.find(&fn);
+	if (iter == entries.end())
+	{
+		iter = entries.emplace(piecewise_construct, forward_as_tuple(&fn), forward_as_tuple(&fn, this)).first;
+	}
+	
+	Entry& entry = iter->second;
+	if (entry.version != version || entry.fingerprint != currentFingerprint)
+	{
+		entry.mssa.reset();
+		entry.domTree.reset();
+		entry.postDomTree.reset();
+		entry.version = version;
+		entry.fingerprint = currentFingerprint;
+	}
+	return entry;
+}
+
+DominatorTree& MemorySSACache::getDominatorTree(Function& fn)
+{
+	Entry& entry = currentEntry(fn);
+	if (entry.domTree == nullptr)
+	{
+		entry.domTree.reset(new DominatorTree(fn));
+	}
+	return *entry.domTree;
+}
+
+PostDominatorTree& MemorySSACache::getPostDominatorTree(Function& fn)
+{
+	Entry& entry = currentEntry(fn);
+	if (entry.postDomTree == nullptr)
+	{
+		entry.postDomTree.reset(new PostDominatorTree);
+		entry.postDomTree->recalculate(fn);
+	}
+	return *entry.postDomTree;
+}
+
+void MemorySSACache::update(const Function& fn)
+{
+	auto iter = entries.find(&fn);
+	if (iter != entries.end())
+	{
+		iter->second.version = versionOf(fn);
+		iter->second.fingerprint = fingerprint(fn);
+	}
+}
+
+void MemorySSACache::erase(const Function& fn)
+{
+	entries.erase(&fn);
+}
@@ -0,0 +1,137 @@
+//
+// memssa_cache.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef fcd__memssa_cache_h
+#define fcd__memssa_cache_h
+
+#include <llvm/ADT/Hashing.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/Pass.h>
+#include <llvm/Transforms/Utils/MemorySSA.h>
+
+#include <memory>
+#include <unordered_map>
+
+// Keeps the MemorySSA and the dominator trees of functions for as long as they don't change, across passes and pass
+// managers. A function has changed when its version was bumped (see md::incrementFunctionVersion) or, since LLVM's own
+// passes don't bump versions, when its instructions or their operands aren't the same anymore. Every analysis of a
+// function is dropped at once when it changes.
+//
+// MemorySSA also depends on what its alias analysis knows beyond the function's body, such as the call information of
+// its callees. Callers of get pass a hash of that, and the MemorySSA is built again when it changes.
+//
+// This relies on MemorySSA only using the alias analysis and the dominator tree that it was built with while it is
+// being built, which holds as long as its walker isn't used.
+class MemorySSACache
+{
+	class FunctionHandle final : public llvm::CallbackVH
+	{
+		MemorySSACache* cache;
+		
+	public:
+		FunctionHandle(llvm::Function* fn, MemorySSACache* cache)
+		: llvm::CallbackVH(fn), cache(cache)
+		{
+		}
+		
+		virtual void deleted() override;
+	};
+	
+	struct Entry
+	{
+		FunctionHandle handle;
+		unsigned version;
+		llvm::hash_code fingerprint;
+		llvm::hash_code dependencies;
+		std::unique_ptr<llvm::MemorySSA> mssa;
+		std::unique_ptr<llvm::DominatorTree> domTree;
+		std::unique_ptr<llvm::PostDominatorTree> postDomTree;
+		
+		Entry(llvm::Function* fn, MemorySSACache* cache)
+		: handle(fn, cache), version(0), fingerprint(0), dependencies(0)
+		{
+		}
+	};
+	
+	std::unordered_map<const llvm::Function*, Entry> entries;
+	
+	static unsigned versionOf(const llvm::Function& fn);
+	
+	// The entry of fn, emptied if fn changed since its analyses were computed.
+	Entry& currentEntry(llvm::Function& fn);
+	
+public:
+	// Changes when the function's instructions, their operands or their flags change. Only meaningful within a
+	// single run.
+	static llvm::hash_code fingerprint(const llvm::Function& fn);
+	
+	// build is called with the function when there is no up-to-date MemorySSA for it, and returns a
+	// std::unique_ptr<llvm::MemorySSA>. dependencies identifies what the alias analysis of build knows about fn
+	// besides its body (see ParameterRegistryAAResults::hashCalleeInformation).
+	template<typename TBuilder>
+	llvm::MemorySSA& get(llvm::Function& fn, llvm::hash_code dependencies, TBuilder&& build)
+	{
+		Entry& entry = currentEntry(fn);
+		if (entry.mssa == nullptr || entry.dependencies != dependencies)
+		{
+			entry.mssa = build(fn);
+			entry.dependencies = dependencies;
+		}
+		return *entry.mssa;
+	}
+	
+	llvm::DominatorTree& getDominatorTree(llvm::Function& fn);
+	llvm::PostDominatorTree& getPostDominatorTree(llvm::Function& fn);
+	
+	// Call after changing a function in a way that kept its MemorySSA up to date, without changing its CFG.
+	void update(const llvm::Function& fn);
+	void erase(const llvm::Function& fn);
+	void clear() { entries.clear(); }
+};
+
+// Makes a MemorySSACache available to the passes of a pass manager. Passes scheduled on other threads must not share
+// a cache.
+class MemorySSAProvider : public llvm::ImmutablePass
+{
+	MemorySSACache* cache;
+	
+public:
+	static char ID;
+	
+	MemorySSAProvider(MemorySSACache* cache)
+	: llvm::ImmutablePass(ID), cache(cache)
+	{
+	}
+	
+	MemorySSACache& getCache() { return *cache; }
+};
+
+namespace llvm
+{
+	template<>
+	inline Pass *callDefaultCtor<MemorySSAProvider>() { return nullptr; }
+}
+
+#endif /* fcd__memssa_cache_h */
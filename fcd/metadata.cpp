@@ -19,6 +19,7 @@
 // along with fcd.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#include "call_conv.h"
 #include "metadata.h"
 
 using namespace llvm;
@@ -26,13 +27,70 @@ using namespace std;
 
 namespace
 {
+	enum KindIndex
+	{
+		VirtualAddressKind,
+		FunctionVersionKind,
+		StackPointerKind,
+		StubTargetKind,
+		RecoverableKind,
+		AssemblyKind,
+		CodeHashKind,
+		AliasesKind,
+		CallInfoKind,
+		StackFrameKind,
+		ProgramMemoryKind,
+		RegistersKind,
+		StackOffsetKind,
+		KindCount
+	};
+	
+	const char* const kindNames[KindCount] = {
+		"fcd.vaddr",
+		"fcd.funver",
+		"fcd.stackptr",
+		"fcd.stubtarget",
+		"fcd.recoverable",
+		"fcd.asm",
+		"fcd.codehash",
+		"fcd.aliases",
+		"fcd.callinfo",
+		"fcd.stackframe",
+		"fcd.prgmem",
+		"fcd.registers",
+		"fcd.stackoffset",
+	};
+	
+	// Kind IDs and the flag node of the context that the current thread used last. Looking up a kind by name hashes
+	// the name, and this is called for every alias query on program memory.
+	struct KindCache
+	{
+		const LLVMContext* context;
+		unsigned ids[KindCount];
+		MDNode* flagNode;
+	};
+	
+	thread_local KindCache kindCache = {nullptr, {}, nullptr};
+	
+	KindCache& kindsOf(LLVMContext& ctx)
+	{
+		if (kindCache.context != &ctx)
+		{
+			md::registerKinds(ctx);
+		}
+		return kindCache;
+	}
+	
+	unsigned kind(const Value& value, KindIndex index)
+	{
+		return kindsOf(value.getContext()).ids[index];
+	}
+	
 	template<typename T>
-	void setFlag(T& value, const char* flag)
+	void setFlag(T& value, KindIndex index)
 	{
-		auto& ctx = value.getContext();
-		Type* i1 = Type::getInt1Ty(ctx);
-		MDNode* zeroNode = MDNode::get(ctx, ConstantAsMetadata::get(ConstantInt::get(i1, 1)));
-		value.setMetadata(flag, zeroNode);
+		KindCache& cache = kindsOf(value.getContext());
+		value.setMetadata(cache.ids[index], cache.flagNode);
 	}
 	
 	bool getMdNameForType(const StructType& type, string& output)
@@ -45,6 +103,69 @@ namespace
 		}
 		return false;
 	}
+	
+	MDNode* valueInformationNode(LLVMContext& ctx, const ValueInformation& value)
+	{
+		Type* i32 = Type::getInt32Ty(ctx);
+		Metadata* storageClass = ConstantAsMetadata::get(ConstantInt::get(i32, value.type));
+		if (value.type == ValueInformation::Stack)
+		{
+			Type* i64 = Type::getInt64Ty(ctx);
+			return MDNode::get(ctx, {storageClass, ConstantAsMetadata::get(ConstantInt::get(i64, value.frameBaseOffset))});
+		}
+		return MDNode::get(ctx, {storageClass, MDString::get(ctx, value.registerInfo->name)});
+	}
+	
+	template<typename TAction>
+	bool forEachValueInformation(const MDNode& values, const TargetInfo& targetInfo, TAction&& action)
+	{
+		for (const MDOperand& operand : values.operands())
+		{
+			auto valueNode = dyn_cast<MDNode>(operand.get());
+			if (valueNode == nullptr || valueNode->getNumOperands() != 2)
+			{
+				return false;
+			}
+			
+			auto storageClass = mdconst::dyn_extract<ConstantInt>(valueNode->getOperand(0));
+			if (storageClass == nullptr)
+			{
+				return false;
+			}
+			
+			auto type = static_cast<ValueInformation::StorageClass>(storageClass->getLimitedValue());
+			if (type == ValueInformation::Stack)
+			{
+				if (auto offset = mdconst::dyn_extract<ConstantInt>(valueNode->getOperand(1)))
+				{
+					action(ValueInformation(type, offset->getLimitedValue()));
+					continue;
+				}
+			}
+			else if (auto name = dyn_cast<MDString>(valueNode->getOperand(1)))
+			{
+				if (auto registerInfo = targetInfo.registerNamed(name->getString().str().c_str()))
+				{
+					action(ValueInformation(type, registerInfo));
+					continue;
+				}
+			}
+			return false;
+		}
+		return true;
+	}
+}
+
+void md::registerKinds(LLVMContext& ctx)
+{
+	kindCache.context = &ctx;
+	for (unsigned i = 0; i < KindCount; ++i)
+	{
+		kindCache.ids[i] = ctx.getMDKindID(kindNames[i]);
+	}
+	
+	Type* i1 = Type::getInt1Ty(ctx);
+	kindCache.flagNode = MDNode::get(ctx, ConstantAsMetadata::get(ConstantInt::get(i1, 1)));
 }
 
 void md::ensureFunctionBody(Function& fn)
@@ -84,7 +205,7 @@ vector<string> md::getIncludedFiles(Module& module)
 
 ConstantInt* md::getStackPointerArgument(const Function &fn)
 {
-	if (auto node = fn.getMetadata("fcd.stackptr"))
+	if (auto node = fn.getMetadata(kind(fn, StackPointerKind)))
 	{
 		if (auto constant = dyn_cast<ConstantAsMetadata>(node->getOperand(0)))
 		{
@@ -96,7 +217,7 @@ ConstantInt* md::getStackPointerArgument(const Function &fn)
 
 ConstantInt* md::getVirtualAddress(const Function& fn)
 {
-	if (auto node = fn.getMetadata("fcd.vaddr"))
+	if (auto node = fn.getMetadata(kind(fn, VirtualAddressKind)))
 	{
 		if (auto constantMD = dyn_cast<ConstantAsMetadata>(node->getOperand(0)))
 		{
@@ -111,7 +232,7 @@ ConstantInt* md::getVirtualAddress(const Function& fn)
 
 unsigned md::getFunctionVersion(const Function& fn)
 {
-	if (auto node = fn.getMetadata("fcd.funver"))
+	if (auto node = fn.getMetadata(kind(fn, FunctionVersionKind)))
 	{
 		if (auto constantMD = dyn_cast<ConstantAsMetadata>(node->getOperand(0)))
 		{
@@ -126,7 +247,7 @@ unsigned md::getFunctionVersion(const Function& fn)
 
 Function* md::getStubTarget(const Function& fn)
 {
-	if (auto node = fn.getMetadata("fcd.stubtarget"))
+	if (auto node = fn.getMetadata(kind(fn, StubTargetKind)))
 	{
 		if (auto valueAsMd = dyn_cast<ValueAsMetadata>(node->getOperand(0)))
 		{
@@ -138,7 +259,7 @@ Function* md::getStubTarget(const Function& fn)
 
 bool md::areArgumentsRecoverable(const Function &fn)
 {
-	return fn.getMetadata("fcd.recoverable") != nullptr;
+	return fn.getMetadata(kind(fn, RecoverableKind)) != nullptr;
 }
 
 bool md::isPrototype(const Function &fn)
@@ -165,17 +286,30 @@ bool md::isPrototype(const Function &fn)
 
 bool md::isStackFrame(const AllocaInst &alloca)
 {
-	return alloca.getMetadata("fcd.stackframe") != nullptr;
+	return alloca.getMetadata(kind(alloca, StackFrameKind)) != nullptr;
 }
 
 bool md::isProgramMemory(const Instruction &value)
 {
-	return value.getMetadata("fcd.prgmem") != nullptr;
+	return value.getMetadata(kind(value, ProgramMemoryKind)) != nullptr;
+}
+
+bool md::getStackOffset(const Instruction& inst, int64_t& offset)
+{
+	if (auto node = inst.getMetadata(kind(inst, StackOffsetKind)))
+	{
+		if (auto constant = mdconst::dyn_extract<ConstantInt>(node->getOperand(0)))
+		{
+			offset = constant->getSExtValue();
+			return true;
+		}
+	}
+	return false;
 }
 
 MDString* md::getAssemblyString(const Function& fn)
 {
-	if (auto node = fn.getMetadata("fcd.asm"))
+	if (auto node = fn.getMetadata(kind(fn, AssemblyKind)))
 	{
 		if (auto nameNode = dyn_cast<MDString>(node->getOperand(0)))
 		{
@@ -185,6 +319,34 @@ MDString* md::getAssemblyString(const Function& fn)
 	return nullptr;
 }
 
+MDString* md::getCodeHash(const Function& fn)
+{
+	if (auto node = fn.getMetadata(kind(fn, CodeHashKind)))
+	{
+		if (auto hashNode = dyn_cast<MDString>(node->getOperand(0)))
+		{
+			return hashNode;
+		}
+	}
+	return nullptr;
+}
+
+vector<string> md::getAliases(const Function& fn)
+{
+	vector<string> result;
+	if (auto node = fn.getMetadata(kind(fn, AliasesKind)))
+	{
+		for (const MDOperand& op : node->operands())
+		{
+			if (auto name = dyn_cast<MDString>(op))
+			{
+				result.push_back(name->getString());
+			}
+		}
+	}
+	return result;
+}
+
 void md::addIncludedFiles(Module& module, const vector<string>& includedFiles)
 {
 	LLVMContext& ctx = module.getContext();
@@ -202,7 +364,7 @@ void md::setVirtualAddress(Function& fn, uint64_t virtualAddress)
 	auto& ctx = fn.getContext();
 	ConstantInt* cvaddr = ConstantInt::get(Type::getInt64Ty(ctx), virtualAddress);
 	MDNode* vaddrNode = MDNode::get(ctx, ConstantAsMetadata::get(cvaddr));
-	fn.setMetadata("fcd.vaddr", vaddrNode);
+	fn.setMetadata(kind(fn, VirtualAddressKind), vaddrNode);
 }
 
 void md::incrementFunctionVersion(llvm::Function &fn)
@@ -211,13 +373,13 @@ void md::incrementFunctionVersion(llvm::Function &fn)
 	auto& ctx = fn.getContext();
 	ConstantInt* cNewVersion = ConstantInt::get(Type::getInt32Ty(ctx), newVersion);
 	MDNode* versionNode = MDNode::get(ctx, ConstantAsMetadata::get(cNewVersion));
-	fn.setMetadata("fcd.funver", versionNode);
+	fn.setMetadata(kind(fn, FunctionVersionKind), versionNode);
 }
 
 void md::setStubTarget(Function& stub, Function& target)
 {
 	ensureFunctionBody(stub);
-	stub.setMetadata("fcd.stubtarget", MDNode::get(stub.getContext(), ValueAsMetadata::get(&target)));
+	stub.setMetadata(kind(stub, StubTargetKind), MDNode::get(stub.getContext(), ValueAsMetadata::get(&target)));
 }
 
 void md::setArgumentsRecoverable(Function &fn, bool recoverable)
@@ -225,11 +387,11 @@ void md::setArgumentsRecoverable(Function &fn, bool recoverable)
 	ensureFunctionBody(fn);
 	if (recoverable)
 	{
-		setFlag(fn, "fcd.recoverable");
+		setFlag(fn, RecoverableKind);
 	}
 	else
 	{
-		fn.setMetadata("fcd.recoverable", nullptr);
+		fn.setMetadata(kind(fn, RecoverableKind), nullptr);
 	}
 }
 
@@ -239,13 +401,13 @@ void md::setStackPointerArgument(Function &fn, unsigned int argIndex)
 	auto& ctx = fn.getContext();
 	ConstantInt* cArgIndex = ConstantInt::get(Type::getInt32Ty(ctx), argIndex);
 	MDNode* argIndexNode = MDNode::get(ctx, ConstantAsMetadata::get(cArgIndex));
-	fn.setMetadata("fcd.stackptr", argIndexNode);
+	fn.setMetadata(kind(fn, StackPointerKind), argIndexNode);
 }
 
 void md::removeStackPointerArgument(Function& fn)
 {
 	ensureFunctionBody(fn);
-	fn.setMetadata("fcd.stackptr", nullptr);
+	fn.setMetadata(kind(fn, StackPointerKind), nullptr);
 }
 
 void md::setAssemblyString(Function &fn, StringRef assembly)
@@ -253,12 +415,31 @@ void md::setAssemblyString(Function &fn, StringRef assembly)
 	ensureFunctionBody(fn);
 	LLVMContext& ctx = fn.getContext();
 	MDNode* asmNode = MDNode::get(ctx, MDString::get(ctx, assembly));
-	fn.setMetadata("fcd.asm", asmNode);
+	fn.setMetadata(kind(fn, AssemblyKind), asmNode);
+}
+
+void md::setCodeHash(Function& fn, StringRef hash)
+{
+	LLVMContext& ctx = fn.getContext();
+	MDNode* hashNode = MDNode::get(ctx, MDString::get(ctx, hash));
+	fn.setMetadata(kind(fn, CodeHashKind), hashNode);
+}
+
+void md::addAlias(Function& fn, StringRef name)
+{
+	LLVMContext& ctx = fn.getContext();
+	SmallVector<Metadata*, 4> names;
+	if (auto node = fn.getMetadata(kind(fn, AliasesKind)))
+	{
+		names.append(node->op_begin(), node->op_end());
+	}
+	names.push_back(MDString::get(ctx, name));
+	fn.setMetadata(kind(fn, AliasesKind), MDNode::get(ctx, names));
 }
 
 void md::setStackFrame(AllocaInst &alloca)
 {
-	setFlag(alloca, "fcd.stackframe");
+	setFlag(alloca, StackFrameKind);
 }
 
 void md::setProgramMemory(Instruction &value, bool isProgramMemory)
@@ -267,15 +448,27 @@ void md::setProgramMemory(Instruction &value, bool isProgramMemory)
 	{
 		if (!md::isProgramMemory(value))
 		{
-			setFlag(value, "fcd.prgmem");
+			setFlag(value, ProgramMemoryKind);
 		}
 	}
 	else if (md::isProgramMemory(value))
 	{
-		value.setMetadata("fcd.prgmem", nullptr);
+		value.setMetadata(kind(value, ProgramMemoryKind), nullptr);
 	}
 }
 
+void md::setStackOffset(Instruction& inst, int64_t offset)
+{
+	auto& ctx = inst.getContext();
+	ConstantInt* cOffset = ConstantInt::get(Type::getInt64Ty(ctx), static_cast<uint64_t>(offset), true);
+	inst.setMetadata(kind(inst, StackOffsetKind), MDNode::get(ctx, ConstantAsMetadata::get(cOffset)));
+}
+
+void md::removeStackOffset(Instruction& inst)
+{
+	inst.setMetadata(kind(inst, StackOffsetKind), nullptr);
+}
+
 void md::copy(const Function& from, Function& to)
 {
 	if (auto ptr = getStackPointerArgument(from))
@@ -294,6 +487,14 @@ void md::copy(const Function& from, Function& to)
 	{
 		setArgumentsRecoverable(to);
 	}
+	if (auto hash = getCodeHash(from))
+	{
+		setCodeHash(to, hash->getString());
+	}
+	if (auto aliases = from.getMetadata(kind(from, AliasesKind)))
+	{
+		to.setMetadata(kind(to, AliasesKind), aliases);
+	}
 }
 
 bool md::isRegisterStruct(const Value &value)
@@ -306,7 +507,7 @@ bool md::isRegisterStruct(const Value &value)
 	
 	if (auto alloca = dyn_cast<AllocaInst>(&value))
 	{
-		return alloca->getMetadata("fcd.registers") != nullptr;
+		return alloca->getMetadata(kind(*alloca, RegistersKind)) != nullptr;
 	}
 	
 	return false;
@@ -314,17 +515,17 @@ bool md::isRegisterStruct(const Value &value)
 
 void md::setRegisterStruct(AllocaInst& alloca, bool registerStruct)
 {
-	auto currentNode = alloca.getMetadata("fcd.registers");
+	auto currentNode = alloca.getMetadata(kind(alloca, RegistersKind));
 	if (registerStruct)
 	{
 		if (currentNode == nullptr)
 		{
-			setFlag(alloca, "fcd.registers");
+			setFlag(alloca, RegistersKind);
 		}
 	}
 	else if (currentNode != nullptr)
 	{
-		alloca.setMetadata("fcd.registers", nullptr);
+		alloca.setMetadata(kind(alloca, RegistersKind), nullptr);
 	}
 }
 
@@ -374,3 +575,123 @@ StringRef md::getRecoveredReturnFieldName(Module& module, StructType& returnType
 	
 	return "";
 }
+
+void md::setCallInformation(Function& fn, const CallInformation& callInfo, StringRef fingerprint)
+{
+	assert(callInfo.getStage() == CallInformation::Completed || callInfo.getStage() == CallInformation::Failed);
+	ensureFunctionBody(fn);
+	LLVMContext& ctx = fn.getContext();
+	SmallVector<Metadata*, 4> parameters;
+	for (const ValueInformation& value : callInfo.parameters())
+	{
+		parameters.push_back(valueInformationNode(ctx, value));
+	}
+	
+	SmallVector<Metadata*, 2> returns;
+	for (const ValueInformation& value : callInfo.returns())
+	{
+		returns.push_back(valueInformationNode(ctx, value));
+	}
+	
+	const CallingConvention* cc = callInfo.getCallingConvention();
+	Metadata* operands[] = {
+		MDString::get(ctx, cc == nullptr ? "" : cc->getName()),
+		ConstantAsMetadata::get(ConstantInt::get(Type::getInt1Ty(ctx), callInfo.isVararg())),
+		MDNode::get(ctx, parameters),
+		MDNode::get(ctx, returns),
+		ConstantAsMetadata::get(ConstantInt::get(Type::getInt32Ty(ctx), callInfo.getStage())),
+		MDString::get(ctx, fingerprint),
+	};
+	fn.setMetadata(kind(fn, CallInfoKind), MDNode::get(ctx, operands));
+}
+
+hash_code md::hashCallInformation(const Function& fn)
+{
+	// Metadata is uniqued, so operands are equal when they are the same node.
+	hash_code result = hash_value(&fn);
+	if (MDNode* node = fn.getMetadata(kind(fn, CallInfoKind)))
+	{
+		for (unsigned i = 0; i < node->getNumOperands() && i < 5; ++i)
+		{
+			result = hash_combine(result, node->getOperand(i).get());
+		}
+	}
+	return result;
+}
+
+bool md::getCallInformation(const Function& fn, const TargetInfo& targetInfo, CallInformation& callInfo, StringRef* fingerprint)
+{
+	MDNode* node = fn.getMetadata(kind(fn, CallInfoKind));
+	if (node == nullptr || node->getNumOperands() != 6)
+	{
+		return false;
+	}
+	
+	auto ccName = dyn_cast<MDString>(node->getOperand(0));
+	auto vararg = mdconst::dyn_extract<ConstantInt>(node->getOperand(1));
+	auto parameters = dyn_cast<MDNode>(node->getOperand(2));
+	auto returns = dyn_cast<MDNode>(node->getOperand(3));
+	auto stage = mdconst::dyn_extract<ConstantInt>(node->getOperand(4));
+	auto fingerprintString = dyn_cast<MDString>(node->getOperand(5));
+	if (ccName == nullptr || vararg == nullptr || parameters == nullptr || returns == nullptr || stage == nullptr || fingerprintString == nullptr)
+	{
+		return false;
+	}
+	
+	CallInformation result;
+	result.setStage(static_cast<CallInformation::Stage>(stage->getLimitedValue()));
+	if (result.getStage() == CallInformation::Completed)
+	{
+		CallingConvention* cc = CallingConvention::getCallingConvention(ccName->getString().str());
+		if (cc == nullptr)
+		{
+			return false;
+		}
+		result.setCallingConvention(cc);
+	}
+	else if (result.getStage() != CallInformation::Failed)
+	{
+		return false;
+	}
+	
+	bool valid = forEachValueInformation(*parameters, targetInfo, [&](const ValueInformation& value)
+	{
+		result.addParameter(value);
+	});
+	valid = valid && forEachValueInformation(*returns, targetInfo, [&](const ValueInformation& value)
+	{
+		result.addReturn(value);
+	});
+	
+	if (!valid)
+	{
+		return false;
+	}
+	
+	result.setVararg(vararg->isOne());
+	callInfo = move(result);
+	if (fingerprint != nullptr)
+	{
+		*fingerprint = fingerprintString->getString();
+	}
+	return true;
+}
+
+void md::setSystemCallingConvention(Module& module, StringRef name)
+{
+	LLVMContext& ctx = module.getContext();
+	NamedMDNode* node = module.getOrInsertNamedMetadata("fcd.callconv");
+	node->dropAllReferences();
+	node->addOperand(MDNode::get(ctx, MDString::get(ctx, name)));
+}
+
+StringRef md::getSystemCallingConvention(const Module& module)
+{
+	if (NamedMDNode* node = module.getNamedMetadata("fcd.callconv"))
+	if (node->getNumOperands() == 1)
+	if (auto name = dyn_cast<MDString>(node->getOperand(0)->getOperand(0)))
+	{
+		return name->getString();
+	}
+	return "";
+}
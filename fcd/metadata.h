@@ -24,6 +24,7 @@
 
 #include "params_registry.h"
 
+#include <llvm/ADT/Hashing.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Function.h>
@@ -34,6 +35,10 @@
 
 namespace md
 {
+	// Accessors cache kind IDs for the last context that was used on the current thread. Call this when creating a
+	// context, so that a context allocated where a destroyed one used to be doesn't reuse its IDs.
+	void registerKinds(llvm::LLVMContext& ctx);
+	
 	void ensureFunctionBody(llvm::Function& fn);
 	
 	std::vector<std::string> getIncludedFiles(llvm::Module& module);
@@ -44,8 +49,14 @@ namespace md
 	bool areArgumentsRecoverable(const llvm::Function& fn);
 	bool isPrototype(const llvm::Function& fn);
 	llvm::MDString* getAssemblyString(const llvm::Function& fn);
+	llvm::MDString* getCodeHash(const llvm::Function& fn);
+	// Names of the functions that have the same body as fn, and that were not lifted on their own.
+	std::vector<std::string> getAliases(const llvm::Function& fn);
 	bool isStackFrame(const llvm::AllocaInst& alloca);
 	bool isProgramMemory(const llvm::Instruction& value);
+	// Offset from the stack pointer on function entry that lifting could tell: of the address that a program memory
+	// access uses, or of the stack pointer itself at a call.
+	bool getStackOffset(const llvm::Instruction& inst, int64_t& offset);
 
 	void addIncludedFiles(llvm::Module& module, const std::vector<std::string>& includedFiles);
 	void setVirtualAddress(llvm::Function& fn, uint64_t virtualAddress);
@@ -55,8 +66,12 @@ namespace md
 	void setStackPointerArgument(llvm::Function& fn, unsigned argIndex);
 	void removeStackPointerArgument(llvm::Function& fn);
 	void setAssemblyString(llvm::Function& fn, llvm::StringRef assembly);
+	void setCodeHash(llvm::Function& fn, llvm::StringRef hash);
+	void addAlias(llvm::Function& fn, llvm::StringRef name);
 	void setStackFrame(llvm::AllocaInst& alloca);
 	void setProgramMemory(llvm::Instruction& value, bool isProgramMemory = true);
+	void setStackOffset(llvm::Instruction& inst, int64_t offset);
+	void removeStackOffset(llvm::Instruction& inst);
 	
 	void copy(const llvm::Function& from, llvm::Function& to);
 	
@@ -65,6 +80,14 @@ namespace md
 	
 	void setRecoveredReturnFieldNames(llvm::Module& module, llvm::StructType& returnType, const CallInformation& callInfo);
 	llvm::StringRef getRecoveredReturnFieldName(llvm::Module& module, llvm::StructType& returnType, unsigned i);
+	
+	void setCallInformation(llvm::Function& fn, const CallInformation& callInfo, llvm::StringRef fingerprint = "");
+	bool getCallInformation(const llvm::Function& fn, const TargetInfo& targetInfo, CallInformation& callInfo, llvm::StringRef* fingerprint = nullptr);
+	// Changes when the call information stored for fn changes (but not when only its fingerprint does). Only
+	// meaningful within a single run.
+	llvm::hash_code hashCallInformation(const llvm::Function& fn);
+	void setSystemCallingConvention(llvm::Module& module, llvm::StringRef name);
+	llvm::StringRef getSystemCallingConvention(const llvm::Module& module);
 }
 
 #endif /* fcd__metadata_h */
@@ -0,0 +1,171 @@
+//
+// module_partition.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "call_conv.h"
+#include "metadata.h"
+#include "module_partition.h"
+#include "params_registry.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	size_t instructionCount(const Function& fn)
+	{
+		size_t count = 0;
+		for (const BasicBlock& bb : fn)
+		{
+			count += bb.size();
+		}
+		return count;
+	}
+	
+	struct CallInformationExport final : public ModulePass
+	{
+		static char ID;
+		
+		CallInformationExport()
+		: ModulePass(ID)
+		{
+		}
+		
+		virtual const char* getPassName() const override
+		{
+			return "Export call information";
+		}
+		
+		virtual void getAnalysisUsage(AnalysisUsage& au) const override
+		{
+			au.addRequired<ParameterRegistry>();
+			au.setPreservesAll();
+		}
+		
+		virtual bool runOnModule(Module& module) override
+		{
+			// The CallInformationStore pass saved call information in the module itself. Remember which calling
+			// convention the registry inferred from the executable, since workers won't have it.
+			ParameterRegistry& registry = getAnalysis<ParameterRegistry>();
+			if (registry.begin() != registry.end())
+			{
+				md::setSystemCallingConvention(module, (*registry.begin())->getName());
+			}
+			return true;
+		}
+	};
+	
+	char CallInformationExport::ID = 0;
+	RegisterPass<CallInformationExport> callInformationExport("#export-callinfo", "Export call information", false, false);
+}
+
+bool writeModulePartitions(Module& module, unsigned partitionCount, const string& directory, string& errorMessage)
+{
+	assert(partitionCount > 0);
+	if (auto error = sys::fs::create_directories(directory))
+	{
+		errorMessage = error.message();
+		return false;
+	}
+	
+	// Assign the largest functions first, each to the partition that has the least instructions so far.
+	vector<pair<size_t, Function*>> definitions;
+	for (Function& fn : module)
+	{
+		if (!md::isPrototype(fn))
+		{
+			definitions.push_back({instructionCount(fn), &fn});
+		}
+	}
+	stable_sort(definitions.begin(), definitions.end(), [](const pair<size_t, Function*>& a, const pair<size_t, Function*>& b)
+	{
+		return a.first > b.first;
+	});
+	
+	unordered_map<const Function*, unsigned> partitionOf;
+	vector<size_t> load(partitionCount);
+	for (const auto& pair : definitions)
+	{
+		auto partition = static_cast<unsigned>(min_element(load.begin(), load.end()) - load.begin());
+		load[partition] += pair.first;
+		partitionOf[pair.second] = partition;
+	}
+	
+	auto targetInfo = TargetInfo::getTargetInfo(module);
+	for (unsigned i = 0; i < partitionCount; ++i)
+	{
+		ValueToValueMapTy valueMap;
+		auto slice = CloneModule(&module, valueMap, [&](const GlobalValue* value)
+		{
+			if (auto fn = dyn_cast<Function>(value))
+			{
+				auto iter = partitionOf.find(fn);
+				return iter == partitionOf.end() ? md::isPrototype(*fn) : iter->second == i;
+			}
+			return true;
+		});
+		
+		// CloneModule leaves functions of other partitions as declarations, without metadata.
+		for (const auto& pair : definitions)
+		{
+			if (partitionOf[pair.second] != i)
+			{
+				const Function& original = *pair.second;
+				Function& prototype = cast<Function>(*valueMap[&original]);
+				md::copy(original, prototype);
+				
+				CallInformation callInfo;
+				if (md::getCallInformation(original, *targetInfo, callInfo))
+				{
+					md::setCallInformation(prototype, callInfo);
+				}
+			}
+		}
+		
+		error_code error;
+		SmallString<128> path(directory);
+		sys::path::append(path, "partition-" + to_string(i) + ".bc");
+		raw_fd_ostream output(path, error, sys::fs::F_None);
+		if (error)
+		{
+			errorMessage = path.str().str() + ": " + error.message();
+			return false;
+		}
+		WriteBitcodeToFile(slice.get(), output);
+	}
+	return true;
+}
+
+ModulePass* createCallInformationExportPass()
+{
+	return new CallInformationExport;
+}
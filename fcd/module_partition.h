@@ -0,0 +1,43 @@
+//
+// module_partition.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef fcd__module_partition_h
+#define fcd__module_partition_h
+
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include <string>
+
+// Splits a pre-optimized module into slices that separate fcd processes can optimize and decompile on their own
+// (with --module-in twice). Each slice keeps the definitions of the functions that it was assigned. The other
+// functions become prototypes that carry the call information computed for them before the split, so that argument
+// recovery in one slice agrees with the others on how to call them.
+//
+// Slices are written to <directory>/partition-<n>.bc.
+bool writeModulePartitions(llvm::Module& module, unsigned partitionCount, const std::string& directory, std::string& errorMessage);
+
+// Computes call information over the whole module, which the ParameterRegistry stores in the module's metadata, and
+// records the system calling convention.
+llvm::ModulePass* createCallInformationExportPass();
+
+#endif /* fcd__module_partition_h */
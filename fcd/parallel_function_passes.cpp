@@ -0,0 +1,371 @@
+//
+// parallel_function_passes.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "metadata.h"
+#include "parallel_function_passes.h"
+#include "progress.h"
+#include "trace_events.h"
+
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_set>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	struct LocalValue
+	{
+		string name;
+		GlobalValue::LinkageTypes linkage;
+		bool unnamed;
+	};
+	
+	// Workers only have declarations for what they don't own, and they refer to it by name. Values with local
+	// linkage get external linkage (and a name, if they don't have one) until worker modules are linked back.
+	vector<LocalValue> promoteLocalValues(Module& module)
+	{
+		vector<LocalValue> result;
+		for (GlobalValue& value : module.global_values())
+		{
+			if (value.hasLocalLinkage())
+			{
+				bool unnamed = !value.hasName();
+				if (unnamed)
+				{
+					value.setName("fcd.local");
+				}
+				result.push_back({value.getName().str(), value.getLinkage(), unnamed});
+				value.setLinkage(GlobalValue::ExternalLinkage);
+			}
+		}
+		return result;
+	}
+	
+	void restoreLocalValues(Module& module, const vector<LocalValue>& locals)
+	{
+		for (const LocalValue& local : locals)
+		{
+			if (GlobalValue* value = module.getNamedValue(local.name))
+			{
+				value->setLinkage(local.linkage);
+				if (local.unnamed)
+				{
+					value->setName("");
+				}
+			}
+		}
+	}
+	
+	size_t instructionCount(const Function& fn)
+	{
+		size_t count = 0;
+		for (const BasicBlock& bb : fn)
+		{
+			count += bb.size();
+		}
+		return count;
+	}
+}
+
+bool ParallelFunctionPasses::canRunInParallel(const Pass& pass, WorkerKind kind)
+{
+	if (pass.getPassKind() != PT_Function)
+	{
+		return false;
+	}
+	return kind == Processes || PassRegistry::getPassRegistry()->getPassInfo(pass.getPassID()) != nullptr;
+}
+
+ParallelFunctionPasses::ParallelFunctionPasses(Executable* executable, TaskScheduler& scheduler, AnalysisSetup setupAnalyses, WorkerKind kind)
+: executable(executable), scheduler(scheduler), jobs(scheduler.getJobCount()), setupAnalyses(setupAnalyses), kind(kind)
+{
+}
+
+ParallelFunctionPasses::~ParallelFunctionPasses()
+{
+	for (Pass* pass : instances)
+	{
+		delete pass;
+	}
+}
+
+void ParallelFunctionPasses::addPass(Pass& pass)
+{
+	assert(canRunInParallel(pass, kind));
+	if (kind == Processes)
+	{
+		instances.push_back(&pass);
+	}
+	else
+	{
+		passes.push_back(PassRegistry::getPassRegistry()->getPassInfo(pass.getPassID()));
+	}
+}
+
+void ParallelFunctionPasses::runPasses(Module& module, const vector<string>& functions, vector<Pass*> toRun) const
+{
+	unordered_set<string> owned(functions.begin(), functions.end());
+	for (Function& fn : module)
+	{
+		if (!fn.isDeclaration() && owned.count(fn.getName().str()) == 0)
+		{
+			fn.deleteBody();
+		}
+	}
+	
+	for (GlobalVariable& global : module.globals())
+	{
+		if (global.hasInitializer())
+		{
+			global.setInitializer(nullptr);
+			global.setLinkage(GlobalValue::ExternalLinkage);
+		}
+	}
+	
+	// Named metadata is appended when modules are linked; the original module already has all of it.
+	vector<NamedMDNode*> namedMetadata;
+	for (NamedMDNode& node : module.named_metadata())
+	{
+		namedMetadata.push_back(&node);
+	}
+	for (NamedMDNode* node : namedMetadata)
+	{
+		module.eraseNamedMetadata(node);
+	}
+	
+	legacy::PassManager pm;
+	setupAnalyses(pm, executable);
+	for (Pass* pass : toRun)
+	{
+		TraceRecorder::addPass(pm, pass);
+	}
+	pm.run(module);
+}
+
+void ParallelFunctionPasses::work(StringRef moduleBitcode, WorkerResult& result) const
+{
+	LLVMContext context;
+	md::registerKinds(context);
+	auto moduleOrError = parseBitcodeFile(MemoryBufferRef(moduleBitcode, "fcd-shard"), context);
+	if (!moduleOrError)
+	{
+		return;
+	}
+	
+	vector<Pass*> toRun;
+	for (const PassInfo* info : passes)
+	{
+		toRun.push_back(info->createPass());
+	}
+	
+	Module& module = *moduleOrError.get();
+	runPasses(module, result.functions, move(toRun));
+	
+	raw_svector_ostream bitcodeStream(result.bitcode);
+	WriteBitcodeToFile(&module, bitcodeStream);
+}
+
+void ParallelFunctionPasses::workInProcesses(Module& module, vector<WorkerResult>& results) const
+{
+	// Children inherit whatever is still buffered and would print it again.
+	outs().flush();
+	errs().flush();
+	fflush(nullptr);
+	
+	// Workers that couldn't be started, or that failed, are left without bitcode.
+	//
+	// The task scheduler's workers and the progress reporter's thread are running when this forks, and only the
+	// forking thread exists in children. Children only run passes over their copy of the module and write bitcode to
+	// their pipe: they detach from the trace recorder and the progress reporter, whose locks those threads could have
+	// held, and never use the task scheduler.
+	vector<pair<pid_t, int>> children;
+	for (WorkerResult& result : results)
+	{
+		int fds[2];
+		if (pipe(fds) != 0)
+		{
+			errs() << "couldn't create pipe for function pass worker: " << strerror(errno) << '\n';
+			break;
+		}
+		
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			// The child owns a copy of the module and of the pass instances, so it can run them directly.
+			close(fds[0]);
+			TraceRecorder::detachFromChild();
+			ProgressReporter::detachFromChild();
+			runPasses(module, result.functions, instances);
+			raw_fd_ostream bitcodeStream(fds[1], true);
+			WriteBitcodeToFile(&module, bitcodeStream);
+			bitcodeStream.close();
+			_exit(bitcodeStream.has_error() ? 1 : 0);
+		}
+		
+		close(fds[1]);
+		if (pid < 0)
+		{
+			errs() << "couldn't fork function pass worker: " << strerror(errno) << '\n';
+			close(fds[0]);
+			break;
+		}
+		children.push_back({pid, fds[0]});
+	}
+	
+	// Children block once their pipe is full, so results are read before children are waited for.
+	for (size_t i = 0; i < children.size(); ++i)
+	{
+		WorkerResult& result = results[i];
+		char buffer[0x10000];
+		while (true)
+		{
+			ssize_t count = read(children[i].second, buffer, sizeof buffer);
+			if (count > 0)
+			{
+				result.bitcode.append(buffer, buffer + count);
+			}
+			else if (count < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			else
+			{
+				break;
+			}
+		}
+		close(children[i].second);
+		
+		int status = 0;
+		pid_t waited;
+		while ((waited = waitpid(children[i].first, &status, 0)) < 0 && errno == EINTR)
+		{
+		}
+		
+		if (waited < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			errs() << "function pass worker " << children[i].first << " didn't exit cleanly\n";
+			result.bitcode.clear();
+		}
+	}
+}
+
+bool ParallelFunctionPasses::run(Module& module)
+{
+	if (passes.size() == 0 && instances.size() == 0)
+	{
+		return true;
+	}
+	
+	// Assign the largest functions first, each to the worker that has the least instructions so far.
+	vector<pair<size_t, Function*>> definitions;
+	for (Function& fn : module)
+	{
+		if (!fn.isDeclaration())
+		{
+			definitions.push_back({instructionCount(fn), &fn});
+		}
+	}
+	stable_sort(definitions.begin(), definitions.end(), [](const pair<size_t, Function*>& a, const pair<size_t, Function*>& b)
+	{
+		return a.first > b.first;
+	});
+	
+	vector<LocalValue> locals = promoteLocalValues(module);
+	vector<WorkerResult> results(min<size_t>(jobs, max<size_t>(definitions.size(), 1)));
+	vector<size_t> load(results.size());
+	for (const auto& pair : definitions)
+	{
+		size_t worker = static_cast<size_t>(min_element(load.begin(), load.end()) - load.begin());
+		load[worker] += pair.first;
+		results[worker].functions.push_back(pair.second->getName().str());
+	}
+	
+	if (kind == Processes)
+	{
+		workInProcesses(module, results);
+	}
+	else
+	{
+		SmallVector<char, 0> moduleBitcode;
+		raw_svector_ostream moduleStream(moduleBitcode);
+		WriteBitcodeToFile(&module, moduleStream);
+		StringRef bitcode(moduleBitcode.data(), moduleBitcode.size());
+		
+		for (WorkerResult& result : results)
+		{
+			scheduler.add([this, bitcode, &result](unsigned)
+			{
+				work(bitcode, result);
+			});
+		}
+		scheduler.run();
+	}
+	
+	// Every worker must have succeeded before the original definitions are replaced. Otherwise, the module keeps them.
+	vector<unique_ptr<Module>> workerModules;
+	for (WorkerResult& result : results)
+	{
+		if (result.bitcode.size() == 0)
+		{
+			errs() << "function pass worker didn't produce a module\n";
+			restoreLocalValues(module, locals);
+			return false;
+		}
+		
+		StringRef resultBitcode(result.bitcode.data(), result.bitcode.size());
+		auto moduleOrError = parseBitcodeFile(MemoryBufferRef(resultBitcode, "fcd-shard"), module.getContext());
+		if (!moduleOrError)
+		{
+			errs() << "couldn't read back function pass worker module: " << moduleOrError.getError().message() << '\n';
+			restoreLocalValues(module, locals);
+			return false;
+		}
+		workerModules.push_back(move(moduleOrError.get()));
+	}
+	
+	for (const auto& pair : definitions)
+	{
+		pair.second->deleteBody();
+	}
+	
+	bool success = true;
+	for (auto& workerModule : workerModules)
+	{
+		if (Linker::linkModules(module, move(workerModule)))
+		{
+			success = false;
+			break;
+		}
+	}
+	
+	restoreLocalValues(module, locals);
+	return success;
+}
@@ -0,0 +1,91 @@
+//
+// parallel_function_passes.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef fcd__parallel_function_passes_h
+#define fcd__parallel_function_passes_h
+
+#include "executable.h"
+#include "task_scheduler.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include <string>
+#include <vector>
+
+// Runs a sequence of function passes over every function definition of a module, on several threads. LLVM contexts
+// can't be shared between threads, so the module is serialized and every worker parses its own copy, in which it
+// only keeps the bodies of the functions that it was assigned. Worker modules are then linked back over the
+// original module's definitions.
+//
+// Passes are instantiated again on each worker from their PassInfo, which means that they must be registered and
+// that they can't depend on state from another pass instance. Workers don't have a ParameterRegistry: this matches
+// the serial pipeline only once argument recovery has invalidated it.
+//
+// Workers can also be forked processes. They then run the instances that were added, on their copy of the module,
+// and send bitcode back through a pipe. This works with passes that can't be instantiated again (like Python passes,
+// which otherwise serialize on the global interpreter) and with executables that can't be mapped concurrently.
+class ParallelFunctionPasses
+{
+public:
+	typedef void (*AnalysisSetup)(llvm::legacy::PassManagerBase& pm, Executable* executable);
+	
+	enum WorkerKind
+	{
+		Threads,
+		Processes,
+	};
+	
+private:
+	struct WorkerResult
+	{
+		llvm::SmallVector<char, 0> bitcode;
+		std::vector<std::string> functions;
+	};
+	
+	Executable* executable;
+	TaskScheduler& scheduler;
+	unsigned jobs;
+	AnalysisSetup setupAnalyses;
+	WorkerKind kind;
+	std::vector<const llvm::PassInfo*> passes;
+	std::vector<llvm::Pass*> instances;
+	
+	void runPasses(llvm::Module& module, const std::vector<std::string>& functions, std::vector<llvm::Pass*> toRun) const;
+	void work(llvm::StringRef moduleBitcode, WorkerResult& result) const;
+	void workInProcesses(llvm::Module& module, std::vector<WorkerResult>& results) const;
+	
+public:
+	static bool canRunInParallel(const llvm::Pass& pass, WorkerKind kind = Threads);
+	
+	// Thread workers are tasks of scheduler; process workers are as many as it has jobs.
+	ParallelFunctionPasses(Executable* executable, TaskScheduler& scheduler, AnalysisSetup setupAnalyses, WorkerKind kind = Threads);
+	~ParallelFunctionPasses();
+	
+	// With threads, workers create their own instances and the caller keeps ownership of the pass. With processes,
+	// the pass instance is taken over.
+	void addPass(llvm::Pass& pass);
+	bool run(llvm::Module& module);
+};
+
+#endif /* fcd__parallel_function_passes_h */
@@ -23,9 +23,11 @@
 #include "pass_argrec.h"
 #include "passes.h"
 
+#include <llvm/ADT/Statistic.h>
 #include <llvm/Analysis/Passes.h>
 #include <llvm/Analysis/CallGraphSCCPass.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
@@ -34,6 +36,15 @@
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "fcd-argrec"
+
+STATISTIC(FunctionsParameterized, "Functions given parameters and return values from their call information");
+STATISTIC(PrototypesTypedFromImports, "Prototypes typed from call information imported with the module");
+STATISTIC(PrototypesTypedFromCallSites, "Prototypes typed from the first call site that was analyzed");
+STATISTIC(FunctionsWithoutCallInfo, "Functions left unchanged because no call information was found");
+STATISTIC(StubsReplaced, "Stubs replaced with their target");
+STATISTIC(CallSitesRewritten, "Calls rewritten to pass arguments and receive return values");
+
 char ArgumentRecovery::ID = 0;
 
 Value* ArgumentRecovery::getRegisterPtr(Function& fn)
@@ -62,6 +73,7 @@ void ArgumentRecovery::getAnalysisUsage(AnalysisUsage& au) const
 
 bool ArgumentRecovery::runOnModule(Module& module)
 {
+	targetInfo = TargetInfo::getTargetInfo(module);
 	for (Function& fn : module.getFunctionList())
 	{
 		getRegisterPtr(fn);
@@ -76,6 +88,7 @@ bool ArgumentRecovery::runOnModule(Module& module)
 			{
 				replaceStub(fn, *target);
 				changed = true;
+				++StubsReplaced;
 			}
 			else
 			{
@@ -84,20 +97,35 @@ bool ArgumentRecovery::runOnModule(Module& module)
 		}
 	}
 	
+	rewriteCallSites(module);
+	for (const auto& pair : bodiesToMove)
+	{
+		updateFunctionBody(*pair.first, *pair.second.target, *pair.second.callInfo);
+	}
+	
+	// Now that stub targets are referenced, they don't need a function body to ensure that they will stay around.
+	for (Function* target : stubTargets)
+	{
+		target->deleteBody();
+	}
+	
 	for (Function* toErase : functionsToErase)
 	{
 		toErase->eraseFromParent();
 	}
 	
+	callSiteRewrites.clear();
+	bodiesToMove.clear();
+	stubTargets.clear();
+	functionsToErase.clear();
 	return changed;
 }
 
 Function& ArgumentRecovery::createParameterizedFunction(Function& base, const CallInformation& callInfo)
 {
 	Module& module = *base.getParent();
-	auto info = TargetInfo::getTargetInfo(*base.getParent());
 	SmallVector<string, 8> parameterNames;
-	FunctionType* ft = createFunctionType(*info, callInfo, module, parameterNames);
+	FunctionType* ft = createFunctionType(*targetInfo, callInfo, module, parameterNames);
 	
 	Function* newFunc = Function::Create(ft, base.getLinkage());
 	base.getParent()->getFunctionList().insert(base.getIterator(), newFunc);
@@ -118,7 +146,7 @@ Function& ArgumentRecovery::createParameterizedFunction(Function& base, const Ca
 	i = 0;
 	for (const auto& param : callInfo.parameters())
 	{
-		if (param.type == ValueInformation::IntegerRegister && param.registerInfo == info->getStackPointer())
+		if (param.type == ValueInformation::IntegerRegister && param.registerInfo == targetInfo->getStackPointer())
 		{
 			md::setStackPointerArgument(*newFunc, static_cast<unsigned>(i));
 			break;
@@ -129,39 +157,70 @@ Function& ArgumentRecovery::createParameterizedFunction(Function& base, const Ca
 	return *newFunc;
 }
 
-void ArgumentRecovery::fixCallSites(Function& base, Function& newTarget, const CallInformation& ci)
+void ArgumentRecovery::rewriteCallSites(Module& module)
 {
-	auto targetInfo = TargetInfo::getTargetInfo(*base.getParent());
+	if (callSiteRewrites.empty())
+	{
+		return;
+	}
 	
-	// loop over callers and transform call sites.
-	while (!base.use_empty())
+	IRBuilder<> builder(module.getContext());
+	SmallVector<CallInst*, 16> calls;
+	for (Function& caller : module)
 	{
-		CallInst* call = cast<CallInst>(base.user_back());
-		Function* caller = call->getParent()->getParent();
-		auto registers = getRegisterPtr(*caller);
-		auto newCall = createCallSite(*targetInfo, ci, newTarget, *registers, *call);
+		calls.clear();
+		for (BasicBlock& bb : caller)
+		{
+			for (Instruction& inst : bb)
+			{
+				if (auto call = dyn_cast<CallInst>(&inst))
+				if (Function* callee = call->getCalledFunction())
+				if (callSiteRewrites.count(callee) != 0)
+				{
+					calls.push_back(call);
+				}
+			}
+		}
 		
-		// replace call
-		newCall->takeName(call);
-		call->eraseFromParent();
+		if (calls.empty())
+		{
+			continue;
+		}
 		
-		md::incrementFunctionVersion(*caller);
+		auto registers = getRegisterPtr(caller);
+		for (CallInst* call : calls)
+		{
+			const CallSiteRewrite& rewrite = callSiteRewrites.find(call->getCalledFunction())->second;
+			builder.SetInsertPoint(call);
+			auto newCall = createCallSite(*targetInfo, *rewrite.callInfo, *rewrite.target, *registers, builder);
+			
+			// replace call
+			newCall->takeName(call);
+			call->eraseFromParent();
+			++CallSitesRewritten;
+		}
+		md::incrementFunctionVersion(caller);
 	}
+	
+#ifndef NDEBUG
+	for (const auto& pair : callSiteRewrites)
+	{
+		assert(pair.first->use_empty() && "function used by something else than a direct call");
+	}
+#endif
 }
 
-Value* ArgumentRecovery::createReturnValue(Function &function, const CallInformation &ci, Instruction *insertionPoint)
+Value* ArgumentRecovery::createReturnValue(Function &function, const CallInformation &ci, IRBuilder<>& builder)
 {
 	assert(ci.returns_size() > 0);
-	auto targetInfo = TargetInfo::getTargetInfo(*function.getParent());
 	auto registers = getRegisterPtr(function);
 	
 	Value* result;
 	if (ci.returns_size() == 1)
 	{
 		const auto& returnInfo = *ci.return_begin();
-		auto gep = targetInfo->getRegister(registers, *returnInfo.registerInfo);
-		gep->insertBefore(insertionPoint);
-		result = new LoadInst(gep, "", insertionPoint);
+		auto gep = builder.Insert(targetInfo->getRegister(registers, *returnInfo.registerInfo));
+		result = builder.CreateLoad(gep);
 	}
 	else
 	{
@@ -171,10 +230,9 @@ Value* ArgumentRecovery::createReturnValue(Function &function, const CallInforma
 		{
 			if (returnInfo.type == ValueInformation::IntegerRegister)
 			{
-				auto gep = targetInfo->getRegister(registers, *returnInfo.registerInfo);
-				gep->insertBefore(insertionPoint);
-				auto loaded = new LoadInst(gep, "", insertionPoint);
-				result = InsertValueInst::Create(result, loaded, {i}, "set." + returnInfo.registerInfo->name, insertionPoint);
+				auto gep = builder.Insert(targetInfo->getRegister(registers, *returnInfo.registerInfo));
+				auto loaded = builder.CreateLoad(gep);
+				result = builder.CreateInsertValue(result, loaded, {i}, "set." + returnInfo.registerInfo->name);
 				i++;
 			}
 			else
@@ -192,9 +250,7 @@ void ArgumentRecovery::updateFunctionBody(Function& oldFunction, Function& newFu
 	assert(!md::isPrototype(oldFunction));
 	
 	LLVMContext& ctx = oldFunction.getContext();
-	auto targetInfo = TargetInfo::getTargetInfo(*oldFunction.getParent());
 	unsigned pointerSize = targetInfo->getPointerSize() * CHAR_BIT;
-	Type* integer = Type::getIntNTy(ctx, pointerSize);
 	Type* integerPtr = Type::getIntNPtrTy(ctx, pointerSize, 1);
 	
 	// move code, delete leftover metadata on oldFunction
@@ -204,16 +260,15 @@ void ArgumentRecovery::updateFunctionBody(Function& oldFunction, Function& newFu
 	// Create a register structure at the beginning of the function and copy arguments to it.
 	Argument* oldArg0 = static_cast<Argument*>(oldFunction.arg_begin());
 	Type* registerStruct = oldArg0->getType()->getPointerElementType();
-	Instruction* insertionPoint = static_cast<Instruction*>(newFunction.begin()->begin());
-	AllocaInst* newRegisters = new AllocaInst(registerStruct, "registers", insertionPoint);
+	IRBuilder<> builder(static_cast<Instruction*>(newFunction.begin()->begin()));
+	AllocaInst* newRegisters = builder.CreateAlloca(registerStruct, nullptr, "registers");
 	md::setRegisterStruct(*newRegisters);
 	oldArg0->replaceAllUsesWith(newRegisters);
 	registerPtr[&newFunction] = newRegisters;
 	
 	// get stack register from new set
-	auto spPtr = targetInfo->getRegister(newRegisters, *targetInfo->getStackPointer());
-	spPtr->insertBefore(insertionPoint);
-	auto spValue = new LoadInst(spPtr, "sp", insertionPoint);
+	auto spPtr = builder.Insert(targetInfo->getRegister(newRegisters, *targetInfo->getStackPointer()));
+	auto spValue = builder.CreateLoad(spPtr, "sp");
 	
 	// Copy each argument to the register structure or to the stack.
 	auto valueIter = ci.begin();
@@ -221,16 +276,14 @@ void ArgumentRecovery::updateFunctionBody(Function& oldFunction, Function& newFu
 	{
 		if (valueIter->type == ValueInformation::IntegerRegister)
 		{
-			auto gep = targetInfo->getRegister(newRegisters, *valueIter->registerInfo);
-			gep->insertBefore(insertionPoint);
-			new StoreInst(&arg, gep, insertionPoint);
+			auto gep = builder.Insert(targetInfo->getRegister(newRegisters, *valueIter->registerInfo));
+			builder.CreateStore(&arg, gep);
 		}
 		else if (valueIter->type == ValueInformation::Stack)
 		{
-			auto offsetConstant = ConstantInt::get(integer, valueIter->frameBaseOffset);
-			auto offset = BinaryOperator::Create(BinaryOperator::Add, spValue, offsetConstant, "", insertionPoint);
-			auto casted = new IntToPtrInst(offset, integerPtr, "", insertionPoint);
-			new StoreInst(&arg, casted, insertionPoint);
+			auto offset = builder.CreateAdd(spValue, builder.getIntN(pointerSize, valueIter->frameBaseOffset));
+			auto casted = builder.CreateIntToPtr(offset, integerPtr);
+			builder.CreateStore(&arg, casted);
 		}
 		else
 		{
@@ -246,8 +299,9 @@ void ArgumentRecovery::updateFunctionBody(Function& oldFunction, Function& newFu
 		{
 			if (auto ret = dyn_cast<ReturnInst>(bb.getTerminator()))
 			{
-				Value* returnValue = createReturnValue(newFunction, ci, ret);
-				ReturnInst::Create(ctx, returnValue, ret);
+				builder.SetInsertPoint(ret);
+				Value* returnValue = createReturnValue(newFunction, ci, builder);
+				builder.CreateRet(returnValue);
 				ret->eraseFromParent();
 			}
 		}
@@ -321,7 +375,13 @@ FunctionType* ArgumentRecovery::createFunctionType(TargetInfo& info, const CallI
 
 CallInst* ArgumentRecovery::createCallSite(TargetInfo& targetInfo, const CallInformation& ci, Value& callee, Value& callerRegisters, Instruction& insertionPoint)
 {
-	LLVMContext& ctx = insertionPoint.getContext();
+	IRBuilder<> builder(&insertionPoint);
+	return createCallSite(targetInfo, ci, callee, callerRegisters, builder);
+}
+
+CallInst* ArgumentRecovery::createCallSite(TargetInfo& targetInfo, const CallInformation& ci, Value& callee, Value& callerRegisters, IRBuilder<>& builder)
+{
+	LLVMContext& ctx = builder.getContext();
 	
 	unsigned pointerSize = targetInfo.getPointerSize() * CHAR_BIT;
 	Type* integer = Type::getIntNTy(ctx, pointerSize);
@@ -329,9 +389,8 @@ CallInst* ArgumentRecovery::createCallSite(TargetInfo& targetInfo, const CallInf
 	
 	// Create GEPs in caller for each value that we need.
 	// Load SP first since we might need it.
-	auto spPtr = targetInfo.getRegister(&callerRegisters, *targetInfo.getStackPointer());
-	spPtr->insertBefore(&insertionPoint);
-	auto spValue = new LoadInst(spPtr, "sp", &insertionPoint);
+	auto spPtr = builder.Insert(targetInfo.getRegister(&callerRegisters, *targetInfo.getStackPointer()));
+	auto spValue = builder.CreateLoad(spPtr, "sp");
 	
 	// Fix parameters
 	ArrayRef<Type*> calleeParameterTypes = cast<FunctionType>(cast<PointerType>(callee.getType())->getElementType())->params();
@@ -341,17 +400,15 @@ CallInst* ArgumentRecovery::createCallSite(TargetInfo& targetInfo, const CallInf
 		Value* argumentValue;
 		if (vi.type == ValueInformation::IntegerRegister)
 		{
-			auto registerPtr = targetInfo.getRegister(&callerRegisters, *vi.registerInfo);
-			registerPtr->insertBefore(&insertionPoint);
-			argumentValue = new LoadInst(registerPtr, vi.registerInfo->name, &insertionPoint);
+			auto registerPtr = builder.Insert(targetInfo.getRegister(&callerRegisters, *vi.registerInfo));
+			argumentValue = builder.CreateLoad(registerPtr, vi.registerInfo->name);
 		}
 		else if (vi.type == ValueInformation::Stack)
 		{
 			// assume one pointer-sized word
-			auto offsetConstant = ConstantInt::get(integer, vi.frameBaseOffset);
-			auto offset = BinaryOperator::Create(BinaryOperator::Add, spValue, offsetConstant, "", &insertionPoint);
-			auto casted = new IntToPtrInst(offset, integerPtr, "", &insertionPoint);
-			argumentValue = new LoadInst(casted, "", &insertionPoint);
+			auto offset = builder.CreateAdd(spValue, ConstantInt::get(integer, vi.frameBaseOffset));
+			auto casted = builder.CreateIntToPtr(offset, integerPtr);
+			argumentValue = builder.CreateLoad(casted);
 		}
 		else
 		{
@@ -365,7 +422,7 @@ CallInst* ArgumentRecovery::createCallSite(TargetInfo& targetInfo, const CallInf
 			{
 				if (intTy->getBitWidth() < pointerSize)
 				{
-					argumentValue = new TruncInst(argumentValue, intTy, "", &insertionPoint);
+					argumentValue = builder.CreateTrunc(argumentValue, intTy);
 				}
 				else
 				{
@@ -374,7 +431,7 @@ CallInst* ArgumentRecovery::createCallSite(TargetInfo& targetInfo, const CallInf
 			}
 			else if (isa<PointerType>(expectedType))
 			{
-				argumentValue = new IntToPtrInst(argumentValue, expectedType, "", &insertionPoint);
+				argumentValue = builder.CreateIntToPtr(argumentValue, expectedType);
 			}
 			else
 			{
@@ -385,18 +442,17 @@ CallInst* ArgumentRecovery::createCallSite(TargetInfo& targetInfo, const CallInf
 		arguments.push_back(argumentValue);
 	}
 	
-	CallInst* newCall = CallInst::Create(&callee, arguments, "", &insertionPoint);
+	CallInst* newCall = builder.CreateCall(&callee, arguments);
 	
 	// Fix return value(s)
 	unsigned i = 0;
-	Instruction* returnInsertionPoint = newCall->getNextNode();
 	for (const auto& vi : ci.returns())
 	{
 		if (vi.type == ValueInformation::IntegerRegister)
 		{
 			Value* registerValue = ci.returns_size() == 1
 				? static_cast<Value*>(newCall)
-				: ExtractValueInst::Create(newCall, {i}, vi.registerInfo->name, returnInsertionPoint);
+				: builder.CreateExtractValue(newCall, {i}, vi.registerInfo->name);
 			
 			if (registerValue->getType() != integer)
 			{
@@ -404,7 +460,7 @@ CallInst* ArgumentRecovery::createCallSite(TargetInfo& targetInfo, const CallInf
 				{
 					if (intTy->getBitWidth() < pointerSize)
 					{
-						registerValue = new ZExtInst(registerValue, integer, "", returnInsertionPoint);
+						registerValue = builder.CreateZExt(registerValue, integer);
 					}
 					else
 					{
@@ -413,7 +469,7 @@ CallInst* ArgumentRecovery::createCallSite(TargetInfo& targetInfo, const CallInf
 				}
 				else if (isa<PointerType>(registerValue->getType()))
 				{
-					registerValue = new PtrToIntInst(registerValue, integer, "", returnInsertionPoint);
+					registerValue = builder.CreatePtrToInt(registerValue, integer);
 				}
 				else
 				{
@@ -421,9 +477,8 @@ CallInst* ArgumentRecovery::createCallSite(TargetInfo& targetInfo, const CallInf
 				}
 			}
 			
-			auto registerPtr = targetInfo.getRegister(&callerRegisters, *vi.registerInfo);
-			registerPtr->insertBefore(returnInsertionPoint);
-			new StoreInst(registerValue, registerPtr, returnInsertionPoint);
+			auto registerPtr = builder.Insert(targetInfo.getRegister(&callerRegisters, *vi.registerInfo));
+			builder.CreateStore(registerValue, registerPtr);
 		}
 		else
 		{
@@ -439,19 +494,20 @@ bool ArgumentRecovery::recoverArguments(Function& fn)
 {
 	ParameterRegistry& paramRegistry = getAnalysis<ParameterRegistry>();
 	
-	unique_ptr<CallInformation> uniqueCallInfo;
 	const CallInformation* callInfo = nullptr;
 	if (md::isPrototype(fn))
 	{
-		// find a call site and consider it canon
-		for (auto user : fn.users())
+		// functions decompiled by another fcd process come with their call information
+		callInfo = paramRegistry.getImportedCallInfo(fn);
+		if (callInfo != nullptr)
 		{
-			if (auto call = dyn_cast<CallInst>(user))
-			{
-				uniqueCallInfo = paramRegistry.analyzeCallSite(CallSite(call));
-				callInfo = uniqueCallInfo.get();
-				break;
-			}
+			++PrototypesTypedFromImports;
+		}
+		else
+		{
+			// find a call site and consider it canon
+			callInfo = paramRegistry.getCallSiteInfo(fn);
+			PrototypesTypedFromCallSites += callInfo != nullptr;
 		}
 	}
 	else
@@ -462,26 +518,25 @@ bool ArgumentRecovery::recoverArguments(Function& fn)
 	if (callInfo != nullptr)
 	{
 		Function& parameterized = createParameterizedFunction(fn, *callInfo);
-		fixCallSites(fn, parameterized, *callInfo);
-		
+		callSiteRewrites[&fn] = {&parameterized, callInfo};
 		if (!md::isPrototype(fn))
 		{
-			updateFunctionBody(fn, parameterized, *callInfo);
+			bodiesToMove.push_back({&fn, {&parameterized, callInfo}});
 			functionsToErase.push_back(&fn);
 		}
+		++FunctionsParameterized;
 		return true;
 	}
+	++FunctionsWithoutCallInfo;
 	return false;
 }
 
 void ArgumentRecovery::replaceStub(Function& stub, Function& target)
 {
 	ParameterRegistry& paramRegistry = getAnalysis<ParameterRegistry>();
-	fixCallSites(stub, target, *paramRegistry.getDefinitionCallInfo(target));
+	callSiteRewrites[&stub] = {&target, paramRegistry.getDefinitionCallInfo(target)};
 	functionsToErase.push_back(&stub);
-	
-	// Now that the function is referenced, it doesn't need a function body to ensure that it will stay around. 
-	target.deleteBody();
+	stubTargets.push_back(&target);
 }
 
 ModulePass* createArgumentRecoveryPass()
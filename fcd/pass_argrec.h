@@ -24,22 +24,39 @@
 
 #include "params_registry.h"
 
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/Analysis/Passes.h>
+#include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
 
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 class ArgumentRecovery final : public llvm::ModulePass
 {
+	struct CallSiteRewrite
+	{
+		llvm::Function* target;
+		const CallInformation* callInfo;
+	};
+	
 	std::unordered_map<const llvm::Function*, llvm::Value*> registerPtr;
 	llvm::SmallVector<llvm::Function*, 10> functionsToErase;
+	std::unique_ptr<TargetInfo> targetInfo;
+	
+	// New signatures are all computed before any call site is rewritten. Call sites are then rewritten in a single
+	// sweep over the module, and function bodies are moved to their parameterized function after that.
+	llvm::DenseMap<const llvm::Function*, CallSiteRewrite> callSiteRewrites;
+	llvm::SmallVector<std::pair<llvm::Function*, CallSiteRewrite>, 16> bodiesToMove;
+	llvm::SmallVector<llvm::Function*, 4> stubTargets;
 	
 	llvm::Value* getRegisterPtr(llvm::Function& fn);
 	
 	llvm::Function& createParameterizedFunction(llvm::Function& base, const CallInformation& ci);
-	void fixCallSites(llvm::Function& base, llvm::Function& newTarget, const CallInformation& ci);
-	llvm::Value* createReturnValue(llvm::Function& function, const CallInformation& ci, llvm::Instruction* insertionPoint);
+	void rewriteCallSites(llvm::Module& module);
+	llvm::Value* createReturnValue(llvm::Function& function, const CallInformation& ci, llvm::IRBuilder<>& builder);
 	void updateFunctionBody(llvm::Function& oldFunction, llvm::Function& newTarget, const CallInformation& ci);
 	bool recoverArguments(llvm::Function& fn);
 	void replaceStub(llvm::Function& fn, llvm::Function& target);
@@ -54,6 +71,7 @@ public:
 	static llvm::FunctionType* createFunctionType(TargetInfo& targetInfo, const CallInformation& ci, llvm::Module& module);
 	static llvm::FunctionType* createFunctionType(TargetInfo& targetInfo, const CallInformation& ci, llvm::Module& module, llvm::SmallVectorImpl<std::string>& parameterNames);
 	static llvm::CallInst* createCallSite(TargetInfo& targetInfo, const CallInformation& ci, llvm::Value& callee, llvm::Value& callerRegisters, llvm::Instruction& insertionPoint);
+	static llvm::CallInst* createCallSite(TargetInfo& targetInfo, const CallInformation& ci, llvm::Value& callee, llvm::Value& callerRegisters, llvm::IRBuilder<>& builder);
 	
 	virtual void getAnalysisUsage(llvm::AnalysisUsage& au) const override;
 	virtual bool runOnModule(llvm::Module& module) override;
@@ -21,6 +21,7 @@
 
 #include "passes.h"
 
+#include <llvm/ADT/Statistic.h>
 #include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/PatternMatch.h>
 
@@ -28,6 +29,11 @@ using namespace llvm;
 using namespace llvm::PatternMatch;
 using namespace std;
 
+#define DEBUG_TYPE "fcd-conditions"
+
+STATISTIC(ConditionsSimplified, "Flag-based conditions replaced with a comparison");
+STATISTIC(ConditionsSimplifiedToInteger, "Flag-based conditions replaced with a comparison extended to an integer");
+
 namespace
 {
 	Value* getOriginalValue(Value& value)
@@ -176,73 +182,13 @@ namespace
 			bool result = false;
 			for (auto& bb : fn)
 			{
-				result |= runOnBasicBlock(bb);
-			}
-			return result;
-		}
-		
-		bool runOnBasicBlock(BasicBlock& bb)
-		{
-			bool result = false;
-			for (auto& inst : bb)
-			{
-				Value* arg0 = nullptr;
-				Value* arg1 = nullptr;
-				if (match(&inst, m_Intrinsic<Intrinsic::usub_with_overflow>(m_Value(arg0), m_Value(arg1))))
-				{
-					for (auto user : inst.users())
-					{
-						if (auto extract = dyn_cast<ExtractValueInst>(user))
-						{
-							auto indices = extract->getIndices();
-							if (indices.size() == 1 && indices[0] == 1)
-							{
-								auto icmp = ICmpInst::Create(Instruction::ICmp, ICmpInst::ICMP_ULT, arg0, arg1, "", &inst);
-								extract->replaceAllUsesWith(icmp);
-							}
-						}
-					}
-				}
-				else
+				for (auto& inst : bb)
 				{
-					Instruction* comparison = nullptr;
-					if (match(&inst, m_Xor(m_Value(arg0), m_Value(arg1))))
-					{
-						if (unique_ptr<Subtraction> sub = matchOverflowSignFlag(*arg0, *arg1))
-						{
-							comparison = ICmpInst::Create(Instruction::ICmp, ICmpInst::ICMP_SLT, sub->left, sub->right, "", &inst);
-						}
-					}
-					else
+					if (Value* simplified = simplifyFlagCondition(inst))
 					{
-						ICmpInst::Predicate pred;
-						if (match(&inst, m_ICmp(pred, m_Value(arg0), m_Value(arg1))))
-						if (pred == ICmpInst::ICMP_EQ || pred == ICmpInst::ICMP_NE)
-						if (unique_ptr<Subtraction> sub = matchOverflowSignFlag(*arg0, *arg1))
-						{
-							CmpInst::Predicate comparisonPred;
-							if (pred == ICmpInst::ICMP_NE)
-							{
-								comparisonPred = ICmpInst::ICMP_SLT;
-							}
-							else if (pred == ICmpInst::ICMP_EQ)
-							{
-								comparisonPred = ICmpInst::ICMP_SGE;
-							}
-							else
-							{
-								continue;
-							}
-							comparison = ICmpInst::Create(Instruction::ICmp, comparisonPred, sub->left, sub->right, "", &inst);
-						}
-					}
-					
-					if (comparison != nullptr)
-					{
-						Instruction* resultInst = inst.getType() != comparison->getType()
-							? (Instruction*)CastInst::Create(CastInst::ZExt, comparison, inst.getType(), "", &inst)
-							: (Instruction*)comparison;
-						inst.replaceAllUsesWith(resultInst);
+						inst.replaceAllUsesWith(simplified);
+						result = true;
+						++(isa<CastInst>(simplified) ? ConditionsSimplifiedToInteger : ConditionsSimplified);
 					}
 				}
 			}
@@ -255,6 +201,51 @@ namespace
 	RegisterPass<ConditionSimplification> condSimp("simplifyconditions", "Simplify flag-based conditionals");
 }
 
+Value* simplifyFlagCondition(Instruction& inst)
+{
+	Value* arg0 = nullptr;
+	Value* arg1 = nullptr;
+	if (auto extract = dyn_cast<ExtractValueInst>(&inst))
+	{
+		auto indices = extract->getIndices();
+		if (indices.size() == 1 && indices[0] == 1)
+		if (match(extract->getAggregateOperand(), m_Intrinsic<Intrinsic::usub_with_overflow>(m_Value(arg0), m_Value(arg1))))
+		{
+			return ICmpInst::Create(Instruction::ICmp, ICmpInst::ICMP_ULT, arg0, arg1, "", &inst);
+		}
+		return nullptr;
+	}
+	
+	Instruction* comparison = nullptr;
+	if (match(&inst, m_Xor(m_Value(arg0), m_Value(arg1))))
+	{
+		if (unique_ptr<Subtraction> sub = matchOverflowSignFlag(*arg0, *arg1))
+		{
+			comparison = ICmpInst::Create(Instruction::ICmp, ICmpInst::ICMP_SLT, sub->left, sub->right, "", &inst);
+		}
+	}
+	else
+	{
+		ICmpInst::Predicate pred;
+		if (match(&inst, m_ICmp(pred, m_Value(arg0), m_Value(arg1))))
+		if (pred == ICmpInst::ICMP_EQ || pred == ICmpInst::ICMP_NE)
+		if (unique_ptr<Subtraction> sub = matchOverflowSignFlag(*arg0, *arg1))
+		{
+			CmpInst::Predicate comparisonPred = pred == ICmpInst::ICMP_NE ? ICmpInst::ICMP_SLT : ICmpInst::ICMP_SGE;
+			comparison = ICmpInst::Create(Instruction::ICmp, comparisonPred, sub->left, sub->right, "", &inst);
+		}
+	}
+	
+	if (comparison == nullptr)
+	{
+		return nullptr;
+	}
+	
+	return inst.getType() != comparison->getType()
+		? CastInst::Create(CastInst::ZExt, comparison, inst.getType(), "", &inst)
+		: comparison;
+}
+
 FunctionPass* createConditionSimplificationPass()
 {
 	return new ConditionSimplification;
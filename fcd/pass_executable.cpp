@@ -21,6 +21,9 @@
 
 #include "pass_executable.h"
 
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+
 using namespace llvm;
 using namespace std;
 
@@ -30,3 +33,66 @@ namespace
 }
 
 char ExecutableWrapper::ID = 0;
+
+bool ExecutableWrapper::getConstantAddress(const Value& pointer, uint64_t& address)
+{
+	const Value* integer = nullptr;
+	if (auto cast = dyn_cast<IntToPtrInst>(&pointer))
+	{
+		integer = cast->getOperand(0);
+	}
+	else if (auto expression = dyn_cast<ConstantExpr>(&pointer))
+	{
+		if (expression->getOpcode() == Instruction::IntToPtr)
+		{
+			integer = expression->getOperand(0);
+		}
+	}
+	
+	if (auto constant = dyn_cast_or_null<ConstantInt>(integer))
+	if (constant->getValue().getActiveBits() <= 64)
+	{
+		address = constant->getLimitedValue();
+		return true;
+	}
+	return false;
+}
+
+bool ExecutableWrapper::isReadOnly(uint64_t address, uint64_t size) const
+{
+	SegmentInfo segment;
+	if (executable != nullptr && executable->getSegment(address, segment))
+	{
+		return !segment.writable && size <= segment.end - address;
+	}
+	return false;
+}
+
+Constant* ExecutableWrapper::readConstant(uint64_t address, Type& type, const DataLayout& dl) const
+{
+	uint64_t size = dl.getTypeStoreSize(&type);
+	if (!isReadOnly(address, size))
+	{
+		return nullptr;
+	}
+	
+	const uint8_t* bytes = executable->map(address);
+	if (auto intType = dyn_cast<IntegerType>(&type))
+	{
+		APInt value(intType->getBitWidth(), 0);
+		for (uint64_t i = 0; i < size; ++i)
+		{
+			uint64_t byteIndex = dl.isLittleEndian() ? i : size - i - 1;
+			APInt byte(intType->getBitWidth(), bytes[byteIndex]);
+			value |= byte.shl(static_cast<unsigned>(i * 8));
+		}
+		return ConstantInt::get(intType, value);
+	}
+	
+	auto arrayType = dyn_cast<ArrayType>(&type);
+	if (arrayType != nullptr && arrayType->getElementType()->isIntegerTy(8))
+	{
+		return ConstantDataArray::get(type.getContext(), makeArrayRef(bytes, size));
+	}
+	return nullptr;
+}
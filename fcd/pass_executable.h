@@ -24,6 +24,9 @@
 
 #include "executable.h"
 
+#include <llvm/IR/Constant.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Type.h>
 #include <llvm/Pass.h>
 
 class ExecutableWrapper : public llvm::ImmutablePass
@@ -39,6 +42,16 @@ public:
 	}
 	
 	Executable* getExecutable() { return executable; }
+	
+	// Matches pointers of the form inttoptr(constant), as the lifter creates them for program memory accesses.
+	static bool getConstantAddress(const llvm::Value& pointer, uint64_t& address);
+	
+	// Whether [address, address + size) is mapped inside a single segment that the program can't write to.
+	bool isReadOnly(uint64_t address, uint64_t size) const;
+	
+	// The value of type that is stored at address, if that memory is read-only. Integers are read with the byte
+	// order of the data layout; arrays of bytes are copied as they are. Returns null for anything else.
+	llvm::Constant* readConstant(uint64_t address, llvm::Type& type, const llvm::DataLayout& dl) const;
 };
 
 namespace llvm
@@ -25,6 +25,7 @@
 #include "pass_argrec.h"
 #include "passes.h"
 
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/Function.h>
@@ -70,8 +71,9 @@ namespace
 		{
 			bool changed = false;
 			
-			// TODO: this only merely makes fcd not fail in the presence of indirect calls, it doesn't actually do
-			// meaningful analysis.
+			// TODO: this only merely makes fcd not fail in the presence of indirect jumps, it doesn't actually do
+			// meaningful analysis. (Jump tables that could be recognized were already lowered to switches when the
+			// function was lifted.)
 			
 			auto& module = *callIntrin.getParent();
 			auto& context = module.getContext();
@@ -101,10 +103,39 @@ namespace
 			ParameterRegistry& params = getAnalysis<ParameterRegistry>();
 			auto target = TargetInfo::getTargetInfo(*callIntrin.getParent());
 			
+			// Destinations can become constant after the lifter ran, for instance when they are loaded from read-only
+			// memory. Calls to known functions become the same direct calls that the lifter creates.
+			DenseMap<uint64_t, Function*> functionsByAddress;
+			for (Function& fn : *callIntrin.getParent())
+			{
+				if (auto address = md::getVirtualAddress(fn))
+				{
+					functionsByAddress[address->getLimitedValue()] = &fn;
+				}
+			}
+			
 			// copy the list as we will replace instructions
 			for (Value* user : vector<Value*>(callIntrin.user_begin(), callIntrin.user_end()))
 			{
-				if (auto call = dyn_cast<CallInst>(user))
+				auto call = dyn_cast<CallInst>(user);
+				if (call == nullptr)
+				{
+					continue;
+				}
+				
+				if (auto destination = dyn_cast<ConstantInt>(call->getOperand(2)))
+				{
+					auto iter = functionsByAddress.find(destination->getLimitedValue());
+					if (iter != functionsByAddress.end())
+					{
+						CallInst* result = CallInst::Create(iter->second, { call->getOperand(1) }, "", call);
+						call->replaceAllUsesWith(result);
+						call->eraseFromParent();
+						changed = true;
+						continue;
+					}
+				}
+				
 				if (auto info = params.analyzeCallSite(CallSite(call)))
 				{
 					Function& parent = *call->getParent()->getParent();
@@ -116,6 +147,7 @@ namespace
 					CallInst* result = ArgumentRecovery::createCallSite(*target, *info, *callable, *registers, *call);
 					result->takeName(call);
 					call->eraseFromParent();
+					changed = true;
 				}
 			}
 			
@@ -0,0 +1,112 @@
+//
+// pass_flagcleanup.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "passes.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/Transforms/Utils/Local.h>
+
+#include <algorithm>
+
+using namespace llvm;
+using namespace std;
+
+#define DEBUG_TYPE "fcd-flagcleanup"
+
+STATISTIC(FlagConditionsSimplified, "Flag-based conditions turned into comparisons");
+STATISTIC(SignExtensionsSimplified, "Sign extension sequences turned into sext");
+
+namespace
+{
+	// simplifyconditions and signext used to run back-to-back, each one scanning the whole function and leaving the
+	// flag computations that it replaced for instcombine to delete. This pass applies both rewrites from a single
+	// worklist: the instructions that it replaces are deleted as it goes, along with whatever flag arithmetic only
+	// existed to feed them, and the users of a replaced value are visited again in case they now match.
+	struct FlagCleanup final : public FunctionPass
+	{
+		static char ID;
+		
+		FlagCleanup() : FunctionPass(ID)
+		{
+		}
+		
+		virtual bool runOnFunction(Function& fn) override
+		{
+			SmallVector<WeakVH, 64> worklist;
+			for (BasicBlock& bb : fn)
+			{
+				for (Instruction& inst : bb)
+				{
+					worklist.push_back(&inst);
+				}
+			}
+			
+			// Visit instructions in program order, so that operands are simplified before their users.
+			reverse(worklist.begin(), worklist.end());
+			
+			bool changed = false;
+			while (!worklist.empty())
+			{
+				Value* value = worklist.pop_back_val();
+				auto inst = dyn_cast_or_null<Instruction>(value);
+				if (inst == nullptr)
+				{
+					continue;
+				}
+				
+				Value* replacement = simplifyFlagCondition(*inst);
+				if (replacement != nullptr)
+				{
+					++FlagConditionsSimplified;
+				}
+				else if ((replacement = simplifySignExtension(*inst)))
+				{
+					++SignExtensionsSimplified;
+				}
+				else
+				{
+					continue;
+				}
+				
+				for (User* user : inst->users())
+				{
+					worklist.push_back(user);
+				}
+				inst->replaceAllUsesWith(replacement);
+				RecursivelyDeleteTriviallyDeadInstructions(inst);
+				changed = true;
+			}
+			return changed;
+		}
+	};
+	
+	char FlagCleanup::ID = 0;
+	
+	RegisterPass<FlagCleanup> flagCleanup("flagcleanup", "Simplify flag-based conditionals and sign extensions");
+}
+
+FunctionPass* createFlagCleanupPass()
+{
+	return new FlagCleanup;
+}
@@ -0,0 +1,242 @@
+//
+// pass_globals.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "metadata.h"
+#include "pass_executable.h"
+#include "passes.h"
+
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+#define DEBUG_TYPE "fcd-globals"
+
+STATISTIC(GlobalsRecovered, "Global variables created for program memory");
+STATISTIC(ConstantGlobalsRecovered, "Global variables created with an initializer from the executable");
+STATISTIC(StringGlobalsRecovered, "Global variables created for string literals");
+STATISTIC(AccessesRewritten, "Program memory accesses rewritten to use a global variable");
+
+namespace
+{
+	struct MemoryAccess
+	{
+		uint64_t address;
+		uint64_t size;
+		Instruction* inst;
+		Type* type;
+	};
+	
+	// Program memory that is accessed at constant addresses becomes a global variable. Accesses that overlap are
+	// clustered into the same global, since different globals are assumed never to alias. A cluster that lives in a
+	// read-only segment and that is never stored to gets its initializer from the executable, so that loads from it
+	// can be folded to constants. Clusters that start in a string literal cover the rest of the literal, up to and
+	// including its NUL.
+	struct RecoverGlobals final : public ModulePass
+	{
+		static char ID;
+		shared_ptr<const StringLiteralIndex> literals;
+		
+		RecoverGlobals() : ModulePass(ID)
+		{
+		}
+		
+		virtual const char* getPassName() const override
+		{
+			return "Recover Global Variables";
+		}
+		
+		virtual void getAnalysisUsage(AnalysisUsage& au) const override
+		{
+			au.addRequired<ExecutableWrapper>();
+			ModulePass::getAnalysisUsage(au);
+		}
+		
+		virtual bool runOnModule(Module& module) override
+		{
+			ExecutableWrapper& wrapper = getAnalysis<ExecutableWrapper>();
+			Executable* executable = wrapper.getExecutable();
+			if (executable == nullptr)
+			{
+				return false;
+			}
+			
+			const DataLayout& dl = module.getDataLayout();
+			vector<MemoryAccess> accesses;
+			for (Function& fn : module)
+			{
+				for (Instruction& inst : instructions(fn))
+				{
+					if (!md::isProgramMemory(inst))
+					{
+						continue;
+					}
+					
+					Value* pointer;
+					Type* type;
+					if (auto load = dyn_cast<LoadInst>(&inst))
+					{
+						pointer = load->getPointerOperand();
+						type = load->getType();
+					}
+					else if (auto store = dyn_cast<StoreInst>(&inst))
+					{
+						pointer = store->getPointerOperand();
+						type = store->getValueOperand()->getType();
+					}
+					else
+					{
+						continue;
+					}
+					
+					uint64_t address;
+					if (ExecutableWrapper::getConstantAddress(*pointer, address) && executable->map(address) != nullptr)
+					{
+						accesses.push_back({ address, dl.getTypeStoreSize(type), &inst, type });
+					}
+				}
+			}
+			
+			if (accesses.size() == 0)
+			{
+				return false;
+			}
+			
+			stable_sort(accesses.begin(), accesses.end(), [](const MemoryAccess& a, const MemoryAccess& b)
+			{
+				return a.address < b.address;
+			});
+			
+			literals = executable->getStringLiterals();
+			auto clusterBegin = accesses.begin();
+			while (clusterBegin != accesses.end())
+			{
+				uint64_t clusterEnd = clusterBegin->address + clusterBegin->size;
+				if (auto literal = literals->find(clusterBegin->address))
+				if (wrapper.isReadOnly(clusterBegin->address, literal->size() + 1))
+				{
+					clusterEnd = max(clusterEnd, clusterBegin->address + literal->size() + 1);
+				}
+				auto clusterIter = clusterBegin + 1;
+				while (clusterIter != accesses.end() && clusterIter->address < clusterEnd)
+				{
+					clusterEnd = max(clusterEnd, clusterIter->address + clusterIter->size);
+					++clusterIter;
+				}
+				
+				recoverGlobal(module, wrapper, makeArrayRef(&*clusterBegin, clusterIter - clusterBegin), clusterEnd);
+				clusterBegin = clusterIter;
+			}
+			return true;
+		}
+		
+		void recoverGlobal(Module& module, const ExecutableWrapper& wrapper, ArrayRef<MemoryAccess> cluster, uint64_t end)
+		{
+			LLVMContext& ctx = module.getContext();
+			const DataLayout& dl = module.getDataLayout();
+			uint64_t begin = cluster.front().address;
+			uint64_t size = end - begin;
+			
+			// Clusters accessed through a single integer type get that type; anything else is an array of bytes.
+			Type* type = cluster.front().type;
+			bool isStored = false;
+			for (const MemoryAccess& access : cluster)
+			{
+				if (access.address != begin || access.type != type)
+				{
+					type = nullptr;
+				}
+				isStored |= isa<StoreInst>(access.inst);
+			}
+			if (type == nullptr || !type->isIntegerTy() || dl.getTypeStoreSize(type) != size)
+			{
+				type = ArrayType::get(Type::getInt8Ty(ctx), size);
+			}
+			
+			// Without a read-only segment that holds the whole cluster, nothing about the contents can be assumed:
+			// the program (or something else) could have written anything there before.
+			Constant* initializer = isStored ? nullptr : wrapper.readConstant(begin, *type, dl);
+			
+			bool isString = initializer != nullptr && literals->find(begin);
+			char name[] = "data_0000000000000000";
+			snprintf(name, sizeof name, isString ? "str_%" PRIx64 : "data_%" PRIx64, begin);
+			auto linkage = initializer == nullptr ? GlobalValue::ExternalLinkage : GlobalValue::InternalLinkage;
+			auto global = new GlobalVariable(module, type, initializer != nullptr, linkage, initializer, name);
+			global->setAlignment(1);
+			
+			GlobalsRecovered++;
+			if (initializer != nullptr)
+			{
+				ConstantGlobalsRecovered++;
+			}
+			if (isString)
+			{
+				StringGlobalsRecovered++;
+			}
+			
+			Type* bytePointerType = Type::getInt8PtrTy(ctx);
+			Type* offsetType = Type::getInt64Ty(ctx);
+			Constant* bytes = ConstantExpr::getPointerCast(global, bytePointerType);
+			for (const MemoryAccess& access : cluster)
+			{
+				unsigned operandIndex = isa<LoadInst>(access.inst)
+					? LoadInst::getPointerOperandIndex()
+					: StoreInst::getPointerOperandIndex();
+				Value* oldPointer = access.inst->getOperand(operandIndex);
+				
+				Constant* newPointer = bytes;
+				if (access.address != begin)
+				{
+					Constant* offset = ConstantInt::get(offsetType, access.address - begin);
+					newPointer = ConstantExpr::getInBoundsGetElementPtr(Type::getInt8Ty(ctx), bytes, offset);
+				}
+				newPointer = ConstantExpr::getPointerCast(newPointer, oldPointer->getType());
+				access.inst->setOperand(operandIndex, newPointer);
+				
+				if (auto cast = dyn_cast<IntToPtrInst>(oldPointer))
+				if (cast->use_empty())
+				{
+					cast->eraseFromParent();
+				}
+				AccessesRewritten++;
+			}
+		}
+	};
+	
+	char RecoverGlobals::ID = 0;
+	RegisterPass<RecoverGlobals> recoverGlobals("recoverglobals", "Recover global variables from program memory");
+}
+
+ModulePass* createRecoverGlobalsPass()
+{
+	return new RecoverGlobals;
+}
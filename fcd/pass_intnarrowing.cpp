@@ -21,6 +21,7 @@
 
 #include "passes.h"
 
+#include <llvm/ADT/Statistic.h>
 #include <llvm/Analysis/DemandedBits.h>
 #include <llvm/IR/Constants.h>
 
@@ -30,6 +31,13 @@
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "fcd-intnarrowing"
+
+STATISTIC(OperationsNarrowed, "Integer operations recreated with fewer bits");
+STATISTIC(TruncationsInserted, "Values truncated because their operation couldn't be narrowed");
+STATISTIC(ValuesWidenedBack, "Values whose uses were replaced with their narrowed value, extended");
+STATISTIC(ValuesNarrowedToSeveralSizes, "Values left in place because they were narrowed to more than one size");
+
 namespace
 {
 	bool isMod2Equivalent(BinaryOperator::BinaryOps operation)
@@ -88,6 +96,7 @@ namespace
 					Value* left = narrowDown(binOp->getOperand(0), size);
 					Value* right = narrowDown(binOp->getOperand(1), size);
 					value = BinaryOperator::Create(binOp->getOpcode(), left, right, "", binOp);
+					++OperationsNarrowed;
 				}
 				else
 				{
@@ -107,6 +116,7 @@ namespace
 						location = static_cast<Instruction*>(currentFunction->getEntryBlock().getFirstInsertionPt());
 					}
 					value = CastInst::Create(Instruction::Trunc, thatValue, truncatedType, "", location);
+					++TruncationsInserted;
 				}
 			}
 			return value;
@@ -168,6 +178,11 @@ namespace
 								use.set(enlarged);
 							}
 						}
+						++ValuesWidenedBack;
+					}
+					else
+					{
+						++ValuesNarrowedToSeveralSizes;
 					}
 				}
 			}
@@ -23,10 +23,11 @@
 #include "metadata.h"
 #include "passes.h"
 
+#include <llvm/ADT/Statistic.h>
 #include <llvm/IR/PatternMatch.h>
 
+#include <algorithm>
 #include <deque>
-#include <map>
 #include <unordered_map>
 #include <vector>
 
@@ -34,6 +35,14 @@ using namespace llvm;
 using namespace llvm::PatternMatch;
 using namespace std;
 
+#define DEBUG_TYPE "fcd-locals"
+
+STATISTIC(StackFramesRecovered, "Functions given a stack frame variable");
+STATISTIC(StackObjectsRecovered, "Stack offsets rewritten as pointers into a stack frame");
+STATISTIC(StackFramesNotRepresented, "Stack frames whose objects couldn't be laid out as a structure");
+STATISTIC(StackArraysNotBounded, "Variable stack offsets left alone because their array couldn't be bounded");
+STATISTIC(StackArgumentsRemoved, "Stack pointer arguments removed once they had no use");
+
 namespace
 {
 	template<typename T, size_t N>
@@ -49,6 +58,7 @@ namespace
 		{
 			Object,
 			Structure,
+			Array,
 		};
 		
 	private:
@@ -255,6 +265,72 @@ namespace
 		}
 	};
 	
+	class ArrayStackObject : public StackObject
+	{
+	public:
+		struct ArrayElement
+		{
+			// Index of the element in the array (a constant or the variable that the stride multiplies).
+			Value* index;
+			unique_ptr<StackObject> object;
+			
+			ArrayElement(Value* index, unique_ptr<StackObject> object)
+			: index(index), object(move(object))
+			{
+			}
+			
+			void print(raw_ostream& os) const
+			{
+				index->printAsOperand(os);
+				os << ": ";
+				object->print(os);
+			}
+		};
+		
+	private:
+		uint64_t stride;
+		uint64_t count;
+		vector<ArrayElement> elements;
+		
+	public:
+		static bool classof(const StackObject* obj)
+		{
+			return obj->getType() == Array;
+		}
+		
+		ArrayStackObject(uint64_t stride, uint64_t count, StackObject* parent = nullptr)
+		: StackObject(Array, parent), stride(stride), count(count)
+		{
+		}
+		
+		uint64_t getStride() const { return stride; }
+		uint64_t getCount() const { return count; }
+		
+		auto begin() const { return elements.begin(); }
+		auto end() const { return elements.end(); }
+		
+		void insert(Value* index, unique_ptr<StackObject> object)
+		{
+			elements.emplace_back(index, move(object));
+		}
+		
+		virtual void print(raw_ostream& os) const override
+		{
+			os << '[' << count << " x " << stride << " bytes: ";
+			auto iter = begin();
+			if (iter != end())
+			{
+				iter->print(os);
+				for (++iter; iter != end(); ++iter)
+				{
+					os << ", ";
+					iter->print(os);
+				}
+			}
+			os << ']';
+		}
+	};
+	
 	class OverlappingTypedAccesses
 	{
 	public:
@@ -714,6 +790,43 @@ namespace
 			return true;
 		}
 		
+		bool representObject(const ArrayStackObject* array)
+		{
+			// Elements that are accessed the same way give the array its element type. Otherwise, elements are
+			// byte arrays of the stride's size, and element pointers are casted to the type of the element object.
+			Type* elementType = nullptr;
+			bool uniformElements = true;
+			for (const auto& element : *array)
+			{
+				if (!representObject(element.object.get()))
+				{
+					return false;
+				}
+				
+				Type* type = typeMap[element.object.get()];
+				uniformElements &= elementType == nullptr || elementType == type;
+				elementType = type;
+			}
+			
+			if (elementType == nullptr || !uniformElements || !elementType->isSized() || dl.getTypeAllocSize(elementType) != array->getStride())
+			{
+				elementType = ArrayType::get(Type::getInt8Ty(ctx), array->getStride());
+			}
+			
+			GepLink* arrayLink = linkFor(array);
+			for (const auto& element : *array)
+			{
+				GepLink* elementLink = linkFor(element.object.get());
+				elementLink->setIndex(element.index, typeMap[element.object.get()]);
+				elementLink->setParent(arrayLink);
+			}
+			
+			auto& resultOut = typeMap[array];
+			assert(resultOut == nullptr);
+			resultOut = ArrayType::get(elementType, array->getCount());
+			return true;
+		}
+		
 		bool representObject(StackObject* object)
 		{
 			if (auto obj = dyn_cast<ObjectStackObject>(object))
@@ -724,6 +837,10 @@ namespace
 			{
 				return representObject(structure);
 			}
+			else if (auto array = dyn_cast<ArrayStackObject>(object))
+			{
+				return representObject(array);
+			}
 			else
 			{
 				return false;
@@ -868,7 +985,71 @@ namespace
 			return static_cast<Argument*>(arg);
 		}
 		
-		bool analyzeObject(Value& base, bool& hasCastInst, map<int64_t, Instruction*>& constantOffsets, map<int64_t, Instruction*>& variableOffsetStrides)
+		struct VariableOffset
+		{
+			Value* index;
+			uint64_t stride;
+			Instruction* elementBase;
+		};
+		
+		// Offsets found by analyzeObject, reused across calls. readObject recurses while it goes through the offsets
+		// of an object, so each call owns the entries that were appended since it started, and removes them when it
+		// returns. Constant offsets are sorted by offset.
+		SmallVector<pair<int64_t, Instruction*>, 32> constantOffsets;
+		SmallVector<VariableOffset, 8> variableOffsets;
+		
+		struct OffsetScope
+		{
+			IdentifyLocals& pass;
+			size_t constantBegin;
+			size_t variableBegin;
+			
+			OffsetScope(IdentifyLocals& pass)
+			: pass(pass), constantBegin(pass.constantOffsets.size()), variableBegin(pass.variableOffsets.size())
+			{
+			}
+			
+			~OffsetScope()
+			{
+				pass.constantOffsets.resize(constantBegin);
+				pass.variableOffsets.resize(variableBegin);
+			}
+		};
+		
+		// The stack offset that lifting attached to every load and store through address, if they all agree.
+		static bool getLiftedStackOffset(Instruction& address, int64_t& offset)
+		{
+			bool found = false;
+			for (User* user : address.users())
+			{
+				auto cast = dyn_cast<CastInst>(user);
+				if (cast == nullptr || cast->getOpcode() != CastInst::IntToPtr)
+				{
+					return false;
+				}
+				
+				for (User* castUser : cast->users())
+				{
+					auto load = dyn_cast<LoadInst>(castUser);
+					auto store = dyn_cast<StoreInst>(castUser);
+					Instruction* access = load != nullptr ? static_cast<Instruction*>(load) : store;
+					int64_t accessOffset;
+					if (access == nullptr || (store != nullptr && store->getPointerOperand() != cast) || !md::getStackOffset(*access, accessOffset))
+					{
+						return false;
+					}
+					if (found && accessOffset != offset)
+					{
+						return false;
+					}
+					offset = accessOffset;
+					found = true;
+				}
+			}
+			return found;
+		}
+		
+		bool analyzeObject(Value& base, bool& hasCastInst)
 		{
 			hasCastInst = false;
 			for (User* user : base.users())
@@ -881,15 +1062,36 @@ namespace
 					}
 					
 					Value* right = binOp->getOperand(binOp->getOperand(0) == &base ? 1 : 0);
+					int64_t liftedOffset;
 					if (auto constant = dyn_cast<ConstantInt>(right))
 					{
-						constantOffsets.insert({constant->getLimitedValue(), binOp});
+						constantOffsets.push_back({constant->getLimitedValue(), binOp});
+					}
+					else if (isa<Argument>(base) && getLiftedStackOffset(*binOp, liftedOffset))
+					{
+						// Offsets from the stack pointer argument itself can be known at lift time even when they
+						// were computed through values that optimizations couldn't fold.
+						constantOffsets.push_back({liftedOffset, binOp});
 					}
 					else
 					{
-						// non-constant offset
-						// IMPLEMENT ME
-						return false;
+						// Variable offsets are usually an index scaled by the size of array elements.
+						Value* index = nullptr;
+						ConstantInt* scale = nullptr;
+						uint64_t stride = 1;
+						if (match(right, m_Mul(m_Value(index), m_ConstantInt(scale))))
+						{
+							stride = scale->getLimitedValue();
+						}
+						else if (match(right, m_Shl(m_Value(index), m_ConstantInt(scale))) && scale->getLimitedValue() < 32)
+						{
+							stride = uint64_t(1) << scale->getLimitedValue();
+						}
+						else
+						{
+							index = right;
+						}
+						variableOffsets.push_back({index, stride, binOp});
 					}
 				}
 				else if (auto castInst = dyn_cast<CastInst>(user))
@@ -900,7 +1102,25 @@ namespace
 			return true;
 		}
 		
-		unique_ptr<StackObject> readObject(Value& base, StackObject* parent)
+		// Sorts the constant offsets that were appended since index begin, keeping the first instruction found for any
+		// given offset.
+		void sortConstantOffsets(size_t begin)
+		{
+			auto first = constantOffsets.begin() + begin;
+			auto byOffset = [](const pair<int64_t, Instruction*>& a, const pair<int64_t, Instruction*>& b)
+			{
+				return a.first < b.first;
+			};
+			auto sameOffset = [](const pair<int64_t, Instruction*>& a, const pair<int64_t, Instruction*>& b)
+			{
+				return a.first == b.first;
+			};
+			stable_sort(first, constantOffsets.end(), byOffset);
+			constantOffsets.erase(unique(first, constantOffsets.end(), sameOffset), constantOffsets.end());
+		}
+		
+		// extent is how many bytes the object can span from its base, or 0 if that isn't known.
+		unique_ptr<StackObject> readObject(Value& base, StackObject* parent, int64_t extent)
 		{
 			//
 			// readObject accepts a "base pointer". A base pointer is an SSA value that modifies the stack pointer.
@@ -929,25 +1149,25 @@ namespace
 			// practice, we only generate arrays and struct from this function.
 			//
 			
+			OffsetScope scope(*this);
 			bool hasCastInst = false;
-			map<int64_t, Instruction*> constantOffsets;
-			map<int64_t, Instruction*> variableOffsetsStrides;
-			if (!analyzeObject(base, hasCastInst, constantOffsets, variableOffsetsStrides))
+			if (!analyzeObject(base, hasCastInst))
 			{
 				return nullptr;
 			}
 			
-			if (variableOffsetsStrides.size() > 0)
+			sortConstantOffsets(scope.constantBegin);
+			size_t constantEnd = constantOffsets.size();
+			size_t variableEnd = variableOffsets.size();
+			if (variableEnd != scope.variableBegin)
 			{
-				// This should be an array.
-				// (IMPLEMENT ME)
-				return nullptr;
+				return readArray(base, parent, extent, scope, constantEnd, variableEnd, hasCastInst);
 			}
-			else if (constantOffsets.size() > 0)
+			else if (constantEnd != scope.constantBegin)
 			{
 				// Since this runs after argument recovery, offsets should uniformly be either positive or negative.
-				auto front = constantOffsets.begin()->first;
-				auto back = constantOffsets.rbegin()->first;
+				auto front = constantOffsets[scope.constantBegin].first;
+				auto back = constantOffsets[constantEnd - 1].first;
 				assert(front == 0 || back == 0 || signbit(front) == signbit(back));
 				
 				unique_ptr<StructureStackObject> structure(new StructureStackObject(parent));
@@ -956,9 +1176,21 @@ namespace
 					structure->insert(0, new ObjectStackObject(base, *structure));
 				}
 				
-				for (const auto& pair : constantOffsets)
+				for (size_t i = scope.constantBegin; i < constantEnd; ++i)
 				{
-					if (auto type = readObject(*pair.second, structure.get()))
+					// Copy the entry: reading the field appends to constantOffsets.
+					auto pair = constantOffsets[i];
+					int64_t fieldExtent = 0;
+					if (i + 1 < constantEnd)
+					{
+						fieldExtent = constantOffsets[i + 1].first - pair.first;
+					}
+					else if (extent > pair.first)
+					{
+						fieldExtent = extent - pair.first;
+					}
+					
+					if (auto type = readObject(*pair.second, structure.get(), fieldExtent))
 					{
 						int64_t offset = pair.first - front;
 						structure->insert(offset, move(type));
@@ -972,6 +1204,57 @@ namespace
 			}
 		}
 		
+		unique_ptr<StackObject> readArray(Value& base, StackObject* parent, int64_t extent, const OffsetScope& scope, size_t constantEnd, size_t variableEnd, bool hasCastInst)
+		{
+			// The element count of an array comes from how far the next object begins. Arrays that can't be bounded
+			// are left alone.
+			uint64_t stride = variableOffsets[scope.variableBegin].stride;
+			if (stride == 0 || extent <= 0 || static_cast<uint64_t>(extent) < stride)
+			{
+				++StackArraysNotBounded;
+				return nullptr;
+			}
+			
+			uint64_t count = static_cast<uint64_t>(extent) / stride;
+			Type* i64 = Type::getInt64Ty(base.getContext());
+			unique_ptr<ArrayStackObject> array(new ArrayStackObject(stride, count, parent));
+			if (hasCastInst)
+			{
+				array->insert(ConstantInt::get(i64, 0), unique_ptr<StackObject>(new ObjectStackObject(base, *array)));
+			}
+			
+			for (size_t i = scope.constantBegin; i < constantEnd; ++i)
+			{
+				auto pair = constantOffsets[i];
+				if (pair.first < 0 || pair.first % stride != 0 || pair.first / stride >= count)
+				{
+					++StackArraysNotBounded;
+					return nullptr;
+				}
+				
+				if (auto element = readObject(*pair.second, array.get(), stride))
+				{
+					array->insert(ConstantInt::get(i64, pair.first / stride), move(element));
+				}
+			}
+			
+			for (size_t i = scope.variableBegin; i < variableEnd; ++i)
+			{
+				VariableOffset offset = variableOffsets[i];
+				if (offset.stride != stride || !offset.index->getType()->isIntegerTy(64))
+				{
+					++StackArraysNotBounded;
+					return nullptr;
+				}
+				
+				if (auto element = readObject(*offset.elementBase, array.get(), stride))
+				{
+					array->insert(offset.index, move(element));
+				}
+			}
+			return move(array);
+		}
+		
 		virtual bool doInitialization(Module& m) override
 		{
 			dl = &m.getDataLayout();
@@ -1077,14 +1360,25 @@ namespace
 					
 					fn.eraseFromParent();
 					changed = true;
+					++StackArgumentsRemoved;
 				}
 			}
 		}
 		
 		void tryToCreateStackFrame(Function& fn)
 		{
-			if (Argument* stackPointer = getStackPointer(fn))
-			if (auto root = readObject(*stackPointer, nullptr))
+			Argument* stackPointer = getStackPointer(fn);
+			if (stackPointer == nullptr)
+			{
+				return;
+			}
+			
+			auto root = readObject(*stackPointer, nullptr, 0);
+			if (root == nullptr)
+			{
+				return;
+			}
+			
 			if (auto llvmFrame = LlvmStackFrame::representObject(fn.getContext(), *dl, cast<StructureStackObject>(*root)))
 			{
 				auto allocaInsert = static_cast<Instruction*>(fn.getEntryBlock().getFirstInsertionPt());
@@ -1104,8 +1398,14 @@ namespace
 						inst->dropAllReferences();
 						inst->eraseFromParent();
 					}
+					++StackObjectsRecovered;
 				}
 				changed = true;
+				++StackFramesRecovered;
+			}
+			else
+			{
+				++StackFramesNotRepresented;
 			}
 		}
 	};
@@ -0,0 +1,218 @@
+//
+// pass_memeffects.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "passes.h"
+
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/CallSite.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+
+using namespace llvm;
+using namespace std;
+
+#define DEBUG_TYPE "fcd-memeffects"
+
+STATISTIC(FunctionsReadNone, "Functions that only access their own stack frame");
+STATISTIC(FunctionsReadOnly, "Functions that don't write outside of their own stack frame");
+
+// Once argument recovery and stack frame recovery have run, calls between recovered functions are the main thing
+// that stops GVN, DSE and memssadle from carrying program memory values forward. This pass marks functions that don't
+// write (or read) memory outside of their stack frame readonly (or readnone), bottom-up over the call graph, so that
+// BasicAA, which every alias analysis stack of fcd has, tells these passes that the calls leave memory alone.
+//
+// Recovered functions take integers, not pointers, so "only accesses argument memory" can't be expressed on them.
+
+namespace
+{
+	enum MemoryEffect
+	{
+		NoEffect,
+		Reads,
+		Writes,
+	};
+	
+	bool isLocal(const Value* pointer, const DataLayout& dl)
+	{
+		return isa<AllocaInst>(GetUnderlyingObject(pointer, dl));
+	}
+	
+	MemoryEffect effectOfCall(ImmutableCallSite cs, const SmallPtrSetImpl<const Function*>& scc, const DataLayout& dl)
+	{
+		const Function* callee = cs.getCalledFunction();
+		if (callee != nullptr && scc.count(callee) != 0)
+		{
+			// Calls inside of the SCC have the effects of the SCC.
+			return NoEffect;
+		}
+		
+		if (auto transfer = dyn_cast<MemTransferInst>(cs.getInstruction()))
+		{
+			if (!isLocal(transfer->getRawDest(), dl))
+			{
+				return Writes;
+			}
+			return isLocal(transfer->getRawSource(), dl) ? NoEffect : Reads;
+		}
+		if (auto memSet = dyn_cast<MemSetInst>(cs.getInstruction()))
+		{
+			return isLocal(memSet->getRawDest(), dl) ? NoEffect : Writes;
+		}
+		
+		if (cs.doesNotAccessMemory())
+		{
+			return NoEffect;
+		}
+		return cs.onlyReadsMemory() ? Reads : Writes;
+	}
+	
+	MemoryEffect effectOfInstruction(const Instruction& inst, const SmallPtrSetImpl<const Function*>& scc, const DataLayout& dl)
+	{
+		if (!inst.mayReadOrWriteMemory())
+		{
+			return NoEffect;
+		}
+		
+		if (auto load = dyn_cast<LoadInst>(&inst))
+		{
+			if (load->isVolatile())
+			{
+				return Writes;
+			}
+			return isLocal(load->getPointerOperand(), dl) ? NoEffect : Reads;
+		}
+		if (auto store = dyn_cast<StoreInst>(&inst))
+		{
+			return !store->isVolatile() && isLocal(store->getPointerOperand(), dl) ? NoEffect : Writes;
+		}
+		
+		ImmutableCallSite cs(&inst);
+		if (cs)
+		{
+			return effectOfCall(cs, scc, dl);
+		}
+		
+		// Atomics, fences and va_arg.
+		return Writes;
+	}
+	
+	struct MemoryEffectSummaries final : public ModulePass
+	{
+		static char ID;
+		
+		MemoryEffectSummaries() : ModulePass(ID)
+		{
+		}
+		
+		virtual const char* getPassName() const override
+		{
+			return "Memory effect summaries";
+		}
+		
+		virtual void getAnalysisUsage(AnalysisUsage& au) const override
+		{
+			au.addRequired<CallGraphWrapperPass>();
+			au.setPreservesCFG();
+		}
+		
+		virtual bool runOnModule(Module& module) override
+		{
+			const DataLayout& dl = module.getDataLayout();
+			CallGraph& callGraph = getAnalysis<CallGraphWrapperPass>().getCallGraph();
+			
+			bool changed = false;
+			SmallPtrSet<const Function*, 4> scc;
+			for (auto iter = scc_begin(&callGraph); !iter.isAtEnd(); ++iter)
+			{
+				scc.clear();
+				bool summarizable = true;
+				for (CallGraphNode* node : *iter)
+				{
+					Function* fn = node->getFunction();
+					// Declarations keep the attributes that they were created with (libc prototypes have some).
+					if (fn == nullptr || fn->isDeclaration() || fn->hasFnAttribute(Attribute::OptimizeNone))
+					{
+						summarizable = false;
+						break;
+					}
+					scc.insert(fn);
+				}
+				
+				if (summarizable)
+				{
+					changed |= summarize(scc, dl);
+				}
+			}
+			return changed;
+		}
+		
+		bool summarize(const SmallPtrSetImpl<const Function*>& scc, const DataLayout& dl)
+		{
+			MemoryEffect effect = NoEffect;
+			for (const Function* fn : scc)
+			{
+				for (const BasicBlock& bb : *fn)
+				{
+					for (const Instruction& inst : bb)
+					{
+						effect = max(effect, effectOfInstruction(inst, scc, dl));
+						if (effect == Writes)
+						{
+							return false;
+						}
+					}
+				}
+			}
+			
+			bool changed = false;
+			for (const Function* constFn : scc)
+			{
+				Function& fn = const_cast<Function&>(*constFn);
+				if (effect == NoEffect && !fn.doesNotAccessMemory())
+				{
+					fn.removeFnAttr(Attribute::ReadOnly);
+					fn.setDoesNotAccessMemory();
+					++FunctionsReadNone;
+					changed = true;
+				}
+				else if (effect == Reads && !fn.onlyReadsMemory())
+				{
+					fn.setOnlyReadsMemory();
+					++FunctionsReadOnly;
+					changed = true;
+				}
+			}
+			return changed;
+		}
+	};
+	
+	char MemoryEffectSummaries::ID = 0;
+	RegisterPass<MemoryEffectSummaries> memoryEffects("memeffects", "Infer readnone and readonly for functions that keep to their stack frame", false, false);
+}
+
+ModulePass* createMemoryEffectSummariesPass()
+{
+	return new MemoryEffectSummaries;
+}
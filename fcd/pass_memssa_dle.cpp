@@ -19,20 +19,40 @@
 // along with fcd.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#include "memssa_cache.h"
+#include "params_registry.h"
 #include "passes.h"
 
 #include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/Statistic.h>
 #include <llvm/IR/PatternMatch.h>
 
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "fcd-memssadle"
+
+STATISTIC(LoadsForwarded, "Loads replaced with the value of a dominating store");
+STATISTIC(LoadsForwardedThroughPhis, "Loads replaced with a value that every path to them stores");
+STATISTIC(LoadsExamined, "Simple loads whose value was searched for");
+STATISTIC(LoadWalksOverBudget, "Load value searches that gave up after visiting too many memory accesses");
+
 namespace
 {
+	// How many memory accesses are visited to find the value of a single load. Walks give up past that.
+	const unsigned maxWalkedAccesses = 100;
+	
 	struct MemorySSADLE final : public FunctionPass
 	{
 		static char ID;
 		
+		AAResults* aa;
+		DominatorTree* domTree;
+		MemorySSA* mssa;
+		SmallPtrSet<const MemoryPhi*, 8> visitingPhis;
+		unsigned walkBudget;
+		
 		MemorySSADLE() : FunctionPass(ID)
 		{
 		}
@@ -45,51 +65,133 @@ namespace
 		virtual void getAnalysisUsage(AnalysisUsage& au) const override
 		{
 			au.addRequired<AAResultsWrapperPass>();
-			au.addRequired<DominatorTreeWrapperPass>();
 			au.setPreservesAll();
 		}
 		
-		bool runOnBasicBlock(MemorySSA& mssa, BasicBlock& bb)
+		// Finds the value that the memory at location has after access. This fails if the value can't be known.
+		// When the walk comes back to a MemoryPhi that is being visited, it succeeds with a null value: cycles of
+		// MemoryPhis preserve the value that comes from outside of them, and if something in the cycle clobbers the
+		// location, the walk fails there instead.
+		//
+		// The MemorySSA can come from a cache, so it's only used for its def chains: alias queries go through this
+		// pass's own AA stack, which includes the program memory AA.
+		bool findStoredValue(MemoryAccess* access, const MemoryLocation& location, Type* type, Value*& value, bool& sawPhi)
+		{
+			while (access != nullptr && !mssa->isLiveOnEntryDef(access))
+			{
+				if (walkBudget == 0)
+				{
+					++LoadWalksOverBudget;
+					return false;
+				}
+				--walkBudget;
+				
+				if (auto phi = dyn_cast<MemoryPhi>(access))
+				{
+					return findStoredValue(*phi, location, type, value, sawPhi);
+				}
+				
+				auto def = cast<MemoryDef>(access);
+				Instruction* inst = def->getMemoryInst();
+				if (auto store = dyn_cast_or_null<StoreInst>(inst))
+				{
+					if (aa->alias(MemoryLocation::get(store), location) == MustAlias)
+					{
+						// sanity test
+						value = store->getValueOperand();
+						return value->getType() == type;
+					}
+				}
+				
+				if (inst == nullptr || (aa->getModRefInfo(inst, location) & MRI_Mod) != 0)
+				{
+					return false;
+				}
+				access = def->getDefiningAccess();
+			}
+			return false;
+		}
+		
+		bool findStoredValue(MemoryPhi& phi, const MemoryLocation& location, Type* type, Value*& value, bool& sawPhi)
+		{
+			value = nullptr;
+			if (!visitingPhis.insert(&phi).second)
+			{
+				return true;
+			}
+			
+			sawPhi = true;
+			bool found = true;
+			for (unsigned i = 0; i < phi.getNumIncomingValues() && found; ++i)
+			{
+				Value* incoming = nullptr;
+				found = findStoredValue(phi.getIncomingValue(i), location, type, incoming, sawPhi);
+				if (found && incoming != nullptr)
+				{
+					found = value == nullptr || value == incoming;
+					value = incoming;
+				}
+			}
+			visitingPhis.erase(&phi);
+			return found;
+		}
+		
+		Value* findLoadedValue(LoadInst& load, const MemoryUse& use, bool& sawPhi)
+		{
+			if (!load.isSimple())
+			{
+				return nullptr;
+			}
+			
+			++LoadsExamined;
+			sawPhi = false;
+			walkBudget = maxWalkedAccesses;
+			MemoryLocation location = MemoryLocation::get(&load);
+			Value* value = nullptr;
+			if (!findStoredValue(use.getDefiningAccess(), location, load.getType(), value, sawPhi) || value == nullptr)
+			{
+				return nullptr;
+			}
+			
+			// Stores that aren't reached through a phi dominate the load; values that every incoming path of a phi
+			// agrees on still have to.
+			if (auto inst = dyn_cast<Instruction>(value))
+			if (!domTree->dominates(inst, &load))
+			{
+				return nullptr;
+			}
+			return value;
+		}
+		
+		bool runOnBasicBlock(BasicBlock& bb)
 		{
 			bool changed = false;
 			SmallVector<LoadInst*, 10> deletedLoads;
-			if (auto accessList = mssa.getBlockAccesses(&bb))
+			if (auto accessList = mssa->getBlockAccesses(&bb))
 			{
 				for (const MemoryAccess& access : *accessList)
 				{
-					if (auto useOrDef = dyn_cast<MemoryUseOrDef>(&access))
+					if (auto use = dyn_cast<MemoryUse>(&access))
+					if (auto load = dyn_cast<LoadInst>(use->getMemoryInst()))
 					{
-						if (auto use = dyn_cast<MemoryUse>(&access))
-						if (auto load = dyn_cast<LoadInst>(use->getMemoryInst()))
+						bool sawPhi = false;
+						if (Value* storedValue = findLoadedValue(*load, *use, sawPhi))
 						{
-							auto parent = useOrDef->getDefiningAccess();
-							if (auto def = dyn_cast<MemoryDef>(parent))
-							if (auto store = dyn_cast_or_null<StoreInst>(def->getMemoryInst()))
-							{
-								auto storedValue = store->getValueOperand();
-								// sanity test
-								if (storedValue->getType() == load->getType())
-								{
-									load->replaceAllUsesWith(storedValue);
-									deletedLoads.push_back(load);
-									changed = true;
-								}
-							}
+							load->replaceAllUsesWith(storedValue);
+							deletedLoads.push_back(load);
+							changed = true;
+							++(sawPhi ? LoadsForwardedThroughPhis : LoadsForwarded);
 						}
 					}
-					else
-					{
-						break;
-					}
 				}
 			}
 			
 			for (LoadInst* deletedLoad : deletedLoads)
 			{
-				auto access = mssa.getMemoryAccess(deletedLoad);
+				auto access = mssa->getMemoryAccess(deletedLoad);
 				assert(access != nullptr);
 				deletedLoad->eraseFromParent();
-				mssa.removeMemoryAccess(access);
+				mssa->removeMemoryAccess(access);
 			}
 			
 			return changed;
@@ -97,15 +199,36 @@ namespace
 		
 		virtual bool runOnFunction(Function& f) override
 		{
-			auto& aaResults = getAnalysis<AAResultsWrapperPass>().getAAResults();
-			auto& domTree = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
-			MemorySSA mssa(f, &aaResults, &domTree);
+			aa = &getAnalysis<AAResultsWrapperPass>().getAAResults();
+			
+			// Share MemorySSA with the ParameterRegistry (and with later pass managers) when possible.
+			// The alias analysis knows about call information when there is a ParameterRegistry.
+			MemorySSACache localCache;
+			MemorySSACache* cache = &localCache;
+			auto registry = getAnalysisIfAvailable<ParameterRegistry>();
+			if (auto provider = getAnalysisIfAvailable<MemorySSAProvider>())
+			{
+				cache = &provider->getCache();
+			}
+			else if (registry != nullptr)
+			{
+				cache = &registry->getMemorySSACache();
+			}
+			hash_code dependencies = registry == nullptr ? hash_code(0) : registry->getAAResult().hashCalleeInformation(f);
+			domTree = &cache->getDominatorTree(f);
+			mssa = &cache->get(f, dependencies, [this](Function& fn)
+			{
+				return std::make_unique<MemorySSA>(fn, aa, domTree);
+			});
 			
 			bool changed = false;
 			for (BasicBlock* bb : ReversePostOrderTraversal<BasicBlock*>(&f.getEntryBlock()))
 			{
-				changed |= runOnBasicBlock(mssa, *bb);
+				changed |= runOnBasicBlock(*bb);
 			}
+			
+			// Dead loads are removed from MemorySSA as they are deleted.
+			cache->update(f);
 			return changed;
 		}
 	};
@@ -0,0 +1,252 @@
+//
+// pass_outline.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "metadata.h"
+#include "passes.h"
+#include "rooted_post_dom_tree.h"
+
+#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/CodeExtractor.h>
+
+#include <memory>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+#define DEBUG_TYPE "fcd-outline"
+
+STATISTIC(RegionsOutlined, "Regions outlined out of large functions");
+
+// Structuring time grows much faster than the size of a function. This pass moves the large single-entry,
+// single-exit regions of functions that have more basic blocks than a threshold to helper functions of their own,
+// which the back end structures independently (and in parallel) and prints right after the function that they come
+// from. Regions are found with the same (rooted) post-dominator tree that the back end uses to find them.
+
+namespace
+{
+	// Outlining smaller regions makes the output harder to follow for little structuring time.
+	const unsigned minimumRegionBlocks = 8;
+	
+	// Collects the blocks of the region that starts at entry and ends at the immediate post-dominator of entry, if the
+	// region has a single entry, at most maxBlocks blocks, and can be moved to a function of its own.
+	bool collectRegion(BasicBlock& entry, DominatorTree& domTree, DominatorTreeBase<BasicBlock>& postDomTree, unsigned maxBlocks, SmallVectorImpl<BasicBlock*>& region)
+	{
+		BasicBlock* exit = postDominatorOf(postDomTree, entry);
+		if (exit == nullptr)
+		{
+			return false;
+		}
+		
+		region.clear();
+		SmallPtrSet<BasicBlock*, 16> visited;
+		SmallVector<BasicBlock*, 16> worklist = { &entry };
+		unsigned exitingEdges = 0;
+		visited.insert(&entry);
+		while (!worklist.empty())
+		{
+			BasicBlock* bb = worklist.pop_back_val();
+			if (!domTree.dominates(&entry, bb) || isa<ReturnInst>(bb->getTerminator()))
+			{
+				return false;
+			}
+			
+			region.push_back(bb);
+			if (region.size() > maxBlocks)
+			{
+				return false;
+			}
+			
+			for (BasicBlock* succ : successors(bb))
+			{
+				if (succ == exit)
+				{
+					++exitingEdges;
+				}
+				else if (visited.insert(succ).second)
+				{
+					worklist.push_back(succ);
+				}
+			}
+		}
+		
+		// Blocks after the exit can still branch back into the middle of the region, which the code extractor can't
+		// handle: only the entry may have predecessors outside of the region.
+		for (BasicBlock* bb : region)
+		{
+			if (bb == &entry)
+			{
+				continue;
+			}
+			
+			for (BasicBlock* pred : predecessors(bb))
+			{
+				if (visited.count(pred) == 0)
+				{
+					return false;
+				}
+			}
+		}
+		
+		// The code extractor would merge the incoming values of several edges from the region into one.
+		if (exitingEdges == 0 || (exitingEdges > 1 && isa<PHINode>(exit->begin())))
+		{
+			return false;
+		}
+		return region.size() >= minimumRegionBlocks;
+	}
+	
+	// Finds the outermost regions of fn that are small enough. They don't overlap, since each region is dominated by
+	// its entry and regions are never searched for in the dominator subtree of another region.
+	void findRegions(Function& fn, unsigned maxBlocks, vector<SmallVector<BasicBlock*, 16>>& regions)
+	{
+		DominatorTree domTree;
+		domTree.recalculate(fn);
+		unique_ptr<DominatorTreeBase<BasicBlock>> postDomTree(new DominatorTreeBase<BasicBlock>(true));
+		postDomTree->recalculate(fn);
+		RootedPostDominatorTree::treeFromIncompleteTree(fn, postDomTree);
+		
+		// A region can't have more blocks than the dominator subtree of its entry.
+		DenseMap<BasicBlock*, unsigned> subtreeSizes;
+		for (DomTreeNode* node : post_order(domTree.getRootNode()))
+		{
+			unsigned size = 1;
+			for (DomTreeNode* child : *node)
+			{
+				size += subtreeSizes[child->getBlock()];
+			}
+			subtreeSizes[node->getBlock()] = size;
+		}
+		
+		// The entry block of a function can't be outlined.
+		DomTreeNode* root = domTree.getRootNode();
+		SmallVector<DomTreeNode*, 16> worklist(root->begin(), root->end());
+		SmallVector<BasicBlock*, 16> region;
+		while (!worklist.empty())
+		{
+			DomTreeNode* node = worklist.pop_back_val();
+			BasicBlock* entry = node->getBlock();
+			if (subtreeSizes[entry] < minimumRegionBlocks)
+			{
+				continue;
+			}
+			
+			if (collectRegion(*entry, domTree, *postDomTree, maxBlocks, region))
+			{
+				regions.push_back(region);
+			}
+			else
+			{
+				worklist.append(node->begin(), node->end());
+			}
+		}
+	}
+	
+	struct RegionOutlining final : public ModulePass
+	{
+		static char ID;
+		unsigned maxBlocks;
+		
+		RegionOutlining(unsigned maxBlocks = 0)
+		: ModulePass(ID), maxBlocks(maxBlocks)
+		{
+		}
+		
+		virtual const char* getPassName() const override
+		{
+			return "Outline regions of large functions";
+		}
+		
+		virtual bool runOnModule(Module& module) override
+		{
+			if (maxBlocks == 0)
+			{
+				return false;
+			}
+			
+			// Outlining adds functions to the module.
+			vector<Function*> largeFunctions;
+			for (Function& fn : module)
+			{
+				if (!fn.isDeclaration() && fn.size() > maxBlocks)
+				{
+					largeFunctions.push_back(&fn);
+				}
+			}
+			
+			bool changed = false;
+			for (Function* fn : largeFunctions)
+			{
+				changed |= outlineRegions(*fn);
+			}
+			return changed;
+		}
+		
+		bool outlineRegions(Function& fn)
+		{
+			vector<SmallVector<BasicBlock*, 16>> regions;
+			findRegions(fn, maxBlocks, regions);
+			
+			unsigned index = 0;
+			for (const auto& region : regions)
+			{
+				CodeExtractor extractor(region);
+				if (!extractor.isEligible())
+				{
+					continue;
+				}
+				
+				if (Function* helper = extractor.extractCodeRegion())
+				{
+					// Helpers share the address of their parent, and the back end sorts them right after it.
+					helper->setName(fn.getName() + "_region" + Twine(index));
+					if (auto address = md::getVirtualAddress(fn))
+					{
+						md::setVirtualAddress(*helper, address->getLimitedValue());
+					}
+					++index;
+					++RegionsOutlined;
+				}
+			}
+			
+			if (index != 0)
+			{
+				md::incrementFunctionVersion(fn);
+			}
+			return index != 0;
+		}
+	};
+	
+	char RegionOutlining::ID = 0;
+	RegisterPass<RegionOutlining> regionOutlining("outlineregions", "Outline single-entry, single-exit regions of large functions", false, false);
+}
+
+ModulePass* createRegionOutliningPass(unsigned maxBlocks)
+{
+	return new RegionOutlining(maxBlocks);
+}
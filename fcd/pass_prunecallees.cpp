@@ -0,0 +1,82 @@
+//
+// pass_prunecallees.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "main.h"
+#include "metadata.h"
+#include "passes.h"
+
+using namespace llvm;
+using namespace std;
+
+// In partial disassembly, functions that are not entry points are only lifted so that ParameterRegistry can infer
+// their prototypes. Once argument recovery has run on their callers, they are turned back into prototypes and skip the
+// rest of the pipeline and the back end.
+
+namespace
+{
+	struct CalleePruning final : public ModulePass
+	{
+		static char ID;
+		
+		CalleePruning() : ModulePass(ID)
+		{
+		}
+		
+		virtual const char* getPassName() const override
+		{
+			return "Prune callees of entry points";
+		}
+		
+		virtual bool runOnModule(Module& module) override
+		{
+			if (!isPartialDisassembly())
+			{
+				return false;
+			}
+			
+			bool changed = false;
+			for (Function& fn : module)
+			{
+				if (!md::isPrototype(fn))
+				if (auto address = md::getVirtualAddress(fn))
+				{
+					uint64_t virtualAddress = address->getLimitedValue();
+					if (!isEntryPoint(virtualAddress))
+					{
+						fn.deleteBody();
+						md::setVirtualAddress(fn, virtualAddress);
+						changed = true;
+					}
+				}
+			}
+			return changed;
+		}
+	};
+	
+	char CalleePruning::ID = 0;
+	RegisterPass<CalleePruning> calleePruning("#prune-callees", "Prune callees of entry points", false, false);
+}
+
+ModulePass* createCalleePruningPass()
+{
+	return new CalleePruning;
+}
@@ -39,20 +39,27 @@
 using namespace llvm;
 using namespace std;
 
-namespace
+bool ProgramMemoryAAResult::isProgramMemory(const Value& pointer)
 {
-	bool isProgramMemory(const Value& pointer)
+	auto iter = programMemoryPointers.find(&pointer);
+	if (iter != programMemoryPointers.end())
 	{
-		for (const User* user : pointer.users())
+		return iter->second;
+	}
+	
+	for (const User* user : pointer.users())
+	{
+		if (auto inst = dyn_cast<Instruction>(user))
+		if (inst->getOpcode() == Instruction::Load || inst->getOpcode() == Instruction::Store)
 		{
-			if (auto inst = dyn_cast<Instruction>(user))
-			if (inst->getOpcode() == Instruction::Load || inst->getOpcode() == Instruction::Store)
-			{
-				return md::isProgramMemory(*inst);
-			}
+			bool result = md::isProgramMemory(*inst);
+			programMemoryPointers[&pointer] = result;
+			return result;
 		}
-		return false;
 	}
+	
+	// Not cached: the pointer could still gain a load or a store.
+	return false;
 }
 
 AliasResult ProgramMemoryAAResult::alias(const MemoryLocation& a, const MemoryLocation& b)
@@ -24,6 +24,7 @@
 
 
 #include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/IR/ValueMap.h>
 #include <llvm/Pass.h>
 
 #include <memory>
@@ -32,10 +33,16 @@ class ProgramMemoryAAResult : public llvm::AAResultBase<ProgramMemoryAAResult>
 {
 	friend llvm::AAResultBase<ProgramMemoryAAResult>;
 	
+	// Pointers are classified by looking at their loads and stores, and alias queries are frequent enough that
+	// walking the user list every time shows up. Entries go away with their pointer.
+	llvm::ValueMap<const llvm::Value*, bool> programMemoryPointers;
+	
+	bool isProgramMemory(const llvm::Value& pointer);
+	
 public:
 	bool invalidate(llvm::Function& fn, const llvm::PreservedAnalyses& pa)
 	{
-		// Stateless.
+		// The classification cache doesn't depend on other analyses.
 		return false;
 	}
 	
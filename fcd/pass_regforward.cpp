@@ -0,0 +1,330 @@
+//
+// pass_regforward.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "metadata.h"
+#include "passes.h"
+
+#include <llvm/ADT/MapVector.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/Transforms/Utils/SSAUpdater.h>
+
+#include <memory>
+
+using namespace llvm;
+using namespace std;
+
+#define DEBUG_TYPE "fcd-regforward"
+
+STATISTIC(RegisterLoadsForwarded, "Register loads replaced with the value last stored to the register");
+
+namespace
+{
+	struct RegisterAccesses
+	{
+		GetElementPtrInst* pointer;
+		Type* type;
+		bool forwardable;
+		bool hasLoads;
+		
+		RegisterAccesses()
+		: pointer(nullptr), type(nullptr), forwardable(true), hasLoads(false)
+		{
+		}
+	};
+	
+	// Lifted functions access the x86_regs structure through GEPs of their only argument. This pass forwards values
+	// stored to a register to the loads of the same register, building SSA form for each register the way mem2reg
+	// does for allocas. Unlike GVN, it doesn't query memory dependences: it walks each function once per register,
+	// considering that a register is overwritten by stores to it, and by calls and stores that could alias it.
+	// Stores are kept; the loads that are replaced are deleted.
+	//
+	// Registers are identified by the largest register that overlaps them. Registers that are accessed with more than
+	// one type or through something else than a load or a store of their GEP are left alone.
+	struct RegisterForwarding final : public FunctionPass
+	{
+		static char ID;
+		unique_ptr<TargetInfo> targetInfo;
+		DenseMap<const Value*, const TargetRegisterInfo*> registerOfPointer;
+		
+		RegisterForwarding() : FunctionPass(ID)
+		{
+		}
+		
+		virtual const char* getPassName() const override
+		{
+			return "Register Forwarding";
+		}
+		
+		virtual bool doInitialization(Module& m) override
+		{
+			targetInfo = TargetInfo::getTargetInfo(m);
+			return FunctionPass::doInitialization(m);
+		}
+		
+		virtual bool runOnFunction(Function& fn) override
+		{
+			if (skipOptnoneFunction(fn) || targetInfo == nullptr || !md::areArgumentsRecoverable(fn))
+			{
+				return false;
+			}
+			
+			assert(fn.arg_size() == 1);
+			auto registers = static_cast<Argument*>(fn.arg_begin());
+			
+			MapVector<const TargetRegisterInfo*, RegisterAccesses> accesses;
+			registerOfPointer.clear();
+			for (User* user : registers->users())
+			{
+				if (isa<CallInst>(user))
+				{
+					// Calls are assumed to overwrite every register that they could write to anyway.
+					continue;
+				}
+				
+				auto gep = dyn_cast<GetElementPtrInst>(user);
+				const TargetRegisterInfo* info = gep == nullptr ? nullptr : targetInfo->registerInfo(*gep);
+				if (info == nullptr)
+				{
+					// The register structure is accessed in a way that doesn't say which register is used.
+					return false;
+				}
+				
+				const TargetRegisterInfo* reg = &targetInfo->largestOverlappingRegister(*info);
+				registerOfPointer[gep] = reg;
+				RegisterAccesses& access = accesses[reg];
+				if (access.pointer == nullptr)
+				{
+					access.pointer = gep;
+				}
+				
+				for (User* gepUser : gep->users())
+				{
+					Type* accessType = nullptr;
+					if (auto load = dyn_cast<LoadInst>(gepUser))
+					{
+						if (load->isSimple())
+						{
+							accessType = load->getType();
+							access.hasLoads = true;
+						}
+					}
+					else if (auto store = dyn_cast<StoreInst>(gepUser))
+					{
+						if (store->isSimple() && store->getPointerOperand() == gep)
+						{
+							accessType = store->getValueOperand()->getType();
+						}
+					}
+					
+					if (accessType == nullptr || (access.type != nullptr && access.type != accessType))
+					{
+						access.forwardable = false;
+					}
+					else
+					{
+						access.type = accessType;
+					}
+				}
+			}
+			
+			bool changed = false;
+			for (auto& pair : accesses)
+			{
+				if (pair.second.forwardable && pair.second.hasLoads)
+				{
+					changed |= forwardRegister(fn, *pair.first, pair.second);
+				}
+			}
+			return changed;
+		}
+		
+		const TargetRegisterInfo* registerOf(Value* pointer) const
+		{
+			auto iter = registerOfPointer.find(pointer->stripPointerCasts());
+			return iter == registerOfPointer.end() ? nullptr : iter->second;
+		}
+		
+		bool mayOverwriteRegisters(StoreInst& store, const DataLayout& dl) const
+		{
+			if (md::isProgramMemory(store))
+			{
+				return false;
+			}
+			
+			Value* pointer = store.getPointerOperand();
+			if (registerOf(pointer) != nullptr)
+			{
+				// Registers that don't overlap are different registers.
+				return false;
+			}
+			return !isa<AllocaInst>(GetUnderlyingObject(pointer, dl));
+		}
+		
+		bool forwardRegister(Function& fn, const TargetRegisterInfo& reg, RegisterAccesses& access)
+		{
+			enum State
+			{
+				// No access to the register in the block yet: its value is the one that it has coming into the block.
+				LiveIn,
+				// The register was overwritten and its new value is unknown.
+				Overwritten,
+				// The current value of the register is known.
+				Known,
+			};
+			
+			const DataLayout& dl = fn.getParent()->getDataLayout();
+			BasicBlock& entry = fn.getEntryBlock();
+			SSAUpdater updater;
+			updater.Initialize(access.type, reg.name);
+			
+			GetElementPtrInst* entryPointer = nullptr;
+			SmallVector<LoadInst*, 16> liveInLoads;
+			SmallVector<LoadInst*, 16> insertedLoads;
+			SmallVector<LoadInst*, 16> forwardedLoads;
+			for (BasicBlock& bb : fn)
+			{
+				// The register contents are unknown when the function starts.
+				State state = &bb == &entry ? Overwritten : LiveIn;
+				Value* current = nullptr;
+				for (Instruction& inst : bb)
+				{
+					if (auto load = dyn_cast<LoadInst>(&inst))
+					{
+						if (registerOf(load->getPointerOperand()) != &reg)
+						{
+							continue;
+						}
+						
+						if (state == Known)
+						{
+							load->replaceAllUsesWith(current);
+							forwardedLoads.push_back(load);
+						}
+						else if (state == LiveIn)
+						{
+							liveInLoads.push_back(load);
+						}
+						else
+						{
+							current = load;
+							state = Known;
+						}
+					}
+					else if (auto store = dyn_cast<StoreInst>(&inst))
+					{
+						if (registerOf(store->getPointerOperand()) == &reg)
+						{
+							Value* value = store->getValueOperand();
+							auto valueLoad = dyn_cast<LoadInst>(value);
+							if (state == LiveIn && valueLoad != nullptr && valueLoad->getParent() == &bb && registerOf(valueLoad->getPointerOperand()) == &reg)
+							{
+								// Storing back the value that the register came in with doesn't change it.
+								continue;
+							}
+							current = value;
+							state = Known;
+						}
+						else if (mayOverwriteRegisters(*store, dl))
+						{
+							current = nullptr;
+							state = Overwritten;
+						}
+					}
+					else if (inst.mayWriteToMemory())
+					{
+						current = nullptr;
+						state = Overwritten;
+					}
+				}
+				
+				if (state == Overwritten)
+				{
+					// Successors need a value for the register. This load is deleted if no one ends up using it.
+					if (entryPointer == nullptr)
+					{
+						entryPointer = cast<GetElementPtrInst>(access.pointer->clone());
+						entryPointer->insertBefore(&*entry.getFirstInsertionPt());
+					}
+					auto load = new LoadInst(entryPointer, "", bb.getTerminator());
+					insertedLoads.push_back(load);
+					current = load;
+					state = Known;
+				}
+				
+				if (state == Known)
+				{
+					updater.AddAvailableValue(&bb, current);
+				}
+			}
+			
+			// Query every value before replacing anything: values can be loads that are about to be replaced, and
+			// value handles follow the replacement.
+			SmallVector<WeakVH, 16> liveInValues;
+			for (LoadInst* load : liveInLoads)
+			{
+				liveInValues.push_back(updater.GetValueInMiddleOfBlock(load->getParent()));
+			}
+			
+			for (size_t i = 0; i < liveInLoads.size(); ++i)
+			{
+				LoadInst* load = liveInLoads[i];
+				Value* value = liveInValues[i];
+				if (value != load)
+				{
+					load->replaceAllUsesWith(value);
+					forwardedLoads.push_back(load);
+				}
+			}
+			
+			for (LoadInst* load : forwardedLoads)
+			{
+				load->eraseFromParent();
+			}
+			for (LoadInst* load : insertedLoads)
+			{
+				if (load->use_empty())
+				{
+					load->eraseFromParent();
+				}
+			}
+			if (entryPointer != nullptr && entryPointer->use_empty())
+			{
+				entryPointer->eraseFromParent();
+			}
+			
+			RegisterLoadsForwarded += forwardedLoads.size();
+			return forwardedLoads.size() > 0;
+		}
+	};
+	
+	char RegisterForwarding::ID = 0;
+	RegisterPass<RegisterForwarding> regForward("regforward", "Forward register stores to register loads", false, false);
+}
+
+FunctionPass* createRegisterForwardingPass()
+{
+	return new RegisterForwarding;
+}
@@ -34,9 +34,10 @@ using namespace std;
 namespace
 {
 	// This pass is a little bit of a hack.
-	// Emulators create weird code for union access. Bitcasts that target just part of a register use a GEP to
-	// the struct that encloses the i64. The address is the same, but the type is different, and this angers
-	// argument promotion. This pass fixes the GEPs to always use the i64 pointer.
+	// Emulators create weird code for union access. General-purpose registers are plain i64 fields, but vector
+	// registers are unions, and bitcasts that target them use a GEP to the struct that encloses the value. The
+	// address is the same, but the type is different, and this angers argument promotion. This pass fixes the GEPs
+	// to always point to the first member of the union.
 	struct RegisterPointerPromotion : public FunctionPass
 	{
 		static char ID;
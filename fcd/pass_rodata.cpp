@@ -0,0 +1,111 @@
+//
+// pass_rodata.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "metadata.h"
+#include "pass_executable.h"
+#include "passes.h"
+
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+
+using namespace llvm;
+using namespace std;
+
+#define DEBUG_TYPE "fcd-rodata"
+
+STATISTIC(ReadOnlyLoadsFolded, "Loads from read-only program memory folded to constants");
+
+namespace
+{
+	// Program memory loads from constant addresses in segments that the program can't write to (vtables, jump tables,
+	// string literals) always produce the value that the executable has at that address. This pass replaces them with
+	// that value, which lets indirect calls through constant tables become direct calls.
+	struct ReadOnlyLoadFolding final : public FunctionPass
+	{
+		static char ID;
+		
+		ReadOnlyLoadFolding() : FunctionPass(ID)
+		{
+		}
+		
+		virtual const char* getPassName() const override
+		{
+			return "Read-Only Load Folding";
+		}
+		
+		virtual void getAnalysisUsage(AnalysisUsage& au) const override
+		{
+			au.addRequired<ExecutableWrapper>();
+			au.setPreservesCFG();
+		}
+		
+		virtual bool runOnFunction(Function& fn) override
+		{
+			if (skipOptnoneFunction(fn))
+			{
+				return false;
+			}
+			
+			ExecutableWrapper& wrapper = getAnalysis<ExecutableWrapper>();
+			if (wrapper.getExecutable() == nullptr)
+			{
+				return false;
+			}
+			
+			const DataLayout& dl = fn.getParent()->getDataLayout();
+			bool changed = false;
+			for (auto iter = inst_begin(fn); iter != inst_end(fn); )
+			{
+				auto load = dyn_cast<LoadInst>(&*iter);
+				++iter;
+				
+				uint64_t address;
+				if (load != nullptr && !load->isVolatile() && md::isProgramMemory(*load))
+				if (ExecutableWrapper::getConstantAddress(*load->getPointerOperand(), address))
+				if (Constant* value = wrapper.readConstant(address, *load->getType(), dl))
+				{
+					auto pointer = dyn_cast<IntToPtrInst>(load->getPointerOperand());
+					load->replaceAllUsesWith(value);
+					load->eraseFromParent();
+					// The cast dominates the load, so the iterator is already past it.
+					if (pointer != nullptr && pointer->use_empty())
+					{
+						pointer->eraseFromParent();
+					}
+					ReadOnlyLoadsFolded++;
+					changed = true;
+				}
+			}
+			return changed;
+		}
+	};
+	
+	char ReadOnlyLoadFolding::ID = 0;
+	RegisterPass<ReadOnlyLoadFolding> foldReadOnly("foldrodata", "Fold loads from read-only program memory", false, false);
+}
+
+FunctionPass* createReadOnlyLoadFoldingPass()
+{
+	return new ReadOnlyLoadFolding;
+}
@@ -23,7 +23,10 @@
 #include "passes.h"
 #include "pass_seseloop.h"
 
+#include <llvm/ADT/BitVector.h>
 #include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Support/raw_os_ostream.h>
@@ -36,6 +39,13 @@
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "fcd-seseloop"
+
+STATISTIC(LoopsVisited, "Loops whose entries and exits were checked");
+STATISTIC(LoopEntriesFunneled, "Loops given a single entry block");
+STATISTIC(LoopExitsFunneled, "Loops given a single exit block");
+STATISTIC(LoopSearchRestarts, "Times that the loop search started over after a loop was normalized");
+
 template<typename TColl>
 void dump(const TColl& coll)
 {
@@ -59,58 +69,44 @@ void dump(const unordered_set<BasicBlock*>& set)
 
 namespace
 {
-	template<typename TGraphType, typename GraphTr = GraphTraits<TGraphType>>
-	void findPathsToSinkNodes(TGraphType currentNode, const unordered_set<TGraphType>& sinkNodes, vector<vector<TGraphType>>& results, deque<TGraphType>& stack)
+	// A DFS edge is a back edge when it goes to a block whose traversal hasn't finished yet.
+	void findBackEdgeDestinations(BasicBlock* entry, unordered_multimap<BasicBlock*, BasicBlock*>& result)
 	{
-		stack.push_back(currentNode);
-		
-		if (sinkNodes.count(currentNode) == 1)
+		enum VisitState : unsigned
 		{
-			results.emplace_back(stack.begin(), stack.end());
-		}
+			Unvisited,
+			Open,
+			Closed,
+		};
 		
-		auto end = GraphTr::child_end(currentNode);
-		for (auto iter = GraphTr::child_begin(currentNode); iter != end; ++iter)
+		DenseMap<BasicBlock*, unsigned> states;
+		SmallVector<pair<BasicBlock*, succ_iterator>, 16> stack;
+		states[entry] = Open;
+		stack.push_back({entry, succ_begin(entry)});
+		while (!stack.empty())
 		{
-			TGraphType explored = *iter;
-			bool found = any_of(stack.rbegin(), stack.rend(), [&](const TGraphType& item)
+			BasicBlock* bb = stack.back().first;
+			succ_iterator& iter = stack.back().second;
+			if (iter == succ_end(bb))
 			{
-				return explored == item;
-			});
-			
-			if (!found)
-			{
-				findPathsToSinkNodes(explored, sinkNodes, results, stack);
+				states[bb] = Closed;
+				stack.pop_back();
+				continue;
 			}
-		}
-		stack.pop_back();
-	}
-	
-	template<typename TGraphType, typename GraphTr = GraphTraits<TGraphType>>
-	vector<vector<TGraphType>> findPathsToSinkNodes(TGraphType startNode, const unordered_set<TGraphType>& sinkNodes)
-	{
-		vector<vector<TGraphType>> result;
-		deque<TGraphType> stack;
-		findPathsToSinkNodes(startNode, sinkNodes, result, stack);
-		return result;
-	}
-	
-	void findBackEdgeDestinations(BasicBlock* entry, deque<BasicBlock*>& stack, unordered_multimap<BasicBlock*, BasicBlock*>& result, unordered_set<BasicBlock*>& visited)
-	{
-		visited.insert(entry);
-		stack.push_back(entry);
-		for (BasicBlock* bb : successors(entry))
-		{
-			if (visited.count(bb) == 0)
+			
+			BasicBlock* succ = *iter;
+			++iter;
+			unsigned& state = states[succ];
+			if (state == Unvisited)
 			{
-				findBackEdgeDestinations(bb, stack, result, visited);
+				state = Open;
+				stack.push_back({succ, succ_begin(succ)});
 			}
-			else if (find(stack.rbegin(), stack.rend(), bb) != stack.rend())
+			else if (state == Open)
 			{
-				result.insert({bb, entry});
+				result.insert({succ, bb});
 			}
 		}
-		stack.pop_back();
 	}
 	
 	void fixNonDominatingValues(DominatorTree& domTree, iterator_range<SmallVectorImpl<BasicBlock*>::iterator> range)
@@ -329,10 +325,8 @@ char SESELoop::ID = 0;
 
 unordered_multimap<BasicBlock*, BasicBlock*> SESELoop::findBackEdgeDestinations(BasicBlock& entryPoint)
 {
-	unordered_set<BasicBlock*> visited;
 	unordered_multimap<BasicBlock*, BasicBlock*> result;
-	deque<BasicBlock*> visitedStack;
-	::findBackEdgeDestinations(&entryPoint, visitedStack, result, visited);
+	::findBackEdgeDestinations(&entryPoint, result);
 	return result;
 }
 
@@ -356,9 +350,13 @@ bool SESELoop::runOnFunction(Function& fn)
 		changedThisIteration = false;
 		unordered_multimap<BasicBlock*, BasicBlock*> destToOrigin = findBackEdgeDestinations(fn.getEntryBlock());
 		
+		blocks.clear();
+		blockIndices.clear();
 		vector<BasicBlock*> postOrderBackwardsEdges;
 		for (BasicBlock* bb : post_order(&fn.getEntryBlock()))
 		{
+			blockIndices[bb] = static_cast<unsigned>(blocks.size());
+			blocks.push_back(bb);
 			if (destToOrigin.count(bb) != 0)
 			{
 				postOrderBackwardsEdges.push_back(bb);
@@ -371,6 +369,7 @@ bool SESELoop::runOnFunction(Function& fn)
 			{
 				changed = true;
 				changedThisIteration = true;
+				++LoopSearchRestarts;
 				break;
 			}
 		}
@@ -381,25 +380,68 @@ bool SESELoop::runOnFunction(Function& fn)
 
 void SESELoop::buildLoopMemberSet(BasicBlock& backEdgeDestination, const unordered_multimap<BasicBlock*, BasicBlock*>& destToOrigin, unordered_set<BasicBlock*>& members, unordered_set<BasicBlock*>& entries, unordered_set<BasicBlock*>& exits)
 {
-	// Build paths to back-edge start nodes.
-	unordered_set<BasicBlock*> sinkNodeSet;
+	// Loop members are the blocks that are reachable from the back-edge destination and that can reach the origin of
+	// one of its back edges, neither going through the destination again.
+	unsigned destination = blockIndices.lookup(&backEdgeDestination);
+	SmallVector<unsigned, 16> worklist;
+	BitVector reachable(static_cast<unsigned>(blocks.size()));
+	reachable.set(destination);
+	worklist.push_back(destination);
+	while (!worklist.empty())
+	{
+		for (BasicBlock* succ : successors(blocks[worklist.pop_back_val()]))
+		{
+			// Successors of reachable blocks are reachable, so they are always numbered.
+			unsigned index = blockIndices.lookup(succ);
+			if (!reachable.test(index))
+			{
+				reachable.set(index);
+				worklist.push_back(index);
+			}
+		}
+	}
+	
+	BitVector reaching(static_cast<unsigned>(blocks.size()));
 	auto range = destToOrigin.equal_range(&backEdgeDestination);
 	for (auto iter = range.first; iter != range.second; iter++)
 	{
-		sinkNodeSet.insert(iter->second);
+		unsigned index = blockIndices.lookup(iter->second);
+		if (!reaching.test(index))
+		{
+			reaching.set(index);
+			worklist.push_back(index);
+		}
 	}
 	
-	auto pathsToBackNodes = findPathsToSinkNodes(&backEdgeDestination, sinkNodeSet);
+	while (!worklist.empty())
+	{
+		unsigned current = worklist.pop_back_val();
+		if (current == destination)
+		{
+			continue;
+		}
+		
+		for (BasicBlock* pred : predecessors(blocks[current]))
+		{
+			auto iter = blockIndices.find(pred);
+			if (iter != blockIndices.end() && !reaching.test(iter->second))
+			{
+				reaching.set(iter->second);
+				worklist.push_back(iter->second);
+			}
+		}
+	}
 	
-	// Build initial loop membership set
-	for (const auto& path : pathsToBackNodes)
+	reachable &= reaching;
+	for (int index = reachable.find_first(); index != -1; index = reachable.find_next(index))
 	{
-		members.insert(path.begin(), path.end());
+		members.insert(blocks[index]);
 	}
 	
-	// The path-to-sink-nodes algorithm won't follow back edges. Because of that, if the cycle contains a
-	// sub-cycle, we need to add its member nodes. This is probably handled by the loop membership refinement
-	// step from the "No More Gotos" paper, but as noted below, we don't use that step.
+	// Reachability doesn't go through the back-edge destination. Because of that, if the cycle contains a sub-cycle
+	// that can only get back to the destination through it, we need to add its member nodes. This is probably handled
+	// by the loop membership refinement step from the "No More Gotos" paper, but as noted below, we don't use that
+	// step.
 	unordered_set<BasicBlock*> newMembers;
 	for (BasicBlock* bb : members)
 	{
@@ -439,6 +481,7 @@ bool SESELoop::runOnBackgoingBlock(BasicBlock& backEdgeDestination, const unorde
 	unordered_set<BasicBlock*> entries; // nodes inside the loop that are reached from the outside
 	unordered_set<BasicBlock*> exits; // nodes outside the loop that are preceded by a node inside of it
 	buildLoopMemberSet(backEdgeDestination, backEdgeMap, members, entries, exits);
+	++LoopsVisited;
 
 	// The "No More Gotos" paper suggests a step of "loop membership refinement", but it seems dubiously useful
 	// to me. I could have done it wrong, but from my experience, it'll just gobble up non-looping nodes and
@@ -453,6 +496,7 @@ bool SESELoop::runOnBackgoingBlock(BasicBlock& backEdgeDestination, const unorde
 		assert(verifyFunction(*backEdgeDestination.getParent(), &errs()) == 0);
 		members.insert(funnel);
 		changed = true;
+		++LoopEntriesFunneled;
 	}
 	
 	if (exits.size() > 1)
@@ -460,6 +504,7 @@ bool SESELoop::runOnBackgoingBlock(BasicBlock& backEdgeDestination, const unorde
 		createFunnelBlock(domTree, members, exits, false);
 		assert(verifyFunction(*backEdgeDestination.getParent(), &errs()) == 0);
 		changed = true;
+		++LoopExitsFunneled;
 	}
 	
 	return changed;
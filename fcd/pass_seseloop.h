@@ -23,19 +23,25 @@
 #define pass_seseloop_h
 
 
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/Analysis/Passes.h>
 #include <llvm/IR/BasicBlock.h>
 
 #include <unordered_map>
+#include <vector>
 
 class SESELoop : public llvm::FunctionPass
 {
 	// Persistent per-function map of back-edge-destination to loop member.
-	// Loops are visited in post-order and the algorithm that finds paths to sink nodes
-	// doesn't run through sub-cycles. This helps identify sub-cycles and insert them as loop
-	// members for larger cycles.
+	// Loops are visited in post-order and loop membership doesn't run through the back-edge destination. This helps
+	// identify sub-cycles and insert them as loop members for larger cycles.
 	std::unordered_multimap<llvm::BasicBlock*, llvm::BasicBlock*> loopMembers;
 	
+	// Blocks reachable from the entry, numbered in post-order, so that loop members can be found with bit vectors.
+	// Renumbered every time that the CFG changes.
+	std::vector<llvm::BasicBlock*> blocks;
+	llvm::DenseMap<llvm::BasicBlock*, unsigned> blockIndices;
+	
 	void buildLoopMemberSet(llvm::BasicBlock& backEdgeDestination, const std::unordered_multimap<llvm::BasicBlock*, llvm::BasicBlock*>& destToOrigin, std::unordered_set<llvm::BasicBlock*>& members, std::unordered_set<llvm::BasicBlock*>& entries, std::unordered_set<llvm::BasicBlock*>& exits);
 	bool runOnBackgoingBlock(llvm::BasicBlock& backEdgeDestination, const std::unordered_multimap<llvm::BasicBlock*, llvm::BasicBlock*>& backEdgeMap);
 	
@@ -34,17 +34,30 @@
 #include "pass_seseloop.h"
 #include "targetinfo.h"
 
+llvm::ModulePass*		createCalleePruningPass();
 llvm::FunctionPass*		createConditionSimplificationPass();
 llvm::ModulePass*		createFixIndirectsPass();
+llvm::FunctionPass*		createFlagCleanupPass();
 llvm::ModulePass*		createIdentifyLocalsPass();
 llvm::FunctionPass*		createIntNarrowingPass();
 llvm::FunctionPass*		createMemorySSADeadLoadEliminationPass();
+llvm::ModulePass*		createMemoryEffectSummariesPass();
 llvm::FunctionPass*		createNoopCastEliminationPass();
+llvm::FunctionPass*		createReadOnlyLoadFoldingPass();
+llvm::ModulePass*		createRecoverGlobalsPass();
+llvm::ModulePass*		createRegionOutliningPass(unsigned maxBlocks);
+llvm::FunctionPass*		createRegisterForwardingPass();
 llvm::FunctionPass*		createRegisterPointerPromotionPass();
 llvm::FunctionPass*		createSignExtPass();
 llvm::FunctionPass*		createSwitchRemoverPass();
 TargetInfo*				createTargetInfoPass();
 
+// Rewrites of single instructions, shared by the passes that apply them. When the instruction matches, replacement
+// instructions are inserted before it and the value that should replace it is returned; otherwise, nothing is changed
+// and the result is null.
+llvm::Value*			simplifyFlagCondition(llvm::Instruction& inst);
+llvm::Value*			simplifySignExtension(llvm::Instruction& inst);
+
 namespace llvm
 {
 	void initializeAstBackEndPass(PassRegistry& pr);
@@ -0,0 +1,429 @@
+//
+// phase_stats.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "json_string.h"
+#include "metadata.h"
+#include "phase_stats.h"
+#include "trace_events.h"
+
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	RegisterPass<PhaseStatisticsMarker> phaseStatisticsMarker("#phase-stats-marker", "Phase statistics marker", false, true);
+	RegisterPass<FunctionStatisticsMarker> functionStatisticsMarker("#function-stats-marker", "Function statistics marker", false, true);
+	
+	double secondsBetween(PhaseStatistics::clock::time_point begin, PhaseStatistics::clock::time_point end)
+	{
+		return chrono::duration<double>(end - begin).count();
+	}
+	
+	uint64_t peakResidentSetSize()
+	{
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+		{
+			return 0;
+		}
+		
+		uint64_t maxRss = static_cast<uint64_t>(usage.ru_maxrss);
+#ifdef __APPLE__
+		return maxRss; // bytes
+#else
+		return maxRss * 1024; // kilobytes
+#endif
+	}
+	
+	uint64_t residentSetSize()
+	{
+#ifdef __APPLE__
+		mach_task_basic_info info;
+		mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+		if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+		{
+			return 0;
+		}
+		return info.resident_size;
+#else
+		FILE* statm = fopen("/proc/self/statm", "r");
+		if (statm == nullptr)
+		{
+			return 0;
+		}
+		
+		unsigned long long totalPages, residentPages;
+		int matched = fscanf(statm, "%llu %llu", &totalPages, &residentPages);
+		fclose(statm);
+		return matched == 2 ? residentPages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) : 0;
+#endif
+	}
+	
+	// LLVM only prints its statistics as a table. Each statistic line is "<value> <component> - <description>".
+	void printLlvmStatistics(raw_ostream& os)
+	{
+		string table;
+		raw_string_ostream tableStream(table);
+		PrintStatistics(tableStream);
+		tableStream.flush();
+		
+		bool first = true;
+		SmallVector<StringRef, 32> lines;
+		StringRef(table).split(lines, '\n');
+		for (StringRef line : lines)
+		{
+			unsigned long long value;
+			StringRef valueString, rest;
+			tie(valueString, rest) = line.trim().split(' ');
+			if (valueString.getAsInteger(10, value))
+			{
+				continue;
+			}
+			
+			StringRef component, description;
+			tie(component, description) = rest.trim().split(" - ");
+			os << (first ? "\n\t\t" : ",\n\t\t") << "{\"component\": ";
+			printJsonString(os, component.trim());
+			os << ", \"description\": ";
+			printJsonString(os, description.trim());
+			os << ", \"value\": " << value << '}';
+			first = false;
+		}
+		if (!first)
+		{
+			os << "\n\t";
+		}
+	}
+}
+
+PhaseStatistics::PhaseStatistics(string outputPath, size_t reportedFunctions)
+: outputPath(move(outputPath)), reportedFunctions(reportedFunctions), processStart(clock::now()), nextPassSlot(0), inPhase(false)
+{
+	EnableStatistics();
+}
+
+PhaseStatistics::~PhaseStatistics()
+{
+	if (inPhase)
+	{
+		endPhase();
+	}
+	
+	if (outputPath == "-")
+	{
+		printReport(errs());
+		return;
+	}
+	
+	error_code error;
+	raw_fd_ostream output(outputPath, error, sys::fs::F_Text);
+	if (error)
+	{
+		errs() << "can't open " << outputPath << " for writing: " << error.message() << '\n';
+		return;
+	}
+	printReport(output);
+}
+
+void PhaseStatistics::beginPhase(string name)
+{
+	if (inPhase)
+	{
+		endPhase();
+	}
+	
+	phases.emplace_back();
+	phases.back().name = move(name);
+	phaseStart = clock::now();
+	inPhase = true;
+}
+
+void PhaseStatistics::endPhase(const Module* module)
+{
+	assert(inPhase);
+	Phase& phase = phases.back();
+	phase.seconds = secondsBetween(phaseStart, clock::now());
+	phase.peakRss = peakResidentSetSize();
+	phase.endRss = residentSetSize();
+	phase.functions = 0;
+	phase.instructions = 0;
+	if (module != nullptr)
+	{
+		for (const Function& fn : *module)
+		{
+			if (!fn.isDeclaration())
+			{
+				phase.functions++;
+				for (const BasicBlock& bb : fn)
+				{
+					phase.instructions += bb.size();
+				}
+			}
+		}
+	}
+	inPhase = false;
+}
+
+void PhaseStatistics::addTimedPass(legacy::PassManagerBase& pm, Pass* pass)
+{
+	// Module markers between the passes of a function pass manager would split it, so only module passes and call
+	// graph passes get them.
+	const char* name = pass->getPassName();
+	unsigned slot = nextPassSlot++;
+	PassKind kind = pass->getPassKind();
+	if (kind == PT_Module || kind == PT_CallGraphSCC)
+	{
+		pm.add(new PhaseStatisticsMarker(this, slot, nullptr));
+		TraceRecorder::addPass(pm, pass);
+		pm.add(new PhaseStatisticsMarker(this, slot, name));
+	}
+	else
+	{
+		pm.add(new FunctionStatisticsMarker(this, slot, nullptr));
+		TraceRecorder::addPass(pm, pass);
+		pm.add(new FunctionStatisticsMarker(this, slot, name));
+	}
+}
+
+void PhaseStatistics::addPassTime(unsigned slot, const char* name, double seconds)
+{
+	assert(inPhase);
+	PassTiming& timing = phases.back().passes[slot];
+	timing.name = name;
+	timing.seconds += seconds;
+}
+
+void PhaseStatistics::addPassTime(const char* name, double seconds)
+{
+	addPassTime(nextPassSlot++, name, seconds);
+}
+
+void PhaseStatistics::modulePassStarted()
+{
+	modulePassStart = clock::now();
+}
+
+void PhaseStatistics::modulePassFinished(unsigned slot, const char* name)
+{
+	addPassTime(slot, name, secondsBetween(modulePassStart, clock::now()));
+}
+
+uint64_t PhaseStatistics::currentResidentSetSize()
+{
+	return residentSetSize();
+}
+
+void PhaseStatistics::memoryReleased(string what)
+{
+	releases.push_back({move(what), residentSetSize()});
+}
+
+void PhaseStatistics::functionFinished(const Function& fn, double seconds)
+{
+	auto address = md::getVirtualAddress(fn);
+	if (address == nullptr)
+	{
+		return;
+	}
+	
+	size_t instructions = 0;
+	for (const BasicBlock& bb : fn)
+	{
+		instructions += bb.size();
+	}
+	
+	lock_guard<mutex> lock(functionsMutex);
+	FunctionTiming& timing = functions[address->getLimitedValue()];
+	if (timing.name.empty() || !fn.getName().startswith("func_"))
+	{
+		timing.name = fn.getName().str();
+	}
+	timing.seconds += seconds;
+	timing.instructions = max(timing.instructions, instructions);
+	
+	const string& phaseName = phases.empty() ? string() : phases.back().name;
+	if (timing.phases.empty() || timing.phases.back().name != phaseName)
+	{
+		timing.phases.push_back({phaseName, 0});
+	}
+	timing.phases.back().seconds += seconds;
+}
+
+void PhaseStatistics::functionPassStarted()
+{
+	functionPassStart = clock::now();
+}
+
+void PhaseStatistics::functionPassFinished(const Function& fn, unsigned slot, const char* name)
+{
+	double seconds = secondsBetween(functionPassStart, clock::now());
+	functionFinished(fn, seconds);
+	addPassTime(slot, name, seconds);
+}
+
+void PhaseStatistics::printFunctions(raw_ostream& os) const
+{
+	vector<const pair<const uint64_t, FunctionTiming>*> sorted;
+	for (const auto& pair : functions)
+	{
+		sorted.push_back(&pair);
+	}
+	
+	size_t count = min(sorted.size(), reportedFunctions);
+	partial_sort(sorted.begin(), sorted.begin() + count, sorted.end(), [](const pair<const uint64_t, FunctionTiming>* a, const pair<const uint64_t, FunctionTiming>* b)
+	{
+		return a->second.seconds > b->second.seconds || (a->second.seconds == b->second.seconds && a->first < b->first);
+	});
+	
+	for (size_t i = 0; i < count; ++i)
+	{
+		const FunctionTiming& timing = sorted[i]->second;
+		os << (i == 0 ? "\n" : ",\n");
+		os << "\t\t{\"address\": " << sorted[i]->first << ", \"name\": ";
+		printJsonString(os, timing.name);
+		os << ", \"seconds\": " << format("%.6f", timing.seconds);
+		os << ", \"instructions\": " << timing.instructions;
+		os << ", \"phases\": [";
+		for (size_t j = 0; j < timing.phases.size(); ++j)
+		{
+			os << (j == 0 ? "" : ", ") << "{\"name\": ";
+			printJsonString(os, timing.phases[j].name);
+			os << ", \"seconds\": " << format("%.6f", timing.phases[j].seconds) << '}';
+		}
+		os << "]}";
+	}
+	if (count != 0)
+	{
+		os << "\n\t";
+	}
+}
+
+void PhaseStatistics::printReport(raw_ostream& os) const
+{
+	os << "{\n";
+	os << "\t\"seconds\": " << format("%.6f", secondsBetween(processStart, clock::now())) << ",\n";
+	os << "\t\"peak_rss_bytes\": " << peakResidentSetSize() << ",\n";
+	os << "\t\"phases\": [";
+	for (size_t i = 0; i < phases.size(); ++i)
+	{
+		const Phase& phase = phases[i];
+		os << (i == 0 ? "\n" : ",\n");
+		os << "\t\t{\n";
+		os << "\t\t\t\"name\": ";
+		printJsonString(os, phase.name);
+		os << ",\n";
+		os << "\t\t\t\"seconds\": " << format("%.6f", phase.seconds) << ",\n";
+		os << "\t\t\t\"peak_rss_bytes\": " << phase.peakRss << ",\n";
+		os << "\t\t\t\"end_rss_bytes\": " << phase.endRss << ",\n";
+		os << "\t\t\t\"functions\": " << phase.functions << ",\n";
+		os << "\t\t\t\"instructions\": " << phase.instructions << ",\n";
+		os << "\t\t\t\"passes\": [";
+		bool first = true;
+		for (const auto& pair : phase.passes)
+		{
+			const PassTiming& pass = pair.second;
+			os << (first ? "\n" : ",\n") << "\t\t\t\t{\"name\": ";
+			first = false;
+			printJsonString(os, pass.name);
+			os << ", \"seconds\": " << format("%.6f", pass.seconds) << '}';
+		}
+		os << (phase.passes.size() == 0 ? "]\n" : "\n\t\t\t]\n");
+		os << "\t\t}";
+	}
+	os << (phases.size() == 0 ? "],\n" : "\n\t],\n");
+	os << "\t\"releases\": [";
+	for (size_t i = 0; i < releases.size(); ++i)
+	{
+		os << (i == 0 ? "\n" : ",\n") << "\t\t{\"name\": ";
+		printJsonString(os, releases[i].name);
+		os << ", \"rss_bytes\": " << releases[i].rss << '}';
+	}
+	os << (releases.size() == 0 ? "],\n" : "\n\t],\n");
+	os << "\t\"functions\": [";
+	printFunctions(os);
+	os << "],\n";
+	os << "\t\"statistics\": [";
+	printLlvmStatistics(os);
+	os << "]\n";
+	os << "}\n";
+}
+
+char PhaseStatisticsMarker::ID = 0;
+
+const char* PhaseStatisticsMarker::getPassName() const
+{
+	return "Phase statistics marker";
+}
+
+void PhaseStatisticsMarker::getAnalysisUsage(AnalysisUsage& au) const
+{
+	au.setPreservesAll();
+}
+
+bool PhaseStatisticsMarker::runOnModule(Module& module)
+{
+	if (timedPassName == nullptr)
+	{
+		stats->modulePassStarted();
+	}
+	else
+	{
+		stats->modulePassFinished(slot, timedPassName);
+	}
+	return false;
+}
+
+char FunctionStatisticsMarker::ID = 0;
+
+const char* FunctionStatisticsMarker::getPassName() const
+{
+	return "Function statistics marker";
+}
+
+void FunctionStatisticsMarker::getAnalysisUsage(AnalysisUsage& au) const
+{
+	au.setPreservesAll();
+}
+
+bool FunctionStatisticsMarker::runOnFunction(Function& fn)
+{
+	if (timedPassName == nullptr)
+	{
+		stats->functionPassStarted();
+	}
+	else
+	{
+		stats->functionPassFinished(fn, slot, timedPassName);
+	}
+	return false;
+}
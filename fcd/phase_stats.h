@@ -0,0 +1,176 @@
+//
+// phase_stats.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef fcd__phase_stats_h
+#define fcd__phase_stats_h
+
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Collects wall time, peak and final resident set size and module size for each phase of the decompilation, and the time
+// spent in each pass that was added through addTimedPass. The report is written as JSON to the output file when the
+// object is destroyed, along with the LLVM statistics that were collected.
+//
+// Time is also recorded per function (by virtual address) and per phase, for lifting, function passes added through
+// addTimedPass and the AST back end. The report lists the functions that took the most time.
+class PhaseStatistics
+{
+public:
+	typedef std::chrono::steady_clock clock;
+	
+private:
+	struct PassTiming
+	{
+		std::string name;
+		double seconds;
+	};
+	
+	struct Phase
+	{
+		std::string name;
+		double seconds;
+		uint64_t peakRss;
+		uint64_t endRss;
+		size_t functions;
+		size_t instructions;
+		std::map<unsigned, PassTiming> passes; // by the order in which passes were added
+	};
+	
+	struct Release
+	{
+		std::string name;
+		uint64_t rss;
+	};
+	
+	struct FunctionTiming
+	{
+		std::string name;
+		double seconds;
+		size_t instructions; // largest size seen
+		std::vector<PassTiming> phases;
+	};
+	
+	std::string outputPath;
+	size_t reportedFunctions;
+	clock::time_point processStart;
+	clock::time_point phaseStart;
+	unsigned nextPassSlot;
+	clock::time_point modulePassStart;
+	clock::time_point functionPassStart;
+	std::vector<Phase> phases;
+	std::vector<Release> releases;
+	bool inPhase;
+	
+	std::mutex functionsMutex;
+	std::map<uint64_t, FunctionTiming> functions;
+	
+	void addPassTime(unsigned slot, const char* name, double seconds);
+	void printReport(llvm::raw_ostream& os) const;
+	void printFunctions(llvm::raw_ostream& os) const;
+	
+public:
+	// Resident set size of the process right now, or 0 if the system doesn't say.
+	static uint64_t currentResidentSetSize();
+	
+	// An outputPath of "-" writes to stderr. The report lists the reportedFunctions functions that took the most time.
+	PhaseStatistics(std::string outputPath, size_t reportedFunctions);
+	~PhaseStatistics();
+	
+	void beginPhase(std::string name);
+	void endPhase(const llvm::Module* module = nullptr);
+	
+	// Adds a pass to the pass manager and records the time spent in it. Passes that run on parts of functions are
+	// timed on each function by function markers, so that function passes still run one function at a time; module
+	// passes are timed by module markers.
+	void addTimedPass(llvm::legacy::PassManagerBase& pm, llvm::Pass* pass);
+	void addPassTime(const char* name, double seconds);
+	void modulePassStarted();
+	void modulePassFinished(unsigned slot, const char* name);
+	
+	// Records the resident set size right after state that is no longer needed (named by what) was freed.
+	void memoryReleased(std::string what);
+	
+	// Adds time spent on a function to the current phase. Can be called from several threads.
+	void functionFinished(const llvm::Function& fn, double seconds);
+	void functionPassStarted();
+	void functionPassFinished(const llvm::Function& fn, unsigned slot, const char* name);
+};
+
+// Module passes are surrounded by a start and an end marker.
+class PhaseStatisticsMarker : public llvm::ModulePass
+{
+	PhaseStatistics* stats;
+	unsigned slot;
+	const char* timedPassName; // null for start markers
+	
+public:
+	static char ID;
+	
+	PhaseStatisticsMarker(PhaseStatistics* stats, unsigned slot, const char* timedPassName)
+	: llvm::ModulePass(ID), stats(stats), slot(slot), timedPassName(timedPassName)
+	{
+	}
+	
+	virtual const char* getPassName() const override;
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& au) const override;
+	virtual bool runOnModule(llvm::Module& module) override;
+};
+
+// Function passes are surrounded by a start and an end marker, which run right before and after them on every
+// function.
+class FunctionStatisticsMarker : public llvm::FunctionPass
+{
+	PhaseStatistics* stats;
+	unsigned slot;
+	const char* timedPassName; // null for start markers
+	
+public:
+	static char ID;
+	
+	FunctionStatisticsMarker(PhaseStatistics* stats, unsigned slot, const char* timedPassName)
+	: llvm::FunctionPass(ID), stats(stats), slot(slot), timedPassName(timedPassName)
+	{
+	}
+	
+	virtual const char* getPassName() const override;
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& au) const override;
+	virtual bool runOnFunction(llvm::Function& fn) override;
+};
+
+namespace llvm
+{
+	template<>
+	inline Pass *callDefaultCtor<PhaseStatisticsMarker>() { return nullptr; }
+	
+	template<>
+	inline Pass *callDefaultCtor<FunctionStatisticsMarker>() { return nullptr; }
+}
+
+#endif /* fcd__phase_stats_h */
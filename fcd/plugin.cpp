@@ -0,0 +1,56 @@
+//
+// plugin.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "errors.h"
+#include "plugin.h"
+
+#include <llvm/Support/DynamicLibrary.h>
+
+using namespace llvm;
+using namespace std;
+
+ErrorOr<Pass*> createPluginPass(const string& path, string& errorMessage)
+{
+	auto library = sys::DynamicLibrary::getPermanentLibrary(path.c_str(), &errorMessage);
+	if (!library.isValid())
+	{
+		return make_error_code(FcdError::Plugin_LoadError);
+	}
+	
+	auto apiVersion = reinterpret_cast<unsigned (*)()>(library.getAddressOfSymbol("fcdPluginApiVersion"));
+	auto createPass = reinterpret_cast<Pass* (*)()>(library.getAddressOfSymbol("fcdPluginCreatePass"));
+	if (apiVersion == nullptr || createPass == nullptr)
+	{
+		return make_error_code(FcdError::Plugin_MissingEntryPoint);
+	}
+	
+	if (apiVersion() != FCD_PLUGIN_API_VERSION)
+	{
+		return make_error_code(FcdError::Plugin_VersionMismatch);
+	}
+	
+	if (Pass* pass = createPass())
+	{
+		return pass;
+	}
+	return make_error_code(FcdError::Plugin_NoPass);
+}
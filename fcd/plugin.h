@@ -0,0 +1,48 @@
+//
+// plugin.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef fcd__plugin_h
+#define fcd__plugin_h
+
+#include <llvm/Pass.h>
+#include <llvm/Support/ErrorOr.h>
+
+#include <string>
+
+// Native passes for --opt, for what would be too slow as a Python pass. A plugin is a shared object that is built with
+// the same LLVM, fcd headers and compiler flags (-fno-rtti) as fcd, and that names the function creating its pass
+// with FCD_PLUGIN_PASS. fcd exports its symbols, so a plugin pass uses fcd like built-in passes do: it can require
+// ParameterRegistry and ExecutableWrapper, use TargetInfo::getTargetInfo and md:: helpers. A plugin pass that is
+// registered with RegisterPass can also be run on several threads.
+//
+// Plugins are checked against FCD_PLUGIN_API_VERSION, which changes when what plugins can rely on changes.
+#define FCD_PLUGIN_API_VERSION 1
+
+#define FCD_PLUGIN_PASS(createPass) \
+	extern "C" __attribute__((visibility("default"))) unsigned fcdPluginApiVersion() { return FCD_PLUGIN_API_VERSION; } \
+	extern "C" __attribute__((visibility("default"))) llvm::Pass* fcdPluginCreatePass() { return (createPass)(); }
+
+// Loads the plugin at path, which stays loaded until fcd exits, and creates its pass. When the shared object can't be
+// loaded, errorMessage says why.
+llvm::ErrorOr<llvm::Pass*> createPluginPass(const std::string& path, std::string& errorMessage);
+
+#endif /* fcd__plugin_h */
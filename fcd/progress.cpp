@@ -0,0 +1,204 @@
+//
+// progress.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "progress.h"
+
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cassert>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	RegisterPass<ProgressFunctionMarker> progressFunctionMarker("#progress-function-marker", "Progress function marker", false, true);
+	
+	void printDuration(raw_ostream& os, double seconds)
+	{
+		auto total = static_cast<unsigned long long>(seconds);
+		os << format("%02llu:%02llu:%02llu", total / 3600, total / 60 % 60, total % 60);
+	}
+	
+	size_t definedFunctions(const Module& module)
+	{
+		size_t count = 0;
+		for (const Function& fn : module)
+		{
+			if (!fn.isDeclaration())
+			{
+				++count;
+			}
+		}
+		return count;
+	}
+}
+
+ProgressReporter* ProgressReporter::active = nullptr;
+
+void ProgressReporter::addPassMarker(legacy::PassManagerBase& pm, const Pass& pass)
+{
+	if (active != nullptr && pass.getPassKind() == PT_Function)
+	{
+		pm.add(new ProgressFunctionMarker(pass.getPassName()));
+	}
+}
+
+ProgressReporter::ProgressReporter(string outputPath, unsigned intervalSeconds)
+: outputPath(move(outputPath)), interval(max(intervalSeconds, 1u)), processStart(clock::now()), stopping(false), stepPass(nullptr), stepStart(processStart), stepTotal(0), stepDone(0)
+{
+	assert(active == nullptr);
+	active = this;
+	reporter = thread([this]
+	{
+		unique_lock<std::mutex> lock(mutex);
+		while (!wake.wait_for(lock, interval, [this] { return stopping; }))
+		{
+			report();
+		}
+	});
+}
+
+ProgressReporter::~ProgressReporter()
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		phase = "done";
+		step.clear();
+		stepTotal = 0;
+	}
+	wake.notify_one();
+	reporter.join();
+	
+	lock_guard<std::mutex> lock(mutex);
+	report();
+	active = nullptr;
+}
+
+void ProgressReporter::report()
+{
+	// Called with mutex held.
+	auto now = clock::now();
+	string line;
+	raw_string_ostream os(line);
+	os << "fcd: [";
+	printDuration(os, chrono::duration<double>(now - processStart).count());
+	os << "] " << (phase.empty() ? "starting" : phase);
+	if (!step.empty())
+	{
+		size_t done = stepDone;
+		size_t total = stepTotal;
+		double elapsed = chrono::duration<double>(now - stepStart).count();
+		os << ": " << step << ' ' << done;
+		if (total > 0)
+		{
+			os << '/' << total;
+		}
+		os << " functions";
+		if (done > 0 && elapsed > 0)
+		{
+			double rate = done / elapsed;
+			os << format(", %.1f/s", rate);
+			if (total > done)
+			{
+				os << ", ETA ";
+				printDuration(os, (total - done) / rate);
+			}
+		}
+	}
+	os << '\n';
+	os.flush();
+	
+	if (outputPath == "-")
+	{
+		errs() << line;
+		return;
+	}
+	
+	error_code error;
+	raw_fd_ostream file(outputPath, error, sys::fs::F_Text);
+	if (!error)
+	{
+		file << line;
+	}
+}
+
+void ProgressReporter::beginPhase(string name)
+{
+	lock_guard<std::mutex> lock(mutex);
+	phase = move(name);
+	step.clear();
+	stepPass = nullptr;
+}
+
+void ProgressReporter::beginStep(string name, size_t total)
+{
+	lock_guard<std::mutex> lock(mutex);
+	step = move(name);
+	stepPass = nullptr;
+	stepStart = clock::now();
+	stepTotal = total;
+	stepDone = 0;
+}
+
+void ProgressReporter::setTotal(size_t total)
+{
+	size_t current = stepTotal;
+	while (current < total && !stepTotal.compare_exchange_weak(current, total))
+	{
+	}
+}
+
+void ProgressReporter::functionPassFinished(const char* passName, const Function& fn)
+{
+	if (passName != stepPass)
+	{
+		beginStep(passName, definedFunctions(*fn.getParent()));
+		stepPass = passName;
+	}
+	functionFinished();
+}
+
+char ProgressFunctionMarker::ID = 0;
+
+const char* ProgressFunctionMarker::getPassName() const
+{
+	return "Progress function marker";
+}
+
+void ProgressFunctionMarker::getAnalysisUsage(AnalysisUsage& au) const
+{
+	au.setPreservesAll();
+}
+
+bool ProgressFunctionMarker::runOnFunction(Function& fn)
+{
+	if (ProgressReporter* reporter = ProgressReporter::getActive())
+	{
+		reporter->functionPassFinished(passName, fn);
+	}
+	return false;
+}
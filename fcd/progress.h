@@ -0,0 +1,122 @@
+//
+// progress.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef fcd__progress_h
+#define fcd__progress_h
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Pass.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Reports what a long decompilation is doing every few seconds, from a thread of its own: the phase, the step of the
+// phase (lifting, a function pass, structuring), how many functions the step is done with out of how many, the rate
+// and an estimated time until the step is done. Reports go to stderr, or replace the contents of a status file.
+//
+// Like TraceRecorder, there is at most one reporter at a time, reachable through getActive(), so that lifting and back
+// end workers can count functions without being handed the reporter.
+class ProgressReporter
+{
+public:
+	typedef std::chrono::steady_clock clock;
+	
+private:
+	static ProgressReporter* active;
+	
+	std::string outputPath;
+	std::chrono::seconds interval;
+	clock::time_point processStart;
+	
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+	std::string phase;
+	std::string step;
+	const char* stepPass;
+	clock::time_point stepStart;
+	std::atomic<size_t> stepTotal;
+	std::atomic<size_t> stepDone;
+	std::thread reporter;
+	
+	void report();
+	
+public:
+	static ProgressReporter* getActive() { return active; }
+	
+	// For forked children, which don't have the reporter thread, and whose copy of the lock may have been held by it.
+	static void detachFromChild() { active = nullptr; }
+	
+	// Adds a marker after function passes that counts the functions that pass is done with. The marker must come
+	// after every other pass that wraps pass.
+	static void addPassMarker(llvm::legacy::PassManagerBase& pm, const llvm::Pass& pass);
+	
+	// The reporter becomes the active one until it is destroyed. An outputPath of "-" reports to stderr.
+	ProgressReporter(std::string outputPath, unsigned intervalSeconds);
+	~ProgressReporter();
+	
+	void beginPhase(std::string name);
+	
+	// Steps start over the function count. A total of 0 means that it isn't known.
+	void beginStep(std::string name, size_t total);
+	
+	// Totals only grow, since lifting discovers functions as it goes.
+	void setTotal(size_t total);
+	
+	// Can be called from several threads.
+	void functionFinished() { ++stepDone; }
+	size_t getFunctionsDone() const { return stepDone; }
+	
+	// Called by pass markers. Begins a step for the pass the first time that it finishes a function.
+	void functionPassFinished(const char* passName, const llvm::Function& fn);
+};
+
+class ProgressFunctionMarker : public llvm::FunctionPass
+{
+	const char* passName;
+	
+public:
+	static char ID;
+	
+	explicit ProgressFunctionMarker(const char* passName)
+	: llvm::FunctionPass(ID), passName(passName)
+	{
+	}
+	
+	virtual const char* getPassName() const override;
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& au) const override;
+	virtual bool runOnFunction(llvm::Function& fn) override;
+};
+
+namespace llvm
+{
+	template<>
+	inline Pass *callDefaultCtor<ProgressFunctionMarker>() { return nullptr; }
+}
+
+#endif /* fcd__progress_h */
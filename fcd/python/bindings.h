@@ -36,6 +36,12 @@ struct Py_LLVM_Wrapped
 
 PyMODINIT_FUNC initLlvmModule(PyObject** module);
 
+// Returns a new reference to the wrapper of ref. Wrappers are cached, so that walking over the same values again
+// doesn't allocate, until the cache is cleared. Clear it once LLVM objects may have been deleted, since a new object
+// could get the address of a deleted one. Bound methods that delete objects clear it themselves.
+PyObject* wrapLLVMObject(PyTypeObject& type, void* ref);
+void clearLLVMWrapperCache();
+
 extern PyTypeObject Py_LLVMUse_Type;
 extern PyTypeObject Py_LLVMModuleProvider_Type;
 extern PyTypeObject Py_LLVMBuilder_Type;
@@ -302,8 +302,54 @@ print
 print "#include \"bindings.h\""
 print "#include <llvm-c/Core.h>"
 print "#include <memory>"
+print "#include <unordered_map>"
+print "#include <utility>"
 print
 
+# Every LLVM reference that goes back to Python goes through wrapLLVMObject, so that a reference gets the same wrapper
+# for as long as the cache lives. Methods that delete LLVM objects clear the cache (see deletesObjects), since a new
+# object could otherwise get the wrapper of a deleted object that had the same address.
+print """namespace
+{
+	struct WrapperKeyHash
+	{
+		size_t operator()(const std::pair<PyTypeObject*, void*>& key) const
+		{
+			return std::hash<void*>()(key.first) ^ std::hash<void*>()(key.second);
+		}
+	};
+	
+	std::unordered_map<std::pair<PyTypeObject*, void*>, AutoPyObject, WrapperKeyHash> wrapperCache;
+}
+
+PyObject* wrapLLVMObject(PyTypeObject& type, void* ref)
+{
+	AutoPyObject& wrapper = wrapperCache[std::make_pair(&type, ref)];
+	if (!wrapper)
+	{
+		auto object = PyObject_New(Py_LLVM_Wrapped<void*>, &type);
+		if (object == nullptr)
+		{
+			wrapperCache.erase(std::make_pair(&type, ref));
+			return nullptr;
+		}
+		object->obj = ref;
+		wrapper.reset((PyObject*)object);
+	}
+	Py_INCREF(wrapper.get());
+	return wrapper.get();
+}
+
+void clearLLVMWrapperCache()
+{
+	wrapperCache.clear();
+}
+"""
+
+# Deleting a function or a block also deletes what it contains, so these clear the whole cache.
+def deletesObjects(functionName):
+	return "Delete" in functionName or "Dispose" in functionName or functionName.endswith("EraseFromParent")
+
 methodNoArgsPrototypeTemplate = """static PyObject* %s(Py_LLVM_Wrapped<%s>* self)"""
 methodArgsPrototypeTemplate = """static PyObject* %s(Py_LLVM_Wrapped<%s>* self, PyObject* args)"""
 
@@ -325,6 +371,73 @@ typeObjectTemplate = """PyTypeObject %s_Type = {
 methodImplementations = ""
 prefix = "Py_"
 
+#
+# Hand-written methods that walk lists on the C side and return them as a single Python list, which is much cheaper
+# than a round trip through the bindings for every element.
+#
+
+listMethodTemplate = """static PyObject* %(cName)s(Py_LLVM_Wrapped<%(selfType)s>* self)
+{
+%(check)s	auto list = TAKEREF PyList_New(0);
+	for (%(loop)s)
+	{
+		auto wrapped = TAKEREF wrapLLVMObject(%(elementType)s, %(element)s);
+		if (!wrapped || PyList_Append(list.get(), wrapped.get()) < 0)
+		{
+			return nullptr;
+		}
+	}
+	return list.release();
+}
+
+"""
+
+listMethodTableEntryTemplate = """\t{"%s", (PyCFunction)&%s, METH_NOARGS, "Returns the %s as a list"},\n"""
+
+functionCheck = """	if (LLVMIsAFunction(self->obj) == nullptr)
+	{
+		PyErr_SetString(PyExc_TypeError, "value is not a function");
+		return nullptr;
+	}
+"""
+
+class ListMethod(object):
+	def __init__(self, name, doc, loop, elementType, element, check = ""):
+		self.name = name
+		self.doc = doc
+		self.loop = loop
+		self.elementType = elementType
+		self.element = element
+		self.check = check
+
+listMethods = {
+	"Module": [
+		ListMethod("GetFunctionList", "functions of a module",
+			"LLVMValueRef fn = LLVMGetFirstFunction(self->obj); fn != nullptr; fn = LLVMGetNextFunction(fn)",
+			"Value", "fn"),
+	],
+	"BasicBlock": [
+		ListMethod("GetInstructionList", "instructions of a basic block",
+			"LLVMValueRef inst = LLVMGetFirstInstruction(self->obj); inst != nullptr; inst = LLVMGetNextInstruction(inst)",
+			"Value", "inst"),
+	],
+	"Value": [
+		ListMethod("GetBasicBlockList", "basic blocks of a function",
+			"LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock(self->obj); bb != nullptr; bb = LLVMGetNextBasicBlock(bb)",
+			"BasicBlock", "bb", functionCheck),
+		ListMethod("GetInstructionList", "instructions of a function",
+			"LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock(self->obj); bb != nullptr; bb = LLVMGetNextBasicBlock(bb))\n" +
+			"\tfor (LLVMValueRef inst = LLVMGetFirstInstruction(bb); inst != nullptr; inst = LLVMGetNextInstruction(inst)",
+			"Value", "inst", functionCheck),
+		ListMethod("GetUseList", "uses of a value",
+			"LLVMUseRef use = LLVMGetFirstUse(self->obj); use != nullptr; use = LLVMGetNextUse(use)",
+			"Use", "use"),
+		ListMethod("GetUserList", "users of a value",
+			"LLVMUseRef use = LLVMGetFirstUse(self->obj); use != nullptr; use = LLVMGetNextUse(use)",
+			"Value", "LLVMGetUser(use)"),
+	],
+}
+
 for classKey in classes:
 	klass = classes[classKey]
 	llvmName = "LLVM%sRef" % classKey
@@ -417,16 +530,13 @@ for classKey in classes:
 			returnedExpression = "%s(%s)" % (method.function.name, ", ".join(cParams))
 		
 		if method.returnType.type == "object":
-			returnTypeString = "Py_LLVM_Wrapped<LLVM%sRef>" % method.returnType.generic
 			objectType = "%sLLVM%s_Type" % (prefix, method.returnType.generic)
 			methodImplementations += "\tauto callReturn = %s;\n" % returnedExpression
 			methodImplementations += "\tif (callReturn == nullptr)\n"
 			methodImplementations += "\t{\n"
 			methodImplementations += "\t\tPy_RETURN_NONE;\n"
 			methodImplementations += "\t}\n"
-			methodImplementations += "\t%s* result = PyObject_New(%s, &%s);\n" % (returnTypeString, returnTypeString, objectType)
-			methodImplementations += "\tresult->obj = callReturn;\n"
-			methodImplementations += "\treturn (PyObject*)result;\n"
+			methodImplementations += "\treturn wrapLLVMObject(%s, callReturn);\n" % objectType
 		elif method.returnType.type == "string":
 			methodImplementations += "\treturn PyString_FromString(%s);\n" % returnedExpression
 		elif method.returnType.type == "int":
@@ -435,10 +545,27 @@ for classKey in classes:
 			methodImplementations += "\treturn PyBool_FromLong(%s);\n" % returnedExpression
 		elif method.returnType.type == "void":
 			methodImplementations += "\t%s;\n" % returnedExpression
+			if deletesObjects(method.function.name):
+				methodImplementations += "\tclearLLVMWrapperCache();\n"
 			methodImplementations += "\tPy_RETURN_NONE;\n"
 		else:
 			methodImplementations += "#error Implement return type %s" % method.returnType.type
 		methodImplementations += "}\n\n"
+	
+	for method in listMethods.get(classKey, []):
+		sys.stderr.write("\tdef %s() -> list\n" % method.name)
+		methodCName = "%s_%s" % (typeName, method.name)
+		prototype = methodNoArgsPrototypeTemplate % (methodCName, llvmName)
+		print prototype + ";"
+		tableEntries += listMethodTableEntryTemplate % (method.name, methodCName, method.doc)
+		methodImplementations += listMethodTemplate % {
+			"cName": methodCName,
+			"selfType": llvmName,
+			"check": method.check,
+			"loop": method.loop,
+			"elementType": "%sLLVM%s_Type" % (prefix, method.elementType),
+			"element": method.element,
+		}
 	print
 	
 	sys.stderr.write("\n")
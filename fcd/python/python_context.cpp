@@ -55,6 +55,7 @@ namespace
 			Py_INCREF(object); // account for ref that PyTuple is about to steal
 			PyTuple_SET_ITEM(tupleArg.get(), 0, object);
 			auto callResult = TAKEREF PyObject_CallObject(run.get(), tupleArg.get());
+			clearLLVMWrapperCache();
 			
 			if (PyErr_Occurred() != nullptr)
 			{
@@ -83,8 +84,7 @@ namespace
 		
 		virtual bool runOnModule(Module& m) override
 		{
-			auto pyModuleObject = TAKEREF Py_LLVMModule_Type.tp_alloc(&Py_LLVMModule_Type, 0);
-			((Py_LLVM_Wrapped<LLVMModuleRef>*)pyModuleObject.get())->obj = wrap(&m);
+			auto pyModuleObject = TAKEREF wrapLLVMObject(Py_LLVMModule_Type, wrap(&m));
 			return runWithObject(pyModuleObject.get());
 		}
 	};
@@ -105,9 +105,8 @@ namespace
 		
 		virtual bool runOnFunction(Function& fn) override
 		{
-			auto pyModuleObject = TAKEREF Py_LLVMValue_Type.tp_alloc(&Py_LLVMValue_Type, 0);
-			((Py_LLVM_Wrapped<LLVMValueRef>*)pyModuleObject.get())->obj = wrap(&fn);
-			return runWithObject(pyModuleObject.get());
+			auto pyFunctionObject = TAKEREF wrapLLVMObject(Py_LLVMValue_Type, wrap(&fn));
+			return runWithObject(pyFunctionObject.get());
 		}
 	};
 	
@@ -127,6 +126,11 @@ void dump(PyObject* obj)
 #endif
 
 #pragma mark - Implementation
+bool PythonContext::isPythonPass(const Pass& pass)
+{
+	return pass.getPassID() == &PythonWrappedModule::ID || pass.getPassID() == &PythonWrappedFunction::ID;
+}
+
 PythonContext::PythonContext(const string& programPath)
 {
 	unique_ptr<char, decltype(free)&> mutableName(strdup(programPath.c_str()), free);
@@ -206,6 +210,7 @@ ErrorOr<Pass*> PythonContext::createPass(const std::string &path)
 
 PythonContext::~PythonContext()
 {
+	clearLLVMWrapperCache();
 	Py_Finalize();
 }
 
@@ -36,6 +36,9 @@ class PythonContext
 	_object* llvmModule;
 	
 public:
+	// Python passes can't be instantiated again from their PassInfo.
+	static bool isPythonPass(const llvm::Pass& pass);
+	
 	PythonContext(const std::string& programPath);
 	~PythonContext();
 	
@@ -0,0 +1,78 @@
+//
+// rooted_post_dom_tree.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "passes.h"
+#include "rooted_post_dom_tree.h"
+
+using namespace llvm;
+using namespace std;
+
+void RootedPostDominatorTree::recalculateWithRoots(Function& fn, const SmallVectorImpl<BasicBlock*>& roots)
+{
+	reset();
+	Vertex.push_back(nullptr);
+	for (BasicBlock* bb : roots)
+	{
+		assert(bb->getParent() == &fn);
+		addRoot(bb);
+	}
+	Calculate<Function, Inverse<BasicBlock*>>(*this, fn);
+}
+
+void RootedPostDominatorTree::treeFromIncompleteTree(Function& fn, unique_ptr<DominatorTreeBase<BasicBlock>>& postDomTree)
+{
+	SmallVector<BasicBlock*, 1> roots;
+	// Find loops, check if they have a node in the existing post-dominator tree. If not, we need a new tree.
+	auto loops = SESELoop::findBackEdgeDestinations(fn.getEntryBlock());
+	
+	// According to this Chris Dodd person, you get an okay post-dominator tree just by picking missing
+	// nodes at random. Let's see how that works.
+	// http://stackoverflow.com/a/35400454/251153
+	for (const auto& pair : loops)
+	{
+		if (postDomTree->getNode(pair.first) == nullptr)
+		{
+			roots.push_back(pair.first);
+		}
+	}
+	
+	if (roots.size() != 0)
+	{
+		// add the tree's original roots too (in case it had any)
+		const auto& originalRoots = postDomTree->getRoots();
+		roots.insert(roots.end(), originalRoots.begin(), originalRoots.end());
+		
+		auto result = std::make_unique<RootedPostDominatorTree>();
+		result->recalculateWithRoots(fn, roots);
+		postDomTree = move(result);
+	}
+}
+
+BasicBlock* postDominatorOf(DominatorTreeBase<BasicBlock>& postDomTree, BasicBlock& bb)
+{
+	if (auto node = postDomTree.getNode(&bb))
+	if (auto idom = node->getIDom())
+	{
+		return idom->getBlock();
+	}
+	return nullptr;
+}
@@ -0,0 +1,51 @@
+//
+// rooted_post_dom_tree.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+// 
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef fcd__rooted_post_dom_tree_h
+#define fcd__rooted_post_dom_tree_h
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+
+#include <memory>
+
+// This is a fairly nasty hack that hinges on protected members of DominatorTreeBase.
+// We need it because the post-dominator tree can't find roots on a function with an endless loop.
+class RootedPostDominatorTree : public llvm::DominatorTreeBase<llvm::BasicBlock>
+{
+public:
+	RootedPostDominatorTree()
+	: llvm::DominatorTreeBase<llvm::BasicBlock>(true)
+	{
+	}
+	
+	void recalculateWithRoots(llvm::Function& fn, const llvm::SmallVectorImpl<llvm::BasicBlock*>& roots);
+	
+	// Replaces postDomTree with a rooted tree if it is missing the blocks of endless loops.
+	static void treeFromIncompleteTree(llvm::Function& fn, std::unique_ptr<llvm::DominatorTreeBase<llvm::BasicBlock>>& postDomTree);
+};
+
+// The immediate post-dominator of bb, or null if it has none.
+llvm::BasicBlock* postDominatorOf(llvm::DominatorTreeBase<llvm::BasicBlock>& postDomTree, llvm::BasicBlock& bb);
+
+#endif /* fcd__rooted_post_dom_tree_h */
@@ -32,6 +32,39 @@
 using namespace llvm;
 using namespace std;
 
+TargetRegisterIndex::TargetRegisterIndex(const vector<TargetRegisterInfo>& registers)
+: registers(registers)
+{
+	// Registers are sorted by offset, and each one is followed by the registers that it overlaps. When several
+	// registers share an ID or a location, the first one wins.
+	for (size_t i = 0; i < registers.size(); ++i)
+	{
+		const TargetRegisterInfo& info = registers[i];
+		if (info.registerId >= byId.size())
+		{
+			byId.resize(info.registerId + 1);
+		}
+		if (byId[info.registerId] == nullptr)
+		{
+			byId[info.registerId] = &info;
+		}
+		byOffsetAndSize.insert({offsetAndSizeKey(info.offset, info.size), &info});
+		byName.insert({info.name, &info});
+	}
+	
+	largestOverlapping.resize(registers.size());
+	size_t i = 0;
+	while (i < registers.size())
+	{
+		const TargetRegisterInfo& current = registers[i];
+		while (i < registers.size() && registers[i].offset < current.offset + current.size)
+		{
+			largestOverlapping[i] = &current;
+			++i;
+		}
+	}
+}
+
 unique_ptr<TargetInfo> TargetInfo::getTargetInfo(const Module& module)
 {
 	Triple triple(module.getTargetTriple());
@@ -48,23 +81,7 @@ unique_ptr<TargetInfo> TargetInfo::getTargetInfo(const Module& module)
 
 GetElementPtrInst* TargetInfo::getRegister(llvm::Value *registerStruct, const TargetRegisterInfo& info) const
 {
-	const auto& largest = largestOverlappingRegister(info);
-	
-	const TargetRegisterInfo* selected = nullptr;
-	for (const auto& targetReg : targetRegisterInfo())
-	{
-		if (&targetReg == &largest)
-		{
-			selected = &targetReg;
-			break;
-		}
-	}
-	
-	if (selected == nullptr)
-	{
-		return nullptr;
-	}
-	
+	const TargetRegisterInfo* selected = &largestOverlappingRegister(info);
 	SmallVector<Value*, 4> indices;
 	LLVMContext& ctx = registerStruct->getContext();
 	IntegerType* int32 = Type::getInt32Ty(ctx);
@@ -79,18 +96,6 @@ GetElementPtrInst* TargetInfo::getRegister(llvm::Value *registerStruct, const Ta
 	return GetElementPtrInst::CreateInBounds(registerStruct, indices);
 }
 
-const TargetRegisterInfo* TargetInfo::registerInfo(unsigned int registerId) const
-{
-	for (const auto& info : targetRegisterInfo())
-	{
-		if (info.registerId == registerId)
-		{
-			return &info;
-		}
-	}
-	return nullptr;
-}
-
 const TargetRegisterInfo* TargetInfo::registerInfo(const Value& value) const
 {
 	if (auto castInst = dyn_cast<CastInst>(&value))
@@ -118,39 +123,3 @@ const TargetRegisterInfo* TargetInfo::registerInfo(const GetElementPtrInst &gep)
 	}
 	return nullptr;
 }
-
-const TargetRegisterInfo* TargetInfo::registerInfo(size_t offset, size_t size) const
-{
-	for (const auto& info : targetRegisterInfo())
-	{
-		if (info.offset == offset && info.size == size)
-		{
-			return &info;
-		}
-		
-		if (info.offset > offset)
-		{
-			break;
-		}
-	}
-	return nullptr;
-}
-
-const TargetRegisterInfo& TargetInfo::largestOverlappingRegister(const TargetRegisterInfo& overlapped) const
-{
-	auto iter = targetRegisterInfo().begin();
-	auto end = targetRegisterInfo().end();
-	while (iter != end)
-	{
-		const auto& currentTarget = *iter;
-		while (iter->offset < currentTarget.offset + currentTarget.size)
-		{
-			if (&*iter == &overlapped)
-			{
-				return currentTarget;
-			}
-			iter++;
-		}
-	}
-	llvm_unreachable("Missing register in largestOverlappingRegister?!");
-}
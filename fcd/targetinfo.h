@@ -23,6 +23,8 @@
 #define fcd__targetinfo_h
 
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/Instructions.h>
 
@@ -40,15 +42,65 @@ struct TargetRegisterInfo
 	unsigned registerId;
 };
 
+// Lookup tables over a target's register list. Register lists are static, and so is their index: it is built once
+// per target rather than once per TargetInfo.
+class TargetRegisterIndex
+{
+	const std::vector<TargetRegisterInfo>& registers;
+	std::vector<const TargetRegisterInfo*> byId;
+	llvm::DenseMap<uint64_t, const TargetRegisterInfo*> byOffsetAndSize;
+	llvm::StringMap<const TargetRegisterInfo*> byName;
+	std::vector<const TargetRegisterInfo*> largestOverlapping;
+	
+	static uint64_t offsetAndSizeKey(size_t offset, size_t size)
+	{
+		return (static_cast<uint64_t>(offset) << 32) | size;
+	}
+	
+public:
+	explicit TargetRegisterIndex(const std::vector<TargetRegisterInfo>& registers);
+	
+	const std::vector<TargetRegisterInfo>& getRegisters() const { return registers; }
+	
+	const TargetRegisterInfo* registerWithId(unsigned registerId) const
+	{
+		return registerId < byId.size() ? byId[registerId] : nullptr;
+	}
+	
+	const TargetRegisterInfo* registerAt(size_t offset, size_t size) const
+	{
+		auto iter = byOffsetAndSize.find(offsetAndSizeKey(offset, size));
+		return iter == byOffsetAndSize.end() ? nullptr : iter->second;
+	}
+	
+	const TargetRegisterInfo* registerNamed(llvm::StringRef name) const
+	{
+		auto iter = byName.find(name);
+		return iter == byName.end() ? nullptr : iter->second;
+	}
+	
+	size_t slotOf(const TargetRegisterInfo& reg) const
+	{
+		size_t slot = static_cast<size_t>(&reg - registers.data());
+		assert(slot < registers.size());
+		return slot;
+	}
+	
+	const TargetRegisterInfo& largestOverlappingRegister(const TargetRegisterInfo& overlapped) const
+	{
+		return *largestOverlapping[slotOf(overlapped)];
+	}
+};
+
 class TargetInfo
 {
 	std::string name;
 	size_t spIndex;
-	const std::vector<TargetRegisterInfo>* targetRegInfo;
+	const TargetRegisterIndex* registerIndex;
 	const llvm::DataLayout* dl;
 	
 	TargetInfo()
-	: spIndex(std::numeric_limits<size_t>::max()), targetRegInfo(nullptr), dl(nullptr)
+	: spIndex(std::numeric_limits<size_t>::max()), registerIndex(nullptr), dl(nullptr)
 	{
 	}
 
@@ -57,13 +109,13 @@ public:
 	
 	inline const std::vector<TargetRegisterInfo>& targetRegisterInfo() const
 	{
-		assert(targetRegInfo != nullptr);
-		return *targetRegInfo;
+		assert(registerIndex != nullptr);
+		return registerIndex->getRegisters();
 	}
 	
-	inline void setTargetRegisterInfo(const std::vector<TargetRegisterInfo>& targetRegInfo)
+	inline void setTargetRegisterInfo(const TargetRegisterIndex& registerIndex)
 	{
-		this->targetRegInfo = &targetRegInfo;
+		this->registerIndex = &registerIndex;
 	}
 	
 	inline std::string& targetName()
@@ -83,23 +135,34 @@ public:
 	
 	inline const TargetRegisterInfo* registerNamed(const char* name) const
 	{
-		for (const auto& regInfo : targetRegisterInfo())
-		{
-			if (regInfo.name == name)
-			{
-				return &regInfo;
-			}
-		}
-		return nullptr;
+		return registerIndex->registerNamed(name);
 	}
 	
 	llvm::GetElementPtrInst* getRegister(llvm::Value* registerStruct, const TargetRegisterInfo& info) const;
 	
-	const TargetRegisterInfo* registerInfo(unsigned registerId) const;
+	const TargetRegisterInfo* registerInfo(unsigned registerId) const
+	{
+		return registerIndex->registerWithId(registerId);
+	}
+	
+	const TargetRegisterInfo* registerInfo(size_t offset, size_t size) const
+	{
+		return registerIndex->registerAt(offset, size);
+	}
+	
+	const TargetRegisterInfo& largestOverlappingRegister(const TargetRegisterInfo& overlapped) const
+	{
+		return registerIndex->largestOverlappingRegister(overlapped);
+	}
+	
+	// Position of a register in targetRegisterInfo(), for containers that are indexed by register.
+	size_t registerSlot(const TargetRegisterInfo& reg) const
+	{
+		return registerIndex->slotOf(reg);
+	}
+	
 	const TargetRegisterInfo* registerInfo(const llvm::Value& value) const;
 	const TargetRegisterInfo* registerInfo(const llvm::GetElementPtrInst& value) const;
-	const TargetRegisterInfo* registerInfo(size_t offset, size_t size) const;
-	const TargetRegisterInfo& largestOverlappingRegister(const TargetRegisterInfo& overlapped) const;
 	
 	inline void setStackPointer(const TargetRegisterInfo& targetReg)
 	{
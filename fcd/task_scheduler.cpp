@@ -0,0 +1,227 @@
+//
+// task_scheduler.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "task_scheduler.h"
+
+#include <cassert>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	// Worker of the scheduler that the current thread is running a task for, so that tasks added from tasks go to
+	// that worker's deque.
+	thread_local const TaskScheduler* currentScheduler = nullptr;
+	thread_local unsigned currentWorker = 0;
+}
+
+TaskScheduler::TaskScheduler(unsigned jobs)
+: jobs(jobs), queues(new WorkerQueue[jobs]), unfinished(0), readyCount(0), nextQueue(0), stopping(false)
+{
+	assert(jobs > 0);
+	for (unsigned i = 1; i < jobs; ++i)
+	{
+		threads.emplace_back(&TaskScheduler::work, this, i);
+	}
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		lock_guard<mutex> lock(stateMutex);
+		stopping = true;
+	}
+	stateChanged.notify_all();
+	for (thread& worker : threads)
+	{
+		worker.join();
+	}
+}
+
+void TaskScheduler::pushReady(unsigned worker, TaskId id)
+{
+	{
+		lock_guard<mutex> lock(queues[worker].mutex);
+		queues[worker].ready.push_back(id);
+	}
+	{
+		lock_guard<mutex> lock(stateMutex);
+		++readyCount;
+	}
+	stateChanged.notify_one();
+}
+
+bool TaskScheduler::popReady(unsigned worker, TaskId& id)
+{
+	// Newest first from our own deque, oldest first from the others.
+	for (unsigned i = 0; i < jobs; ++i)
+	{
+		WorkerQueue& queue = queues[(worker + i) % jobs];
+		lock_guard<mutex> lock(queue.mutex);
+		if (!queue.ready.empty())
+		{
+			if (i == 0)
+			{
+				id = queue.ready.back();
+				queue.ready.pop_back();
+			}
+			else
+			{
+				id = queue.ready.front();
+				queue.ready.pop_front();
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+bool TaskScheduler::takeTask(unsigned worker, TaskId& id, bool untilIdle)
+{
+	while (true)
+	{
+		if (popReady(worker, id))
+		{
+			lock_guard<mutex> lock(stateMutex);
+			--readyCount;
+			return true;
+		}
+
+		unique_lock<mutex> lock(stateMutex);
+		stateChanged.wait(lock, [&]
+		{
+			return stopping || readyCount > 0 || (untilIdle && unfinished == 0);
+		});
+
+		if (readyCount == 0)
+		{
+			return false;
+		}
+	}
+}
+
+void TaskScheduler::runTask(unsigned worker, TaskId id)
+{
+	Task task;
+	{
+		lock_guard<mutex> lock(stateMutex);
+		task = move(nodes[id].task);
+	}
+
+	currentScheduler = this;
+	currentWorker = worker;
+	task(worker);
+	currentScheduler = nullptr;
+
+	SmallVector<TaskId, 2> madeReady;
+	bool done;
+	{
+		lock_guard<mutex> lock(stateMutex);
+		TaskNode& node = nodes[id];
+		node.finished = true;
+		for (TaskId dependent : node.dependents)
+		{
+			if (--nodes[dependent].pendingDependencies == 0)
+			{
+				madeReady.push_back(dependent);
+			}
+		}
+		done = --unfinished == 0;
+	}
+
+	for (TaskId dependent : madeReady)
+	{
+		pushReady(worker, dependent);
+	}
+
+	if (done)
+	{
+		stateChanged.notify_all();
+	}
+}
+
+void TaskScheduler::work(unsigned worker)
+{
+	TaskId id;
+	while (takeTask(worker, id, false))
+	{
+		runTask(worker, id);
+	}
+}
+
+TaskScheduler::TaskId TaskScheduler::add(Task task, ArrayRef<TaskId> dependencies)
+{
+	TaskId id;
+	bool ready;
+	unsigned worker;
+	{
+		lock_guard<mutex> lock(stateMutex);
+		id = nodes.size();
+		nodes.emplace_back();
+		TaskNode& node = nodes.back();
+		node.task = move(task);
+		node.pendingDependencies = 0;
+		node.finished = false;
+		for (TaskId dependency : dependencies)
+		{
+			assert(dependency < id);
+			if (!nodes[dependency].finished)
+			{
+				nodes[dependency].dependents.push_back(id);
+				++node.pendingDependencies;
+			}
+		}
+		++unfinished;
+
+		ready = node.pendingDependencies == 0;
+		if (currentScheduler == this)
+		{
+			worker = currentWorker;
+		}
+		else
+		{
+			// Spread tasks that are added up front over every worker, so that they don't all start by stealing.
+			worker = nextQueue;
+			nextQueue = (nextQueue + 1) % jobs;
+		}
+	}
+
+	if (ready)
+	{
+		pushReady(worker, id);
+	}
+	return id;
+}
+
+void TaskScheduler::run()
+{
+	TaskId id;
+	while (takeTask(0, id, true))
+	{
+		runTask(0, id);
+	}
+
+	lock_guard<mutex> lock(stateMutex);
+	assert(unfinished == 0 && readyCount == 0);
+	nodes.clear();
+	nextQueue = 0;
+}
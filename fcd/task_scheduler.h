@@ -0,0 +1,101 @@
+//
+// task_scheduler.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef fcd__task_scheduler_h
+#define fcd__task_scheduler_h
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads that every parallel phase shares, so that threads (and the chunks that DumbAllocator caches for
+// them) survive from one phase to the next. Tasks run once the tasks that they depend on have finished. Each worker
+// has a deque of tasks that are ready: it runs the newest one from its own deque, and when that is empty, it steals
+// the oldest one from another worker. The tasks that a finished task makes ready go to the deque of the worker that
+// ran it, so that dependent work tends to stay on the same core.
+//
+// Tasks receive the index of the worker that runs them, which is less than getJobCount(). Worker 0 is the thread
+// that calls run(). State that can't be shared between threads, like an LLVMContext or a DumbAllocator, can be kept
+// in a slot per worker. Which worker runs a task depends on scheduling, so results that must be deterministic should
+// go to a slot that belongs to the task, and be merged in task order once run() returns.
+class TaskScheduler
+{
+public:
+	typedef size_t TaskId;
+	typedef std::function<void(unsigned worker)> Task;
+
+private:
+	struct TaskNode
+	{
+		Task task;
+		unsigned pendingDependencies;
+		bool finished;
+		llvm::SmallVector<TaskId, 2> dependents;
+	};
+
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<TaskId> ready;
+	};
+
+	unsigned jobs;
+	std::unique_ptr<WorkerQueue[]> queues;
+	std::vector<std::thread> threads;
+
+	std::mutex stateMutex;
+	std::condition_variable stateChanged;
+	std::deque<TaskNode> nodes;
+	size_t unfinished;
+	size_t readyCount;
+	unsigned nextQueue;
+	bool stopping;
+
+	void pushReady(unsigned worker, TaskId id);
+	bool popReady(unsigned worker, TaskId& id);
+	bool takeTask(unsigned worker, TaskId& id, bool untilIdle);
+	void runTask(unsigned worker, TaskId id);
+	void work(unsigned worker);
+
+public:
+	// With a single job, no thread is started and run() executes every task on the calling thread.
+	explicit TaskScheduler(unsigned jobs);
+	~TaskScheduler();
+
+	unsigned getJobCount() const { return jobs; }
+
+	// Adds a task that becomes ready once every task in dependencies has finished. Tasks can be added before run(), or
+	// by running tasks. Task IDs are only valid until run() returns.
+	TaskId add(Task task, llvm::ArrayRef<TaskId> dependencies = llvm::None);
+
+	// Runs tasks until every task that was added, including the ones that tasks add, has finished.
+	void run();
+};
+
+#endif /* fcd__task_scheduler_h */
@@ -0,0 +1,257 @@
+//
+// trace_events.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "json_string.h"
+#include "metadata.h"
+#include "trace_events.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+
+#include <atomic>
+#include <cassert>
+#include <cinttypes>
+#include <unistd.h>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	RegisterPass<TraceModuleMarker> traceModuleMarker("#trace-module-marker", "Trace module marker", false, true);
+	RegisterPass<TraceFunctionMarker> traceFunctionMarker("#trace-function-marker", "Trace function marker", false, true);
+
+	atomic<unsigned> nextThreadId(0);
+
+	// Start times of the traced passes that are running on this thread. Markers of nested pass managers nest too.
+	thread_local vector<TraceRecorder::clock::time_point> openPasses;
+
+	long long microsecondsBetween(TraceRecorder::clock::time_point begin, TraceRecorder::clock::time_point end)
+	{
+		return chrono::duration_cast<chrono::microseconds>(end - begin).count();
+	}
+
+	void passStarted()
+	{
+		openPasses.push_back(TraceRecorder::clock::now());
+	}
+
+	void passFinished(const char* name, const Function* fn)
+	{
+		assert(!openPasses.empty());
+		auto begin = openPasses.back();
+		openPasses.pop_back();
+		if (TraceRecorder* recorder = TraceRecorder::getActive())
+		{
+			if (fn == nullptr)
+			{
+				recorder->addSpan(name, "pass", begin, TraceRecorder::clock::now());
+			}
+			else
+			{
+				recorder->addSpan(name, "pass", begin, TraceRecorder::clock::now(), *fn);
+			}
+		}
+	}
+}
+
+TraceRecorder* TraceRecorder::active = nullptr;
+
+unsigned TraceRecorder::getThreadId()
+{
+	thread_local unsigned id = nextThreadId++;
+	return id;
+}
+
+void TraceRecorder::addPass(legacy::PassManagerBase& pm, Pass* pass)
+{
+	if (active == nullptr)
+	{
+		pm.add(pass);
+		return;
+	}
+
+	// Module markers between the passes of a function pass manager would split it.
+	const char* name = pass->getPassName();
+	PassKind kind = pass->getPassKind();
+	if (kind == PT_Module || kind == PT_CallGraphSCC)
+	{
+		pm.add(new TraceModuleMarker(name, true));
+		pm.add(pass);
+		pm.add(new TraceModuleMarker(name, false));
+	}
+	else
+	{
+		pm.add(new TraceFunctionMarker(name, true));
+		pm.add(pass);
+		pm.add(new TraceFunctionMarker(name, false));
+	}
+}
+
+TraceRecorder::TraceRecorder(string outputPath)
+: outputPath(move(outputPath)), processStart(clock::now()), inPhase(false)
+{
+	assert(active == nullptr);
+	active = this;
+	getThreadId();
+}
+
+TraceRecorder::~TraceRecorder()
+{
+	if (inPhase)
+	{
+		endPhase();
+	}
+	active = nullptr;
+
+	error_code error;
+	raw_fd_ostream output(outputPath, error, sys::fs::F_Text);
+	if (error)
+	{
+		errs() << "can't open " << outputPath << " for writing: " << error.message() << '\n';
+		return;
+	}
+	printTrace(output);
+}
+
+void TraceRecorder::beginPhase(string name)
+{
+	if (inPhase)
+	{
+		endPhase();
+	}
+
+	phaseName = move(name);
+	phaseStart = clock::now();
+	inPhase = true;
+}
+
+void TraceRecorder::endPhase()
+{
+	assert(inPhase);
+	addSpan(move(phaseName), "phase", phaseStart, clock::now());
+	inPhase = false;
+}
+
+void TraceRecorder::addSpan(string name, const char* category, clock::time_point begin, clock::time_point end, uint64_t address, bool hasAddress)
+{
+	unsigned thread = getThreadId();
+	lock_guard<mutex> lock(eventsMutex);
+	events.push_back({move(name), category, begin, end, thread, address, hasAddress});
+}
+
+void TraceRecorder::addSpan(string name, const char* category, clock::time_point begin, clock::time_point end, const Function& fn)
+{
+	if (auto address = md::getVirtualAddress(fn))
+	{
+		addSpan(move(name), category, begin, end, address->getLimitedValue(), true);
+	}
+	else
+	{
+		addSpan(move(name), category, begin, end);
+	}
+}
+
+void TraceRecorder::printTrace(raw_ostream& os) const
+{
+	// Complete ("X") events, in microseconds since the recorder was created.
+	int pid = getpid();
+	os << "{\"traceEvents\": [";
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		const Event& event = events[i];
+		os << (i == 0 ? "\n" : ",\n");
+		os << "\t{\"name\": ";
+		printJsonString(os, event.name);
+		os << ", \"cat\": \"" << event.category << "\", \"ph\": \"X\"";
+		os << ", \"ts\": " << microsecondsBetween(processStart, event.begin);
+		os << ", \"dur\": " << microsecondsBetween(event.begin, event.end);
+		os << ", \"pid\": " << pid << ", \"tid\": " << event.thread;
+		if (event.hasAddress)
+		{
+			os << ", \"args\": {\"address\": \"" << format("0x%" PRIx64, event.address) << "\"}";
+		}
+		os << '}';
+	}
+	os << (events.size() == 0 ? "]" : "\n]");
+	os << ", \"displayTimeUnit\": \"ms\"}\n";
+}
+
+TraceSpan::TraceSpan(const char* name, const char* category, const Function& fn)
+: TraceSpan(name, category)
+{
+	if (TraceRecorder::getActive() != nullptr)
+	if (auto address = md::getVirtualAddress(fn))
+	{
+		this->address = address->getLimitedValue();
+		hasAddress = true;
+	}
+}
+
+char TraceModuleMarker::ID = 0;
+
+const char* TraceModuleMarker::getPassName() const
+{
+	return "Trace module marker";
+}
+
+void TraceModuleMarker::getAnalysisUsage(AnalysisUsage& au) const
+{
+	au.setPreservesAll();
+}
+
+bool TraceModuleMarker::runOnModule(Module& module)
+{
+	if (isStart)
+	{
+		passStarted();
+	}
+	else
+	{
+		passFinished(tracedPassName, nullptr);
+	}
+	return false;
+}
+
+char TraceFunctionMarker::ID = 0;
+
+const char* TraceFunctionMarker::getPassName() const
+{
+	return "Trace function marker";
+}
+
+void TraceFunctionMarker::getAnalysisUsage(AnalysisUsage& au) const
+{
+	au.setPreservesAll();
+}
+
+bool TraceFunctionMarker::runOnFunction(Function& fn)
+{
+	if (isStart)
+	{
+		passStarted();
+	}
+	else
+	{
+		passFinished(tracedPassName, &fn);
+	}
+	return false;
+}
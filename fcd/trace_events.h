@@ -0,0 +1,181 @@
+//
+// trace_events.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is part of fcd.
+//
+// fcd is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// fcd is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with fcd.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef fcd__trace_events_h
+#define fcd__trace_events_h
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Records spans of time as Chrome trace events, which are written as JSON to the output file when the object is
+// destroyed and can be opened with chrome://tracing or Perfetto. Each span has the thread that it ran on and, when it
+// is about a function, the function's virtual address.
+//
+// Spans are recorded from anywhere in the process, including worker threads, so there is at most one recorder at a
+// time and it is reachable through getActive(). When no recorder exists, TraceSpan and addPass cost a null check.
+class TraceRecorder
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+private:
+	struct Event
+	{
+		std::string name;
+		const char* category;
+		clock::time_point begin;
+		clock::time_point end;
+		unsigned thread;
+		uint64_t address;
+		bool hasAddress;
+	};
+
+	static TraceRecorder* active;
+
+	std::string outputPath;
+	clock::time_point processStart;
+	std::string phaseName;
+	clock::time_point phaseStart;
+	bool inPhase;
+
+	std::mutex eventsMutex;
+	std::vector<Event> events;
+
+	void printTrace(llvm::raw_ostream& os) const;
+
+public:
+	static TraceRecorder* getActive() { return active; }
+
+	// For forked children. Their copy of the recorder is never written, and its lock may have been held by a thread
+	// that doesn't exist in the child, so they stop recording instead.
+	static void detachFromChild() { active = nullptr; }
+
+	// Small, stable number for the calling thread. The first thread to ask is thread 0.
+	static unsigned getThreadId();
+
+	// Adds pass to pm, surrounded by markers that record a span each time that it runs. Module and call graph passes get
+	// a span each time that they run over the module; other passes get a span for each function that they run on.
+	static void addPass(llvm::legacy::PassManagerBase& pm, llvm::Pass* pass);
+
+	// The recorder becomes the active one until it is destroyed.
+	explicit TraceRecorder(std::string outputPath);
+	~TraceRecorder();
+
+	void beginPhase(std::string name);
+	void endPhase();
+
+	// Can be called from several threads. address is ignored unless hasAddress is set.
+	void addSpan(std::string name, const char* category, clock::time_point begin, clock::time_point end, uint64_t address = 0, bool hasAddress = false);
+	void addSpan(std::string name, const char* category, clock::time_point begin, clock::time_point end, const llvm::Function& fn);
+};
+
+// Records a span from construction to destruction with the active recorder, if there is one.
+class TraceSpan
+{
+	const char* name;
+	const char* category;
+	TraceRecorder::clock::time_point begin;
+	uint64_t address;
+	bool hasAddress;
+
+public:
+	TraceSpan(const char* name, const char* category)
+	: name(name), category(category), address(0), hasAddress(false)
+	{
+		if (TraceRecorder::getActive() != nullptr)
+		{
+			begin = TraceRecorder::clock::now();
+		}
+	}
+
+	TraceSpan(const char* name, const char* category, uint64_t address)
+	: TraceSpan(name, category)
+	{
+		this->address = address;
+		hasAddress = true;
+	}
+
+	// Tagged with the function's virtual address, if it has one.
+	TraceSpan(const char* name, const char* category, const llvm::Function& fn);
+
+	~TraceSpan()
+	{
+		if (TraceRecorder* recorder = TraceRecorder::getActive())
+		{
+			recorder->addSpan(name, category, begin, TraceRecorder::clock::now(), address, hasAddress);
+		}
+	}
+};
+
+class TraceModuleMarker : public llvm::ModulePass
+{
+	const char* tracedPassName;
+	bool isStart;
+
+public:
+	static char ID;
+
+	TraceModuleMarker(const char* tracedPassName, bool isStart)
+	: llvm::ModulePass(ID), tracedPassName(tracedPassName), isStart(isStart)
+	{
+	}
+
+	virtual const char* getPassName() const override;
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& au) const override;
+	virtual bool runOnModule(llvm::Module& module) override;
+};
+
+class TraceFunctionMarker : public llvm::FunctionPass
+{
+	const char* tracedPassName;
+	bool isStart;
+
+public:
+	static char ID;
+
+	TraceFunctionMarker(const char* tracedPassName, bool isStart)
+	: llvm::FunctionPass(ID), tracedPassName(tracedPassName), isStart(isStart)
+	{
+	}
+
+	virtual const char* getPassName() const override;
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& au) const override;
+	virtual bool runOnFunction(llvm::Function& fn) override;
+};
+
+namespace llvm
+{
+	template<>
+	inline Pass *callDefaultCtor<TraceModuleMarker>() { return nullptr; }
+
+	template<>
+	inline Pass *callDefaultCtor<TraceFunctionMarker>() { return nullptr; }
+}
+
+#endif /* fcd__trace_events_h */
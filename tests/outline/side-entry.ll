@@ -0,0 +1,72 @@
+; RUN: %fcd -m -m -m --outline-regions=12 %s | FileCheck %s
+;
+; The region that starts at %region and ends at %exit is dominated by its entry, but %latch, which comes after the
+; exit, branches back to %join1 in the middle of it. The region has two entries and must not be outlined.
+
+; CHECK: f(
+; CHECK-NOT: f_region
+
+define void @f(i32* %p, i32 %n) {
+start:
+  br label %region
+
+region:
+  %c0 = icmp eq i32 %n, 0
+  br i1 %c0, label %left, label %right
+
+left:
+  store i32 1, i32* %p
+  br label %left1
+
+left1:
+  store i32 2, i32* %p
+  br label %left2
+
+left2:
+  store i32 3, i32* %p
+  br label %left3
+
+left3:
+  store i32 4, i32* %p
+  br label %join1
+
+join1:
+  %v1 = load i32, i32* %p
+  %v2 = add i32 %v1, 1
+  store i32 %v2, i32* %p
+  br label %exit
+
+right:
+  store i32 5, i32* %p
+  br label %right1
+
+right1:
+  store i32 6, i32* %p
+  br label %right2
+
+right2:
+  store i32 7, i32* %p
+  br label %right3
+
+right3:
+  store i32 8, i32* %p
+  br label %join2
+
+join2:
+  %v3 = load i32, i32* %p
+  %v4 = add i32 %v3, 2
+  store i32 %v4, i32* %p
+  br label %exit
+
+exit:
+  %v5 = load i32, i32* %p
+  %c1 = icmp slt i32 %v5, 100
+  br i1 %c1, label %latch, label %done
+
+latch:
+  store i32 %v5, i32* %p
+  br label %join1
+
+done:
+  ret void
+}
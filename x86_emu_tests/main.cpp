@@ -8,9 +8,13 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <dlfcn.h>
 #include <limits>
+#include <random>
 #include <string>
 #include "x86.emulator.h"
 
@@ -19,6 +23,13 @@ using namespace std;
 #define DECLARE_TEST(name) extern "C" void x86_test_ ## name (uintptr_t*, uint16_t*, uintptr_t, uintptr_t);
 #include "x86_tests.h"
 
+// from x86_intrin_impl.cpp
+extern bool x86_trace_instructions;
+extern bool x86_profile_instructions;
+extern uint64_t x86_instruction_counts[X86_INS_ENDING];
+extern uint64_t x86_instruction_nanoseconds[X86_INS_ENDING];
+const char* x86_instruction_name(unsigned id);
+
 namespace
 {
 	enum x86_flag
@@ -50,6 +61,16 @@ namespace
 	extern "C" const char x86_native_trampoline_call_ret[];
 	extern "C" void x86_native_trampoline(uintptr_t*, uint16_t*, uintptr_t, uintptr_t, test_function, void*);
 	const x86_config config = { x86_isa64, 8, X86_REG_RIP, X86_REG_RSP, X86_REG_RBP, };
+	
+	string test_name(test_function call)
+	{
+		Dl_info info;
+		if (dladdr(reinterpret_cast<void*>(call), &info) == 1 && info.dli_sname != nullptr)
+		{
+			return info.dli_sname;
+		}
+		return "<unknown test>";
+	}
 
 	template<typename T>
 	uintptr_t as_uintptr(T* value)
@@ -98,24 +119,22 @@ struct x86_test_entry
 	uintptr_t arg2;
 	bool test_stack;
 	
-	void test() const
+	void print_call() const
 	{
-		Dl_info info;
-		if (dladdr(reinterpret_cast<void*>(call), &info) == 1)
+		printf("%s(", test_name(call).c_str());
+		if (arg1 != 0 || arg2 != 0)
 		{
-			printf("%s(", info.dli_sname);
-			if (arg1 != 0 || arg2 != 0)
+			printf("%#lx", arg1);
+			if (arg2 != 0)
 			{
-				printf("%#lx", arg1);
-				if (arg2 != 0)
-				{
-					printf(", %#lx", arg2);
-				}
+				printf(", %#lx", arg2);
 			}
-			printf(")\n");
 		}
-		
-		result emulated, native;
+		printf(")\n");
+	}
+	
+	void emulate(result& emulated) const
+	{
 		x86_regs regs = {
 			.ip = { as_uintptr(x86_native_trampoline_call_ret) },
 			.sp = { as_uintptr(end(emulated.stack)) },
@@ -124,19 +143,39 @@ struct x86_test_entry
 			.d = { arg1 },
 			.c = { arg2 },
 		};
+		x86_call_intrin(&config, &regs, as_uintptr(call));
+	}
+	
+	// Runs the test natively and through the emulator and compares the results. In quiet mode, nothing is printed
+	// unless the results are different.
+	bool run(bool verbose) const
+	{
+		if (verbose)
+		{
+			print_call();
+		}
 		
+		result emulated, native;
 		x86_native_trampoline(&native.value, &native.flags, arg1, arg2, call, end(native.stack));
-		x86_call_intrin(&config, &regs, as_uintptr(call));
+		emulate(emulated);
 		
-		if (native.value != emulated.value)
+		bool valuesMatch = native.value == emulated.value;
+		bool flagsMatch = ((native.flags ^ emulated.flags) & relevant_flags) == 0;
+		bool stackMatch = !test_stack || memcmp(emulated.stack, native.stack, sizeof emulated.stack) == 0;
+		bool passed = valuesMatch && flagsMatch && stackMatch;
+		if (!passed && !verbose)
+		{
+			print_call();
+		}
+		
+		if (!valuesMatch)
 		{
 			printf("Result values are different\n");
 			printf("Native:   %#lx\n", native.value);
 			printf("Emulated: %#lx\n", emulated.value);
-			abort();
 		}
 		
-		if (native.flags != emulated.flags)
+		if (native.flags != emulated.flags && (verbose || !flagsMatch))
 		{
 			uint16_t relevant_native = native.flags & relevant_flags;
 			uint16_t relevant_emulated = emulated.flags & relevant_flags;
@@ -144,23 +183,24 @@ struct x86_test_entry
 			printf("Result flags are different (mask = %s)\n", flag_string(relevant_flags).c_str());
 			printf("Native:   %s => %s\n", flag_string(native.flags).c_str(), flag_string(relevant_native).c_str());
 			printf("Emulated: %s => %s\n", flag_string(emulated.flags).c_str(), flag_string(relevant_emulated).c_str());
-			if (relevant_emulated != relevant_native)
-			{
-				abort();
-			}
 		}
 		
-		if (test_stack)
+		if (!stackMatch)
 		{
-			if (memcmp(emulated.stack, native.stack, sizeof emulated.stack) != 0)
-			{
-				printf("Stack leftovers are different\n");
-				printf("Native:   %s\n", native.dump_stack().c_str());
-				printf("Emulated: %s\n", emulated.dump_stack().c_str());
-				abort();
-			}
+			printf("Stack leftovers are different\n");
+			printf("Native:   %s\n", native.dump_stack().c_str());
+			printf("Emulated: %s\n", emulated.dump_stack().c_str());
 		}
 		
+		return passed;
+	}
+	
+	void test() const
+	{
+		if (!run(true))
+		{
+			abort();
+		}
 		puts("");
 	}
 };
@@ -420,9 +460,227 @@ const x86_test_entry tests[] = {
 	{ &x86_test_xor, OF|SF|ZF|CF|PF, 0x8000000000000000, 0x8000000000000000 },
 };
 
+// Tests that can run with arbitrary operands, along with the flags that are defined for every operand value. Shift
+// and rotate tests take their count in arg2; OF is only defined for counts of 1 and AF isn't defined at all, so they
+// are checked separately.
+struct x86_fuzz_entry
+{
+	test_function call;
+	uint16_t relevant_flags;
+	bool shift;
+};
+
+const x86_fuzz_entry fuzz_tests[] = {
+	{ &x86_test_adc32, OF|SF|ZF|AF|CF|PF },
+	{ &x86_test_adc64, OF|SF|ZF|AF|CF|PF },
+	{ &x86_test_and32, OF|SF|ZF|CF|PF },
+	{ &x86_test_and64, OF|SF|ZF|CF|PF },
+	{ &x86_test_bt, CF },
+	{ &x86_test_cmov, 0 },
+	{ &x86_test_cmp, OF|SF|ZF|AF|CF|PF },
+	{ &x86_test_dec, OF|SF|ZF|AF|CF|PF },
+	{ &x86_test_imul32, CF|OF },
+	{ &x86_test_imul64, CF|OF },
+	{ &x86_test_imul128, CF|OF },
+	{ &x86_test_inc, OF|SF|ZF|AF|PF },
+	{ &x86_test_mul32, CF|OF },
+	{ &x86_test_mul64, CF|OF },
+	{ &x86_test_mul128, CF|OF },
+	{ &x86_test_neg, OF|SF|ZF|AF|CF|PF },
+	{ &x86_test_not, 0 },
+	{ &x86_test_or, OF|SF|ZF|CF|PF },
+	{ &x86_test_rol, SF|ZF|CF|PF, true },
+	{ &x86_test_ror, SF|ZF|CF|PF, true },
+	{ &x86_test_sar, SF|ZF|CF|PF, true },
+	{ &x86_test_sbb32, OF|SF|ZF|AF|CF|PF },
+	{ &x86_test_sbb64, OF|SF|ZF|AF|CF|PF },
+	{ &x86_test_seta, 0 },
+	{ &x86_test_setae, 0 },
+	{ &x86_test_setb, 0 },
+	{ &x86_test_setbe, 0 },
+	{ &x86_test_sete, 0 },
+	{ &x86_test_setg, 0 },
+	{ &x86_test_setge, 0 },
+	{ &x86_test_setl, 0 },
+	{ &x86_test_setle, 0 },
+	{ &x86_test_setne, 0 },
+	{ &x86_test_setno, 0 },
+	{ &x86_test_setnp, 0 },
+	{ &x86_test_setns, 0 },
+	{ &x86_test_seto, 0 },
+	{ &x86_test_setp, 0 },
+	{ &x86_test_sets, 0 },
+	{ &x86_test_shl, SF|ZF|CF|PF, true },
+	{ &x86_test_shr, SF|ZF|CF|PF, true },
+	{ &x86_test_sub32, OF|SF|ZF|AF|CF|PF },
+	{ &x86_test_sub64, OF|SF|ZF|AF|CF|PF },
+	{ &x86_test_test, OF|SF|ZF|CF|PF },
+	{ &x86_test_xor, OF|SF|ZF|CF|PF },
+};
+
+namespace
+{
+	// Uniformly random operands almost never hit the carry, overflow and zero edge cases, so half of them are picked
+	// around values where those flags change.
+	uintptr_t random_operand(mt19937_64& random)
+	{
+		static const uintptr_t edges[] = {
+			0, 1, 0x7f, 0x80, 0xff, 0x7fff, 0x8000, 0xffff, 0x7fffffff, 0x80000000, 0xffffffff,
+			0x7fffffffffffffff, 0x8000000000000000, ~uintptr_t(0),
+		};
+		
+		switch (random() % 4)
+		{
+			case 0: return edges[random() % (sizeof edges / sizeof edges[0])];
+			case 1: return edges[random() % (sizeof edges / sizeof edges[0])] + (random() % 5) - 2;
+			case 2: return static_cast<uint32_t>(random());
+			default: return random();
+		}
+	}
+	
+	void fuzz(size_t iterations, uint64_t seed)
+	{
+		printf("fuzzing %zu iterations per test with seed %llu\n", iterations, static_cast<unsigned long long>(seed));
+		mt19937_64 random(seed);
+		for (const auto& entry : fuzz_tests)
+		{
+			for (size_t i = 0; i < iterations; i++)
+			{
+				x86_test_entry test = { entry.call, entry.relevant_flags, random_operand(random), random_operand(random) };
+				if (entry.shift)
+				{
+					test.arg2 = random() % 128;
+					if ((test.arg2 & 0x3f) == 1)
+					{
+						test.relevant_flags |= OF;
+					}
+				}
+				
+				if (!test.run(false))
+				{
+					printf("failed on iteration %zu (seed %llu)\n", i, static_cast<unsigned long long>(seed));
+					abort();
+				}
+			}
+			printf("%-28s ok\n", test_name(entry.call).c_str());
+		}
+	}
+	
+	// Measures how fast the emulator runs each test routine, then how much time is spent in each emulator function.
+	// This runs natively compiled instruction implementations; it doesn't account for the work that the optimizer has
+	// to do with them once they are lifted to IR.
+	void benchmark(size_t iterations)
+	{
+		typedef chrono::duration<double> seconds;
+		
+		x86_profile_instructions = true;
+		fill(begin(x86_instruction_counts), end(x86_instruction_counts), 0);
+		fill(begin(x86_instruction_nanoseconds), end(x86_instruction_nanoseconds), 0);
+		
+		printf("%-32s %12s %16s\n", "test", "runs/s", "instructions/s");
+		test_function last = nullptr;
+		for (const auto& test : tests)
+		{
+			if (test.call == last)
+			{
+				continue;
+			}
+			last = test.call;
+			
+			uint64_t instructionsBefore = 0;
+			for (uint64_t count : x86_instruction_counts)
+			{
+				instructionsBefore += count;
+			}
+			
+			auto start = chrono::steady_clock::now();
+			for (size_t i = 0; i < iterations; i++)
+			{
+				x86_test_entry::result emulated;
+				test.emulate(emulated);
+			}
+			double elapsed = chrono::duration_cast<seconds>(chrono::steady_clock::now() - start).count();
+			
+			uint64_t instructions = 0;
+			for (uint64_t count : x86_instruction_counts)
+			{
+				instructions += count;
+			}
+			instructions -= instructionsBefore;
+			printf("%-32s %12.0f %16.0f\n", test_name(test.call).c_str(), iterations / elapsed, instructions / elapsed);
+		}
+		
+		// Take out what it costs to read the clock twice from each timed instruction.
+		const size_t calibrationRuns = 100000;
+		auto calibrationStart = chrono::steady_clock::now();
+		for (size_t i = 0; i < calibrationRuns; i++)
+		{
+			chrono::steady_clock::now();
+		}
+		double clockCost = chrono::duration_cast<chrono::duration<double, nano>>(chrono::steady_clock::now() - calibrationStart).count() / calibrationRuns;
+		
+		printf("\n%-32s %12s %16s\n", "instruction", "executions", "ns/execution");
+		for (unsigned i = 0; i < X86_INS_ENDING; i++)
+		{
+			if (uint64_t count = x86_instruction_counts[i])
+			{
+				double average = max(0.0, double(x86_instruction_nanoseconds[i]) / count - clockCost);
+				printf("%-32s %12llu %16.2f\n", x86_instruction_name(i), static_cast<unsigned long long>(count), average);
+			}
+		}
+		x86_profile_instructions = false;
+	}
+	
+	size_t option_value(const char* arg, size_t defaultValue)
+	{
+		const char* equals = strchr(arg, '=');
+		return equals == nullptr ? defaultValue : strtoull(equals + 1, nullptr, 0);
+	}
+}
+
+// Without arguments, runs the fixed test cases. --fuzz[=N] compares the emulator against native execution for N random
+// operand pairs per instruction test (--seed=S to reproduce a run), and --bench[=N] measures emulator throughput.
 int main(int argc, const char * argv[]) {
-	for (const auto& test : tests)
+	size_t fuzzIterations = 0;
+	size_t benchIterations = 0;
+	uint64_t seed = random_device()();
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--fuzz", 6) == 0)
+		{
+			fuzzIterations = option_value(argv[i], 10000);
+		}
+		else if (strncmp(argv[i], "--bench", 7) == 0)
+		{
+			benchIterations = option_value(argv[i], 10000);
+		}
+		else if (strncmp(argv[i], "--seed", 6) == 0)
+		{
+			seed = option_value(argv[i], seed);
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--fuzz[=N]] [--bench[=N]] [--seed=S]\n", argv[0]);
+			return 1;
+		}
+	}
+	
+	if (fuzzIterations == 0 && benchIterations == 0)
+	{
+		for (const auto& test : tests)
+		{
+			test.test();
+		}
+		return 0;
+	}
+	
+	x86_trace_instructions = false;
+	if (fuzzIterations != 0)
+	{
+		fuzz(fuzzIterations, seed);
+	}
+	if (benchIterations != 0)
 	{
-		test.test();
+		benchmark(benchIterations);
 	}
 }
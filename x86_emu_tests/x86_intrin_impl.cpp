@@ -8,6 +8,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <csetjmp>
 #include <dlfcn.h>
 #include <iostream>
@@ -67,6 +68,19 @@ namespace
 
 extern const char x86_test_epilogue[];
 
+// Knobs for the test driver. When profiling is enabled, the time spent in each emulator function is accumulated per
+// instruction. Instructions that transfer control (jumps, returns) are counted but not timed since they leave through
+// longjmp, and call times include the time spent emulating the callee.
+bool x86_trace_instructions = true;
+bool x86_profile_instructions = false;
+uint64_t x86_instruction_counts[X86_INS_ENDING];
+uint64_t x86_instruction_nanoseconds[X86_INS_ENDING];
+
+const char* x86_instruction_name(unsigned id)
+{
+	return id < X86_INS_ENDING ? emulator_func_names[id] : "";
+}
+
 // Ignore segments.
 extern "C" void x86_write_mem(x86_reg, uint64_t address, size_t size, uint64_t value)
 {
@@ -95,19 +109,20 @@ extern "C" uint64_t x86_read_mem(x86_reg, uint64_t address, size_t size)
 extern "C" void x86_call_intrin(CPTR(x86_config) config, PTR(x86_regs) regs, uint64_t target)
 {
 	cs_mode size;
-	uint64_t return_to = regs->ip.qword;
+	uint64_t return_to = regs->ip;
 	if (config->address_size == 4)
 	{
-		regs->sp.low.dword -= 4;
-		write_at<uint32_t>(regs->sp.low.dword, regs->ip.low.dword);
-		regs->ip.qword = static_cast<uint32_t>(target);
+		// Like the emulator, 32-bit writes zero the upper half of the register.
+		regs->sp = static_cast<uint32_t>(regs->sp - 4);
+		write_at<uint32_t>(regs->sp, static_cast<uint32_t>(regs->ip));
+		regs->ip = static_cast<uint32_t>(target);
 		size = CS_MODE_32;
 	}
 	else if (config->address_size == 8)
 	{
-		regs->sp.qword -= 8;
-		write_at<uint64_t>(regs->sp.qword, regs->ip.qword);
-		regs->ip.qword = target;
+		regs->sp -= 8;
+		write_at<uint64_t>(regs->sp, regs->ip);
+		regs->ip = target;
 		size = CS_MODE_64;
 	}
 	else
@@ -133,12 +148,12 @@ extern "C" void x86_call_intrin(CPTR(x86_config) config, PTR(x86_regs) regs, uin
 		abort();
 	}
 	
-	bool print = true;
+	bool print = x86_trace_instructions;
 	while (true)
 	{
-		auto code_begin = reinterpret_cast<const uint8_t*>(regs->ip.qword);
+		auto code_begin = reinterpret_cast<const uint8_t*>(regs->ip);
 		auto code_end = reinterpret_cast<const uint8_t*>(UINTPTR_MAX);
-		auto iter = cs->begin(code_begin, code_end, regs->ip.qword);
+		auto iter = cs->begin(code_begin, code_end, regs->ip);
 		
 		int cause = setjmp(jump_to);
 		if (cause == 0)
@@ -151,10 +166,21 @@ extern "C" void x86_call_intrin(CPTR(x86_config) config, PTR(x86_regs) regs, uin
 					printf("%llx %6s %s\n", iter->address, iter->mnemonic, iter->op_str);
 				}
 				
-				regs->ip.qword = iter.next_address();
+				regs->ip = iter.next_address();
 				if (x86_impl implementation = get_emulator_impl(static_cast<x86_insn>(iter->id)))
 				{
-					implementation(config, &iter->detail->x86, regs, &flags);
+					x86_instruction_counts[iter->id]++;
+					if (x86_profile_instructions)
+					{
+						auto start = chrono::steady_clock::now();
+						implementation(config, &iter->detail->x86, regs, &flags);
+						auto elapsed = chrono::steady_clock::now() - start;
+						x86_instruction_nanoseconds[iter->id] += chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+					}
+					else
+					{
+						implementation(config, &iter->detail->x86, regs, &flags);
+					}
 				}
 				else
 				{
@@ -166,7 +192,7 @@ extern "C" void x86_call_intrin(CPTR(x86_config) config, PTR(x86_regs) regs, uin
 		else if (cause == 1)
 		{
 			// return
-			assert(regs->ip.qword == return_to);
+			assert(regs->ip == return_to);
 			break;
 		}
 		else if (cause == 2)
@@ -189,7 +215,7 @@ NORETURN extern "C" void x86_ret_intrin(CPTR(x86_config), PTR(x86_regs))
 
 NORETURN extern "C" void x86_jump_intrin(CPTR(x86_config), PTR(x86_regs) regs, uint64_t destination)
 {
-	regs->ip.qword = destination;
+	regs->ip = destination;
 	longjmp(jump_to, 2);
 }
 